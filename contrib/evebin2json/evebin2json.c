@@ -0,0 +1,554 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Convert eve-log files written with "format: msgpack" back to the
+ * eve.json lines Suricata would have written. See src/util-msgpack.h
+ * for the file format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <jansson.h>
+
+#define FORMAT_NAME     "eve-msgpack"
+#define FORMAT_VERSION  1
+
+#define FRAME_HEADER    'H'
+#define FRAME_STRINGS   'S'
+#define FRAME_EVENT     'E'
+#define FRAME_HDR_LEN   5
+/** sanity limit, records are far smaller */
+#define FRAME_MAX_LEN   (256 * 1024 * 1024)
+
+#define EXT_STRING      1
+#define EXT_TIME        2
+
+#define MAX_DEPTH       128
+
+typedef struct String_ {
+    char *str;
+    uint32_t len;
+} String;
+
+typedef struct Reader_ {
+    const char *name;
+    /* from the header frame */
+    bool header;
+    size_t json_flags;
+    char *prefix;
+    /* string table, reset by each header */
+    String *strings;
+    uint32_t count;
+    uint32_t size;
+
+    uint64_t events;
+} Reader;
+
+/** cursor into a frame */
+typedef struct Cursor_ {
+    const uint8_t *p;
+    const uint8_t *end;
+} Cursor;
+
+static uint64_t GetBE(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static bool Need(const Cursor *c, size_t len)
+{
+    return (size_t)(c->end - c->p) >= len;
+}
+
+/* days since 1970-01-01 to a date in the proleptic gregorian calendar */
+static void CivilFromDays(int64_t z, int64_t *y, unsigned *m, unsigned *d)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+/** \brief format a time ext value like Suricata's CreateIsoTimeString() */
+static json_t *FormatTime(int64_t usec, int16_t offset)
+{
+    if (offset <= -24 * 60 || offset >= 24 * 60)
+        return NULL;
+
+    int64_t secs = usec / 1000000;
+    int64_t us = usec % 1000000;
+    if (us < 0) {
+        us += 1000000;
+        secs--;
+    }
+    secs += offset * 60;
+    int64_t days = secs / 86400;
+    int64_t rem = secs % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        days--;
+    }
+
+    int64_t y;
+    unsigned m, d;
+    CivilFromDays(days, &y, &m, &d);
+    if (y < 0 || y > 9999)
+        return NULL;
+
+    char str[64];
+    int absoff = offset < 0 ? -offset : offset;
+    snprintf(str, sizeof(str), "%04d-%02u-%02uT%02d:%02d:%02d.%06d%c%02d%02d",
+            (int)y, m, d, (int)(rem / 3600), (int)(rem / 60 % 60),
+            (int)(rem % 60), (int)us, offset < 0 ? '-' : '+', absoff / 60,
+            absoff % 60);
+    return json_string(str);
+}
+
+/** \brief copy a msgpack string, jansson wants it nul terminated */
+static char *CopyStr(const uint8_t *p, size_t len)
+{
+    char *s = malloc(len + 1);
+    if (s == NULL)
+        return NULL;
+    memcpy(s, p, len);
+    s[len] = '\0';
+    return s;
+}
+
+/**
+ * \brief decode the next value of the frame
+ *
+ * \param key set instead of returning a value if the value is a string,
+ *        for map keys. Must be freed by the caller.
+ */
+static json_t *Decode(Reader *r, Cursor *c, int depth, char **key)
+{
+    if (depth > MAX_DEPTH || !Need(c, 1))
+        return NULL;
+
+    const uint8_t t = *c->p++;
+    size_t len = 0;
+    bool array = false;
+    int64_t count = -1;
+    const uint8_t *str = NULL;
+
+    if (t <= 0x7f)
+        return json_integer(t);
+    if (t >= 0xe0)
+        return json_integer((int8_t)t);
+    if ((t & 0xf0) == 0x80) {
+        count = t & 0x0f;
+    } else if ((t & 0xf0) == 0x90) {
+        count = t & 0x0f;
+        array = true;
+    } else if ((t & 0xe0) == 0xa0) {
+        len = t & 0x1f;
+        str = c->p;
+    } else {
+        switch (t) {
+            case 0xc0:
+                return json_null();
+            case 0xc2:
+                return json_false();
+            case 0xc3:
+                return json_true();
+            case 0xcb: {
+                if (!Need(c, 8))
+                    return NULL;
+                uint64_t bits = GetBE(c->p, 8);
+                double val;
+                memcpy(&val, &bits, sizeof(val));
+                c->p += 8;
+                return json_real(val);
+            }
+            case 0xcc: case 0xcd: case 0xce: case 0xcf: {
+                int n = 1 << (t - 0xcc);
+                if (!Need(c, n))
+                    return NULL;
+                uint64_t v = GetBE(c->p, n);
+                c->p += n;
+                return json_integer((json_int_t)v);
+            }
+            case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+                int n = 1 << (t - 0xd0);
+                if (!Need(c, n))
+                    return NULL;
+                uint64_t v = GetBE(c->p, n);
+                c->p += n;
+                /* sign extend */
+                if (n < 8 && (v & (1ULL << (n * 8 - 1))))
+                    v |= ~0ULL << (n * 8);
+                return json_integer((json_int_t)(int64_t)v);
+            }
+            case 0xd9: case 0xda: case 0xdb: {
+                int n = 1 << (t - 0xd9);
+                if (!Need(c, n))
+                    return NULL;
+                len = GetBE(c->p, n);
+                c->p += n;
+                str = c->p;
+                break;
+            }
+            case 0xdc: case 0xdd: case 0xde: case 0xdf: {
+                int n = (t == 0xdc || t == 0xde) ? 2 : 4;
+                if (!Need(c, n))
+                    return NULL;
+                count = GetBE(c->p, n);
+                c->p += n;
+                array = (t == 0xdc || t == 0xdd);
+                break;
+            }
+            case 0xd5: case 0xd6: {
+                /* fixext 2 and 4: string reference */
+                int n = (t == 0xd5) ? 2 : 4;
+                if (!Need(c, 1 + n) || c->p[0] != EXT_STRING)
+                    return NULL;
+                uint32_t id = GetBE(c->p + 1, n);
+                c->p += 1 + n;
+                if (id >= r->count)
+                    return NULL;
+                if (key != NULL) {
+                    *key = CopyStr((const uint8_t *)r->strings[id].str,
+                            r->strings[id].len);
+                    return json_null();
+                }
+                return json_string(r->strings[id].str);
+            }
+            case 0xc7: {
+                /* ext 8: time */
+                if (!Need(c, 2 + 10) || c->p[0] != 10 || c->p[1] != EXT_TIME)
+                    return NULL;
+                int64_t usec = (int64_t)GetBE(c->p + 2, 8);
+                int16_t offset = (int16_t)GetBE(c->p + 10, 2);
+                c->p += 12;
+                return FormatTime(usec, offset);
+            }
+            default:
+                return NULL;
+        }
+    }
+
+    if (str != NULL) {
+        if (!Need(c, len))
+            return NULL;
+        c->p += len;
+        char *s = CopyStr(str, len);
+        if (s == NULL)
+            return NULL;
+        if (key != NULL) {
+            *key = s;
+            return json_null();
+        }
+        json_t *js = json_string(s);
+        free(s);
+        return js;
+    }
+
+    json_t *js = array ? json_array() : json_object();
+    if (js == NULL)
+        return NULL;
+    for (int64_t i = 0; i < count; i++) {
+        if (array) {
+            json_t *v = Decode(r, c, depth + 1, NULL);
+            if (v == NULL || json_array_append_new(js, v) != 0)
+                goto error;
+        } else {
+            char *k = NULL;
+            json_t *kv = Decode(r, c, depth + 1, &k);
+            json_decref(kv);
+            if (k == NULL)
+                goto error;
+            json_t *v = Decode(r, c, depth + 1, NULL);
+            int ret = (v != NULL) ? json_object_set_new(js, k, v) : -1;
+            free(k);
+            if (ret != 0)
+                goto error;
+        }
+    }
+    return js;
+error:
+    json_decref(js);
+    return NULL;
+}
+
+static void ResetStrings(Reader *r)
+{
+    for (uint32_t i = 0; i < r->count; i++)
+        free(r->strings[i].str);
+    r->count = 0;
+}
+
+static int HandleHeader(Reader *r, Cursor *c)
+{
+    json_t *js = Decode(r, c, 0, NULL);
+    if (!json_is_object(js))
+        goto error;
+
+    const char *format = json_string_value(json_object_get(js, "format"));
+    json_t *version = json_object_get(js, "version");
+    json_t *flags = json_object_get(js, "json-flags");
+    if (format == NULL || strcmp(format, FORMAT_NAME) != 0 ||
+            !json_is_integer(version) || !json_is_integer(flags)) {
+        fprintf(stderr, "%s: not an eve msgpack file\n", r->name);
+        goto error;
+    }
+    if (json_integer_value(version) != FORMAT_VERSION) {
+        fprintf(stderr, "%s: unsupported version %lld\n",
+                r->name, (long long)json_integer_value(version));
+        goto error;
+    }
+
+    free(r->prefix);
+    r->prefix = NULL;
+    const char *prefix = json_string_value(json_object_get(js, "prefix"));
+    if (prefix != NULL && (r->prefix = strdup(prefix)) == NULL)
+        goto error;
+    r->json_flags = (size_t)json_integer_value(flags);
+    r->header = true;
+    ResetStrings(r);
+    json_decref(js);
+    return 0;
+error:
+    json_decref(js);
+    return -1;
+}
+
+static int HandleStrings(Reader *r, Cursor *c)
+{
+    if (!Need(c, 1))
+        return -1;
+    const uint8_t t = *c->p++;
+    uint64_t n;
+    if ((t & 0xf0) == 0x90) {
+        n = t & 0x0f;
+    } else if (t == 0xdc && Need(c, 2)) {
+        n = GetBE(c->p, 2);
+        c->p += 2;
+    } else if (t == 0xdd && Need(c, 4)) {
+        n = GetBE(c->p, 4);
+        c->p += 4;
+    } else {
+        return -1;
+    }
+    if (n == 0)
+        return -1;
+
+    json_t *first = Decode(r, c, 0, NULL);
+    if (!json_is_integer(first) ||
+            json_integer_value(first) != (json_int_t)r->count) {
+        json_decref(first);
+        return -1;
+    }
+    json_decref(first);
+
+    for (uint64_t i = 1; i < n; i++) {
+        char *s = NULL;
+        json_t *js = Decode(r, c, 0, &s);
+        json_decref(js);
+        if (s == NULL)
+            return -1;
+        if (r->count == r->size) {
+            uint32_t size = r->size ? r->size * 2 : 256;
+            String *strings = realloc(r->strings, size * sizeof(*strings));
+            if (strings == NULL) {
+                free(s);
+                return -1;
+            }
+            r->strings = strings;
+            r->size = size;
+        }
+        r->strings[r->count].str = s;
+        r->strings[r->count].len = strlen(s);
+        r->count++;
+    }
+    return 0;
+}
+
+static int HandleEvent(Reader *r, Cursor *c, FILE *out)
+{
+    if (!r->header)
+        return -1;
+    json_t *js = Decode(r, c, 0, NULL);
+    if (!json_is_object(js)) {
+        json_decref(js);
+        return -1;
+    }
+    char *str = json_dumps(js, r->json_flags);
+    json_decref(js);
+    if (str == NULL)
+        return -1;
+    if (r->prefix != NULL)
+        fputs(r->prefix, out);
+    fputs(str, out);
+    fputc('\n', out);
+    free(str);
+    r->events++;
+    return 0;
+}
+
+static int Convert(Reader *r, FILE *in, FILE *out)
+{
+    uint8_t hdr[FRAME_HDR_LEN];
+    uint8_t *frame = NULL;
+    size_t frame_size = 0;
+    uint64_t offset = 0;
+    int ret = -1;
+
+    for (;;) {
+        size_t n = fread(hdr, 1, sizeof(hdr), in);
+        if (n == 0 && feof(in)) {
+            ret = 0;
+            break;
+        }
+        if (n != sizeof(hdr)) {
+            fprintf(stderr, "%s: truncated frame at offset %"PRIu64"\n",
+                    r->name, offset);
+            break;
+        }
+
+        uint32_t len = GetBE(hdr, 4);
+        if (len > FRAME_MAX_LEN) {
+            fprintf(stderr, "%s: bad frame length at offset %"PRIu64"\n",
+                    r->name, offset);
+            break;
+        }
+        if (len > frame_size) {
+            uint8_t *tmp = realloc(frame, len);
+            if (tmp == NULL) {
+                fprintf(stderr, "%s: out of memory\n", r->name);
+                break;
+            }
+            frame = tmp;
+            frame_size = len;
+        }
+        if (fread(frame, 1, len, in) != len) {
+            fprintf(stderr, "%s: truncated frame at offset %"PRIu64"\n",
+                    r->name, offset);
+            break;
+        }
+
+        Cursor c = { frame, frame + len };
+        int r2;
+        switch (hdr[4]) {
+            case FRAME_HEADER:
+                r2 = HandleHeader(r, &c);
+                break;
+            case FRAME_STRINGS:
+                r2 = HandleStrings(r, &c);
+                break;
+            case FRAME_EVENT:
+                r2 = HandleEvent(r, &c, out);
+                break;
+            default:
+                /* unknown frames are skipped */
+                r2 = 0;
+                c.p = c.end;
+                break;
+        }
+        if (r2 != 0 || c.p != c.end) {
+            fprintf(stderr, "%s: invalid '%c' frame at offset %"PRIu64"\n",
+                    r->name, hdr[4], offset);
+            break;
+        }
+        offset += FRAME_HDR_LEN + len;
+    }
+
+    free(frame);
+    return ret;
+}
+
+static void Usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-q] [file ...]\n\n"
+            "Convert eve-log msgpack files to eve.json lines on stdout.\n"
+            "Reads stdin if no file or \"-\" is given, so compressed\n"
+            "files can be piped in, e.g.:\n\n"
+            "    zstd -dc eve.msgpack.zst | %s\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    bool quiet = false;
+    int first = 1;
+    int ret = EXIT_SUCCESS;
+
+    for (; first < argc && argv[first][0] == '-' && argv[first][1] != '\0';
+            first++) {
+        if (strcmp(argv[first], "-q") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[first], "--") == 0) {
+            first++;
+            break;
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int nfiles = argc - first;
+    for (int i = 0; i < (nfiles ? nfiles : 1); i++) {
+        const char *name = nfiles ? argv[first + i] : "-";
+        Reader r;
+        memset(&r, 0, sizeof(r));
+        FILE *in = stdin;
+
+        if (strcmp(name, "-") == 0) {
+            r.name = "stdin";
+        } else {
+            r.name = name;
+            in = fopen(name, "rb");
+            if (in == NULL) {
+                fprintf(stderr, "%s: %s\n", name, strerror(errno));
+                ret = EXIT_FAILURE;
+                continue;
+            }
+        }
+
+        if (Convert(&r, in, stdout) != 0)
+            ret = EXIT_FAILURE;
+        if (!quiet) {
+            fprintf(stderr, "%s: %"PRIu64" events, %"PRIu32" strings\n",
+                    r.name, r.events, r.count);
+        }
+
+        if (in != stdin)
+            fclose(in);
+        ResetStrings(&r);
+        free(r.strings);
+        free(r.prefix);
+    }
+
+    if (fflush(stdout) != 0)
+        ret = EXIT_FAILURE;
+    return ret;
+}
@@ -690,6 +690,23 @@ error:
     return -1;
 }
 
+/**
+ *  \brief mark the txs libhtp is working on as log ready
+ *
+ *  Together with the request and response complete callbacks this
+ *  covers every tx whose progress changes during a htp_connp_*_data()
+ *  call.
+ */
+static void HTPMarkTxLogReady(HtpState *hstate, AppLayerParserState *pstate)
+{
+    htp_tx_t *tx = htp_connp_get_in_tx(hstate->connp);
+    if (tx != NULL)
+        AppLayerParserTxLogReady(pstate, tx->index);
+    tx = htp_connp_get_out_tx(hstate->connp);
+    if (tx != NULL)
+        AppLayerParserTxLogReady(pstate, tx->index);
+}
+
 /**
  *  \brief  Function to handle the reassembled data from client and feed it to
  *          the HTP library to process it.
@@ -726,6 +743,7 @@ static int HTPHandleRequestData(Flow *f, void *htp_state,
     htp_time_t ts = { f->lastts.tv_sec, f->lastts.tv_usec };
     /* pass the new data to the htp parser */
     if (input_len > 0) {
+        HTPMarkTxLogReady(hstate, pstate);
         const int r = htp_connp_req_data(hstate->connp, &ts, input, input_len);
         switch (r) {
             case HTP_STREAM_ERROR:
@@ -735,6 +753,7 @@ static int HTPHandleRequestData(Flow *f, void *htp_state,
                 break;
         }
         HTPHandleError(hstate);
+        HTPMarkTxLogReady(hstate, pstate);
     }
 
     /* if the TCP connection is closed, then close the HTTP connection */
@@ -788,6 +807,7 @@ static int HTPHandleResponseData(Flow *f, void *htp_state,
 
     htp_time_t ts = { f->lastts.tv_sec, f->lastts.tv_usec };
     if (input_len > 0) {
+        HTPMarkTxLogReady(hstate, pstate);
         const int r = htp_connp_res_data(hstate->connp, &ts, input, input_len);
         switch (r) {
             case HTP_STREAM_ERROR:
@@ -797,6 +817,7 @@ static int HTPHandleResponseData(Flow *f, void *htp_state,
                 break;
         }
         HTPHandleError(hstate);
+        HTPMarkTxLogReady(hstate, pstate);
     }
 
     /* if we the TCP connection is closed, then close the HTTP connection */
@@ -1909,6 +1930,7 @@ static int HTPCallbackRequest(htp_tx_t *tx)
                hstate->transaction_cnt, HTPStateGetTxCnt(hstate));
 
     SCLogDebug("HTTP request completed");
+    AppLayerParserTxLogReady(hstate->f->alparser, tx->index);
 
     HTPErrorCheckTxRequestFlags(hstate, tx);
 
@@ -1944,6 +1966,7 @@ static int HTPCallbackResponse(htp_tx_t *tx)
 
     /* we have one whole transaction now */
     hstate->transaction_cnt++;
+    AppLayerParserTxLogReady(hstate->f->alparser, tx->index);
 
     HtpTxUserData *htud = (HtpTxUserData *) htp_tx_get_user_data(tx);
     if (htud != NULL) {
@@ -2855,6 +2878,8 @@ void RegisterHTPParsers(void)
         AppLayerParserRegisterGetEventInfo(IPPROTO_TCP, ALPROTO_HTTP, HTPStateGetEventInfo);
 
         AppLayerParserRegisterTruncateFunc(IPPROTO_TCP, ALPROTO_HTTP, HTPStateTruncate);
+        AppLayerParserRegisterOptionFlags(IPPROTO_TCP, ALPROTO_HTTP,
+                APP_LAYER_PARSER_OPT_LOG_READY);
         AppLayerParserRegisterDetectStateFuncs(IPPROTO_TCP, ALPROTO_HTTP,
                                                HTPGetTxDetectState, HTPSetTxDetectState);
         AppLayerParserRegisterDetectFlagsFuncs(IPPROTO_TCP, ALPROTO_HTTP,
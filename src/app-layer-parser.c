@@ -155,6 +155,22 @@ struct AppLayerParserState_ {
 
     uint64_t min_id;
 
+    /* Bumped each time the parser is invoked for this flow, in either
+     * direction. Detection compares it against detect_data_version to
+     * find out whether the txs may have changed since its last run. */
+    uint64_t data_version;
+    /* data_version at the time of the last tx inspection, per direction. */
+    uint64_t detect_data_version[2];
+    /* data_version and disruption flags at the time of the last tx
+     * logger run. */
+    uint64_t log_data_version;
+    uint8_t log_disrupt_flags[2];
+
+    /* txs marked log ready by the parser since the last logger run,
+     * sorted. Set to UINT8_MAX when more than fit were marked. */
+    uint8_t log_ready_cnt;
+    uint64_t log_ready[APP_LAYER_PARSER_LOG_READY_MAX];
+
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
 };
@@ -795,6 +811,115 @@ void AppLayerParserSetTransactionInspectId(const Flow *f, AppLayerParserState *p
     SCReturn;
 }
 
+uint64_t AppLayerParserGetDataVersion(const AppLayerParserState *pstate)
+{
+    if (pstate == NULL)
+        return 0;
+    return pstate->data_version;
+}
+
+uint64_t AppLayerParserGetDetectDataVersion(const AppLayerParserState *pstate,
+                                            uint8_t direction)
+{
+    if (pstate == NULL)
+        return 0;
+    return pstate->detect_data_version[direction & STREAM_TOSERVER ? 0 : 1];
+}
+
+void AppLayerParserSetDetectDataVersion(AppLayerParserState *pstate,
+                                        uint8_t direction, uint64_t version)
+{
+    if (pstate == NULL)
+        return;
+    pstate->detect_data_version[direction & STREAM_TOSERVER ? 0 : 1] = version;
+}
+
+/** \brief forget what detection has seen, so that the next run inspects
+ *         all txs again. Used on detect engine reload. */
+void AppLayerParserResetDetectDataVersion(AppLayerParserState *pstate)
+{
+    if (pstate == NULL)
+        return;
+    pstate->detect_data_version[0] = 0;
+    pstate->detect_data_version[1] = 0;
+}
+
+uint64_t AppLayerParserGetLogDataVersion(const AppLayerParserState *pstate)
+{
+    if (pstate == NULL)
+        return 0;
+    return pstate->log_data_version;
+}
+
+/** \brief check if the stream disruption flags (depth reached, gap)
+ *         changed since the last tx logger run. Such a change can make
+ *         txs loggable without any new data. */
+bool AppLayerParserLogDisruptionChanged(const AppLayerParserState *pstate,
+                                        uint8_t ts_disrupt_flags, uint8_t tc_disrupt_flags)
+{
+    if (pstate == NULL)
+        return true;
+    return (pstate->log_disrupt_flags[0] != ts_disrupt_flags ||
+            pstate->log_disrupt_flags[1] != tc_disrupt_flags);
+}
+
+/** \brief remember the data version and disruption flags the tx
+ *         logger has seen */
+void AppLayerParserSetLogDataVersion(AppLayerParserState *pstate,
+                                     uint8_t ts_disrupt_flags, uint8_t tc_disrupt_flags)
+{
+    if (pstate == NULL)
+        return;
+    pstate->log_data_version = pstate->data_version;
+    pstate->log_disrupt_flags[0] = ts_disrupt_flags;
+    pstate->log_disrupt_flags[1] = tc_disrupt_flags;
+}
+
+/** \brief mark a tx as possibly ready for logging
+ *
+ *  To be called by parsers registered with APP_LAYER_PARSER_OPT_LOG_READY
+ *  for every tx whose progress changed. */
+void AppLayerParserTxLogReady(AppLayerParserState *pstate, uint64_t tx_id)
+{
+    if (pstate == NULL || pstate->log_ready_cnt == UINT8_MAX)
+        return;
+
+    uint8_t i = pstate->log_ready_cnt;
+    while (i > 0 && pstate->log_ready[i - 1] >= tx_id) {
+        if (pstate->log_ready[i - 1] == tx_id)
+            return;
+        i--;
+    }
+    if (pstate->log_ready_cnt == APP_LAYER_PARSER_LOG_READY_MAX) {
+        pstate->log_ready_cnt = UINT8_MAX;
+        return;
+    }
+    memmove(&pstate->log_ready[i + 1], &pstate->log_ready[i],
+            (pstate->log_ready_cnt - i) * sizeof(pstate->log_ready[0]));
+    pstate->log_ready[i] = tx_id;
+    pstate->log_ready_cnt++;
+}
+
+/** \brief get the txs marked log ready
+ *
+ *  \retval cnt number of tx ids in tx_ids, in ascending order
+ *  \retval -1 too many txs were marked, all have to be checked */
+int AppLayerParserGetTxLogReady(const AppLayerParserState *pstate,
+                                const uint64_t **tx_ids)
+{
+    if (pstate == NULL || pstate->log_ready_cnt == UINT8_MAX)
+        return -1;
+    *tx_ids = pstate->log_ready;
+    return pstate->log_ready_cnt;
+}
+
+void AppLayerParserResetTxLogReady(AppLayerParserState *pstate)
+{
+    if (pstate == NULL)
+        return;
+    pstate->log_ready_cnt = 0;
+}
+
 AppLayerDecoderEvents *AppLayerParserGetDecoderEvents(AppLayerParserState *pstate)
 {
     SCEnter();
@@ -1120,6 +1245,9 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
             goto error;
     }
 
+    /* txs may change from here on */
+    pstate->data_version++;
+
     if (flags & STREAM_EOF)
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_EOF);
 
@@ -1282,6 +1410,13 @@ int AppLayerParserProtocolSupportsTxs(uint8_t ipproto, AppProto alproto)
     SCReturnInt(r);
 }
 
+int AppLayerParserProtocolHasLogReady(uint8_t ipproto, AppProto alproto)
+{
+    int ipproto_map = FlowGetProtoMapping(ipproto);
+    return (alp_ctx.ctxs[ipproto_map][alproto].flags &
+            APP_LAYER_PARSER_OPT_LOG_READY) ? 1 : 0;
+}
+
 int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto)
 {
     SCEnter();
@@ -1915,6 +2050,15 @@ static int TestProtocolParser(Flow *f, void *test_state, AppLayerParserState *ps
     SCReturnInt(-1);
 }
 
+/** \brief Test parser that accepts all input */
+static int TestProtocolParserOk(Flow *f, void *test_state, AppLayerParserState *pstate,
+                                uint8_t *input, uint32_t input_len,
+                                void *local_data)
+{
+    SCEnter();
+    SCReturnInt(0);
+}
+
 /** \brief Function to allocates the Test protocol state memory
  */
 static void *TestProtocolStateAlloc(void)
@@ -2065,6 +2209,108 @@ static int AppLayerParserTest02(void)
     return result;
 }
 
+/**
+ * \test Test that each parser invocation bumps the data version and that
+ *       the detect watermark is tracked per direction.
+ */
+static int AppLayerParserTest03(void)
+{
+    AppLayerParserBackupParserTable();
+
+    uint8_t testbuf[] = { 0x11 };
+    uint32_t testlen = sizeof(testbuf);
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    AppLayerParserRegisterParser(IPPROTO_UDP, ALPROTO_TEST, STREAM_TOSERVER,
+                      TestProtocolParserOk);
+    AppLayerParserRegisterParser(IPPROTO_UDP, ALPROTO_TEST, STREAM_TOCLIENT,
+                      TestProtocolParserOk);
+    AppLayerParserRegisterStateFuncs(IPPROTO_UDP, ALPROTO_TEST,
+                          TestProtocolStateAlloc, TestProtocolStateFree);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 20, 40);
+    FAIL_IF_NULL(f);
+    f->alproto = ALPROTO_TEST;
+    f->proto = IPPROTO_UDP;
+    f->protomap = FlowGetProtoMapping(f->proto);
+
+    FAIL_IF(AppLayerParserGetDataVersion(f->alparser) != 0);
+
+    FLOWLOCK_WRLOCK(f);
+    int r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_TEST,
+                                STREAM_TOSERVER, testbuf, testlen);
+    FAIL_IF(r != 0);
+    uint64_t v = AppLayerParserGetDataVersion(f->alparser);
+    FAIL_IF(v == 0);
+
+    AppLayerParserSetDetectDataVersion(f->alparser, STREAM_TOSERVER, v);
+    FAIL_IF(AppLayerParserGetDetectDataVersion(f->alparser, STREAM_TOSERVER) != v);
+    FAIL_IF(AppLayerParserGetDetectDataVersion(f->alparser, STREAM_TOCLIENT) != 0);
+
+    /* data in the other direction invalidates the watermark as well */
+    r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_TEST,
+                            STREAM_TOCLIENT, testbuf, testlen);
+    FAIL_IF(r != 0);
+    FAIL_IF(AppLayerParserGetDataVersion(f->alparser) == v);
+
+    AppLayerParserResetDetectDataVersion(f->alparser);
+    FAIL_IF(AppLayerParserGetDetectDataVersion(f->alparser, STREAM_TOSERVER) != 0);
+    FLOWLOCK_UNLOCK(f);
+
+    /* free the flow while the test parser is still registered */
+    UTHFreeFlow(f);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    AppLayerParserRestoreParserTable();
+    PASS;
+}
+
+/**
+ * \test Test the log ready marks: sorted, without duplicates and falling
+ *       back to a full scan when too many txs are marked. Test the
+ *       disruption flags the tx logger tracks.
+ */
+static int AppLayerParserTest04(void)
+{
+    const uint64_t *ids = NULL;
+    AppLayerParserState *pstate = AppLayerParserStateAlloc();
+    FAIL_IF_NULL(pstate);
+
+    FAIL_IF(AppLayerParserGetLogDataVersion(pstate) != 0);
+    FAIL_IF(AppLayerParserLogDisruptionChanged(pstate, 0, 0));
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) != 0);
+
+    AppLayerParserTxLogReady(pstate, 5);
+    AppLayerParserTxLogReady(pstate, 3);
+    AppLayerParserTxLogReady(pstate, 5);
+    AppLayerParserTxLogReady(pstate, 4);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) != 3);
+    FAIL_IF(ids[0] != 3 || ids[1] != 4 || ids[2] != 5);
+
+    AppLayerParserResetTxLogReady(pstate);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) != 0);
+
+    uint64_t i;
+    for (i = 0; i < APP_LAYER_PARSER_LOG_READY_MAX; i++)
+        AppLayerParserTxLogReady(pstate, i);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) !=
+            APP_LAYER_PARSER_LOG_READY_MAX);
+    AppLayerParserTxLogReady(pstate, 0);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) !=
+            APP_LAYER_PARSER_LOG_READY_MAX);
+    AppLayerParserTxLogReady(pstate, i);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) != -1);
+    AppLayerParserResetTxLogReady(pstate);
+    FAIL_IF(AppLayerParserGetTxLogReady(pstate, &ids) != 0);
+
+    FAIL_IF(!(AppLayerParserLogDisruptionChanged(pstate, STREAM_DEPTH, 0)));
+    AppLayerParserSetLogDataVersion(pstate, STREAM_DEPTH, 0);
+    FAIL_IF(AppLayerParserLogDisruptionChanged(pstate, STREAM_DEPTH, 0));
+    FAIL_IF(!(AppLayerParserLogDisruptionChanged(pstate, STREAM_DEPTH, STREAM_GAP)));
+
+    AppLayerParserStateFree(pstate);
+    PASS;
+}
 
 void AppLayerParserRegisterUnittests(void)
 {
@@ -2085,6 +2331,8 @@ void AppLayerParserRegisterUnittests(void)
 
     UtRegisterTest("AppLayerParserTest01", AppLayerParserTest01);
     UtRegisterTest("AppLayerParserTest02", AppLayerParserTest02);
+    UtRegisterTest("AppLayerParserTest03", AppLayerParserTest03);
+    UtRegisterTest("AppLayerParserTest04", AppLayerParserTest04);
 
     SCReturn;
 }
@@ -39,6 +39,13 @@
 
 /* Flags for AppLayerParserProtoCtx. */
 #define APP_LAYER_PARSER_OPT_ACCEPT_GAPS        BIT_U64(0)
+/** parser calls AppLayerParserTxLogReady() for each tx it changes, so
+ *  the tx logger only has to look at those */
+#define APP_LAYER_PARSER_OPT_LOG_READY          BIT_U64(1)
+
+/** max txs marked log ready between two logger runs. If more are
+ *  marked the logger looks at all txs again. */
+#define APP_LAYER_PARSER_LOG_READY_MAX          8
 
 /* applies to DetectFlags uint64_t field */
 
@@ -193,6 +200,23 @@ uint64_t AppLayerParserGetTransactionInspectId(AppLayerParserState *pstate, uint
 void AppLayerParserSetTransactionInspectId(const Flow *f, AppLayerParserState *pstate,
                                 void *alstate, const uint8_t flags, bool tag_txs_as_inspected);
 
+uint64_t AppLayerParserGetDataVersion(const AppLayerParserState *pstate);
+uint64_t AppLayerParserGetDetectDataVersion(const AppLayerParserState *pstate,
+                                            uint8_t direction);
+void AppLayerParserSetDetectDataVersion(AppLayerParserState *pstate,
+                                        uint8_t direction, uint64_t version);
+void AppLayerParserResetDetectDataVersion(AppLayerParserState *pstate);
+
+uint64_t AppLayerParserGetLogDataVersion(const AppLayerParserState *pstate);
+bool AppLayerParserLogDisruptionChanged(const AppLayerParserState *pstate,
+                                        uint8_t ts_disrupt_flags, uint8_t tc_disrupt_flags);
+void AppLayerParserSetLogDataVersion(AppLayerParserState *pstate,
+                                     uint8_t ts_disrupt_flags, uint8_t tc_disrupt_flags);
+void AppLayerParserTxLogReady(AppLayerParserState *pstate, uint64_t tx_id);
+int AppLayerParserGetTxLogReady(const AppLayerParserState *pstate,
+                                const uint64_t **tx_ids);
+void AppLayerParserResetTxLogReady(AppLayerParserState *pstate);
+
 AppLayerDecoderEvents *AppLayerParserGetDecoderEvents(AppLayerParserState *pstate);
 void AppLayerParserSetDecoderEvents(AppLayerParserState *pstate, AppLayerDecoderEvents *devents);
 AppLayerDecoderEvents *AppLayerParserGetEventsByTx(uint8_t ipproto, AppProto alproto, void *alstate,
@@ -231,6 +255,7 @@ int AppLayerParserProtocolIsTxAware(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolIsTxEventAware(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolSupportsTxs(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto);
+int AppLayerParserProtocolHasLogReady(uint8_t ipproto, AppProto alproto);
 LoggerId AppLayerParserProtocolGetLoggerBits(uint8_t ipproto, AppProto alproto);
 void AppLayerParserTriggerRawStreamReassembly(Flow *f, int direction);
 void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto, uint32_t stream_depth);
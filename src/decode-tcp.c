@@ -262,6 +262,38 @@ static int TCPCalculateInvalidChecksumtest02(void)
     PASS;
 }
 
+/** \test checksum of a full size segment, summed by the selected kernel */
+static int TCPCalculateLargeChecksumtest05(void)
+{
+    uint8_t raw_ipshdr[] = {
+        0x40, 0x8e, 0x7e, 0xb2, 0xc0, 0xa8, 0x01, 0x03};
+    uint16_t raw_tcp[741];
+    const uint16_t tlen = sizeof(raw_tcp) - 1;
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < sizeof(raw_tcp) / 2; i++) {
+        seed = seed * 1103515245 + 12345;
+        raw_tcp[i] = (uint16_t)(seed >> 16);
+    }
+    raw_tcp[8] = 0;
+
+    /* reference sum of the pseudo header and the segment */
+    const uint16_t *ip = (const uint16_t *)raw_ipshdr;
+    uint32_t sum = ip[0] + ip[1] + ip[2] + ip[3] + htons(6) + htons(tlen);
+    for (uint32_t i = 0; i < tlen / 2; i++)
+        sum += raw_tcp[i];
+    uint16_t pad = 0;
+    *(uint8_t *)&pad = *((uint8_t *)raw_tcp + tlen - 1);
+    sum += pad;
+    sum = (sum >> 16) + (sum & 0x0000FFFF);
+    sum += (sum >> 16);
+    const uint16_t expect = (uint16_t)~sum;
+
+    FAIL_IF(TCPChecksum((uint16_t *)raw_ipshdr, raw_tcp, tlen, 0) != expect);
+    FAIL_IF(TCPChecksum((uint16_t *)raw_ipshdr, raw_tcp, tlen, expect) != 0);
+    PASS;
+}
+
 static int TCPV6CalculateValidChecksumtest03(void)
 {
     uint16_t csum = 0;
@@ -525,6 +557,8 @@ void DecodeTCPRegisterTests(void)
                    TCPV6CalculateValidChecksumtest03);
     UtRegisterTest("TCPV6CalculateInvalidChecksumtest04",
                    TCPV6CalculateInvalidChecksumtest04);
+    UtRegisterTest("TCPCalculateLargeChecksumtest05",
+                   TCPCalculateLargeChecksumtest05);
     UtRegisterTest("TCPGetWscaleTest01", TCPGetWscaleTest01);
     UtRegisterTest("TCPGetWscaleTest02", TCPGetWscaleTest02);
     UtRegisterTest("TCPGetWscaleTest03", TCPGetWscaleTest03);
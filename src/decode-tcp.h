@@ -25,6 +25,8 @@
 #ifndef __DECODE_TCP_H__
 #define __DECODE_TCP_H__
 
+#include "util-checksum-simd.h"
+
 #define TCP_HEADER_LEN                       20
 #define TCP_OPTLENMAX                        40
 #define TCP_OPTMAX                           20 /* every opt is at least 2 bytes
@@ -193,6 +195,15 @@ static inline uint16_t TCPChecksum(uint16_t *shdr, uint16_t *pkt,
     tlen -= 20;
     pkt += 10;
 
+#ifdef SC_CPU_DISPATCH
+    if (tlen >= CHECKSUM_SUM16_MIN) {
+        const uint16_t blen = tlen & ~31;
+        csum += ChecksumSum16(pkt, blen);
+        tlen -= blen;
+        pkt += blen / 2;
+    }
+#endif
+
     while (tlen >= 32) {
         csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
             pkt[7] +
@@ -260,6 +271,15 @@ static inline uint16_t TCPV6Checksum(uint16_t *shdr, uint16_t *pkt,
     tlen -= 20;
     pkt += 10;
 
+#ifdef SC_CPU_DISPATCH
+    if (tlen >= CHECKSUM_SUM16_MIN) {
+        const uint16_t blen = tlen & ~31;
+        csum += ChecksumSum16(pkt, blen);
+        tlen -= blen;
+        pkt += blen / 2;
+    }
+#endif
+
     while (tlen >= 32) {
         csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
             pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
@@ -24,6 +24,8 @@
 #ifndef __DECODE_UDP_H__
 #define __DECODE_UDP_H__
 
+#include "util-checksum-simd.h"
+
 #define UDP_HEADER_LEN         8
 
 /* XXX RAW* needs to be really 'raw', so no SCNtohs there */
@@ -83,6 +85,15 @@ static inline uint16_t UDPV4Checksum(uint16_t *shdr, uint16_t *pkt,
     tlen -= 8;
     pkt += 4;
 
+#ifdef SC_CPU_DISPATCH
+    if (tlen >= CHECKSUM_SUM16_MIN) {
+        const uint16_t blen = tlen & ~31;
+        csum += ChecksumSum16(pkt, blen);
+        tlen -= blen;
+        pkt += blen / 2;
+    }
+#endif
+
     while (tlen >= 32) {
         csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
             pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
@@ -152,6 +163,15 @@ static inline uint16_t UDPV6Checksum(uint16_t *shdr, uint16_t *pkt,
     tlen -= 8;
     pkt += 4;
 
+#ifdef SC_CPU_DISPATCH
+    if (tlen >= CHECKSUM_SUM16_MIN) {
+        const uint16_t blen = tlen & ~31;
+        csum += ChecksumSum16(pkt, blen);
+        tlen -= blen;
+        pkt += blen / 2;
+    }
+#endif
+
     while (tlen >= 32) {
         csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
             pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
@@ -237,12 +237,8 @@ static void PrefilterTxDnsQuery(DetectEngineThreadCtx *det_ctx,
         if (buffer == NULL)
             break;
 
-        if (buffer->inspect_len >= mpm_ctx->minlen) {
-            (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                    &det_ctx->mtcu, &det_ctx->pmq,
-                    buffer->inspect, buffer->inspect_len);
-        }
-
+        DetectMpmVectorAdd(det_ctx, mpm_ctx,
+                buffer->inspect, buffer->inspect_len, local_id);
         local_id++;
     }
 #else
@@ -254,14 +250,15 @@ static void PrefilterTxDnsQuery(DetectEngineThreadCtx *det_ctx,
         InspectionBuffer *buffer = DnsQueryGetData(det_ctx, ctx->transforms,
                 f, &cbdata, list_id, true);
 
-        if (buffer != NULL && buffer->inspect_len >= mpm_ctx->minlen) {
-            (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                    &det_ctx->mtcu, &det_ctx->pmq,
-                    buffer->inspect, buffer->inspect_len);
+        if (buffer != NULL) {
+            DetectMpmVectorAdd(det_ctx, mpm_ctx,
+                    buffer->inspect, buffer->inspect_len, local_id);
         }
         local_id++;
     }
 #endif
+    /* all queries of the tx in one batch */
+    (void)DetectMpmVectorSearch(det_ctx, mpm_ctx);
 }
 
 static void PrefilterMpmDnsQueryFree(void *ptr)
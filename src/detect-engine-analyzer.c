@@ -34,6 +34,7 @@
 #include "detect-content.h"
 #include "detect-flow.h"
 #include "detect-flags.h"
+#include "detect-pcre-prefilter.h"
 #include "util-print.h"
 
 static int rule_warnings_only = 0;
@@ -310,7 +311,7 @@ int SetupRuleAnalyzer(void)
     return 1;
 }
 
-void CleanupFPAnalyzer(void)
+void CleanupFPAnalyzer(const DetectEngineCtx *de_ctx)
 {
     fprintf(fp_engine_analysis_FD, "============\n"
         "Summary:\n============\n");
@@ -324,6 +325,12 @@ void CleanupFPAnalyzer(void)
             "%s, smallest pattern %u byte(s), longest pattern %u byte(s), number of patterns %u, avg pattern len %.2f byte(s)\n",
             DetectSigmatchListEnumToString(i), f->min, f->max, f->cnt, (float)((double)f->tot/(float)f->cnt));
     }
+    if (de_ctx->prefilter_pcre) {
+        fprintf(fp_engine_analysis_FD,
+            "pcre prefilter, %u rules accelerated, %u exact, %u approximate\n",
+            de_ctx->pcre_prefilter_exact_cnt + de_ctx->pcre_prefilter_approx_cnt,
+            de_ctx->pcre_prefilter_exact_cnt, de_ctx->pcre_prefilter_approx_cnt);
+    }
 
     if (fp_engine_analysis_FD != NULL) {
         fclose(fp_engine_analysis_FD);
@@ -334,9 +341,16 @@ void CleanupFPAnalyzer(void)
 }
 
 
-void CleanupRuleAnalyzer(void)
+void CleanupRuleAnalyzer(const DetectEngineCtx *de_ctx)
 {
     if (rule_engine_analysis_FD != NULL) {
+        if (de_ctx->prefilter_pcre) {
+            fprintf(rule_engine_analysis_FD, "== Summary ==\n"
+                "    %u pcre rules are accelerated by the Hyperscan prefilter: "
+                "%u exact, %u approximate.\n",
+                de_ctx->pcre_prefilter_exact_cnt + de_ctx->pcre_prefilter_approx_cnt,
+                de_ctx->pcre_prefilter_exact_cnt, de_ctx->pcre_prefilter_approx_cnt);
+        }
          SCLogInfo("Engine-Analyis for rules printed to file - %s", log_path);
         fclose(rule_engine_analysis_FD);
         rule_engine_analysis_FD = NULL;
@@ -574,6 +588,19 @@ void EngineAnalysisRules2(const DetectEngineCtx *de_ctx, const Signature *s)
         json_object_set_new(js, "engines", js_array);
     }
 
+    if (s->init_data->prefilter_sm != NULL) {
+        json_t *js_prefilter = json_object();
+        if (js_prefilter != NULL) {
+            json_object_set_new(js_prefilter, "name",
+                    json_string(sigmatch_table[s->init_data->prefilter_sm->type].name));
+            const char *mode = DetectPcrePrefilterMode(s);
+            if (mode != NULL) {
+                json_object_set_new(js_prefilter, "pcre", json_string(mode));
+            }
+            json_object_set_new(js, "prefilter", js_prefilter);
+        }
+    }
+
     const char *filename = "rules.json";
     const char *log_dir = ConfigGetLogDirectory();
     char json_path[PATH_MAX] = "";
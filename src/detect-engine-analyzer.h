@@ -27,10 +27,10 @@
 #include <stdint.h>
 
 int SetupFPAnalyzer(void);
-void CleanupFPAnalyzer(void);
+void CleanupFPAnalyzer(const DetectEngineCtx *de_ctx);
 
 int SetupRuleAnalyzer(void);
-void CleanupRuleAnalyzer (void);
+void CleanupRuleAnalyzer(const DetectEngineCtx *de_ctx);
 
 int PerCentEncodingSetup (void);
 int PerCentEncodingMatch (uint8_t *content, uint8_t content_len);
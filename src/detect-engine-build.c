@@ -16,6 +16,7 @@
  */
 
 #include "suricata-common.h"
+#include "suricata.h"
 #include "detect.h"
 #include "detect-engine.h"
 #include "detect-parse.h"
@@ -24,6 +25,7 @@
 #include "detect-engine-analyzer.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-mpm-bench.h"
 #include "detect-engine-siggroup.h"
 #include "detect-engine-port.h"
 #include "detect-engine-prefilter.h"
@@ -33,6 +35,7 @@
 #include "detect-flags.h"
 #include "detect-flow.h"
 #include "detect-flowbits.h"
+#include "detect-pcre-prefilter.h"
 
 #include "util-profiling.h"
 
@@ -594,6 +597,16 @@ static int RuleMpmIsNegated(const Signature *s)
     return (cd->flags & DETECT_CONTENT_NEGATED);
 }
 
+/** \internal
+ *  \brief ratio of the rule group memory without and with sharing */
+static double RulesGroupSharingRatio(const DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->sgh_mem_used == 0)
+        return 1.0;
+    return (double)(de_ctx->sgh_mem_used + de_ctx->sgh_mem_saved) /
+        (double)de_ctx->sgh_mem_used;
+}
+
 #ifdef HAVE_LIBJANSSON
 static json_t *RulesGroupPrintSghStats(const SigGroupHead *sgh,
                                 const int add_rules, const int add_mpm_stats)
@@ -825,6 +838,12 @@ static json_t *RulesGroupPrintSghStats(const SigGroupHead *sgh,
 
     json_object_set_new(js, "whitelist", json_integer(sgh->init->whitelist));
 
+    uint64_t saved = 0;
+    json_t *mem = json_object();
+    json_object_set_new(mem, "bytes", json_integer(SigGroupHeadMemoryUsage(sgh, &saved)));
+    json_object_set_new(mem, "shared_bytes", json_integer(saved));
+    json_object_set_new(js, "memory", mem);
+
     return js;
 }
 #endif /* HAVE_LIBJANSSON */
@@ -883,6 +902,13 @@ static void RulesDumpGrouping(const DetectEngineCtx *de_ctx,
 
     }
 
+    json_t *mem = json_object();
+    json_object_set_new(mem, "rule_groups", json_integer(de_ctx->sgh_array_cnt));
+    json_object_set_new(mem, "bytes", json_integer(de_ctx->sgh_mem_used));
+    json_object_set_new(mem, "saved_bytes", json_integer(de_ctx->sgh_mem_saved));
+    json_object_set_new(mem, "sharing_ratio", json_real(RulesGroupSharingRatio(de_ctx)));
+    json_object_set_new(js, "memory", mem);
+
     const char *filename = "rule_group.json";
     const char *log_dir = ConfigGetLogDirectory();
     char log_path[PATH_MAX] = "";
@@ -1343,6 +1369,9 @@ int SigAddressPrepareStage1(DetectEngineCtx *de_ctx)
 
         RuleSetWhitelist(tmp_s);
 
+        /* rules without a fast pattern can use a pcre as prefilter */
+        DetectPcrePrefilterSigSetup(de_ctx, tmp_s);
+
         /* if keyword engines are enabled in the config, handle them here */
         if (de_ctx->prefilter_setting == DETECT_PREFILTER_AUTO &&
             !(tmp_s->flags & SIG_FLAG_PREFILTER))
@@ -1396,6 +1425,12 @@ int SigAddressPrepareStage1(DetectEngineCtx *de_ctx)
                 " inspect application layer, %"PRIu32" are decoder event only",
                 de_ctx->sig_cnt, cnt_iponly, cnt_payload, cnt_applayer,
                 cnt_deonly);
+        if (de_ctx->prefilter_pcre) {
+            SCLogConfig("%"PRIu32" rules use their pcre as prefilter: %"PRIu32
+                    " exact, %"PRIu32" approximate",
+                    de_ctx->pcre_prefilter_exact_cnt + de_ctx->pcre_prefilter_approx_cnt,
+                    de_ctx->pcre_prefilter_exact_cnt, de_ctx->pcre_prefilter_approx_cnt);
+        }
 
         SCLogConfig("building signature grouping structure, stage 1: "
                "preprocessing rules... complete");
@@ -1745,8 +1780,17 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
 
     //SCLogInfo("sgh's %"PRIu32, de_ctx->sgh_array_cnt);
 
+    /* the sgh's were deduplicated per proto and direction. Use the hash
+     * again to find sgh's with the same sigs across protos and directions
+     * so they can share their signature arrays. */
+    SigGroupHeadHashFree(de_ctx);
+    SigGroupHeadHashInit(de_ctx);
+
     uint32_t cnt = 0;
+    uint32_t shared = 0;
     uint32_t idx = 0;
+    de_ctx->sgh_mem_used = 0;
+    de_ctx->sgh_mem_saved = 0;
     for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
         SigGroupHead *sgh = de_ctx->sgh_array[idx];
         if (sgh == NULL)
@@ -1757,17 +1801,34 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
         SigGroupHeadSetFilemagicFlag(de_ctx, sgh);
         SigGroupHeadSetFileHashFlag(de_ctx, sgh);
         SigGroupHeadSetFilesizeFlag(de_ctx, sgh);
+        SigGroupHeadSetTxPacketMatchFlag(de_ctx, sgh);
         SigGroupHeadSetFilestoreCount(de_ctx, sgh);
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
 
         PrefilterSetupRuleGroup(de_ctx, sgh);
 
-        SigGroupHeadBuildNonPrefilterArray(de_ctx, sgh);
+        SigGroupHead *owner = SigGroupHeadHashLookup(de_ctx, sgh);
+        if (owner == NULL) {
+            SigGroupHeadBuildNonPrefilterArray(de_ctx, sgh);
+            SigGroupHeadHashAdd(de_ctx, sgh);
+        } else {
+            SCLogDebug("sgh %p shares arrays of sgh %p", sgh, owner);
+            SigGroupHeadShareArrays(sgh, owner);
+            shared++;
+        }
+
+        uint64_t saved = 0;
+        de_ctx->sgh_mem_used += SigGroupHeadMemoryUsage(sgh, &saved);
+        de_ctx->sgh_mem_saved += saved;
 
         sgh->id = idx;
         cnt++;
     }
     SCLogPerf("Unique rule groups: %u", cnt);
+    SCLogPerf("Rule groups use %"PRIu64" bytes, %u share their signature "
+            "arrays saving %"PRIu64" bytes (sharing ratio %.2f)",
+            de_ctx->sgh_mem_used, shared, de_ctx->sgh_mem_saved,
+            RulesGroupSharingRatio(de_ctx));
 
     MpmStoreReportStats(de_ctx);
 
@@ -1783,7 +1844,7 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
     int dump_grouping = 0;
     (void)ConfGetBool("detect.profiling.grouping.dump-to-disk", &dump_grouping);
 
-    if (dump_grouping) {
+    if (dump_grouping || RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS) {
         int add_rules = 0;
         (void)ConfGetBool("detect.profiling.grouping.include-rules", &add_rules);
         int add_mpm_stats = 0;
@@ -1892,13 +1953,16 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         exit(EXIT_FAILURE);
     }
 
-    int r = DetectMpmPrepareBuiltinMpms(de_ctx);
-    r |= DetectMpmPrepareAppMpms(de_ctx);
-    if (r != 0) {
+    if (DetectMpmPrepareMpms(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
 
+    /* the init data holding the fast patterns is freed by SigMatchPrepare */
+    if (RunmodeGetCurrent() == RUNMODE_MPM_BENCH) {
+        MpmBenchCollect(de_ctx);
+    }
+
     if (SigMatchPrepare(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
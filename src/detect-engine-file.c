@@ -56,6 +56,7 @@
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
 #include "util-profiling.h"
+#include "util-file-offload.h"
 
 
 /**
@@ -120,6 +121,14 @@ static int DetectFileInspect(ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
                 continue;
             }
 
+            /* the hashes of a closed file may still be in the offload
+             * pool */
+            if ((s->file_flags & (FILE_SIG_NEED_MD5|FILE_SIG_NEED_SHA1|
+                                  FILE_SIG_NEED_SHA256)) &&
+                    file->state >= FILE_STATE_CLOSED) {
+                (void)FileOffloadSync(file, true);
+            }
+
             if ((s->file_flags & FILE_SIG_NEED_MD5) && (!(file->flags & FILE_MD5))) {
                 SCLogDebug("sig needs file md5, but we don't have any");
                 r = DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
@@ -245,6 +245,15 @@ static void PrefilterTxHttpRequestBody(DetectEngineThreadCtx *det_ctx,
                                                      &buffer_len,
                                                      &stream_start_offset);
 
+    if (mpm_ctx->flags & MPMCTX_FLAGS_STREAM) {
+        if (buffer_len > 0) {
+            PrefilterMpmStreamScan(det_ctx, mpm_ctx, &det_ctx->mtcu, f, txv,
+                    flags, buffer, buffer_len, stream_start_offset,
+                    DETECT_MPM_STREAM_HCBD);
+        }
+        return;
+    }
+
     if (buffer_len >= mpm_ctx->minlen) {
         (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
                 &det_ctx->mtcu, &det_ctx->pmq, buffer, buffer_len);
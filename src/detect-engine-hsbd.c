@@ -85,7 +85,9 @@ InspectionBuffer *HttpServerBodyGetDataCallback(DetectEngineThreadCtx *det_ctx,
 {
     SCEnter();
 
-    InspectionBuffer *buffer = &det_ctx->inspect_buffers[list_id];
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer == NULL)
+        return NULL;
     if (buffer->inspect != NULL)
         return buffer;
 
@@ -54,6 +54,12 @@
 #include "util-unittest-helper.h"
 #include "util-print.h"
 #include "util-profiling.h"
+#include "util-hash-lookup3.h"
+#include "util-hashlist.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifdef OS_WIN32
 #include <winsock.h>
@@ -61,6 +67,9 @@
 #include <netinet/in.h>
 #endif /* OS_WIN32 */
 
+static int IPOnlyLookupBuild(DetectEngineCtx *, DetectEngineIPOnlyCtx *);
+static void IPOnlyLookupFree(DetectEngineIPOnlyCtx *);
+
 /**
  * \brief This function creates a new IPOnlyCIDRItem
  *
@@ -866,25 +875,6 @@ void IPOnlyInit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
                                                   SigNumArrayPrint);
 }
 
-/**
- * \brief Setup the IP Only thread detection engine context
- *
- * \param de_ctx Pointer to the current detection engine
- * \param io_ctx Pointer to the current ip only thread detection engine
- */
-void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
-                                  DetectEngineIPOnlyThreadCtx *io_tctx)
-{
-    /* initialize the signature bitarray */
-    io_tctx->sig_match_size = de_ctx->io_ctx.max_idx / 8 + 1;
-    io_tctx->sig_match_array = SCMalloc(io_tctx->sig_match_size);
-    if (io_tctx->sig_match_array == NULL) {
-        exit(EXIT_FAILURE);
-    }
-
-    memset(io_tctx->sig_match_array, 0, io_tctx->sig_match_size);
-}
-
 /**
  * \brief Print stats of the IP Only engine
  *
@@ -924,22 +914,13 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
         SCRadixReleaseRadixTree(io_ctx->tree_ipv6dst);
     io_ctx->tree_ipv6dst = NULL;
 
+    IPOnlyLookupFree(io_ctx);
+
     if (io_ctx->sig_init_array)
         SCFree(io_ctx->sig_init_array);
     io_ctx->sig_init_array = NULL;
 }
 
-/**
- * \brief Deinitialize the IP Only thread detection engine context
- *
- * \param de_ctx Pointer to the current detection engine
- * \param io_ctx Pointer to the current ip only detection engine
- */
-void DetectEngineIPOnlyThreadDeinit(DetectEngineIPOnlyThreadCtx *io_tctx)
-{
-    SCFree(io_tctx->sig_match_array);
-}
-
 static inline
 int IPOnlyMatchCompatSMs(ThreadVars *tv,
                          DetectEngineThreadCtx *det_ctx,
@@ -965,140 +946,662 @@ int IPOnlyMatchCompatSMs(ThreadVars *tv,
     return 1;
 }
 
+/** \internal
+ *  \brief network collected from a radix tree while flattening it
+ *
+ *  IPv4 networks use the low word only. */
+typedef struct IPOnlyNet_ {
+    uint64_t start[2];  /**< first address, most significant word first */
+    uint64_t end[2];    /**< last address */
+    uint32_t set;       /**< sig set id */
+    uint8_t netmask;
+} IPOnlyNet;
+
+typedef struct IPOnlyNetList_ {
+    IPOnlyNet *nets;
+    uint32_t cnt;
+    uint32_t size;
+} IPOnlyNetList;
+
+/** \internal
+ *  \brief range of the flattened table */
+typedef struct IPOnlyRange_ {
+    uint64_t start[2];
+    uint32_t set;
+} IPOnlyRange;
+
+typedef struct IPOnlyRangeList_ {
+    IPOnlyRange *ranges;
+    uint32_t cnt;
+    uint32_t size;
+} IPOnlyRangeList;
+
+/** \internal
+ *  \brief sig set dedup hash entry. Points to the SigNumArray in the
+ *         radix tree, so only valid while the trees exist. */
+typedef struct IPOnlySet_ {
+    const uint8_t *array;
+    uint32_t size;
+    uint32_t id;
+} IPOnlySet;
+
+static uint32_t IPOnlySetHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const IPOnlySet *set = (IPOnlySet *)data;
+    return hashlittle_safe(set->array, set->size, 0) % ht->array_size;
+}
+
+static char IPOnlySetCompareFunc(void *data1, uint16_t len1, void *data2,
+                                 uint16_t len2)
+{
+    const IPOnlySet *set1 = (IPOnlySet *)data1;
+    const IPOnlySet *set2 = (IPOnlySet *)data2;
+
+    if (set1->size != set2->size)
+        return 0;
+    return (memcmp(set1->array, set2->array, set1->size) == 0);
+}
+
+static void IPOnlySetFreeFunc(void *data)
+{
+    SCFree(data);
+}
+
+/** \internal
+ *  \brief get the id of the deduplicated copy of a SigNumArray
+ *
+ *  \retval id set id, 0 for an empty set
+ *  \retval -1 error
+ */
+static int64_t IPOnlySetGetId(HashListTable *ht, const SigNumArray *sna,
+                              uint32_t *next_id)
+{
+    uint32_t u;
+    for (u = 0; u < sna->size; u++) {
+        if (sna->array[u] != 0)
+            break;
+    }
+    if (u == sna->size)
+        return 0;
+
+    IPOnlySet lookup = { sna->array, sna->size, 0 };
+    IPOnlySet *set = HashListTableLookup(ht, &lookup, 0);
+    if (set != NULL)
+        return set->id;
+
+    set = SCMalloc(sizeof(*set));
+    if (unlikely(set == NULL))
+        return -1;
+    set->array = sna->array;
+    set->size = sna->size;
+    set->id = (*next_id)++;
+    if (HashListTableAdd(ht, set, 0) != 0) {
+        SCFree(set);
+        return -1;
+    }
+    return set->id;
+}
+
+/** \internal
+ *  \brief collect all networks of a radix (sub)tree
+ *
+ *  \param bitlen 32 for IPv4, 128 for IPv6
+ */
+static int IPOnlyCollectNets(const SCRadixNode *node, const uint16_t bitlen,
+                             HashListTable *ht, uint32_t *next_id,
+                             IPOnlyNetList *list)
+{
+    if (node == NULL)
+        return 0;
+
+    if (node->prefix != NULL && node->prefix->stream != NULL) {
+        const uint8_t *k = node->prefix->stream;
+        uint64_t key[2] = { 0, 0 };
+        int i;
+        if (bitlen == 32) {
+            key[1] = ((uint64_t)k[0] << 24) | ((uint64_t)k[1] << 16) |
+                     ((uint64_t)k[2] << 8) | (uint64_t)k[3];
+        } else {
+            for (i = 0; i < 8; i++) {
+                key[0] = (key[0] << 8) | k[i];
+                key[1] = (key[1] << 8) | k[i + 8];
+            }
+        }
+
+        const SCRadixUserData *ud = node->prefix->user_data;
+        for ( ; ud != NULL; ud = ud->next) {
+            if (ud->user == NULL)
+                continue;
+
+            int64_t id = IPOnlySetGetId(ht, (const SigNumArray *)ud->user, next_id);
+            if (id < 0)
+                return -1;
+
+            /* host part masks of the two words */
+            uint64_t hmask[2];
+            if (bitlen == 32) {
+                hmask[0] = 0;
+                hmask[1] = (ud->netmask == 0) ? 0xffffffffULL :
+                    (0xffffffffULL >> ud->netmask);
+            } else if (ud->netmask <= 64) {
+                hmask[0] = (ud->netmask == 0) ? ~0ULL : (~0ULL >> ud->netmask);
+                hmask[1] = ~0ULL;
+            } else {
+                hmask[0] = 0;
+                hmask[1] = (ud->netmask == 128) ? 0 : (~0ULL >> (ud->netmask - 64));
+            }
+
+            if (list->cnt == list->size) {
+                uint32_t new_size = list->size ? list->size * 2 : 256;
+                IPOnlyNet *ptr = SCRealloc(list->nets, new_size * sizeof(IPOnlyNet));
+                if (unlikely(ptr == NULL))
+                    return -1;
+                list->nets = ptr;
+                list->size = new_size;
+            }
+            IPOnlyNet *net = &list->nets[list->cnt++];
+            for (i = 0; i < 2; i++) {
+                net->start[i] = key[i] & ~hmask[i];
+                net->end[i] = net->start[i] | hmask[i];
+            }
+            net->set = (uint32_t)id;
+            net->netmask = ud->netmask;
+        }
+    }
+
+    if (IPOnlyCollectNets(node->left, bitlen, ht, next_id, list) < 0)
+        return -1;
+    return IPOnlyCollectNets(node->right, bitlen, ht, next_id, list);
+}
+
+static inline int IPOnlyAddrCmp(const uint64_t *a, const uint64_t *b)
+{
+    if (a[0] != b[0])
+        return a[0] < b[0] ? -1 : 1;
+    if (a[1] != b[1])
+        return a[1] < b[1] ? -1 : 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief sort by address, and for equal addresses the widest network
+ *         first, so that a network always follows the ones it is
+ *         nested in */
+static int IPOnlyNetCompare(const void *a, const void *b)
+{
+    const IPOnlyNet *n1 = (const IPOnlyNet *)a;
+    const IPOnlyNet *n2 = (const IPOnlyNet *)b;
+
+    int r = IPOnlyAddrCmp(n1->start, n2->start);
+    if (r != 0)
+        return r;
+    return (int)n1->netmask - (int)n2->netmask;
+}
+
+/** \internal
+ *  \brief append a range, merging it with the previous range where
+ *         possible */
+static int IPOnlyRangeAppend(IPOnlyRangeList *list, const uint64_t *start,
+                             uint32_t set)
+{
+    if (list->cnt > 0) {
+        IPOnlyRange *last = &list->ranges[list->cnt - 1];
+        if (IPOnlyAddrCmp(last->start, start) == 0) {
+            last->set = set;
+            /* the range may now be the same as its predecessor */
+            if (list->cnt > 1 && list->ranges[list->cnt - 2].set == set)
+                list->cnt--;
+            return 0;
+        }
+        if (last->set == set)
+            return 0;
+    }
+
+    if (list->cnt == list->size) {
+        uint32_t new_size = list->size ? list->size * 2 : 256;
+        IPOnlyRange *ptr = SCRealloc(list->ranges, new_size * sizeof(IPOnlyRange));
+        if (unlikely(ptr == NULL))
+            return -1;
+        list->ranges = ptr;
+        list->size = new_size;
+    }
+    IPOnlyRange *r = &list->ranges[list->cnt++];
+    r->start[0] = start[0];
+    r->start[1] = start[1];
+    r->set = set;
+    return 0;
+}
+
+/** \internal
+ *  \brief append the range following a network that is no longer
+ *         active. Nothing follows a network ending at the last address.
+ */
+static int IPOnlyRangeAppendAfter(IPOnlyRangeList *list, const IPOnlyNet *net,
+                                  const uint64_t *max, uint32_t set)
+{
+    if (IPOnlyAddrCmp(net->end, max) == 0)
+        return 0;
+
+    uint64_t next[2] = { net->end[0], net->end[1] + 1 };
+    if (next[1] == 0)
+        next[0]++;
+    return IPOnlyRangeAppend(list, next, set);
+}
+
+/** \internal
+ *  \brief turn the (nested) networks into a list of adjacent ranges,
+ *         each mapped to the set of the longest network covering it
+ *
+ *  \param nets networks sorted by IPOnlyNetCompare
+ */
+static int IPOnlyFlatten(const IPOnlyNetList *nets, const uint64_t *max,
+                         IPOnlyRangeList *ranges)
+{
+    /* networks are nested at most 129 deep */
+    const IPOnlyNet *stack[129];
+    int sp = 0;
+    const uint64_t zero[2] = { 0, 0 };
+
+    if (IPOnlyRangeAppend(ranges, zero, 0) < 0)
+        return -1;
+
+    uint32_t u;
+    for (u = 0; u < nets->cnt; u++) {
+        const IPOnlyNet *net = &nets->nets[u];
+
+        while (sp > 0 && IPOnlyAddrCmp(stack[sp - 1]->end, net->start) < 0) {
+            const IPOnlyNet *done = stack[--sp];
+            if (IPOnlyRangeAppendAfter(ranges, done, max,
+                        sp > 0 ? stack[sp - 1]->set : 0) < 0)
+                return -1;
+        }
+
+        if (IPOnlyRangeAppend(ranges, net->start, net->set) < 0)
+            return -1;
+        BUG_ON(sp >= 129);
+        stack[sp++] = net;
+    }
+    while (sp > 0) {
+        const IPOnlyNet *done = stack[--sp];
+        if (IPOnlyRangeAppendAfter(ranges, done, max,
+                    sp > 0 ? stack[sp - 1]->set : 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int IPOnlyLookupV4Build(IPOnlyLookupV4 *t, const IPOnlyRangeList *ranges)
+{
+    t->start = SCMalloc(ranges->cnt * sizeof(uint32_t));
+    t->set = SCMalloc(ranges->cnt * sizeof(uint32_t));
+    t->index = SCMalloc(65537 * sizeof(uint32_t));
+    if (t->start == NULL || t->set == NULL || t->index == NULL)
+        return -1;
+    t->cnt = ranges->cnt;
+
+    uint32_t u;
+    for (u = 0; u < ranges->cnt; u++) {
+        t->start[u] = (uint32_t)ranges->ranges[u].start[1];
+        t->set[u] = ranges->ranges[u].set;
+    }
+
+    uint32_t idx = 0;
+    for (u = 0; u < 65536; u++) {
+        while (idx + 1 < t->cnt && t->start[idx + 1] <= (u << 16))
+            idx++;
+        t->index[u] = idx;
+    }
+    t->index[65536] = t->cnt - 1;
+    return 0;
+}
+
+static int IPOnlyLookupV6Build(IPOnlyLookupV6 *t, const IPOnlyRangeList *ranges)
+{
+    t->start = SCMalloc(ranges->cnt * 2 * sizeof(uint64_t));
+    t->set = SCMalloc(ranges->cnt * sizeof(uint32_t));
+    if (t->start == NULL || t->set == NULL)
+        return -1;
+    t->cnt = ranges->cnt;
+
+    uint32_t u;
+    for (u = 0; u < ranges->cnt; u++) {
+        t->start[u * 2] = ranges->ranges[u].start[0];
+        t->start[u * 2 + 1] = ranges->ranges[u].start[1];
+        t->set[u] = ranges->ranges[u].set;
+    }
+    return 0;
+}
+
+static void IPOnlyLookupFree(DetectEngineIPOnlyCtx *io_ctx)
+{
+    IPOnlyLookupV4 *v4[2] = { &io_ctx->lookup_ipv4src, &io_ctx->lookup_ipv4dst };
+    IPOnlyLookupV6 *v6[2] = { &io_ctx->lookup_ipv6src, &io_ctx->lookup_ipv6dst };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (v4[i]->start != NULL)
+            SCFree(v4[i]->start);
+        if (v4[i]->set != NULL)
+            SCFree(v4[i]->set);
+        if (v4[i]->index != NULL)
+            SCFree(v4[i]->index);
+        memset(v4[i], 0x00, sizeof(*v4[i]));
+
+        if (v6[i]->start != NULL)
+            SCFree(v6[i]->start);
+        if (v6[i]->set != NULL)
+            SCFree(v6[i]->set);
+        memset(v6[i], 0x00, sizeof(*v6[i]));
+    }
+
+    if (io_ctx->sets != NULL)
+        SCFreeAligned(io_ctx->sets);
+    io_ctx->sets = NULL;
+    io_ctx->sets_cnt = 0;
+    io_ctx->sets_size = 0;
+}
+
+/**
+ * \brief Build the runtime lookup tables from the radix trees
+ *
+ * Each tree is flattened into a sorted list of address ranges, and the
+ * SigNumArrays of the trees are deduplicated into io_ctx->sets. Large
+ * address lists of a single rule end up sharing one sig set. After this
+ * the trees are no longer needed and are freed.
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+static int IPOnlyLookupBuild(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
+{
+    SCRadixTree *trees[4] = { io_ctx->tree_ipv4src, io_ctx->tree_ipv4dst,
+                              io_ctx->tree_ipv6src, io_ctx->tree_ipv6dst };
+    IPOnlyNetList nets[4];
+    IPOnlyRangeList ranges;
+    const uint64_t max_v4[2] = { 0, 0xffffffffULL };
+    const uint64_t max_v6[2] = { ~0ULL, ~0ULL };
+    uint32_t next_id = 1;
+    uint32_t ranges_total = 0;
+    uint64_t bytes = 0;
+    int r = -1;
+    int i;
+
+    memset(&nets, 0x00, sizeof(nets));
+    memset(&ranges, 0x00, sizeof(ranges));
+
+    HashListTable *ht = HashListTableInit(4096, IPOnlySetHashFunc,
+            IPOnlySetCompareFunc, IPOnlySetFreeFunc);
+    if (ht == NULL)
+        return -1;
+
+    for (i = 0; i < 4; i++) {
+        if (trees[i] == NULL)
+            continue;
+        if (IPOnlyCollectNets(trees[i]->head, i < 2 ? 32 : 128, ht,
+                    &next_id, &nets[i]) < 0)
+            goto end;
+    }
+
+    /* copy the unique sets into one aligned block. Set 0 stays empty. */
+    io_ctx->sets_size = ((io_ctx->max_idx / 8 + 1) + 15) & ~15U;
+    io_ctx->sets_cnt = next_id;
+    io_ctx->sets = SCMallocAligned(io_ctx->sets_cnt * io_ctx->sets_size, 16);
+    if (io_ctx->sets == NULL)
+        goto end;
+    memset(io_ctx->sets, 0x00, io_ctx->sets_cnt * io_ctx->sets_size);
+
+    HashListTableBucket *htb = NULL;
+    for (htb = HashListTableGetListHead(ht); htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        const IPOnlySet *set = (IPOnlySet *)HashListTableGetListData(htb);
+        memcpy(io_ctx->sets + (set->id * io_ctx->sets_size), set->array,
+                MIN(set->size, io_ctx->sets_size));
+    }
+    bytes += io_ctx->sets_cnt * io_ctx->sets_size;
+
+    for (i = 0; i < 4; i++) {
+        if (nets[i].cnt == 0)
+            continue;
+
+        qsort(nets[i].nets, nets[i].cnt, sizeof(IPOnlyNet), IPOnlyNetCompare);
+
+        ranges.cnt = 0;
+        if (IPOnlyFlatten(&nets[i], i < 2 ? max_v4 : max_v6, &ranges) < 0)
+            goto end;
+        ranges_total += ranges.cnt;
+
+        switch (i) {
+            case 0:
+            case 1: {
+                IPOnlyLookupV4 *t = (i == 0) ? &io_ctx->lookup_ipv4src :
+                                               &io_ctx->lookup_ipv4dst;
+                if (IPOnlyLookupV4Build(t, &ranges) < 0)
+                    goto end;
+                bytes += t->cnt * 2 * sizeof(uint32_t) + 65537 * sizeof(uint32_t);
+                break;
+            }
+            default: {
+                IPOnlyLookupV6 *t = (i == 2) ? &io_ctx->lookup_ipv6src :
+                                               &io_ctx->lookup_ipv6dst;
+                if (IPOnlyLookupV6Build(t, &ranges) < 0)
+                    goto end;
+                bytes += t->cnt * (2 * sizeof(uint64_t) + sizeof(uint32_t));
+                break;
+            }
+        }
+    }
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogPerf("IP-only engine: %u networks, %u ranges, %u unique rule "
+                "sets of %u bytes, %"PRIu64" bytes in total",
+                nets[0].cnt + nets[1].cnt + nets[2].cnt + nets[3].cnt,
+                ranges_total, io_ctx->sets_cnt - 1, io_ctx->sets_size, bytes);
+    }
+    r = 0;
+end:
+    HashListTableFree(ht);
+    for (i = 0; i < 4; i++) {
+        if (nets[i].nets != NULL)
+            SCFree(nets[i].nets);
+    }
+    if (ranges.ranges != NULL)
+        SCFree(ranges.ranges);
+    return r;
+}
+
+static inline uint32_t IPOnlyLookupV4Find(const IPOnlyLookupV4 *t, uint32_t addr)
+{
+    if (t->cnt == 0)
+        return 0;
+
+    uint32_t lo = t->index[addr >> 16];
+    uint32_t hi = t->index[(addr >> 16) + 1];
+
+    /* last range starting at or before addr */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (t->start[mid] <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return t->set[lo];
+}
+
+static inline uint32_t IPOnlyLookupV6Find(const IPOnlyLookupV6 *t, const uint32_t *addr)
+{
+    if (t->cnt == 0)
+        return 0;
+
+    const uint64_t key[2] = {
+        ((uint64_t)SCNtohl(addr[0]) << 32) | SCNtohl(addr[1]),
+        ((uint64_t)SCNtohl(addr[2]) << 32) | SCNtohl(addr[3]) };
+    uint32_t lo = 0;
+    uint32_t hi = t->cnt - 1;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (IPOnlyAddrCmp(&t->start[mid * 2], key) <= 0)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return t->set[lo];
+}
+
+/** \internal
+ *  \brief run the remaining checks of an IP-only sig and alert */
+static inline void IPOnlyMatchSig(ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
+                                  const Signature *cs, Packet *p)
+{
+    Signature *s = (Signature *)cs;
+
+    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+
+    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
+        SCLogDebug("proto didn't match");
+        return;
+    }
+
+    /* check the source & dst port in the sig */
+    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
+        if (!(s->flags & SIG_FLAG_DP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
+            if (dport == NULL) {
+                SCLogDebug("dport didn't match.");
+                return;
+            }
+        }
+        if (!(s->flags & SIG_FLAG_SP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
+            if (sport == NULL) {
+                SCLogDebug("sport didn't match.");
+                return;
+            }
+        }
+    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
+        SCLogDebug("port-less protocol and sig needs ports");
+        return;
+    }
+
+    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
+        return;
+    }
+
+    SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+               s->num, s->id, s->msg);
+
+    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
+        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
+        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
+
+        SCLogDebug("running match functions, sm %p", smd);
+
+        if (smd != NULL) {
+            while (1) {
+                KEYWORD_PROFILING_START;
+                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
+                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
+                if (smd->is_last)
+                    break;
+                smd++;
+            }
+        }
+    }
+    if (!(s->flags & SIG_FLAG_NOALERT)) {
+        if (s->action & ACTION_DROP)
+            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
+        else
+            PacketAlertAppend(det_ctx, s, p, 0, 0);
+    } else {
+        /* apply actions for noalert/rule suppressed as well */
+        DetectSignatureApplyActions(p, s, 0);
+    }
+}
+
 /**
  * \brief Match a packet against the IP Only detection engine contexts
  *
  * \param de_ctx Pointer to the current detection engine
  * \param io_ctx Pointer to the current ip only detection engine
- * \param io_ctx Pointer to the current ip only thread detection engine
  * \param p Pointer to the Packet to match against
  */
 void IPOnlyMatchPacket(ThreadVars *tv,
                        const DetectEngineCtx *de_ctx,
                        DetectEngineThreadCtx *det_ctx,
-                       const DetectEngineIPOnlyCtx *io_ctx,
-                       DetectEngineIPOnlyThreadCtx *io_tctx, Packet *p)
+                       const DetectEngineIPOnlyCtx *io_ctx, Packet *p)
 {
-    SigNumArray *src = NULL;
-    SigNumArray *dst = NULL;
-    void *user_data_src = NULL, *user_data_dst = NULL;
+    uint32_t src_set = 0, dst_set = 0;
 
     if (p->src.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
-                                              io_ctx->tree_ipv4src, &user_data_src);
+        src_set = IPOnlyLookupV4Find(&io_ctx->lookup_ipv4src,
+                SCNtohl(GET_IPV4_SRC_ADDR_U32(p)));
     } else if (p->src.family == AF_INET6) {
-        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
-                                              io_ctx->tree_ipv6src, &user_data_src);
+        src_set = IPOnlyLookupV6Find(&io_ctx->lookup_ipv6src,
+                GET_IPV6_SRC_ADDR(p));
     }
+    if (src_set == 0)
+        return;
 
     if (p->dst.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
-                                              io_ctx->tree_ipv4dst, &user_data_dst);
+        dst_set = IPOnlyLookupV4Find(&io_ctx->lookup_ipv4dst,
+                SCNtohl(GET_IPV4_DST_ADDR_U32(p)));
     } else if (p->dst.family == AF_INET6) {
-        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
-                                              io_ctx->tree_ipv6dst, &user_data_dst);
+        dst_set = IPOnlyLookupV6Find(&io_ctx->lookup_ipv6dst,
+                GET_IPV6_DST_ADDR(p));
     }
-
-    src = user_data_src;
-    dst = user_data_dst;
-
-    if (src == NULL || dst == NULL)
+    if (dst_set == 0)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
-
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
-
-        /* We have to move the logic of the signature checking
-         * to the main detect loop, in order to apply the
-         * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
-
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
-
-                    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-                    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-
-                    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
-                        SCLogDebug("proto didn't match");
-                        continue;
-                    }
-
-                    /* check the source & dst port in the sig */
-                    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
-                        if (!(s->flags & SIG_FLAG_DP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
-                            if (dport == NULL) {
-                                SCLogDebug("dport didn't match.");
-                                continue;
-                            }
-                        }
-                        if (!(s->flags & SIG_FLAG_SP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
-                            if (sport == NULL) {
-                                SCLogDebug("sport didn't match.");
-                                continue;
-                            }
-                        }
-                    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
-                        SCLogDebug("port-less protocol and sig needs ports");
-                        continue;
-                    }
-
-                    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
-                        continue;
-                    }
+    const uint8_t *src = io_ctx->sets + (src_set * io_ctx->sets_size);
+    const uint8_t *dst = io_ctx->sets + (dst_set * io_ctx->sets_size);
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
-
-                    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
-                        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
-
-                        SCLogDebug("running match functions, sm %p", smd);
-
-                        if (smd != NULL) {
-                            while (1) {
-                                KEYWORD_PROFILING_START;
-                                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
-                                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
-                                if (smd->is_last)
-                                    break;
-                                smd++;
-                            }
-                        }
-                    }
-                    if (!(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0, 0);
-                    } else {
-                        /* apply actions for noalert/rule suppressed as well */
-                        DetectSignatureApplyActions(p, s, 0);
-                    }
-                }
+    /* AND the sets 16 bytes at a time, skipping empty blocks. The sets
+     * are 16 byte aligned and padded. We have to move the logic of the
+     * signature checking to the main detect loop, in order to apply the
+     * priority of actions (pass, drop, reject, alert) */
+    uint32_t u;
+    for (u = 0; u < io_ctx->sets_size; u += 16) {
+        uint8_t block[16];
+#ifdef __SSE2__
+        __m128i r = _mm_and_si128(_mm_load_si128((const __m128i *)(src + u)),
+                                  _mm_load_si128((const __m128i *)(dst + u)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128())) == 0xFFFF)
+            continue;
+        _mm_storeu_si128((__m128i *)block, r);
+#else
+        uint64_t w[4];
+        memcpy(w, src + u, 16);
+        memcpy(w + 2, dst + u, 16);
+        w[0] &= w[2];
+        w[1] &= w[3];
+        if ((w[0] | w[1]) == 0)
+            continue;
+        memcpy(block, w, 16);
+#endif
+        uint32_t b;
+        for (b = 0; b < 16; b++) {
+            uint32_t bits = block[b];
+            while (bits != 0) {
+                uint32_t i = __builtin_ctz(bits);
+                bits &= bits - 1;
+
+                const Signature *s = de_ctx->sig_array[(u + b) * 8 + i];
+                IPOnlyMatchSig(tv, det_ctx, s, p);
             }
         }
     }
@@ -1508,6 +2011,11 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
         SCFree(tmpaux);
     }
 
+    if (IPOnlyLookupBuild(de_ctx, &de_ctx->io_ctx) < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to build IP-only lookup tables");
+        exit(EXIT_FAILURE);
+    }
+
     /* print all the trees: for debuggin it might print too much info
     SCLogDebug("Radix tree src ipv4:");
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv4src);
@@ -1521,6 +2029,16 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv6dst);
     SCLogDebug("__________________");
     */
+
+    /* the lookup tables hold all we need from the trees now */
+    SCRadixReleaseRadixTree((de_ctx->io_ctx).tree_ipv4src);
+    SCRadixReleaseRadixTree((de_ctx->io_ctx).tree_ipv4dst);
+    SCRadixReleaseRadixTree((de_ctx->io_ctx).tree_ipv6src);
+    SCRadixReleaseRadixTree((de_ctx->io_ctx).tree_ipv6dst);
+    (de_ctx->io_ctx).tree_ipv4src = NULL;
+    (de_ctx->io_ctx).tree_ipv4dst = NULL;
+    (de_ctx->io_ctx).tree_ipv6src = NULL;
+    (de_ctx->io_ctx).tree_ipv6dst = NULL;
 }
 
 /**
@@ -2252,6 +2770,48 @@ static int IPOnlyTestSig17(void)
     return result;
 }
 
+/**
+ * \brief Unittest for the flattened lookup tables: nested and negated
+ *        netblocks for both IPv4 and IPv6.
+ */
+static int IPOnlyTestSig18(void)
+{
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+
+    uint8_t numpkts = 5;
+    uint8_t numsigs = 4;
+
+    Packet *p[5];
+
+    p[0] = UTHBuildPacketSrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "10.0.0.1", "192.168.1.1");
+    p[1] = UTHBuildPacketSrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "10.1.0.1", "192.168.1.1");
+    p[2] = UTHBuildPacketSrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "10.1.2.1", "192.168.1.1");
+    p[3] = UTHBuildPacketIPV6SrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "2001:db8::1", "3ffe::1");
+    p[4] = UTHBuildPacketIPV6SrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "2001:db8:1::1", "3ffe:1::1");
+
+    const char *sigs[numsigs];
+    sigs[0]= "alert tcp [10.0.0.0/8,!10.1.2.0/24] any -> any any (msg:\"Testing src ip (sid 1)\"; sid:1;)";
+    sigs[1]= "alert tcp 10.1.0.0/16 any -> 192.168.0.0/16 any (msg:\"Testing src ip (sid 2)\"; sid:2;)";
+    sigs[2]= "alert tcp [2001:db8::/32,!2001:db8:1::/48] any -> any any (msg:\"Testing src ip (sid 3)\"; sid:3;)";
+    sigs[3]= "alert tcp any any -> [3ffe::/16,!3ffe::/32] any (msg:\"Testing dst ip (sid 4)\"; sid:4;)";
+
+    uint32_t sid[4] = { 1, 2, 3, 4 };
+    uint32_t results[5][4] = {
+                              { 1, 0, 0, 0 },
+                              { 1, 1, 0, 0 },
+                              { 0, 1, 0, 0 },
+                              { 0, 0, 1, 0 },
+                              { 0, 0, 0, 1 } };
+
+    int result = UTHGenericTest(p, numpkts, sigs, sid, (uint32_t *) results, numsigs);
+
+    UTHFreePackets(p, numpkts);
+
+    FAIL_IF(result != 1);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void)
@@ -2287,6 +2847,7 @@ void IPOnlyRegisterTests(void)
     UtRegisterTest("IPOnlyTestSig16", IPOnlyTestSig16);
 
     UtRegisterTest("IPOnlyTestSig17", IPOnlyTestSig17);
+    UtRegisterTest("IPOnlyTestSig18", IPOnlyTestSig18);
 #endif
 
     return;
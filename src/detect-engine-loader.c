@@ -372,10 +372,10 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     gettimeofday(&de_ctx->last_reload, NULL);
     if (RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS) {
         if (rule_engine_analysis_set) {
-            CleanupRuleAnalyzer();
+            CleanupRuleAnalyzer(de_ctx);
         }
         if (fp_engine_analysis_set) {
-            CleanupFPAnalyzer();
+            CleanupFPAnalyzer(de_ctx);
         }
     }
 
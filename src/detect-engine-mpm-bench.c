@@ -0,0 +1,743 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Benchmark of the mpm and spm backends against the patterns of a
+ * ruleset (--mpm-bench).
+ *
+ * While the ruleset is built, the fast patterns are collected per buffer
+ * type, using the fast pattern selection of the detection engine. All
+ * content patterns are collected for the spm backends. Then for every
+ * registered mpm backend and every buffer type an mpm ctx is built with
+ * those patterns and run over the payloads of a pcap, a file or a
+ * directory of files. Same for the spm backends and the contents.
+ *
+ * The payloads are the packet payloads as decoded, no stream reassembly
+ * or app-layer parsing is done. The same payloads are used for all
+ * buffer types.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-mpm-bench.h"
+#include "detect-content.h"
+
+#include "decode.h"
+#include "packet-queue.h"
+#include "source-pcap-file-helper.h"
+
+#include "util-mpm.h"
+#include "util-spm.h"
+#include "util-prefilter.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+/** scan the payloads until at least this many bytes are scanned */
+#define MPM_BENCH_MIN_BYTES         (64 * 1024 * 1024)
+#define MPM_BENCH_MAX_PASSES        1000
+/** number of contents used for the spm backends, every content is
+ *  scanned for in every payload */
+#define MPM_BENCH_SPM_MAX_PATTERNS  1000
+
+typedef struct MpmBenchPattern_ {
+    const Signature *s;
+    const DetectContentData *cd;
+} MpmBenchPattern;
+
+typedef struct MpmBenchBuffer_ {
+    uint32_t cnt;
+    uint32_t size;
+    MpmBenchPattern *patterns;
+} MpmBenchBuffer;
+
+typedef struct MpmBenchRules_ {
+    /* fast patterns per buffer type, indexed by sm_list */
+    MpmBenchBuffer *buffers;
+    uint32_t buffers_cnt;
+    /* contents of all lists, for the spm backends */
+    MpmBenchBuffer contents;
+} MpmBenchRules;
+
+typedef struct MpmBenchPayload_ {
+    uint8_t *buf;
+    uint32_t len;
+} MpmBenchPayload;
+
+typedef struct MpmBenchCorpus_ {
+    MpmBenchPayload *payloads;
+    uint32_t cnt;
+    uint32_t size;
+    uint64_t bytes;
+} MpmBenchCorpus;
+
+typedef struct MpmBenchResult_ {
+    uint64_t build_usec;
+    uint32_t memory;
+    uint64_t bytes;
+    uint64_t usec;
+    uint64_t matches;
+    uint64_t sids;
+} MpmBenchResult;
+
+/* patterns collected while the ruleset was built */
+static MpmBenchRules g_mpm_bench_rules;
+
+static uint64_t MpmBenchNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int MpmBenchBufferAdd(MpmBenchBuffer *b, const Signature *s,
+        const DetectContentData *cd)
+{
+    if (b->cnt == b->size) {
+        uint32_t size = b->size ? b->size * 2 : 16;
+        MpmBenchPattern *ptr = SCRealloc(b->patterns, size * sizeof(*ptr));
+        if (ptr == NULL)
+            return -1;
+        b->patterns = ptr;
+        b->size = size;
+    }
+    b->patterns[b->cnt].s = s;
+    b->patterns[b->cnt].cd = cd;
+    b->cnt++;
+    return 0;
+}
+
+static void MpmBenchRulesFree(MpmBenchRules *r)
+{
+    if (r->buffers != NULL) {
+        for (uint32_t i = 0; i < r->buffers_cnt; i++) {
+            if (r->buffers[i].patterns != NULL)
+                SCFree(r->buffers[i].patterns);
+        }
+        SCFree(r->buffers);
+    }
+    if (r->contents.patterns != NULL)
+        SCFree(r->contents.patterns);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * \internal
+ * \brief collect the fast patterns and contents of all signatures
+ *
+ * Needs the fast patterns to be selected (DetectSetFastPatternAndItsId)
+ * and the signature init data to still be around.
+ */
+static int MpmBenchRulesCollect(const DetectEngineCtx *de_ctx, MpmBenchRules *r)
+{
+    memset(r, 0, sizeof(*r));
+
+    r->buffers_cnt = MAX((uint32_t)DETECT_SM_LIST_MAX, de_ctx->buffer_type_map_elements);
+    r->buffers = SCCalloc(r->buffers_cnt, sizeof(MpmBenchBuffer));
+    if (r->buffers == NULL)
+        return -1;
+
+    for (const Signature *s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->init_data == NULL)
+            continue;
+
+        if (s->init_data->mpm_sm != NULL) {
+            int list = SigMatchListSMBelongsTo(s, s->init_data->mpm_sm);
+            const DetectContentData *cd =
+                (const DetectContentData *)s->init_data->mpm_sm->ctx;
+
+            /* skipped by the engine as well, see MpmStoreSetup */
+            if (list >= 0 && (uint32_t)list < r->buffers_cnt &&
+                !((cd->flags & DETECT_CONTENT_NEGATED) &&
+                  !(DETECT_CONTENT_MPM_IS_CONCLUSIVE(cd))))
+            {
+                if (MpmBenchBufferAdd(&r->buffers[list], s, cd) != 0)
+                    goto error;
+            }
+        }
+
+        for (uint32_t i = 0; i < s->init_data->smlists_array_size; i++) {
+            for (const SigMatch *sm = s->init_data->smlists[i];
+                    sm != NULL; sm = sm->next)
+            {
+                if (sm->type != DETECT_CONTENT)
+                    continue;
+                if (r->contents.cnt >= MPM_BENCH_SPM_MAX_PATTERNS)
+                    continue;
+                if (MpmBenchBufferAdd(&r->contents, s,
+                            (const DetectContentData *)sm->ctx) != 0)
+                    goto error;
+            }
+        }
+    }
+    return 0;
+
+error:
+    MpmBenchRulesFree(r);
+    return -1;
+}
+
+/**
+ * \brief collect the patterns of a ruleset that is being built
+ *
+ * Called from SigGroupBuild in the mpm-bench runmode, after the fast
+ * patterns have been selected.
+ */
+void MpmBenchCollect(const DetectEngineCtx *de_ctx)
+{
+    MpmBenchRulesFree(&g_mpm_bench_rules);
+    if (MpmBenchRulesCollect(de_ctx, &g_mpm_bench_rules) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to collect patterns for mpm-bench");
+    }
+}
+
+static int MpmBenchCorpusAdd(MpmBenchCorpus *c, const uint8_t *buf, uint32_t len)
+{
+    if (len == 0)
+        return 0;
+
+    if (c->cnt == c->size) {
+        uint32_t size = c->size ? c->size * 2 : 1024;
+        MpmBenchPayload *ptr = SCRealloc(c->payloads, size * sizeof(*ptr));
+        if (ptr == NULL)
+            return -1;
+        c->payloads = ptr;
+        c->size = size;
+    }
+
+    MpmBenchPayload *p = &c->payloads[c->cnt];
+    p->buf = SCMalloc(len);
+    if (p->buf == NULL)
+        return -1;
+    memcpy(p->buf, buf, len);
+    p->len = len;
+
+    c->cnt++;
+    c->bytes += len;
+    return 0;
+}
+
+static void MpmBenchCorpusFree(MpmBenchCorpus *c)
+{
+    for (uint32_t i = 0; i < c->cnt; i++) {
+        SCFree(c->payloads[i].buf);
+    }
+    if (c->payloads != NULL)
+        SCFree(c->payloads);
+    memset(c, 0, sizeof(*c));
+}
+
+/**
+ * \internal
+ * \brief add the decoded payloads of a pcap
+ *
+ * A pcap with a link type we can't decode is an error: scanning its
+ * raw bytes instead would benchmark something else.
+ *
+ * \retval 0 ok
+ * \retval -1 not a pcap
+ * \retval -2 error
+ */
+static int MpmBenchCorpusLoadPcap(MpmBenchCorpus *c, const char *path)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    pcap_t *pcap = pcap_open_offline(path, errbuf);
+    if (pcap == NULL)
+        return -1;
+
+    Decoder decoder;
+    if (ValidateLinkType(pcap_datalink(pcap), &decoder) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "%s: unsupported link type %d",
+                path, pcap_datalink(pcap));
+        pcap_close(pcap);
+        return -2;
+    }
+
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(&tv);
+    if (dtv == NULL) {
+        pcap_close(pcap);
+        return -2;
+    }
+    DecodeRegisterPerfCounters(dtv, &tv);
+    StatsSetupPrivate(&tv);
+    PacketQueue pq;
+    memset(&pq, 0, sizeof(pq));
+
+    int ret = 0;
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    while (ret == 0 && pcap_next_ex(pcap, &hdr, &data) == 1) {
+        if (hdr->caplen > UINT16_MAX)
+            continue;
+
+        Packet *p = PacketGetFromAlloc();
+        if (p == NULL) {
+            ret = -2;
+            break;
+        }
+        if (PacketCopyData(p, (uint8_t *)data, hdr->caplen) == 0) {
+            (void)decoder(&tv, dtv, p, GET_PKT_DATA(p), (uint16_t)GET_PKT_LEN(p), &pq);
+            if (MpmBenchCorpusAdd(c, p->payload, p->payload_len) != 0)
+                ret = -2;
+        }
+        /* tunneled and reassembled packets */
+        Packet *extra_p;
+        while ((extra_p = PacketDequeue(&pq)) != NULL) {
+            if (MpmBenchCorpusAdd(c, extra_p->payload, extra_p->payload_len) != 0)
+                ret = -2;
+            PacketFree(extra_p);
+        }
+        PacketFree(p);
+    }
+
+    StatsThreadCleanup(&tv);
+    DecodeThreadVarsFree(&tv, dtv);
+    pcap_close(pcap);
+    return ret;
+}
+
+/**
+ * \internal
+ * \brief add a file as a single payload
+ */
+static int MpmBenchCorpusLoadFile(MpmBenchCorpus *c, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = -1;
+    uint8_t *buf = NULL;
+    if (fseek(fp, 0, SEEK_END) != 0)
+        goto end;
+    long len = ftell(fp);
+    if (len < 0 || len > UINT32_MAX || fseek(fp, 0, SEEK_SET) != 0)
+        goto end;
+    if (len == 0) {
+        ret = 0;
+        goto end;
+    }
+    buf = SCMalloc(len);
+    if (buf == NULL)
+        goto end;
+    if (fread(buf, 1, len, fp) != (size_t)len)
+        goto end;
+    ret = MpmBenchCorpusAdd(c, buf, (uint32_t)len);
+end:
+    if (buf != NULL)
+        SCFree(buf);
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * \internal
+ * \brief load payloads from a pcap or another file
+ *
+ * Files that are not a pcap are added as a single payload.
+ */
+static int MpmBenchCorpusLoadAny(MpmBenchCorpus *c, const char *path)
+{
+    int r = MpmBenchCorpusLoadPcap(c, path);
+    if (r == -1)
+        return MpmBenchCorpusLoadFile(c, path);
+    return r == 0 ? 0 : -1;
+}
+
+/**
+ * \internal
+ * \brief load payloads from a pcap, a file or a directory of files
+ */
+static int MpmBenchCorpusLoad(MpmBenchCorpus *c, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: %s", path, strerror(errno));
+            return -1;
+        }
+        struct dirent *dent;
+        while ((dent = readdir(dir)) != NULL) {
+            char file[PATH_MAX];
+            if (dent->d_name[0] == '.')
+                continue;
+            snprintf(file, sizeof(file), "%s/%s", path, dent->d_name);
+            if (stat(file, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            if (MpmBenchCorpusLoadAny(c, file) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        return 0;
+    }
+
+    return MpmBenchCorpusLoadAny(c, path);
+}
+
+/**
+ * \internal
+ * \brief build a mpm ctx for a buffer's patterns and scan the corpus
+ *
+ * \param passes number of times the corpus is scanned
+ */
+static int MpmBenchMpm(const MpmBenchBuffer *b, uint16_t matcher,
+        const MpmBenchCorpus *c, uint32_t passes, MpmBenchResult *res)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(res, 0, sizeof(*res));
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(&mpm_thread_ctx, 0, sizeof(mpm_thread_ctx));
+    memset(&pmq, 0, sizeof(pmq));
+
+    MpmInitCtx(&mpm_ctx, matcher);
+    for (uint32_t i = 0; i < b->cnt; i++) {
+        const DetectContentData *cd = b->patterns[i].cd;
+        PopulateMpmHelperAddPattern(&mpm_ctx, cd, b->patterns[i].s, 0,
+                (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP));
+    }
+
+    uint64_t start = MpmBenchNow();
+    if (mpm_table[matcher].Prepare(&mpm_ctx) != 0) {
+        mpm_table[matcher].DestroyCtx(&mpm_ctx);
+        return -1;
+    }
+    res->build_usec = MpmBenchNow() - start;
+    res->memory = mpm_ctx.memory_size;
+
+    MpmInitThreadCtx(&mpm_thread_ctx, matcher);
+    if (PmqSetup(&pmq) != 0) {
+        mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        mpm_table[matcher].DestroyCtx(&mpm_ctx);
+        return -1;
+    }
+
+    start = MpmBenchNow();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        for (uint32_t i = 0; i < c->cnt; i++) {
+            const MpmBenchPayload *p = &c->payloads[i];
+            res->matches += mpm_table[matcher].Search(&mpm_ctx, &mpm_thread_ctx,
+                    &pmq, p->buf, p->len);
+            res->sids += pmq.rule_id_array_cnt;
+            PmqReset(&pmq);
+        }
+    }
+    res->usec = MpmBenchNow() - start;
+    res->bytes = c->bytes * passes;
+
+    PmqFree(&pmq);
+    mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    mpm_table[matcher].DestroyCtx(&mpm_ctx);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief build a spm ctx per content and scan the corpus for each
+ */
+static int MpmBenchSpm(const MpmBenchBuffer *b, uint16_t matcher,
+        const MpmBenchCorpus *c, MpmBenchResult *res)
+{
+    int ret = -1;
+    SpmCtx **ctxs = NULL;
+    SpmThreadCtx *thread_ctx = NULL;
+
+    memset(res, 0, sizeof(*res));
+
+    SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+    if (global_thread_ctx == NULL)
+        return -1;
+    ctxs = SCCalloc(b->cnt, sizeof(SpmCtx *));
+    if (ctxs == NULL)
+        goto end;
+
+    uint64_t start = MpmBenchNow();
+    for (uint32_t i = 0; i < b->cnt; i++) {
+        const DetectContentData *cd = b->patterns[i].cd;
+        ctxs[i] = SpmInitCtx(cd->content, cd->content_len,
+                (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0, global_thread_ctx);
+        if (ctxs[i] == NULL)
+            goto end;
+    }
+    res->build_usec = MpmBenchNow() - start;
+
+    thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+    if (thread_ctx == NULL)
+        goto end;
+
+    start = MpmBenchNow();
+    for (uint32_t i = 0; i < c->cnt; i++) {
+        const MpmBenchPayload *p = &c->payloads[i];
+        for (uint32_t x = 0; x < b->cnt; x++) {
+            if (SpmScan(ctxs[x], thread_ctx, p->buf, p->len) != NULL)
+                res->matches++;
+        }
+    }
+    res->usec = MpmBenchNow() - start;
+    res->bytes = c->bytes * b->cnt;
+    ret = 0;
+
+end:
+    if (thread_ctx != NULL)
+        SpmDestroyThreadCtx(thread_ctx);
+    if (ctxs != NULL) {
+        for (uint32_t i = 0; i < b->cnt; i++) {
+            if (ctxs[i] != NULL)
+                SpmDestroyCtx(ctxs[i]);
+        }
+        SCFree(ctxs);
+    }
+    SpmDestroyGlobalThreadCtx(global_thread_ctx);
+    return ret;
+}
+
+static void MpmBenchPrintHeader(void)
+{
+    printf("  %-10s %12s %12s %10s %14s %14s\n",
+            "algo", "build (ms)", "memory", "MB/s", "matches", "sids");
+}
+
+static void MpmBenchPrintResult(const char *name, const MpmBenchResult *res, int spm)
+{
+    const double mbs = res->usec ? (double)res->bytes / (double)res->usec : 0;
+
+    if (spm) {
+        printf("  %-10s %12.3f %12s %10.1f %14"PRIu64" %14s\n", name,
+                (double)res->build_usec / 1000, "-", mbs, res->matches, "-");
+    } else {
+        printf("  %-10s %12.3f %12u %10.1f %14"PRIu64" %14"PRIu64"\n", name,
+                (double)res->build_usec / 1000, res->memory, mbs,
+                res->matches, res->sids);
+    }
+}
+
+/**
+ * \brief run all mpm and spm backends against the collected patterns
+ *
+ * \param de_ctx detect engine ctx the patterns were collected from
+ * \param path pcap, file or directory with the payloads to scan
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int MpmBenchRun(const DetectEngineCtx *de_ctx, const char *path)
+{
+    MpmBenchCorpus corpus;
+    MpmBenchResult res;
+    MpmBenchRules *r = &g_mpm_bench_rules;
+    int ret = -1;
+
+    memset(&corpus, 0, sizeof(corpus));
+
+    if (path == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "mpm-bench needs payloads to scan, "
+                "pass a pcap, a file or a directory with -r");
+        goto end;
+    }
+    if (r->buffers == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "mpm-bench: no patterns collected");
+        goto end;
+    }
+    if (MpmBenchCorpusLoad(&corpus, path) != 0)
+        goto end;
+    if (corpus.cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "mpm-bench: no payloads in %s", path);
+        goto end;
+    }
+
+    uint32_t passes = MPM_BENCH_MIN_BYTES / corpus.bytes;
+    passes = MAX(1, MIN(passes, MPM_BENCH_MAX_PASSES));
+
+    printf("mpm-bench: %u payloads, %"PRIu64" bytes from %s, %u passes\n",
+            corpus.cnt, corpus.bytes, path, passes);
+
+    for (uint32_t list = 0; list < r->buffers_cnt; list++) {
+        const MpmBenchBuffer *b = &r->buffers[list];
+        if (b->cnt == 0)
+            continue;
+
+        const char *name = NULL;
+        if (list < DETECT_SM_LIST_MAX)
+            name = DetectSigmatchListEnumToString(list);
+        else
+            name = DetectBufferTypeGetNameById(de_ctx, list);
+
+        printf("\nmpm %s: %u patterns\n", name ? name : "unknown", b->cnt);
+        MpmBenchPrintHeader();
+
+        for (uint16_t m = 0; m < MPM_TABLE_SIZE; m++) {
+            if (mpm_table[m].name == NULL || mpm_table[m].Search == NULL)
+                continue;
+            if (MpmBenchMpm(b, m, &corpus, passes, &res) != 0) {
+                printf("  %-10s failed to build\n", mpm_table[m].name);
+                continue;
+            }
+            MpmBenchPrintResult(mpm_table[m].name, &res, 0);
+        }
+    }
+
+    if (r->contents.cnt > 0) {
+        printf("\nspm content: %u patterns%s\n", r->contents.cnt,
+                r->contents.cnt == MPM_BENCH_SPM_MAX_PATTERNS ? " (capped)" : "");
+        MpmBenchPrintHeader();
+
+        for (uint16_t m = 0; m < SPM_TABLE_SIZE; m++) {
+            if (spm_table[m].name == NULL)
+                continue;
+            if (MpmBenchSpm(&r->contents, m, &corpus, &res) != 0) {
+                printf("  %-10s failed to build\n", spm_table[m].name);
+                continue;
+            }
+            MpmBenchPrintResult(spm_table[m].name, &res, 1);
+        }
+    }
+    ret = 0;
+
+end:
+    MpmBenchCorpusFree(&corpus);
+    MpmBenchRulesFree(r);
+    return ret;
+}
+
+/* UNITTESTS */
+#ifdef UNITTESTS
+
+/** \test collect patterns and run them through all backends */
+static int MpmBenchTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"abc\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"DEF\"; nocase; fast_pattern; content:\"xyz\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"/index\"; http_uri; sid:3;)"));
+
+    /* what SigGroupBuild does up to the point it calls MpmBenchCollect */
+    uint32_t num = 0;
+    for (Signature *s = de_ctx->sig_list; s != NULL; s = s->next)
+        s->num = num++;
+    FAIL_IF(DetectSetFastPatternAndItsId(de_ctx) < 0);
+
+    MpmBenchRules rules;
+    FAIL_IF(MpmBenchRulesCollect(de_ctx, &rules) != 0);
+    FAIL_IF(rules.buffers[DETECT_SM_LIST_PMATCH].cnt != 2);
+    int uri = DetectBufferTypeGetByName("http_uri");
+    FAIL_IF(uri < 0);
+    FAIL_IF(rules.buffers[uri].cnt != 1);
+    FAIL_IF(rules.contents.cnt != 4);
+
+    MpmBenchCorpus corpus;
+    memset(&corpus, 0, sizeof(corpus));
+    FAIL_IF(MpmBenchCorpusAdd(&corpus, (uint8_t *)"GET /index abc def", 18) != 0);
+    FAIL_IF(MpmBenchCorpusAdd(&corpus, (uint8_t *)"nothing", 7) != 0);
+    FAIL_IF(MpmBenchCorpusAdd(&corpus, (uint8_t *)"", 0) != 0);
+    FAIL_IF(corpus.cnt != 2);
+
+    MpmBenchResult res;
+    for (uint16_t m = 0; m < MPM_TABLE_SIZE; m++) {
+        if (mpm_table[m].name == NULL || mpm_table[m].Search == NULL)
+            continue;
+        FAIL_IF(MpmBenchMpm(&rules.buffers[DETECT_SM_LIST_PMATCH], m,
+                    &corpus, 2, &res) != 0);
+        /* sids 1 and 2 match the first payload, in both passes */
+        FAIL_IF(res.sids != 4);
+        FAIL_IF(res.bytes != 50);
+
+        FAIL_IF(MpmBenchMpm(&rules.buffers[uri], m, &corpus, 1, &res) != 0);
+        FAIL_IF(res.sids != 1);
+    }
+
+    for (uint16_t m = 0; m < SPM_TABLE_SIZE; m++) {
+        if (spm_table[m].name == NULL)
+            continue;
+        FAIL_IF(MpmBenchSpm(&rules.contents, m, &corpus, &res) != 0);
+        /* abc, def and /index, but not xyz */
+        FAIL_IF(res.matches != 3);
+        FAIL_IF(res.bytes != 4 * 25);
+    }
+
+    MpmBenchCorpusFree(&corpus);
+    MpmBenchRulesFree(&rules);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test a pcap with a link type we can't decode is rejected, not
+ *        scanned as a raw file */
+static int MpmBenchTest02(void)
+{
+    char filename[] = "/tmp/suricata-mpm-bench-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+    close(fd);
+
+    /* 802.11 radiotap */
+    pcap_t *pcap = pcap_open_dead(127, 65535);
+    FAIL_IF_NULL(pcap);
+    pcap_dumper_t *dumper = pcap_dump_open(pcap, filename);
+    FAIL_IF_NULL(dumper);
+    uint8_t data[64];
+    memset(data, 'a', sizeof(data));
+    struct pcap_pkthdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.caplen = hdr.len = sizeof(data);
+    pcap_dump((u_char *)dumper, &hdr, data);
+    pcap_dump_close(dumper);
+    pcap_close(pcap);
+
+    MpmBenchCorpus corpus;
+    memset(&corpus, 0, sizeof(corpus));
+    FAIL_IF(MpmBenchCorpusLoad(&corpus, filename) != -1);
+    FAIL_IF(corpus.cnt != 0);
+
+    MpmBenchCorpusFree(&corpus);
+    unlink(filename);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MpmBenchRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MpmBenchTest01", MpmBenchTest01);
+    UtRegisterTest("MpmBenchTest02", MpmBenchTest02);
+#endif /* UNITTESTS */
+}
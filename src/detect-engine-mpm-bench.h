@@ -0,0 +1,33 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Benchmark of the mpm and spm backends against the patterns of a
+ * ruleset (--mpm-bench).
+ */
+
+#ifndef __DETECT_ENGINE_MPM_BENCH_H__
+#define __DETECT_ENGINE_MPM_BENCH_H__
+
+void MpmBenchCollect(const DetectEngineCtx *de_ctx);
+int MpmBenchRun(const DetectEngineCtx *de_ctx, const char *path);
+
+void MpmBenchRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_MPM_BENCH_H__ */
@@ -72,6 +72,9 @@
 #include "util-print.h"
 #include "util-validate.h"
 
+#include "tm-threads.h"
+#include "runmodes.h"
+
 const char *builtin_mpms[] = {
     "toserver TCP packet",
     "toclient TCP packet",
@@ -293,11 +296,41 @@ void DetectMpmSetupAppMpms(DetectEngineCtx *de_ctx)
     }
 }
 
+/** \internal
+ *  \brief list of mpm contexts that still need to be prepared */
+typedef struct MpmPrepareQueue_ {
+    MpmCtx **ctxs;
+    uint32_t cnt;
+    uint32_t size;
+
+    /** next ctx to hand out to a worker */
+    SC_ATOMIC_DECLARE(uint32_t, next);
+    /** set if a Prepare failed */
+    SC_ATOMIC_DECLARE(int, failed);
+} MpmPrepareQueue;
+
+static int MpmPrepareQueueAdd(MpmPrepareQueue *q, MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx == NULL)
+        return 0;
+
+    if (q->cnt == q->size) {
+        uint32_t new_size = q->size ? q->size * 2 : 64;
+        MpmCtx **ptr = SCRealloc(q->ctxs, new_size * sizeof(MpmCtx *));
+        if (ptr == NULL)
+            return -1;
+        q->ctxs = ptr;
+        q->size = new_size;
+    }
+    q->ctxs[q->cnt++] = mpm_ctx;
+    return 0;
+}
+
 /**
- *  \brief initialize mpm contexts for applayer buffers that are in
+ *  \brief queue mpm contexts for applayer buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmQueueAppMpms(DetectEngineCtx *de_ctx, MpmPrepareQueue *q)
 {
     int r = 0;
     DetectMpmAppLayerKeyword *am = de_ctx->app_mpms;
@@ -307,11 +340,7 @@ int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
         if (am->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
         {
             MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, am->sgh_mpm_context, dir);
-            if (mpm_ctx != NULL) {
-                if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-                }
-            }
+            r |= MpmPrepareQueueAdd(q, mpm_ctx);
         }
         am++;
     }
@@ -352,55 +381,269 @@ void DetectMpmInitializeBuiltinMpms(DetectEngineCtx *de_ctx)
 }
 
 /**
- *  \brief initialize mpm contexts for builtin buffers that are in
+ *  \brief queue mpm contexts for builtin buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmQueueBuiltinMpms(DetectEngineCtx *de_ctx, MpmPrepareQueue *q)
 {
     int r = 0;
-    MpmCtx *mpm_ctx = NULL;
 
     if (de_ctx->sgh_mpm_context_proto_tcp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_tcp_packet, 0));
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_tcp_packet, 1));
     }
 
     if (de_ctx->sgh_mpm_context_proto_udp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_udp_packet, 0));
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_udp_packet, 1));
     }
 
     if (de_ctx->sgh_mpm_context_proto_other_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_other_packet, 0));
     }
 
     if (de_ctx->sgh_mpm_context_stream != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_stream, 0));
+        r |= MpmPrepareQueueAdd(q, MpmFactoryGetMpmCtxForProfile(de_ctx,
+                    de_ctx->sgh_mpm_context_stream, 1));
+    }
+
+    return r;
+}
+
+/**
+ *  \brief queue the per rule group ("full" mode) mpm contexts of the
+ *         MpmStore hash.
+ */
+static int DetectMpmQueueUniqueMpms(DetectEngineCtx *de_ctx, MpmPrepareQueue *q)
+{
+    int r = 0;
+    HashListTableBucket *htb = NULL;
+
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL)
+            continue;
+        if (ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+            continue;
+        r |= MpmPrepareQueueAdd(q, ms->mpm_ctx);
+    }
+    return r;
+}
+
+/** \internal
+ *  \brief sort so that the largest contexts are handed out first
+ *
+ *  Equal sizes are ordered by address so that duplicates end up next
+ *  to each other. */
+static int MpmPrepareQueueCompare(const void *a, const void *b)
+{
+    const MpmCtx *ma = *(const MpmCtx **)a;
+    const MpmCtx *mb = *(const MpmCtx **)b;
+
+    if (ma->pattern_cnt > mb->pattern_cnt)
+        return -1;
+    else if (ma->pattern_cnt < mb->pattern_cnt)
+        return 1;
+    else if ((uintptr_t)ma < (uintptr_t)mb)
+        return -1;
+    else if ((uintptr_t)ma > (uintptr_t)mb)
+        return 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief sort the queue and remove the duplicate contexts
+ *
+ *  A buffer registered for multiple protocols (e.g. file_data) has one
+ *  app mpm entry per registration, but in shared mode they all use the
+ *  same factory context. Such a context must be queued only once, as two
+ *  workers can't run Prepare on the same context.
+ */
+static void MpmPrepareQueueUnique(MpmPrepareQueue *q)
+{
+    if (q->cnt == 0)
+        return;
+
+    qsort(q->ctxs, q->cnt, sizeof(MpmCtx *), MpmPrepareQueueCompare);
+
+    uint32_t cnt = 1;
+    for (uint32_t i = 1; i < q->cnt; i++) {
+        if (q->ctxs[i] != q->ctxs[cnt - 1])
+            q->ctxs[cnt++] = q->ctxs[i];
+    }
+    q->cnt = cnt;
+}
+
+/** \internal
+ *  \brief build the sorted queue of all contexts to prepare */
+static int MpmPrepareQueueBuild(DetectEngineCtx *de_ctx, MpmPrepareQueue *q)
+{
+    int r = DetectMpmQueueBuiltinMpms(de_ctx, q);
+    r |= DetectMpmQueueAppMpms(de_ctx, q);
+    r |= DetectMpmQueueUniqueMpms(de_ctx, q);
+    if (r != 0)
+        return r;
+
+    MpmPrepareQueueUnique(q);
+    return 0;
+}
+
+/** queue of the prepare that is running. Prepares of multiple engines,
+ *  e.g. tenants loaded by different loaders, take turns: each one
+ *  already uses all build threads. */
+static SCMutex mpm_prepare_lock = SCMUTEX_INITIALIZER;
+static MpmPrepareQueue *mpm_prepare_queue = NULL;
+
+/** \internal
+ *  \brief prepare contexts from the queue until it's empty
+ *
+ *  \param tv thread vars of a prepare thread, NULL for the caller
+ *
+ *  \retval 0 ok
+ *  \retval -1 a Prepare failed or the thread was killed
+ */
+static int MpmPrepareWorker(ThreadVars *tv, MpmPrepareQueue *q)
+{
+    int r = 0;
+
+    while (1) {
+        uint32_t idx = SC_ATOMIC_ADD(q->next, 1) - 1;
+        if (idx >= q->cnt)
+            break;
+        if (tv != NULL && TmThreadsCheckFlag(tv, THV_KILL))
+            return -1;
+
+        MpmCtx *mpm_ctx = q->ctxs[idx];
+        if (mpm_table[mpm_ctx->mpm_type].Prepare != NULL) {
+            r |= mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
         }
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+    }
+    return r ? -1 : 0;
+}
+
+static void *MpmPrepareThread(void *td)
+{
+    ThreadVars *tv = (ThreadVars *)td;
+    MpmPrepareQueue *q = mpm_prepare_queue;
+
+    /* Set the thread name */
+    if (SCSetThreadName(tv->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+    TmThreadsSetFlag(tv, THV_INIT_DONE);
+
+    if (MpmPrepareWorker(tv, q) != 0) {
+        (void)SC_ATOMIC_SET(q->failed, 1);
+    }
+
+    TmThreadsSetFlag(tv, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv, THV_DEINIT);
+    TmThreadsSetFlag(tv, THV_CLOSED);
+    return NULL;
+}
+
+/** \internal
+ *  \brief run the Prepare calls of the queue over nthreads threads
+ *
+ *  The calling thread is one of the workers. If threads can't be
+ *  created the remaining work is done by the threads we do have.
+ *
+ *  \retval threads number of threads that were used
+ */
+static uint32_t MpmPrepareQueueRun(MpmPrepareQueue *q, uint32_t nthreads, int *result)
+{
+    ThreadVars *tvs[nthreads];
+    uint32_t started = 0;
+
+    SCMutexLock(&mpm_prepare_lock);
+    mpm_prepare_queue = q;
+
+    /* thread 0 is the calling thread */
+    for (uint32_t i = 1; i < nthreads; i++) {
+        char name[TM_THREAD_NAME_MAX];
+        snprintf(name, sizeof(name), "%s#%02u", thread_name_mpm_prepare, i);
+
+        ThreadVars *tv = TmThreadCreateMgmtThread(name, MpmPrepareThread, 0);
+        if (tv == NULL || TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "failed to create mpm prepare "
+                    "thread, continuing with %u threads", i);
+            if (tv != NULL)
+                TmThreadKillAndFree(tv);
+            break;
         }
+        tvs[started++] = tv;
+    }
+    if (MpmPrepareWorker(NULL, q) != 0) {
+        (void)SC_ATOMIC_SET(q->failed, 1);
     }
 
-    return r;
+    for (uint32_t i = 0; i < started; i++) {
+        TmThreadWaitForFlag(tvs[i], THV_RUNNING_DONE);
+        TmThreadKillAndFree(tvs[i]);
+    }
+    mpm_prepare_queue = NULL;
+    SCMutexUnlock(&mpm_prepare_lock);
+
+    *result |= SC_ATOMIC_GET(q->failed);
+    return started + 1;
+}
+
+/**
+ *  \brief prepare all mpm contexts of the engine
+ *
+ *  The contexts are independent of each other, so they are handed out
+ *  to de_ctx->build_threads worker threads, largest first.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int DetectMpmPrepareMpms(DetectEngineCtx *de_ctx)
+{
+    MpmPrepareQueue q;
+    memset(&q, 0x00, sizeof(q));
+    SC_ATOMIC_INIT(q.next);
+    SC_ATOMIC_INIT(q.failed);
+
+    int r = MpmPrepareQueueBuild(de_ctx, &q);
+    if (r != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to queue mpm contexts");
+        goto end;
+    }
+    if (q.cnt == 0)
+        goto end;
+
+    uint32_t nthreads = de_ctx->build_threads;
+    if (nthreads == 0)
+        nthreads = 1;
+    if (nthreads > q.cnt)
+        nthreads = q.cnt;
+
+    struct timeval tv_start, tv_end;
+    gettimeofday(&tv_start, NULL);
+
+    nthreads = MpmPrepareQueueRun(&q, nthreads, &r);
+
+    gettimeofday(&tv_end, NULL);
+    uint64_t msecs = ((uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000) +
+        (tv_end.tv_usec / 1000) - (tv_start.tv_usec / 1000);
+    SCLogPerf("prepared %u mpm contexts using %u thread(s) in %"PRIu64" ms",
+            q.cnt, nthreads, msecs);
+
+end:
+    SCFree(q.ctxs);
+    SC_ATOMIC_DESTROY(q.next);
+    SC_ATOMIC_DESTROY(q.failed);
+    return r ? -1 : 0;
 }
 
 /**
@@ -594,10 +837,10 @@ uint32_t PatternStrength(uint8_t *pat, uint16_t patlen)
     return s;
 }
 
-static void PopulateMpmHelperAddPattern(MpmCtx *mpm_ctx,
-                                        const DetectContentData *cd,
-                                        const Signature *s, uint8_t flags,
-                                        int chop)
+void PopulateMpmHelperAddPattern(MpmCtx *mpm_ctx,
+                                 const DetectContentData *cd,
+                                 const Signature *s, uint8_t flags,
+                                 int chop)
 {
     uint16_t pat_offset = cd->offset;
     uint16_t pat_depth = cd->depth;
@@ -1020,6 +1263,143 @@ void MpmStoreFree(DetectEngineCtx *de_ctx)
     return;
 }
 
+/** names and directions of the DetectMpmStreamBuffers and their
+ *  counters. http_server_body registers the file_data buffer. Only its
+ *  http (toclient) engine scans a growing buffer, the smtp and smb
+ *  file_data engines inspect file chunks in block mode. */
+static const struct {
+    const char *name;
+    int direction;  /**< 0 for both */
+    const char *received;
+    const char *scanned;
+} g_mpm_stream_buffers[DETECT_MPM_STREAM_MAX] = {
+    { "stream", 0,
+        "detect.mpm_stream.stream.bytes_received",
+        "detect.mpm_stream.stream.bytes_scanned" },
+    { "http_client_body", SIG_FLAG_TOSERVER,
+        "detect.mpm_stream.http_client_body.bytes_received",
+        "detect.mpm_stream.http_client_body.bytes_scanned" },
+    { "file_data", SIG_FLAG_TOCLIENT,
+        "detect.mpm_stream.file_data.bytes_received",
+        "detect.mpm_stream.file_data.bytes_scanned" },
+};
+
+/** \brief get the DetectMpmStreamBuffers id of a buffer
+ *  \param direction SIG_FLAG_TOSERVER or SIG_FLAG_TOCLIENT
+ *  \retval id or -1 if the buffer doesn't use the streaming mpm in this
+ *          direction */
+int DetectMpmStreamBufferGet(const char *name, const int direction)
+{
+    for (int i = 0; i < DETECT_MPM_STREAM_MAX; i++) {
+        if (strcmp(name, g_mpm_stream_buffers[i].name) == 0) {
+            if (g_mpm_stream_buffers[i].direction != 0 &&
+                g_mpm_stream_buffers[i].direction != direction)
+                return -1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** \brief register the streaming mpm bytes received/scanned counters, if
+ *         detect.mpm-streaming is enabled */
+void DetectMpmStreamRegisterCounters(ThreadVars *tv,
+        uint16_t *received, uint16_t *scanned)
+{
+    int enabled = 0;
+    if (ConfGetBool("detect.mpm-streaming.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    for (int i = 0; i < DETECT_MPM_STREAM_MAX; i++) {
+        received[i] = StatsRegisterCounter(g_mpm_stream_buffers[i].received, tv);
+        scanned[i] = StatsRegisterCounter(g_mpm_stream_buffers[i].scanned, tv);
+    }
+}
+
+/** \brief flush the per packet streaming mpm byte counts to the counters */
+void DetectMpmStreamUpdateCounters(ThreadVars *tv, DetectEngineThreadCtx *det_ctx)
+{
+    for (int i = 0; i < DETECT_MPM_STREAM_MAX; i++) {
+        if (det_ctx->mpm_stream_received[i] > 0) {
+            if (det_ctx->counter_mpm_stream_received[i] != 0)
+                StatsAddUI64(tv, det_ctx->counter_mpm_stream_received[i],
+                        det_ctx->mpm_stream_received[i]);
+            det_ctx->mpm_stream_received[i] = 0;
+        }
+        if (det_ctx->mpm_stream_scanned[i] > 0) {
+            if (det_ctx->counter_mpm_stream_scanned[i] != 0)
+                StatsAddUI64(tv, det_ctx->counter_mpm_stream_scanned[i],
+                        det_ctx->mpm_stream_scanned[i]);
+            det_ctx->mpm_stream_scanned[i] = 0;
+        }
+    }
+}
+
+/**
+ * \brief Queue a buffer for a batched search with DetectMpmVectorSearch().
+ *
+ * For prefilters that get many small buffers from a single tx. The
+ * buffer has to stay valid until the search. Buffers shorter than the
+ * shortest pattern of the ctx are not queued.
+ *
+ * \param tag caller's id for the buffer, e.g. the local id
+ */
+void DetectMpmVectorAdd(DetectEngineThreadCtx *det_ctx, const MpmCtx *mpm_ctx,
+        const uint8_t *buf, const uint32_t buflen, const uint32_t tag)
+{
+    if (buflen == 0 || buflen < mpm_ctx->minlen)
+        return;
+
+    if (det_ctx->mpm_vec_cnt == det_ctx->mpm_vec_size) {
+        uint32_t new_size = det_ctx->mpm_vec_size ? det_ctx->mpm_vec_size * 2 : 8;
+        void *ptr = SCRealloc(det_ctx->mpm_vec, new_size * sizeof(MpmVector));
+        if (ptr == NULL) {
+            /* can't queue it, so search it right away */
+            (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                    &det_ctx->mtcu, &det_ctx->pmq, buf, buflen);
+            return;
+        }
+        det_ctx->mpm_vec = ptr;
+        det_ctx->mpm_vec_size = new_size;
+    }
+
+    MpmVector *v = &det_ctx->mpm_vec[det_ctx->mpm_vec_cnt++];
+    v->buf = buf;
+    v->len = buflen;
+    v->tag = tag;
+    v->matches = 0;
+}
+
+/**
+ * \brief Search the buffers queued by DetectMpmVectorAdd() and empty
+ *        the queue.
+ *
+ * \retval matches match count over all buffers
+ */
+uint32_t DetectMpmVectorSearch(DetectEngineThreadCtx *det_ctx, const MpmCtx *mpm_ctx)
+{
+    uint32_t matches = MpmSearchVector(mpm_ctx, &det_ctx->mtcu,
+            &det_ctx->pmq, det_ctx->mpm_vec, det_ctx->mpm_vec_cnt);
+    det_ctx->mpm_vec_cnt = 0;
+    return matches;
+}
+
+/** \internal
+ *  \brief check if the ctx of a store should be prepared for streaming */
+static bool MpmStoreUsesStreaming(const DetectEngineCtx *de_ctx, const MpmStore *ms)
+{
+    if (!de_ctx->mpm_streaming)
+        return false;
+
+    if (ms->buffer != MPMB_MAX) {
+        return (ms->buffer == MPMB_TCP_STREAM_TS || ms->buffer == MPMB_TCP_STREAM_TC);
+    }
+
+    const char *name = DetectBufferTypeGetNameById(de_ctx, ms->sm_list);
+    return (name != NULL &&
+            DetectMpmStreamBufferGet(name, ms->direction) > DETECT_MPM_STREAM_RAW);
+}
+
 static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
 {
     const Signature *s = NULL;
@@ -1063,6 +1443,9 @@ static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         return;
 
     MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    if (MpmStoreUsesStreaming(de_ctx, ms)) {
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_STREAM;
+    }
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
@@ -1104,15 +1487,11 @@ static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         }
     }
 
+    /* unique contexts are prepared later by DetectMpmPrepareMpms, in
+     * parallel with all others */
     if (ms->mpm_ctx->pattern_cnt == 0) {
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
-    } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
-        }
     }
 }
 
@@ -1582,3 +1961,87 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
 
     return 0;
 }
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+#include "detect-engine-build.h"
+#include "util-unittest.h"
+
+/** \test a buffer registered for multiple protocols shares one mpm ctx
+ *        in shared mode, which must be prepared only once */
+static int DetectMpmPrepareQueueTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->build_threads = 4;
+    FAIL_IF(de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(flow:to_client; file_data; content:\"abc\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert smtp any any -> any any "
+            "(file_data; content:\"def\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"ghi\"; http_header; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"jkl\"; http_cookie; sid:4;)"));
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+
+    /* all queued contexts are unique */
+    MpmPrepareQueue q;
+    memset(&q, 0x00, sizeof(q));
+    SC_ATOMIC_INIT(q.next);
+    FAIL_IF(MpmPrepareQueueBuild(de_ctx, &q) != 0);
+    FAIL_IF(q.cnt == 0);
+    for (uint32_t i = 0; i < q.cnt; i++) {
+        for (uint32_t j = i + 1; j < q.cnt; j++) {
+            FAIL_IF(q.ctxs[i] == q.ctxs[j]);
+        }
+    }
+    SCFree(q.ctxs);
+
+    /* queue the app mpms as if every buffer was registered for two
+     * protocols: the result must be the same as for one registration */
+    memset(&q, 0x00, sizeof(q));
+    FAIL_IF(DetectMpmQueueAppMpms(de_ctx, &q) != 0);
+    MpmPrepareQueueUnique(&q);
+    uint32_t cnt = q.cnt;
+    FAIL_IF(cnt == 0);
+    FAIL_IF(DetectMpmQueueAppMpms(de_ctx, &q) != 0);
+    FAIL_IF(q.cnt != cnt * 2);
+    MpmPrepareQueueUnique(&q);
+    FAIL_IF(q.cnt != cnt);
+    for (uint32_t i = 1; i < q.cnt; i++) {
+        FAIL_IF(q.ctxs[i] == q.ctxs[i - 1]);
+    }
+    SCFree(q.ctxs);
+
+    SC_ATOMIC_DESTROY(q.next);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test streaming mpm buffers and their directions */
+static int DetectMpmStreamBufferTest01(void)
+{
+    FAIL_IF(DetectMpmStreamBufferGet("stream", SIG_FLAG_TOSERVER) != DETECT_MPM_STREAM_RAW);
+    FAIL_IF(DetectMpmStreamBufferGet("stream", SIG_FLAG_TOCLIENT) != DETECT_MPM_STREAM_RAW);
+    FAIL_IF(DetectMpmStreamBufferGet("http_client_body", SIG_FLAG_TOSERVER) != DETECT_MPM_STREAM_HCBD);
+    FAIL_IF(DetectMpmStreamBufferGet("http_client_body", SIG_FLAG_TOCLIENT) != -1);
+    /* http_server_body is file_data toclient, smtp file_data is toserver */
+    FAIL_IF(DetectMpmStreamBufferGet("file_data", SIG_FLAG_TOCLIENT) != DETECT_MPM_STREAM_FILEDATA);
+    FAIL_IF(DetectMpmStreamBufferGet("file_data", SIG_FLAG_TOSERVER) != -1);
+    FAIL_IF(DetectMpmStreamBufferGet("http_server_body", SIG_FLAG_TOCLIENT) != -1);
+    FAIL_IF(DetectMpmStreamBufferGet("http_uri", SIG_FLAG_TOSERVER) != -1);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectMpmRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectMpmPrepareQueueTest01", DetectMpmPrepareQueueTest01);
+    UtRegisterTest("DetectMpmStreamBufferTest01", DetectMpmStreamBufferTest01);
+#endif
+}
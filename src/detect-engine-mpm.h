@@ -34,9 +34,9 @@
 
 void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx);
 void DetectMpmSetupAppMpms(DetectEngineCtx *de_ctx);
-int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx);
 void DetectMpmInitializeBuiltinMpms(DetectEngineCtx *de_ctx);
-int DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx);
+int DetectMpmPrepareMpms(DetectEngineCtx *de_ctx);
+void DetectMpmRegisterTests(void);
 
 uint32_t PatternStrength(uint8_t *, uint16_t);
 
@@ -62,12 +62,23 @@ int SignatureHasPacketContent(const Signature *);
 int SignatureHasStreamContent(const Signature *);
 
 void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s);
+void PopulateMpmHelperAddPattern(MpmCtx *mpm_ctx, const DetectContentData *cd,
+        const Signature *s, uint8_t flags, int chop);
 
 int MpmStoreInit(DetectEngineCtx *);
 void MpmStoreFree(DetectEngineCtx *);
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx);
 MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh, enum MpmBuiltinBuffers buf);
 
+int DetectMpmStreamBufferGet(const char *name, const int direction);
+void DetectMpmStreamRegisterCounters(ThreadVars *tv,
+        uint16_t *received, uint16_t *scanned);
+void DetectMpmStreamUpdateCounters(ThreadVars *tv, DetectEngineThreadCtx *det_ctx);
+
+void DetectMpmVectorAdd(DetectEngineThreadCtx *det_ctx, const MpmCtx *mpm_ctx,
+        const uint8_t *buf, const uint32_t buflen, const uint32_t tag);
+uint32_t DetectMpmVectorSearch(DetectEngineThreadCtx *det_ctx, const MpmCtx *mpm_ctx);
+
 /**
  * \brief Figured out the FP and their respective content ids for all the
  *        sigs in the engine.
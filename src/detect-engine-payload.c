@@ -39,6 +39,8 @@
 #include "stream.h"
 #include "stream-tcp.h"
 
+#include "flow-storage.h"
+
 #include "util-debug.h"
 #include "util-print.h"
 
@@ -48,14 +50,69 @@
 
 #include "util-mpm-ac.h"
 
+/** flow storage for the streaming mpm state of the raw stream */
+static int g_stream_mpm_storage_id = -1;
+
+typedef struct StreamMpmState_ {
+    MpmStreamState *list[2]; /**< toserver, toclient */
+} StreamMpmState;
+
+static void StreamMpmStateFree(void *ptr)
+{
+    StreamMpmState *state = ptr;
+    MpmStreamStateFree(state->list[0]);
+    MpmStreamStateFree(state->list[1]);
+    SCFree(state);
+}
+
+/** \brief register the flow storage used by the streaming mpm */
+void PrefilterPktStreamInit(void)
+{
+    g_stream_mpm_storage_id = FlowStorageRegister("stream-mpm",
+            sizeof(void *), NULL, StreamMpmStateFree);
+    if (g_stream_mpm_storage_id == -1) {
+        SCLogError(SC_ERR_FLOW_INIT, "Can't initiate flow storage for stream mpm");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** \internal
+ *  \brief get the streaming mpm state list for the packet's direction,
+ *          creating the flow storage if needed */
+static MpmStreamState **StreamMpmStateGetList(Flow *f, const Packet *p)
+{
+    StreamMpmState *state = FlowGetStorageById(f, g_stream_mpm_storage_id);
+    if (state == NULL) {
+        state = SCCalloc(1, sizeof(*state));
+        if (unlikely(state == NULL))
+            return NULL;
+        FlowSetStorageById(f, g_stream_mpm_storage_id, state);
+    }
+    return &state->list[PKT_IS_TOSERVER(p) ? 0 : 1];
+}
+
 struct StreamMpmData {
     DetectEngineThreadCtx *det_ctx;
     const MpmCtx *mpm_ctx;
+    /* streaming mpm state, NULL for block mode */
+    MpmStreamState **list;
 };
 
-static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamMpmFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     struct StreamMpmData *smd = cb_data;
+    if (smd->list != NULL) {
+        DetectEngineThreadCtx *det_ctx = smd->det_ctx;
+        uint32_t received = 0, scanned = 0;
+        (void)MpmStreamScan(smd->list, smd->mpm_ctx, &det_ctx->mtcs,
+                &det_ctx->pmq, data, data_len, offset,
+                det_ctx->de_ctx->version, 0, &received, &scanned);
+        det_ctx->mpm_stream_received[DETECT_MPM_STREAM_RAW] += received;
+        det_ctx->mpm_stream_scanned[DETECT_MPM_STREAM_RAW] += scanned;
+        return 0;
+    }
+
     if (data_len >= smd->mpm_ctx->minlen) {
 #ifdef DEBUG
         smd->det_ctx->stream_mpm_cnt++;
@@ -77,7 +134,14 @@ static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
 
     /* for established packets inspect any stream we may have queued up */
     if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
-        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx };
+        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx, NULL };
+        /* inline mode inspects a window around the packet that doesn't
+         * progress linearly, so it's always scanned in block mode */
+        if ((mpm_ctx->flags & MPMCTX_FLAGS_STREAM) &&
+                StreamTcpInlineMode() == FALSE)
+        {
+            stream_mpm_data.list = StreamMpmStateGetList(p->flow, p);
+        }
         StreamReassembleRaw(p->flow->protoctx, p,
                 StreamMpmFunc, &stream_mpm_data,
                 &det_ctx->raw_stream_progress);
@@ -220,7 +284,8 @@ struct StreamContentInspectData {
     Flow *f;
 };
 
-static int StreamContentInspectFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
@@ -278,7 +343,8 @@ struct StreamContentInspectEngineData {
     Flow *f;
 };
 
-static int StreamContentInspectEngineFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectEngineFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
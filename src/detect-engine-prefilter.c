@@ -49,6 +49,8 @@
 
 #include "detect-engine-prefilter.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine.h"
+#include "detect-pcre-prefilter.h"
 
 #include "app-layer-parser.h"
 #include "app-layer-htp.h"
@@ -358,6 +360,13 @@ void PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         }
     }
 
+    if (de_ctx->prefilter_pcre) {
+        if (PrefilterSetupPcre(de_ctx, sgh) != 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "setting up the pcre prefilter "
+                    "for a rule group failed");
+        }
+    }
+
     /* we have lists of engines in sgh->init now. Lets setup the
      * match arrays */
     PrefilterEngineList *el;
@@ -552,11 +561,62 @@ const char *PrefilterStoreGetName(const uint32_t id)
 
 #include "util-print.h"
 
+/**
+ * \brief Scan a tx buffer that grows over time with the streaming mpm.
+ *
+ * The stream state is kept in the tx's detect state, which is created if
+ * needed. Sids are replayed on each scan, as the rules that didn't match
+ * yet are not stored in the tx state: they count on the mpm to trigger
+ * them again.
+ *
+ * \param offset     offset of data in the tx buffer
+ * \param stream_idx DetectMpmStreamBuffers id for the stats
+ */
+void PrefilterMpmStreamScan(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, MpmThreadCtx *mtc, Flow *f, void *txv,
+        const uint8_t flags, const uint8_t *data, const uint32_t data_len,
+        const uint64_t offset, const int stream_idx)
+{
+    MpmStreamState **list = NULL;
+
+    DetectEngineState *de_state = AppLayerParserGetTxDetectState(f->proto, f->alproto, txv);
+    if (de_state == NULL) {
+        de_state = DetectEngineStateAlloc();
+        if (de_state != NULL && AppLayerParserSetTxDetectState(f, txv, de_state) < 0) {
+            DetectEngineStateFree(de_state);
+            de_state = NULL;
+        }
+    }
+    if (de_state != NULL) {
+        list = &de_state->dir_state[flags & STREAM_TOSERVER ? 0 : 1].mpm_stream;
+    }
+
+    if (list == NULL) {
+        det_ctx->mpm_stream_received[stream_idx] += data_len;
+        det_ctx->mpm_stream_scanned[stream_idx] += data_len;
+        if (data_len >= mpm_ctx->minlen) {
+            (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                    mtc, &det_ctx->pmq, data, data_len);
+        }
+        return;
+    }
+
+    uint32_t received = 0, scanned = 0;
+    (void)MpmStreamScan(list, mpm_ctx, mtc, &det_ctx->pmq,
+            data, data_len, offset, det_ctx->de_ctx->version,
+            MPM_STREAM_REPLAY, &received, &scanned);
+    det_ctx->mpm_stream_received[stream_idx] += received;
+    det_ctx->mpm_stream_scanned[stream_idx] += scanned;
+}
+
 typedef struct PrefilterMpmCtx {
     int list_id;
     InspectionBufferGetDataPtr GetData;
     const MpmCtx *mpm_ctx;
     const DetectEngineTransforms *transforms;
+    /* DetectMpmStreamBuffers id if the buffer uses the streaming
+     * mpm, -1 otherwise */
+    int stream_idx;
 } PrefilterMpmCtx;
 
 /** \brief Generic Mpm prefilter callback
@@ -589,6 +649,14 @@ static void PrefilterMpm(DetectEngineThreadCtx *det_ctx,
     SCLogDebug("mpm'ing buffer:");
     //PrintRawDataFp(stdout, data, data_len);
 
+    /* a buffer changed by a built-in transformation (swf decompression)
+     * has no stable offsets, so it's scanned in block mode */
+    if (ctx->stream_idx >= 0 && data != NULL && buffer->inspect == buffer->orig) {
+        PrefilterMpmStreamScan(det_ctx, mpm_ctx, &det_ctx->mtcu, f, txv,
+                flags, data, data_len, buffer->inspect_offset, ctx->stream_idx);
+        return;
+    }
+
     if (data != NULL && data_len >= mpm_ctx->minlen) {
         (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
                 &det_ctx->mtcu, &det_ctx->pmq, data, data_len);
@@ -612,6 +680,11 @@ int PrefilterGenericMpmRegister(DetectEngineCtx *de_ctx,
     pectx->GetData = mpm_reg->v2.GetData;
     pectx->mpm_ctx = mpm_ctx;
     pectx->transforms = &mpm_reg->v2.transforms;
+    pectx->stream_idx = -1;
+    if ((mpm_ctx->flags & MPMCTX_FLAGS_STREAM) && mpm_reg->v2.transforms.cnt == 0) {
+        pectx->stream_idx = DetectMpmStreamBufferGet(
+                DetectBufferTypeGetNameById(de_ctx, list_id), mpm_reg->direction);
+    }
 
     int r = PrefilterAppendTxEngine(de_ctx, sgh, PrefilterMpm,
         mpm_reg->v2.alproto, mpm_reg->v2.tx_min_progress,
@@ -76,4 +76,9 @@ int PrefilterGenericMpmRegister(DetectEngineCtx *de_ctx,
         SigGroupHead *sgh, MpmCtx *mpm_ctx,
         const DetectMpmAppLayerRegistery *mpm_reg, int list_id);
 
+void PrefilterMpmStreamScan(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, MpmThreadCtx *mtc, Flow *f, void *txv,
+        const uint8_t flags, const uint8_t *data, const uint32_t data_len,
+        const uint64_t offset, const int stream_idx);
+
 #endif
@@ -44,6 +44,7 @@
 
 #include "util-hash.h"
 #include "util-hashlist.h"
+#include "util-hash-lookup3.h"
 
 #include "util-error.h"
 #include "util-debug.h"
@@ -155,6 +156,15 @@ void SigGroupHeadFree(const DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 
     SCLogDebug("sgh %p", sgh);
 
+    /* shared arrays are freed with the sgh that owns them */
+    if (sgh->flags & SIG_GROUP_HEAD_SHARED_ARRAYS) {
+        sgh->match_array = NULL;
+        sgh->non_pf_other_store_array = NULL;
+        sgh->non_pf_other_store_cnt = 0;
+        sgh->non_pf_syn_store_array = NULL;
+        sgh->non_pf_syn_store_cnt = 0;
+    }
+
     if (sgh->match_array != NULL) {
         SCFree(sgh->match_array);
         sgh->match_array = NULL;
@@ -198,14 +208,10 @@ void SigGroupHeadFree(const DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 static uint32_t SigGroupHeadHashFunc(HashListTable *ht, void *data, uint16_t datalen)
 {
     SigGroupHead *sgh = (SigGroupHead *)data;
-    uint32_t hash = 0;
-    uint32_t b = 0;
 
     SCLogDebug("hashing sgh %p", sgh);
 
-    for (b = 0; b < sgh->init->sig_size; b++)
-        hash += sgh->init->sig_array[b];
-
+    uint32_t hash = hashlittle_safe(sgh->init->sig_array, sgh->init->sig_size, 0);
     hash %= ht->array_size;
     SCLogDebug("hash %"PRIu32" (sig_size %"PRIu32")", hash, sgh->init->sig_size);
     return hash;
@@ -571,6 +577,71 @@ void SigGroupHeadSetFilesizeFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/**
+ *  \brief check if a match list keyword checks flow or host state that
+ *         can change without new tx data
+ *
+ *  Static checks like flow, dsize or ttl are left out: a packet carrying
+ *  no new tx data doesn't make those match for the tx.
+ */
+static int SigMatchIsTxPacketMatch(const SigMatch *sm)
+{
+    switch (sm->type) {
+        case DETECT_FLOWBITS:
+        case DETECT_FLOWINT:
+        case DETECT_XBITS:
+        case DETECT_HOSTBITS:
+        case DETECT_FLOWVAR:
+        case DETECT_PKTVAR:
+        case DETECT_STREAM_SIZE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ *  \brief Set the flag for tx rules with flow level conditions.
+ *
+ *  A tx rule that fails on its header (flowvar requirement) or on a
+ *  packet match like flowbits or flowint stores no state, so it is only
+ *  evaluated again when the tx is. Such conditions can change on any
+ *  packet, so the txs of these groups can't be skipped when the app-layer
+ *  data didn't change.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetTxPacketMatchFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    SigMatch *sm = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL || !(s->flags & SIG_FLAG_STATE_MATCH))
+            continue;
+
+        if (s->flags & SIG_FLAG_REQUIRE_FLOWVAR)
+            goto found;
+
+        for (sm = s->init_data->smlists[DETECT_SM_LIST_MATCH]; sm != NULL; sm = sm->next) {
+            if (SigMatchIsTxPacketMatch(sm))
+                goto found;
+        }
+    }
+    return;
+
+found:
+    sgh->flags |= SIG_GROUP_HEAD_HAVETXPKTMATCH;
+    SCLogDebug("sgh %p has tx rules with flow level matches", sgh);
+    return;
+}
+
 /**
  *  \brief Set the need hash flag in the sgh.
  *
@@ -717,6 +788,79 @@ int SigGroupHeadBuildNonPrefilterArray(DetectEngineCtx *de_ctx, SigGroupHead *sg
     return 0;
 }
 
+/**
+ * \brief Use the signature arrays of another sgh with the same signatures.
+ *
+ * Rule groups are only deduplicated per protocol and direction, so for
+ * example the toserver group for dport 80 and the toclient group for
+ * sport 80 often have the same signatures. Their prefilter engines differ,
+ * but the match and non prefilter arrays are the same.
+ *
+ * \param sgh   sgh to update. Its own match_array is freed.
+ * \param owner sgh that keeps owning the arrays
+ */
+void SigGroupHeadShareArrays(SigGroupHead *sgh, const SigGroupHead *owner)
+{
+    BUG_ON(sgh->sig_cnt != owner->sig_cnt);
+    BUG_ON(owner->flags & SIG_GROUP_HEAD_SHARED_ARRAYS);
+    BUG_ON(sgh->non_pf_other_store_array != NULL);
+    BUG_ON(sgh->non_pf_syn_store_array != NULL);
+
+    if (sgh->match_array != NULL)
+        SCFree(sgh->match_array);
+
+    sgh->match_array = owner->match_array;
+    sgh->non_pf_other_store_array = owner->non_pf_other_store_array;
+    sgh->non_pf_other_store_cnt = owner->non_pf_other_store_cnt;
+    sgh->non_pf_syn_store_array = owner->non_pf_syn_store_array;
+    sgh->non_pf_syn_store_cnt = owner->non_pf_syn_store_cnt;
+    sgh->flags |= SIG_GROUP_HEAD_SHARED_ARRAYS;
+}
+
+static uint64_t PrefilterEnginesMemoryUsage(const PrefilterEngine *e)
+{
+    uint64_t size = 0;
+
+    for ( ; e != NULL; e++) {
+        size += sizeof(*e);
+        if (e->is_last)
+            break;
+    }
+    return size;
+}
+
+/**
+ * \brief Get the runtime memory use of a sgh.
+ *
+ * Counts the sgh, its prefilter engine arrays and its signature arrays.
+ * Init data and the prefilter engine ctx' are not included.
+ *
+ * \param sgh   the sgh
+ * \param saved set to the size of the signature arrays if they are
+ *              shared with another sgh, 0 otherwise
+ *
+ * \retval bytes used by this sgh, excluding shared arrays
+ */
+uint64_t SigGroupHeadMemoryUsage(const SigGroupHead *sgh, uint64_t *saved)
+{
+    uint64_t arrays = (uint64_t)sgh->sig_cnt * sizeof(Signature *) +
+        (uint64_t)(sgh->non_pf_other_store_cnt + sgh->non_pf_syn_store_cnt) *
+        sizeof(SignatureNonPrefilterStore);
+
+    uint64_t size = sizeof(SigGroupHead);
+    size += PrefilterEnginesMemoryUsage(sgh->pkt_engines);
+    size += PrefilterEnginesMemoryUsage(sgh->payload_engines);
+    size += PrefilterEnginesMemoryUsage(sgh->tx_engines);
+
+    if (sgh->flags & SIG_GROUP_HEAD_SHARED_ARRAYS) {
+        *saved = arrays;
+    } else {
+        *saved = 0;
+        size += arrays;
+    }
+    return size;
+}
+
 /**
  * \brief Check if a SigGroupHead contains a Signature, whose sid is sent as an
  *        argument.
@@ -1197,6 +1341,35 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+
+/**
+ * \test rule groups for different directions with the same sigs share
+ *       their signature arrays.
+ */
+static int SigGroupHeadTest11(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+
+    Signature *s = DetectEngineAppendSig(de_ctx,
+            "alert tcp any any -> any 80 (content:\"abc\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+
+    DetectPort *ts = de_ctx->flow_gh[1].tcp;
+    DetectPort *tc = de_ctx->flow_gh[0].tcp;
+    FAIL_IF_NULL(ts);
+    FAIL_IF_NULL(tc);
+    FAIL_IF(ts->sh == tc->sh);
+    FAIL_IF(ts->sh->match_array != tc->sh->match_array);
+    FAIL_IF(ts->sh->match_array[0] != s);
+    FAIL_IF(((ts->sh->flags ^ tc->sh->flags) & SIG_GROUP_HEAD_SHARED_ARRAYS) == 0);
+    FAIL_IF(de_ctx->sgh_mem_saved == 0);
+    FAIL_IF(de_ctx->sgh_mem_used == 0);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
 #endif
 
 void SigGroupHeadRegisterTests(void)
@@ -1208,5 +1381,6 @@ void SigGroupHeadRegisterTests(void)
     UtRegisterTest("SigGroupHeadTest08", SigGroupHeadTest08);
     UtRegisterTest("SigGroupHeadTest09", SigGroupHeadTest09);
     UtRegisterTest("SigGroupHeadTest10", SigGroupHeadTest10);
+    UtRegisterTest("SigGroupHeadTest11", SigGroupHeadTest11);
 #endif
 }
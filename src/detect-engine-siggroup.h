@@ -69,9 +69,12 @@ void SigGroupHeadSetFilemagicFlag(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFilestoreCount(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFileHashFlag(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFilesizeFlag(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadSetTxPacketMatchFlag(DetectEngineCtx *, SigGroupHead *);
 uint16_t SigGroupHeadGetMinMpmSize(DetectEngineCtx *de_ctx,
                                    SigGroupHead *sgh, int list);
 
 int SigGroupHeadBuildNonPrefilterArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+void SigGroupHeadShareArrays(SigGroupHead *sgh, const SigGroupHead *owner);
+uint64_t SigGroupHeadMemoryUsage(const SigGroupHead *sgh, uint64_t *saved);
 
 #endif /* __DETECT_ENGINE_SIGGROUP_H__ */
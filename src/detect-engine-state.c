@@ -187,6 +187,7 @@ void DetectEngineStateFree(DetectEngineState *state)
             SCFree(store);
             store = store_next;
         }
+        MpmStreamStateFree(state->dir_state[i].mpm_stream);
     }
     SCFree(state);
 
@@ -268,6 +269,9 @@ void DeStateUpdateInspectTransactionId(Flow *f, const uint8_t flags,
  */
 void DetectEngineStateResetTxs(Flow *f)
 {
+    /* the new engine has to see all txs at least once */
+    AppLayerParserResetDetectDataVersion(f->alparser);
+
     void *alstate = FlowGetAppState(f);
     if (!StateIsValid(f->alproto, alstate)) {
         return;
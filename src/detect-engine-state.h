@@ -84,6 +84,8 @@ typedef struct DetectEngineStateDirection_ {
     uint16_t filestore_cnt;
     uint8_t flags;
     /* coccinelle: DetectEngineStateDirection:flags:DETECT_ENGINE_STATE_FLAG_ */
+    /** streaming mpm state of the tx buffers in this direction */
+    struct MpmStreamState_ *mpm_stream;
 } DetectEngineStateDirection;
 
 typedef struct DetectEngineState_ {
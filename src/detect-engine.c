@@ -44,6 +44,7 @@
 #include "detect-engine-prefilter.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-iponly.h"
+#include "detect-pcre-prefilter.h"
 #include "detect-engine-tag.h"
 
 #include "detect-engine-uri.h"
@@ -67,12 +68,15 @@
 #include "util-error.h"
 #include "util-hash.h"
 #include "util-byte.h"
+#include "util-cpu.h"
+#include "util-hyperscan.h"
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-action.h"
 #include "util-magic.h"
 #include "util-signal.h"
 #include "util-spm.h"
+#include "util-misc.h"
 
 #include "util-var-name.h"
 
@@ -862,6 +866,75 @@ void InspectionBufferFree(InspectionBuffer *buffer)
     memset(buffer, 0, sizeof(*buffer));
 }
 
+/**
+ * \brief get a buffer from the per thread inspection buffer cache
+ *
+ * If the buffer's 'inspect' ptr is set, it was already set up for the
+ * current tx and can be used as is. Otherwise the caller is expected
+ * to fill it, or to leave it empty if there is no data. Either way the
+ * buffer is considered set up for the current tx after this call.
+ *
+ * \param list_id buffer id to get the InspectionBuffer for
+ * \retval buffer the InspectionBuffer
+ * \retval NULL the buffer was already found to be empty for this tx
+ */
+InspectionBuffer *InspectionBufferGet(DetectEngineThreadCtx *det_ctx, const int list_id)
+{
+    BUG_ON(det_ctx->inspect_buffers == NULL);
+    InspectionBuffer *buffer = &det_ctx->inspect_buffers[list_id];
+
+    if (buffer->initialized) {
+        det_ctx->inspect_cache.hits++;
+        return buffer->inspect != NULL ? buffer : NULL;
+    }
+
+    det_ctx->inspect_cache.misses++;
+    buffer->initialized = 1;
+    /* if the queue is full, InspectionBufferCacheClean resets all */
+    if (det_ctx->inspect_cache.queue_cnt < det_ctx->inspect_buffers_size) {
+        det_ctx->inspect_cache.queue[det_ctx->inspect_cache.queue_cnt++] = list_id;
+    }
+    return buffer;
+}
+
+/** \brief reset the buffers that were set up since the last clean */
+void InspectionBufferCacheClean(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->inspect_cache.queue_cnt == det_ctx->inspect_buffers_size) {
+        for (uint32_t i = 0; i < det_ctx->inspect_buffers_size; i++) {
+            det_ctx->inspect_buffers[i].inspect = NULL;
+            det_ctx->inspect_buffers[i].initialized = 0;
+        }
+    } else {
+        for (uint32_t i = 0; i < det_ctx->inspect_cache.queue_cnt; i++) {
+            const uint32_t list_id = det_ctx->inspect_cache.queue[i];
+            det_ctx->inspect_buffers[list_id].inspect = NULL;
+            det_ctx->inspect_buffers[list_id].initialized = 0;
+        }
+    }
+    det_ctx->inspect_cache.queue_cnt = 0;
+    det_ctx->inspect_cache.tx_ptr = NULL;
+    det_ctx->inspect_cache.tx_progress = 0;
+}
+
+/**
+ * \brief set the tx the cached inspection buffers are for
+ *
+ * Buffers set up for another tx, or for the same tx at a lower progress,
+ * are invalidated.
+ */
+void InspectionBufferCacheSetTx(DetectEngineThreadCtx *det_ctx,
+        const void *tx_ptr, const int tx_progress)
+{
+    if (det_ctx->inspect_cache.tx_ptr != tx_ptr ||
+        det_ctx->inspect_cache.tx_progress != tx_progress)
+    {
+        InspectionBufferCacheClean(det_ctx);
+        det_ctx->inspect_cache.tx_ptr = tx_ptr;
+        det_ctx->inspect_cache.tx_progress = tx_progress;
+    }
+}
+
 /**
  * \brief make sure that the buffer has at least 'min_size' bytes
  * Expand the buffer if necessary
@@ -1624,6 +1697,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
      */
     SigGroupHeadHashFree(de_ctx);
     MpmStoreFree(de_ctx);
+    DetectPcrePrefilterFree(de_ctx);
     DetectParseDupSigHashFree(de_ctx);
     SCSigSignatureOrderingModuleCleanup(de_ctx);
     ThresholdContextDestroy(de_ctx);
@@ -1764,6 +1838,50 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
         de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
     }
 
+    /* detect.build-threads option parsing */
+    const char *build_threads = NULL;
+    (void)ConfGet("detect.build-threads", &build_threads);
+    if (build_threads == NULL || strcmp(build_threads, "auto") == 0) {
+        de_ctx->build_threads = UtilCpuGetNumProcessorsOnline();
+    } else if (ByteExtractStringUint16(&de_ctx->build_threads, 10,
+                strlen(build_threads), build_threads) <= 0 ||
+            de_ctx->build_threads == 0)
+    {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                "detect.build-threads: '%s'. Valid options: auto or a "
+                "number of threads.", build_threads);
+        return -1;
+    }
+    if (de_ctx->build_threads == 0)
+        de_ctx->build_threads = 1;
+    SCLogConfig("using %u thread(s) to prepare the pattern matchers",
+            de_ctx->build_threads);
+
+    /* detect.mpm-streaming option parsing */
+    int mpm_streaming = 0;
+    (void)ConfGetBool("detect.mpm-streaming.enabled", &mpm_streaming);
+    if (mpm_streaming) {
+        if (mpm_table[de_ctx->mpm_matcher].StreamOpen == NULL) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "detect.mpm-streaming: mpm-algo "
+                    "'%s' has no streaming mode, using block mode",
+                    mpm_table[de_ctx->mpm_matcher].name);
+        } else {
+            const char *memcap = NULL;
+            uint64_t memcap_val = 0;
+            if (ConfGet("detect.mpm-streaming.memcap", &memcap) == 1 && memcap != NULL) {
+                if (ParseSizeStringU64(memcap, &memcap_val) < 0) {
+                    SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                            "detect.mpm-streaming.memcap: '%s'", memcap);
+                    return -1;
+                }
+                MpmStreamSetMemcap(memcap_val);
+            }
+            de_ctx->mpm_streaming = 1;
+            SCLogConfig("streaming mpm enabled, memcap %"PRIu64,
+                    MpmStreamGetMemcap());
+        }
+    }
+
     /* parse profile custom-values */
     opt = NULL;
     switch (profile) {
@@ -1961,6 +2079,17 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
             break;
     }
 
+    int pf_pcre = 0;
+    if (ConfGetBool("detect.prefilter.pcre", &pf_pcre) == 1 && pf_pcre) {
+#ifdef BUILD_HYPERSCAN
+        de_ctx->prefilter_pcre = true;
+        SCLogConfig("prefilter engines: pcre using Hyperscan");
+#else
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "detect.prefilter.pcre "
+                "requires Hyperscan support, ignoring");
+#endif
+    }
+
     return 0;
 }
 
@@ -2212,9 +2341,6 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         BUG_ON(det_ctx->non_pf_id_array == NULL);
     }
 
-    /* IP-ONLY */
-    DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
-
     /* DeState */
     if (de_ctx->sig_array_len > 0) {
         det_ctx->match_array_len = de_ctx->sig_array_len;
@@ -2250,6 +2376,10 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     if (det_ctx->inspect_buffers == NULL) {
         return TM_ECODE_FAILED;
     }
+    det_ctx->inspect_cache.queue = SCCalloc(det_ctx->inspect_buffers_size, sizeof(uint32_t));
+    if (det_ctx->inspect_cache.queue == NULL) {
+        return TM_ECODE_FAILED;
+    }
     det_ctx->multi_inspect_buffers_size = de_ctx->buffer_type_id;
     det_ctx->multi_inspect_buffers = SCCalloc(det_ctx->multi_inspect_buffers_size, sizeof(InspectionBufferMultipleForList));
     if (det_ctx->multi_inspect_buffers == NULL) {
@@ -2291,6 +2421,14 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /* first register the counter. In delayed detect mode we exit right after if the
      * rules haven't been loaded yet. */
     uint16_t counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    uint16_t counter_buffer_cache_hits = StatsRegisterCounter("detect.buffer_cache_hits", tv);
+    uint16_t counter_buffer_cache_misses = StatsRegisterCounter("detect.buffer_cache_misses", tv);
+    uint16_t counter_tx_inspected = StatsRegisterCounter("detect.tx_inspected", tv);
+    uint16_t counter_tx_skipped = StatsRegisterCounter("detect.tx_skipped", tv);
+    uint16_t counter_mpm_stream_received[DETECT_MPM_STREAM_MAX] = { 0 };
+    uint16_t counter_mpm_stream_scanned[DETECT_MPM_STREAM_MAX] = { 0 };
+    DetectMpmStreamRegisterCounters(tv, counter_mpm_stream_received,
+            counter_mpm_stream_scanned);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -2327,6 +2465,14 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
 
     /** alert counter setup */
     det_ctx->counter_alerts = counter_alerts;
+    det_ctx->counter_buffer_cache_hits = counter_buffer_cache_hits;
+    det_ctx->counter_buffer_cache_misses = counter_buffer_cache_misses;
+    det_ctx->counter_tx_inspected = counter_tx_inspected;
+    det_ctx->counter_tx_skipped = counter_tx_skipped;
+    memcpy(det_ctx->counter_mpm_stream_received, counter_mpm_stream_received,
+            sizeof(counter_mpm_stream_received));
+    memcpy(det_ctx->counter_mpm_stream_scanned, counter_mpm_stream_scanned,
+            sizeof(counter_mpm_stream_scanned));
 #ifdef PROFILING
     det_ctx->counter_mpm_list = counter_mpm_list;
     det_ctx->counter_nonmpm_list = counter_nonmpm_list;
@@ -2379,6 +2525,12 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_buffer_cache_hits = StatsRegisterCounter("detect.buffer_cache_hits", tv);
+    det_ctx->counter_buffer_cache_misses = StatsRegisterCounter("detect.buffer_cache_misses", tv);
+    det_ctx->counter_tx_inspected = StatsRegisterCounter("detect.tx_inspected", tv);
+    det_ctx->counter_tx_skipped = StatsRegisterCounter("detect.tx_skipped", tv);
+    DetectMpmStreamRegisterCounters(tv, det_ctx->counter_mpm_stream_received,
+            det_ctx->counter_mpm_stream_scanned);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -2425,8 +2577,6 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
     SCProfilingSghThreadCleanup(det_ctx);
 #endif
 
-    DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
-
     /** \todo get rid of this static */
     if (det_ctx->de_ctx != NULL) {
         PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
@@ -2436,6 +2586,9 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 
     PmqFree(&det_ctx->pmq);
 
+    if (det_ctx->mpm_vec != NULL)
+        SCFree(det_ctx->mpm_vec);
+
     if (det_ctx->spm_thread_ctx != NULL) {
         SpmDestroyThreadCtx(det_ctx->spm_thread_ctx);
     }
@@ -2468,6 +2621,9 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         }
         SCFree(det_ctx->inspect_buffers);
     }
+    if (det_ctx->inspect_cache.queue) {
+        SCFree(det_ctx->inspect_cache.queue);
+    }
     if (det_ctx->multi_inspect_buffers) {
         for (uint32_t i = 0; i < det_ctx->multi_inspect_buffers_size; i++) {
             InspectionBufferMultipleForList *fb = &det_ctx->multi_inspect_buffers[i];
@@ -2714,6 +2870,49 @@ DetectEngineCtx *DetectEngineReference(DetectEngineCtx *de_ctx)
     return de_ctx;
 }
 
+static uint64_t DetectEngineSghMemuseCounter(void)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    uint64_t memuse = 0;
+
+    SCMutexLock(&master->lock);
+    DetectEngineCtx *de_ctx = master->list;
+    for ( ; de_ctx != NULL; de_ctx = de_ctx->next) {
+        memuse += de_ctx->sgh_mem_used;
+    }
+    SCMutexUnlock(&master->lock);
+    return memuse;
+}
+
+static uint64_t DetectEngineSghMemsavedCounter(void)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    uint64_t memsaved = 0;
+
+    SCMutexLock(&master->lock);
+    DetectEngineCtx *de_ctx = master->list;
+    for ( ; de_ctx != NULL; de_ctx = de_ctx->next) {
+        memsaved += de_ctx->sgh_mem_saved;
+    }
+    SCMutexUnlock(&master->lock);
+    return memsaved;
+}
+
+/** \brief register the detect engine global counters: rule group
+ *         memory use of the active engines, the bytes saved by
+ *         sharing signature arrays between rule groups, the memory
+ *         used by the streaming mpm state and by the Hyperscan
+ *         scratch shared by all threads. */
+void DetectEngineRegisterGlobalCounters(void)
+{
+    StatsRegisterGlobalCounter("detect.sgh_memuse", DetectEngineSghMemuseCounter);
+    StatsRegisterGlobalCounter("detect.sgh_memsaved", DetectEngineSghMemsavedCounter);
+    StatsRegisterGlobalCounter("detect.mpm_stream_memuse", MpmStreamGetMemuse);
+#ifdef BUILD_HYPERSCAN
+    StatsRegisterGlobalCounter("detect.hs_scratch_memuse", HSScratchGetMemuse);
+#endif
+}
+
 /** TODO locking? Not needed if this is a one time setting at startup */
 int DetectEngineMultiTenantEnabled(void)
 {
@@ -3850,6 +4049,61 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test inspection buffer cache hits, misses and invalidation */
+static int DetectEngineTest10(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    InspectionBuffer buffers[4];
+    uint32_t queue[4];
+    int tx1, tx2;
+    const uint8_t data[] = "abc";
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(buffers, 0, sizeof(buffers));
+    det_ctx.inspect_buffers = buffers;
+    det_ctx.inspect_buffers_size = 4;
+    det_ctx.inspect_cache.queue = queue;
+
+    InspectionBufferCacheSetTx(&det_ctx, &tx1, 1);
+    InspectionBuffer *buffer = InspectionBufferGet(&det_ctx, 2);
+    FAIL_IF(buffer != &buffers[2]);
+    FAIL_IF_NOT_NULL(buffer->inspect);
+    InspectionBufferSetup(buffer, data, 3);
+    FAIL_IF(det_ctx.inspect_cache.misses != 1);
+
+    /* same tx and progress: cached */
+    InspectionBufferCacheSetTx(&det_ctx, &tx1, 1);
+    buffer = InspectionBufferGet(&det_ctx, 2);
+    FAIL_IF(buffer->inspect != data);
+    FAIL_IF(det_ctx.inspect_cache.hits != 1);
+
+    /* a buffer left empty is cached as empty */
+    buffer = InspectionBufferGet(&det_ctx, 3);
+    FAIL_IF(buffer != &buffers[3]);
+    FAIL_IF(det_ctx.inspect_cache.misses != 2);
+    FAIL_IF_NOT_NULL(InspectionBufferGet(&det_ctx, 3));
+    FAIL_IF_NOT_NULL(InspectionBufferGet(&det_ctx, 3));
+    FAIL_IF(det_ctx.inspect_cache.hits != 3);
+    FAIL_IF(det_ctx.inspect_cache.misses != 2);
+    FAIL_IF(det_ctx.inspect_cache.queue_cnt != 2);
+
+    /* progress update invalidates */
+    InspectionBufferCacheSetTx(&det_ctx, &tx1, 2);
+    FAIL_IF_NOT_NULL(buffers[2].inspect);
+    FAIL_IF(buffers[3].initialized);
+    buffer = InspectionBufferGet(&det_ctx, 2);
+    FAIL_IF_NULL(buffer);
+    InspectionBufferSetup(buffer, data, 3);
+
+    /* so does another tx */
+    InspectionBufferCacheSetTx(&det_ctx, &tx2, 2);
+    FAIL_IF_NOT_NULL(buffers[2].inspect);
+    FAIL_IF(buffers[2].initialized);
+    FAIL_IF(det_ctx.inspect_cache.misses != 3);
+    FAIL_IF(det_ctx.inspect_cache.queue_cnt != 0);
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -3861,6 +4115,7 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
 #endif
     return;
 }
@@ -31,6 +31,10 @@
 void InspectionBufferInit(InspectionBuffer *buffer, uint32_t initial_size);
 void InspectionBufferSetup(InspectionBuffer *buffer, const uint8_t *data, const uint32_t data_len);
 void InspectionBufferFree(InspectionBuffer *buffer);
+InspectionBuffer *InspectionBufferGet(DetectEngineThreadCtx *det_ctx, const int list_id);
+void InspectionBufferCacheSetTx(DetectEngineThreadCtx *det_ctx,
+        const void *tx_ptr, const int tx_progress);
+void InspectionBufferCacheClean(DetectEngineThreadCtx *det_ctx);
 void InspectionBufferCheckAndExpand(InspectionBuffer *buffer, uint32_t min_size);
 void InspectionBufferCopy(InspectionBuffer *buffer, uint8_t *buf, uint32_t buf_len);
 void InspectionBufferApplyTransforms(InspectionBuffer *buffer,
@@ -91,6 +95,7 @@ int DetectEngineReload(const SCInstance *suri);
 int DetectEngineEnabled(void);
 int DetectEngineMTApply(void);
 int DetectEngineMultiTenantEnabled(void);
+void DetectEngineRegisterGlobalCounters(void);
 int DetectEngineMultiTenantSetup(void);
 
 int DetectEngineReloadStart(void);
@@ -186,14 +186,12 @@ static void PrefilterTxKrb5CName(DetectEngineThreadCtx *det_ctx,
         if (buffer == NULL)
             break;
 
-        if (buffer->inspect_len >= mpm_ctx->minlen) {
-            (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                    &det_ctx->mtcu, &det_ctx->pmq,
-                    buffer->inspect, buffer->inspect_len);
-        }
-
+        DetectMpmVectorAdd(det_ctx, mpm_ctx,
+                buffer->inspect, buffer->inspect_len, local_id);
         local_id++;
     }
+
+    (void)DetectMpmVectorSearch(det_ctx, mpm_ctx);
 }
 
 static void PrefilterMpmKrb5NameFree(void *ptr)
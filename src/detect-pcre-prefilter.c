@@ -0,0 +1,732 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hyperscan prefilter for rules that only have a pcre to match on
+ * the payload.
+ *
+ * Rules without a fast pattern are evaluated on every packet of their
+ * rule group. If such a rule has a pcre on the payload that Hyperscan
+ * can compile, that pcre is used as the rule's prefilter: all of them
+ * are compiled into one Hyperscan database per rule group, and a rule
+ * only becomes a candidate if its expression matched. Expressions that
+ * Hyperscan can't handle exactly (e.g. back references) are compiled
+ * with HS_FLAG_PREFILTER, which may report more matches than the pcre
+ * but never less.
+ *
+ * The pcre is still evaluated by the rule's inspection, so captures
+ * and all other semantics are unchanged.
+ *
+ * Enabled with detect.prefilter.pcre.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-prefilter.h"
+#include "detect-pcre.h"
+#include "detect-pcre-prefilter.h"
+
+#include "stream.h"
+#include "stream-tcp.h"
+
+#include "util-debug.h"
+#include "util-hashlist.h"
+#include "util-hyperscan.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#ifdef BUILD_HYPERSCAN
+
+#include <hs.h>
+
+/** per detection engine state */
+typedef struct DetectPcrePrefilterCtx_ {
+    /** engines, shared by rule groups with the same pcre rules */
+    HashListTable *ctx_hash;
+} DetectPcrePrefilterCtx;
+
+typedef struct PrefilterPcreCtx_ {
+    /* all rules using this engine, in rule group order. Used as the
+     * hash key and as the fallback if the database failed to build. */
+    SigIntId *sigs;
+    uint32_t sigs_cnt;
+    /* scan the packet payload even if it's added to the stream, as
+     * rules requiring a packet inspect it */
+    bool pkt_sigs;
+
+    hs_database_t *db;
+
+    /* sids for expression id x: sids[sids_offset[x]] to
+     * sids[sids_offset[x + 1] - 1] */
+    uint32_t expr_cnt;
+    uint32_t *sids_offset;
+    SigIntId *sids;
+
+    /* rules with a pcre prefilter hyperscan doesn't support. They are
+     * always a candidate. */
+    SigIntId *always;
+    uint32_t always_cnt;
+} PrefilterPcreCtx;
+
+typedef struct PrefilterPcreScanData_ {
+    DetectEngineThreadCtx *det_ctx;
+    const PrefilterPcreCtx *ctx;
+    hs_scratch_t *scratch;
+} PrefilterPcreScanData;
+
+/** unique expression of a rule group, used while building a database */
+typedef struct PcreExpr_ {
+    const char *expr;
+    unsigned int flags;
+    uint32_t id;
+    uint32_t cnt;
+} PcreExpr;
+
+static int PrefilterPcreMatch(unsigned int id, unsigned long long from,
+        unsigned long long to, unsigned int flags, void *data)
+{
+    PrefilterPcreScanData *sd = data;
+    const PrefilterPcreCtx *ctx = sd->ctx;
+
+    PrefilterAddSids(&sd->det_ctx->pmq, ctx->sids + ctx->sids_offset[id],
+            ctx->sids_offset[id + 1] - ctx->sids_offset[id]);
+    return 0;
+}
+
+static void PrefilterPcreScan(PrefilterPcreScanData *sd,
+        const uint8_t *buf, const uint32_t buf_len)
+{
+    if (buf_len == 0)
+        return;
+
+    hs_error_t err = hs_scan(sd->ctx->db, (const char *)buf, buf_len, 0,
+            sd->scratch, PrefilterPcreMatch, sd);
+    if (err != HS_SUCCESS) {
+        /* same as the mpm: an error here means a broken database or
+         * scratch, which we can't recover from */
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int PrefilterPcreStreamFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
+{
+    PrefilterPcreScan(cb_data, data, data_len);
+    return 0;
+}
+
+static void PrefilterPcre(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    SCEnter();
+
+    const PrefilterPcreCtx *ctx = (const PrefilterPcreCtx *)pectx;
+
+    if (ctx->db == NULL) {
+        PrefilterAddSids(&det_ctx->pmq, ctx->sigs, ctx->sigs_cnt);
+        SCReturn;
+    }
+    PrefilterAddSids(&det_ctx->pmq, ctx->always, ctx->always_cnt);
+
+    /* the thread scratch is shared with the mpm, see HSScratchGet() */
+    PrefilterPcreScanData sd = { det_ctx, ctx, HSScratchGet() };
+    BUG_ON(sd.scratch == NULL);
+
+    /* the rules inspect the same stream chunks as the stream mpm */
+    if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
+        StreamReassembleRaw(p->flow->protoctx, p,
+                PrefilterPcreStreamFunc, &sd,
+                &det_ctx->raw_stream_progress);
+    }
+
+    if (!(p->flags & PKT_STREAM_ADD) || ctx->pkt_sigs) {
+        PrefilterPcreScan(&sd, p->payload, p->payload_len);
+    }
+}
+
+static void PrefilterPcreCtxFree(void *ptr)
+{
+    PrefilterPcreCtx *ctx = ptr;
+    if (ctx == NULL)
+        return;
+
+    if (ctx->db != NULL)
+        hs_free_database(ctx->db);
+    SCFree(ctx->sigs);
+    SCFree(ctx->sids_offset);
+    SCFree(ctx->sids);
+    SCFree(ctx->always);
+    SCFree(ctx);
+}
+
+static uint32_t PrefilterPcreCtxHash(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const PrefilterPcreCtx *ctx = data;
+    uint32_t hash = ctx->sigs_cnt + ctx->pkt_sigs;
+    uint32_t i;
+
+    for (i = 0; i < ctx->sigs_cnt; i++) {
+        hash = hash * 31 + ctx->sigs[i];
+    }
+    return hash % ht->array_size;
+}
+
+static char PrefilterPcreCtxCompare(void *data1, uint16_t len1,
+        void *data2, uint16_t len2)
+{
+    const PrefilterPcreCtx *ctx1 = data1;
+    const PrefilterPcreCtx *ctx2 = data2;
+
+    if (ctx1->sigs_cnt != ctx2->sigs_cnt || ctx1->pkt_sigs != ctx2->pkt_sigs)
+        return 0;
+    return memcmp(ctx1->sigs, ctx2->sigs,
+            ctx1->sigs_cnt * sizeof(SigIntId)) == 0;
+}
+
+static uint32_t PcreExprHash(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const PcreExpr *e = data;
+    uint32_t hash = e->flags;
+    const char *c;
+
+    for (c = e->expr; *c != '\0'; c++) {
+        hash = hash * 31 + (uint8_t)*c;
+    }
+    return hash % ht->array_size;
+}
+
+static char PcreExprCompare(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const PcreExpr *e1 = data1;
+    const PcreExpr *e2 = data2;
+
+    return e1->flags == e2->flags && strcmp(e1->expr, e2->expr) == 0;
+}
+
+/** \internal
+ *  \brief check if the pcre can be compiled by hyperscan
+ *
+ *  Tries an exact compile first and falls back to HS_FLAG_PREFILTER.
+ *  The result is kept in the pcre data: hs_flags is set if supported,
+ *  hs_expr is cleared if not.
+ *
+ *  \retval 0 supported
+ *  \retval -1 not supported
+ */
+static int PcrePrefilterCheck(DetectPcreData *pd)
+{
+    if (pd->hs_expr == NULL)
+        return -1;
+    if (pd->hs_flags != 0)
+        return 0;
+
+    if ((pd->flags & (DETECT_PCRE_RELATIVE|DETECT_PCRE_NEGATE)) ||
+        (pd->opts & (PCRE_ANCHORED|PCRE_DOLLAR_ENDONLY|PCRE_EXTENDED)))
+    {
+        goto unsupported;
+    }
+
+    unsigned int flags = HS_FLAG_SINGLEMATCH;
+    if (pd->opts & PCRE_CASELESS)
+        flags |= HS_FLAG_CASELESS;
+    if (pd->opts & PCRE_MULTILINE)
+        flags |= HS_FLAG_MULTILINE;
+    if (pd->opts & PCRE_DOTALL)
+        flags |= HS_FLAG_DOTALL;
+
+    hs_database_t *db = NULL;
+    hs_compile_error_t *compile_err = NULL;
+    hs_error_t err = hs_compile(pd->hs_expr, flags, HS_MODE_BLOCK, NULL,
+            &db, &compile_err);
+    if (err != HS_SUCCESS) {
+        hs_free_compile_error(compile_err);
+        compile_err = NULL;
+
+        flags |= HS_FLAG_PREFILTER;
+        err = hs_compile(pd->hs_expr, flags, HS_MODE_BLOCK, NULL,
+                &db, &compile_err);
+        if (err != HS_SUCCESS) {
+            SCLogDebug("pcre \"%s\" not supported by hyperscan: %s",
+                    pd->hs_expr, compile_err ? compile_err->message : "?");
+            hs_free_compile_error(compile_err);
+            goto unsupported;
+        }
+    }
+    hs_free_database(db);
+
+    pd->hs_flags = flags;
+    return 0;
+
+unsupported:
+    SCFree(pd->hs_expr);
+    pd->hs_expr = NULL;
+    return -1;
+}
+
+static bool SigHasPcrePrefilter(const Signature *s)
+{
+    return s->init_data->prefilter_sm != NULL &&
+        s->init_data->prefilter_sm->type == DETECT_PCRE;
+}
+
+static DetectPcrePrefilterCtx *DetectPcrePrefilterCtxGet(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->pcre_prefilter_ctx != NULL)
+        return de_ctx->pcre_prefilter_ctx;
+
+    DetectPcrePrefilterCtx *g = SCCalloc(1, sizeof(*g));
+    if (unlikely(g == NULL))
+        return NULL;
+    g->ctx_hash = HashListTableInit(256, PrefilterPcreCtxHash,
+            PrefilterPcreCtxCompare, PrefilterPcreCtxFree);
+    if (g->ctx_hash == NULL) {
+        SCFree(g);
+        return NULL;
+    }
+
+    de_ctx->pcre_prefilter_ctx = g;
+    return g;
+}
+
+/**
+ *  \brief use a pcre of the rule as its prefilter, if possible
+ *
+ *  Only rules without a prefilter that inspect nothing but the packet
+ *  payload and the stream are considered. An exactly supported pcre
+ *  is preferred over an approximate one.
+ *
+ *  \retval 1 pcre set as the prefilter
+ *  \retval 0 rule left alone
+ */
+int DetectPcrePrefilterSigSetup(DetectEngineCtx *de_ctx, Signature *s)
+{
+    if (!de_ctx->prefilter_pcre)
+        return 0;
+    if (s->flags & (SIG_FLAG_PREFILTER|SIG_FLAG_APPLAYER))
+        return 0;
+
+    uint32_t i;
+    for (i = DETECT_SM_LIST_DYNAMIC_START; i < s->init_data->smlists_array_size; i++) {
+        if (s->init_data->smlists[i] != NULL)
+            return 0;
+    }
+
+    SigMatch *approx = NULL;
+    SigMatch *sm = s->init_data->smlists[DETECT_SM_LIST_PMATCH];
+    for ( ; sm != NULL; sm = sm->next) {
+        if (sm->type != DETECT_PCRE)
+            continue;
+
+        DetectPcreData *pd = (DetectPcreData *)sm->ctx;
+        if (PcrePrefilterCheck(pd) < 0)
+            continue;
+        if (!(pd->hs_flags & HS_FLAG_PREFILTER))
+            break;
+        if (approx == NULL)
+            approx = sm;
+    }
+    if (sm == NULL)
+        sm = approx;
+    if (sm == NULL)
+        return 0;
+
+    if (DetectPcrePrefilterCtxGet(de_ctx) == NULL)
+        return 0;
+
+    const DetectPcreData *pd = (const DetectPcreData *)sm->ctx;
+    if (pd->hs_flags & HS_FLAG_PREFILTER)
+        de_ctx->pcre_prefilter_approx_cnt++;
+    else
+        de_ctx->pcre_prefilter_exact_cnt++;
+
+    s->init_data->prefilter_sm = sm;
+    s->flags |= SIG_FLAG_PREFILTER;
+    SCLogDebug("sid %u: prefilter is on pcre \"%s\" (%s)", s->id, pd->hs_expr,
+            (pd->hs_flags & HS_FLAG_PREFILTER) ? "approximate" : "exact");
+    return 1;
+}
+
+/** \internal
+ *  \brief build the database for the rules in sigs */
+static PrefilterPcreCtx *PrefilterPcreCtxBuild(DetectPcrePrefilterCtx *g,
+        const SigGroupHead *sgh, PrefilterPcreCtx *ctx)
+{
+    HashListTable *ht = NULL;
+    PcreExpr *exprs = NULL;
+    const char **expressions = NULL;
+    unsigned int *flags = NULL;
+    unsigned int *ids = NULL;
+    uint32_t sig, i;
+
+    ctx->sids = SCCalloc(ctx->sigs_cnt, sizeof(SigIntId));
+    ctx->always = SCCalloc(ctx->sigs_cnt, sizeof(SigIntId));
+    exprs = SCCalloc(ctx->sigs_cnt, sizeof(PcreExpr));
+    ht = HashListTableInit(256, PcreExprHash, PcreExprCompare, NULL);
+    if (ctx->sids == NULL || ctx->always == NULL || exprs == NULL || ht == NULL)
+        goto error;
+
+    /* dedup the expressions and count the rules for each */
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || !SigHasPcrePrefilter(s))
+            continue;
+
+        const DetectPcreData *pd = (const DetectPcreData *)s->init_data->prefilter_sm->ctx;
+        if (pd->hs_expr == NULL || pd->hs_flags == 0) {
+            /* set by the prefilter keyword, but not supported */
+            ctx->always[ctx->always_cnt++] = s->num;
+            continue;
+        }
+
+        PcreExpr lookup = { .expr = pd->hs_expr, .flags = pd->hs_flags };
+        PcreExpr *e = HashListTableLookup(ht, &lookup, sizeof(lookup));
+        if (e == NULL) {
+            e = &exprs[ctx->expr_cnt];
+            *e = lookup;
+            e->id = ctx->expr_cnt++;
+            if (HashListTableAdd(ht, e, sizeof(*e)) != 0)
+                goto error;
+        }
+        e->cnt++;
+    }
+
+    if (ctx->expr_cnt == 0) {
+        /* only unsupported rules, leave the db NULL so all are added */
+        goto done;
+    }
+
+    ctx->sids_offset = SCCalloc(ctx->expr_cnt + 1, sizeof(uint32_t));
+    expressions = SCCalloc(ctx->expr_cnt, sizeof(char *));
+    flags = SCCalloc(ctx->expr_cnt, sizeof(unsigned int));
+    ids = SCCalloc(ctx->expr_cnt, sizeof(unsigned int));
+    if (ctx->sids_offset == NULL || expressions == NULL || flags == NULL || ids == NULL)
+        goto error;
+
+    for (i = 0; i < ctx->expr_cnt; i++) {
+        ctx->sids_offset[i + 1] = ctx->sids_offset[i] + exprs[i].cnt;
+        exprs[i].cnt = 0;
+
+        expressions[i] = exprs[i].expr;
+        flags[i] = exprs[i].flags;
+        ids[i] = exprs[i].id;
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || !SigHasPcrePrefilter(s))
+            continue;
+
+        const DetectPcreData *pd = (const DetectPcreData *)s->init_data->prefilter_sm->ctx;
+        if (pd->hs_expr == NULL || pd->hs_flags == 0)
+            continue;
+
+        PcreExpr lookup = { .expr = pd->hs_expr, .flags = pd->hs_flags };
+        PcreExpr *e = HashListTableLookup(ht, &lookup, sizeof(lookup));
+        BUG_ON(e == NULL);
+        ctx->sids[ctx->sids_offset[e->id] + e->cnt++] = s->num;
+    }
+
+    hs_compile_error_t *compile_err = NULL;
+    hs_error_t err = hs_compile_multi(expressions, flags, ids, ctx->expr_cnt,
+            HS_MODE_BLOCK, NULL, &ctx->db, &compile_err);
+    if (err != HS_SUCCESS) {
+        /* each expression compiled on its own, so this is unexpected.
+         * Keep the rules running without the prefilter. */
+        SCLogWarning(SC_ERR_FATAL, "failed to compile pcre prefilter "
+                "database of %u expressions: %s", ctx->expr_cnt,
+                compile_err ? compile_err->message : "unknown error");
+        hs_free_compile_error(compile_err);
+        ctx->db = NULL;
+        goto done;
+    }
+
+    if (HSScratchAddDatabase(ctx->db) != 0) {
+        SCLogError(SC_ERR_FATAL, "failed to allocate pcre prefilter scratch");
+        goto error;
+    }
+
+done:
+    HashListTableFree(ht);
+    SCFree(exprs);
+    SCFree(expressions);
+    SCFree(flags);
+    SCFree(ids);
+    return ctx;
+
+error:
+    if (ht != NULL)
+        HashListTableFree(ht);
+    SCFree(exprs);
+    SCFree(expressions);
+    SCFree(flags);
+    SCFree(ids);
+    return NULL;
+}
+
+/**
+ *  \brief set up the pcre prefilter engine of a rule group
+ *
+ *  \retval 0 ok (or nothing to do)
+ *  \retval -1 error
+ */
+int PrefilterSetupPcre(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    DetectPcrePrefilterCtx *g = de_ctx->pcre_prefilter_ctx;
+    if (g == NULL)
+        return 0;
+
+    uint32_t sig;
+    uint32_t cnt = 0;
+    bool pkt_sigs = false;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || !SigHasPcrePrefilter(s))
+            continue;
+        cnt++;
+        if (s->flags & SIG_FLAG_REQUIRE_PACKET)
+            pkt_sigs = true;
+    }
+    if (cnt == 0)
+        return 0;
+
+    PrefilterPcreCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return -1;
+    ctx->sigs = SCCalloc(cnt, sizeof(SigIntId));
+    if (unlikely(ctx->sigs == NULL)) {
+        SCFree(ctx);
+        return -1;
+    }
+    ctx->pkt_sigs = pkt_sigs;
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s != NULL && SigHasPcrePrefilter(s))
+            ctx->sigs[ctx->sigs_cnt++] = s->num;
+    }
+
+    /* rule groups with the same rules share the engine */
+    PrefilterPcreCtx *shared = HashListTableLookup(g->ctx_hash, ctx, sizeof(*ctx));
+    if (shared != NULL) {
+        PrefilterPcreCtxFree(ctx);
+        ctx = shared;
+    } else {
+        if (PrefilterPcreCtxBuild(g, sgh, ctx) == NULL) {
+            PrefilterPcreCtxFree(ctx);
+            return -1;
+        }
+        if (HashListTableAdd(g->ctx_hash, ctx, sizeof(*ctx)) != 0) {
+            PrefilterPcreCtxFree(ctx);
+            return -1;
+        }
+        SCLogDebug("pcre prefilter: %u rules, %u expressions, %u unsupported",
+                ctx->sigs_cnt, ctx->expr_cnt, ctx->always_cnt);
+    }
+
+    /* engine is owned by the hash, so no free func */
+    return PrefilterAppendPayloadEngine(de_ctx, sgh, PrefilterPcre, ctx,
+            NULL, "pcre");
+}
+
+/**
+ *  \brief get how the rule's pcre prefilter matches
+ *
+ *  \retval "exact" or "approximate" if the rule uses the pcre prefilter
+ *  \retval NULL otherwise
+ */
+const char *DetectPcrePrefilterMode(const Signature *s)
+{
+    if (s->init_data == NULL || !SigHasPcrePrefilter(s))
+        return NULL;
+
+    const DetectPcreData *pd = (const DetectPcreData *)s->init_data->prefilter_sm->ctx;
+    if (pd->hs_expr == NULL || pd->hs_flags == 0)
+        return NULL;
+    return (pd->hs_flags & HS_FLAG_PREFILTER) ? "approximate" : "exact";
+}
+
+void DetectPcrePrefilterFree(DetectEngineCtx *de_ctx)
+{
+    DetectPcrePrefilterCtx *g = de_ctx->pcre_prefilter_ctx;
+    if (g == NULL)
+        return;
+
+    HashListTableFree(g->ctx_hash);
+    SCFree(g);
+    de_ctx->pcre_prefilter_ctx = NULL;
+}
+
+#else /* BUILD_HYPERSCAN */
+
+int DetectPcrePrefilterSigSetup(DetectEngineCtx *de_ctx, Signature *s)
+{
+    return 0;
+}
+
+int PrefilterSetupPcre(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return 0;
+}
+
+const char *DetectPcrePrefilterMode(const Signature *s)
+{
+    return NULL;
+}
+
+void DetectPcrePrefilterFree(DetectEngineCtx *de_ctx)
+{
+}
+
+#endif /* BUILD_HYPERSCAN */
+
+#ifdef UNITTESTS
+#ifdef BUILD_HYPERSCAN
+
+static DetectEngineCtx *PcrePrefilterTestInit(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return NULL;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->prefilter_pcre = true;
+    return de_ctx;
+}
+
+/** \test supported pcres become the prefilter, exact or approximate */
+static int DetectPcrePrefilterTest01(void)
+{
+    DetectEngineCtx *de_ctx = PcrePrefilterTestInit();
+    FAIL_IF_NULL(de_ctx);
+
+    Signature *s1 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/ab[0-9]+cd/i\"; sid:1;)");
+    FAIL_IF_NULL(s1);
+    /* back reference: approximate */
+    Signature *s2 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/(ab)x\\1/\"; sid:2;)");
+    FAIL_IF_NULL(s2);
+    /* has a fast pattern */
+    Signature *s3 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"abc\"; pcre:\"/abc[0-9]/\"; sid:3;)");
+    FAIL_IF_NULL(s3);
+    /* negated pcres and the x modifier can't be used */
+    Signature *s4 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:!\"/abc/\"; sid:4;)");
+    FAIL_IF_NULL(s4);
+    Signature *s5 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/a b c/x\"; sid:5;)");
+    FAIL_IF_NULL(s5);
+
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+
+    FAIL_IF_NOT(s1->flags & SIG_FLAG_PREFILTER);
+    FAIL_IF_NOT(s2->flags & SIG_FLAG_PREFILTER);
+    FAIL_IF(s4->flags & SIG_FLAG_PREFILTER);
+    FAIL_IF(s5->flags & SIG_FLAG_PREFILTER);
+    FAIL_IF_NOT(de_ctx->pcre_prefilter_exact_cnt == 1);
+    FAIL_IF_NOT(de_ctx->pcre_prefilter_approx_cnt == 1);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test only rules whose pcre matched are inspected */
+static int DetectPcrePrefilterTest02(void)
+{
+    uint8_t buf[] = "xx ab123cd xx abxab";
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    Packet *p = UTHBuildPacket(buf, sizeof(buf) - 1, IPPROTO_UDP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = PcrePrefilterTestInit();
+    FAIL_IF_NULL(de_ctx);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(pcre:\"/AB[0-9]+CD/i\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(pcre:\"/(ab)x\\1/\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(pcre:\"/(ab)c\\1/\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(pcre:\"/xyz/\"; sid:4;)"));
+    /* same expression as sid 1 */
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(pcre:\"/AB[0-9]+CD/i\"; sid:5;)"));
+
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+    FAIL_IF_NOT(de_ctx->pcre_prefilter_exact_cnt == 3);
+    FAIL_IF_NOT(de_ctx->pcre_prefilter_approx_cnt == 2);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p, 2));
+    FAIL_IF(PacketAlertCheck(p, 3));
+    FAIL_IF(PacketAlertCheck(p, 4));
+    FAIL_IF_NOT(PacketAlertCheck(p, 5));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
+/** \test disabled by default */
+static int DetectPcrePrefilterTest03(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/abc/\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+    FAIL_IF(s->flags & SIG_FLAG_PREFILTER);
+    FAIL_IF_NOT_NULL(de_ctx->pcre_prefilter_ctx);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+#endif /* BUILD_HYPERSCAN */
+#endif /* UNITTESTS */
+
+void DetectPcrePrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef BUILD_HYPERSCAN
+    UtRegisterTest("DetectPcrePrefilterTest01", DetectPcrePrefilterTest01);
+    UtRegisterTest("DetectPcrePrefilterTest02", DetectPcrePrefilterTest02);
+    UtRegisterTest("DetectPcrePrefilterTest03", DetectPcrePrefilterTest03);
+#endif /* BUILD_HYPERSCAN */
+#endif /* UNITTESTS */
+}
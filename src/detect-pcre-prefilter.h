@@ -0,0 +1,35 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hyperscan prefilter for rules that only have a pcre to match on
+ * the payload.
+ */
+
+#ifndef __DETECT_PCRE_PREFILTER_H__
+#define __DETECT_PCRE_PREFILTER_H__
+
+int DetectPcrePrefilterSigSetup(DetectEngineCtx *de_ctx, Signature *s);
+int PrefilterSetupPcre(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+const char *DetectPcrePrefilterMode(const Signature *s);
+void DetectPcrePrefilterFree(DetectEngineCtx *de_ctx);
+
+void DetectPcrePrefilterRegisterTests(void);
+
+#endif /* __DETECT_PCRE_PREFILTER_H__ */
@@ -58,6 +58,8 @@
 #include "app-layer-protos.h"
 #include "app-layer-parser.h"
 #include "util-pages.h"
+#include "util-misc.h"
+#include "util-profiling.h"
 
 /* pcre named substring capture supports only 32byte names, A-z0-9 plus _
  * and needs to start with non-numeric. */
@@ -67,9 +69,33 @@
 #define SC_MATCH_LIMIT_DEFAULT 3500
 #define SC_MATCH_LIMIT_RECURSION_DEFAULT 1500
 
+/* size of the ovector: pcre uses the last third as workspace */
+#define DETECT_PCRE_OVECTOR_SIZE 30
+
+#define DETECT_PCRE_JIT_STACK_START         (32 * 1024)
+#define DETECT_PCRE_JIT_STACK_MAX_DEFAULT   (512 * 1024)
+
 static int pcre_match_limit = 0;
 static int pcre_match_limit_recursion = 0;
 
+/** per thread data for pcre matching
+ *
+ *  Holds everything a match needs besides the expression itself, so
+ *  nothing is set up per call. */
+typedef struct DetectPcreThreadData_ {
+#ifdef PCRE_HAVE_JIT_EXEC
+    /* jit stack, used instead of the 32k on the machine stack pcre
+     * uses by default */
+    pcre_jit_stack *jit_stack;
+#endif
+    int ov[DETECT_PCRE_OVECTOR_SIZE];
+} DetectPcreThreadData;
+
+static int g_pcre_thread_id = -1;
+#ifdef PCRE_HAVE_JIT_EXEC
+static uint32_t pcre_jit_stack_max = DETECT_PCRE_JIT_STACK_MAX_DEFAULT;
+#endif
+
 static pcre *parse_regex;
 static pcre_extra *parse_regex_study;
 static pcre *parse_capture_regex;
@@ -83,6 +109,38 @@ static int DetectPcreSetup (DetectEngineCtx *, Signature *, const char *);
 static void DetectPcreFree(void *);
 static void DetectPcreRegisterTests(void);
 
+static void *DetectPcreThreadDataInit(void *data)
+{
+    DetectPcreThreadData *td = SCCalloc(1, sizeof(*td));
+    if (unlikely(td == NULL))
+        return NULL;
+
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (pcre_use_jit) {
+        td->jit_stack = pcre_jit_stack_alloc(DETECT_PCRE_JIT_STACK_START,
+                pcre_jit_stack_max);
+        if (td->jit_stack == NULL) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "failed to allocate pcre jit "
+                    "stack, using the default stack");
+        }
+    }
+#endif
+    return td;
+}
+
+static void DetectPcreThreadDataFree(void *data)
+{
+    DetectPcreThreadData *td = data;
+    if (td == NULL)
+        return;
+
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (td->jit_stack != NULL)
+        pcre_jit_stack_free(td->jit_stack);
+#endif
+    SCFree(td);
+}
+
 void DetectPcreRegister (void)
 {
     sigmatch_table[DETECT_PCRE].name = "pcre";
@@ -150,10 +208,69 @@ void DetectPcreRegister (void)
     }
 #endif
 
+#ifdef PCRE_HAVE_JIT_EXEC
+    const char *jit_stack_str = NULL;
+    if (ConfGet("pcre.jit-stack-size", &jit_stack_str) == 1 && jit_stack_str != NULL) {
+        uint32_t size = 0;
+        if (ParseSizeStringU32(jit_stack_str, &size) < 0 ||
+                size < DETECT_PCRE_JIT_STACK_START) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "pcre.jit-stack-size: \"%s\", minimum is %u. Using "
+                    "default of %u", jit_stack_str, DETECT_PCRE_JIT_STACK_START,
+                    DETECT_PCRE_JIT_STACK_MAX_DEFAULT);
+        } else {
+            pcre_jit_stack_max = size;
+            SCLogConfig("Using PCRE jit-stack-size setting of: %u", size);
+        }
+    }
+#endif
+
+    g_pcre_thread_id = DetectRegisterThreadCtxGlobalFuncs("pcre",
+            DetectPcreThreadDataInit, NULL, DetectPcreThreadDataFree);
+
     DetectParseRegexAddToFreeList(parse_capture_regex, parse_capture_regex_study);
     return;
 }
 
+/** \internal
+ *  \brief run the expression, using the thread's jit stack if we can
+ *
+ *  Single point where the keyword calls into pcre. */
+static inline int DetectPcreExec(const DetectPcreData *pe,
+        DetectPcreThreadData *td, const uint8_t *buf, uint32_t len,
+        int start_offset, int *ov)
+{
+#ifdef PCRE_HAVE_JIT_EXEC
+    if ((pe->flags & DETECT_PCRE_JIT) && td != NULL && td->jit_stack != NULL) {
+        return pcre_jit_exec(pe->re, pe->sd, (const char *)buf, len,
+                start_offset, 0, ov, DETECT_PCRE_OVECTOR_SIZE, td->jit_stack);
+    }
+#endif
+    return pcre_exec(pe->re, pe->sd, (const char *)buf, len,
+            start_offset, 0, ov, DETECT_PCRE_OVECTOR_SIZE);
+}
+
+/** \internal
+ *  \brief check if pcre gave up because of one of its limits
+ *
+ *  In that case the expression didn't fail to match, it just wasn't
+ *  allowed to find out. */
+static inline int DetectPcreLimitHit(const int ret)
+{
+    switch (ret) {
+        case PCRE_ERROR_MATCHLIMIT:
+#ifdef PCRE_ERROR_RECURSIONLIMIT
+        case PCRE_ERROR_RECURSIONLIMIT:
+#endif
+#ifdef PCRE_ERROR_JIT_STACKLIMIT
+        case PCRE_ERROR_JIT_STACKLIMIT:
+#endif
+            return 1;
+        default:
+            return 0;
+    }
+}
+
 /**
  * \brief Match a regex on a single payload.
  *
@@ -173,9 +290,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
                            uint8_t *payload, uint32_t payload_len)
 {
     SCEnter();
-#define MAX_SUBSTRINGS 30
     int ret = 0;
-    int ov[MAX_SUBSTRINGS];
     uint8_t *ptr = NULL;
     uint16_t len = 0;
     uint16_t capture_len = 0;
@@ -195,8 +310,17 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
         start_offset = (payload + det_ctx->pcre_match_start_offset - ptr);
     }
 
+    /* the thread data is missing for det_ctx' that weren't set up by
+     * the engine, as in some unittests */
+    DetectPcreThreadData *td = DetectThreadCtxGetGlobalKeywordThreadCtx(det_ctx,
+            g_pcre_thread_id);
+    int local_ov[DETECT_PCRE_OVECTOR_SIZE];
+    int *ov = td ? td->ov : local_ov;
+
     /* run the actual pcre detection */
-    ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0, ov, MAX_SUBSTRINGS);
+    PCRE_PROFILING_START;
+    ret = DetectPcreExec(pe, td, ptr, len, start_offset, ov);
+    PCRE_PROFILING_END(det_ctx, s, ret >= 0, DetectPcreLimitHit(ret));
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
     if (ret == PCRE_ERROR_NOMATCH) {
@@ -224,7 +348,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
                 for (x = 0; x < pe->idx; x++) {
                     SCLogDebug("capturing %u", x);
                     const char *str_ptr = NULL;
-                    ret = pcre_get_substring((char *)ptr, ov, MAX_SUBSTRINGS, x+1, &str_ptr);
+                    ret = pcre_get_substring((char *)ptr, ov, DETECT_PCRE_OVECTOR_SIZE, x+1, &str_ptr);
                     if (unlikely(ret == 0)) {
                         pcre_free_substring(str_ptr);
                         continue;
@@ -236,7 +360,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
                     if (pe->captypes[x] == VAR_TYPE_PKT_VAR_KV) {
                         /* get the value, as first capture is the key */
                         const char *str_ptr2 = NULL;
-                        int ret2 = pcre_get_substring((char *)ptr, ov, MAX_SUBSTRINGS, x+2, &str_ptr2);
+                        int ret2 = pcre_get_substring((char *)ptr, ov, DETECT_PCRE_OVECTOR_SIZE, x+2, &str_ptr2);
                         if (unlikely(ret2 == 0)) {
                             pcre_free_substring(str_ptr);
                             pcre_free_substring(str_ptr2);
@@ -610,6 +734,12 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, const char *reg
                 "at offset %" PRId32 ": %s", regexstr, eo, eb);
         goto error;
     }
+    pd->opts = opts;
+#ifdef BUILD_HYPERSCAN
+    /* only needed by the prefilter; on failure the rule just won't use it */
+    if (de_ctx->prefilter_pcre)
+        pd->hs_expr = SCStrdup(re);
+#endif
 
     int options = 0;
 #ifdef PCRE_HAVE_JIT
@@ -632,6 +762,8 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, const char *reg
         SCLogDebug("PCRE JIT compiler does not support: %s. "
                 "Falling back to regular PCRE handling (%s:%d)",
                 regexstr, de_ctx->rule_file, de_ctx->rule_line);
+    } else {
+        pd->flags |= DETECT_PCRE_JIT;
     }
 #endif /*PCRE_HAVE_JIT*/
 
@@ -669,6 +801,10 @@ error:
         pcre_free(pd->re);
     if (pd != NULL && pd->sd != NULL)
         pcre_free_study(pd->sd);
+#ifdef BUILD_HYPERSCAN
+    if (pd != NULL && pd->hs_expr != NULL)
+        SCFree(pd->hs_expr);
+#endif
     if (pd)
         SCFree(pd);
     return NULL;
@@ -900,6 +1036,10 @@ static void DetectPcreFree(void *ptr)
         pcre_free(pd->re);
     if (pd->sd != NULL)
         pcre_free_study(pd->sd);
+#ifdef BUILD_HYPERSCAN
+    if (pd->hs_expr != NULL)
+        SCFree(pd->hs_expr);
+#endif
 
     SCFree(pd);
     return;
@@ -3481,6 +3621,39 @@ static int DetectPcreParseCaptureTest(void)
     PASS;
 }
 
+/** \test the per thread data path gives the same results as the
+ *        plain pcre_exec path */
+static int DetectPcreExecThreadDataTest(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF(de_ctx == NULL);
+    int list = DETECT_SM_LIST_NOTSET;
+    DetectPcreData *pd = DetectPcreParse(de_ctx, "/b(c+)d/", &list, NULL, 0, false);
+    FAIL_IF_NULL(pd);
+
+    DetectPcreThreadData *td = DetectPcreThreadDataInit(NULL);
+    FAIL_IF_NULL(td);
+
+    const uint8_t buf[] = "abcccde";
+    int ov[DETECT_PCRE_OVECTOR_SIZE];
+    int ret = DetectPcreExec(pd, NULL, buf, sizeof(buf) - 1, 0, ov);
+    FAIL_IF_NOT(ret == 2);
+    ret = DetectPcreExec(pd, td, buf, sizeof(buf) - 1, 0, td->ov);
+    FAIL_IF_NOT(ret == 2);
+    FAIL_IF_NOT(memcmp(ov, td->ov, 4 * sizeof(int)) == 0);
+    FAIL_IF_NOT(td->ov[2] == 2 && td->ov[3] == 5);
+
+    ret = DetectPcreExec(pd, td, buf, sizeof(buf) - 1, 3, td->ov);
+    FAIL_IF_NOT(ret == PCRE_ERROR_NOMATCH);
+    FAIL_IF(DetectPcreLimitHit(ret));
+    FAIL_IF_NOT(DetectPcreLimitHit(PCRE_ERROR_MATCHLIMIT));
+
+    DetectPcreThreadDataFree(td);
+    DetectPcreFree(pd);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -3569,6 +3742,8 @@ static void DetectPcreRegisterTests(void)
 
     UtRegisterTest("DetectPcreParseHttpHost", DetectPcreParseHttpHost);
     UtRegisterTest("DetectPcreParseCaptureTest", DetectPcreParseCaptureTest);
+    UtRegisterTest("DetectPcreExecThreadDataTest",
+            DetectPcreExecThreadDataTest);
 
 #endif /* UNITTESTS */
 }
@@ -31,6 +31,7 @@
 #define DETECT_PCRE_MATCH_LIMIT         0x00020
 #define DETECT_PCRE_RELATIVE_NEXT       0x00040
 #define DETECT_PCRE_NEGATE              0x00080
+#define DETECT_PCRE_JIT                 0x00100 /**< expression is jit compiled */
 
 #define DETECT_PCRE_CAPTURE_MAX         8
 
@@ -43,6 +44,12 @@ typedef struct DetectPcreData_ {
     uint8_t idx;
     uint8_t captypes[DETECT_PCRE_CAPTURE_MAX];
     uint32_t capids[DETECT_PCRE_CAPTURE_MAX];
+#ifdef BUILD_HYPERSCAN
+    /* expression and flags for the hyperscan prefilter, see
+     * detect-pcre-prefilter.c. hs_expr is NULL if not supported. */
+    char *hs_expr;
+    unsigned int hs_flags;
+#endif
 } DetectPcreData;
 
 /* prototypes */
@@ -555,7 +555,7 @@ static void DetectRunInspectIPOnly(ThreadVars *tv, const DetectEngineCtx *de_ctx
             SCLogDebug("testing against \"ip-only\" signatures");
 
             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_IPONLY);
-            IPOnlyMatchPacket(tv, de_ctx, det_ctx, &de_ctx->io_ctx, &det_ctx->io_ctx, p);
+            IPOnlyMatchPacket(tv, de_ctx, det_ctx, &de_ctx->io_ctx, p);
             PACKET_PROFILING_DETECT_END(p, PROF_DETECT_IPONLY);
 
             /* save in the flow that we scanned this direction... */
@@ -578,8 +578,7 @@ static void DetectRunInspectIPOnly(ThreadVars *tv, const DetectEngineCtx *de_ctx
 
         /* Even without flow we should match the packet src/dst */
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_IPONLY);
-        IPOnlyMatchPacket(tv, de_ctx, det_ctx, &de_ctx->io_ctx,
-                          &det_ctx->io_ctx, p);
+        IPOnlyMatchPacket(tv, de_ctx, det_ctx, &de_ctx->io_ctx, p);
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_IPONLY);
     }
 }
@@ -1023,6 +1022,24 @@ static inline void DetectRunPostRules(
         StatsAddUI64(tv, det_ctx->counter_alerts, (uint64_t)p->alerts.cnt);
     }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_ALERT);
+
+    if (det_ctx->inspect_cache.hits > 0) {
+        StatsAddUI64(tv, det_ctx->counter_buffer_cache_hits, det_ctx->inspect_cache.hits);
+        det_ctx->inspect_cache.hits = 0;
+    }
+    if (det_ctx->inspect_cache.misses > 0) {
+        StatsAddUI64(tv, det_ctx->counter_buffer_cache_misses, det_ctx->inspect_cache.misses);
+        det_ctx->inspect_cache.misses = 0;
+    }
+    if (det_ctx->tx_inspected_cnt > 0) {
+        StatsAddUI64(tv, det_ctx->counter_tx_inspected, det_ctx->tx_inspected_cnt);
+        det_ctx->tx_inspected_cnt = 0;
+    }
+    if (det_ctx->tx_skipped_cnt > 0) {
+        StatsAddUI64(tv, det_ctx->counter_tx_skipped, det_ctx->tx_skipped_cnt);
+        det_ctx->tx_skipped_cnt = 0;
+    }
+    DetectMpmStreamUpdateCounters(tv, det_ctx);
 }
 
 static void DetectRunCleanup(DetectEngineThreadCtx *det_ctx,
@@ -1033,12 +1050,7 @@ static void DetectRunCleanup(DetectEngineThreadCtx *det_ctx,
     PacketPatternCleanup(det_ctx);
 
     if (pflow != NULL) {
-        // TODO clean this up
-        const int nlists = det_ctx->de_ctx->buffer_type_id;
-        for (int i = 0; i < nlists; i++) {
-            InspectionBuffer *buffer = &det_ctx->inspect_buffers[i];
-            buffer->inspect = NULL;
-        }
+        InspectionBufferCacheClean(det_ctx);
 
         /* update inspected tracker for raw reassembly */
         if (p->proto == IPPROTO_TCP && pflow->protoctx != NULL) {
@@ -1345,6 +1357,41 @@ static DetectTransaction GetDetectTx(const uint8_t ipproto, const AppProto alpro
     return tx;
 }
 
+/** \brief see if the txs of this flow can be skipped if they have no
+ *         stored state
+ *
+ *  The parser bumps the flow's data version each time it runs. If it didn't
+ *  change since our last run in this direction, tx progress, buffers and
+ *  files are unchanged, so the tx prefilter engines can't add anything and
+ *  rules without stored state would have to be started from scratch. That
+ *  leaves the 'state' rules from the packet prefilter, which are always
+ *  considered, flags like EOF that change how progress is evaluated and
+ *  tx rules with packet level conditions like flowbits: those store no
+ *  state when they fail, but may match now.
+ *
+ *  \retval true txs without stored state can be skipped
+ */
+static inline bool DetectRunTxNoNewData(const DetectEngineThreadCtx *det_ctx,
+        const SigGroupHead *sgh, const Flow *f, const uint8_t flow_flags,
+        const uint64_t data_version)
+{
+    if (sgh->flags & SIG_GROUP_HEAD_HAVETXPKTMATCH)
+        return false;
+
+    if (data_version == 0 ||
+        data_version != AppLayerParserGetDetectDataVersion(f->alparser, flow_flags))
+        return false;
+
+    if (flow_flags & ~(STREAM_TOSERVER|STREAM_TOCLIENT))
+        return false;
+
+    for (uint32_t i = 0; i < det_ctx->match_array_cnt; i++) {
+        if (det_ctx->match_array[i]->flags & SIG_FLAG_STATE_MATCH)
+            return false;
+    }
+    return true;
+}
+
 static void DetectRunTx(ThreadVars *tv,
                     DetectEngineCtx *de_ctx,
                     DetectEngineThreadCtx *det_ctx,
@@ -1362,6 +1409,9 @@ static void DetectRunTx(ThreadVars *tv,
     uint64_t tx_id_min = AppLayerParserGetTransactionInspectId(f->alparser, flow_flags);
     const int tx_end_state = AppLayerParserGetStateProgressCompletionStatus(alproto, flow_flags);
 
+    const uint64_t data_version = AppLayerParserGetDataVersion(f->alparser);
+    const bool no_new_data = DetectRunTxNoNewData(det_ctx, sgh, f, flow_flags, data_version);
+
     AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(ipproto, alproto);
     AppLayerGetTxIterState state;
     memset(&state, 0, sizeof(state));
@@ -1382,6 +1432,17 @@ static void DetectRunTx(ThreadVars *tv,
         }
         tx_id_min = tx.tx_id + 1; // next look for cur + 1
 
+        if (no_new_data && (tx.de_state == NULL || tx.de_state->cnt == 0)) {
+            SCLogDebug("%p/%"PRIu64" no new data since last inspection, skip",
+                    tx.tx_ptr, tx.tx_id);
+            det_ctx->tx_skipped_cnt++;
+            goto next;
+        }
+        det_ctx->tx_inspected_cnt++;
+
+        /* buffers cached for another tx or progress can't be used */
+        InspectionBufferCacheSetTx(det_ctx, tx.tx_ptr, tx.tx_progress);
+
         uint32_t array_idx = 0;
         uint32_t total_rules = det_ctx->match_array_cnt;
         total_rules += (tx.de_state ? tx.de_state->cnt : 0);
@@ -1592,6 +1653,8 @@ next:
         if (!ires.has_next)
             break;
     }
+
+    AppLayerParserSetDetectDataVersion(f->alparser, flow_flags, data_version);
 }
 
 /** \brief Apply action(s) and Set 'drop' sig info,
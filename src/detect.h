@@ -345,6 +345,8 @@ typedef struct InspectionBuffer {
 
     const uint8_t *orig;
     uint32_t orig_len;
+
+    int initialized;    /**< set up for the current tx, possibly empty */
 } InspectionBuffer;
 
 /* inspection buffers are kept per tx (in det_ctx), but some protocols
@@ -607,10 +609,25 @@ typedef struct DetectVarList_ {
     struct DetectVarList_ *next;
 } DetectVarList;
 
-typedef struct DetectEngineIPOnlyThreadCtx_ {
-    uint8_t *sig_match_array; /* bit array of sig nums */
-    uint32_t sig_match_size;  /* size in bytes of the array */
-} DetectEngineIPOnlyThreadCtx;
+/** \brief flattened IPv4 longest prefix match table
+ *
+ *  The ranges are sorted and together cover the whole address space.
+ *  Each range maps to a sig set id, 0 meaning no sig set. A /16 index
+ *  narrows the binary search to the ranges overlapping the /16 of the
+ *  address. */
+typedef struct IPOnlyLookupV4_ {
+    uint32_t *start;    /**< first address of each range, host order */
+    uint32_t *set;      /**< sig set id of each range */
+    uint32_t *index;    /**< per /16: last range starting at or before it */
+    uint32_t cnt;       /**< number of ranges */
+} IPOnlyLookupV4;
+
+/** \brief flattened IPv6 longest prefix match table, see IPOnlyLookupV4 */
+typedef struct IPOnlyLookupV6_ {
+    uint64_t *start;    /**< 2 words per range, most significant first */
+    uint32_t *set;      /**< sig set id of each range */
+    uint32_t cnt;       /**< number of ranges */
+} IPOnlyLookupV6;
 
 /** \brief IP only rules matching ctx. */
 typedef struct DetectEngineIPOnlyCtx_ {
@@ -625,6 +642,16 @@ typedef struct DetectEngineIPOnlyCtx_ {
     /* Used to build the radix trees */
     IPOnlyCIDRItem *ip_src, *ip_dst;
 
+    /* Lookup tables built from the radix trees, used at runtime */
+    IPOnlyLookupV4 lookup_ipv4src, lookup_ipv4dst;
+    IPOnlyLookupV6 lookup_ipv6src, lookup_ipv6dst;
+
+    /* deduplicated sig sets: sets_cnt bit arrays of sets_size bytes
+     * each. Set 0 is the empty set. */
+    uint8_t *sets;
+    uint32_t sets_size;
+    uint32_t sets_cnt;
+
     /* counters */
     uint32_t a_src_uniq16, a_src_total16;
     uint32_t a_dst_uniq16, a_dst_total16;
@@ -734,6 +761,11 @@ typedef struct DetectEngineCtx_ {
 
     uint32_t gh_unique, gh_reuse;
 
+    /* rule group memory: bytes in use and bytes saved by sharing the
+     * signature arrays between rule groups */
+    uint64_t sgh_mem_used;
+    uint64_t sgh_mem_saved;
+
     /* init phase vars */
     HashListTable *sgh_hash_table;
 
@@ -747,6 +779,8 @@ typedef struct DetectEngineCtx_ {
 
     uint16_t mpm_matcher; /**< mpm matcher this ctx uses */
     uint16_t spm_matcher; /**< spm matcher this ctx uses */
+    /** bool: use the streaming mpm for the DetectMpmStreamBuffers */
+    uint8_t mpm_streaming;
 
     /* spm thread context prototype, built as spm matchers are constructed and
      * later used to construct thread context for each thread. */
@@ -760,6 +794,9 @@ typedef struct DetectEngineCtx_ {
     /* specify the configuration for mpm context factory */
     uint8_t sgh_mpm_context;
 
+    /* number of threads used to prepare the mpm contexts */
+    uint16_t build_threads;
+
     /* max flowbit id that is used */
     uint32_t max_fb_id;
 
@@ -841,6 +878,13 @@ typedef struct DetectEngineCtx_ {
     /** are we useing just mpm or also other prefilters */
     enum DetectEnginePrefilterSetting prefilter_setting;
 
+    /** use hyperscan to prefilter rules that only have a pcre */
+    bool prefilter_pcre;
+    struct DetectPcrePrefilterCtx_ *pcre_prefilter_ctx;
+    /** rules using the pcre prefilter: exact and approximate matching */
+    uint32_t pcre_prefilter_exact_cnt;
+    uint32_t pcre_prefilter_approx_cnt;
+
     HashListTable *dport_hash_table;
 
     DetectPort *tcp_whitelist;
@@ -899,6 +943,14 @@ enum {
     ENGINE_SGH_MPM_FACTORY_CONTEXT_AUTO
 };
 
+/** buffers that can use the streaming mpm (detect.mpm-streaming) */
+enum DetectMpmStreamBuffers {
+    DETECT_MPM_STREAM_RAW = 0,  /**< reassembled tcp stream */
+    DETECT_MPM_STREAM_HCBD,     /**< http_client_body */
+    DETECT_MPM_STREAM_FILEDATA, /**< file_data toclient: http_server_body */
+    DETECT_MPM_STREAM_MAX,
+};
+
 typedef struct HttpReassembledBody_ {
     const uint8_t *buffer;
     uint8_t *decompressed_buffer;
@@ -994,6 +1046,35 @@ typedef struct DetectEngineThreadCtx_ {
      * buffers in parallel, we need this extra wrapper struct */
     InspectionBufferMultipleForList *multi_inspect_buffers;
 
+    /* inspect_buffers are a cache shared by the prefilter and inspect
+     * engines. They are valid for a single tx at a given progress. The
+     * queue holds the ids of the buffers that may have been filled so
+     * that only those are reset. */
+    struct {
+        const void *tx_ptr;
+        int tx_progress;
+        uint32_t *queue;
+        uint32_t queue_cnt;
+        uint64_t hits;
+        uint64_t misses;
+    } inspect_cache;
+    uint16_t counter_buffer_cache_hits;
+    uint16_t counter_buffer_cache_misses;
+
+    /* txs run through the tx inspection vs txs skipped because the
+     * parser didn't see new data since the last run */
+    uint64_t tx_inspected_cnt;
+    uint64_t tx_skipped_cnt;
+    uint16_t counter_tx_inspected;
+    uint16_t counter_tx_skipped;
+
+    /* streaming mpm: new bytes received per buffer vs the bytes passed
+     * to the matcher. Counters are only registered if it's enabled. */
+    uint64_t mpm_stream_received[DETECT_MPM_STREAM_MAX];
+    uint64_t mpm_stream_scanned[DETECT_MPM_STREAM_MAX];
+    uint16_t counter_mpm_stream_received[DETECT_MPM_STREAM_MAX];
+    uint16_t counter_mpm_stream_scanned[DETECT_MPM_STREAM_MAX];
+
     /* used to discontinue any more matching */
     uint16_t discontinue_matching;
     uint16_t flags;
@@ -1032,13 +1113,15 @@ typedef struct DetectEngineThreadCtx_ {
     MpmThreadCtx mtcs;  /**< thread ctx for stream mpm */
     PrefilterRuleStore pmq;
 
+    /** buffers queued for a batched mpm search, see DetectMpmVectorAdd() */
+    MpmVector *mpm_vec;
+    uint32_t mpm_vec_cnt;
+    uint32_t mpm_vec_size;
+
     /** SPM thread context used for scanning. This has been cloned from the
      * prototype held by DetectEngineCtx. */
     SpmThreadCtx *spm_thread_ctx;
 
-    /** ip only rules ctx */
-    DetectEngineIPOnlyThreadCtx io_ctx;
-
     /* byte jump values */
     uint64_t *bj_values;
 
@@ -1087,6 +1170,8 @@ typedef struct DetectEngineThreadCtx_ {
     struct SCProfileKeywordData_ *keyword_perf_data;
     struct SCProfileKeywordData_ **keyword_perf_data_per_list;
     int keyword_perf_list; /**< list we're currently inspecting, DETECT_SM_LIST_* */
+    struct SCProfilePcreData_ *pcre_perf_data; /**< per rule, by Signature::num */
+    uint32_t pcre_perf_data_size;
     struct SCProfileSghData_ *sgh_perf_data;
 
     struct SCProfilePrefilterData_ *prefilter_perf_data;
@@ -1161,6 +1246,11 @@ enum {
 #define SIG_GROUP_HEAD_HAVEFILESIZE     (1 << 22)
 #define SIG_GROUP_HEAD_HAVEFILESHA1     (1 << 23)
 #define SIG_GROUP_HEAD_HAVEFILESHA256   (1 << 24)
+/** match_array and non prefilter arrays are owned by another sgh */
+#define SIG_GROUP_HEAD_SHARED_ARRAYS    (1 << 25)
+/** has tx rules with flow level conditions, like flowbits, that can
+ *  change on any packet */
+#define SIG_GROUP_HEAD_HAVETXPKTMATCH   (1 << 26)
 
 enum MpmBuiltinBuffers {
     MPMB_TCP_PKT_TS,
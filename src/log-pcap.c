@@ -89,8 +89,27 @@
 
 #define PCAP_SNAPLEN                    262144
 
+#define PCAP_LOG_WRITER_LIBPCAP         0
+#define PCAP_LOG_WRITER_DIRECT          1
+
+#define PCAP_LOG_FORMAT_PCAP            0
+#define PCAP_LOG_FORMAT_PCAPNG          1
+
+/** alignment of the direct writer buffer, file offsets and write sizes */
+#define PCAP_LOG_DIRECT_ALIGN           4096
+#define PCAP_LOG_DIRECT_BUFFER_SIZE     (1024 * 1024)
+#define PCAP_LOG_DIRECT_BUFFER_MIN      (64 * 1024)
+#define PCAP_LOG_DIRECT_BUFFER_MAX      (256 * 1024 * 1024)
+
 SC_ATOMIC_DECLARE(uint32_t, thread_cnt);
 
+/* direct writer stats, all threads */
+static SC_ATOMIC_DECLARE(uint64_t, direct_bytes);
+static SC_ATOMIC_DECLARE(uint64_t, direct_writes);
+static SC_ATOMIC_DECLARE(uint64_t, direct_write_usec);
+static SC_ATOMIC_DECLARE(uint64_t, direct_write_errors);
+static SC_ATOMIC_DECLARE(uint64_t, direct_drops);
+
 typedef struct PcapFileName_ {
     char *filename;
     char *dirname;
@@ -133,6 +152,25 @@ typedef struct PcapLogCompressionData_ {
     uint64_t bytes_in_block;
 } PcapLogCompressionData;
 
+/**
+ *  Direct writer: records are built in an aligned buffer that is
+ *  written out in full, so with O_DIRECT every write is aligned. The
+ *  last partial block of a file is written with O_DIRECT turned off,
+ *  as is the rest of a file once a write was short or was refused as
+ *  unaligned.
+ */
+typedef struct PcapLogDirectData_ {
+    int format;                 /**< PCAP_LOG_FORMAT_* */
+    int o_direct;               /**< open files with O_DIRECT */
+    int fd;
+    int fd_direct;              /**< fd is in O_DIRECT mode */
+    int error;                  /**< write failed, reopen on next packet */
+    uint8_t *buf;               /**< PCAP_LOG_DIRECT_ALIGN aligned */
+    uint32_t buf_size;
+    uint32_t buf_len;
+    uint32_t buf_pkts;          /**< packets (partially) in buf */
+} PcapLogDirectData;
+
 /**
  * PcapLog thread vars
  *
@@ -178,6 +216,9 @@ typedef struct PcapLogData_ {
     int filename_part_cnt;
 
     PcapLogCompressionData compression;
+
+    int writer;                 /**< PCAP_LOG_WRITER_* */
+    PcapLogDirectData direct;
 } PcapLogData;
 
 typedef struct PcapLogThreadData_ {
@@ -209,6 +250,11 @@ void PcapLogRegister(void)
         PcapLogDataDeinit, NULL);
     PcapLogProfileSetup();
     SC_ATOMIC_INIT(thread_cnt);
+    SC_ATOMIC_INIT(direct_bytes);
+    SC_ATOMIC_INIT(direct_writes);
+    SC_ATOMIC_INIT(direct_write_usec);
+    SC_ATOMIC_INIT(direct_write_errors);
+    SC_ATOMIC_INIT(direct_drops);
     return;
 }
 
@@ -230,6 +276,307 @@ static int PcapLogCondition(ThreadVars *tv, const Packet *p)
     return TRUE;
 }
 
+static uint64_t PcapLogDirectNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/** \internal
+ *  \brief turn O_DIRECT off for the rest of the file
+ *
+ *  O_DIRECT writes have to be aligned in memory, size and file offset.
+ */
+static void PcapLogDirectBuffered(PcapLogData *pl)
+{
+#ifdef O_DIRECT
+    PcapLogDirectData *d = &pl->direct;
+
+    if (!d->fd_direct)
+        return;
+    int flags = fcntl(d->fd, F_GETFL);
+    if (flags == -1 || fcntl(d->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+        SCLogWarning(SC_ERR_FWRITE, "pcap-log: unable to clear "
+                "O_DIRECT on %s: %s", pl->filename, strerror(errno));
+        return;
+    }
+    d->fd_direct = 0;
+#endif
+}
+
+/** \internal
+ *  \brief write the first len bytes of the direct writer buffer
+ *
+ *  On failure the packets in the buffer are lost. They are counted as
+ *  drops and the file is replaced on the next packet.
+ *
+ *  \retval 0 ok
+ *  \retval -1 write error
+ */
+static int PcapLogDirectWrite(PcapLogData *pl, uint32_t len)
+{
+    PcapLogDirectData *d = &pl->direct;
+    const uint8_t *ptr = d->buf;
+    uint32_t left = len;
+
+    uint64_t start = PcapLogDirectNow();
+    while (left > 0) {
+        ssize_t r = write(d->fd, ptr, left);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && errno == EINVAL && d->fd_direct) {
+            /* alignment refused, e.g. the device has larger blocks */
+            PcapLogDirectBuffered(pl);
+            if (!d->fd_direct)
+                continue;
+        }
+        if (r <= 0) {
+            SCLogError(SC_ERR_FWRITE, "pcap-log: writing to %s failed: %s",
+                    pl->filename, r < 0 ? strerror(errno) : "short write");
+            (void)SC_ATOMIC_ADD(direct_write_errors, 1);
+            (void)SC_ATOMIC_ADD(direct_drops, d->buf_pkts);
+            d->error = 1;
+            d->buf_len = 0;
+            d->buf_pkts = 0;
+            return -1;
+        }
+        ptr += r;
+        left -= (uint32_t)r;
+
+        /* a short write of part of a block leaves the rest of the buffer
+         * and the file offset unaligned */
+        if (left > 0 && d->fd_direct && (r % PCAP_LOG_DIRECT_ALIGN) != 0) {
+            SCLogDebug("pcap-log: short write of %"PRIuMAX" bytes to %s, "
+                    "O_DIRECT off for the rest of the file", (uintmax_t)r,
+                    pl->filename);
+            PcapLogDirectBuffered(pl);
+        }
+    }
+    (void)SC_ATOMIC_ADD(direct_write_usec, PcapLogDirectNow() - start);
+    (void)SC_ATOMIC_ADD(direct_writes, 1);
+    (void)SC_ATOMIC_ADD(direct_bytes, len);
+    return 0;
+}
+
+/** \internal
+ *  \brief copy data into the buffer, writing it out each time it's full
+ *
+ *  Records are split over buffer boundaries so that all writes but the
+ *  last one of a file are of the full (aligned) buffer size.
+ */
+static int PcapLogDirectAppend(PcapLogData *pl, const void *data, uint32_t len)
+{
+    PcapLogDirectData *d = &pl->direct;
+    const uint8_t *ptr = data;
+
+    while (len > 0) {
+        uint32_t n = MIN(len, d->buf_size - d->buf_len);
+        memcpy(d->buf + d->buf_len, ptr, n);
+        d->buf_len += n;
+        ptr += n;
+        len -= n;
+
+        if (d->buf_len == d->buf_size) {
+            if (PcapLogDirectWrite(pl, d->buf_len) < 0)
+                return -1;
+            d->buf_len = 0;
+            /* rest of the current record goes into the next write */
+            d->buf_pkts = (len > 0) ? 1 : 0;
+        }
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief size of the record for a packet of caplen bytes
+ */
+static uint32_t PcapLogDirectRecordSize(const PcapLogData *pl, uint32_t caplen)
+{
+    if (pl->direct.format == PCAP_LOG_FORMAT_PCAPNG) {
+        /* enhanced packet block: 28 byte header, padded data, length */
+        return 28 + ((caplen + 3) & ~3U) + 4;
+    }
+    return 16 + caplen;
+}
+
+/** \internal
+ *  \brief open pl->filename and add the file header to the buffer
+ */
+static int PcapLogDirectOpen(PcapLogData *pl, int datalink)
+{
+    PcapLogDirectData *d = &pl->direct;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+    if (d->o_direct)
+        flags |= O_DIRECT;
+#endif
+    d->fd = open(pl->filename, flags, 0644);
+    d->fd_direct = (d->fd != -1 && d->o_direct);
+#ifdef O_DIRECT
+    if (d->fd == -1 && d->o_direct && errno == EINVAL) {
+        /* e.g. tmpfs */
+        SCLogWarning(SC_ERR_OPENING_FILE, "pcap-log: O_DIRECT not supported "
+                "for %s, using buffered writes", pl->filename);
+        d->o_direct = 0;
+        d->fd = open(pl->filename, flags & ~O_DIRECT, 0644);
+    }
+#endif
+    if (d->fd == -1) {
+        SCLogError(SC_ERR_OPENING_FILE, "Error opening pcap log file %s: %s",
+                pl->filename, strerror(errno));
+        return TM_ECODE_FAILED;
+    }
+    d->error = 0;
+    d->buf_len = 0;
+    d->buf_pkts = 0;
+
+    /* libpcap writes the LINKTYPE_ value, which only differs from the
+     * DLT_ value for raw IP */
+    uint32_t linktype = (datalink == DLT_RAW) ? LINKTYPE_RAW2 : (uint32_t)datalink;
+
+    if (d->format == PCAP_LOG_FORMAT_PCAPNG) {
+        struct {
+            uint32_t type;
+            uint32_t len;
+            uint32_t magic;
+            uint16_t major;
+            uint16_t minor;
+            uint32_t section_len[2];
+            uint32_t len2;
+        } shb = { 0x0A0D0D0A, 28, 0x1A2B3C4D, 1, 0,
+                  { 0xffffffff, 0xffffffff }, 28 };
+        struct {
+            uint32_t type;
+            uint32_t len;
+            uint16_t linktype;
+            uint16_t reserved;
+            uint32_t snaplen;
+            uint32_t len2;
+        } idb = { 1, 20, (uint16_t)linktype, 0, PCAP_SNAPLEN, 20 };
+
+        BUG_ON(sizeof(shb) != 28 || sizeof(idb) != 20);
+        if (PcapLogDirectAppend(pl, &shb, sizeof(shb)) < 0 ||
+                PcapLogDirectAppend(pl, &idb, sizeof(idb)) < 0)
+            return TM_ECODE_FAILED;
+    } else {
+        struct pcap_file_header fh;
+        memset(&fh, 0, sizeof(fh));
+        fh.magic = 0xa1b2c3d4; /* usec timestamps */
+        fh.version_major = 2;
+        fh.version_minor = 4;
+        fh.snaplen = PCAP_SNAPLEN;
+        fh.linktype = linktype;
+        if (PcapLogDirectAppend(pl, &fh, sizeof(fh)) < 0)
+            return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+}
+
+/** \internal
+ *  \brief add a packet record to the buffer
+ *
+ *  \param caplen bytes of data to log, at most PCAP_SNAPLEN
+ *  \param len original length of the packet
+ */
+static int PcapLogDirectPacket(PcapLogData *pl, const struct timeval *ts,
+        const uint8_t *data, uint32_t caplen, uint32_t len)
+{
+    PcapLogDirectData *d = &pl->direct;
+    int r;
+
+    d->buf_pkts++;
+    if (d->format == PCAP_LOG_FORMAT_PCAPNG) {
+        uint32_t block_len = PcapLogDirectRecordSize(pl, caplen);
+        uint64_t usecs = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+        uint32_t epb[7] = { 6, block_len, 0, (uint32_t)(usecs >> 32),
+                            (uint32_t)usecs, caplen, len };
+        static const uint8_t pad[3] = { 0, 0, 0 };
+
+        r = PcapLogDirectAppend(pl, epb, sizeof(epb));
+        if (r == 0)
+            r = PcapLogDirectAppend(pl, data, caplen);
+        if (r == 0)
+            r = PcapLogDirectAppend(pl, pad, ((caplen + 3) & ~3U) - caplen);
+        if (r == 0)
+            r = PcapLogDirectAppend(pl, &block_len, sizeof(block_len));
+    } else {
+        uint32_t hdr[4] = { (uint32_t)ts->tv_sec, (uint32_t)ts->tv_usec,
+                            caplen, len };
+
+        r = PcapLogDirectAppend(pl, hdr, sizeof(hdr));
+        if (r == 0)
+            r = PcapLogDirectAppend(pl, data, caplen);
+    }
+    return r;
+}
+
+/** \internal
+ *  \brief write out what is left in the buffer and close the file
+ */
+static int PcapLogDirectClose(PcapLogData *pl)
+{
+    PcapLogDirectData *d = &pl->direct;
+    int r = 0;
+
+    if (d->fd == -1)
+        return 0;
+
+    if (!d->error && d->buf_len > 0) {
+        /* the tail is not a multiple of the block size */
+        if (d->buf_len % PCAP_LOG_DIRECT_ALIGN)
+            PcapLogDirectBuffered(pl);
+        r = PcapLogDirectWrite(pl, d->buf_len);
+    }
+    close(d->fd);
+    d->fd = -1;
+    d->fd_direct = 0;
+    d->error = 0;
+    d->buf_len = 0;
+    d->buf_pkts = 0;
+    return r;
+}
+
+static uint64_t PcapLogDirectCounterBytes(void)
+{
+    return SC_ATOMIC_GET(direct_bytes);
+}
+
+static uint64_t PcapLogDirectCounterWrites(void)
+{
+    return SC_ATOMIC_GET(direct_writes);
+}
+
+static uint64_t PcapLogDirectCounterWriteUsec(void)
+{
+    return SC_ATOMIC_GET(direct_write_usec);
+}
+
+static uint64_t PcapLogDirectCounterWriteErrors(void)
+{
+    return SC_ATOMIC_GET(direct_write_errors);
+}
+
+static uint64_t PcapLogDirectCounterDrops(void)
+{
+    return SC_ATOMIC_GET(direct_drops);
+}
+
+static void PcapLogDirectReport(const PcapLogData *pl)
+{
+    if (pl->writer != PCAP_LOG_WRITER_DIRECT)
+        return;
+
+    uint64_t bytes = SC_ATOMIC_GET(direct_bytes);
+    uint64_t usec = SC_ATOMIC_GET(direct_write_usec);
+    SCLogInfo("pcap-log: wrote %"PRIu64" bytes in %"PRIu64" writes "
+            "(%"PRIu64" MiB/s), %"PRIu64" write errors, %"PRIu64
+            " packets dropped", bytes, SC_ATOMIC_GET(direct_writes),
+            usec ? (bytes * 1000000 / usec) / (1024 * 1024) : 0,
+            SC_ATOMIC_GET(direct_write_errors), SC_ATOMIC_GET(direct_drops));
+}
+
 /**
  * \brief Function to close pcaplog file
  *
@@ -241,6 +588,13 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
     if (pl != NULL) {
         PCAPLOG_PROFILE_START;
 
+        if (pl->writer == PCAP_LOG_WRITER_DIRECT) {
+            int r = PcapLogDirectClose(pl);
+            pl->size_current = 0;
+            PCAPLOG_PROFILE_END(pl->profile_close);
+            return r;
+        }
+
         if (pl->pcap_dumper != NULL) {
             pcap_dump_close(pl->pcap_dumper);
 #ifdef HAVE_LIBLZ4
@@ -500,6 +854,13 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     pl->h->caplen = GET_PKT_LEN(p);
     pl->h->len = GET_PKT_LEN(p);
     len = sizeof(*pl->h) + GET_PKT_LEN(p);
+    if (pl->writer == PCAP_LOG_WRITER_DIRECT) {
+        pl->h->caplen = MIN(GET_PKT_LEN(p), PCAP_SNAPLEN);
+        len = PcapLogDirectRecordSize(pl, pl->h->caplen);
+        /* replace the file after a failed write */
+        if (pl->direct.error)
+            rotate = 1;
+    }
 
     if (pl->filename == NULL) {
         ret = PcapLogOpenFileCtx(pl);
@@ -548,6 +909,26 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     }
 #endif /* HAVE_LIBLZ4 */
 
+    if (pl->writer == PCAP_LOG_WRITER_DIRECT) {
+        if (pl->direct.fd == -1) {
+            if (PcapLogDirectOpen(pl, p->datalink) != TM_ECODE_OK) {
+                (void)SC_ATOMIC_ADD(direct_drops, 1);
+                PcapLogUnlock(pl);
+                return TM_ECODE_FAILED;
+            }
+        }
+
+        PCAPLOG_PROFILE_START;
+        ret = PcapLogDirectPacket(pl, &p->ts, GET_PKT_DATA(p),
+                pl->h->caplen, GET_PKT_LEN(p));
+        pl->size_current += len;
+        PCAPLOG_PROFILE_END(pl->profile_write);
+        pl->profile_data_size += len;
+
+        PcapLogUnlock(pl);
+        return ret == 0 ? TM_ECODE_OK : TM_ECODE_FAILED;
+    }
+
     /* XXX pcap handles, nfq, pfring, can only have one link type ipfw? we do
      * this here as we don't know the link type until we get our first packet */
     if (pl->pcap_dead_handle == NULL || pl->pcap_dumper == NULL) {
@@ -689,6 +1070,22 @@ static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
     }
 #endif /* HAVE_LIBLZ4 */
 
+    copy->writer = pl->writer;
+    copy->direct.fd = -1;
+    if (pl->writer == PCAP_LOG_WRITER_DIRECT) {
+        copy->direct.format = pl->direct.format;
+        copy->direct.o_direct = pl->direct.o_direct;
+        copy->direct.buf_size = pl->direct.buf_size;
+        copy->direct.buf = SCMallocAligned(copy->direct.buf_size,
+                PCAP_LOG_DIRECT_ALIGN);
+        if (copy->direct.buf == NULL) {
+            SCFree(copy->prefix);
+            SCFree(copy->h);
+            SCFree(copy);
+            return NULL;
+        }
+    }
+
     TAILQ_INIT(&copy->pcap_file_list);
     SCMutexInit(&copy->plog_lock, NULL);
 
@@ -1013,6 +1410,9 @@ static void PcapLogDataFree(PcapLogData *pl)
         }
     }
 #endif /* HAVE_LIBLZ4 */
+    if (pl->direct.buf != NULL) {
+        SCFreeAligned(pl->direct.buf);
+    }
     SCFree(pl);
 }
 
@@ -1029,7 +1429,7 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
     PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
     PcapLogData *pl = td->pcap_log;
 
-    if (pl->pcap_dumper != NULL) {
+    if (pl->pcap_dumper != NULL || pl->direct.fd != -1) {
         if (PcapLogCloseFile(t,pl) < 0) {
             SCLogDebug("PcapLogCloseFile failed");
         }
@@ -1039,12 +1439,15 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
         SCMutexLock(&g_pcap_data->plog_lock);
         StatsMerge(g_pcap_data, pl);
         g_pcap_data->reported++;
-        if (g_pcap_data->threads == g_pcap_data->reported)
+        if (g_pcap_data->threads == g_pcap_data->reported) {
             PcapLogProfilingDump(g_pcap_data);
+            PcapLogDirectReport(g_pcap_data);
+        }
         SCMutexUnlock(&g_pcap_data->plog_lock);
     } else {
         if (pl->reported == 0) {
             PcapLogProfilingDump(pl);
+            PcapLogDirectReport(pl);
             pl->reported = 1;
         }
     }
@@ -1151,6 +1554,88 @@ error:
     return -1;
 }
 
+/** \internal
+ *  \brief setup the direct writer from the "direct" section
+ */
+static void PcapLogInitDirect(PcapLogData *pl, ConfNode *conf)
+{
+    uint64_t buf_size = PCAP_LOG_DIRECT_BUFFER_SIZE;
+
+    if (pl->compression.format != PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-log: the direct writer "
+                "does not support compression");
+        exit(EXIT_FAILURE);
+    }
+
+    pl->writer = PCAP_LOG_WRITER_DIRECT;
+    pl->direct.format = PCAP_LOG_FORMAT_PCAP;
+    pl->direct.o_direct = 1;
+
+    ConfNode *dconf = ConfNodeLookupChild(conf, "direct");
+    if (dconf != NULL) {
+        const char *val = ConfNodeLookupChildValue(dconf, "buffer-size");
+        if (val != NULL && ParseSizeStringU64(val, &buf_size) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-log: invalid "
+                    "direct.buffer-size: %s", val);
+            exit(EXIT_FAILURE);
+        }
+
+        val = ConfNodeLookupChildValue(dconf, "format");
+        if (val != NULL) {
+            if (strcasecmp(val, "pcapng") == 0) {
+                pl->direct.format = PCAP_LOG_FORMAT_PCAPNG;
+            } else if (strcasecmp(val, "pcap") != 0) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-log: invalid "
+                        "direct.format \"%s\". Valid options: \"pcap\" or "
+                        "\"pcapng\"", val);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int o_direct;
+        if (ConfGetChildValueBool(dconf, "o-direct", &o_direct)) {
+            pl->direct.o_direct = o_direct;
+        }
+    }
+#ifndef O_DIRECT
+    if (pl->direct.o_direct) {
+        SCLogInfo("pcap-log: O_DIRECT not available on this platform");
+        pl->direct.o_direct = 0;
+    }
+#endif
+
+    if (buf_size < PCAP_LOG_DIRECT_BUFFER_MIN ||
+            buf_size > PCAP_LOG_DIRECT_BUFFER_MAX) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-log: direct.buffer-size "
+                "must be between %u and %u", PCAP_LOG_DIRECT_BUFFER_MIN,
+                PCAP_LOG_DIRECT_BUFFER_MAX);
+        exit(EXIT_FAILURE);
+    }
+    pl->direct.buf_size = (uint32_t)((buf_size + PCAP_LOG_DIRECT_ALIGN - 1) &
+            ~((uint64_t)PCAP_LOG_DIRECT_ALIGN - 1));
+
+    /* in multi mode each thread gets its own buffer */
+    if (pl->mode != LOGMODE_MULTI) {
+        pl->direct.buf = SCMallocAligned(pl->direct.buf_size,
+                PCAP_LOG_DIRECT_ALIGN);
+        if (pl->direct.buf == NULL) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    StatsRegisterGlobalCounter("pcap_log.bytes", PcapLogDirectCounterBytes);
+    StatsRegisterGlobalCounter("pcap_log.writes", PcapLogDirectCounterWrites);
+    StatsRegisterGlobalCounter("pcap_log.write_usec",
+            PcapLogDirectCounterWriteUsec);
+    StatsRegisterGlobalCounter("pcap_log.write_errors",
+            PcapLogDirectCounterWriteErrors);
+    StatsRegisterGlobalCounter("pcap_log.drops", PcapLogDirectCounterDrops);
+
+    SCLogInfo("pcap-log: direct writer, %s format, %u byte buffer%s",
+            pl->direct.format == PCAP_LOG_FORMAT_PCAPNG ? "pcapng" : "pcap",
+            pl->direct.buf_size, pl->direct.o_direct ? ", O_DIRECT" : "");
+}
+
 /** \brief Fill in pcap logging struct from the provided ConfNode.
  *  \param conf The configuration node for this output.
  *  \retval output_ctx
@@ -1182,6 +1667,8 @@ static OutputInitResult PcapLogInitCtx(ConfNode *conf)
     pl->timestamp_format = TS_FORMAT_SEC;
     pl->use_stream_depth = USE_STREAM_DEPTH_DISABLED;
     pl->honor_pass_rules = HONOR_PASS_RULES_DISABLED;
+    pl->writer = PCAP_LOG_WRITER_LIBPCAP;
+    pl->direct.fd = -1;
 
     TAILQ_INIT(&pl->pcap_file_list);
 
@@ -1488,6 +1975,21 @@ static OutputInitResult PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    const char *writer = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        writer = ConfNodeLookupChildValue(conf, "writer");
+    }
+    if (writer != NULL) {
+        if (strcasecmp(writer, "direct") == 0) {
+            PcapLogInitDirect(pl, conf);
+        } else if (strcasecmp(writer, "libpcap") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap writer \"%s\" is invalid, must be \"libpcap\" "
+                "or \"direct\"", writer);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* create the output ctx and send it back */
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
@@ -1839,3 +2341,129 @@ void PcapLogProfileSetup(void)
         }
     }
 }
+
+#ifdef UNITTESTS
+/** \internal
+ *  \brief create a test file, on a filesystem that supports O_DIRECT if
+ *         there is one
+ *
+ *  /tmp is often a tmpfs, which doesn't. Try the current directory and
+ *  /var/tmp first, then fall back to a buffered file in /tmp.
+ *
+ *  \param o_direct set to 1 if the file can be opened with O_DIRECT
+ *
+ *  \retval 1 file created
+ *  \retval 0 no file could be created
+ */
+static int PcapLogDirectTestFile(char *filename, size_t size, int *o_direct)
+{
+#ifdef O_DIRECT
+    const char *dirs[] = { ".", "/var/tmp", NULL };
+
+    for (int i = 0; dirs[i] != NULL; i++) {
+        snprintf(filename, size, "%s/suricata-pcap-log-XXXXXX", dirs[i]);
+        int fd = mkstemp(filename);
+        if (fd == -1)
+            continue;
+        close(fd);
+        fd = open(filename, O_WRONLY | O_DIRECT);
+        if (fd != -1) {
+            close(fd);
+            *o_direct = 1;
+            return 1;
+        }
+        unlink(filename);
+    }
+#endif
+    snprintf(filename, size, "/tmp/suricata-pcap-log-XXXXXX");
+    int fd = mkstemp(filename);
+    if (fd == -1)
+        return 0;
+    close(fd);
+    *o_direct = 0;
+    return 1;
+}
+
+/** \test write packets with the direct writer in the given format and
+ *        read them back with libpcap. Without O_DIRECT support the
+ *        buffered path of the writer is tested. */
+static int PcapLogDirectTestFormat(int format)
+{
+    char filename[PATH_MAX];
+    int o_direct = 0;
+    FAIL_IF_NOT(PcapLogDirectTestFile(filename, sizeof(filename), &o_direct));
+    if (!o_direct) {
+        SCLogNotice("O_DIRECT is not supported in the current directory "
+                "or /var/tmp, testing buffered writes only");
+    }
+
+    PcapLogData *pl = SCCalloc(1, sizeof(*pl));
+    FAIL_IF_NULL(pl);
+    pl->writer = PCAP_LOG_WRITER_DIRECT;
+    pl->filename = filename;
+    pl->direct.fd = -1;
+    pl->direct.format = format;
+    pl->direct.o_direct = o_direct;
+    pl->direct.buf_size = PCAP_LOG_DIRECT_BUFFER_MIN;
+    pl->direct.buf = SCMallocAligned(pl->direct.buf_size, PCAP_LOG_DIRECT_ALIGN);
+    FAIL_IF_NULL(pl->direct.buf);
+
+    /* enough packets of odd sizes to fill the buffer several times */
+    uint8_t pkt[1601];
+    for (uint32_t i = 0; i < sizeof(pkt); i++)
+        pkt[i] = (uint8_t)i;
+
+    FAIL_IF(PcapLogDirectOpen(pl, DLT_EN10MB) != TM_ECODE_OK);
+    FAIL_IF(pl->direct.fd_direct != o_direct);
+    for (uint32_t i = 0; i < 500; i++) {
+        struct timeval ts = { 1500000000 + i, i * 7 };
+        uint32_t len = 1 + (i * 37) % sizeof(pkt);
+        FAIL_IF(PcapLogDirectPacket(pl, &ts, pkt, len, len + 1) != 0);
+    }
+    FAIL_IF(PcapLogDirectClose(pl) != 0);
+    FAIL_IF(pl->direct.fd != -1);
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(filename, errbuf);
+    FAIL_IF_NULL(pcap);
+    FAIL_IF(pcap_datalink(pcap) != DLT_EN10MB);
+
+    struct pcap_pkthdr *h;
+    const u_char *data;
+    uint32_t cnt = 0;
+    while (pcap_next_ex(pcap, &h, &data) == 1) {
+        uint32_t len = 1 + (cnt * 37) % sizeof(pkt);
+        FAIL_IF(h->ts.tv_sec != 1500000000 + cnt);
+        FAIL_IF(h->ts.tv_usec != cnt * 7);
+        FAIL_IF(h->caplen != len);
+        FAIL_IF(h->len != len + 1);
+        FAIL_IF(memcmp(data, pkt, len) != 0);
+        cnt++;
+    }
+    FAIL_IF(cnt != 500);
+    pcap_close(pcap);
+
+    unlink(filename);
+    SCFreeAligned(pl->direct.buf);
+    SCFree(pl);
+    PASS;
+}
+
+static int PcapLogDirectTest01(void)
+{
+    return PcapLogDirectTestFormat(PCAP_LOG_FORMAT_PCAP);
+}
+
+static int PcapLogDirectTest02(void)
+{
+    return PcapLogDirectTestFormat(PCAP_LOG_FORMAT_PCAPNG);
+}
+#endif /* UNITTESTS */
+
+void PcapLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapLogDirectTest01", PcapLogDirectTest01);
+    UtRegisterTest("PcapLogDirectTest02", PcapLogDirectTest02);
+#endif /* UNITTESTS */
+}
@@ -30,5 +30,6 @@
 
 void PcapLogRegister(void);
 void PcapLogProfileSetup(void);
+void PcapLogRegisterTests(void);
 
 #endif /* __LOG_PCAP_H__ */
@@ -30,6 +30,7 @@
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "detect-filemagic.h"
+#include "util-file-offload.h"
 #include "util-profiling.h"
 #include "util-validate.h"
 
@@ -115,6 +116,13 @@ static void OutputFileLogFfc(ThreadVars *tv,
             SCLogDebug("ff %p state %u", ff, ff->state);
 
             if (ff->state > FILE_STATE_OPENED) {
+                /* log the file once the offload pool has the hashes, at
+                 * the end of the flow wait for them. Only tcp flows get
+                 * pseudo packets at the end. */
+                if (!FileOffloadSync(ff, file_close || file_trunc ||
+                            p->proto != IPPROTO_TCP))
+                    continue;
+
                 bool file_logged = false;
 #ifdef HAVE_MAGIC
                 if (FileForceMagic() && ff->magic == NULL) {
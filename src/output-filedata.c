@@ -30,6 +30,7 @@
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "detect-filemagic.h"
+#include "util-file-offload.h"
 #include "conf.h"
 #include "util-profiling.h"
 
@@ -133,7 +134,8 @@ static void OutputFiledataLogFfc(ThreadVars *tv, OutputLoggerThreadStore *store,
         for (ff = ffc->head; ff != NULL; ff = ff->next) {
             uint8_t file_flags = call_flags;
 #ifdef HAVE_MAGIC
-            if (FileForceMagic() && ff->magic == NULL) {
+            if (FileForceMagic() && ff->magic == NULL &&
+                    !FileOffloadMagic(ff)) {
                 FilemagicGlobalLookup(ff);
             }
 #endif
@@ -155,11 +157,28 @@ static void OutputFiledataLogFfc(ThreadVars *tv, OutputLoggerThreadStore *store,
                 if (ff->state < FILE_STATE_CLOSED) {
                     FileCloseFilePtr(ff, NULL, 0, FILE_TRUNCATED);
                 }
+                (void)FileOffloadSync(ff, true);
                 CallLoggers(tv, store, p, ff, NULL, 0, OUTPUT_FILEDATA_FLAG_CLOSE, dir);
                 ff->flags |= FILE_STORED;
                 continue;
             }
 
+            /* if file needs to be closed or truncated, inform
+             * loggers */
+            if ((file_close || file_trunc) && ff->state < FILE_STATE_CLOSED) {
+                FileCloseFilePtr(ff, NULL, 0, FILE_TRUNCATED);
+            }
+
+            /* tell the logger we're closing up, once the offload pool
+             * has the hashes. At the end of the flow wait for them. Only
+             * tcp flows get pseudo packets at the end. */
+            if (ff->state >= FILE_STATE_CLOSED) {
+                if (!FileOffloadSync(ff, file_close || file_trunc ||
+                            p->proto != IPPROTO_TCP))
+                    continue;
+                file_flags |= OUTPUT_FILEDATA_FLAG_CLOSE;
+            }
+
             /* store */
 
             /* if file_store_id == 0, this is the first store of this file */
@@ -171,16 +190,6 @@ static void OutputFiledataLogFfc(ThreadVars *tv, OutputLoggerThreadStore *store,
                 /* existing file */
             }
 
-            /* if file needs to be closed or truncated, inform
-             * loggers */
-            if ((file_close || file_trunc) && ff->state < FILE_STATE_CLOSED) {
-                FileCloseFilePtr(ff, NULL, 0, FILE_TRUNCATED);
-            }
-
-            /* tell the logger we're closing up */
-            if (ff->state >= FILE_STATE_CLOSED)
-                file_flags |= OUTPUT_FILEDATA_FLAG_CLOSE;
-
             /* do the actual logging */
             const uint8_t *data = NULL;
             uint32_t data_len = 0;
@@ -28,6 +28,7 @@
 
 #include "util-print.h"
 #include "util-misc.h"
+#include "util-file-offload.h"
 
 #ifdef HAVE_NSS
 
@@ -121,64 +122,161 @@ static void OutputFilestoreUpdateFileTime(const char *src_filename,
     }
 }
 
-static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
-        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
-        const Packet *p, File *ff, uint8_t dir) {
+static void OutputFilestoreFinalFilename(const OutputFilestoreCtx *ctx,
+        const uint8_t *sha256, char *final_filename, size_t size)
+{
     /* Stringify the SHA256 which will be used in the final
      * filename. */
     char sha256string[(SHA256_LENGTH * 2) + 1];
-    PrintHexString(sha256string, sizeof(sha256string), ff->sha256,
-            sizeof(ff->sha256));
+    PrintHexString(sha256string, sizeof(sha256string), (uint8_t *)sha256,
+            SHA256_LENGTH);
 
-    char tmp_filename[PATH_MAX] = "";
-    snprintf(tmp_filename, sizeof(tmp_filename), "%s/file.%u", ctx->tmpdir,
-            ff->file_store_id);
-
-    char final_filename[PATH_MAX] = "";
-    snprintf(final_filename, sizeof(final_filename), "%s/%c%c/%s",
-            ctx->prefix, sha256string[0], sha256string[1], sha256string);
+    snprintf(final_filename, size, "%s/%c%c/%s", ctx->prefix,
+            sha256string[0], sha256string[1], sha256string);
+}
 
+/**
+ * \brief Move a stored file to its final name, or remove it if the
+ *     same content is stored already.
+ *
+ * \param errors incremented for every failed file system operation
+ *
+ * \retval true if the content is in place
+ */
+static bool OutputFilestoreMoveFile(const char *tmp_filename,
+        const char *final_filename, int *errors)
+{
     if (SCPathExists(final_filename)) {
         OutputFilestoreUpdateFileTime(tmp_filename, final_filename);
         if (unlink(tmp_filename) != 0) {
-            StatsIncr(tv, oft->fs_error_counter);
+            (*errors)++;
             WARN_ONCE(SC_WARN_REMOVE_FILE,
                     "Failed to remove temporary file %s: %s", tmp_filename,
                     strerror(errno));
         }
     } else if (rename(tmp_filename, final_filename) != 0) {
-        StatsIncr(tv, oft->fs_error_counter);
+        (*errors)++;
         WARN_ONCE(SC_WARN_RENAMING_FILE, "Failed to rename %s to %s: %s",
                 tmp_filename, final_filename, strerror(errno));
         if (unlink(tmp_filename) != 0) {
             /* Just increment, don't log as has_fs_errors would
              * already be set above. */
-            StatsIncr(tv, oft->fs_error_counter);
+            (*errors)++;
         }
-        return;
+        return false;
     }
+    return true;
+}
 
+static void OutputFilestoreWriteFileinfo(const OutputFilestoreCtx *ctx,
+        const Packet *p, File *ff, uint8_t dir, const char *final_filename)
+{
 #ifdef HAVE_LIBJANSSON
-    if (ctx->fileinfo) {
-        char js_metadata_filename[PATH_MAX];
-        if (snprintf(js_metadata_filename, sizeof(js_metadata_filename),
-                        "%s.%"PRIuMAX".%u.json", final_filename,
-                        (uintmax_t)p->ts.tv_sec, ff->file_store_id)
-                == (int)sizeof(js_metadata_filename)) {
-            WARN_ONCE(SC_ERR_SPRINTF,
-                "Failed to write file info record. Output filename truncated.");
-        } else {
-            json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
-                    ctx->xff_cfg);
-            if (likely(js_fileinfo != NULL)) {
-                json_dump_file(js_fileinfo, js_metadata_filename, 0);
-                json_decref(js_fileinfo);
-            }
+    char js_metadata_filename[PATH_MAX];
+    if (snprintf(js_metadata_filename, sizeof(js_metadata_filename),
+                    "%s.%"PRIuMAX".%u.json", final_filename,
+                    (uintmax_t)p->ts.tv_sec, ff->file_store_id)
+            == (int)sizeof(js_metadata_filename)) {
+        WARN_ONCE(SC_ERR_SPRINTF,
+            "Failed to write file info record. Output filename truncated.");
+    } else {
+        json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
+                ctx->xff_cfg);
+        if (likely(js_fileinfo != NULL)) {
+            json_dump_file(js_fileinfo, js_metadata_filename, 0);
+            json_decref(js_fileinfo);
         }
     }
 #endif
 }
 
+static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
+        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
+        const Packet *p, File *ff, uint8_t dir) {
+    char tmp_filename[PATH_MAX] = "";
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s/file.%u", ctx->tmpdir,
+            ff->file_store_id);
+
+    char final_filename[PATH_MAX] = "";
+    OutputFilestoreFinalFilename(ctx, ff->sha256, final_filename,
+            sizeof(final_filename));
+
+    int errors = 0;
+    bool moved = OutputFilestoreMoveFile(tmp_filename, final_filename,
+            &errors);
+    if (errors > 0) {
+        StatsAddUI64(tv, oft->fs_error_counter, errors);
+    }
+    if (!moved) {
+        return;
+    }
+
+    if (ctx->fileinfo) {
+        OutputFilestoreWriteFileinfo(ctx, p, ff, dir, final_filename);
+    }
+}
+
+/**
+ * \brief Called by the file offload pool once it closed a stored file.
+ */
+static int OutputFilestoreOffloadDone(void *data, const char *tmp_filename,
+        const uint8_t *sha256)
+{
+    const OutputFilestoreCtx *ctx = (const OutputFilestoreCtx *)data;
+
+    char final_filename[PATH_MAX] = "";
+    OutputFilestoreFinalFilename(ctx, sha256, final_filename,
+            sizeof(final_filename));
+
+    int errors = 0;
+    (void)OutputFilestoreMoveFile(tmp_filename, final_filename, &errors);
+    return errors;
+}
+
+/**
+ * \brief Hand the writes of a file to the file offload pool.
+ *
+ * The pool creates, appends to and closes the temporary file and moves it
+ * in place. The file info record needs the packet, so it is written
+ * here. Errors of the pool are counted in file_offload.store_errors.
+ */
+static void OutputFilestoreOffloadLogger(ThreadVars *tv,
+        OutputFilestoreLogThread *aft, const Packet *p, File *ff,
+        const char *filename, const uint8_t *data, uint32_t data_len,
+        uint8_t flags, uint8_t dir)
+{
+    OutputFilestoreCtx *ctx = aft->ctx;
+
+    if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+        bool keep_open = false;
+        if (SC_ATOMIC_GET(filestore_open_file_cnt) < FileGetMaxOpenFiles()) {
+            SC_ATOMIC_ADD(filestore_open_file_cnt, 1);
+            keep_open = true;
+        } else if (FileGetMaxOpenFiles() > 0) {
+            StatsIncr(tv, aft->counter_max_hits);
+        }
+        FileOffloadStoreOpen(ff, filename, keep_open,
+                OutputFilestoreOffloadDone, ctx);
+    }
+
+    if (data != NULL) {
+        FileOffloadStoreData(ff, data, data_len);
+    }
+
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        if (FileOffloadStoreClose(ff)) {
+            SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+        }
+        /* the hashes were picked up before the close */
+        if (ctx->fileinfo) {
+            char final_filename[PATH_MAX] = "";
+            OutputFilestoreFinalFilename(ctx, ff->sha256, final_filename,
+                    sizeof(final_filename));
+            OutputFilestoreWriteFileinfo(ctx, p, ff, dir, final_filename);
+        }
+    }
+}
+
 static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
         const Packet *p, File *ff, const uint8_t *data, uint32_t data_len,
         uint8_t flags, uint8_t dir)
@@ -205,6 +303,12 @@ static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
             ctx->tmpdir, ff->file_store_id);
     snprintf(filename, sizeof(filename), "%s", base_filename);
 
+    if (ff->offload != NULL) {
+        OutputFilestoreOffloadLogger(tv, aft, p, ff, filename, data, data_len,
+                flags, dir);
+        return 0;
+    }
+
     if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
         file_fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY,
                 0644);
@@ -76,6 +76,9 @@
 #include "util-buffer.h"
 #include "util-crypt.h"
 #include "util-validate.h"
+#include "util-hashlist.h"
+#include "util-hash-lookup3.h"
+#include "util-time.h"
 
 #define MODULE_NAME "JsonAlertLog"
 
@@ -98,6 +101,11 @@
 
 #define JSON_STREAM_BUFFER_SIZE 4096
 
+#define ALERT_AGGREGATE_DEFAULT_WINDOW  60
+#define ALERT_AGGREGATE_DEFAULT_MEMCAP  (1024 * 1024)
+#define ALERT_AGGREGATE_HASH_SIZE       4096
+#define ALERT_AGGREGATE_MAX_INSTANCES   8
+
 typedef struct AlertJsonOutputCtx_ {
     LogFileCtx* file_ctx;
     uint16_t flags;
@@ -105,6 +113,13 @@ typedef struct AlertJsonOutputCtx_ {
     HttpXFFCfg *xff_cfg;
     HttpXFFCfg *parent_xff_cfg;
     bool include_metadata;
+
+    /** aggregation window in seconds, 0 if aggregation is disabled */
+    uint32_t aggregate_window;
+    /** max alerts tracked per thread */
+    uint32_t aggregate_max;
+    /** index into alert_aggregate_next */
+    int aggregate_slot;
 } AlertJsonOutputCtx;
 
 typedef struct JsonAlertLogThread_ {
@@ -113,8 +128,50 @@ typedef struct JsonAlertLogThread_ {
     MemBuffer *json_buffer;
     MemBuffer *payload_buffer;
     AlertJsonOutputCtx* json_output_ctx;
+
+    /** AlertAggregateEntry's, NULL if aggregation is disabled */
+    HashListTable *aggregate;
+    uint32_t aggregate_cnt;
+    uint16_t counter_aggregate_suppressed;
+    uint16_t counter_aggregate_summaries;
+    uint16_t counter_aggregate_memcap;
 } JsonAlertLogThread;
 
+/* alerts are aggregated by signature, source, destination, destination
+ * port and protocol. The addresses are the logged ones, so with xff in
+ * overwrite mode the clients behind a proxy are aggregated apart. The
+ * key is hashed as 32 bit words, so its size is a multiple of 4. */
+typedef struct AlertAggregateKey_ {
+    char src_ip[46];
+    char dst_ip[46];
+    uint32_t gid;
+    uint32_t sid;
+    /* dest port, proto and address family */
+    uint32_t dp_proto;
+} AlertAggregateKey;
+
+typedef struct AlertAggregateEntry_ {
+    /* first, as the hash table only looks at the key */
+    AlertAggregateKey key;
+
+    uint32_t rev;
+    int prio;
+    JsonAddrInfo addr;
+    /** alerts not logged since the last record */
+    uint64_t count;
+    struct timeval first_ts;
+    struct timeval last_ts;
+    /** end of the current window */
+    time_t window_end;
+} AlertAggregateEntry;
+
+/** number of alert loggers with aggregation enabled */
+static int alert_aggregate_instances = 0;
+/** per thread and logger: end of the earliest window, 0 if there is
+ *  none. Lets JsonAlertLogCondition() hand packets without alerts to the
+ *  logger, so the summaries are written once the window is over. */
+static __thread time_t alert_aggregate_next[ALERT_AGGREGATE_MAX_INSTANCES];
+
 /* Callback function to pack payload contents from a stream into a buffer
  * so we can report them in JSON output. */
 static int AlertJsonDumpStreamSegmentCallback(const Packet *p, void *data, const uint8_t *buf, uint32_t buflen)
@@ -125,7 +182,7 @@ static int AlertJsonDumpStreamSegmentCallback(const Packet *p, void *data, const
     return 1;
 }
 
-static void AlertJsonTls(const Flow *f, json_t *js)
+static void AlertJsonTls(const Flow *f, JsonBuilder *jb)
 {
     SSLState *ssl_state = (SSLState *)FlowGetAppState(f);
     if (ssl_state) {
@@ -136,13 +193,14 @@ static void AlertJsonTls(const Flow *f, json_t *js)
         JsonTlsLogJSONBasic(tjs, ssl_state);
         JsonTlsLogJSONExtended(tjs, ssl_state);
 
-        json_object_set_new(js, "tls", tjs);
+        JsonBuilderSetJson(jb, "tls", tjs);
+        json_decref(tjs);
     }
 
     return;
 }
 
-static void AlertJsonSsh(const Flow *f, json_t *js)
+static void AlertJsonSsh(const Flow *f, JsonBuilder *jb)
 {
     SshState *ssh_state = (SshState *)FlowGetAppState(f);
     if (ssh_state) {
@@ -152,13 +210,14 @@ static void AlertJsonSsh(const Flow *f, json_t *js)
 
         JsonSshLogJSON(tjs, ssh_state);
 
-        json_object_set_new(js, "ssh", tjs);
+        JsonBuilderSetJson(jb, "ssh", tjs);
+        json_decref(tjs);
     }
 
     return;
 }
 
-static void AlertJsonDnp3(const Flow *f, json_t *js)
+static void AlertJsonDnp3(const Flow *f, JsonBuilder *jb)
 {
     DNP3State *dnp3_state = (DNP3State *)FlowGetAppState(f);
     if (dnp3_state) {
@@ -180,7 +239,8 @@ static void AlertJsonDnp3(const Flow *f, json_t *js)
                         json_object_set_new(dnp3js, "response", response);
                     }
                 }
-                json_object_set_new(js, "dnp3", dnp3js);
+                JsonBuilderSetJson(jb, "dnp3", dnp3js);
+                json_decref(dnp3js);
             }
         }
     }
@@ -188,7 +248,7 @@ static void AlertJsonDnp3(const Flow *f, json_t *js)
     return;
 }
 
-static void AlertJsonDns(const Flow *f, json_t *js)
+static void AlertJsonDns(const Flow *f, JsonBuilder *jb)
 {
 #ifndef HAVE_RUST
     DNSState *dns_state = (DNSState *)FlowGetAppState(f);
@@ -210,13 +270,24 @@ static void AlertJsonDns(const Flow *f, json_t *js)
             if (ajs != NULL) {
                 json_object_set_new(dnsjs, "answer", ajs);
             }
-            json_object_set_new(js, "dns", dnsjs);
+            JsonBuilderSetJson(jb, "dns", dnsjs);
+            json_decref(dnsjs);
         }
     }
 #endif
     return;
 }
 
+/** \brief set a jansson object built by an app-layer logger and
+ *         release it */
+static void AlertJsonSetNew(JsonBuilder *jb, const char *key, json_t *js)
+{
+    if (js != NULL) {
+        JsonBuilderSetJson(jb, key, js);
+        json_decref(js);
+    }
+}
+
 static void AlertJsonSourceTarget(const Packet *p, const PacketAlert *pa,
                                   json_t *js, json_t* ajs)
 {
@@ -296,10 +367,8 @@ static void AlertJsonMetadata(AlertJsonOutputCtx *json_output_ctx, const PacketA
 }
 
 
-void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *js,
-                     uint16_t flags)
+static const char *AlertJsonAction(const Packet *p, const PacketAlert *pa)
 {
-    AlertJsonOutputCtx *json_output_ctx = (AlertJsonOutputCtx *)ctx;
     const char *action = "allowed";
     /* use packet action if rate_filter modified the action */
     if (unlikely(pa->flags & PACKET_ALERT_RATE_FILTER_MODIFIED)) {
@@ -314,6 +383,14 @@ void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *
             action = "blocked";
         }
     }
+    return action;
+}
+
+void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *js,
+                     uint16_t flags)
+{
+    AlertJsonOutputCtx *json_output_ctx = (AlertJsonOutputCtx *)ctx;
+    const char *action = AlertJsonAction(p, pa);
 
     /* Add tx_id to root element for correlation with other events. */
     json_object_del(js, "tx_id");
@@ -350,53 +427,158 @@ void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *
     json_object_set_new(js, "alert", ajs);
 }
 
-static void AlertJsonTunnel(const Packet *p, json_t *js)
+static void AlertJsonBuilderSourceTarget(const Packet *p, const PacketAlert *pa,
+        const JsonAddrInfo *addr, JsonBuilder *jb)
+{
+    const char *sip = NULL, *tip = NULL;
+    Port sport = 0, tport = 0;
+
+    if (pa->s->flags & SIG_FLAG_DEST_IS_TARGET) {
+        sip = addr->src_ip;
+        tip = addr->dst_ip;
+        sport = addr->sp;
+        tport = addr->dp;
+    } else if (pa->s->flags & SIG_FLAG_SRC_IS_TARGET) {
+        sip = addr->dst_ip;
+        tip = addr->src_ip;
+        sport = addr->dp;
+        tport = addr->sp;
+    }
+
+    bool ports = false;
+    switch (p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            ports = (sip != NULL);
+            break;
+    }
+
+    JsonBuilderOpenObject(jb, "source");
+    JsonBuilderSetString(jb, "ip", sip);
+    if (ports)
+        JsonBuilderSetInt(jb, "port", sport);
+    JsonBuilderClose(jb);
+
+    JsonBuilderOpenObject(jb, "target");
+    JsonBuilderSetString(jb, "ip", tip);
+    if (ports)
+        JsonBuilderSetInt(jb, "port", tport);
+    JsonBuilderClose(jb);
+}
+
+/**
+ * \brief add the rule metadata, grouping the values per key in the order
+ *        the keys first appear in the rule
+ */
+static void AlertJsonBuilderMetadata(const PacketAlert *pa, JsonBuilder *jb)
 {
-    json_t *tunnel = json_object();
-    if (tunnel == NULL)
+    const DetectMetadata *kv = pa->s->metadata;
+    if (kv == NULL)
         return;
 
+    JsonBuilderOpenObject(jb, "metadata");
+    for ( ; kv != NULL; kv = kv->next) {
+        /* skip keys that were logged with an earlier entry */
+        const DetectMetadata *prev = pa->s->metadata;
+        while (prev != kv && strcmp(prev->key, kv->key) != 0)
+            prev = prev->next;
+        if (prev != kv)
+            continue;
+
+        JsonBuilderOpenArray(jb, kv->key);
+        for (const DetectMetadata *v = kv; v != NULL; v = v->next) {
+            if (v == kv || strcmp(v->key, kv->key) == 0)
+                JsonBuilderSetString(jb, NULL, v->value);
+        }
+        JsonBuilderClose(jb);
+    }
+    JsonBuilderClose(jb);
+}
+
+/**
+ * \brief write tx_id and the alert object, same members as
+ *        AlertJsonHeader()
+ */
+static void AlertJsonBuilderHeader(const Packet *p, const PacketAlert *pa,
+        const JsonAddrInfo *addr, JsonBuilder *jb, uint16_t flags)
+{
+    /* Add tx_id to root element for correlation with other events. */
+    if (pa->flags & PACKET_ALERT_FLAG_TX)
+        JsonBuilderSetInt(jb, "tx_id", pa->tx_id);
+
+    JsonBuilderOpenObject(jb, "alert");
+    JsonBuilderSetString(jb, "action", AlertJsonAction(p, pa));
+    JsonBuilderSetInt(jb, "gid", pa->s->gid);
+    JsonBuilderSetInt(jb, "signature_id", pa->s->id);
+    JsonBuilderSetInt(jb, "rev", pa->s->rev);
+    JsonBuilderSetString(jb, "signature",
+            (pa->s->msg) ? pa->s->msg : "");
+    JsonBuilderSetString(jb, "category",
+            (pa->s->class_msg) ? pa->s->class_msg : "");
+    JsonBuilderSetInt(jb, "severity", pa->s->prio);
+
+    if (p->tenant_id > 0)
+        JsonBuilderSetInt(jb, "tenant_id", p->tenant_id);
+
+    if (pa->s->flags & SIG_FLAG_HAS_TARGET) {
+        AlertJsonBuilderSourceTarget(p, pa, addr, jb);
+    }
+
+    if (flags & LOG_JSON_RULE_METADATA) {
+        AlertJsonBuilderMetadata(pa, jb);
+    }
+
+    /* signature text */
+    if (flags & LOG_JSON_RULE) {
+        JsonBuilderSetString(jb, "rule", pa->s->sig_str);
+    }
+
+    JsonBuilderClose(jb);
+}
+
+static void AlertJsonTunnel(const Packet *p, JsonBuilder *jb)
+{
     if (p->root == NULL) {
-        json_decref(tunnel);
         return;
     }
 
+    JsonAddrInfo addr;
+
     /* get a lock to access root packet fields */
     SCMutex *m = &p->root->tunnel_mutex;
 
     SCMutexLock(m);
-    JsonFiveTuple((const Packet *)p->root, 0, tunnel);
+    JsonAddrInfoInit((const Packet *)p->root, LOG_DIR_PACKET, &addr);
     SCMutexUnlock(m);
 
-    json_object_set_new(tunnel, "depth", json_integer(p->recursion_level));
-
-    json_object_set_new(js, "tunnel", tunnel);
+    JsonBuilderOpenObject(jb, "tunnel");
+    JsonFiveTuple((const Packet *)p->root, &addr, jb);
+    JsonBuilderSetInt(jb, "depth", p->recursion_level);
+    JsonBuilderClose(jb);
 }
 
-static void AlertJsonPacket(const Packet *p, json_t *js)
+static void AlertJsonPacket(const Packet *p, JsonBuilder *jb)
 {
     unsigned long len = GET_PKT_LEN(p) * 2;
     uint8_t encoded_packet[len];
     Base64Encode((unsigned char*) GET_PKT_DATA(p), GET_PKT_LEN(p),
         encoded_packet, &len);
-    json_object_set_new(js, "packet", json_string((char *)encoded_packet));
+    JsonBuilderSetString(jb, "packet", (char *)encoded_packet);
 
     /* Create packet info. */
-    json_t *packetinfo_js = json_object();
-    if (unlikely(packetinfo_js == NULL)) {
-        return;
-    }
-    json_object_set_new(packetinfo_js, "linktype", json_integer(p->datalink));
-    json_object_set_new(js, "packet_info", packetinfo_js);
+    JsonBuilderOpenObject(jb, "packet_info");
+    JsonBuilderSetInt(jb, "linktype", p->datalink);
+    JsonBuilderClose(jb);
 }
 
-static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, json_t *js, const Packet *p)
+static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, JsonBuilder *jb, const Packet *p)
 {
     if (json_output_ctx->flags & LOG_JSON_PAYLOAD_BASE64) {
         unsigned long len = p->payload_len * 2 + 1;
         uint8_t encoded[len];
         if (Base64Encode(p->payload, p->payload_len, encoded, &len) == SC_BASE64_OK) {
-            json_object_set_new(js, "payload", json_string((char *)encoded));
+            JsonBuilderSetString(jb, "payload", (char *)encoded);
         }
     }
 
@@ -407,8 +589,194 @@ static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, json_t *js, con
                 p->payload_len + 1,
                 p->payload, p->payload_len);
         printable_buf[p->payload_len] = '\0';
-        json_object_set_new(js, "payload_printable", json_string((char *)printable_buf));
+        JsonBuilderSetString(jb, "payload_printable", (char *)printable_buf);
+    }
+}
+
+/**
+ * \brief get the ip of the X-Forwarded-For header for an alert
+ *
+ * \retval 1 if buffer was set, 0 otherwise
+ */
+static int AlertJsonGetXff(const Packet *p, const PacketAlert *pa,
+        HttpXFFCfg *xff_cfg, char *buffer)
+{
+    if ((xff_cfg == NULL) || (xff_cfg->flags & XFF_DISABLED) || p->flow == NULL)
+        return 0;
+
+    if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
+        if (pa->flags & PACKET_ALERT_FLAG_TX) {
+            return HttpXFFGetIPFromTx(p->flow, pa->tx_id, xff_cfg, buffer, XFF_MAXLEN);
+        } else {
+            return HttpXFFGetIP(p->flow, xff_cfg, buffer, XFF_MAXLEN);
+        }
+    }
+    return 0;
+}
+
+static uint32_t AlertAggregateHash(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const AlertAggregateKey *key = data;
+    return hashword((const uint32_t *)key, sizeof(*key) / sizeof(uint32_t), 0) %
+        ht->array_size;
+}
+
+static char AlertAggregateCompare(void *data1, uint16_t len1, void *data2,
+        uint16_t len2)
+{
+    return memcmp(data1, data2, sizeof(AlertAggregateKey)) == 0;
+}
+
+static void AlertAggregateFree(void *data)
+{
+    SCFree(data);
+}
+
+static void AlertAggregateKeyInit(AlertAggregateKey *key, const Packet *p,
+        const PacketAlert *pa, const JsonAddrInfo *addr)
+{
+    /* zero the padding after the strings, it's hashed and compared */
+    memset(key, 0, sizeof(*key));
+    strlcpy(key->src_ip, addr->src_ip, sizeof(key->src_ip));
+    strlcpy(key->dst_ip, addr->dst_ip, sizeof(key->dst_ip));
+    key->gid = pa->s->gid;
+    key->sid = pa->s->id;
+    key->dp_proto = (uint32_t)p->dp << 16 | (uint32_t)p->proto << 8 |
+        (uint8_t)p->src.family;
+}
+
+/**
+ * \brief write the summary of the alerts that weren't logged
+ */
+static void AlertAggregateLogSummary(JsonAlertLogThread *aft,
+        const AlertAggregateEntry *e)
+{
+    char timebuf[64];
+    JsonBuilder jb;
+
+    OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
+
+    CreateIsoTimeString(&e->last_ts, timebuf, sizeof(timebuf));
+    JsonBuilderSetString(&jb, "timestamp", timebuf);
+    JsonBuilderSetString(&jb, "event_type", "alert_summary");
+
+    JsonBuilderSetString(&jb, "src_ip", e->addr.src_ip);
+    JsonBuilderSetString(&jb, "dest_ip", e->addr.dst_ip);
+    switch ((e->key.dp_proto >> 8) & 0xff) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetInt(&jb, "dest_port", e->addr.dp);
+            break;
+    }
+    JsonBuilderSetString(&jb, "proto", e->addr.proto);
+
+    JsonBuilderOpenObject(&jb, "alert");
+    JsonBuilderSetInt(&jb, "gid", e->key.gid);
+    JsonBuilderSetInt(&jb, "signature_id", e->key.sid);
+    JsonBuilderSetInt(&jb, "rev", e->rev);
+    JsonBuilderSetInt(&jb, "severity", e->prio);
+    JsonBuilderClose(&jb);
+
+    JsonBuilderOpenObject(&jb, "aggregate");
+    JsonBuilderSetInt(&jb, "count", e->count);
+    CreateIsoTimeString(&e->first_ts, timebuf, sizeof(timebuf));
+    JsonBuilderSetString(&jb, "first_timestamp", timebuf);
+    CreateIsoTimeString(&e->last_ts, timebuf, sizeof(timebuf));
+    JsonBuilderSetString(&jb, "last_timestamp", timebuf);
+    JsonBuilderClose(&jb);
+
+    OutputJsonBuilderBuffer(&jb, aft->file_ctx, &aft->json_buffer);
+}
+
+/**
+ * \brief end the windows that are over
+ *
+ * Alerts counted in the window are summarized and a new window is started.
+ * Entries without alerts in their window are removed, so the next alert
+ * for them is logged in full again.
+ *
+ * \param flush end all windows, at shutdown
+ */
+static void AlertAggregateSweep(ThreadVars *tv, JsonAlertLogThread *aft,
+        time_t now, bool flush)
+{
+    const AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
+    time_t next = 0;
+
+    HashListTableBucket *hb = HashListTableGetListHead(aft->aggregate);
+    while (hb != NULL) {
+        HashListTableBucket *hb_next = HashListTableGetListNext(hb);
+        AlertAggregateEntry *e = HashListTableGetListData(hb);
+
+        if (flush || now >= e->window_end) {
+            if (e->count == 0) {
+                HashListTableRemove(aft->aggregate, e, sizeof(e->key));
+                aft->aggregate_cnt--;
+                hb = hb_next;
+                continue;
+            }
+            AlertAggregateLogSummary(aft, e);
+            if (tv != NULL)
+                StatsIncr(tv, aft->counter_aggregate_summaries);
+            e->count = 0;
+            e->window_end = now + json_output_ctx->aggregate_window;
+        }
+        if (next == 0 || e->window_end < next)
+            next = e->window_end;
+        hb = hb_next;
+    }
+
+    alert_aggregate_next[json_output_ctx->aggregate_slot] = next;
+}
+
+/**
+ * \brief account an alert in the aggregation table
+ *
+ * \retval true log the alert in full
+ * \retval false alert is counted for the summary
+ */
+static bool AlertAggregate(ThreadVars *tv, JsonAlertLogThread *aft,
+        const Packet *p, const PacketAlert *pa, const JsonAddrInfo *addr)
+{
+    const AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
+    AlertAggregateKey key;
+
+    AlertAggregateKeyInit(&key, p, pa, addr);
+    AlertAggregateEntry *e = HashListTableLookup(aft->aggregate, &key,
+            sizeof(key));
+    if (e != NULL) {
+        if (e->count == 0)
+            e->first_ts = p->ts;
+        e->last_ts = p->ts;
+        e->count++;
+        StatsIncr(tv, aft->counter_aggregate_suppressed);
+        return false;
     }
+
+    /* out of memory: log the alert instead of dropping it */
+    if (aft->aggregate_cnt >= json_output_ctx->aggregate_max) {
+        StatsIncr(tv, aft->counter_aggregate_memcap);
+        return true;
+    }
+    e = SCCalloc(1, sizeof(*e));
+    if (unlikely(e == NULL))
+        return true;
+    e->key = key;
+    e->rev = pa->s->rev;
+    e->prio = pa->s->prio;
+    e->addr = *addr;
+    e->window_end = p->ts.tv_sec + json_output_ctx->aggregate_window;
+    if (HashListTableAdd(aft->aggregate, e, sizeof(key)) != 0) {
+        SCFree(e);
+        return true;
+    }
+    aft->aggregate_cnt++;
+
+    time_t *next = &alert_aggregate_next[json_output_ctx->aggregate_slot];
+    if (*next == 0 || e->window_end < *next)
+        *next = e->window_end;
+    return true;
 }
 
 static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
@@ -416,19 +784,18 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
     MemBuffer *payload = aft->payload_buffer;
     AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
     json_t *hjs = NULL;
+    JsonBuilder jb;
 
     int i;
 
     if (p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG))
         return TM_ECODE_OK;
 
-    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "alert");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    JsonAddrInfo addr;
+    JsonAddrInfoInit(p, LOG_DIR_PACKET, &addr);
 
-    if (json_output_ctx->include_metadata) {
-        JsonAddMetadata(p, p->flow, js);
-    }
+    HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg != NULL ?
+        json_output_ctx->xff_cfg : json_output_ctx->parent_xff_cfg;
 
     for (i = 0; i < p->alerts.cnt; i++) {
         const PacketAlert *pa = &p->alerts.alerts[i];
@@ -436,13 +803,39 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
             continue;
         }
 
-        MemBufferReset(aft->json_buffer);
+        /* xff header */
+        char xff_buffer[XFF_MAXLEN];
+        int have_xff_ip = AlertJsonGetXff(p, pa, xff_cfg, xff_buffer);
+        JsonAddrInfo xff_addr;
+        const JsonAddrInfo *log_addr = &addr;
+        if (have_xff_ip && !(xff_cfg->flags & XFF_EXTRADATA) &&
+                (xff_cfg->flags & XFF_OVERWRITE)) {
+            xff_addr = addr;
+            if (p->flowflags & FLOW_PKT_TOCLIENT) {
+                strlcpy(xff_addr.dst_ip, xff_buffer, sizeof(xff_addr.dst_ip));
+            } else {
+                strlcpy(xff_addr.src_ip, xff_buffer, sizeof(xff_addr.src_ip));
+            }
+            log_addr = &xff_addr;
+        }
+
+        if (aft->aggregate != NULL &&
+                !(AlertAggregate(tv, aft, p, pa, log_addr))) {
+            continue;
+        }
+
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
+        OutputJsonBuilderHeader(&jb, p, LOG_DIR_PACKET, "alert", log_addr);
+
+        if (json_output_ctx->include_metadata) {
+            OutputJsonBuilderMetadata(&jb, p, p->flow);
+        }
 
         /* alert */
-        AlertJsonHeader(json_output_ctx, p, pa, js, json_output_ctx->flags);
+        AlertJsonBuilderHeader(p, pa, &addr, &jb, json_output_ctx->flags);
 
         if (IS_TUNNEL_PKT(p)) {
-            AlertJsonTunnel(p, js);
+            AlertJsonTunnel(p, &jb);
         }
 
         if (json_output_ctx->flags & LOG_JSON_APP_LAYER && p->flow != NULL) {
@@ -458,73 +851,60 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     if (json_output_ctx->flags & LOG_JSON_HTTP_BODY_BASE64) {
                         JsonHttpLogJSONBodyBase64(hjs, p->flow, pa->tx_id);
                     }
-                    json_object_set_new(js, "http", hjs);
+                    AlertJsonSetNew(&jb, "http", hjs);
                 }
             }
 
             /* tls alert */
             if (proto == ALPROTO_TLS) {
-                AlertJsonTls(p->flow, js);
+                AlertJsonTls(p->flow, &jb);
             }
 
             /* ssh alert */
             if (proto == ALPROTO_SSH) {
-                AlertJsonSsh(p->flow, js);
+                AlertJsonSsh(p->flow, &jb);
             }
 
             /* smtp alert */
             if (proto == ALPROTO_SMTP) {
-                hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
-                if (hjs) {
-                    json_object_set_new(js, "smtp", hjs);
-                }
-
-                hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
-                if (hjs) {
-                    json_object_set_new(js, "email", hjs);
-                }
+                AlertJsonSetNew(&jb, "smtp",
+                        JsonSMTPAddMetadata(p->flow, pa->tx_id));
+                AlertJsonSetNew(&jb, "email",
+                        JsonEmailAddMetadata(p->flow, pa->tx_id));
             }
 
 #ifdef HAVE_RUST
             if (proto == ALPROTO_NFS) {
-                hjs = JsonNFSAddMetadataRPC(p->flow, pa->tx_id);
-                if (hjs)
-                    json_object_set_new(js, "rpc", hjs);
-                hjs = JsonNFSAddMetadata(p->flow, pa->tx_id);
-                if (hjs)
-                    json_object_set_new(js, "nfs", hjs);
+                AlertJsonSetNew(&jb, "rpc",
+                        JsonNFSAddMetadataRPC(p->flow, pa->tx_id));
+                AlertJsonSetNew(&jb, "nfs",
+                        JsonNFSAddMetadata(p->flow, pa->tx_id));
             } else if (proto == ALPROTO_SMB) {
-                hjs = JsonSMBAddMetadata(p->flow, pa->tx_id);
-                if (hjs)
-                    json_object_set_new(js, "smb", hjs);
+                AlertJsonSetNew(&jb, "smb",
+                        JsonSMBAddMetadata(p->flow, pa->tx_id));
             }
 #endif
             if (proto == ALPROTO_FTPDATA) {
-                hjs = JsonFTPDataAddMetadata(p->flow);
-                if (hjs)
-                    json_object_set_new(js, "ftp-data", hjs);
+                AlertJsonSetNew(&jb, "ftp-data",
+                        JsonFTPDataAddMetadata(p->flow));
             }
 
             /* dnp3 alert */
             if (proto == ALPROTO_DNP3) {
-                AlertJsonDnp3(p->flow, js);
+                AlertJsonDnp3(p->flow, &jb);
             }
 
             if (proto == ALPROTO_DNS) {
-                AlertJsonDns(p->flow, js);
+                AlertJsonDns(p->flow, &jb);
             }
         }
 
         if (p->flow) {
             if (json_output_ctx->flags & LOG_JSON_FLOW) {
-                hjs = json_object();
-                if (hjs != NULL) {
-                    JsonAddFlow(p->flow, js, hjs);
-                    json_object_set_new(js, "flow", hjs);
-                }
+                JsonAddFlow(p->flow, &jb);
             } else {
-                json_object_set_new(js, "app_proto",
-                        json_string(AppProtoToString(p->flow->alproto)));
+                JsonBuilderSetString(&jb, "app_proto",
+                        AppProtoToString(p->flow->alproto));
             }
         }
 
@@ -554,7 +934,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                         unsigned long len = json_output_ctx->payload_buffer_size * 2;
                         uint8_t encoded[len];
                         Base64Encode(payload->buffer, payload->offset, encoded, &len);
-                        json_object_set_new(js, "payload", json_string((char *)encoded));
+                        JsonBuilderSetString(&jb, "payload", (char *)encoded);
                     }
 
                     if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -563,78 +943,39 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                         PrintStringsToBuffer(printable_buf, &offset,
                                 sizeof(printable_buf),
                                 payload->buffer, payload->offset);
-                        json_object_set_new(js, "payload_printable",
-                                json_string((char *)printable_buf));
+                        JsonBuilderSetString(&jb, "payload_printable",
+                                (char *)printable_buf);
                     }
                 } else if (p->payload_len) {
                     /* Fallback on packet payload */
-                    AlertAddPayload(json_output_ctx, js, p);
+                    AlertAddPayload(json_output_ctx, &jb, p);
                 }
             } else {
                 /* This is a single packet and not a stream */
-                AlertAddPayload(json_output_ctx, js, p);
+                AlertAddPayload(json_output_ctx, &jb, p);
             }
 
-            json_object_set_new(js, "stream", json_integer(stream));
+            JsonBuilderSetInt(&jb, "stream", stream);
         }
 
         /* base64-encoded full packet */
         if (json_output_ctx->flags & LOG_JSON_PACKET) {
-            AlertJsonPacket(p, js);
-        }
-
-        /* signature text */
-        if (json_output_ctx->flags & LOG_JSON_RULE) {
-            hjs = json_object_get(js, "alert");
-            if (json_is_object(hjs))
-                json_object_set_new(hjs, "rule", json_string(pa->s->sig_str));
+            AlertJsonPacket(p, &jb);
         }
 
-        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg != NULL ?
-            json_output_ctx->xff_cfg : json_output_ctx->parent_xff_cfg;;
-
-        /* xff header */
-        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
-            int have_xff_ip = 0;
-            char buffer[XFF_MAXLEN];
-
-            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
-                if (pa->flags & PACKET_ALERT_FLAG_TX) {
-                    have_xff_ip = HttpXFFGetIPFromTx(p->flow, pa->tx_id, xff_cfg, buffer, XFF_MAXLEN);
-                } else {
-                    have_xff_ip = HttpXFFGetIP(p->flow, xff_cfg, buffer, XFF_MAXLEN);
-                }
-            }
-
-            if (have_xff_ip) {
-                if (xff_cfg->flags & XFF_EXTRADATA) {
-                    json_object_set_new(js, "xff", json_string(buffer));
-                }
-                else if (xff_cfg->flags & XFF_OVERWRITE) {
-                    if (p->flowflags & FLOW_PKT_TOCLIENT) {
-                        json_object_set(js, "dest_ip", json_string(buffer));
-                    } else {
-                        json_object_set(js, "src_ip", json_string(buffer));
-                    }
-                }
-            }
+        if (have_xff_ip && (xff_cfg->flags & XFF_EXTRADATA)) {
+            JsonBuilderSetString(&jb, "xff", xff_buffer);
         }
 
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_del(js, "alert");
+        OutputJsonBuilderBuffer(&jb, aft->file_ctx, &aft->json_buffer);
     }
-    json_object_clear(js);
-    json_decref(js);
 
     if ((p->flags & PKT_HAS_TAG) && (json_output_ctx->flags &
             LOG_JSON_TAGGED_PACKETS)) {
-        MemBufferReset(aft->json_buffer);
-        json_t *packetjs = CreateJSONHeader(p, LOG_DIR_PACKET, "packet");
-        if (unlikely(packetjs != NULL)) {
-            AlertJsonPacket(p, packetjs);
-            OutputJSONBuffer(packetjs, aft->file_ctx, &aft->json_buffer);
-            json_decref(packetjs);
-        }
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
+        OutputJsonBuilderHeader(&jb, p, LOG_DIR_PACKET, "packet", &addr);
+        AlertJsonPacket(p, &jb);
+        OutputJsonBuilderBuffer(&jb, aft->file_ctx, &aft->json_buffer);
     }
 
     return TM_ECODE_OK;
@@ -644,7 +985,7 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
 {
     int i;
     char timebuf[64];
-    json_t *js;
+    JsonBuilder jb;
 
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
@@ -652,8 +993,6 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
     CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
 
     for (i = 0; i < p->alerts.cnt; i++) {
-        MemBufferReset(aft->json_buffer);
-
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
@@ -666,47 +1005,28 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
             action = "blocked";
         }
 
-        char buf[(32 * 3) + 1];
-        PrintRawLineHexBuf(buf, sizeof(buf), GET_PKT_DATA(p), GET_PKT_LEN(p) < 32 ? GET_PKT_LEN(p) : 32);
-
-        js = json_object();
-        if (js == NULL)
-            return TM_ECODE_OK;
-
-        json_t *ajs = json_object();
-        if (ajs == NULL) {
-            json_decref(js);
-            return TM_ECODE_OK;
-        }
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
 
         /* time & tx */
-        json_object_set_new(js, "timestamp", json_string(timebuf));
-
-        /* tuple */
-        //json_object_set_new(js, "srcip", json_string(srcip));
-        //json_object_set_new(js, "sp", json_integer(p->sp));
-        //json_object_set_new(js, "dstip", json_string(dstip));
-        //json_object_set_new(js, "dp", json_integer(p->dp));
-        //json_object_set_new(js, "proto", json_integer(proto));
-
-        json_object_set_new(ajs, "action", json_string(action));
-        json_object_set_new(ajs, "gid", json_integer(pa->s->gid));
-        json_object_set_new(ajs, "signature_id", json_integer(pa->s->id));
-        json_object_set_new(ajs, "rev", json_integer(pa->s->rev));
-        json_object_set_new(ajs, "signature",
-                            json_string((pa->s->msg) ? pa->s->msg : ""));
-        json_object_set_new(ajs, "category",
-                            json_string((pa->s->class_msg) ? pa->s->class_msg : ""));
-        json_object_set_new(ajs, "severity", json_integer(pa->s->prio));
+        JsonBuilderSetString(&jb, "timestamp", timebuf);
+
+        JsonBuilderOpenObject(&jb, "alert");
+        JsonBuilderSetString(&jb, "action", action);
+        JsonBuilderSetInt(&jb, "gid", pa->s->gid);
+        JsonBuilderSetInt(&jb, "signature_id", pa->s->id);
+        JsonBuilderSetInt(&jb, "rev", pa->s->rev);
+        JsonBuilderSetString(&jb, "signature",
+                (pa->s->msg) ? pa->s->msg : "");
+        JsonBuilderSetString(&jb, "category",
+                (pa->s->class_msg) ? pa->s->class_msg : "");
+        JsonBuilderSetInt(&jb, "severity", pa->s->prio);
 
         if (p->tenant_id > 0)
-            json_object_set_new(ajs, "tenant_id", json_integer(p->tenant_id));
+            JsonBuilderSetInt(&jb, "tenant_id", p->tenant_id);
 
         /* alert */
-        json_object_set_new(js, "alert", ajs);
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_clear(js);
-        json_decref(js);
+        JsonBuilderClose(&jb);
+        OutputJsonBuilderBuffer(&jb, aft->file_ctx, &aft->json_buffer);
     }
 
     return TM_ECODE_OK;
@@ -716,6 +1036,13 @@ static int JsonAlertLogger(ThreadVars *tv, void *thread_data, const Packet *p)
 {
     JsonAlertLogThread *aft = thread_data;
 
+    if (aft->aggregate != NULL) {
+        const time_t next =
+            alert_aggregate_next[aft->json_output_ctx->aggregate_slot];
+        if (next != 0 && p->ts.tv_sec >= next)
+            AlertAggregateSweep(tv, aft, p->ts.tv_sec, false);
+    }
+
     if (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)) {
         return AlertJson(tv, aft, p);
     } else if (p->alerts.cnt > 0) {
@@ -729,6 +1056,15 @@ static int JsonAlertLogCondition(ThreadVars *tv, const Packet *p)
     if (p->alerts.cnt || (p->flags & PKT_HAS_TAG)) {
         return TRUE;
     }
+
+    /* summaries of aggregated alerts are due */
+    int i;
+    for (i = 0; i < alert_aggregate_instances; i++) {
+        if (alert_aggregate_next[i] != 0 &&
+                p->ts.tv_sec >= alert_aggregate_next[i]) {
+            return TRUE;
+        }
+    }
     return FALSE;
 }
 
@@ -764,6 +1100,25 @@ static TmEcode JsonAlertLogThreadInit(ThreadVars *t, const void *initdata, void
         return TM_ECODE_FAILED;
     }
 
+    if (json_output_ctx->aggregate_window > 0) {
+        aft->aggregate = HashListTableInit(ALERT_AGGREGATE_HASH_SIZE,
+                AlertAggregateHash, AlertAggregateCompare, AlertAggregateFree);
+        if (aft->aggregate == NULL) {
+            MemBufferFree(aft->json_buffer);
+            MemBufferFree(aft->payload_buffer);
+            SCFree(aft);
+            return TM_ECODE_FAILED;
+        }
+        alert_aggregate_next[json_output_ctx->aggregate_slot] = 0;
+
+        aft->counter_aggregate_suppressed =
+            StatsRegisterCounter("alert_aggregate.suppressed", t);
+        aft->counter_aggregate_summaries =
+            StatsRegisterCounter("alert_aggregate.summaries", t);
+        aft->counter_aggregate_memcap =
+            StatsRegisterCounter("alert_aggregate.memcap", t);
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -775,6 +1130,15 @@ static TmEcode JsonAlertLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    if (aft->aggregate != NULL) {
+        /* write out what is left */
+        struct timeval ts;
+        TimeGet(&ts);
+        AlertAggregateSweep(NULL, aft, ts.tv_sec, true);
+        HashListTableFree(aft->aggregate);
+        alert_aggregate_next[aft->json_output_ctx->aggregate_slot] = 0;
+    }
+
     MemBufferFree(aft->json_buffer);
     MemBufferFree(aft->payload_buffer);
 
@@ -901,6 +1265,59 @@ static void JsonAlertLogSetupMetadata(AlertJsonOutputCtx *json_output_ctx,
     json_output_ctx->flags |= flags;
 }
 
+static void JsonAlertLogSetupAggregate(AlertJsonOutputCtx *json_output_ctx,
+        ConfNode *conf)
+{
+    ConfNode *aggregate = conf ? ConfNodeLookupChild(conf, "aggregate") : NULL;
+    if (aggregate == NULL || !ConfNodeChildValueIsTrue(aggregate, "enabled"))
+        return;
+
+    if (alert_aggregate_instances == ALERT_AGGREGATE_MAX_INSTANCES) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "alert aggregation is supported "
+                "for at most %d alert loggers, disabled for this one",
+                ALERT_AGGREGATE_MAX_INSTANCES);
+        return;
+    }
+
+    uint64_t window = ALERT_AGGREGATE_DEFAULT_WINDOW;
+    const char *window_value = ConfNodeLookupChildValue(aggregate, "window");
+    if (window_value != NULL) {
+        window = SCParseTimeSizeString(window_value);
+        if (window == 0 || window > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Error parsing "
+                       "aggregate.window - %s. Killing engine",
+                       window_value);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t memcap = ALERT_AGGREGATE_DEFAULT_MEMCAP;
+    const char *memcap_value = ConfNodeLookupChildValue(aggregate, "memcap");
+    if (memcap_value != NULL) {
+        if (ParseSizeStringU64(memcap_value, &memcap) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Error parsing "
+                       "aggregate.memcap - %s. Killing engine",
+                       memcap_value);
+            exit(EXIT_FAILURE);
+        }
+    }
+    const uint64_t max = memcap /
+        (sizeof(AlertAggregateEntry) + sizeof(HashListTableBucket));
+    if (max == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "aggregate.memcap %s is too "
+                   "small. Killing engine", memcap_value);
+        exit(EXIT_FAILURE);
+    }
+
+    json_output_ctx->aggregate_window = (uint32_t)window;
+    json_output_ctx->aggregate_max = (uint32_t)MIN(max, UINT32_MAX);
+    json_output_ctx->aggregate_slot = alert_aggregate_instances++;
+
+    SCLogConfig("alert aggregation enabled: window %"PRIu64"s, "
+                "max %"PRIu32" alerts per thread", window,
+                json_output_ctx->aggregate_max);
+}
+
 static HttpXFFCfg *JsonAlertLogGetXffCfg(ConfNode *conf)
 {
     HttpXFFCfg *xff_cfg = NULL;
@@ -950,6 +1367,7 @@ static OutputInitResult JsonAlertLogInitCtx(ConfNode *conf)
     json_output_ctx->file_ctx = logfile_ctx;
 
     JsonAlertLogSetupMetadata(json_output_ctx, conf);
+    JsonAlertLogSetupAggregate(json_output_ctx, conf);
     json_output_ctx->xff_cfg = JsonAlertLogGetXffCfg(conf);
 
     output_ctx->data = json_output_ctx;
@@ -985,6 +1403,7 @@ static OutputInitResult JsonAlertLogInitCtxSub(ConfNode *conf, OutputCtx *parent
     json_output_ctx->include_metadata = ajt->include_metadata;
 
     JsonAlertLogSetupMetadata(json_output_ctx, conf);
+    JsonAlertLogSetupAggregate(json_output_ctx, conf);
     json_output_ctx->xff_cfg = JsonAlertLogGetXffCfg(conf);
     if (json_output_ctx->xff_cfg == NULL) {
         json_output_ctx->parent_xff_cfg = ajt->xff_cfg;
@@ -1019,11 +1438,250 @@ void JsonAlertLogRegister (void)
         NULL);
 }
 
+#ifdef UNITTESTS
+static int alert_aggregate_test_records = 0;
+static char alert_aggregate_test_last[1024];
+
+static int AlertAggregateTestWrite(const char *buffer, int buffer_len,
+        LogFileCtx *file_ctx)
+{
+    alert_aggregate_test_records++;
+    strlcpy(alert_aggregate_test_last, buffer,
+            MIN((size_t)buffer_len + 1, sizeof(alert_aggregate_test_last)));
+    return 0;
+}
+
+/** \internal set up a logger thread with aggregation, capturing its
+ *  records */
+static JsonAlertLogThread *AlertAggregateTestSetup(ThreadVars *tv,
+        OutputCtx *output_ctx, AlertJsonOutputCtx *json_output_ctx,
+        uint32_t max)
+{
+    void *data = NULL;
+
+    memset(tv, 0, sizeof(*tv));
+    memset(output_ctx, 0, sizeof(*output_ctx));
+    memset(json_output_ctx, 0, sizeof(*json_output_ctx));
+
+    json_output_ctx->file_ctx = LogFileNewCtx();
+    if (json_output_ctx->file_ctx == NULL)
+        return NULL;
+    json_output_ctx->file_ctx->type = LOGFILE_TYPE_FILE;
+    json_output_ctx->file_ctx->json_flags = JSON_PRESERVE_ORDER|JSON_COMPACT|
+        JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH;
+    json_output_ctx->file_ctx->Write = AlertAggregateTestWrite;
+    json_output_ctx->payload_buffer_size = JSON_STREAM_BUFFER_SIZE;
+    json_output_ctx->aggregate_window = 60;
+    json_output_ctx->aggregate_max = max;
+    output_ctx->data = json_output_ctx;
+
+    if (JsonAlertLogThreadInit(tv, output_ctx, &data) != TM_ECODE_OK) {
+        LogFileFreeCtx(json_output_ctx->file_ctx);
+        return NULL;
+    }
+    alert_aggregate_test_records = 0;
+    alert_aggregate_test_last[0] = '\0';
+    return data;
+}
+
+static void AlertAggregateTestTeardown(ThreadVars *tv, JsonAlertLogThread *aft,
+        AlertJsonOutputCtx *json_output_ctx)
+{
+    JsonAlertLogThreadDeinit(tv, aft);
+    LogFileFreeCtx(json_output_ctx->file_ctx);
+    StatsThreadCleanup(tv);
+}
+
+/**
+ * \test alerts are aggregated by the logged addresses, so clients
+ *       behind the same proxy (xff overwrite) are kept apart
+ */
+static int JsonAlertAggregateTest01(void)
+{
+    uint8_t payload[] = "GET / HTTP/1.0\r\n\r\n";
+    ThreadVars tv;
+    OutputCtx output_ctx;
+    AlertJsonOutputCtx json_output_ctx;
+    Signature s;
+    PacketAlert pa;
+
+    memset(&s, 0, sizeof(s));
+    s.id = 1;
+    s.gid = 1;
+    s.rev = 1;
+    memset(&pa, 0, sizeof(pa));
+    pa.s = &s;
+
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p);
+    JsonAlertLogThread *aft = AlertAggregateTestSetup(&tv, &output_ctx,
+            &json_output_ctx, 16);
+    FAIL_IF_NULL(aft);
+
+    JsonAddrInfo addr;
+    JsonAddrInfoInit(p, LOG_DIR_PACKET, &addr);
+    JsonAddrInfo xff_addr = addr;
+    strlcpy(xff_addr.src_ip, "172.16.0.1", sizeof(xff_addr.src_ip));
+
+    /* first alert is logged in full, the next ones are counted */
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p, &pa, &addr));
+    FAIL_IF(AlertAggregate(&tv, aft, p, &pa, &addr));
+    FAIL_IF(AlertAggregate(&tv, aft, p, &pa, &addr));
+
+    /* same packet addresses, other client behind the proxy */
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p, &pa, &xff_addr));
+    FAIL_IF(AlertAggregate(&tv, aft, p, &pa, &xff_addr));
+    FAIL_IF(aft->aggregate_cnt != 2);
+
+    /* other signature */
+    s.id = 2;
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p, &pa, &addr));
+    FAIL_IF(aft->aggregate_cnt != 3);
+
+    AlertAggregateTestTeardown(&tv, aft, &json_output_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+
+/**
+ * \test the summary is written once the window is over, and an entry
+ *       without alerts in its window is removed
+ */
+static int JsonAlertAggregateTest02(void)
+{
+    uint8_t payload[] = "GET / HTTP/1.0\r\n\r\n";
+    ThreadVars tv;
+    OutputCtx output_ctx;
+    AlertJsonOutputCtx json_output_ctx;
+    Signature s;
+
+    memset(&s, 0, sizeof(s));
+    s.id = 1;
+    s.gid = 1;
+    s.rev = 1;
+
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p);
+    JsonAlertLogThread *aft = AlertAggregateTestSetup(&tv, &output_ctx,
+            &json_output_ctx, 16);
+    FAIL_IF_NULL(aft);
+
+    p->alerts.cnt = 1;
+    p->alerts.alerts[0].s = &s;
+    p->alerts.alerts[0].action = ACTION_ALERT;
+
+    p->ts.tv_sec = 1000;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 1);
+    FAIL_IF_NULL(strstr(alert_aggregate_test_last, "\"event_type\":\"alert\""));
+
+    p->ts.tv_sec = 1010;
+    JsonAlertLogger(&tv, aft, p);
+    p->ts.tv_sec = 1020;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 1);
+
+    /* window is over: a packet without alerts writes the summary */
+    p->alerts.cnt = 0;
+    p->ts.tv_sec = 1059;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 1);
+    p->ts.tv_sec = 1060;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 2);
+    FAIL_IF_NULL(strstr(alert_aggregate_test_last,
+                "\"event_type\":\"alert_summary\""));
+    FAIL_IF_NULL(strstr(alert_aggregate_test_last, "\"count\":2"));
+    FAIL_IF(aft->aggregate_cnt != 1);
+
+    /* no alerts in the next window: entry is dropped without a summary */
+    p->ts.tv_sec = 1120;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 2);
+    FAIL_IF(aft->aggregate_cnt != 0);
+
+    /* so the next alert is logged in full again */
+    p->alerts.cnt = 1;
+    p->ts.tv_sec = 1130;
+    JsonAlertLogger(&tv, aft, p);
+    FAIL_IF(alert_aggregate_test_records != 3);
+    FAIL_IF_NULL(strstr(alert_aggregate_test_last, "\"event_type\":\"alert\""));
+
+    AlertAggregateTestTeardown(&tv, aft, &json_output_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+
+/**
+ * \test alerts that don't fit in the memcap are logged in full, the
+ *       tracked ones are still aggregated
+ */
+static int JsonAlertAggregateTest03(void)
+{
+    uint8_t payload[] = "GET / HTTP/1.0\r\n\r\n";
+    ThreadVars tv;
+    OutputCtx output_ctx;
+    AlertJsonOutputCtx json_output_ctx;
+    Signature s;
+    PacketAlert pa;
+
+    memset(&s, 0, sizeof(s));
+    s.id = 1;
+    s.gid = 1;
+    s.rev = 1;
+    memset(&pa, 0, sizeof(pa));
+    pa.s = &s;
+
+    Packet *p1 = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.6", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p2);
+    JsonAlertLogThread *aft = AlertAggregateTestSetup(&tv, &output_ctx,
+            &json_output_ctx, 1);
+    FAIL_IF_NULL(aft);
+
+    JsonAddrInfo addr1, addr2;
+    JsonAddrInfoInit(p1, LOG_DIR_PACKET, &addr1);
+    JsonAddrInfoInit(p2, LOG_DIR_PACKET, &addr2);
+
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p1, &pa, &addr1));
+    FAIL_IF(aft->aggregate_cnt != 1);
+
+    /* table is full */
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p2, &pa, &addr2));
+    FAIL_IF_NOT(AlertAggregate(&tv, aft, p2, &pa, &addr2));
+    FAIL_IF(aft->aggregate_cnt != 1);
+
+    FAIL_IF(AlertAggregate(&tv, aft, p1, &pa, &addr1));
+
+    AlertAggregateTestTeardown(&tv, aft, &json_output_ctx);
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void JsonAlertLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonAlertAggregateTest01", JsonAlertAggregateTest01);
+    UtRegisterTest("JsonAlertAggregateTest02", JsonAlertAggregateTest02);
+    UtRegisterTest("JsonAlertAggregateTest03", JsonAlertAggregateTest03);
+#endif
+}
+
 #else
 
 void JsonAlertLogRegister (void)
 {
 }
 
-#endif
+void JsonAlertLogRegisterTests(void)
+{
+}
 
+#endif
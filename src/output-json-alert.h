@@ -28,6 +28,7 @@
 #define __OUTPUT_JSON_ALERT_H__
 
 void JsonAlertLogRegister(void);
+void JsonAlertLogRegisterTests(void);
 #ifdef HAVE_LIBJANSSON
 void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *js,
                      uint16_t flags);
@@ -411,6 +411,19 @@ static int DNSRRTypeEnabled(uint16_t type, uint64_t flags)
 }
 #endif
 
+/**
+ * \brief start a dns record: common header and metadata
+ */
+static void JsonDnsLogStart(LogDnsLogThread *aft, JsonBuilder *jb,
+        const Packet *p, Flow *f)
+{
+    OutputJsonBuilderStart(jb, aft->dnslog_ctx->file_ctx, &aft->buffer);
+    OutputJsonBuilderHeader(jb, p, LOG_DIR_PACKET, "dns", NULL);
+    if (aft->dnslog_ctx->include_metadata) {
+        OutputJsonBuilderMetadata(jb, p, f);
+    }
+}
+
 #ifndef HAVE_RUST
 static json_t *OutputQuery(DNSTransaction *tx, uint64_t tx_id, DNSQueryEntry *entry)
 {
@@ -461,8 +474,8 @@ json_t *JsonDNSLogQuery(DNSTransaction *tx, uint64_t tx_id)
     return queryjs;
 }
 
-static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
-        uint64_t tx_id, DNSQueryEntry *entry)
+static void LogQuery(LogDnsLogThread *aft, const Packet *p, Flow *f,
+        DNSTransaction *tx, uint64_t tx_id, DNSQueryEntry *entry)
 {
     SCLogDebug("got a DNS request and now logging !!");
 
@@ -475,13 +488,11 @@ static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
         return;
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-
-    /* dns */
-    json_object_set_new(js, "dns", djs);
-    OutputJSONBuffer(js, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "dns");
+    JsonBuilder jb;
+    JsonDnsLogStart(aft, &jb, p, f);
+    JsonBuilderSetJson(&jb, "dns", djs);
+    json_decref(djs);
+    OutputJsonBuilderBuffer(&jb, aft->dnslog_ctx->file_ctx, &aft->buffer);
 }
 #endif
 
@@ -722,43 +733,43 @@ out:
     json_object_set_new(js, "grouped", jrdata);
 }
 
-static void OutputAnswerV1(LogDnsLogThread *aft, json_t *djs,
+static void OutputAnswerV1(LogDnsLogThread *aft, const Packet *p, Flow *f,
         DNSTransaction *tx, DNSAnswerEntry *entry)
 {
     if (!DNSRRTypeEnabled(entry->type, aft->dnslog_ctx->flags)) {
         return;
     }
 
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    JsonBuilder jb;
+    JsonDnsLogStart(aft, &jb, p, f);
+    JsonBuilderOpenObject(&jb, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonBuilderSetString(&jb, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonBuilderSetInt(&jb, "id", tx->tx_id);
 
     /* dns */
     char flags[7] = "";
     snprintf(flags, sizeof(flags), "%4x", tx->flags);
-    json_object_set_new(js, "flags", json_string(flags));
+    JsonBuilderSetString(&jb, "flags", flags);
     if (tx->flags & 0x8000)
-        json_object_set_new(js, "qr", json_true());
+        JsonBuilderSetBool(&jb, "qr", 1);
     if (tx->flags & 0x0400)
-        json_object_set_new(js, "aa", json_true());
+        JsonBuilderSetBool(&jb, "aa", 1);
     if (tx->flags & 0x0200)
-        json_object_set_new(js, "tc", json_true());
+        JsonBuilderSetBool(&jb, "tc", 1);
     if (tx->flags & 0x0100)
-        json_object_set_new(js, "rd", json_true());
+        JsonBuilderSetBool(&jb, "rd", 1);
     if (tx->flags & 0x0080)
-        json_object_set_new(js, "ra", json_true());
+        JsonBuilderSetBool(&jb, "ra", 1);
 
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonBuilderSetString(&jb, "rcode", rcode);
 
     /* query */
     if (entry->fqdn_len > 0) {
@@ -766,7 +777,7 @@ static void OutputAnswerV1(LogDnsLogThread *aft, json_t *djs,
         c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
                 entry->fqdn_len);
         if (c != NULL) {
-            json_object_set_new(js, "rrname", json_string(c));
+            JsonBuilderSetString(&jb, "rrname", c);
             SCFree(c);
         }
     }
@@ -774,22 +785,22 @@ static void OutputAnswerV1(LogDnsLogThread *aft, json_t *djs,
     /* name */
     char record[16] = "";
     DNSCreateTypeString(entry->type, record, sizeof(record));
-    json_object_set_new(js, "rrtype", json_string(record));
+    JsonBuilderSetString(&jb, "rrtype", record);
 
     /* ttl */
-    json_object_set_new(js, "ttl", json_integer(entry->ttl));
+    JsonBuilderSetInt(&jb, "ttl", entry->ttl);
 
     uint8_t *ptr = (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)+ entry->fqdn_len);
     if (entry->type == DNS_RECORD_TYPE_A && entry->data_len == 4) {
         char a[16] = "";
         PrintInet(AF_INET, (const void *)ptr, a, sizeof(a));
-        json_object_set_new(js, "rdata", json_string(a));
+        JsonBuilderSetString(&jb, "rdata", a);
     } else if (entry->type == DNS_RECORD_TYPE_AAAA && entry->data_len == 16) {
         char a[46] = "";
         PrintInet(AF_INET6, (const void *)ptr, a, sizeof(a));
-        json_object_set_new(js, "rdata", json_string(a));
+        JsonBuilderSetString(&jb, "rdata", a);
     } else if (entry->data_len == 0) {
-        json_object_set_new(js, "rdata", json_string(""));
+        JsonBuilderSetString(&jb, "rdata", "");
     } else if (entry->type == DNS_RECORD_TYPE_TXT || entry->type == DNS_RECORD_TYPE_CNAME ||
             entry->type == DNS_RECORD_TYPE_MX || entry->type == DNS_RECORD_TYPE_PTR ||
             entry->type == DNS_RECORD_TYPE_NS) {
@@ -799,24 +810,22 @@ static void OutputAnswerV1(LogDnsLogThread *aft, json_t *djs,
                 entry->data_len : sizeof(buffer) - 1;
             memcpy(buffer, ptr, copy_len);
             buffer[copy_len] = '\0';
-            json_object_set_new(js, "rdata", json_string(buffer));
+            JsonBuilderSetString(&jb, "rdata", buffer);
         } else {
-            json_object_set_new(js, "rdata", json_string(""));
+            JsonBuilderSetString(&jb, "rdata", "");
         }
     } else if (entry->type == DNS_RECORD_TYPE_SSHFP) {
         if (entry->data_len > 2) {
             json_t *hjs = DnsParseSshFpType(entry, ptr);
             if (hjs != NULL) {
-                json_object_set_new(js, "sshfp", hjs);
+                JsonBuilderSetJson(&jb, "sshfp", hjs);
+                json_decref(hjs);
             }
         }
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonBuilderClose(&jb);
+    OutputJsonBuilderBuffer(&jb, aft->dnslog_ctx->file_ctx, &aft->buffer);
 
     return;
 }
@@ -902,16 +911,17 @@ static json_t *BuildAnswer(DNSTransaction *tx, uint64_t tx_id, uint64_t flags,
     return js;
 }
 
-static void OutputAnswerV2(LogDnsLogThread *aft, json_t *djs,
+static void OutputAnswerV2(LogDnsLogThread *aft, const Packet *p, Flow *f,
         DNSTransaction *tx)
 {
     json_t *dnsjs = BuildAnswer(tx, tx->tx_id, aft->dnslog_ctx->flags,
                                 aft->dnslog_ctx->version);
     if (dnsjs != NULL) {
-        /* reset */
-        MemBufferReset(aft->buffer);
-        json_object_set_new(djs, "dns", dnsjs);
-        OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
+        JsonBuilder jb;
+        JsonDnsLogStart(aft, &jb, p, f);
+        JsonBuilderSetJson(&jb, "dns", dnsjs);
+        json_decref(dnsjs);
+        OutputJsonBuilderBuffer(&jb, aft->dnslog_ctx->file_ctx, &aft->buffer);
     }
 }
 
@@ -930,51 +940,49 @@ json_t *JsonDNSLogAnswer(DNSTransaction *tx, uint64_t tx_id)
 #endif
 
 #ifndef HAVE_RUST
-static void OutputFailure(LogDnsLogThread *aft, json_t *djs,
-        DNSTransaction *tx, DNSQueryEntry *entry) __attribute__((nonnull));
+static void OutputFailure(LogDnsLogThread *aft, const Packet *p, Flow *f,
+        DNSTransaction *tx, DNSQueryEntry *entry) __attribute__((nonnull(1, 2, 4, 5)));
 
-static void OutputFailure(LogDnsLogThread *aft, json_t *djs,
+static void OutputFailure(LogDnsLogThread *aft, const Packet *p, Flow *f,
         DNSTransaction *tx, DNSQueryEntry *entry)
 {
     if (!DNSRRTypeEnabled(entry->type, aft->dnslog_ctx->flags)) {
         return;
     }
 
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    JsonBuilder jb;
+    JsonDnsLogStart(aft, &jb, p, f);
+    JsonBuilderOpenObject(&jb, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonBuilderSetString(&jb, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonBuilderSetInt(&jb, "id", tx->tx_id);
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonBuilderSetString(&jb, "rcode", rcode);
 
     /* no answer RRs, use query for rname */
     char *c;
     c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
     if (c != NULL) {
-        json_object_set_new(js, "rrname", json_string(c));
+        JsonBuilderSetString(&jb, "rrname", c);
         SCFree(c);
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonBuilderClose(&jb);
+    OutputJsonBuilderBuffer(&jb, aft->dnslog_ctx->file_ctx, &aft->buffer);
 
     return;
 }
 #endif
 
 #ifndef HAVE_RUST
-static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uint64_t tx_id)
+static void LogAnswers(LogDnsLogThread *aft, const Packet *p, Flow *f,
+        DNSTransaction *tx, uint64_t tx_id)
 {
 
     SCLogDebug("got a DNS response and now logging !!");
@@ -984,7 +992,7 @@ static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uin
         if (query && !DNSRRTypeEnabled(query->type, aft->dnslog_ctx->flags)) {
             return;
         }
-        OutputAnswerV2(aft, js, tx);
+        OutputAnswerV2(aft, p, f, tx);
     } else {
         DNSAnswerEntry *entry = NULL;
 
@@ -995,15 +1003,15 @@ static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uin
              * are likely to lead to FORMERR, so log this. */
             DNSQueryEntry *query = NULL;
             TAILQ_FOREACH(query, &tx->query_list, next) {
-                OutputFailure(aft, js, tx, query);
+                OutputFailure(aft, p, f, tx, query);
             }
         }
 
         TAILQ_FOREACH(entry, &tx->answer_list, next) {
-            OutputAnswerV1(aft, js, tx, entry);
+            OutputAnswerV1(aft, p, f, tx, entry);
         }
         TAILQ_FOREACH(entry, &tx->authority_list, next) {
-            OutputAnswerV1(aft, js, tx, entry);
+            OutputAnswerV1(aft, p, f, tx, entry);
         }
     }
 
@@ -1017,7 +1025,6 @@ static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
 
     LogDnsLogThread *td = (LogDnsLogThread *)thread_data;
     LogDnsFileCtx *dnslog_ctx = td->dnslog_ctx;
-    json_t *js;
 
     if (unlikely(dnslog_ctx->flags & LOG_QUERIES) == 0) {
         return TM_ECODE_OK;
@@ -1025,37 +1032,21 @@ static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
 
 #ifdef HAVE_RUST
     for (uint16_t i = 0; i < 0xffff; i++) {
-        js = CreateJSONHeader(p, LOG_DIR_PACKET, "dns");
-        if (unlikely(js == NULL)) {
-            return TM_ECODE_OK;
-        }
-        if (dnslog_ctx->include_metadata) {
-            JsonAddMetadata(p, f, js);
-        }
         json_t *dns = rs_dns_log_json_query(txptr, i, td->dnslog_ctx->flags);
         if (unlikely(dns == NULL)) {
-            json_decref(js);
             break;
         }
-        json_object_set_new(js, "dns", dns);
-        MemBufferReset(td->buffer);
-        OutputJSONBuffer(js, td->dnslog_ctx->file_ctx, &td->buffer);
-        json_decref(js);
+        JsonBuilder jb;
+        JsonDnsLogStart(td, &jb, p, f);
+        JsonBuilderSetJson(&jb, "dns", dns);
+        json_decref(dns);
+        OutputJsonBuilderBuffer(&jb, td->dnslog_ctx->file_ctx, &td->buffer);
     }
 #else
     DNSTransaction *tx = txptr;
     DNSQueryEntry *query = NULL;
     TAILQ_FOREACH(query, &tx->query_list, next) {
-        js = CreateJSONHeader(p, LOG_DIR_PACKET, "dns");
-        if (unlikely(js == NULL))
-            return TM_ECODE_OK;
-        if (dnslog_ctx->include_metadata) {
-            JsonAddMetadata(p, f, js);
-        }
-
-        LogQuery(td, js, tx, tx_id, query);
-
-        json_decref(js);
+        LogQuery(td, p, f, tx, tx_id, query);
     }
 #endif
 
@@ -1074,32 +1065,24 @@ static int JsonDnsLoggerToClient(ThreadVars *tv, void *thread_data,
         return TM_ECODE_OK;
     }
 
-    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "dns");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    if (dnslog_ctx->include_metadata) {
-        JsonAddMetadata(p, f, js);
-    }
-
 #if HAVE_RUST
     if (td->dnslog_ctx->version == DNS_VERSION_2) {
         json_t *answer = rs_dns_log_json_answer(txptr,
                 td->dnslog_ctx->flags);
         if (answer != NULL) {
-            json_object_set_new(js, "dns", answer);
-            MemBufferReset(td->buffer);
-            OutputJSONBuffer(js, td->dnslog_ctx->file_ctx, &td->buffer);
+            JsonBuilder jb;
+            JsonDnsLogStart(td, &jb, p, f);
+            JsonBuilderSetJson(&jb, "dns", answer);
+            json_decref(answer);
+            OutputJsonBuilderBuffer(&jb, td->dnslog_ctx->file_ctx, &td->buffer);
         }
     }
 #else
     DNSTransaction *tx = txptr;
 
-    LogAnswers(td, js, tx, tx_id);
+    LogAnswers(td, p, f, tx, tx_id);
 #endif
 
-    json_decref(js);
-
     SCReturnInt(TM_ECODE_OK);
 }
 
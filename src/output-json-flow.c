@@ -63,16 +63,13 @@ typedef struct JsonFlowLogThread_ {
     MemBuffer *buffer;
 } JsonFlowLogThread;
 
-static json_t *CreateJSONHeaderFromFlow(const Flow *f, const char *event_type)
+static void JsonFlowLogHeader(JsonBuilder *jb, const Flow *f,
+        const char *event_type)
 {
     char timebuf[64];
     char srcip[46], dstip[46];
     Port sp, dp;
 
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
     struct timeval tv;
     memset(&tv, 0x00, sizeof(tv));
     TimeGet(&tv);
@@ -100,139 +97,114 @@ static json_t *CreateJSONHeaderFromFlow(const Flow *f, const char *event_type)
     }
 
     /* time */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
+    JsonBuilderSetString(jb, "timestamp", timebuf);
 
-    CreateJSONFlowId(js, (const Flow *)f);
+    OutputJsonBuilderFlowId(jb, f);
 
-#if 0 // TODO
-    /* sensor id */
-    if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
-#endif
     if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
+        JsonBuilderSetString(jb, "event_type", event_type);
     }
-#if 0
-    /* vlan */
-    if (f->vlan_id[0] > 0) {
-        json_t *js_vlan;
-        switch (f->vlan_idx) {
-            case 1:
-                json_object_set_new(js, "vlan",
-                                    json_integer(f->vlan_id[0]));
-                break;
-            case 2:
-                js_vlan = json_array();
-                if (unlikely(js != NULL)) {
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID1(p)));
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID2(p)));
-                    json_object_set_new(js, "vlan", js_vlan);
-                }
-                break;
-            default:
-                /* shouldn't get here */
-                break;
-        }
-    }
-#endif
+
     /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
+    JsonBuilderSetString(jb, "src_ip", srcip);
     switch(f->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            JsonBuilderSetInt(jb, "src_port", sp);
             break;
     }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    JsonBuilderSetString(jb, "dest_ip", dstip);
     switch(f->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            JsonBuilderSetInt(jb, "dest_port", dp);
             break;
     }
-    json_object_set_new(js, "proto", json_string(proto));
+    JsonBuilderSetString(jb, "proto", proto);
     switch (f->proto) {
         case IPPROTO_ICMP:
         case IPPROTO_ICMPV6:
-            json_object_set_new(js, "icmp_type",
-                    json_integer(f->icmp_s.type));
-            json_object_set_new(js, "icmp_code",
-                    json_integer(f->icmp_s.code));
+            JsonBuilderSetInt(jb, "icmp_type", f->icmp_s.type);
+            JsonBuilderSetInt(jb, "icmp_code", f->icmp_s.code);
             if (f->tosrcpktcnt) {
-                json_object_set_new(js, "response_icmp_type",
-                        json_integer(f->icmp_d.type));
-                json_object_set_new(js, "response_icmp_code",
-                        json_integer(f->icmp_d.code));
+                JsonBuilderSetInt(jb, "response_icmp_type", f->icmp_d.type);
+                JsonBuilderSetInt(jb, "response_icmp_code", f->icmp_d.code);
             }
             break;
     }
-    return js;
 }
 
-void JsonAddFlow(Flow *f, json_t *js, json_t *hjs)
+static void JsonAddAppProto(const Flow *f, JsonBuilder *jb)
 {
-    json_object_set_new(js, "app_proto",
-            json_string(AppProtoToString(f->alproto)));
+    JsonBuilderSetString(jb, "app_proto", AppProtoToString(f->alproto));
     if (f->alproto_ts != f->alproto) {
-        json_object_set_new(js, "app_proto_ts",
-                json_string(AppProtoToString(f->alproto_ts)));
+        JsonBuilderSetString(jb, "app_proto_ts",
+                AppProtoToString(f->alproto_ts));
     }
     if (f->alproto_tc != f->alproto) {
-        json_object_set_new(js, "app_proto_tc",
-                json_string(AppProtoToString(f->alproto_tc)));
+        JsonBuilderSetString(jb, "app_proto_tc",
+                AppProtoToString(f->alproto_tc));
     }
     if (f->alproto_orig != f->alproto && f->alproto_orig != ALPROTO_UNKNOWN) {
-        json_object_set_new(js, "app_proto_orig",
-                json_string(AppProtoToString(f->alproto_orig)));
+        JsonBuilderSetString(jb, "app_proto_orig",
+                AppProtoToString(f->alproto_orig));
     }
     if (f->alproto_expect != f->alproto && f->alproto_expect != ALPROTO_UNKNOWN) {
-        json_object_set_new(js, "app_proto_expected",
-                json_string(AppProtoToString(f->alproto_expect)));
+        JsonBuilderSetString(jb, "app_proto_expected",
+                AppProtoToString(f->alproto_expect));
     }
+}
 
-    json_object_set_new(hjs, "pkts_toserver",
-            json_integer(f->todstpktcnt));
-    json_object_set_new(hjs, "pkts_toclient",
-            json_integer(f->tosrcpktcnt));
-    json_object_set_new(hjs, "bytes_toserver",
-            json_integer(f->todstbytecnt));
-    json_object_set_new(hjs, "bytes_toclient",
-            json_integer(f->tosrcbytecnt));
+/** \internal add the counters and start time to an open "flow" object */
+static void JsonAddFlowCounters(const Flow *f, JsonBuilder *jb)
+{
+    JsonBuilderSetInt(jb, "pkts_toserver", f->todstpktcnt);
+    JsonBuilderSetInt(jb, "pkts_toclient", f->tosrcpktcnt);
+    JsonBuilderSetInt(jb, "bytes_toserver", f->todstbytecnt);
+    JsonBuilderSetInt(jb, "bytes_toclient", f->tosrcbytecnt);
 
     char timebuf1[64];
     CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
-    json_object_set_new(hjs, "start", json_string(timebuf1));
+    JsonBuilderSetString(jb, "start", timebuf1);
+}
+
+/**
+ * \brief Add the app_proto members and the "flow" object
+ */
+void JsonAddFlow(Flow *f, JsonBuilder *jb)
+{
+    JsonAddAppProto(f, jb);
+
+    JsonBuilderOpenObject(jb, "flow");
+    JsonAddFlowCounters(f, jb);
+    JsonBuilderClose(jb);
 }
 
 /* JSON format logging */
-static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
+static void JsonFlowLogJSON(JsonFlowLogThread *aft, JsonBuilder *jb, Flow *f)
 {
     LogJsonFileCtx *flow_ctx = aft->flowlog_ctx;
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
 
-    JsonAddFlow(f, js, hjs);
+    JsonAddAppProto(f, jb);
+
+    JsonBuilderOpenObject(jb, "flow");
+    JsonAddFlowCounters(f, jb);
 
     char timebuf2[64];
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JsonBuilderSetString(jb, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JsonBuilderSetInt(jb, "age", age);
 
     if (f->flow_end_flags & FLOW_END_FLAG_EMERGENCY)
-        json_object_set_new(hjs, "emergency", json_true());
+        JsonBuilderSetBool(jb, "emergency", 1);
     const char *state = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_STATE_NEW)
         state = "new";
@@ -245,12 +217,10 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
         int flow_state = SC_ATOMIC_GET(f->flow_state);
         switch (flow_state) {
             case FLOW_STATE_LOCAL_BYPASSED:
-                json_object_set_new(hjs, "bypass",
-                        json_string("local"));
+                JsonBuilderSetString(jb, "bypass", "local");
                 break;
             case FLOW_STATE_CAPTURE_BYPASSED:
-                json_object_set_new(hjs, "bypass",
-                        json_string("capture"));
+                JsonBuilderSetString(jb, "bypass", "capture");
                 break;
             default:
                 SCLogError(SC_ERR_INVALID_VALUE,
@@ -259,8 +229,7 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
         }
     }
 
-    json_object_set_new(hjs, "state",
-            json_string(state));
+    JsonBuilderSetString(jb, "state", state);
 
     const char *reason = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)
@@ -270,40 +239,37 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_SHUTDOWN)
         reason = "shutdown";
 
-    json_object_set_new(hjs, "reason",
-            json_string(reason));
+    JsonBuilderSetString(jb, "reason", reason);
 
-    json_object_set_new(hjs, "alerted", json_boolean(FlowHasAlerts(f)));
+    JsonBuilderSetBool(jb, "alerted", FlowHasAlerts(f));
 
-    json_object_set_new(js, "flow", hjs);
+    /* flow */
+    JsonBuilderClose(jb);
 
     if (flow_ctx->include_metadata) {
-        JsonAddMetadata(NULL, f, js);
+        OutputJsonBuilderMetadata(jb, NULL, f);
     }
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
+        JsonBuilderOpenObject(jb, "tcp");
 
         TcpSession *ssn = f->protoctx;
 
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->tcp_packet_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->client.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_ts", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags_ts", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_tc", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags_tc", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->tcp_packet_flags : 0, tjs);
+        JsonTcpFlags(ssn ? ssn->tcp_packet_flags : 0, jb);
 
         if (ssn) {
             const char *tcp_state = NULL;
@@ -345,10 +311,10 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
                     tcp_state = "closed";
                     break;
             }
-            json_object_set_new(tjs, "state", json_string(tcp_state));
+            JsonBuilderSetString(jb, "state", tcp_state);
         }
 
-        json_object_set_new(js, "tcp", tjs);
+        JsonBuilderClose(jb);
     }
 }
 
@@ -356,21 +322,12 @@ static int JsonFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 {
     SCEnter();
     JsonFlowLogThread *jhl = (JsonFlowLogThread *)thread_data;
+    JsonBuilder jb;
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-
-    json_t *js = CreateJSONHeaderFromFlow(f, "flow");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    JsonFlowLogJSON(jhl, js, f);
-
-    OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
-
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderStart(&jb, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
+    JsonFlowLogHeader(&jb, f, "flow");
+    JsonFlowLogJSON(jhl, &jb, f);
+    OutputJsonBuilderBuffer(&jb, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
 
     SCReturnInt(TM_ECODE_OK);
 }
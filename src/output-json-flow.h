@@ -26,7 +26,7 @@
 
 void JsonFlowLogRegister(void);
 #ifdef HAVE_LIBJANSSON
-void JsonAddFlow(Flow *f, json_t *js, json_t *hjs);
+void JsonAddFlow(Flow *f, JsonBuilder *jb);
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* __OUTPUT_JSON_FLOW_H__ */
@@ -430,7 +430,7 @@ void JsonHttpLogJSONBodyBase64(json_t *js, Flow *f, uint64_t tx_id)
 }
 
 /* JSON format logging */
-static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx, uint64_t tx_id)
+static void JsonHttpLogJSON(JsonHttpLogThread *aft, JsonBuilder *jb, htp_tx_t *tx, uint64_t tx_id)
 {
     LogHttpFileCtx *http_ctx = aft->httplog_ctx;
     json_t *hjs = json_object();
@@ -445,7 +445,8 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx, ui
     if (http_ctx->flags & LOG_HTTP_EXTENDED)
         JsonHttpLogJSONExtended(hjs, tx);
 
-    json_object_set_new(js, "http", hjs);
+    JsonBuilderSetJson(jb, "http", hjs);
+    json_decref(hjs);
 }
 
 static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow *f, void *alstate, void *txptr, uint64_t tx_id)
@@ -454,50 +455,49 @@ static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Fl
 
     htp_tx_t *tx = txptr;
     JsonHttpLogThread *jhl = (JsonHttpLogThread *)thread_data;
+    JsonBuilder jb;
+    JsonAddrInfo addr;
 
-    json_t *js = CreateJSONHeaderWithTxId(p, LOG_DIR_FLOW, "http", tx_id);
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    if (jhl->httplog_ctx->include_metadata) {
-        JsonAddMetadata(p, f, js);
-    }
-
-    SCLogDebug("got a HTTP request and now logging !!");
-
-    /* reset */
-    MemBufferReset(jhl->buffer);
+    JsonAddrInfoInit(p, LOG_DIR_FLOW, &addr);
 
-    JsonHttpLogJSON(jhl, js, tx, tx_id);
     HttpXFFCfg *xff_cfg = jhl->httplog_ctx->xff_cfg != NULL ?
         jhl->httplog_ctx->xff_cfg : jhl->httplog_ctx->parent_xff_cfg;
 
-    /* xff header */
+    /* xff header, needed before the header is written */
+    int have_xff_ip = 0;
+    char buffer[XFF_MAXLEN];
     if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
-        int have_xff_ip = 0;
-        char buffer[XFF_MAXLEN];
-
         have_xff_ip = HttpXFFGetIPFromTx(p->flow, tx_id, xff_cfg, buffer, XFF_MAXLEN);
 
-        if (have_xff_ip) {
-            if (xff_cfg->flags & XFF_EXTRADATA) {
-                json_object_set_new(js, "xff", json_string(buffer));
-            }
-            else if (xff_cfg->flags & XFF_OVERWRITE) {
-                if (p->flowflags & FLOW_PKT_TOCLIENT) {
-                    json_object_set(js, "dest_ip", json_string(buffer));
-                } else {
-                    json_object_set(js, "src_ip", json_string(buffer));
-                }
+        if (have_xff_ip && !(xff_cfg->flags & XFF_EXTRADATA) &&
+                (xff_cfg->flags & XFF_OVERWRITE)) {
+            if (p->flowflags & FLOW_PKT_TOCLIENT) {
+                strlcpy(addr.dst_ip, buffer, sizeof(addr.dst_ip));
+            } else {
+                strlcpy(addr.src_ip, buffer, sizeof(addr.src_ip));
             }
         }
     }
 
-    OutputJSONBuffer(js, jhl->httplog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
+    SCLogDebug("got a HTTP request and now logging !!");
+
+    OutputJsonBuilderStart(&jb, jhl->httplog_ctx->file_ctx, &jhl->buffer);
+    OutputJsonBuilderHeader(&jb, p, LOG_DIR_FLOW, "http", &addr);
+
+    /* tx id for correlation with other events */
+    JsonBuilderSetInt(&jb, "tx_id", tx_id);
+
+    if (jhl->httplog_ctx->include_metadata) {
+        OutputJsonBuilderMetadata(&jb, p, f);
+    }
+
+    JsonHttpLogJSON(jhl, &jb, tx, tx_id);
+
+    if (have_xff_ip && (xff_cfg->flags & XFF_EXTRADATA)) {
+        JsonBuilderSetString(&jb, "xff", buffer);
+    }
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderBuffer(&jb, jhl->httplog_ctx->file_ctx, &jhl->buffer);
 
     SCReturnInt(TM_ECODE_OK);
 }
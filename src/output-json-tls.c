@@ -393,24 +393,11 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
         return 0;
     }
 
-    json_t *js = CreateJSONHeader(p, LOG_DIR_FLOW, "tls");
-    if (unlikely(js == NULL)) {
-        return 0;
-    }
-
-    if (tls_ctx->include_metadata) {
-        JsonAddMetadata(p, f, js);
-    }
-
     json_t *tjs = json_object();
     if (tjs == NULL) {
-        free(js);
         return 0;
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-
     /* log custom fields */
     if (tls_ctx->flags & LOG_TLS_CUSTOM) {
         JsonTlsLogJSONCustom(tls_ctx, tjs, ssl_state);
@@ -431,11 +418,18 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
                 json_string(AppLayerGetProtoName(f->alproto_orig)));
     }
 
-    json_object_set_new(js, "tls", tjs);
+    JsonBuilder jb;
+    OutputJsonBuilderStart(&jb, tls_ctx->file_ctx, &aft->buffer);
+    OutputJsonBuilderHeader(&jb, p, LOG_DIR_FLOW, "tls", NULL);
+
+    if (tls_ctx->include_metadata) {
+        OutputJsonBuilderMetadata(&jb, p, f);
+    }
+
+    JsonBuilderSetJson(&jb, "tls", tjs);
+    json_decref(tjs);
 
-    OutputJSONBuffer(js, tls_ctx->file_ctx, &aft->buffer);
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderBuffer(&jb, tls_ctx->file_ctx, &aft->buffer);
 
     return 0;
 }
@@ -29,6 +29,7 @@
 #include "detect.h"
 #include "flow.h"
 #include "conf.h"
+#include "conf-yaml-loader.h"
 
 #include "threads.h"
 #include "tm-threads.h"
@@ -55,13 +56,17 @@
 #include "util-proto-name.h"
 #include "util-optimize.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-logopenfile.h"
 #include "util-log-redis.h"
+#include "util-msgpack.h"
 #include "util-device.h"
 #include "util-validate.h"
 
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-util.h"
+#include "stream-tcp.h"
 
 #include "source-pcap-file.h"
 
@@ -362,38 +367,39 @@ void JsonAddMetadata(const Packet *p, const Flow *f, json_t *js)
 /** \brief jsonify tcp flags field
  *  Only add 'true' fields in an attempt to keep things reasonably compact.
  */
-void JsonTcpFlags(uint8_t flags, json_t *js)
+void JsonTcpFlags(uint8_t flags, JsonBuilder *jb)
 {
     if (flags & TH_SYN)
-        json_object_set_new(js, "syn", json_true());
+        JsonBuilderSetBool(jb, "syn", 1);
     if (flags & TH_FIN)
-        json_object_set_new(js, "fin", json_true());
+        JsonBuilderSetBool(jb, "fin", 1);
     if (flags & TH_RST)
-        json_object_set_new(js, "rst", json_true());
+        JsonBuilderSetBool(jb, "rst", 1);
     if (flags & TH_PUSH)
-        json_object_set_new(js, "psh", json_true());
+        JsonBuilderSetBool(jb, "psh", 1);
     if (flags & TH_ACK)
-        json_object_set_new(js, "ack", json_true());
+        JsonBuilderSetBool(jb, "ack", 1);
     if (flags & TH_URG)
-        json_object_set_new(js, "urg", json_true());
+        JsonBuilderSetBool(jb, "urg", 1);
     if (flags & TH_ECN)
-        json_object_set_new(js, "ecn", json_true());
+        JsonBuilderSetBool(jb, "ecn", 1);
     if (flags & TH_CWR)
-        json_object_set_new(js, "cwr", json_true());
+        JsonBuilderSetBool(jb, "cwr", 1);
 }
 
 /**
- * \brief Add five tuple from packet to JSON object
+ * \brief Get the addresses, ports and protocol name of a packet
  *
  * \param p Packet
  * \param dir log direction (packet or flow)
- * \param js JSON object
+ * \param addr filled in
  */
-void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
+void JsonAddrInfoInit(const Packet *p, enum OutputJsonLogDirection dir,
+        JsonAddrInfo *addr)
 {
-    char srcip[46], dstip[46];
+    char *srcip = addr->src_ip, *dstip = addr->dst_ip;
+    const size_t ipsize = sizeof(addr->src_ip);
     Port sp, dp;
-    char proto[16];
 
     srcip[0] = '\0';
     dstip[0] = '\0';
@@ -402,14 +408,14 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
         case LOG_DIR_PACKET:
             if (PKT_IS_IPV4(p)) {
                 PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                        srcip, sizeof(srcip));
+                        srcip, ipsize);
                 PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                        dstip, sizeof(dstip));
+                        dstip, ipsize);
             } else if (PKT_IS_IPV6(p)) {
                 PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                        srcip, sizeof(srcip));
+                        srcip, ipsize);
                 PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                        dstip, sizeof(dstip));
+                        dstip, ipsize);
             }
             sp = p->sp;
             dp = p->dp;
@@ -419,28 +425,28 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
             if ((PKT_IS_TOSERVER(p))) {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
                 sp = p->sp;
                 dp = p->dp;
             } else {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
                 sp = p->dp;
                 dp = p->sp;
@@ -450,28 +456,28 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
             if ((PKT_IS_TOCLIENT(p))) {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
                 sp = p->sp;
                 dp = p->dp;
             } else {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
                 sp = p->dp;
                 dp = p->sp;
@@ -479,16 +485,25 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
             break;
         default:
             DEBUG_VALIDATE_BUG_ON(1);
-            return;
+            sp = 0;
+            dp = 0;
+            break;
     }
 
+    addr->sp = sp;
+    addr->dp = dp;
+
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
+        strlcpy(addr->proto, known_proto[IP_GET_IPPROTO(p)], sizeof(addr->proto));
     } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
+        snprintf(addr->proto, sizeof(addr->proto), "%03" PRIu32, IP_GET_IPPROTO(p));
     }
+}
 
-    json_object_set_new(js, "src_ip", json_string(srcip));
+static void JsonFiveTupleJansson(const Packet *p, const JsonAddrInfo *addr,
+        json_t *js)
+{
+    json_object_set_new(js, "src_ip", json_string(addr->src_ip));
 
     switch(p->proto) {
         case IPPROTO_ICMP:
@@ -496,11 +511,11 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            json_object_set_new(js, "src_port", json_integer(addr->sp));
             break;
     }
 
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    json_object_set_new(js, "dest_ip", json_string(addr->dst_ip));
 
     switch(p->proto) {
         case IPPROTO_ICMP:
@@ -508,11 +523,47 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            json_object_set_new(js, "dest_port", json_integer(addr->dp));
             break;
     }
 
-    json_object_set_new(js, "proto", json_string(proto));
+    json_object_set_new(js, "proto", json_string(addr->proto));
+}
+
+/**
+ * \brief Add five tuple to a JSON builder
+ *
+ * \param p Packet, for the protocol
+ * \param addr addresses and ports from JsonAddrInfoInit()
+ * \param jb JSON builder
+ */
+void JsonFiveTuple(const Packet *p, const JsonAddrInfo *addr, JsonBuilder *jb)
+{
+    JsonBuilderSetString(jb, "src_ip", addr->src_ip);
+
+    switch(p->proto) {
+        case IPPROTO_ICMP:
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetInt(jb, "src_port", addr->sp);
+            break;
+    }
+
+    JsonBuilderSetString(jb, "dest_ip", addr->dst_ip);
+
+    switch(p->proto) {
+        case IPPROTO_ICMP:
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetInt(jb, "dest_port", addr->dp);
+            break;
+    }
+
+    JsonBuilderSetString(jb, "proto", addr->proto);
 }
 
 void CreateJSONFlowId(json_t *js, const Flow *f)
@@ -586,7 +637,9 @@ json_t *CreateJSONHeader(const Packet *p, enum OutputJsonLogDirection dir,
     }
 
     /* 5-tuple */
-    JsonFiveTuple(p, dir, js);
+    JsonAddrInfo addr;
+    JsonAddrInfoInit(p, dir, &addr);
+    JsonFiveTupleJansson(p, &addr, js);
 
     /* icmp */
     switch (p->proto) {
@@ -648,6 +701,18 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
         json_object_set_new(js, "pcap_filename", json_string(PcapFileGetFilename()));
     }
 
+    if (file_ctx->msgpack != NULL) {
+        /* the prefix is in the file header */
+        uint32_t start = MEMBUFFER_OFFSET(*buffer);
+        if (MsgpackFrameStart(buffer, MSGPACK_FRAME_EVENT) < 0 ||
+                MsgpackWriteJson(file_ctx->msgpack, buffer, js, false) < 0)
+            return TM_ECODE_OK;
+        MsgpackFrameFinish(*buffer, start);
+        file_ctx->Write((const char *)MEMBUFFER_BUFFER(*buffer) + start,
+                MEMBUFFER_OFFSET(*buffer) - start, file_ctx);
+        return 0;
+    }
+
     if (file_ctx->prefix) {
         MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
     }
@@ -666,6 +731,187 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
     return 0;
 }
 
+/**
+ * \brief Add flow_id and parent_id to a JSON builder
+ */
+void OutputJsonBuilderFlowId(JsonBuilder *jb, const Flow *f)
+{
+    if (f == NULL)
+        return;
+    int64_t flow_id = FlowGetId(f);
+    JsonBuilderSetInt(jb, "flow_id", flow_id);
+    if (f->parent_id) {
+        JsonBuilderSetInt(jb, "parent_id", f->parent_id);
+    }
+}
+
+/**
+ * \brief Start a record: reset the buffer, write the prefix and open
+ *        the top level object.
+ *
+ * The record is written to the per thread buffer as it is built, so
+ * there must not be another record in progress on the same buffer.
+ */
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx,
+        MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+    if (file_ctx->msgpack != NULL) {
+        JsonBuilderInitMsgpack(jb, buffer, file_ctx->msgpack);
+        if (MsgpackFrameStart(buffer, MSGPACK_FRAME_EVENT) < 0)
+            jb->error = true;
+        JsonBuilderOpenObject(jb, NULL);
+        return;
+    }
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+    JsonBuilderInit(jb, buffer, file_ctx->json_flags);
+    JsonBuilderOpenObject(jb, NULL);
+}
+
+/**
+ * \brief Write the common header of a packet based record
+ *
+ * Same members in the same order as CreateJSONHeader().
+ *
+ * \param addr five tuple to log, NULL to use the one of the packet
+ */
+void OutputJsonBuilderHeader(JsonBuilder *jb, const Packet *p,
+        enum OutputJsonLogDirection dir, const char *event_type,
+        const JsonAddrInfo *addr)
+{
+    char timebuf[64];
+    const Flow *f = (const Flow *)p->flow;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    /* time & tx */
+    JsonBuilderSetString(jb, "timestamp", timebuf);
+
+    OutputJsonBuilderFlowId(jb, f);
+
+    /* sensor id */
+    if (sensor_id >= 0)
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
+
+    /* input interface */
+    if (p->livedev) {
+        JsonBuilderSetString(jb, "in_iface", p->livedev->dev);
+    }
+
+    /* pcap_cnt */
+    if (p->pcap_cnt != 0) {
+        JsonBuilderSetInt(jb, "pcap_cnt", p->pcap_cnt);
+    }
+
+    if (event_type) {
+        JsonBuilderSetString(jb, "event_type", event_type);
+    }
+
+    /* vlan */
+    if (p->vlan_idx > 0) {
+        switch (p->vlan_idx) {
+            case 1:
+                JsonBuilderSetInt(jb, "vlan", VLAN_GET_ID1(p));
+                break;
+            case 2:
+                JsonBuilderOpenArray(jb, "vlan");
+                JsonBuilderSetInt(jb, NULL, VLAN_GET_ID1(p));
+                JsonBuilderSetInt(jb, NULL, VLAN_GET_ID2(p));
+                JsonBuilderClose(jb);
+                break;
+            default:
+                /* shouldn't get here */
+                break;
+        }
+    }
+
+    /* 5-tuple */
+    JsonAddrInfo paddr;
+    if (addr == NULL) {
+        JsonAddrInfoInit(p, dir, &paddr);
+        addr = &paddr;
+    }
+    JsonFiveTuple(p, addr, jb);
+
+    /* icmp */
+    switch (p->proto) {
+        case IPPROTO_ICMP:
+            if (p->icmpv4h) {
+                JsonBuilderSetInt(jb, "icmp_type", p->icmpv4h->type);
+                JsonBuilderSetInt(jb, "icmp_code", p->icmpv4h->code);
+            }
+            break;
+        case IPPROTO_ICMPV6:
+            if (p->icmpv6h) {
+                JsonBuilderSetInt(jb, "icmp_type", p->icmpv6h->type);
+                JsonBuilderSetInt(jb, "icmp_code", p->icmpv6h->code);
+            }
+            break;
+    }
+}
+
+/**
+ * \brief Add the "traffic" and "metadata" members, see JsonAddMetadata()
+ *
+ * These are still built as jansson objects, but only for packets and
+ * flows that have variables set.
+ */
+void OutputJsonBuilderMetadata(JsonBuilder *jb, const Packet *p, const Flow *f)
+{
+    if ((p && p->pktvar) || (f && f->flowvar)) {
+        json_t *js = json_object();
+        if (unlikely(js == NULL))
+            return;
+
+        JsonAddMetadata(p, f, js);
+        JsonBuilderSetJson(jb, "traffic", json_object_get(js, "traffic"));
+        JsonBuilderSetJson(jb, "metadata", json_object_get(js, "metadata"));
+        json_decref(js);
+    }
+}
+
+/**
+ * \brief Finish a record started with OutputJsonBuilderStart() and
+ *        write it out
+ *
+ * Adds the members OutputJSONBuffer() adds and closes the top level
+ * object. Records that could not be fully written are dropped.
+ */
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx,
+        MemBuffer **buffer)
+{
+    if (file_ctx->sensor_name) {
+        JsonBuilderSetString(jb, "host", file_ctx->sensor_name);
+    }
+
+    if (file_ctx->is_pcap_offline) {
+        JsonBuilderSetString(jb, "pcap_filename", PcapFileGetFilename());
+    }
+
+    JsonBuilderClose(jb);
+    if (!JsonBuilderIsComplete(jb)) {
+        DEBUG_VALIDATE_BUG_ON(jb->depth != 0 || jb->discard != 0);
+        return TM_ECODE_OK;
+    }
+
+    if (file_ctx->msgpack != NULL) {
+        MsgpackFrameFinish(*buffer, 0);
+        file_ctx->Write((const char *)MEMBUFFER_BUFFER(*buffer),
+                MEMBUFFER_OFFSET(*buffer), file_ctx);
+        return 0;
+    }
+
+    /* room for the newline LogFileWrite() appends */
+    if (MEMBUFFER_OFFSET(*buffer) + 2 > MEMBUFFER_SIZE(*buffer)) {
+        MemBufferExpand(buffer, OUTPUT_BUFFER_SIZE);
+    }
+
+    LogFileWrite(file_ctx, *buffer);
+    return 0;
+}
+
 /**
  * \brief Create a new LogFileCtx for "fast" output style.
  * \param conf The configuration node for this output.
@@ -773,6 +1019,13 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
             json_ctx->json_out == LOGFILE_TYPE_UNIX_DGRAM ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_STREAM)
         {
+            /* one file per writer thread, so the threads don't
+             * serialize on the file lock */
+            const char *threaded = ConfNodeLookupChildValue(conf, "threaded");
+            if (threaded != NULL && ConfValIsTrue(threaded)) {
+                json_ctx->file_ctx->threaded = true;
+            }
+
             if (SCConfLogOpenGeneric(conf, json_ctx->file_ctx, DEFAULT_LOG_FILENAME, 1) < 0) {
                 LogFileFreeCtx(json_ctx->file_ctx);
                 SCFree(json_ctx);
@@ -780,6 +1033,32 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
                 return result;
             }
             OutputRegisterFileRotationFlag(&json_ctx->file_ctx->rotation_flag);
+
+            const char *format = ConfNodeLookupChildValue(conf, "format");
+            if (format != NULL && strcmp(format, "msgpack") == 0) {
+                if (json_ctx->json_out != LOGFILE_TYPE_FILE ||
+                        !json_ctx->file_ctx->is_regular) {
+                    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "eve-log format "
+                            "msgpack is only supported for regular files, "
+                            "using json");
+                } else {
+                    json_ctx->file_ctx->msgpack = MsgpackCtxNew(
+                            json_ctx->file_ctx->json_flags,
+                            json_ctx->file_ctx->prefix);
+                    if (json_ctx->file_ctx->msgpack == NULL) {
+                        LogFileFreeCtx(json_ctx->file_ctx);
+                        SCFree(json_ctx);
+                        SCFree(output_ctx);
+                        return result;
+                    }
+                    SCLogConfig("eve-log writing msgpack to %s",
+                            json_ctx->file_ctx->filename);
+                }
+            } else if (format != NULL && strcmp(format, "json") != 0) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "Invalid eve-log format: %s", format);
+                exit(EXIT_FAILURE);
+            }
         }
 #ifndef OS_WIN32
 	else if (json_ctx->json_out == LOGFILE_TYPE_SYSLOG) {
@@ -832,6 +1111,18 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
                 SCFree(output_ctx);
                 return result;
             }
+
+            /* send the events from a writer thread in batches */
+            ConfNode *async = ConfNodeLookupChild(conf, "async");
+            if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+                json_ctx->file_ctx->type = LOGFILE_TYPE_REDIS;
+                if (SCLogRedisAsyncSetup(json_ctx->file_ctx, async) < 0) {
+                    LogFileFreeCtx(json_ctx->file_ctx);
+                    SCFree(json_ctx);
+                    SCFree(output_ctx);
+                    return result;
+                }
+            }
         }
 #endif
 
@@ -892,9 +1183,398 @@ static void OutputJsonDeInitCtx(OutputCtx *output_ctx)
     if (json_ctx->xff_cfg != NULL) {
         SCFree(json_ctx->xff_cfg);
     }
+    /* the files, incl. queued async records, are done with it after this */
+    MsgpackCtx *msgpack = logfile_ctx->msgpack;
     LogFileFreeCtx(logfile_ctx);
+    MsgpackCtxFree(msgpack);
     SCFree(json_ctx);
     SCFree(output_ctx);
 }
 
+#ifdef UNITTESTS
+
+#define OUTPUT_JSON_TEST_FLAGS \
+    (JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH)
+
+/** \internal build a header record the old way, returns the length */
+static size_t OutputJsonTestJansson(const Packet *p, MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "alert");
+    if (js == NULL)
+        return 0;
+    json_t *ajs = json_object();
+    if (ajs != NULL) {
+        json_object_set_new(ajs, "signature_id", json_integer(1));
+        json_object_set_new(ajs, "signature", json_string("test \"rule\""));
+        json_object_set_new(js, "alert", ajs);
+    }
+    OutputJSONMemBufferWrapper wrapper = {
+        .buffer = buffer,
+        .expand_by = OUTPUT_BUFFER_SIZE
+    };
+    int r = json_dump_callback(js, OutputJSONMemBufferCallback, &wrapper,
+            OUTPUT_JSON_TEST_FLAGS);
+    json_decref(js);
+    return r == 0 ? MEMBUFFER_OFFSET(*buffer) : 0;
+}
+
+/** \internal build the same record with the builder */
+static size_t OutputJsonTestBuilder(const Packet *p, MemBuffer **buffer)
+{
+    JsonBuilder jb;
+
+    MemBufferReset(*buffer);
+    JsonBuilderInit(&jb, buffer, OUTPUT_JSON_TEST_FLAGS);
+    JsonBuilderOpenObject(&jb, NULL);
+    OutputJsonBuilderHeader(&jb, p, LOG_DIR_PACKET, "alert", NULL);
+    JsonBuilderOpenObject(&jb, "alert");
+    JsonBuilderSetInt(&jb, "signature_id", 1);
+    JsonBuilderSetString(&jb, "signature", "test \"rule\"");
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    return JsonBuilderIsComplete(&jb) ? MEMBUFFER_OFFSET(*buffer) : 0;
+}
+
+/**
+ * \test the builder header is byte identical to CreateJSONHeader()
+ */
+static int OutputJsonTest01(void)
+{
+    uint8_t payload[] = "GET / HTTP/1.0\r\n\r\n";
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p);
+    Flow *f = UTHBuildFlow(AF_INET, "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(f);
+    p->flow = f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->pcap_cnt = 7;
+
+    MemBuffer *old = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
+    FAIL_IF_NULL(old);
+    MemBuffer *new = MemBufferCreateNew(8);
+    FAIL_IF_NULL(new);
+
+    size_t old_len = OutputJsonTestJansson(p, &old);
+    size_t new_len = OutputJsonTestBuilder(p, &new);
+    FAIL_IF(old_len == 0);
+    FAIL_IF(old_len != new_len);
+    FAIL_IF(memcmp(old->buffer, new->buffer, old_len) != 0);
+
+    MemBufferFree(old);
+    MemBufferFree(new);
+    UTHFreeFlow(f);
+    UTHFreePacket(p);
+    PASS;
+}
+
+#ifdef PROFILING
+/* The benchmark only runs in profiling builds: it takes seconds and its
+ * numbers mean nothing in a debug or sanitized unittest build. Run it
+ * with "suricata -u -U OutputJsonBench". */
+
+#define OUTPUT_JSON_BENCH_ITERATIONS 100000
+
+static uint64_t output_json_test_allocs = 0;
+
+static void *OutputJsonTestMalloc(size_t size)
+{
+    output_json_test_allocs++;
+    return malloc(size);
+}
+
+static void OutputJsonTestFree(void *ptr)
+{
+    free(ptr);
+}
+
+static uint64_t OutputJsonTestNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+typedef int (*OutputJsonBenchFunc)(void *);
+
+/**
+ * \internal
+ * \brief time OUTPUT_JSON_BENCH_ITERATIONS records of \a Func
+ *
+ * The counting jansson allocator is only installed for the loop, so
+ * it's restored before returning, also when a record fails.
+ *
+ * \param allocs if not NULL, set to the jansson allocations of the loop
+ *
+ * \retval 1 ok, 0 if a record failed
+ */
+static int OutputJsonBenchRun(const char *name, OutputJsonBenchFunc Func,
+        void *data, uint64_t *allocs)
+{
+    uint32_t i;
+
+    json_set_alloc_funcs(OutputJsonTestMalloc, OutputJsonTestFree);
+    output_json_test_allocs = 0;
+    uint64_t start = OutputJsonTestNow();
+    for (i = 0; i < OUTPUT_JSON_BENCH_ITERATIONS; i++) {
+        if (Func(data) != 0)
+            break;
+    }
+    uint64_t usec = OutputJsonTestNow() - start;
+    json_set_alloc_funcs(malloc, free);
+
+    if (i != OUTPUT_JSON_BENCH_ITERATIONS) {
+        SCLogError(SC_ERR_INVALID_VALUE, "%s: record %u failed", name, i);
+        return 0;
+    }
+
+    SCLogInfo("%s: %u records %"PRIu64"us, %.3fus %.1f allocs/record",
+            name, i, usec, (double)usec / i,
+            (double)output_json_test_allocs / i);
+    if (allocs != NULL)
+        *allocs = output_json_test_allocs;
+    return 1;
+}
+
+typedef struct OutputJsonBenchHeader_ {
+    const Packet *p;
+    MemBuffer **buffer;
+} OutputJsonBenchHeader;
+
+static int OutputJsonBenchJansson(void *data)
+{
+    OutputJsonBenchHeader *hb = data;
+    return OutputJsonTestJansson(hb->p, hb->buffer) == 0;
+}
+
+static int OutputJsonBenchBuilder(void *data)
+{
+    OutputJsonBenchHeader *hb = data;
+    return OutputJsonTestBuilder(hb->p, hb->buffer) == 0;
+}
+
+typedef struct OutputJsonBenchLogger_ {
+    OutputModule *module;
+    ThreadVars tv;
+    void *thread_data;
+    Packet *p;
+    void *alstate;
+    void *tx;
+} OutputJsonBenchLogger;
+
+/** \internal log one record through the module's own log function */
+static int OutputJsonBenchLog(void *data)
+{
+    OutputJsonBenchLogger *bl = data;
+    OutputModule *module = bl->module;
+    int r = TM_ECODE_FAILED;
+
+    if (module->PacketLogFunc != NULL) {
+        r = module->PacketLogFunc(&bl->tv, bl->thread_data, bl->p);
+    } else if (module->FlowLogFunc != NULL) {
+        r = module->FlowLogFunc(&bl->tv, bl->thread_data, bl->p->flow);
+    } else if (module->TxLogFunc != NULL) {
+        r = module->TxLogFunc(&bl->tv, bl->thread_data, bl->p, bl->p->flow,
+                bl->alstate, bl->tx, 0);
+    }
+    return r != TM_ECODE_OK;
+}
+
+/**
+ * \internal
+ * \brief set up the eve sub module \a conf_name with its defaults and
+ *        time its records for \a p
+ */
+static int OutputJsonBenchModule(OutputCtx *eve_ctx, const char *conf_name,
+        Packet *p, void *alstate, void *tx)
+{
+    OutputJsonBenchLogger bl;
+    int result = 0;
+
+    memset(&bl, 0, sizeof(bl));
+    bl.module = OutputGetModuleByConfName(conf_name);
+    if (bl.module == NULL || bl.module->InitSubFunc == NULL)
+        return 0;
+    bl.p = p;
+    bl.alstate = alstate;
+    bl.tx = tx;
+
+    ConfNode *conf = ConfNodeNew();
+    if (conf == NULL)
+        return 0;
+    OutputInitResult init = bl.module->InitSubFunc(conf, eve_ctx);
+    if (init.ok && init.ctx != NULL) {
+        if (bl.module->ThreadInit(&bl.tv, init.ctx, &bl.thread_data) == TM_ECODE_OK) {
+            result = OutputJsonBenchRun(conf_name, OutputJsonBenchLog, &bl, NULL);
+            bl.module->ThreadDeinit(&bl.tv, bl.thread_data);
+        }
+        init.ctx->DeInit(init.ctx);
+    }
+    ConfNodeFree(conf);
+    return result;
+}
+
+/**
+ * \internal
+ * \brief parse \a buf as the first to server data of a \a alproto flow
+ *        and time the records of its first tx
+ */
+static int OutputJsonBenchTx(OutputCtx *eve_ctx, const char *conf_name,
+        AppProto alproto, uint8_t ipproto, Port dp, uint8_t *buf,
+        uint32_t buflen)
+{
+    int result = 0;
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    Packet *p = UTHBuildPacketReal(buf, buflen, ipproto,
+            "192.168.1.5", "10.0.0.1", 41424, dp);
+    Flow *f = UTHBuildFlow(AF_INET, "192.168.1.5", "10.0.0.1", 41424, dp);
+    if (alp_tctx == NULL || p == NULL || f == NULL)
+        goto end;
+
+    f->proto = ipproto;
+    f->protomap = FlowGetProtoMapping(ipproto);
+    f->alproto = alproto;
+    if (ipproto == IPPROTO_TCP)
+        f->protoctx = &ssn;
+    p->flow = f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+
+    if (AppLayerParserParse(NULL, alp_tctx, f, alproto,
+                STREAM_TOSERVER|STREAM_START, buf, buflen) != 0)
+        goto end;
+    void *tx = AppLayerParserGetTx(ipproto, alproto, f->alstate, 0);
+    if (tx == NULL)
+        goto end;
+
+    result = OutputJsonBenchModule(eve_ctx, conf_name, p, f->alstate, tx);
+end:
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    if (f != NULL)
+        UTHFreeFlow(f);
+    if (p != NULL)
+        UTHFreePacket(p);
+    return result;
+}
+
+/**
+ * \test time and count the allocations of the header built both ways and
+ *       of the alert, flow, netflow, dns, http and tls records
+ */
+static int OutputJsonBench01(void)
+{
+    const char eve_conf[] = "\
+%YAML 1.1\n\
+---\n\
+eve-log:\n\
+  filetype: regular\n\
+  filename: /dev/null\n\
+";
+    uint8_t http_buf[] = "GET /index.html HTTP/1.1\r\n"
+        "Host: www.example.org\r\n"
+        "User-Agent: Mozilla/5.0\r\n"
+        "Accept: */*\r\n\r\n";
+    /* google.com TXT query */
+    uint8_t dns_buf[] = { 0x10, 0x32, 0x01, 0x00, 0x00, 0x01,
+                          0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                          0x06, 0x67, 0x6F, 0x6F, 0x67, 0x6C,
+                          0x65, 0x03, 0x63, 0x6F, 0x6D, 0x00,
+                          0x00, 0x10, 0x00, 0x01, };
+    /* client hello with sni google.com */
+    uint8_t tls_buf[] = { 0x16, 0x03, 0x03, 0x00, 0x82, 0x01, 0x00, 0x00, 0x7E,
+                          0x03, 0x03, 0x57, 0x04, 0x9F, 0x5D, 0xC9, 0x5C, 0x87,
+                          0xAE, 0xF2, 0xA7, 0x4A, 0xFC, 0x59, 0x78, 0x23, 0x31,
+                          0x61, 0x2D, 0x29, 0x92, 0xB6, 0x70, 0xA5, 0xA1, 0xFC,
+                          0x0E, 0x79, 0xFE, 0xC3, 0x97, 0x37, 0xC0, 0x00, 0x00,
+                          0x44, 0x00, 0x04, 0x00, 0x05, 0x00, 0x0A, 0x00, 0x0D,
+                          0x00, 0x10, 0x00, 0x13, 0x00, 0x16, 0x00, 0x2F, 0x00,
+                          0x30, 0x00, 0x31, 0x00, 0x32, 0x00, 0x33, 0x00, 0x35,
+                          0x00, 0x36, 0x00, 0x37, 0x00, 0x38, 0x00, 0x39, 0x00,
+                          0x3C, 0x00, 0x3D, 0x00, 0x3E, 0x00, 0x3F, 0x00, 0x40,
+                          0x00, 0x41, 0x00, 0x44, 0x00, 0x45, 0x00, 0x66, 0x00,
+                          0x67, 0x00, 0x68, 0x00, 0x69, 0x00, 0x6A, 0x00, 0x6B,
+                          0x00, 0x84, 0x00, 0x87, 0x00, 0xFF, 0x01, 0x00, 0x00,
+                          0x13, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x0D, 0x00, 0x00,
+                          0x0A, 0x67, 0x6F, 0x6F, 0x67, 0x6C, 0x65, 0x2E, 0x63,
+                          0x6F, 0x6D, };
+    uint8_t payload[] = "GET / HTTP/1.0\r\n\r\n";
+    uint64_t allocs = 0;
+
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(p);
+    Flow *f = UTHBuildFlow(AF_INET, "192.168.1.5", "10.0.0.1", 41424, 80);
+    FAIL_IF_NULL(f);
+    f->proto = IPPROTO_TCP;
+    p->flow = f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+
+    MemBuffer *buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
+    FAIL_IF_NULL(buffer);
+    OutputJsonBenchHeader hb = { .p = p, .buffer = &buffer };
+
+    FAIL_IF_NOT(OutputJsonBenchRun("header jansson", OutputJsonBenchJansson,
+                &hb, NULL));
+    FAIL_IF_NOT(OutputJsonBenchRun("header builder", OutputJsonBenchBuilder,
+                &hb, &allocs));
+    /* the builder only writes into the thread buffer */
+    FAIL_IF(allocs != 0);
+    MemBufferFree(buffer);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF(ConfYamlLoadString(eve_conf, strlen(eve_conf)) != 0);
+    OutputInitResult eve = OutputJsonInitCtx(ConfGetNode("eve-log"));
+    FAIL_IF_NOT(eve.ok);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    Signature *s = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(msg:\"eve bench\"; content:\"GET\"; sid:1; rev:1;)");
+    FAIL_IF_NULL(s);
+    p->alerts.cnt = 1;
+    p->alerts.alerts[0].s = s;
+    p->alerts.alerts[0].action = ACTION_ALERT;
+    FAIL_IF_NOT(OutputJsonBenchModule(eve.ctx, "eve-log.alert", p, NULL, NULL));
+    p->alerts.cnt = 0;
+    SigFree(s);
+    DetectEngineCtxFree(de_ctx);
+
+    FAIL_IF_NOT(OutputJsonBenchModule(eve.ctx, "eve-log.flow", p, NULL, NULL));
+    FAIL_IF_NOT(OutputJsonBenchModule(eve.ctx, "eve-log.netflow", p, NULL, NULL));
+
+    StreamTcpInitConfig(TRUE);
+    FAIL_IF_NOT(OutputJsonBenchTx(eve.ctx, "eve-log.dns", ALPROTO_DNS,
+                IPPROTO_UDP, 53, dns_buf, sizeof(dns_buf)));
+    FAIL_IF_NOT(OutputJsonBenchTx(eve.ctx, "eve-log.http", ALPROTO_HTTP,
+                IPPROTO_TCP, 80, http_buf, sizeof(http_buf) - 1));
+    FAIL_IF_NOT(OutputJsonBenchTx(eve.ctx, "eve-log.tls", ALPROTO_TLS,
+                IPPROTO_TCP, 443, tls_buf, sizeof(tls_buf)));
+    StreamTcpFreeConfig(TRUE);
+
+    eve.ctx->DeInit(eve.ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    UTHFreeFlow(f);
+    UTHFreePacket(p);
+    PASS;
+}
+#endif /* PROFILING */
+
+#endif /* UNITTESTS */
+
+void OutputJsonRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("OutputJsonTest01", OutputJsonTest01);
+#ifdef PROFILING
+    UtRegisterTest("OutputJsonBench01", OutputJsonBench01);
+#endif
+#endif
+}
+
 #endif
@@ -26,12 +26,14 @@
 
 #include "suricata-common.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-logopenfile.h"
 #include "output.h"
 
 #include "app-layer-htp-xff.h"
 
 void OutputJsonRegister(void);
+void OutputJsonRegisterTests(void);
 
 #ifdef HAVE_LIBJANSSON
 
@@ -48,17 +50,38 @@ typedef struct OutputJSONMemBufferWrapper_ {
     size_t expand_by;   /**< expand by this size */
 } OutputJSONMemBufferWrapper;
 
+/* addresses, ports and protocol name of a record */
+typedef struct JsonAddrInfo_ {
+    char src_ip[46];
+    char dst_ip[46];
+    Port sp;
+    Port dp;
+    char proto[16];
+} JsonAddrInfo;
+
 int OutputJSONMemBufferCallback(const char *str, size_t size, void *data);
 
 void JsonAddMetadata(const Packet *p, const Flow *f, json_t *js);
 void CreateJSONFlowId(json_t *js, const Flow *f);
-void JsonTcpFlags(uint8_t flags, json_t *js);
-void JsonFiveTuple(const Packet *, enum OutputJsonLogDirection, json_t *);
+void JsonTcpFlags(uint8_t flags, JsonBuilder *jb);
+void JsonAddrInfoInit(const Packet *p, enum OutputJsonLogDirection dir,
+        JsonAddrInfo *addr);
+void JsonFiveTuple(const Packet *p, const JsonAddrInfo *addr, JsonBuilder *jb);
 json_t *CreateJSONHeader(const Packet *p,
         enum OutputJsonLogDirection dir, const char *event_type);
 json_t *CreateJSONHeaderWithTxId(const Packet *p,
         enum OutputJsonLogDirection dir, const char *event_type, uint64_t tx_id);
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer);
+
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx,
+        MemBuffer **buffer);
+void OutputJsonBuilderHeader(JsonBuilder *jb, const Packet *p,
+        enum OutputJsonLogDirection dir, const char *event_type,
+        const JsonAddrInfo *addr);
+void OutputJsonBuilderFlowId(JsonBuilder *jb, const Flow *f);
+void OutputJsonBuilderMetadata(JsonBuilder *jb, const Packet *p, const Flow *f);
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx,
+        MemBuffer **buffer);
 OutputInitResult OutputJsonInitCtx(ConfNode *);
 
 /*
@@ -40,6 +40,13 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+
+    /** txs looked at */
+    uint16_t counter_txs_visited;
+    /** txs a full scan would have looked at, but weren't */
+    uint16_t counter_txs_skipped;
+    /** flows that weren't looked at as nothing changed */
+    uint16_t counter_flows_skipped;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -127,6 +134,147 @@ int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
     return 0;
 }
 
+/** \internal
+ *  \brief run the loggers that haven't logged the tx yet
+ *
+ *  \retval logged the updated tx_logged bits of the tx
+ */
+static LoggerId OutputTxLogTx(ThreadVars *tv, Packet *p, Flow *f,
+        void *alstate, void *tx, const uint64_t tx_id,
+        const LoggerId logger_expectation,
+        const uint8_t ts_disrupt_flags, const uint8_t tc_disrupt_flags,
+        const OutputLoggerThreadData *op_thread_data)
+{
+    const AppProto alproto = f->alproto;
+    LoggerId tx_logged = AppLayerParserGetTxLogged(f, alstate, tx);
+    const LoggerId tx_logged_old = tx_logged;
+    SCLogDebug("logger: expect %08x, have %08x", logger_expectation, tx_logged);
+    if (tx_logged == logger_expectation) {
+        /* tx already fully logged */
+        return tx_logged;
+    }
+
+    int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
+            tx, ts_disrupt_flags);
+    int tx_progress_tc = AppLayerParserGetStateProgress(p->proto, alproto,
+            tx, tc_disrupt_flags);
+    SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
+            tx_progress_ts, tx_progress_tc);
+
+    const OutputTxLogger *logger = list;
+    const OutputLoggerThreadStore *store = op_thread_data->store;
+#ifdef DEBUG_VALIDATION
+    BUG_ON(logger == NULL && store != NULL);
+    BUG_ON(logger != NULL && store == NULL);
+    BUG_ON(logger == NULL && store == NULL);
+#endif
+    while (logger && store) {
+        BUG_ON(logger->LogFunc == NULL);
+
+        SCLogDebug("logger %p, LogCondition %p, ts_log_progress %d "
+                "tc_log_progress %d", logger, logger->LogCondition,
+                logger->ts_log_progress, logger->tc_log_progress);
+        if (logger->alproto == alproto &&
+            (tx_logged & (1<<logger->logger_id)) == 0)
+        {
+            SCLogDebug("alproto match, logging tx_id %"PRIu64, tx_id);
+
+            if (!(AppLayerParserStateIssetFlag(f->alparser,
+                                               APP_LAYER_PARSER_EOF))) {
+                if (logger->LogCondition) {
+                    int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
+                    if (r == FALSE) {
+                        SCLogDebug("conditions not met, not logging");
+                        goto next_logger;
+                    }
+                } else {
+                    if (tx_progress_tc < logger->tc_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        goto next_logger;
+                    }
+
+                    if (tx_progress_ts < logger->ts_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        goto next_logger;
+                    }
+                }
+            }
+
+            SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id,
+                logger->logger_id);
+            PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
+            logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
+            PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
+
+            tx_logged |= (1<<logger->logger_id);
+        }
+
+next_logger:
+        logger = logger->next;
+        store = store->next;
+#ifdef DEBUG_VALIDATION
+        BUG_ON(logger == NULL && store != NULL);
+        BUG_ON(logger != NULL && store == NULL);
+#endif
+    }
+
+    if (tx_logged != tx_logged_old) {
+        SCLogDebug("logger: storing %08x (was %08x)",
+            tx_logged, tx_logged_old);
+        AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
+                tx_logged);
+    }
+    return tx_logged;
+}
+
+/** \internal
+ *  \brief log only the txs the parser marked log ready
+ *
+ *  Afterwards the log id is moved past the txs that are fully logged.
+ *
+ *  \retval visited number of txs looked at
+ */
+static uint64_t OutputTxLogReady(ThreadVars *tv, Packet *p, Flow *f,
+        void *alstate, const uint64_t *tx_ids, const int tx_ids_cnt,
+        const uint64_t total_txs, const LoggerId logger_expectation,
+        const uint8_t ts_disrupt_flags, const uint8_t tc_disrupt_flags,
+        const OutputLoggerThreadData *op_thread_data)
+{
+    const uint8_t ipproto = f->proto;
+    const AppProto alproto = f->alproto;
+    uint64_t log_id = AppLayerParserGetTransactionLogId(f->alparser);
+    uint64_t visited = 0;
+    int i;
+
+    for (i = 0; i < tx_ids_cnt; i++) {
+        const uint64_t tx_id = tx_ids[i];
+        if (tx_id < log_id || tx_id >= total_txs)
+            continue;
+        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, tx_id);
+        if (tx == NULL)
+            continue;
+
+        (void)OutputTxLogTx(tv, p, f, alstate, tx, tx_id, logger_expectation,
+                ts_disrupt_flags, tc_disrupt_flags, op_thread_data);
+        visited++;
+    }
+
+    /* the marked txs may have completed the ones at the log id */
+    const uint64_t old_log_id = log_id;
+    while (log_id < total_txs) {
+        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, log_id);
+        if (tx == NULL ||
+                AppLayerParserGetTxLogged(f, alstate, tx) != logger_expectation)
+            break;
+        log_id++;
+    }
+    if (log_id != old_log_id) {
+        SCLogDebug("updating log tx_id %"PRIu64, log_id);
+        AppLayerParserSetTransactionLogId(f->alparser, log_id);
+    }
+    return visited;
+}
+
 static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
 {
     BUG_ON(thread_data == NULL);
@@ -161,7 +309,51 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
     const uint8_t tc_disrupt_flags = FlowGetDisruptionFlags(f, STREAM_TOCLIENT);
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
     uint64_t tx_id = AppLayerParserGetTransactionLogId(f->alparser);
+    const uint64_t open_txs = total_txs > tx_id ? total_txs - tx_id : 0;
+
+    /* nothing happened to the txs since our last run: the parser
+     * wasn't called and the stream wasn't cut short. The end of the
+     * stream makes the loggers ignore the progress, so it always gets
+     * a full run. */
+    const bool new_data = AppLayerParserGetDataVersion(f->alparser) !=
+        AppLayerParserGetLogDataVersion(f->alparser);
+    const bool disrupted = AppLayerParserLogDisruptionChanged(f->alparser,
+            ts_disrupt_flags, tc_disrupt_flags);
+    const bool eof = (p->flags & PKT_PSEUDO_STREAM_END) ||
+        AppLayerParserStateIssetFlag(f->alparser, APP_LAYER_PARSER_EOF);
+    if (!new_data && !disrupted && !eof) {
+        SCLogDebug("no new data since last run, skipping %"PRIu64" txs",
+                open_txs);
+        StatsIncr(tv, op_thread_data->counter_flows_skipped);
+        StatsAddUI64(tv, op_thread_data->counter_txs_skipped, open_txs);
+        goto end;
+    }
+    /* if only new data came in, the ready marks list all txs that
+     * changed */
+    const bool marks_complete = !disrupted && !eof;
+    AppLayerParserSetLogDataVersion(f->alparser, ts_disrupt_flags, tc_disrupt_flags);
+
+    const uint64_t *tx_ids = NULL;
+    const int tx_ids_cnt = AppLayerParserGetTxLogReady(f->alparser, &tx_ids);
+    if (marks_complete && tx_ids_cnt >= 0 &&
+            AppLayerParserProtocolHasLogReady(ipproto, alproto))
+    {
+        uint64_t visited = OutputTxLogReady(tv, p, f, alstate, tx_ids,
+                tx_ids_cnt, total_txs, logger_expectation, ts_disrupt_flags,
+                tc_disrupt_flags, op_thread_data);
+        AppLayerParserResetTxLogReady(f->alparser);
+
+        SCLogDebug("visited %"PRIu64" of %"PRIu64" txs", visited, open_txs);
+        StatsAddUI64(tv, op_thread_data->counter_txs_visited, visited);
+        if (open_txs > visited)
+            StatsAddUI64(tv, op_thread_data->counter_txs_skipped,
+                    open_txs - visited);
+        goto end;
+    }
+    AppLayerParserResetTxLogReady(f->alparser);
+
     uint64_t max_id = tx_id;
+    uint64_t visited = 0;
     int logged = 0;
     int gap = 0;
 
@@ -175,85 +367,11 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
             break;
         void * const tx = ires.tx_ptr;
         tx_id = ires.tx_id;
+        visited++;
 
-        LoggerId tx_logged = AppLayerParserGetTxLogged(f, alstate, tx);
-        const LoggerId tx_logged_old = tx_logged;
-        SCLogDebug("logger: expect %08x, have %08x", logger_expectation, tx_logged);
-        if (tx_logged == logger_expectation) {
-            /* tx already fully logged */
-            goto next_tx;
-        }
-
-        int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, ts_disrupt_flags);
-        int tx_progress_tc = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, tc_disrupt_flags);
-        SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
-                tx_progress_ts, tx_progress_tc);
-
-        const OutputTxLogger *logger = list;
-        const OutputLoggerThreadStore *store = op_thread_data->store;
-#ifdef DEBUG_VALIDATION
-        BUG_ON(logger == NULL && store != NULL);
-        BUG_ON(logger != NULL && store == NULL);
-        BUG_ON(logger == NULL && store == NULL);
-#endif
-        while (logger && store) {
-            BUG_ON(logger->LogFunc == NULL);
-
-            SCLogDebug("logger %p, LogCondition %p, ts_log_progress %d "
-                    "tc_log_progress %d", logger, logger->LogCondition,
-                    logger->ts_log_progress, logger->tc_log_progress);
-            if (logger->alproto == alproto &&
-                (tx_logged & (1<<logger->logger_id)) == 0)
-            {
-                SCLogDebug("alproto match, logging tx_id %"PRIu64, tx_id);
-
-                if (!(AppLayerParserStateIssetFlag(f->alparser,
-                                                   APP_LAYER_PARSER_EOF))) {
-                    if (logger->LogCondition) {
-                        int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
-                        if (r == FALSE) {
-                            SCLogDebug("conditions not met, not logging");
-                            goto next_logger;
-                        }
-                    } else {
-                        if (tx_progress_tc < logger->tc_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next_logger;
-                        }
-
-                        if (tx_progress_ts < logger->ts_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next_logger;
-                        }
-                    }
-                }
-
-                SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id,
-                    logger->logger_id);
-                PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
-                logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
-                PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
-
-                tx_logged |= (1<<logger->logger_id);
-            }
-
-next_logger:
-            logger = logger->next;
-            store = store->next;
-#ifdef DEBUG_VALIDATION
-            BUG_ON(logger == NULL && store != NULL);
-            BUG_ON(logger != NULL && store == NULL);
-#endif
-        }
-
-        if (tx_logged != tx_logged_old) {
-            SCLogDebug("logger: storing %08x (was %08x)",
-                tx_logged, tx_logged_old);
-            AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
-                    tx_logged);
-        }
+        const LoggerId tx_logged = OutputTxLogTx(tv, p, f, alstate, tx, tx_id,
+                logger_expectation, ts_disrupt_flags, tc_disrupt_flags,
+                op_thread_data);
 
         /* If all loggers logged set a flag and update the last tx_id
          * that was logged.
@@ -267,10 +385,10 @@ next_logger:
         } else {
             gap = 1;
         }
-next_tx:
         if (!ires.has_next)
             break;
     }
+    StatsAddUI64(tv, op_thread_data->counter_txs_visited, visited);
 
     /* Update the the last ID that has been logged with all
      * transactions before it. */
@@ -293,6 +411,10 @@ static TmEcode OutputTxLogThreadInit(ThreadVars *tv, const void *initdata, void
         return TM_ECODE_FAILED;
     memset(td, 0x00, sizeof(*td));
 
+    td->counter_txs_visited = StatsRegisterCounter("tx_logger.txs_visited", tv);
+    td->counter_txs_skipped = StatsRegisterCounter("tx_logger.txs_skipped", tv);
+    td->counter_flows_skipped = StatsRegisterCounter("tx_logger.flows_skipped", tv);
+
     *data = (void *)td;
     SCLogDebug("OutputTxLogThreadInit happy (*data %p)", *data);
 
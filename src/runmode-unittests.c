@@ -33,6 +33,8 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-mpm-bench.h"
+#include "detect-pcre-prefilter.h"
 #include "detect-engine-sigorder.h"
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
@@ -93,6 +95,7 @@
 #include "util-profiling.h"
 #include "util-magic.h"
 #include "util-memcmp.h"
+#include "util-base64.h"
 #include "util-misc.h"
 #include "util-signal.h"
 
@@ -107,6 +110,15 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-log-async.h"
+#include "util-log-redis.h"
+#include "util-file-offload.h"
+#include "util-log-compress.h"
+#include "log-pcap.h"
+#include "util-json-builder.h"
+#include "util-msgpack.h"
+#include "output-json.h"
+#include "output-json-alert.h"
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
@@ -155,6 +167,9 @@ static void RegisterUnittests(void)
     PoolRegisterTests();
     ByteRegisterTests();
     MpmRegisterTests();
+    DetectMpmRegisterTests();
+    MpmBenchRegisterTests();
+    DetectPcrePrefilterRegisterTests();
     FlowBitRegisterTests();
     HostBitRegisterTests();
     IPPairBitRegisterTests();
@@ -201,6 +216,7 @@ static void RegisterUnittests(void)
 #endif
     DeStateRegisterTests();
     MemcmpRegisterTests();
+    Base64RegisterTests();
     DetectEngineHttpClientBodyRegisterTests();
     DetectEngineHttpServerBodyRegisterTests();
     DetectEngineHttpRawHeaderRegisterTests();
@@ -226,6 +242,17 @@ static void RegisterUnittests(void)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    LogAsyncRegisterTests();
+    SCLogRedisRegisterTests();
+    FileOffloadRegisterTests();
+    LogCompressRegisterTests();
+    PcapLogRegisterTests();
+#ifdef HAVE_LIBJANSSON
+    JsonBuilderRegisterTests();
+    MsgpackRegisterTests();
+    OutputJsonRegisterTests();
+    JsonAlertLogRegisterTests();
+#endif
 #ifdef OS_WIN32
     Win32SyscallRegisterTests();
 #endif
@@ -276,6 +303,7 @@ void RunUnittests(int list_unittests, const char *regex_arg)
     SCProtoNameInit();
 
     TagInitCtx();
+    PrefilterPktStreamInit();
     SCReferenceConfInit();
     SCClassConfInit();
 
@@ -68,6 +68,7 @@ const char *thread_name_unix_socket = "US";
 const char *thread_name_detect_loader = "DL";
 const char *thread_name_counter_stats = "CS";
 const char *thread_name_counter_wakeup = "CW";
+const char *thread_name_mpm_prepare = "MP";
 
 /**
  * \brief Holds description for a runmode.
@@ -504,6 +505,7 @@ bool IsRunModeOffline(int run_mode_to_check)
         case RUNMODE_PCAP_FILE:
         case RUNMODE_ERF_FILE:
         case RUNMODE_ENGINE_ANALYSIS:
+        case RUNMODE_MPM_BENCH:
         case RUNMODE_UNIX_SOCKET:
             return true;
             break;
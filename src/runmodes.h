@@ -52,6 +52,7 @@ enum RunModes {
     RUNMODE_CONF_TEST,
     RUNMODE_LIST_UNITTEST,
     RUNMODE_ENGINE_ANALYSIS,
+    RUNMODE_MPM_BENCH,
 #ifdef OS_WIN32
     RUNMODE_INSTALL_SERVICE,
     RUNMODE_REMOVE_SERVICE,
@@ -71,6 +72,7 @@ extern const char *thread_name_unix_socket;
 extern const char *thread_name_detect_loader;
 extern const char *thread_name_counter_stats;
 extern const char *thread_name_counter_wakeup;
+extern const char *thread_name_mpm_prepare;
 
 char *RunmodeGetActive(void);
 const char *RunModeGetMainMode(void);
@@ -59,10 +59,12 @@
 #include "detect-parse.h"
 #include "detect-fast-pattern.h"
 #include "detect-engine-tag.h"
+#include "detect-engine-payload.h"
 #include "detect-engine-threshold.h"
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-mpm-bench.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -170,6 +172,7 @@
 #include "util-proto-name.h"
 #include "util-mpm-hs.h"
 #include "util-storage.h"
+#include "util-file-offload.h"
 #include "host-storage.h"
 
 #include "util-lua.h"
@@ -338,6 +341,9 @@ void GlobalsInitPreConfig(void)
         exit(EXIT_FAILURE);
     }
 
+    /* pick the SIMD kernels for this cpu */
+    UtilCpuDispatchSetup();
+
     TimeInit();
     SupportFastPatternForSigMatchTypes();
     SCThresholdConfGlobalInit();
@@ -615,6 +621,9 @@ static void PrintUsage(const char *progname)
     printf("\t--engine-analysis                    : print reports on analysis of different sections in the engine and exit.\n"
            "\t                                       Please have a look at the conf parameter engine-analysis on what reports\n"
            "\t                                       can be printed\n");
+    printf("\t--mpm-bench                          : benchmark the mpm and spm algorithms against the patterns of the\n"
+           "\t                                       loaded rules, scanning the payloads of the pcap, file or\n"
+           "\t                                       directory passed with -r, and exit\n");
     printf("\t--pidfile <file>                     : write pid to this file\n");
     printf("\t--init-errors-fatal                  : enable fatal failure on signature init error\n");
     printf("\t--disable-detection                  : disable detection engine\n");
@@ -778,6 +787,11 @@ static void PrintBuildInfo(void)
         strlcat(features, "none", sizeof(features));
     }
     printf("SIMD support: %s\n", features);
+#ifdef SC_CPU_DISPATCH
+    printf("SIMD runtime dispatch: yes\n");
+#else
+    printf("SIMD runtime dispatch: no\n");
+#endif
 
     /* atomics stuff */
     memset(features, 0x00, sizeof(features));
@@ -1455,6 +1469,7 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
     int conf_test_force_success = 0;
 #endif
     int engine_analysis = 0;
+    int mpm_bench = 0;
     int set_log_directory = 0;
     int ret = TM_ECODE_OK;
 
@@ -1530,6 +1545,7 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"list-keywords", optional_argument, &list_keywords, 1},
         {"runmode", required_argument, NULL, 0},
         {"engine-analysis", 0, &engine_analysis, 1},
+        {"mpm-bench", 0, &mpm_bench, 1},
 #ifdef OS_WIN32
 		{"service-install", 0, 0, 0},
 		{"service-remove", 0, 0, 0},
@@ -2130,6 +2146,9 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         suri->run_mode = RUNMODE_CONF_TEST;
     if (engine_analysis)
         suri->run_mode = RUNMODE_ENGINE_ANALYSIS;
+    /* -r is used for the payloads, so this overrides the pcap runmode */
+    if (mpm_bench)
+        suri->run_mode = RUNMODE_MPM_BENCH;
 
     suri->offline = IsRunModeOffline(suri->run_mode);
 
@@ -2272,6 +2291,7 @@ void PreRunInit(const int runmode)
     StreamTcpInitConfig(STREAM_VERBOSE);
     AppLayerParserPostStreamSetup();
     AppLayerRegisterGlobalCounters();
+    DetectEngineRegisterGlobalCounters();
 }
 
 /* tasks we need to run before packets start flowing,
@@ -2282,6 +2302,8 @@ void PreRunPostPrivsDropInit(const int runmode)
         return;
 
     RunModeInitializeOutputs();
+    /* after the outputs, they set the file hashing options */
+    FileOffloadInit();
     StatsSetupPostConfig();
 }
 
@@ -2316,6 +2338,9 @@ void PostRunDeinit(const int runmode, struct timeval *start_time)
 
     PacketPoolDestroy();
 
+    /* run the queued file jobs while the outputs are still around */
+    FileOffloadShutdown();
+
     /* mgt and ppt threads killed, we can run non thread-safe
      * shutdown functions */
     StatsReleaseResources();
@@ -2590,6 +2615,11 @@ static void PostConfLoadedDetectSetup(SCInstance *suri)
             if (suri->run_mode == RUNMODE_ENGINE_ANALYSIS) {
                 exit(EXIT_SUCCESS);
             }
+            if (suri->run_mode == RUNMODE_MPM_BENCH) {
+                const char *path = NULL;
+                (void)ConfGet("pcap-file.file", &path);
+                exit(MpmBenchRun(de_ctx, path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
         }
 
         gettimeofday(&de_ctx->last_reload, NULL);
@@ -2735,6 +2765,7 @@ static int PostConfLoadedSetup(SCInstance *suri)
     SCProtoNameInit();
 
     TagInitCtx();
+    PrefilterPktStreamInit();
     PacketAlertTagInit();
     ThresholdInit();
     HostBitInitCtx();
@@ -5153,6 +5153,227 @@ end:
     return result;
 }
 
+/** \test build the engine with multiple mpm prepare threads */
+static int SigTestBuildThreads01(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t payload[] = "GET /one/two/three HTTP/1.0";
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    Packet *p1 = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "1.2.3.4", "5.6.7.8", 1024, 80);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "1.2.3.4", "5.6.7.8", 1024, 8080);
+    FAIL_IF_NULL(p2);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->build_threads = 4;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"/one/\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 8080 "
+            "(content:\"/two/\"; sid:2;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 8080 "
+            "(content:\"three\"; content:\"/one\"; sid:3;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"four\"; sid:4;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(content:\"/one/\"; sid:5;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p1);
+    FAIL_IF_NOT(PacketAlertCheck(p1, 1));
+    FAIL_IF(PacketAlertCheck(p1, 2));
+    FAIL_IF(PacketAlertCheck(p1, 3));
+    FAIL_IF(PacketAlertCheck(p1, 4));
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p2);
+    FAIL_IF(PacketAlertCheck(p2, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p2, 2));
+    FAIL_IF_NOT(PacketAlertCheck(p2, 3));
+    FAIL_IF(PacketAlertCheck(p2, 5));
+
+    DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+
+/** \test a tx rule that failed on flowbits:isset has to be evaluated
+ *        again when a later packet without new app-layer data sets the
+ *        flowbit */
+static int SigTestTxFlowbits01(void)
+{
+    uint8_t http_buf[] = "GET http://example.org/ HTTP/1.1\r\n"
+                         "User-Agent: ";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    uint8_t set_buf[] = "setbit";
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    TcpSession ssn;
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p1 = UTHBuildPacket(http_buf, http_len, IPPROTO_TCP);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacket(set_buf, sizeof(set_buf) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p2);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.flags |= FLOW_IPV4;
+    f.proto = IPPROTO_TCP;
+    f.alproto = ALPROTO_HTTP;
+
+    p1->flow = &f;
+    p1->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p1->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p2->flow = &f;
+    p2->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p2->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(dsize:6; flowbits:set,setbit; flowbits:noalert; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(flowbits:isset,setbit; content:\"example.org\"; http_host; sid:2;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    /* request line is done, the headers are not: the http_host prefilter
+     * will run again for this tx */
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
+                                STREAM_TOSERVER, http_buf, http_len);
+    FAIL_IF(r != 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    FAIL_IF(PacketAlertCheck(p1, 2));
+
+    /* no app-layer data, but the flowbit is set now */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 2));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+
+/** \test a tx rule with only static packet matches, like flow, doesn't
+ *        stop txs without new app-layer data from being skipped */
+static int SigTestTxSkip01(void)
+{
+    uint8_t http_buf[] = "GET /index.html HTTP/1.1\r\n"
+                         "Host: example.org\r\n";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    uint8_t ack_buf[] = "xyz";
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    TcpSession ssn;
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p1 = UTHBuildPacket(http_buf, http_len, IPPROTO_TCP);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacket(ack_buf, sizeof(ack_buf) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p2);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.flags |= FLOW_IPV4;
+    f.proto = IPPROTO_TCP;
+    f.alproto = ALPROTO_HTTP;
+
+    p1->flow = &f;
+    p1->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p1->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p2->flow = &f;
+    p2->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p2->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(flow:established,to_server; content:\"/admin\"; http_uri; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF_NULL(s->init_data->smlists[DETECT_SM_LIST_MATCH]);
+
+    SigGroupBuild(de_ctx);
+    strlcpy(th_v.name, "detect_test", sizeof(th_v.name));
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    StatsSetupPrivate(&th_v);
+
+    /* the headers are not done yet, so the tx stays open */
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
+                                STREAM_TOSERVER, http_buf, http_len);
+    FAIL_IF(r != 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    FAIL_IF(PacketAlertCheck(p1, 1));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&th_v, det_ctx->counter_tx_inspected) == 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&th_v, det_ctx->counter_tx_skipped) == 0);
+
+    /* no app-layer data: the tx is skipped */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF(PacketAlertCheck(p2, 1));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&th_v, det_ctx->counter_tx_inspected) == 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&th_v, det_ctx->counter_tx_skipped) == 1);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+
 static const char *dummy_conf_string2 =
     "%YAML 1.1\n"
     "---\n"
@@ -5448,6 +5669,9 @@ void SigRegisterTests(void)
 
     UtRegisterTest("SigTestPorts01", SigTestPorts01);
     UtRegisterTest("SigTestBug01", SigTestBug01);
+    UtRegisterTest("SigTestBuildThreads01", SigTestBuildThreads01);
+    UtRegisterTest("SigTestTxFlowbits01", SigTestTxFlowbits01);
+    UtRegisterTest("SigTestTxSkip01", SigTestTxSkip01);
 
     DetectEngineContentInspectionRegisterTests();
 }
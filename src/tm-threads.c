@@ -1836,6 +1836,37 @@ static void TmThreadFree(ThreadVars *tv)
     SCFree(tv);
 }
 
+/**
+ * \brief Kill and free a thread that is not part of the runmode
+ *
+ * For short lived helper threads. A spawned thread is removed from
+ * tv_root, killed and joined like at shutdown. A thread that failed
+ * to spawn is just freed.
+ *
+ * \param tv the thread to free
+ */
+void TmThreadKillAndFree(ThreadVars *tv)
+{
+    ThreadVars *t = NULL;
+    unsigned int sleep_usec = 100;
+
+    SCMutexLock(&tv_root_lock);
+    for (t = tv_root[tv->type]; t != NULL; t = t->next) {
+        if (t == tv)
+            break;
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    if (t != NULL) {
+        TmThreadRemove(tv, tv->type);
+        while (TmThreadKillThread(tv) == 0) {
+            SleepUsec(sleep_usec);
+            sleep_usec = MIN(sleep_usec * 2, 999999);
+        }
+    }
+    TmThreadFree(tv);
+}
+
 void TmThreadSetGroupName(ThreadVars *tv, const char *name)
 {
     char *thread_group_name = NULL;
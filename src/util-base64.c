@@ -23,6 +23,8 @@
  */
 
 #include "util-base64.h"
+#include "util-cpu.h"
+#include "util-unittest.h"
 
 /* Constants */
 #define BASE64_TABLE_MAX  122
@@ -77,6 +79,201 @@ static inline void DecodeBase64Block(uint8_t ascii[ASCII_BLOCK], uint8_t b64[B64
     ascii[2] = (uint8_t) (b64[2] << 6) | (b64[3]);
 }
 
+/**
+ * \brief Decodes whole runs of valid base64 characters
+ *
+ * Decodes blocks of characters until a block holds a character that is
+ * not in the base64 alphabet, padding included. What is left is up to
+ * the scalar decoder.
+ *
+ * \param dest the destination buffer, 3 bytes are written per 4 chars
+ * \param src the source string
+ * \param len the length of the source string
+ *
+ * \return number of source characters decoded, a multiple of 4
+ */
+typedef uint32_t (*Base64DecodeBlocksFunc)(uint8_t *dest, const uint8_t *src,
+        uint32_t len);
+
+/** decoder for runs of valid characters, NULL if none is available */
+static Base64DecodeBlocksFunc base64_decode_blocks = NULL;
+/** min number of characters the block decoder needs */
+static uint32_t base64_decode_blocks_min = 0;
+
+#ifdef SC_CPU_DISPATCH
+#include <immintrin.h>
+
+/* The SSSE3 and AVX2 decoders classify the chars by their nibbles:
+ * lut_lo[lo] & lut_hi[hi] is non zero only for valid chars. Per high
+ * nibble: 0x2 allows '+' and '/', 0x3 '0'-'9', 0x4 and 0x6 everything but
+ * 0x40 and 0x60, 0x5 and 0x7 up to 0x5a and 0x7a. */
+#define BASE64_LUT_LO \
+    0x0a, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, \
+    0x0e, 0x0e, 0x0c, 0x05, 0x04, 0x04, 0x04, 0x05
+#define BASE64_LUT_HI \
+    0x00, 0x00, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+/* value to add to the char per high nibble. Index 1 is used for '/',
+ * which shares its high nibble with '+'. */
+#define BASE64_LUT_ROLL \
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+/* 3 bytes out of each 32 bit lane after the merge */
+#define BASE64_PACK \
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+SC_CPU_TARGET("ssse3")
+static uint32_t Base64DecodeBlocksSSSE3(uint8_t *dest, const uint8_t *src,
+        uint32_t len)
+{
+    const __m128i lut_lo = _mm_setr_epi8(BASE64_LUT_LO);
+    const __m128i lut_hi = _mm_setr_epi8(BASE64_LUT_HI);
+    const __m128i lut_roll = _mm_setr_epi8(BASE64_LUT_ROLL);
+    const __m128i pack = _mm_setr_epi8(BASE64_PACK);
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    const __m128i slash = _mm_set1_epi8('/');
+    uint32_t i = 0;
+
+    for ( ; i + 16 <= len; i += 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), low4);
+        const __m128i lo = _mm_and_si128(in, low4);
+        const __m128i valid = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+                _mm_shuffle_epi8(lut_hi, hi));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(valid, _mm_setzero_si128())) != 0)
+            break;
+
+        const __m128i roll = _mm_shuffle_epi8(lut_roll,
+                _mm_add_epi8(_mm_cmpeq_epi8(in, slash), hi));
+        const __m128i values = _mm_add_epi8(in, roll);
+        /* merge 4 6-bit values into 24 bits per 32 bit lane */
+        const __m128i merged = _mm_madd_epi16(
+                _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)),
+                _mm_set1_epi32(0x00011000));
+        const __m128i out = _mm_shuffle_epi8(merged, pack);
+
+        uint8_t *d = dest + i / 4 * 3;
+        _mm_storel_epi64((__m128i *)d, out);
+        const uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+        memcpy(d + 8, &last, 4);
+    }
+    return i;
+}
+
+SC_CPU_TARGET("avx2")
+static uint32_t Base64DecodeBlocksAVX2(uint8_t *dest, const uint8_t *src,
+        uint32_t len)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(BASE64_LUT_LO, BASE64_LUT_LO);
+    const __m256i lut_hi = _mm256_setr_epi8(BASE64_LUT_HI, BASE64_LUT_HI);
+    const __m256i lut_roll = _mm256_setr_epi8(BASE64_LUT_ROLL, BASE64_LUT_ROLL);
+    const __m256i pack = _mm256_setr_epi8(BASE64_PACK, BASE64_PACK);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i slash = _mm256_set1_epi8('/');
+    uint32_t i = 0;
+
+    for ( ; i + 32 <= len; i += 32) {
+        const __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), low4);
+        const __m256i lo = _mm256_and_si256(in, low4);
+        const __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+                _mm256_shuffle_epi8(lut_hi, hi));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(valid, _mm256_setzero_si256())) != 0)
+            break;
+
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll,
+                _mm256_add_epi8(_mm256_cmpeq_epi8(in, slash), hi));
+        const __m256i values = _mm256_add_epi8(in, roll);
+        const __m256i merged = _mm256_madd_epi16(
+                _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)),
+                _mm256_set1_epi32(0x00011000));
+        const __m256i out = _mm256_shuffle_epi8(merged, pack);
+
+        /* 12 bytes per 128 bit lane */
+        uint8_t *d = dest + i / 4 * 3;
+        const __m128i out0 = _mm256_castsi256_si128(out);
+        const __m128i out1 = _mm256_extracti128_si256(out, 1);
+        uint32_t last;
+        _mm_storel_epi64((__m128i *)d, out0);
+        last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out0, 8));
+        memcpy(d + 8, &last, 4);
+        _mm_storel_epi64((__m128i *)(d + 12), out1);
+        last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out1, 8));
+        memcpy(d + 20, &last, 4);
+    }
+    return i;
+}
+
+/* AVX512 VBMI: a full 128 entry table lookup translates the chars, so 64
+ * chars are done per iteration. Invalid chars map to 0x80. */
+static uint8_t base64_vbmi_lut[128] __attribute__((aligned(64)));
+static uint8_t base64_vbmi_pack[64] __attribute__((aligned(64)));
+
+SC_CPU_TARGET("avx512f,avx512bw,avx512vbmi")
+static uint32_t Base64DecodeBlocksAVX512(uint8_t *dest, const uint8_t *src,
+        uint32_t len)
+{
+    const __m512i lut0 = _mm512_load_si512((const void *)base64_vbmi_lut);
+    const __m512i lut1 = _mm512_load_si512((const void *)(base64_vbmi_lut + 64));
+    const __m512i pack = _mm512_load_si512((const void *)base64_vbmi_pack);
+    uint32_t i = 0;
+
+    for ( ; i + 64 <= len; i += 64) {
+        const __m512i in = _mm512_loadu_si512((const void *)(src + i));
+        const __m512i values = _mm512_permutex2var_epi8(lut0, in, lut1);
+        /* high bit set on invalid chars and on chars >= 0x80 */
+        if (_mm512_movepi8_mask(_mm512_or_si512(values, in)) != 0)
+            break;
+
+        const __m512i merged = _mm512_madd_epi16(
+                _mm512_maddubs_epi16(values, _mm512_set1_epi32(0x01400140)),
+                _mm512_set1_epi32(0x00011000));
+        const __m512i out = _mm512_permutexvar_epi8(pack, merged);
+        _mm512_mask_storeu_epi8(dest + i / 4 * 3, 0x0000ffffffffffffULL, out);
+    }
+    return i;
+}
+
+static void Base64SetupVbmiTables(void)
+{
+    for (int c = 0; c < 128; c++) {
+        int val = GetBase64Value((uint8_t)c);
+        base64_vbmi_lut[c] = val < 0 ? 0x80 : (uint8_t)val;
+    }
+    /* like BASE64_PACK, but across the whole register */
+    for (int j = 0; j < 64; j++) {
+        base64_vbmi_pack[j] = j < 48 ? (uint8_t)((j / 3) * 4 + 2 - (j % 3)) : 0;
+    }
+}
+#endif /* SC_CPU_DISPATCH */
+
+/**
+ * \brief Select the block decoder for the cpu we run on
+ */
+void Base64DispatchSetup(void)
+{
+#ifdef SC_CPU_DISPATCH
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX512BW|CPU_FEATURE_AVX512VBMI)) {
+        Base64SetupVbmiTables();
+        base64_decode_blocks = Base64DecodeBlocksAVX512;
+        base64_decode_blocks_min = 64;
+        UtilCpuDispatchRegister("base64", "avx512vbmi");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        base64_decode_blocks = Base64DecodeBlocksAVX2;
+        base64_decode_blocks_min = 32;
+        UtilCpuDispatchRegister("base64", "avx2");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_SSSE3)) {
+        base64_decode_blocks = Base64DecodeBlocksSSSE3;
+        base64_decode_blocks_min = 16;
+        UtilCpuDispatchRegister("base64", "ssse3");
+    } else {
+        base64_decode_blocks = NULL;
+        UtilCpuDispatchRegister("base64", "scalar");
+    }
+#else
+    UtilCpuDispatchRegister("base64", "scalar");
+#endif
+}
+
 /**
  * \brief Decodes a base64-encoded string buffer into an ascii-encoded byte buffer
  *
@@ -99,6 +296,20 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     /* Traverse through each alpha-numeric letter in the source array */
     for(i = 0; i < len && src[i] != 0; i++) {
 
+        /* Hand runs of valid characters to the block decoder */
+        if (bbidx == 0 && base64_decode_blocks != NULL &&
+                len - i >= base64_decode_blocks_min) {
+            const uint32_t n = base64_decode_blocks(dptr, src + i, len - i);
+            if (n > 0) {
+                const uint32_t out = n / B64_BLOCK * ASCII_BLOCK;
+                numDecoded += out;
+                dptr += out;
+                i += n;
+                if (i == len || src[i] == 0)
+                    break;
+            }
+        }
+
         /* Get decimal representation */
         val = GetBase64Value(src[i]);
         if (val < 0) {
@@ -149,3 +360,103 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
 
     return numDecoded;
 }
+
+#ifdef UNITTESTS
+
+static const char base64_test_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int Base64Test01(void)
+{
+    const uint8_t src[] = "U3VyaWNhdGE=";
+    uint8_t dest[16];
+
+    FAIL_IF(DecodeBase64(dest, src, sizeof(src) - 1, 1) != 8);
+    FAIL_IF(memcmp(dest, "Suricata", 8) != 0);
+    PASS;
+}
+
+/** \brief decode the buffer with the scalar decoder and each of the block
+ *         decoders the cpu supports and compare the results */
+static int Base64TestCompare(const uint8_t *src, uint32_t len)
+{
+    struct {
+        Base64DecodeBlocksFunc func;
+        uint32_t min;
+    } variants[4] = { { NULL, 0 } };
+    int nvariants = 0;
+    uint8_t dest[512];
+    uint8_t expect[512];
+
+#ifdef SC_CPU_DISPATCH
+    if (UtilCpuHasFeature(CPU_FEATURE_SSSE3)) {
+        variants[nvariants].func = Base64DecodeBlocksSSSE3;
+        variants[nvariants++].min = 16;
+    }
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        variants[nvariants].func = Base64DecodeBlocksAVX2;
+        variants[nvariants++].min = 32;
+    }
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX512BW|CPU_FEATURE_AVX512VBMI)) {
+        Base64SetupVbmiTables();
+        variants[nvariants].func = Base64DecodeBlocksAVX512;
+        variants[nvariants++].min = 64;
+    }
+#endif
+
+    Base64DecodeBlocksFunc func = base64_decode_blocks;
+    uint32_t min = base64_decode_blocks_min;
+    int result = 1;
+
+    for (int strict = 0; strict < 2; strict++) {
+        memset(expect, 0, sizeof(expect));
+        base64_decode_blocks = NULL;
+        const uint32_t e = DecodeBase64(expect, src, len, strict);
+
+        for (int v = 0; v < nvariants; v++) {
+            memset(dest, 0, sizeof(dest));
+            base64_decode_blocks = variants[v].func;
+            base64_decode_blocks_min = variants[v].min;
+            if (DecodeBase64(dest, src, len, strict) != e ||
+                    memcmp(dest, expect, e) != 0)
+                result = 0;
+        }
+    }
+
+    base64_decode_blocks = func;
+    base64_decode_blocks_min = min;
+    return result;
+}
+
+/** \test all characters, long runs and invalid bytes at every position
+ *         give the same result with every decoder */
+static int Base64Test02(void)
+{
+    uint8_t src[600];
+    uint32_t seed = 1;
+
+    for (uint32_t len = 1; len <= sizeof(src); len++) {
+        for (uint32_t i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            src[i] = base64_test_alphabet[(seed >> 16) % 64];
+        }
+        /* every few runs put an invalid or a padding char in */
+        if (len % 3 == 0) {
+            static const uint8_t bad[] = { '=', '*', ' ', 0x80, 0xc1, '\n', 0 };
+            seed = seed * 1103515245 + 12345;
+            src[(seed >> 16) % len] = bad[(seed >> 8) % sizeof(bad)];
+        }
+        FAIL_IF_NOT(Base64TestCompare(src, len));
+    }
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void Base64RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("Base64Test01", Base64Test01);
+    UtRegisterTest("Base64Test02", Base64Test02);
+#endif /* UNITTESTS */
+}
@@ -51,5 +51,8 @@
 /* Function prototypes */
 uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     int strict);
+void Base64DispatchSetup(void);
+
+void Base64RegisterTests(void);
 
 #endif
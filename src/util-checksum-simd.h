@@ -0,0 +1,50 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Runtime selected kernel summing the 16 bit words of the TCP and UDP
+ * checksums. Kept apart from util-checksum.h as it is needed by the
+ * decoder headers that util-checksum.h depends on.
+ */
+
+#ifndef __UTIL_CHECKSUM_SIMD_H__
+#define __UTIL_CHECKSUM_SIMD_H__
+
+#include "util-cpu.h"
+
+/** payloads from this size on are summed by the selected kernel */
+#define CHECKSUM_SUM16_MIN  128
+
+/**
+ * \brief sum the 16 bit words of a buffer
+ *
+ * \param pkt buffer to sum
+ * \param len length in bytes, a multiple of 32
+ *
+ * \retval sum unfolded 32 bit sum of the words
+ */
+typedef uint32_t (*ChecksumSum16Func)(const uint16_t *pkt, uint32_t len);
+
+#ifdef SC_CPU_DISPATCH
+extern ChecksumSum16Func ChecksumSum16;
+#endif
+
+void ChecksumDispatchSetup(void);
+
+#endif /* __UTIL_CHECKSUM_SIMD_H__ */
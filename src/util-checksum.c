@@ -26,6 +26,7 @@
 #include "suricata-common.h"
 
 #include "util-checksum.h"
+#include "util-checksum-simd.h"
 
 int ReCalculateChecksum(Packet *p)
 {
@@ -88,3 +89,88 @@ int ChecksumAutoModeCheck(uint32_t thread_count,
     }
     return 0;
 }
+
+#ifdef SC_CPU_DISPATCH
+#include <immintrin.h>
+
+static uint32_t ChecksumSum16Scalar(const uint16_t *pkt, uint32_t len)
+{
+    uint32_t csum = 0;
+    for ( ; len >= 32; len -= 32, pkt += 16) {
+        csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
+            pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
+            pkt[14] + pkt[15];
+    }
+    return csum;
+}
+
+/* The vector variants add the low and high word of each 32 bit lane into
+ * separate accumulators. A 64k packet adds at most 2048 * 65535 to a lane,
+ * so the lanes can't overflow. */
+
+SC_CPU_TARGET("sse2")
+static uint32_t ChecksumSum16SSE2(const uint16_t *pkt, uint32_t len)
+{
+    const uint8_t *p = (const uint8_t *)pkt;
+    const __m128i lo16 = _mm_set1_epi32(0x0000ffff);
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+
+    for (uint32_t i = 0; i < len; i += 32) {
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(p + i));
+        const __m128i v2 = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        acc_lo = _mm_add_epi32(acc_lo, _mm_and_si128(v1, lo16));
+        acc_hi = _mm_add_epi32(acc_hi, _mm_srli_epi32(v1, 16));
+        acc_lo = _mm_add_epi32(acc_lo, _mm_and_si128(v2, lo16));
+        acc_hi = _mm_add_epi32(acc_hi, _mm_srli_epi32(v2, 16));
+    }
+    __m128i s = _mm_add_epi32(acc_lo, acc_hi);
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+    return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+SC_CPU_TARGET("avx2")
+static uint32_t ChecksumSum16AVX2(const uint16_t *pkt, uint32_t len)
+{
+    const uint8_t *p = (const uint8_t *)pkt;
+    const __m256i lo16 = _mm256_set1_epi32(0x0000ffff);
+    __m256i acc_lo = _mm256_setzero_si256();
+    __m256i acc_hi = _mm256_setzero_si256();
+
+    for (uint32_t i = 0; i < len; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        acc_lo = _mm256_add_epi32(acc_lo, _mm256_and_si256(v, lo16));
+        acc_hi = _mm256_add_epi32(acc_hi, _mm256_srli_epi32(v, 16));
+    }
+    const __m256i acc = _mm256_add_epi32(acc_lo, acc_hi);
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+            _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+    return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+ChecksumSum16Func ChecksumSum16 = ChecksumSum16Scalar;
+#endif /* SC_CPU_DISPATCH */
+
+/**
+ *  \brief select the word summing kernel used by the TCP and UDP checksums
+ */
+void ChecksumDispatchSetup(void)
+{
+#ifdef SC_CPU_DISPATCH
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        ChecksumSum16 = ChecksumSum16AVX2;
+        UtilCpuDispatchRegister("checksum", "avx2");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_SSE2)) {
+        ChecksumSum16 = ChecksumSum16SSE2;
+        UtilCpuDispatchRegister("checksum", "sse2");
+    } else {
+        ChecksumSum16 = ChecksumSum16Scalar;
+        UtilCpuDispatchRegister("checksum", "scalar");
+    }
+#else
+    UtilCpuDispatchRegister("checksum", "scalar");
+#endif
+}
@@ -27,6 +27,14 @@
 #include "util-error.h"
 #include "util-debug.h"
 #include "util-cpu.h"
+#include "util-memcmp.h"
+#include "util-checksum-simd.h"
+#include "util-base64.h"
+#include "util-spm-simd.h"
+
+#ifdef SC_CPU_DISPATCH
+#include <cpuid.h>
+#endif
 
 /**
  * Ok, if they should use sysconf, check that they have the macro's
@@ -156,6 +164,171 @@ uint16_t UtilCpuGetNumProcessorsMax(void)
 #endif
 }
 
+static uint32_t cpu_features = 0;
+static int cpu_features_init = 0;
+
+#ifdef SC_CPU_DISPATCH
+static uint64_t UtilCpuGetXcr0(void)
+{
+    uint32_t eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((uint64_t)edx << 32) | eax;
+}
+#endif
+
+/**
+ * \brief Detect the SIMD features of the cpu we run on
+ *
+ * Safe to call more than once. Only the first call does the detection.
+ */
+void UtilCpuFeaturesInit(void)
+{
+    if (cpu_features_init)
+        return;
+    cpu_features_init = 1;
+
+#ifdef SC_CPU_DISPATCH
+    uint32_t eax, ebx, ecx, edx;
+    const uint32_t max = __get_cpuid_max(0, NULL);
+    if (max < 1)
+        return;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (edx & BIT_U32(26))
+        cpu_features |= CPU_FEATURE_SSE2;
+    if (ecx & BIT_U32(9))
+        cpu_features |= CPU_FEATURE_SSSE3;
+    if (ecx & BIT_U32(19))
+        cpu_features |= CPU_FEATURE_SSE41;
+    if (ecx & BIT_U32(20))
+        cpu_features |= CPU_FEATURE_SSE42;
+    if (ecx & BIT_U32(23))
+        cpu_features |= CPU_FEATURE_POPCNT;
+
+    /* AVX registers need to be saved by the OS: OSXSAVE and XCR0 */
+    if (!(ecx & BIT_U32(27)) || !(ecx & BIT_U32(28)) || max < 7)
+        return;
+    const uint64_t xcr0 = UtilCpuGetXcr0();
+    if ((xcr0 & 0x06) != 0x06)
+        return;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (ebx & BIT_U32(5))
+        cpu_features |= CPU_FEATURE_AVX2;
+
+    /* opmask and upper zmm state */
+    if ((xcr0 & 0xe0) != 0xe0)
+        return;
+    if (ebx & BIT_U32(16)) {
+        cpu_features |= CPU_FEATURE_AVX512F;
+        if (ebx & BIT_U32(30))
+            cpu_features |= CPU_FEATURE_AVX512BW;
+        if (ebx & BIT_U32(31))
+            cpu_features |= CPU_FEATURE_AVX512VL;
+        if (ecx & BIT_U32(1))
+            cpu_features |= CPU_FEATURE_AVX512VBMI;
+    }
+#endif
+}
+
+/**
+ * \brief Check if the cpu supports all of the features
+ *
+ * \param features CPU_FEATURE_* flags
+ *
+ * \retval 1 all features are supported
+ * \retval 0 one or more is missing
+ */
+int UtilCpuHasFeature(uint32_t features)
+{
+    if (!cpu_features_init)
+        UtilCpuFeaturesInit();
+    return (cpu_features & features) == features;
+}
+
+#define CPU_DISPATCH_MAX 16
+
+/** kernels and the variant picked for them, for the startup report */
+static struct {
+    const char *kernel;
+    const char *variant;
+} cpu_dispatch[CPU_DISPATCH_MAX];
+static int cpu_dispatch_cnt = 0;
+
+/**
+ * \brief Record the variant selected for a kernel
+ *
+ * Called at init. Registering a kernel again updates its variant.
+ */
+void UtilCpuDispatchRegister(const char *kernel, const char *variant)
+{
+    int i;
+    for (i = 0; i < cpu_dispatch_cnt; i++) {
+        if (strcmp(cpu_dispatch[i].kernel, kernel) == 0) {
+            cpu_dispatch[i].variant = variant;
+            return;
+        }
+    }
+    if (cpu_dispatch_cnt == CPU_DISPATCH_MAX)
+        return;
+    cpu_dispatch[cpu_dispatch_cnt].kernel = kernel;
+    cpu_dispatch[cpu_dispatch_cnt].variant = variant;
+    cpu_dispatch_cnt++;
+}
+
+/**
+ * \brief Detect the cpu features and select the kernel variants
+ */
+void UtilCpuDispatchSetup(void)
+{
+    UtilCpuFeaturesInit();
+
+    MemcmpDispatchSetup();
+    ChecksumDispatchSetup();
+    Base64DispatchSetup();
+    SpmSimdDispatchSetup();
+}
+
+static void UtilCpuDispatchPrintSummary(void)
+{
+    static const struct {
+        uint32_t feature;
+        const char *name;
+    } names[] = {
+        { CPU_FEATURE_SSE2, "sse2" },
+        { CPU_FEATURE_SSSE3, "ssse3" },
+        { CPU_FEATURE_SSE41, "sse4.1" },
+        { CPU_FEATURE_SSE42, "sse4.2" },
+        { CPU_FEATURE_POPCNT, "popcnt" },
+        { CPU_FEATURE_AVX2, "avx2" },
+        { CPU_FEATURE_AVX512F, "avx512f" },
+        { CPU_FEATURE_AVX512BW, "avx512bw" },
+        { CPU_FEATURE_AVX512VL, "avx512vl" },
+        { CPU_FEATURE_AVX512VBMI, "avx512vbmi" },
+    };
+    char buf[256] = "";
+    size_t i;
+    int n;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (UtilCpuHasFeature(names[i].feature)) {
+            strlcat(buf, " ", sizeof(buf));
+            strlcat(buf, names[i].name, sizeof(buf));
+        }
+    }
+    SCLogConfig("CPU features:%s", strlen(buf) ? buf : " none");
+
+    buf[0] = '\0';
+    for (n = 0; n < cpu_dispatch_cnt; n++) {
+        strlcat(buf, " ", sizeof(buf));
+        strlcat(buf, cpu_dispatch[n].kernel, sizeof(buf));
+        strlcat(buf, ":", sizeof(buf));
+        strlcat(buf, cpu_dispatch[n].variant, sizeof(buf));
+    }
+    if (cpu_dispatch_cnt > 0)
+        SCLogConfig("SIMD kernels:%s", buf);
+}
+
 /**
  * \brief Print a summary of CPUs detected (configured and online)
  */
@@ -172,6 +345,8 @@ void UtilCpuPrintSummary(void)
     if (cpus_online == 0 && cpus_conf == 0)
         SCLogInfo("Couldn't retireve any information of CPU's, please, send your operating "
                   "system info and check util-cpu.{c,h}");
+
+    UtilCpuDispatchPrintSummary();
 }
 
 /**
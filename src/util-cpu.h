@@ -36,4 +36,33 @@ void UtilCpuPrintSummary(void);
 
 uint64_t UtilCpuGetTicks(void);
 
+/* Runtime selection of SIMD kernels. With gcc >= 5 and clang >= 4 the
+ * x86 intrinsics can be used in functions marked with a target attribute
+ * without building the whole file for that instruction set. */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__clang__) && __clang_major__ >= 4) || \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 5))
+#define SC_CPU_DISPATCH 1
+#define SC_CPU_TARGET(t) __attribute__((target(t)))
+#endif
+
+/* cpu features as detected at startup. The AVX features are only set if
+ * the OS saves the extended registers. */
+#define CPU_FEATURE_SSE2        BIT_U32(0)
+#define CPU_FEATURE_SSSE3       BIT_U32(1)
+#define CPU_FEATURE_SSE41       BIT_U32(2)
+#define CPU_FEATURE_SSE42       BIT_U32(3)
+#define CPU_FEATURE_POPCNT      BIT_U32(4)
+#define CPU_FEATURE_AVX2        BIT_U32(5)
+#define CPU_FEATURE_AVX512F     BIT_U32(6)
+#define CPU_FEATURE_AVX512BW    BIT_U32(7)
+#define CPU_FEATURE_AVX512VL    BIT_U32(8)
+#define CPU_FEATURE_AVX512VBMI  BIT_U32(9)
+
+void UtilCpuFeaturesInit(void);
+int UtilCpuHasFeature(uint32_t features);
+
+void UtilCpuDispatchRegister(const char *kernel, const char *variant);
+void UtilCpuDispatchSetup(void);
+
 #endif /* __UTIL_CPU_H__ */
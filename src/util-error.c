@@ -356,6 +356,7 @@ const char * SCErrorToString(SCError err)
         CASE_CODE (SC_ERR_WINDIVERT_NOSUPPORT);
         CASE_CODE (SC_ERR_WINDIVERT_INVALID_FILTER);
         CASE_CODE (SC_ERR_WINDIVERT_TOOLONG_FILTER);
+        CASE_CODE (SC_ERR_LOG_COMPRESS);
 
         CASE_CODE (SC_ERR_MAX);
     }
@@ -346,6 +346,7 @@ typedef enum {
     SC_ERR_WINDIVERT_NOSUPPORT,
     SC_ERR_WINDIVERT_INVALID_FILTER,
     SC_ERR_WINDIVERT_TOOLONG_FILTER,
+    SC_ERR_LOG_COMPRESS,
 
     SC_ERR_MAX,
 } SCError;
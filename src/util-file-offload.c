@@ -0,0 +1,1278 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * File offload pool.
+ *
+ * Hashing file data and writing the filestore (v2) files is moved out of
+ * the packet threads into a pool of threads. Every file is pinned to one
+ * pool thread, so its jobs run in order. A packet thread copies a chunk
+ * once into its single producer, single consumer ring for that pool
+ * thread, the pool thread hashes and writes it straight from the ring.
+ *
+ * The results (hashes, magic) are picked up by the thread holding the
+ * flow with FileOffloadSync() before the file is logged or inspected by
+ * the hash keywords.
+ *
+ * When a ring is full the packet thread waits for space, or with
+ * "on-full: inline" runs the job itself once the earlier jobs of the file
+ * are done.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-magic.h"
+#include "util-logopenfile.h"
+#include "util-file-offload.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_NSS
+
+#define FILE_OFFLOAD_DEFAULT_THREADS        2
+#define FILE_OFFLOAD_MAX_THREADS            64
+#define FILE_OFFLOAD_DEFAULT_BUFFER_SIZE    (1024 * 1024)
+#define FILE_OFFLOAD_MIN_BUFFER_SIZE        (64 * 1024)
+/** max time a job waits if the packet thread doesn't wake the pool */
+#define FILE_OFFLOAD_IDLE_USEC              1000
+/** data used for the magic lookup, same as the filemagic keyword */
+#define FILE_OFFLOAD_MAGIC_SIZE             512
+
+/** ring record header value that marks the unused end of the ring */
+#define FILE_OFFLOAD_WRAP                   UINT32_MAX
+#define FILE_OFFLOAD_ALIGN(len)             (((len) + 7) & ~7)
+
+enum FileOffloadJobType {
+    FILE_OFFLOAD_JOB_DATA = 1,
+    FILE_OFFLOAD_JOB_END,
+    FILE_OFFLOAD_JOB_STORE_OPEN,
+    FILE_OFFLOAD_JOB_STORE_DATA,
+    FILE_OFFLOAD_JOB_STORE_CLOSE,
+};
+
+/** keep the store file open between the jobs */
+#define FILE_OFFLOAD_STORE_KEEP_OPEN        0x01
+
+/** ring record: the header followed by len bytes of data, padded to 8
+ *  bytes */
+typedef struct FileOffloadJob_ {
+    uint32_t len;       /**< data length or FILE_OFFLOAD_WRAP */
+    uint8_t type;
+    uint8_t flags;
+    uint16_t pad;
+    FileOffload *fo;
+} FileOffloadJob;
+
+typedef struct FileOffloadStoreOpenData_ {
+    FileOffloadStoreDoneFunc Done;
+    void *ctx;
+    char filename[PATH_MAX];
+} FileOffloadStoreOpenData;
+
+struct FileOffload_ {
+    /** held by the file and by every queued job */
+    SC_ATOMIC_DECLARE(uint32_t, refcnt);
+    /** jobs run by the pool */
+    SC_ATOMIC_DECLARE(uint64_t, done);
+    /** magic lookup done, the magic can be picked up before the other
+     *  jobs are done */
+    SC_ATOMIC_DECLARE(int, magic_done);
+
+    /* used by the thread holding the flow of the file */
+    uint64_t queued;
+    uint32_t thread;            /**< pool thread the file is pinned to */
+    void *producer;             /**< producer of the last queued job */
+    uint16_t hashes;            /**< FILE_MD5, FILE_SHA1, FILE_SHA256 */
+    uint16_t want;              /**< hashes to report, set at the end */
+    bool magic_wanted;
+    bool ended;
+    bool synced;
+    bool store_open;            /**< counted as open by the store */
+
+    /* used by the thread running the jobs */
+    HASHContext *md5_ctx;
+    HASHContext *sha1_ctx;
+    HASHContext *sha256_ctx;
+    uint8_t *magic_buf;
+    uint32_t magic_len;
+    int store_fd;
+    char *store_filename;
+    FileOffloadStoreDoneFunc StoreDone;
+    void *store_ctx;
+
+    /* results, read once all jobs are done */
+    uint16_t results;
+    uint8_t md5[MD5_LENGTH];
+    uint8_t sha1[SHA1_LENGTH];
+    uint8_t sha256[SHA256_LENGTH];
+    char *magic;
+};
+
+/** single producer, single consumer ring of jobs */
+typedef struct FileOffloadRing_ {
+    uint8_t *buffer;
+    /** size of the buffer, power of 2 */
+    uint32_t size;
+    /** positions are not wrapped, the offset is pos & (size - 1) */
+    SC_ATOMIC_DECLARE(uint64_t, head);  /**< written by the producer */
+    SC_ATOMIC_DECLARE(uint64_t, tail);  /**< written by the pool thread */
+} FileOffloadRing;
+
+/** per packet thread state, only written by that thread */
+typedef struct FileOffloadProducer_ {
+    FileOffloadRing *rings[FILE_OFFLOAD_MAX_THREADS];
+    uint64_t full;
+    uint64_t inline_jobs;
+    uint64_t waits;
+    uint64_t store_errors;
+} FileOffloadProducer;
+
+typedef struct FileOffloadThread_ {
+    uint32_t id;
+    pthread_t thread;
+    bool running;
+
+    /** rings of all producers, only added until shutdown */
+    SCMutex rings_mutex;
+    FileOffloadRing **rings;
+    uint32_t rings_cnt;
+    uint32_t rings_max;
+
+    SCCtrlMutex wakeup_mutex;
+    SCCtrlCondT wakeup_cond;
+
+    /* stats, only written by the pool thread */
+    uint64_t jobs;
+    uint64_t bytes;
+    uint64_t store_errors;
+} FileOffloadThread;
+
+static bool file_offload_running = false;
+static bool file_offload_block = true;
+static uint32_t file_offload_ring_size = FILE_OFFLOAD_DEFAULT_BUFFER_SIZE;
+static uint32_t file_offload_threads_cnt = 0;
+static FileOffloadThread *file_offload_threads = NULL;
+/** owner id of the producers in the thread cache */
+static uint32_t file_offload_owner_id = 0;
+static bool file_offload_counters_registered = false;
+
+static SC_ATOMIC_DECLARE(uint32_t, file_offload_next_thread);
+static SC_ATOMIC_DECLARE(int, file_offload_stop);
+static SC_ATOMIC_DECLARE(int, file_offload_store_warned);
+
+/* all producers, for the stats counters and the cleanup */
+static SCMutex file_offload_producers_mutex = SCMUTEX_INITIALIZER;
+static FileOffloadProducer **file_offload_producers = NULL;
+static uint32_t file_offload_producers_cnt = 0;
+static uint32_t file_offload_producers_max = 0;
+
+/** \brief check if new files are handed to the pool */
+bool FileOffloadEnabled(void)
+{
+    return file_offload_running;
+}
+
+static inline uint32_t FileOffloadRingUsed(FileOffloadRing *r)
+{
+    return (uint32_t)(SC_ATOMIC_GET(r->head) - SC_ATOMIC_GET(r->tail));
+}
+
+/** \brief largest chunk of data per job */
+static inline uint32_t FileOffloadChunkSize(void)
+{
+    return file_offload_ring_size / 4 - sizeof(FileOffloadJob);
+}
+
+static void FileOffloadWakeup(FileOffloadThread *pt)
+{
+    SCCtrlMutexLock(&pt->wakeup_mutex);
+    SCCtrlCondSignal(&pt->wakeup_cond);
+    SCCtrlMutexUnlock(&pt->wakeup_mutex);
+}
+
+static void FileOffloadFree(FileOffload *fo)
+{
+    if (fo->md5_ctx)
+        HASH_Destroy(fo->md5_ctx);
+    if (fo->sha1_ctx)
+        HASH_Destroy(fo->sha1_ctx);
+    if (fo->sha256_ctx)
+        HASH_Destroy(fo->sha256_ctx);
+    if (fo->magic_buf != NULL)
+        SCFree(fo->magic_buf);
+    if (fo->magic != NULL)
+        SCFree(fo->magic);
+    if (fo->store_fd != -1)
+        close(fo->store_fd);
+    if (fo->store_filename != NULL)
+        SCFree(fo->store_filename);
+    SC_ATOMIC_DESTROY(fo->refcnt);
+    SC_ATOMIC_DESTROY(fo->done);
+    SC_ATOMIC_DESTROY(fo->magic_done);
+    SCFree(fo);
+}
+
+/**
+ * \brief drop a reference to the offload state of a file
+ *
+ * Called by FileFree() for the reference of the file. Jobs still queued
+ * keep the state around until they ran.
+ */
+void FileOffloadRelease(FileOffload *fo)
+{
+    if (fo == NULL)
+        return;
+    if (SC_ATOMIC_SUB(fo->refcnt, 1) == 0)
+        FileOffloadFree(fo);
+}
+
+/**
+ * \brief set up the offload state for a new file
+ *
+ * \param hashes hashes to compute, FILE_MD5, FILE_SHA1 and FILE_SHA256
+ * \param magic run the magic lookup in the pool as well
+ *
+ * \retval fo the state or NULL if the pool is not running, the file is
+ *         then handled by the packet thread as before
+ */
+FileOffload *FileOffloadNew(uint16_t hashes, bool magic)
+{
+    if (!file_offload_running || hashes == 0)
+        return NULL;
+
+    FileOffload *fo = SCCalloc(1, sizeof(*fo));
+    if (unlikely(fo == NULL))
+        return NULL;
+    SC_ATOMIC_INIT(fo->refcnt);
+    SC_ATOMIC_INIT(fo->done);
+    SC_ATOMIC_INIT(fo->magic_done);
+    SC_ATOMIC_SET(fo->refcnt, 1);
+    fo->store_fd = -1;
+
+    if (hashes & FILE_MD5) {
+        fo->md5_ctx = HASH_Create(HASH_AlgMD5);
+        if (fo->md5_ctx != NULL) {
+            HASH_Begin(fo->md5_ctx);
+            fo->hashes |= FILE_MD5;
+        }
+    }
+    if (hashes & FILE_SHA1) {
+        fo->sha1_ctx = HASH_Create(HASH_AlgSHA1);
+        if (fo->sha1_ctx != NULL) {
+            HASH_Begin(fo->sha1_ctx);
+            fo->hashes |= FILE_SHA1;
+        }
+    }
+    if (hashes & FILE_SHA256) {
+        fo->sha256_ctx = HASH_Create(HASH_AlgSHA256);
+        if (fo->sha256_ctx != NULL) {
+            HASH_Begin(fo->sha256_ctx);
+            fo->hashes |= FILE_SHA256;
+        }
+    }
+    if (fo->hashes != hashes) {
+        /* let the packet thread handle the file */
+        FileOffloadFree(fo);
+        return NULL;
+    }
+#ifdef HAVE_MAGIC
+    if (magic) {
+        fo->magic_buf = SCMalloc(FILE_OFFLOAD_MAGIC_SIZE);
+        fo->magic_wanted = (fo->magic_buf != NULL);
+    }
+#endif
+
+    fo->thread = SC_ATOMIC_ADD(file_offload_next_thread, 1) %
+        file_offload_threads_cnt;
+    return fo;
+}
+
+static void FileOffloadStoreError(int err, const char *what,
+        const char *filename)
+{
+    if (SC_ATOMIC_CAS(&file_offload_store_warned, 0, 1)) {
+        SCLogWarning(err, "file offload: failed to %s %s: %s (further "
+                "errors are only counted)", what, filename, strerror(errno));
+    }
+}
+
+#ifdef HAVE_MAGIC
+static void FileOffloadMagicLookup(FileOffload *fo)
+{
+    if (fo->magic_len > 0) {
+        fo->magic = MagicGlobalLookup(fo->magic_buf, fo->magic_len);
+    }
+    SCFree(fo->magic_buf);
+    fo->magic_buf = NULL;
+    SC_ATOMIC_SET(fo->magic_done, 1);
+}
+#endif
+
+/**
+ * \brief run a job, in the pool or in the packet thread
+ *
+ * \retval errors number of failed file system operations
+ */
+static uint32_t FileOffloadRun(FileOffload *fo, uint8_t type, uint8_t flags,
+        const uint8_t *data, uint32_t data_len)
+{
+    uint32_t errors = 0;
+
+    switch (type) {
+        case FILE_OFFLOAD_JOB_DATA:
+            if (fo->md5_ctx)
+                HASH_Update(fo->md5_ctx, data, data_len);
+            if (fo->sha1_ctx)
+                HASH_Update(fo->sha1_ctx, data, data_len);
+            if (fo->sha256_ctx)
+                HASH_Update(fo->sha256_ctx, data, data_len);
+#ifdef HAVE_MAGIC
+            if (fo->magic_buf != NULL) {
+                uint32_t len = MIN(data_len,
+                        FILE_OFFLOAD_MAGIC_SIZE - fo->magic_len);
+                memcpy(fo->magic_buf + fo->magic_len, data, len);
+                fo->magic_len += len;
+                if (fo->magic_len == FILE_OFFLOAD_MAGIC_SIZE)
+                    FileOffloadMagicLookup(fo);
+            }
+#endif
+            break;
+
+        case FILE_OFFLOAD_JOB_END: {
+            unsigned int len = 0;
+#ifdef HAVE_MAGIC
+            if (fo->magic_buf != NULL)
+                FileOffloadMagicLookup(fo);
+#endif
+            if (fo->md5_ctx) {
+                HASH_End(fo->md5_ctx, fo->md5, &len, sizeof(fo->md5));
+                fo->results |= FILE_MD5;
+            }
+            if (fo->sha1_ctx) {
+                HASH_End(fo->sha1_ctx, fo->sha1, &len, sizeof(fo->sha1));
+                fo->results |= FILE_SHA1;
+            }
+            if (fo->sha256_ctx) {
+                HASH_End(fo->sha256_ctx, fo->sha256, &len,
+                        sizeof(fo->sha256));
+                fo->results |= FILE_SHA256;
+            }
+            break;
+        }
+
+        case FILE_OFFLOAD_JOB_STORE_OPEN: {
+            const FileOffloadStoreOpenData *od =
+                (const FileOffloadStoreOpenData *)data;
+            fo->StoreDone = od->Done;
+            fo->store_ctx = od->ctx;
+            fo->store_filename = SCStrdup(od->filename);
+            if (unlikely(fo->store_filename == NULL)) {
+                errors++;
+                break;
+            }
+            int fd = open(fo->store_filename,
+                    O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+            if (fd == -1) {
+                FileOffloadStoreError(SC_ERR_OPENING_FILE, "create",
+                        fo->store_filename);
+                errors++;
+            } else if (flags & FILE_OFFLOAD_STORE_KEEP_OPEN) {
+                fo->store_fd = fd;
+            } else {
+                close(fd);
+            }
+            break;
+        }
+
+        case FILE_OFFLOAD_JOB_STORE_DATA: {
+            if (fo->store_filename == NULL)
+                break;
+            int fd = fo->store_fd;
+            if (fd == -1) {
+                fd = open(fo->store_filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+                if (fd == -1) {
+                    FileOffloadStoreError(SC_ERR_OPENING_FILE, "open",
+                            fo->store_filename);
+                    errors++;
+                    break;
+                }
+            }
+            if (write(fd, data, data_len) == -1) {
+                FileOffloadStoreError(SC_ERR_FWRITE, "write to",
+                        fo->store_filename);
+                errors++;
+                /* reopen for every chunk from now on */
+                fo->store_fd = -1;
+            }
+            if (fo->store_fd == -1)
+                close(fd);
+            break;
+        }
+
+        case FILE_OFFLOAD_JOB_STORE_CLOSE:
+            if (fo->store_fd != -1) {
+                close(fo->store_fd);
+                fo->store_fd = -1;
+            }
+            if (fo->StoreDone != NULL && fo->store_filename != NULL) {
+                errors += fo->StoreDone(fo->store_ctx, fo->store_filename,
+                        fo->sha256);
+            }
+            break;
+    }
+    return errors;
+}
+
+static FileOffloadRing *FileOffloadRingNew(uint32_t size)
+{
+    FileOffloadRing *r = SCCalloc(1, sizeof(*r));
+    if (unlikely(r == NULL))
+        return NULL;
+    r->buffer = SCMallocAligned(size, 64);
+    if (unlikely(r->buffer == NULL)) {
+        SCFree(r);
+        return NULL;
+    }
+    r->size = size;
+    SC_ATOMIC_INIT(r->head);
+    SC_ATOMIC_INIT(r->tail);
+    return r;
+}
+
+static void FileOffloadRingFree(FileOffloadRing *r)
+{
+    SCFreeAligned(r->buffer);
+    SC_ATOMIC_DESTROY(r->head);
+    SC_ATOMIC_DESTROY(r->tail);
+    SCFree(r);
+}
+
+/**
+ * \brief get the producer of the calling thread, add one on first use
+ *
+ * \retval NULL if the thread has none, its jobs run inline then
+ */
+static FileOffloadProducer *FileOffloadProducerGet(void)
+{
+    void **slot = LogThreadCacheSlot(file_offload_owner_id);
+    if (unlikely(slot == NULL))
+        return NULL;
+    if (likely(*slot != NULL))
+        return *slot;
+
+    FileOffloadProducer *pr = SCCalloc(1, sizeof(*pr));
+    if (unlikely(pr == NULL))
+        return NULL;
+
+    SCMutexLock(&file_offload_producers_mutex);
+    if (file_offload_producers_cnt == file_offload_producers_max) {
+        uint32_t max = file_offload_producers_max ?
+            file_offload_producers_max * 2 : 8;
+        FileOffloadProducer **producers = SCRealloc(file_offload_producers,
+                max * sizeof(*producers));
+        if (unlikely(producers == NULL)) {
+            SCMutexUnlock(&file_offload_producers_mutex);
+            SCFree(pr);
+            return NULL;
+        }
+        file_offload_producers = producers;
+        file_offload_producers_max = max;
+    }
+    file_offload_producers[file_offload_producers_cnt++] = pr;
+    SCMutexUnlock(&file_offload_producers_mutex);
+
+    *slot = pr;
+    return pr;
+}
+
+/** \brief get the ring of a producer to a pool thread, add it on first
+ *         use */
+static FileOffloadRing *FileOffloadRingGet(FileOffloadProducer *pr,
+        uint32_t thread)
+{
+    if (likely(pr->rings[thread] != NULL))
+        return pr->rings[thread];
+
+    FileOffloadThread *pt = &file_offload_threads[thread];
+    FileOffloadRing *r = FileOffloadRingNew(file_offload_ring_size);
+    if (unlikely(r == NULL))
+        return NULL;
+
+    SCMutexLock(&pt->rings_mutex);
+    if (pt->rings_cnt == pt->rings_max) {
+        uint32_t max = pt->rings_max ? pt->rings_max * 2 : 8;
+        FileOffloadRing **rings = SCRealloc(pt->rings, max * sizeof(*rings));
+        if (unlikely(rings == NULL)) {
+            SCMutexUnlock(&pt->rings_mutex);
+            FileOffloadRingFree(r);
+            return NULL;
+        }
+        pt->rings = rings;
+        pt->rings_max = max;
+    }
+    pt->rings[pt->rings_cnt++] = r;
+    SCMutexUnlock(&pt->rings_mutex);
+
+    pr->rings[thread] = r;
+    return r;
+}
+
+/** \brief wait until the pool ran all queued jobs of a file */
+static void FileOffloadWait(FileOffload *fo, FileOffloadProducer *pr)
+{
+    if (fo->queued == SC_ATOMIC_GET(fo->done))
+        return;
+    if (pr != NULL)
+        pr->waits++;
+    do {
+        FileOffloadWakeup(&file_offload_threads[fo->thread]);
+        usleep(100);
+    } while (fo->queued != SC_ATOMIC_GET(fo->done));
+}
+
+/**
+ * \brief queue a job for the pool thread of a file
+ *
+ * \param data_len at most FileOffloadChunkSize()
+ */
+static void FileOffloadQueue(FileOffload *fo, uint8_t type, uint8_t flags,
+        const uint8_t *data, uint32_t data_len)
+{
+    FileOffloadProducer *pr = NULL;
+    FileOffloadRing *r = NULL;
+
+    if (likely(file_offload_running)) {
+        pr = FileOffloadProducerGet();
+        /* the jobs of a file stay in order within a ring, if the file
+         * moves to another thread its earlier jobs have to be done
+         * first */
+        if (unlikely(fo->producer != pr)) {
+            FileOffloadWait(fo, pr);
+            fo->producer = pr;
+        }
+        if (likely(pr != NULL))
+            r = FileOffloadRingGet(pr, fo->thread);
+    }
+    if (unlikely(r == NULL))
+        goto run_inline;
+
+    const uint32_t need = FILE_OFFLOAD_ALIGN(sizeof(FileOffloadJob) + data_len);
+    const uint64_t head = SC_ATOMIC_GET(r->head);
+    uint32_t offset = head & (r->size - 1);
+    uint32_t wrap = (need > r->size - offset) ? r->size - offset : 0;
+
+    FileOffloadThread *pt = &file_offload_threads[fo->thread];
+    uint64_t tail = SC_ATOMIC_GET(r->tail);
+    if (head + wrap + need - tail > r->size) {
+        pr->full++;
+        if (!file_offload_block)
+            goto run_inline;
+        do {
+            FileOffloadWakeup(pt);
+            usleep(100);
+            tail = SC_ATOMIC_GET(r->tail);
+        } while (head + wrap + need - tail > r->size);
+    }
+    /* don't touch the space before the pool thread is done with it,
+     * pairs with the tail update in FileOffloadDrain() */
+    hw_barrier();
+
+    if (wrap) {
+        *(uint32_t *)(r->buffer + offset) = FILE_OFFLOAD_WRAP;
+        offset = 0;
+    }
+    FileOffloadJob *job = (FileOffloadJob *)(r->buffer + offset);
+    job->len = data_len;
+    job->type = type;
+    job->flags = flags;
+    job->pad = 0;
+    job->fo = fo;
+    if (data_len > 0)
+        memcpy((uint8_t *)(job + 1), data, data_len);
+
+    SC_ATOMIC_ADD(fo->refcnt, 1);
+    fo->queued++;
+
+    const uint32_t used = (uint32_t)(head - tail);
+    SC_ATOMIC_SET(r->head, head + wrap + need);
+
+    /* an idle pool thread sleeps until it's woken or times out */
+    if (used == 0)
+        FileOffloadWakeup(pt);
+    return;
+
+run_inline:
+    FileOffloadWait(fo, pr);
+    uint32_t errors = FileOffloadRun(fo, type, flags, data, data_len);
+    if (pr != NULL) {
+        pr->inline_jobs++;
+        pr->store_errors += errors;
+    }
+}
+
+/** \brief queue data in chunks that fit the rings */
+static void FileOffloadQueueData(FileOffload *fo, uint8_t type,
+        const uint8_t *data, uint32_t data_len)
+{
+    const uint32_t chunk = FileOffloadChunkSize();
+    while (data_len > 0) {
+        uint32_t len = MIN(data_len, chunk);
+        FileOffloadQueue(fo, type, 0, data, len);
+        data += len;
+        data_len -= len;
+    }
+}
+
+/** \brief hash a chunk of file data in the pool */
+void FileOffloadData(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL || fo->ended || data_len == 0)
+        return;
+    FileOffloadQueueData(fo, FILE_OFFLOAD_JOB_DATA, data, data_len);
+}
+
+/**
+ * \brief finish the hashes of a file
+ *
+ * \param hashes hashes the file reports, the others are computed but
+ *        not set in the file
+ */
+void FileOffloadEnd(File *ff, uint16_t hashes)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL || fo->ended)
+        return;
+    fo->want = hashes & fo->hashes;
+    fo->ended = true;
+    FileOffloadQueue(fo, FILE_OFFLOAD_JOB_END, 0, NULL, 0);
+}
+
+/** \brief check if the magic of a file is looked up by the pool */
+bool FileOffloadMagic(const File *ff)
+{
+    return (ff->offload != NULL && ff->offload->magic_wanted);
+}
+
+static void FileOffloadSyncMagic(File *ff, FileOffload *fo)
+{
+#ifdef HAVE_MAGIC
+    if (fo->magic_wanted && SC_ATOMIC_GET(fo->magic_done)) {
+        fo->magic_wanted = false;
+        if (ff->magic == NULL) {
+            ff->magic = fo->magic;
+            fo->magic = NULL;
+        }
+    }
+#endif
+}
+
+/**
+ * \brief pick up the results of the pool
+ *
+ * Sets the magic in the file once it's looked up and the hashes once the
+ * pool ran all jobs queued for the file.
+ *
+ * \param wait wait for the pool if it's not done yet
+ *
+ * \retval true done, the results are in the file
+ * \retval false jobs are pending
+ */
+bool FileOffloadSync(File *ff, bool wait)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL)
+        return true;
+
+    FileOffloadSyncMagic(ff, fo);
+    if (fo->queued != SC_ATOMIC_GET(fo->done)) {
+        if (!wait)
+            return false;
+        FileOffloadWait(fo, file_offload_running ?
+                FileOffloadProducerGet() : NULL);
+        FileOffloadSyncMagic(ff, fo);
+    }
+    if (fo->ended && !fo->synced) {
+        fo->synced = true;
+        const uint16_t results = fo->results & fo->want;
+        if (results & FILE_MD5) {
+            memcpy(ff->md5, fo->md5, sizeof(ff->md5));
+            ff->flags |= FILE_MD5;
+        }
+        if (results & FILE_SHA1) {
+            memcpy(ff->sha1, fo->sha1, sizeof(ff->sha1));
+            ff->flags |= FILE_SHA1;
+        }
+        if (results & FILE_SHA256) {
+            memcpy(ff->sha256, fo->sha256, sizeof(ff->sha256));
+            ff->flags |= FILE_SHA256;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief create the store file of a file in the pool
+ *
+ * \param keep_open keep the file open until FileOffloadStoreClose()
+ * \param Done called by the pool after closing the file, e.g. to move
+ *        it in place
+ */
+void FileOffloadStoreOpen(File *ff, const char *filename, bool keep_open,
+        FileOffloadStoreDoneFunc Done, void *ctx)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL)
+        return;
+
+    FileOffloadStoreOpenData od;
+    od.Done = Done;
+    od.ctx = ctx;
+    strlcpy(od.filename, filename, sizeof(od.filename));
+
+    fo->store_open = keep_open;
+    FileOffloadQueue(fo, FILE_OFFLOAD_JOB_STORE_OPEN,
+            keep_open ? FILE_OFFLOAD_STORE_KEEP_OPEN : 0, (uint8_t *)&od,
+            offsetof(FileOffloadStoreOpenData, filename) +
+            strlen(od.filename) + 1);
+}
+
+/** \brief append a chunk to the store file of a file in the pool */
+void FileOffloadStoreData(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL || data_len == 0)
+        return;
+    FileOffloadQueueData(fo, FILE_OFFLOAD_JOB_STORE_DATA, data, data_len);
+}
+
+/**
+ * \brief close the store file of a file in the pool
+ *
+ * \retval true if the file was opened with keep_open
+ */
+bool FileOffloadStoreClose(File *ff)
+{
+    FileOffload *fo = ff->offload;
+    if (fo == NULL)
+        return false;
+    FileOffloadQueue(fo, FILE_OFFLOAD_JOB_STORE_CLOSE, 0, NULL, 0);
+
+    bool was_open = fo->store_open;
+    fo->store_open = false;
+    return was_open;
+}
+
+/**
+ * \brief run the jobs queued in all rings of a pool thread
+ *
+ * \retval cnt number of jobs run
+ */
+static uint32_t FileOffloadDrain(FileOffloadThread *pt)
+{
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; ; i++) {
+        SCMutexLock(&pt->rings_mutex);
+        FileOffloadRing *r = (i < pt->rings_cnt) ? pt->rings[i] : NULL;
+        SCMutexUnlock(&pt->rings_mutex);
+        if (r == NULL)
+            break;
+
+        const uint64_t head = SC_ATOMIC_GET(r->head);
+        uint64_t tail = SC_ATOMIC_GET(r->tail);
+        /* pairs with the head update in FileOffloadQueue(): the jobs up
+         * to head are complete */
+        hw_barrier();
+        while (tail != head) {
+            uint32_t offset = tail & (r->size - 1);
+            FileOffloadJob *job = (FileOffloadJob *)(r->buffer + offset);
+            if (job->len == FILE_OFFLOAD_WRAP) {
+                tail += r->size - offset;
+                continue;
+            }
+            FileOffload *fo = job->fo;
+            pt->store_errors += FileOffloadRun(fo, job->type, job->flags,
+                    (const uint8_t *)(job + 1), job->len);
+            pt->jobs++;
+            pt->bytes += job->len;
+            total++;
+
+            tail += FILE_OFFLOAD_ALIGN(sizeof(FileOffloadJob) + job->len);
+            /* hand the space back only after the job ran */
+            SC_ATOMIC_SET(r->tail, tail);
+
+            SC_ATOMIC_ADD(fo->done, 1);
+            FileOffloadRelease(fo);
+        }
+    }
+    return total;
+}
+
+static void *FileOffloadThreadMain(void *arg)
+{
+    FileOffloadThread *pt = arg;
+
+    char name[16];
+    snprintf(name, sizeof(name), "FileOffload#%02u", pt->id);
+    if (SCSetThreadName(name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (1) {
+        /* read the flag before draining, so jobs queued before the stop
+         * always run */
+        int stop = SC_ATOMIC_GET(file_offload_stop);
+        if (FileOffloadDrain(pt) != 0)
+            continue;
+        if (stop)
+            break;
+
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        uint64_t usec = tv.tv_usec + FILE_OFFLOAD_IDLE_USEC;
+        ts.tv_sec = tv.tv_sec + usec / 1000000;
+        ts.tv_nsec = (usec % 1000000) * 1000;
+
+        SCCtrlMutexLock(&pt->wakeup_mutex);
+        if (!SC_ATOMIC_GET(file_offload_stop))
+            SCCtrlCondTimedwait(&pt->wakeup_cond, &pt->wakeup_mutex, &ts);
+        SCCtrlMutexUnlock(&pt->wakeup_mutex);
+    }
+    return NULL;
+}
+
+static uint64_t FileOffloadCounterQueued(void)
+{
+    uint64_t bytes = 0;
+    for (uint32_t t = 0; t < file_offload_threads_cnt; t++) {
+        FileOffloadThread *pt = &file_offload_threads[t];
+        SCMutexLock(&pt->rings_mutex);
+        for (uint32_t i = 0; i < pt->rings_cnt; i++)
+            bytes += FileOffloadRingUsed(pt->rings[i]);
+        SCMutexUnlock(&pt->rings_mutex);
+    }
+    return bytes;
+}
+
+#define FILE_OFFLOAD_THREAD_SUM(name, field)                \
+static uint64_t name(void)                                  \
+{                                                           \
+    uint64_t v = 0;                                         \
+    for (uint32_t t = 0; t < file_offload_threads_cnt; t++) \
+        v += file_offload_threads[t].field;                 \
+    return v;                                               \
+}
+
+#define FILE_OFFLOAD_PRODUCER_SUM(name, field)              \
+static uint64_t name(void)                                  \
+{                                                           \
+    uint64_t v = 0;                                         \
+    SCMutexLock(&file_offload_producers_mutex);             \
+    for (uint32_t i = 0; i < file_offload_producers_cnt; i++) \
+        v += file_offload_producers[i]->field;              \
+    SCMutexUnlock(&file_offload_producers_mutex);           \
+    return v;                                               \
+}
+
+FILE_OFFLOAD_THREAD_SUM(FileOffloadCounterJobs, jobs)
+FILE_OFFLOAD_THREAD_SUM(FileOffloadCounterBytes, bytes)
+FILE_OFFLOAD_THREAD_SUM(FileOffloadCounterPoolStoreErrors, store_errors)
+FILE_OFFLOAD_PRODUCER_SUM(FileOffloadCounterFull, full)
+FILE_OFFLOAD_PRODUCER_SUM(FileOffloadCounterInline, inline_jobs)
+FILE_OFFLOAD_PRODUCER_SUM(FileOffloadCounterWaits, waits)
+FILE_OFFLOAD_PRODUCER_SUM(FileOffloadCounterInlineStoreErrors, store_errors)
+
+static uint64_t FileOffloadCounterStoreErrors(void)
+{
+    return FileOffloadCounterPoolStoreErrors() +
+        FileOffloadCounterInlineStoreErrors();
+}
+
+static void FileOffloadRegisterCounters(void)
+{
+    if (file_offload_counters_registered)
+        return;
+    file_offload_counters_registered = true;
+
+    StatsRegisterGlobalCounter("file_offload.jobs", FileOffloadCounterJobs);
+    StatsRegisterGlobalCounter("file_offload.bytes", FileOffloadCounterBytes);
+    StatsRegisterGlobalCounter("file_offload.queued_bytes",
+            FileOffloadCounterQueued);
+    StatsRegisterGlobalCounter("file_offload.full", FileOffloadCounterFull);
+    StatsRegisterGlobalCounter("file_offload.inline",
+            FileOffloadCounterInline);
+    StatsRegisterGlobalCounter("file_offload.waits", FileOffloadCounterWaits);
+    StatsRegisterGlobalCounter("file_offload.store_errors",
+            FileOffloadCounterStoreErrors);
+}
+
+static int FileOffloadStart(uint32_t threads, uint32_t ring_size, bool block)
+{
+    /* round up to a power of 2 */
+    uint32_t size = FILE_OFFLOAD_MIN_BUFFER_SIZE;
+    while (size < ring_size && size < (1U << 31))
+        size <<= 1;
+
+    file_offload_threads = SCCalloc(threads, sizeof(FileOffloadThread));
+    if (unlikely(file_offload_threads == NULL))
+        return -1;
+    file_offload_threads_cnt = threads;
+    file_offload_ring_size = size;
+    file_offload_block = block;
+    file_offload_owner_id = LogThreadCacheNewOwner();
+    SC_ATOMIC_INIT(file_offload_next_thread);
+    SC_ATOMIC_INIT(file_offload_stop);
+    SC_ATOMIC_INIT(file_offload_store_warned);
+
+    for (uint32_t t = 0; t < threads; t++) {
+        FileOffloadThread *pt = &file_offload_threads[t];
+        pt->id = t + 1;
+        SCMutexInit(&pt->rings_mutex, NULL);
+        SCCtrlMutexInit(&pt->wakeup_mutex, NULL);
+        SCCtrlCondInit(&pt->wakeup_cond, NULL);
+        if (pthread_create(&pt->thread, NULL, FileOffloadThreadMain, pt) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "failed to start file offload "
+                    "thread");
+            file_offload_running = true;
+            FileOffloadShutdown();
+            return -1;
+        }
+        pt->running = true;
+    }
+    file_offload_running = true;
+    return 0;
+}
+
+/**
+ * \brief parse the "file-offload" config and start the pool
+ */
+void FileOffloadInit(void)
+{
+    if (file_offload_running)
+        return;
+
+    ConfNode *conf = ConfGetNode("file-offload");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return;
+
+    intmax_t threads = FILE_OFFLOAD_DEFAULT_THREADS;
+    if (ConfGetChildValueInt(conf, "threads", &threads) &&
+            (threads <= 0 || threads > FILE_OFFLOAD_MAX_THREADS)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                "invalid file-offload threads %"PRIdMAX", expected 1-%d",
+                threads, FILE_OFFLOAD_MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t ring_size = FILE_OFFLOAD_DEFAULT_BUFFER_SIZE;
+    const char *value = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (value != NULL && (ParseSizeStringU32(value, &ring_size) < 0 ||
+                ring_size == 0)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                "invalid file-offload buffer-size \"%s\"", value);
+        exit(EXIT_FAILURE);
+    }
+
+    bool block = true;
+    value = ConfNodeLookupChildValue(conf, "on-full");
+    if (value != NULL) {
+        if (strcasecmp(value, "inline") == 0) {
+            block = false;
+        } else if (strcasecmp(value, "block") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                    "invalid file-offload on-full \"%s\", expected block "
+                    "or inline", value);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (FileOffloadStart((uint32_t)threads, ring_size, block) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to start the file offload "
+                "pool");
+        exit(EXIT_FAILURE);
+    }
+    FileOffloadRegisterCounters();
+
+    SCLogConfig("file offload: %u threads, %u bytes per packet thread and "
+            "pool thread, %s when full", file_offload_threads_cnt,
+            file_offload_ring_size, block ? "blocking" : "running inline");
+}
+
+/**
+ * \brief stop the pool after it ran the queued jobs
+ *
+ * The packet threads must be done. Files still around keep their
+ * results and are freed as usual.
+ */
+void FileOffloadShutdown(void)
+{
+    if (!file_offload_running)
+        return;
+
+    SC_ATOMIC_SET(file_offload_stop, 1);
+    for (uint32_t t = 0; t < file_offload_threads_cnt; t++) {
+        FileOffloadThread *pt = &file_offload_threads[t];
+        if (pt->running) {
+            FileOffloadWakeup(pt);
+            pthread_join(pt->thread, NULL);
+            pt->running = false;
+        }
+    }
+    file_offload_running = false;
+
+    for (uint32_t t = 0; t < file_offload_threads_cnt; t++) {
+        FileOffloadThread *pt = &file_offload_threads[t];
+        for (uint32_t i = 0; i < pt->rings_cnt; i++)
+            FileOffloadRingFree(pt->rings[i]);
+        if (pt->rings != NULL)
+            SCFree(pt->rings);
+        SCMutexDestroy(&pt->rings_mutex);
+        SCCtrlMutexDestroy(&pt->wakeup_mutex);
+        SCCtrlCondDestroy(&pt->wakeup_cond);
+    }
+
+    SCMutexLock(&file_offload_producers_mutex);
+    for (uint32_t i = 0; i < file_offload_producers_cnt; i++)
+        SCFree(file_offload_producers[i]);
+    if (file_offload_producers != NULL)
+        SCFree(file_offload_producers);
+    file_offload_producers = NULL;
+    file_offload_producers_cnt = 0;
+    file_offload_producers_max = 0;
+    SCMutexUnlock(&file_offload_producers_mutex);
+
+    /* the stats thread is gone, the counters read nothing from here */
+    SCFree(file_offload_threads);
+    file_offload_threads = NULL;
+    file_offload_threads_cnt = 0;
+}
+
+#else /* HAVE_NSS */
+
+bool FileOffloadEnabled(void)
+{
+    return false;
+}
+
+void FileOffloadInit(void)
+{
+    ConfNode *conf = ConfGetNode("file-offload");
+    if (conf != NULL && ConfNodeChildValueIsTrue(conf, "enabled")) {
+        SCLogInfo("file-offload requires linking against libnss");
+    }
+}
+
+void FileOffloadShutdown(void)
+{
+}
+
+FileOffload *FileOffloadNew(uint16_t hashes, bool magic)
+{
+    return NULL;
+}
+
+void FileOffloadRelease(FileOffload *fo)
+{
+}
+
+void FileOffloadData(File *ff, const uint8_t *data, uint32_t data_len)
+{
+}
+
+void FileOffloadEnd(File *ff, uint16_t hashes)
+{
+}
+
+bool FileOffloadMagic(const File *ff)
+{
+    return false;
+}
+
+bool FileOffloadSync(File *ff, bool wait)
+{
+    return true;
+}
+
+void FileOffloadStoreOpen(File *ff, const char *filename, bool keep_open,
+        FileOffloadStoreDoneFunc Done, void *ctx)
+{
+}
+
+void FileOffloadStoreData(File *ff, const uint8_t *data, uint32_t data_len)
+{
+}
+
+bool FileOffloadStoreClose(File *ff)
+{
+    return false;
+}
+
+#endif /* HAVE_NSS */
+
+#if defined(UNITTESTS) && defined(HAVE_NSS)
+
+#define FILE_OFFLOAD_TEST_THREADS   4
+#define FILE_OFFLOAD_TEST_FILES     16
+
+typedef struct FileOffloadTestData_ {
+    File files[FILE_OFFLOAD_TEST_FILES];
+    uint8_t data[256 * 1024];
+} FileOffloadTestData;
+
+static void *FileOffloadTestProducer(void *arg)
+{
+    FileOffloadTestData *td = arg;
+
+    /* odd chunk sizes to wrap the rings at odd offsets */
+    for (uint32_t i = 0; i < FILE_OFFLOAD_TEST_FILES; i++) {
+        File *ff = &td->files[i];
+        uint32_t offset = 0;
+        uint32_t len = 1 + i * 331;
+        while (offset < sizeof(td->data)) {
+            len = MIN(len, sizeof(td->data) - offset);
+            FileOffloadData(ff, td->data + offset, len);
+            offset += len;
+            len = (len * 7 + 13) % 70000 + 1;
+        }
+        FileOffloadEnd(ff, FILE_MD5|FILE_SHA1|FILE_SHA256);
+    }
+    return NULL;
+}
+
+/**
+ * \test files hashed by the pool from several threads with small rings
+ *       get the same hashes as hashed inline
+ */
+static int FileOffloadTest01(void)
+{
+    FileOffloadTestData *td[FILE_OFFLOAD_TEST_THREADS];
+    pthread_t threads[FILE_OFFLOAD_TEST_THREADS];
+
+    FAIL_IF(FileOffloadStart(2, FILE_OFFLOAD_MIN_BUFFER_SIZE, true) != 0);
+
+    for (int t = 0; t < FILE_OFFLOAD_TEST_THREADS; t++) {
+        td[t] = SCCalloc(1, sizeof(FileOffloadTestData));
+        FAIL_IF_NULL(td[t]);
+        for (uint32_t i = 0; i < sizeof(td[t]->data); i++)
+            td[t]->data[i] = (uint8_t)(i * (t + 3) + (i >> 11));
+        for (int i = 0; i < FILE_OFFLOAD_TEST_FILES; i++) {
+            td[t]->files[i].offload = FileOffloadNew(
+                    FILE_MD5|FILE_SHA1|FILE_SHA256, false);
+            FAIL_IF_NULL(td[t]->files[i].offload);
+        }
+        FAIL_IF(pthread_create(&threads[t], NULL, FileOffloadTestProducer,
+                    td[t]) != 0);
+    }
+    for (int t = 0; t < FILE_OFFLOAD_TEST_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int t = 0; t < FILE_OFFLOAD_TEST_THREADS; t++) {
+        uint8_t sha256[SHA256_LENGTH];
+        unsigned int len = 0;
+        HASHContext *ctx = HASH_Create(HASH_AlgSHA256);
+        FAIL_IF_NULL(ctx);
+        HASH_Begin(ctx);
+        HASH_Update(ctx, td[t]->data, sizeof(td[t]->data));
+        HASH_End(ctx, sha256, &len, sizeof(sha256));
+        HASH_Destroy(ctx);
+
+        for (int i = 0; i < FILE_OFFLOAD_TEST_FILES; i++) {
+            File *ff = &td[t]->files[i];
+            FAIL_IF_NOT(FileOffloadSync(ff, true));
+            FAIL_IF_NOT(ff->flags & FILE_MD5);
+            FAIL_IF_NOT(ff->flags & FILE_SHA1);
+            FAIL_IF_NOT(ff->flags & FILE_SHA256);
+            FAIL_IF(memcmp(ff->sha256, sha256, sizeof(sha256)) != 0);
+            FileOffloadRelease(ff->offload);
+        }
+        SCFree(td[t]);
+    }
+
+    FileOffloadShutdown();
+    PASS;
+}
+
+static int FileOffloadTestStoreDone(void *ctx, const char *filename,
+        const uint8_t *sha256)
+{
+    memcpy(ctx, sha256, SHA256_LENGTH);
+    return 0;
+}
+
+/**
+ * \test store jobs write the file, on a full ring the jobs run inline
+ *       after the earlier jobs of the file
+ */
+static int FileOffloadTest02(void)
+{
+    char filename[] = "/tmp/suricata-file-offload-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+    close(fd);
+
+    FAIL_IF(FileOffloadStart(1, FILE_OFFLOAD_MIN_BUFFER_SIZE, false) != 0);
+
+    File ff;
+    memset(&ff, 0, sizeof(ff));
+    ff.offload = FileOffloadNew(FILE_SHA256, false);
+    FAIL_IF_NULL(ff.offload);
+
+    uint8_t sha256[SHA256_LENGTH];
+    memset(sha256, 0, sizeof(sha256));
+    FileOffloadStoreOpen(&ff, filename, true, FileOffloadTestStoreDone,
+            sha256);
+
+    uint8_t data[4096];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+    for (int i = 0; i < 256; i++) {
+        FileOffloadData(&ff, data, sizeof(data));
+        FileOffloadStoreData(&ff, data, sizeof(data));
+    }
+    FileOffloadEnd(&ff, FILE_SHA256);
+    FAIL_IF_NOT(FileOffloadStoreClose(&ff));
+    FAIL_IF_NOT(FileOffloadSync(&ff, true));
+    FAIL_IF_NOT(ff.flags & FILE_SHA256);
+    FAIL_IF(memcmp(ff.sha256, sha256, sizeof(sha256)) != 0);
+
+    struct stat st;
+    FAIL_IF(stat(filename, &st) != 0);
+    FAIL_IF(st.st_size != 256 * (off_t)sizeof(data));
+    unlink(filename);
+
+    FileOffloadRelease(ff.offload);
+    FileOffloadShutdown();
+    PASS;
+}
+
+#endif /* UNITTESTS && HAVE_NSS */
+
+void FileOffloadRegisterTests(void)
+{
+#if defined(UNITTESTS) && defined(HAVE_NSS)
+    UtRegisterTest("FileOffloadTest01", FileOffloadTest01);
+    UtRegisterTest("FileOffloadTest02", FileOffloadTest02);
+#endif
+}
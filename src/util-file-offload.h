@@ -0,0 +1,57 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Pool of threads that hash files, run the magic lookup and write the
+ * filestore (v2) files for the packet threads.
+ */
+
+#ifndef __UTIL_FILE_OFFLOAD_H__
+#define __UTIL_FILE_OFFLOAD_H__
+
+#include "util-file.h"
+
+/** per file state of the pool, see File::offload */
+typedef struct FileOffload_ FileOffload;
+
+/** called by the pool when a stored file is closed
+ *  \retval errors number of failed file system operations */
+typedef int (*FileOffloadStoreDoneFunc)(void *ctx, const char *filename,
+        const uint8_t *sha256);
+
+void FileOffloadInit(void);
+void FileOffloadShutdown(void);
+bool FileOffloadEnabled(void);
+
+FileOffload *FileOffloadNew(uint16_t hashes, bool magic);
+void FileOffloadRelease(FileOffload *fo);
+
+void FileOffloadData(File *ff, const uint8_t *data, uint32_t data_len);
+void FileOffloadEnd(File *ff, uint16_t hashes);
+bool FileOffloadMagic(const File *ff);
+bool FileOffloadSync(File *ff, bool wait);
+
+void FileOffloadStoreOpen(File *ff, const char *filename, bool keep_open,
+        FileOffloadStoreDoneFunc Done, void *ctx);
+void FileOffloadStoreData(File *ff, const uint8_t *data, uint32_t data_len);
+bool FileOffloadStoreClose(File *ff);
+
+void FileOffloadRegisterTests(void);
+
+#endif /* __UTIL_FILE_OFFLOAD_H__ */
@@ -36,6 +36,7 @@
 #include "util-print.h"
 #include "app-layer-parser.h"
 #include "util-validate.h"
+#include "util-file-offload.h"
 
 /** \brief switch to force filestore on all files
  *         regardless of the rules.
@@ -304,6 +305,9 @@ static int FilePruneFile(File *file)
     SCEnter();
 #ifdef HAVE_MAGIC
     if (!(file->flags & FILE_NOMAGIC)) {
+        /* the offload pool may have looked it up by now */
+        if (file->magic == NULL)
+            (void)FileOffloadSync(file, false);
         /* need magic but haven't set it yet, bail out */
         if (file->magic == NULL)
             SCReturnInt(0);
@@ -472,6 +476,7 @@ static void FileFree(File *ff)
     if (ff->sb != NULL) {
         StreamingBufferFree(ff->sb);
     }
+    FileOffloadRelease(ff->offload);
 
 #ifdef HAVE_NSS
     if (ff->md5_ctx)
@@ -553,6 +558,52 @@ static int FileStoreNoStoreCheck(File *ff)
     SCReturnInt(0);
 }
 
+#ifdef HAVE_NSS
+/** \internal
+ *  \brief get the hashes to compute for a file */
+static uint16_t FileHashesWanted(const File *ff)
+{
+    uint16_t hashes = 0;
+    if (!(ff->flags & FILE_NOMD5) || g_file_force_md5)
+        hashes |= FILE_MD5;
+    if (!(ff->flags & FILE_NOSHA1) || g_file_force_sha1)
+        hashes |= FILE_SHA1;
+    if (!(ff->flags & FILE_NOSHA256) || g_file_force_sha256)
+        hashes |= FILE_SHA256;
+    return hashes;
+}
+
+/** \internal
+ *  \brief update the hashes of a file, or hand the data to the offload
+ *         pool
+ *
+ *  \retval 1 the file is hashed
+ *  \retval 0 no hashes for this file
+ */
+static int FileHashUpdate(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    if (ff->offload != NULL) {
+        FileOffloadData(ff, data, data_len);
+        return 1;
+    }
+
+    int hash_done = 0;
+    if (ff->md5_ctx) {
+        HASH_Update(ff->md5_ctx, data, data_len);
+        hash_done = 1;
+    }
+    if (ff->sha1_ctx) {
+        HASH_Update(ff->sha1_ctx, data, data_len);
+        hash_done = 1;
+    }
+    if (ff->sha256_ctx) {
+        HASH_Update(ff->sha256_ctx, data, data_len);
+        hash_done = 1;
+    }
+    return hash_done;
+}
+#endif
+
 static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
 {
     if (StreamingBufferAppendNoTrack(file->sb, data, data_len) != 0) {
@@ -560,15 +611,7 @@ static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
     }
 
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
-    }
-    if (file->sha1_ctx) {
-        HASH_Update(file->sha1_ctx, data, data_len);
-    }
-    if (file->sha256_ctx) {
-        HASH_Update(file->sha256_ctx, data, data_len);
-    }
+    (void)FileHashUpdate(file, data, data_len);
 #endif
     SCReturnInt(0);
 }
@@ -602,22 +645,8 @@ static int FileAppendDataDo(File *ff, const uint8_t *data, uint32_t data_len)
 
     if (FileStoreNoStoreCheck(ff) == 1) {
 #ifdef HAVE_NSS
-        int hash_done = 0;
         /* no storage but forced hashing */
-        if (ff->md5_ctx) {
-            HASH_Update(ff->md5_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha1_ctx) {
-            HASH_Update(ff->sha1_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha256_ctx) {
-            HASH_Update(ff->sha256_ctx, data, data_len);
-            hash_done = 1;
-        }
-
-        if (hash_done)
+        if (FileHashUpdate(ff, data, data_len))
             SCReturnInt(0);
 #endif
         if (g_file_force_tracking || (!(ff->flags & FILE_NOTRACK)))
@@ -792,19 +821,24 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
     }
 
 #ifdef HAVE_NSS
-    if (!(ff->flags & FILE_NOMD5) || g_file_force_md5) {
+    const uint16_t hashes = FileHashesWanted(ff);
+    /* the magic for the loggers is looked up in the pool as well, the
+     * filemagic keyword does its own lookup */
+    ff->offload = FileOffloadNew(hashes,
+            g_file_force_magic && !(ff->flags & FILE_NOMAGIC));
+    if (ff->offload == NULL && (hashes & FILE_MD5)) {
         ff->md5_ctx = HASH_Create(HASH_AlgMD5);
         if (ff->md5_ctx != NULL) {
             HASH_Begin(ff->md5_ctx);
         }
     }
-    if (!(ff->flags & FILE_NOSHA1) || g_file_force_sha1) {
+    if (ff->offload == NULL && (hashes & FILE_SHA1)) {
         ff->sha1_ctx = HASH_Create(HASH_AlgSHA1);
         if (ff->sha1_ctx != NULL) {
             HASH_Begin(ff->sha1_ctx);
         }
     }
-    if (!(ff->flags & FILE_NOSHA256) || g_file_force_sha256) {
+    if (ff->offload == NULL && (hashes & FILE_SHA256)) {
         ff->sha256_ctx = HASH_Create(HASH_AlgSHA256);
         if (ff->sha256_ctx != NULL) {
             HASH_Begin(ff->sha256_ctx);
@@ -865,12 +899,7 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
         if (ff->flags & FILE_NOSTORE) {
 #ifdef HAVE_NSS
             /* no storage but hashing */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
-            if (ff->sha1_ctx)
-                HASH_Update(ff->sha1_ctx, data, data_len);
-            if (ff->sha256_ctx)
-                HASH_Update(ff->sha256_ctx, data, data_len);
+            (void)FileHashUpdate(ff, data, data_len);
 #endif
         } else {
             if (AppendData(ff, data, data_len) != 0) {
@@ -894,6 +923,11 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
             }
 #endif
         }
+#ifdef HAVE_NSS
+        /* the pool finishes all hashes, only sha256 is set as above */
+        FileOffloadEnd(ff, (!(flags & FILE_NOSTORE) && g_file_force_sha256) ?
+                FILE_SHA256 : 0);
+#endif
     } else {
         ff->state = FILE_STATE_CLOSED;
         SCLogDebug("flowfile state transitioned to FILE_STATE_CLOSED");
@@ -912,6 +946,8 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
         if (ff->sha256_ctx) {
             FileEndSha256(ff);
         }
+        /* hashes disabled since the file was opened are not set */
+        FileOffloadEnd(ff, FileHashesWanted(ff));
 #endif
     }
 
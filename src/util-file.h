@@ -89,6 +89,8 @@ typedef struct File_ {
                                      *   flag is set */
     uint64_t content_stored;
     uint64_t size;
+    struct FileOffload_ *offload;   /**< state in the offload pool, NULL if
+                                     *   hashed by the packet thread */
 } File;
 
 typedef struct FileContainer_ {
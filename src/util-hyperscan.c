@@ -57,4 +57,245 @@ char *HSRenderPattern(const uint8_t *pat, uint16_t pat_len)
     return str;
 }
 
+/* Scratch manager
+ *
+ * Hyperscan needs a scratch region per scanning thread, large enough
+ * for the database being scanned. Instead of a scratch per thread for
+ * each mpm, spm and pcre prefilter user, of each tenant and detect
+ * engine, every thread gets a single scratch that fits all databases
+ * compiled so far. Scratch is sized for the largest database, not the
+ * sum, so one region serves them all.
+ *
+ * Databases are registered with HSScratchAddDatabase(), which grows the
+ * prototype and bumps the generation if needed. HSScratchGet() returns
+ * the calling thread's scratch, cloning the prototype again if it grew
+ * since the last call. A thread only scans one database at a time, so
+ * sharing the region between the users is safe. */
+
+typedef struct HSThreadScratch_ {
+    hs_scratch_t *scratch;
+    size_t size;
+    /* prototype generation this scratch was cloned from */
+    uint32_t gen;
+} HSThreadScratch;
+
+static hs_scratch_t *g_hs_scratch_proto = NULL;
+static size_t g_hs_scratch_proto_size = 0;
+static SCMutex g_hs_scratch_mutex = SCMUTEX_INITIALIZER;
+static int g_hs_scratch_initialized = 0;
+static pthread_key_t g_hs_scratch_key;
+
+SC_ATOMIC_DECLARE(uint32_t, hs_scratch_gen);
+SC_ATOMIC_DECLARE(uint32_t, hs_scratch_threads);
+SC_ATOMIC_DECLARE(uint64_t, hs_scratch_memuse);
+
+#ifdef TLS
+static __thread HSThreadScratch *hs_thread_scratch = NULL;
+#endif
+
+static void HSThreadScratchFree(void *data)
+{
+    HSThreadScratch *ts = data;
+    if (ts == NULL)
+        return;
+
+    if (ts->scratch != NULL) {
+        hs_free_scratch(ts->scratch);
+        (void)SC_ATOMIC_SUB(hs_scratch_memuse, ts->size);
+        (void)SC_ATOMIC_SUB(hs_scratch_threads, 1);
+    }
+    SCFree(ts);
+}
+
+/**
+ * \brief Set up the scratch manager. Safe to call more than once.
+ */
+void HSScratchInit(void)
+{
+    SCMutexLock(&g_hs_scratch_mutex);
+    if (g_hs_scratch_initialized) {
+        SCMutexUnlock(&g_hs_scratch_mutex);
+        return;
+    }
+
+    SC_ATOMIC_INIT(hs_scratch_gen);
+    SC_ATOMIC_INIT(hs_scratch_threads);
+    SC_ATOMIC_INIT(hs_scratch_memuse);
+
+    /* the destructor frees the scratch of exiting threads */
+    int r = pthread_key_create(&g_hs_scratch_key, HSThreadScratchFree);
+    if (r != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "pthread_key_create failed with %d", r);
+        exit(EXIT_FAILURE);
+    }
+    g_hs_scratch_initialized = 1;
+    SCMutexUnlock(&g_hs_scratch_mutex);
+}
+
+/**
+ * \brief Make the scratch prototype large enough for a database.
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int HSScratchAddDatabase(const hs_database_t *db)
+{
+    size_t size = 0;
+
+    HSScratchInit();
+
+    SCMutexLock(&g_hs_scratch_mutex);
+    hs_error_t err = hs_alloc_scratch(db, &g_hs_scratch_proto);
+    if (err == HS_SUCCESS)
+        err = hs_scratch_size(g_hs_scratch_proto, &size);
+    if (err != HS_SUCCESS) {
+        SCMutexUnlock(&g_hs_scratch_mutex);
+        SCLogError(SC_ERR_FATAL, "failed to allocate scratch (error %d)", err);
+        return -1;
+    }
+
+    if (size != g_hs_scratch_proto_size) {
+        SCLogDebug("scratch prototype grew from %"PRIuMAX" to %"PRIuMAX" bytes",
+                (uintmax_t)g_hs_scratch_proto_size, (uintmax_t)size);
+        (void)SC_ATOMIC_ADD(hs_scratch_memuse, size - g_hs_scratch_proto_size);
+        g_hs_scratch_proto_size = size;
+        /* threads pick up the larger scratch on their next scan */
+        (void)SC_ATOMIC_ADD(hs_scratch_gen, 1);
+    }
+    SCMutexUnlock(&g_hs_scratch_mutex);
+    return 0;
+}
+
+static HSThreadScratch *HSThreadScratchLookup(void)
+{
+#ifdef TLS
+    HSThreadScratch *ts = hs_thread_scratch;
+#else
+    HSThreadScratch *ts = pthread_getspecific(g_hs_scratch_key);
+#endif
+    if (likely(ts != NULL))
+        return ts;
+
+    ts = SCCalloc(1, sizeof(*ts));
+    if (ts == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc thread scratch");
+        exit(EXIT_FAILURE);
+    }
+    int r = pthread_setspecific(g_hs_scratch_key, ts);
+    if (r != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "pthread_setspecific failed with %d", r);
+        exit(EXIT_FAILURE);
+    }
+#ifdef TLS
+    hs_thread_scratch = ts;
+#endif
+    return ts;
+}
+
+static void HSThreadScratchUpdate(HSThreadScratch *ts)
+{
+    hs_scratch_t *scratch = NULL;
+    size_t size = 0;
+    uint32_t gen;
+
+    SCMutexLock(&g_hs_scratch_mutex);
+    if (g_hs_scratch_proto == NULL) {
+        /* no database compiled yet */
+        SCMutexUnlock(&g_hs_scratch_mutex);
+        return;
+    }
+    hs_error_t err = hs_clone_scratch(g_hs_scratch_proto, &scratch);
+    size = g_hs_scratch_proto_size;
+    gen = SC_ATOMIC_GET(hs_scratch_gen);
+    SCMutexUnlock(&g_hs_scratch_mutex);
+
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "Unable to clone scratch prototype");
+        exit(EXIT_FAILURE);
+    }
+
+    if (ts->scratch != NULL) {
+        hs_free_scratch(ts->scratch);
+        (void)SC_ATOMIC_SUB(hs_scratch_memuse, ts->size);
+    } else {
+        (void)SC_ATOMIC_ADD(hs_scratch_threads, 1);
+    }
+    (void)SC_ATOMIC_ADD(hs_scratch_memuse, size);
+    ts->scratch = scratch;
+    ts->size = size;
+    ts->gen = gen;
+}
+
+/**
+ * \brief Get the scratch of the calling thread, large enough for every
+ *        database added with HSScratchAddDatabase().
+ *
+ * \retval scratch or NULL if no database was added yet
+ */
+hs_scratch_t *HSScratchGet(void)
+{
+    HSThreadScratch *ts = HSThreadScratchLookup();
+
+    if (unlikely(ts->scratch == NULL ||
+                ts->gen != SC_ATOMIC_GET(hs_scratch_gen))) {
+        HSThreadScratchUpdate(ts);
+    }
+    return ts->scratch;
+}
+
+static int HSScratchIsInitialized(void)
+{
+    SCMutexLock(&g_hs_scratch_mutex);
+    int initialized = g_hs_scratch_initialized;
+    SCMutexUnlock(&g_hs_scratch_mutex);
+    return initialized;
+}
+
+/**
+ * \brief Memory used by the scratch prototype and the thread scratches.
+ */
+uint64_t HSScratchGetMemuse(void)
+{
+    if (!HSScratchIsInitialized())
+        return 0;
+    return SC_ATOMIC_GET(hs_scratch_memuse);
+}
+
+/**
+ * \brief Free the prototype and the scratch of the calling thread. The
+ *        scratch of other threads is freed when they exit.
+ */
+void HSScratchCleanup(void)
+{
+    if (!HSScratchIsInitialized())
+        return;
+
+#ifdef TLS
+    HSThreadScratch *ts = hs_thread_scratch;
+    hs_thread_scratch = NULL;
+#else
+    HSThreadScratch *ts = pthread_getspecific(g_hs_scratch_key);
+#endif
+    if (ts != NULL) {
+        (void)pthread_setspecific(g_hs_scratch_key, NULL);
+        HSThreadScratchFree(ts);
+    }
+
+    SCMutexLock(&g_hs_scratch_mutex);
+    if (g_hs_scratch_proto != NULL) {
+        SCLogPerf("Cleaning up Hyperscan scratch: %"PRIuMAX" bytes per "
+                "thread, %u thread(s) still holding one",
+                (uintmax_t)g_hs_scratch_proto_size,
+                SC_ATOMIC_GET(hs_scratch_threads));
+        hs_free_scratch(g_hs_scratch_proto);
+        (void)SC_ATOMIC_SUB(hs_scratch_memuse, g_hs_scratch_proto_size);
+        g_hs_scratch_proto = NULL;
+        g_hs_scratch_proto_size = 0;
+        /* make remaining thread scratches re-clone if a new database is
+         * added later */
+        (void)SC_ATOMIC_ADD(hs_scratch_gen, 1);
+    }
+    SCMutexUnlock(&g_hs_scratch_mutex);
+}
+
 #endif /* BUILD_HYPERSCAN */
@@ -28,4 +28,14 @@
 
 char *HSRenderPattern(const uint8_t *pat, uint16_t pat_len);
 
+#ifdef BUILD_HYPERSCAN
+#include <hs.h>
+
+void HSScratchInit(void);
+int HSScratchAddDatabase(const hs_database_t *db);
+hs_scratch_t *HSScratchGet(void);
+uint64_t HSScratchGetMemuse(void);
+void HSScratchCleanup(void);
+#endif /* BUILD_HYPERSCAN */
+
 #endif /* __UTIL_HYPERSCAN__H__ */
@@ -0,0 +1,887 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Append only JSON writer for the eve loggers.
+ *
+ * Members are written to the MemBuffer as they are set, so the record
+ * is never held as a tree of jansson objects. To stay byte compatible
+ * with json_dump_callback() the writer follows jansson's rules:
+ *
+ * - strings that are NULL or not valid UTF-8 are dropped together with
+ *   their key, like json_object_set_new() drops a NULL json_string()
+ * - members with a key that is not valid UTF-8 are dropped, for objects
+ *   and arrays including everything set in them
+ * - escaping, \\uXXXX case and surrogate pairs are done the same way
+ * - separators follow JSON_COMPACT
+ *
+ * Keys are not checked for duplicates. A logger that sets a key twice
+ * gets it twice, where jansson would have replaced the first value.
+ *
+ * In msgpack mode the same rules apply for what is dropped. Containers
+ * are opened with a 5 byte map 32 or array 32 header, on close the
+ * member count is filled in and the header shrunk to the smallest form.
+ */
+
+#include "suricata-common.h"
+#include "util-json-builder.h"
+#include "util-msgpack.h"
+#include "util-unittest.h"
+#include "util-validate.h"
+
+#ifdef HAVE_LIBJANSSON
+
+/** expand the buffer by at least this much */
+#define JSON_BUILDER_EXPAND_SIZE    65536
+
+/** escaped length of the ascii characters, '/' is handled by the caller
+ *  as it depends on JSON_ESCAPE_SLASH */
+static const uint8_t json_escape_len[128] = {
+    6, 6, 6, 6, 6, 6, 6, 6, 2, 2, 2, 6, 2, 2, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+static const char json_hex[] = "0123456789ABCDEF";
+
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer, size_t flags)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->buffer = buffer;
+    jb->flags = flags;
+}
+
+void JsonBuilderInitMsgpack(JsonBuilder *jb, MemBuffer **buffer,
+        struct MsgpackCtx_ *ctx)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->buffer = buffer;
+    jb->msgpack = ctx;
+}
+
+/**
+ * \brief decode the UTF-8 sequence at s
+ *
+ * Same checks as jansson's utf8_check_first() and utf8_check_full():
+ * no overlong forms, no surrogates and nothing above U+10FFFF.
+ *
+ * \param size set to the length of the sequence
+ * \retval codepoint or -1 if s doesn't start with a valid sequence
+ */
+static int32_t JsonUtf8Decode(const uint8_t *s, size_t len, uint32_t *size)
+{
+    const uint8_t c = s[0];
+    uint32_t n;
+    int32_t cp;
+
+    if (c < 0xc2) {
+        /* continuation byte or overlong 2 byte form */
+        return -1;
+    } else if (c < 0xe0) {
+        n = 2;
+        cp = c & 0x1f;
+    } else if (c < 0xf0) {
+        n = 3;
+        cp = c & 0x0f;
+    } else if (c < 0xf5) {
+        n = 4;
+        cp = c & 0x07;
+    } else {
+        return -1;
+    }
+    if (n > len)
+        return -1;
+
+    for (uint32_t i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return -1;
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+
+    if (cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+        return -1;
+    if ((n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000))
+        return -1;
+
+    *size = n;
+    return cp;
+}
+
+/**
+ * \brief get the length of str as an escaped JSON string, without the
+ *        quotes
+ *
+ * \retval length or -1 if str is not valid UTF-8
+ */
+static int64_t JsonEscapedLen(const JsonBuilder *jb, const char *str, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)str;
+    const bool slash = (jb->flags & JSON_ESCAPE_SLASH) != 0;
+    const bool ascii = (jb->flags & JSON_ENSURE_ASCII) != 0;
+    int64_t elen = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        const uint8_t c = s[i];
+        if (c < 0x80) {
+            elen += json_escape_len[c];
+            if (c == '/' && slash)
+                elen++;
+            i++;
+            continue;
+        }
+
+        uint32_t n;
+        int32_t cp = JsonUtf8Decode(s + i, len - i, &n);
+        if (cp < 0)
+            return -1;
+        if (ascii)
+            elen += (cp < 0x10000) ? 6 : 12;
+        else
+            elen += n;
+        i += n;
+    }
+    return elen;
+}
+
+static inline uint8_t *JsonWriteU16(uint8_t *dst, uint32_t v)
+{
+    *dst++ = '\\';
+    *dst++ = 'u';
+    *dst++ = json_hex[(v >> 12) & 0xf];
+    *dst++ = json_hex[(v >> 8) & 0xf];
+    *dst++ = json_hex[(v >> 4) & 0xf];
+    *dst++ = json_hex[v & 0xf];
+    return dst;
+}
+
+/**
+ * \brief write str escaped, str must have passed JsonEscapedLen()
+ */
+static uint8_t *JsonWriteEscaped(const JsonBuilder *jb, uint8_t *dst,
+        const char *str, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)str;
+    const bool slash = (jb->flags & JSON_ESCAPE_SLASH) != 0;
+    const bool ascii = (jb->flags & JSON_ENSURE_ASCII) != 0;
+    size_t i = 0;
+
+    while (i < len) {
+        /* copy the run of characters that don't need escaping */
+        size_t run = i;
+        while (run < len && s[run] < 0x80 && json_escape_len[s[run]] == 1 &&
+                !(s[run] == '/' && slash))
+            run++;
+        if (run > i) {
+            memcpy(dst, s + i, run - i);
+            dst += run - i;
+            i = run;
+            if (i == len)
+                break;
+        }
+
+        const uint8_t c = s[i];
+        if (c < 0x80) {
+            char e;
+            switch (c) {
+                case '"':  e = '"'; break;
+                case '\\': e = '\\'; break;
+                case '/':  e = '/'; break;
+                case '\b': e = 'b'; break;
+                case '\f': e = 'f'; break;
+                case '\n': e = 'n'; break;
+                case '\r': e = 'r'; break;
+                case '\t': e = 't'; break;
+                default:   e = 0; break;
+            }
+            if (e != 0) {
+                *dst++ = '\\';
+                *dst++ = e;
+            } else {
+                dst = JsonWriteU16(dst, c);
+            }
+            i++;
+            continue;
+        }
+
+        uint32_t n = 1;
+        int32_t cp = JsonUtf8Decode(s + i, len - i, &n);
+        if (!ascii) {
+            memcpy(dst, s + i, n);
+            dst += n;
+        } else if (cp < 0x10000) {
+            dst = JsonWriteU16(dst, cp);
+        } else {
+            /* surrogate pair */
+            cp -= 0x10000;
+            dst = JsonWriteU16(dst, 0xd800 | ((cp & 0xffc00) >> 10));
+            dst = JsonWriteU16(dst, 0xdc00 | (cp & 0x3ff));
+        }
+        i += n;
+    }
+    return dst;
+}
+
+/**
+ * \brief make sure len more bytes and the terminating nul fit
+ */
+static int JsonBuilderReserve(JsonBuilder *jb, uint64_t len)
+{
+    MemBuffer *b = *jb->buffer;
+    if ((uint64_t)b->offset + len < b->size)
+        return 0;
+
+    uint64_t expand_by = JSON_BUILDER_EXPAND_SIZE;
+    while ((uint64_t)b->offset + len >= b->size + expand_by)
+        expand_by += JSON_BUILDER_EXPAND_SIZE;
+    if (expand_by > UINT32_MAX ||
+            MemBufferExpand(jb->buffer, (uint32_t)expand_by) < 0) {
+        jb->error = true;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief write the separator and the key of a new member
+ *
+ * \param key member name, NULL for array elements
+ * \param vlen bytes to reserve for the value
+ *
+ * \retval dst where the value is to be written, NULL if the member is
+ *         to be dropped
+ */
+static uint8_t *JsonBuilderBeginMember(JsonBuilder *jb, const char *key,
+        uint64_t vlen)
+{
+    if (unlikely(jb->error) || jb->discard > 0)
+        return NULL;
+
+    const uint64_t bit = 1ULL << jb->depth;
+    const bool object = jb->depth > 0 && !(jb->arrays & bit);
+    const bool compact = (jb->flags & JSON_COMPACT) != 0;
+    size_t klen = 0;
+    int64_t elen = 0;
+
+    if (object) {
+        if (key == NULL) {
+            DEBUG_VALIDATE_BUG_ON(1);
+            return NULL;
+        }
+        klen = strlen(key);
+        elen = JsonEscapedLen(jb, key, klen);
+        if (elen < 0)
+            return NULL;
+    } else if (jb->depth == 0 && (jb->members & bit)) {
+        /* only a single top level value */
+        DEBUG_VALIDATE_BUG_ON(1);
+        return NULL;
+    }
+
+    if (jb->msgpack != NULL) {
+        if (JsonBuilderReserve(jb, MSGPACK_STR_MAX_LEN(klen) + vlen) < 0)
+            return NULL;
+
+        MemBuffer *b = *jb->buffer;
+        uint8_t *dst = b->buffer + b->offset;
+        jb->intern = false;
+        if (object) {
+            int64_t id = MsgpackIntern(jb->msgpack, key, klen, &jb->intern);
+            if (id >= 0)
+                dst = MsgpackWriteStringRef(dst, (uint32_t)id);
+            else
+                dst = MsgpackWriteStr(dst, key, klen);
+        }
+        jb->counts[jb->depth]++;
+        jb->members |= bit;
+        return dst;
+    }
+
+    if (JsonBuilderReserve(jb, 2 + elen + 4 + vlen) < 0)
+        return NULL;
+
+    MemBuffer *b = *jb->buffer;
+    uint8_t *dst = b->buffer + b->offset;
+    if (jb->members & bit) {
+        *dst++ = ',';
+        if (!compact)
+            *dst++ = ' ';
+    }
+    if (object) {
+        *dst++ = '"';
+        dst = JsonWriteEscaped(jb, dst, key, klen);
+        *dst++ = '"';
+        *dst++ = ':';
+        if (!compact)
+            *dst++ = ' ';
+    }
+    jb->members |= bit;
+    return dst;
+}
+
+static inline void JsonBuilderEndMember(JsonBuilder *jb, uint8_t *dst)
+{
+    MemBuffer *b = *jb->buffer;
+    b->offset = (uint32_t)(dst - b->buffer);
+    *dst = '\0';
+}
+
+static void JsonBuilderOpen(JsonBuilder *jb, const char *key, bool array)
+{
+    if (unlikely(jb->depth + 1 >= JSON_BUILDER_MAX_DEPTH)) {
+        jb->error = true;
+        jb->discard++;
+        return;
+    }
+
+    uint8_t *dst = JsonBuilderBeginMember(jb, key, 5);
+    if (dst == NULL) {
+        /* drop the container and everything in it */
+        jb->discard++;
+        return;
+    }
+    if (jb->msgpack != NULL) {
+        jb->offsets[jb->depth + 1] = dst - (*jb->buffer)->buffer;
+        jb->counts[jb->depth + 1] = 0;
+        *dst++ = array ? 0xdd : 0xdf;
+        memset(dst, 0, 4);
+        dst += 4;
+    } else {
+        *dst++ = array ? '[' : '{';
+    }
+    JsonBuilderEndMember(jb, dst);
+
+    jb->depth++;
+    const uint64_t bit = 1ULL << jb->depth;
+    jb->members &= ~bit;
+    if (array)
+        jb->arrays |= bit;
+    else
+        jb->arrays &= ~bit;
+}
+
+/**
+ * \brief open an object
+ *
+ * \param key member name, NULL for the top level object and for
+ *        objects in an array
+ */
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, false);
+}
+
+/**
+ * \brief open an array
+ *
+ * \param key member name, NULL for arrays in an array
+ */
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, true);
+}
+
+/**
+ * \brief close the innermost object or array
+ */
+void JsonBuilderClose(JsonBuilder *jb)
+{
+    if (jb->discard > 0) {
+        jb->discard--;
+        return;
+    }
+    if (unlikely(jb->depth == 0)) {
+        DEBUG_VALIDATE_BUG_ON(1);
+        return;
+    }
+
+    const bool array = (jb->arrays & (1ULL << jb->depth)) != 0;
+    jb->depth--;
+    if (unlikely(jb->error))
+        return;
+
+    if (jb->msgpack != NULL) {
+        MemBuffer *b = *jb->buffer;
+        const uint32_t start = jb->offsets[jb->depth + 1];
+        uint8_t hdr[5];
+        uint32_t hlen = MsgpackWriteContainer(hdr, array,
+                jb->counts[jb->depth + 1]) - hdr;
+        memcpy(b->buffer + start, hdr, hlen);
+        if (hlen < sizeof(hdr)) {
+            memmove(b->buffer + start + hlen, b->buffer + start + sizeof(hdr),
+                    b->offset - start - sizeof(hdr));
+            JsonBuilderEndMember(jb, b->buffer + b->offset -
+                    (sizeof(hdr) - hlen));
+        }
+        return;
+    }
+
+    if (JsonBuilderReserve(jb, 1) < 0)
+        return;
+
+    MemBuffer *b = *jb->buffer;
+    uint8_t *dst = b->buffer + b->offset;
+    *dst++ = array ? ']' : '}';
+    JsonBuilderEndMember(jb, dst);
+}
+
+/**
+ * \brief set a string member
+ *
+ * Like json_object_set_new(js, key, json_string(str)), the member is
+ * not written if str is NULL or not valid UTF-8.
+ *
+ * \param key member name, NULL for array elements
+ */
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *str)
+{
+    if (str == NULL)
+        return;
+
+    const size_t len = strlen(str);
+    const int64_t elen = JsonEscapedLen(jb, str, len);
+    if (elen < 0)
+        return;
+
+    if (jb->msgpack != NULL) {
+        uint8_t *dst = JsonBuilderBeginMember(jb, key, MSGPACK_STR_MAX_LEN(len));
+        if (dst == NULL)
+            return;
+        dst = MsgpackWriteValue(jb->msgpack, dst, str, len, jb->intern);
+        JsonBuilderEndMember(jb, dst);
+        return;
+    }
+
+    uint8_t *dst = JsonBuilderBeginMember(jb, key, elen + 2);
+    if (dst == NULL)
+        return;
+    *dst++ = '"';
+    dst = JsonWriteEscaped(jb, dst, str, len);
+    *dst++ = '"';
+    JsonBuilderEndMember(jb, dst);
+}
+
+/**
+ * \brief set an integer member, formatted like jansson's json_integer()
+ *
+ * \param key member name, NULL for array elements
+ */
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    if (jb->msgpack != NULL) {
+        uint8_t *dst = JsonBuilderBeginMember(jb, key, MSGPACK_MAX_SCALAR_LEN);
+        if (dst != NULL)
+            JsonBuilderEndMember(jb, MsgpackWriteInt(dst, val));
+        return;
+    }
+
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = (val < 0) ? -(uint64_t)val : (uint64_t)val;
+
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (val < 0)
+        *--p = '-';
+
+    const size_t len = tmp + sizeof(tmp) - p;
+    uint8_t *dst = JsonBuilderBeginMember(jb, key, len);
+    if (dst == NULL)
+        return;
+    memcpy(dst, p, len);
+    JsonBuilderEndMember(jb, dst + len);
+}
+
+/**
+ * \brief set a true or false member
+ *
+ * \param key member name, NULL for array elements
+ */
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val)
+{
+    if (jb->msgpack != NULL) {
+        uint8_t *dst = JsonBuilderBeginMember(jb, key, 1);
+        if (dst != NULL)
+            JsonBuilderEndMember(jb, MsgpackWriteBool(dst, val != 0));
+        return;
+    }
+
+    const char *str = val ? "true" : "false";
+    const size_t len = val ? 4 : 5;
+
+    uint8_t *dst = JsonBuilderBeginMember(jb, key, len);
+    if (dst == NULL)
+        return;
+    memcpy(dst, str, len);
+    JsonBuilderEndMember(jb, dst + len);
+}
+
+static int JsonBuilderDumpCallback(const char *str, size_t size, void *data)
+{
+    JsonBuilder *jb = data;
+    if (JsonBuilderReserve(jb, size) < 0)
+        return -1;
+
+    MemBuffer *b = *jb->buffer;
+    memcpy(b->buffer + b->offset, str, size);
+    JsonBuilderEndMember(jb, b->buffer + b->offset + size);
+    return 0;
+}
+
+/**
+ * \brief set a member from a jansson value
+ *
+ * For parts of a record that are still built as a jansson tree, e.g. by
+ * functions shared with other loggers. The value is dumped with the
+ * builder's flags. js is not released.
+ *
+ * \param key member name, NULL for array elements
+ */
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, const json_t *js)
+{
+    if (js == NULL)
+        return;
+
+    uint8_t *dst = JsonBuilderBeginMember(jb, key, 0);
+    if (dst == NULL)
+        return;
+    JsonBuilderEndMember(jb, dst);
+
+    if (jb->msgpack != NULL) {
+        if (MsgpackWriteJson(jb->msgpack, jb->buffer, js, jb->intern) < 0)
+            jb->error = true;
+        return;
+    }
+
+    if (json_dump_callback(js, JsonBuilderDumpCallback, jb,
+                jb->flags | JSON_ENCODE_ANY) != 0) {
+        jb->error = true;
+    }
+}
+
+#ifdef UNITTESTS
+
+#define JB_TEST_FLAGS (JSON_PRESERVE_ORDER|JSON_COMPACT| \
+        JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH)
+
+/** \test check the builder output against a literal and against jansson
+ *  dumping the tree built with the same calls */
+static int JsonBuilderTestCompare(MemBuffer *b, json_t *js, size_t flags,
+        const char *expected)
+{
+    if (strcmp((const char *)b->buffer, expected) != 0) {
+        printf("builder: %s\nexpected: %s\n", b->buffer, expected);
+        return 0;
+    }
+    char *str = json_dumps(js, flags);
+    if (str == NULL)
+        return 0;
+    int r = (strcmp(str, expected) == 0);
+    if (!r)
+        printf("jansson: %s\nexpected: %s\n", str, expected);
+    free(str);
+    return r;
+}
+
+/** \test nesting, integers and booleans */
+static int JsonBuilderTest01(void)
+{
+    MemBuffer *b = MemBufferCreateNew(256);
+    FAIL_IF_NULL(b);
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &b, JB_TEST_FLAGS);
+
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "timestamp", "2018-01-01T00:00:00.000000+0000");
+    JsonBuilderSetInt(&jb, "flow_id", 1234567890123LL);
+    JsonBuilderSetInt(&jb, "neg", INT64_MIN);
+    JsonBuilderOpenArray(&jb, "vlan");
+    JsonBuilderSetInt(&jb, NULL, 10);
+    JsonBuilderSetInt(&jb, NULL, 0);
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenObject(&jb, "alert");
+    JsonBuilderSetBool(&jb, "a", 1);
+    JsonBuilderSetBool(&jb, "b", 0);
+    JsonBuilderOpenObject(&jb, "empty");
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenArray(&jb, "nested");
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "x", "y");
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenArray(&jb, NULL);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderIsComplete(&jb));
+
+    json_t *js = json_object();
+    json_object_set_new(js, "timestamp", json_string("2018-01-01T00:00:00.000000+0000"));
+    json_object_set_new(js, "flow_id", json_integer(1234567890123LL));
+    json_object_set_new(js, "neg", json_integer(INT64_MIN));
+    json_t *vlan = json_array();
+    json_array_append_new(vlan, json_integer(10));
+    json_array_append_new(vlan, json_integer(0));
+    json_object_set_new(js, "vlan", vlan);
+    json_t *ajs = json_object();
+    json_object_set_new(ajs, "a", json_true());
+    json_object_set_new(ajs, "b", json_false());
+    json_object_set_new(ajs, "empty", json_object());
+    json_t *nested = json_array();
+    json_t *x = json_object();
+    json_object_set_new(x, "x", json_string("y"));
+    json_array_append_new(nested, x);
+    json_array_append_new(nested, json_array());
+    json_object_set_new(ajs, "nested", nested);
+    json_object_set_new(js, "alert", ajs);
+
+    FAIL_IF_NOT(JsonBuilderTestCompare(b, js, JB_TEST_FLAGS,
+                "{\"timestamp\":\"2018-01-01T00:00:00.000000+0000\","
+                "\"flow_id\":1234567890123,\"neg\":-9223372036854775808,"
+                "\"vlan\":[10,0],\"alert\":{\"a\":true,\"b\":false,"
+                "\"empty\":{},\"nested\":[{\"x\":\"y\"},[]]}}"));
+
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test escaping with and without JSON_ENSURE_ASCII and JSON_ESCAPE_SLASH */
+static int JsonBuilderTest02(void)
+{
+    /* control chars, quote, backslash, slash, U+00E9, U+20AC, U+1F600 */
+    const char *str = "a\"b\\c/d\b\f\n\r\t\x01\x1f\x7f"
+        "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+    MemBuffer *b = MemBufferCreateNew(256);
+    FAIL_IF_NULL(b);
+    JsonBuilder jb;
+
+    JsonBuilderInit(&jb, &b, JB_TEST_FLAGS);
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "k/\xc3\xa9", str);
+    JsonBuilderClose(&jb);
+
+    json_t *js = json_object();
+    json_object_set_new(js, "k/\xc3\xa9", json_string(str));
+    FAIL_IF_NOT(JsonBuilderTestCompare(b, js, JB_TEST_FLAGS,
+                "{\"k\\/\\u00E9\":\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\\u0001"
+                "\\u001F\x7f\\u00E9\\u20AC\\uD83D\\uDE00\"}"));
+
+    MemBufferReset(b);
+    JsonBuilderInit(&jb, &b, JSON_PRESERVE_ORDER);
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "k/\xc3\xa9", str);
+    JsonBuilderSetInt(&jb, "i", 1);
+    JsonBuilderClose(&jb);
+
+    json_object_set_new(js, "i", json_integer(1));
+    FAIL_IF_NOT(JsonBuilderTestCompare(b, js, JSON_PRESERVE_ORDER,
+                "{\"k/\xc3\xa9\": \"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001"
+                "\\u001F\x7f\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\", \"i\": 1}"));
+
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test NULL and invalid UTF-8 strings and keys are dropped */
+static int JsonBuilderTest03(void)
+{
+    static const char *invalid[] = {
+        "\x80",                 /* lone continuation byte */
+        "\xc0\xaf",             /* overlong '/' */
+        "\xe0\x80\xaf",         /* overlong '/' */
+        "\xed\xa0\x80",         /* surrogate */
+        "\xf4\x90\x80\x80",     /* above U+10FFFF */
+        "\xc3",                 /* truncated */
+        "\xe2\x82",             /* truncated */
+        "\xf8\x88\x80\x80\x80", /* 5 byte form */
+    };
+    MemBuffer *b = MemBufferCreateNew(256);
+    FAIL_IF_NULL(b);
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &b, JB_TEST_FLAGS);
+    json_t *js = json_object();
+
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "null", NULL);
+    json_object_set_new(js, "null", json_string(NULL));
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        JsonBuilderSetString(&jb, "s", invalid[i]);
+        json_object_set_new(js, "s", json_string(invalid[i]));
+        JsonBuilderSetInt(&jb, invalid[i], 1);
+        json_object_set_new(js, invalid[i], json_integer(1));
+    }
+    JsonBuilderOpenObject(&jb, "\xc3");
+    JsonBuilderSetInt(&jb, "x", 1);
+    JsonBuilderOpenArray(&jb, "y");
+    JsonBuilderSetInt(&jb, NULL, 1);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    json_t *o = json_object();
+    json_object_set_new(o, "x", json_integer(1));
+    json_object_set_new(js, "\xc3", o);
+
+    JsonBuilderOpenArray(&jb, "a");
+    JsonBuilderSetString(&jb, NULL, "\xc3");
+    JsonBuilderSetString(&jb, NULL, "ok");
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderIsComplete(&jb));
+
+    json_t *a = json_array();
+    json_array_append_new(a, json_string("\xc3"));
+    json_array_append_new(a, json_string("ok"));
+    json_object_set_new(js, "a", a);
+
+    FAIL_IF_NOT(JsonBuilderTestCompare(b, js, JB_TEST_FLAGS,
+                "{\"a\":[\"ok\"]}"));
+
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test jansson values and growing the buffer */
+static int JsonBuilderTest04(void)
+{
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &b, JB_TEST_FLAGS);
+
+    char big[100000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    json_t *sub = json_object();
+    json_object_set_new(sub, "url", json_string("/index.html"));
+    json_object_set_new(sub, "status", json_integer(200));
+
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetJson(&jb, "http", sub);
+    JsonBuilderSetJson(&jb, "none", NULL);
+    JsonBuilderSetString(&jb, "big", big);
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderIsComplete(&jb));
+
+    const char *head = "{\"http\":{\"url\":\"\\/index.html\",\"status\":200},"
+        "\"big\":\"";
+    FAIL_IF(b->offset != strlen(head) + sizeof(big) - 1 + 2);
+    FAIL_IF(strncmp((const char *)b->buffer, head, strlen(head)) != 0);
+    FAIL_IF(memcmp(b->buffer + b->offset - 4, "xx\"}", 4) != 0);
+    FAIL_IF(b->buffer[b->offset] != '\0');
+
+    json_decref(sub);
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test msgpack mode gives the same bytes as encoding the jansson tree
+ *  built with the same calls */
+static int JsonBuilderTest05(void)
+{
+    MsgpackCtx *ctx1 = MsgpackCtxNew(0, NULL);
+    FAIL_IF_NULL(ctx1);
+    MsgpackCtx *ctx2 = MsgpackCtxNew(0, NULL);
+    FAIL_IF_NULL(ctx2);
+    MemBuffer *b1 = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b1);
+    MemBuffer *b2 = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b2);
+    JsonBuilder jb;
+    JsonBuilderInitMsgpack(&jb, &b1, ctx1);
+    json_t *js = json_object();
+
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "timestamp", "2018-01-01T00:00:00.000000+0000");
+    json_object_set_new(js, "timestamp",
+            json_string("2018-01-01T00:00:00.000000+0000"));
+    JsonBuilderSetString(&jb, "event_type", "alert");
+    json_object_set_new(js, "event_type", json_string("alert"));
+    JsonBuilderSetString(&jb, "bad", "\xc3");
+    JsonBuilderSetInt(&jb, "\xc3", 1);
+
+    /* map 16 after shrinking */
+    JsonBuilderOpenObject(&jb, "many");
+    json_t *many = json_object();
+    for (int i = 0; i < 20; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        JsonBuilderSetInt(&jb, key, i * 1000);
+        json_object_set_new(many, key, json_integer(i * 1000));
+    }
+    JsonBuilderClose(&jb);
+    json_object_set_new(js, "many", many);
+
+    JsonBuilderOpenArray(&jb, "arr");
+    JsonBuilderSetBool(&jb, NULL, 1);
+    JsonBuilderSetString(&jb, NULL, "alert");
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    json_t *arr = json_array();
+    json_array_append_new(arr, json_true());
+    json_array_append_new(arr, json_string("alert"));
+    json_array_append_new(arr, json_object());
+    json_object_set_new(js, "arr", arr);
+
+    json_t *sub = json_object();
+    json_object_set_new(sub, "proto", json_string("TCP"));
+    json_object_set_new(sub, "r", json_real(0.5));
+    JsonBuilderSetJson(&jb, "sub", sub);
+    json_object_set_new(js, "sub", sub);
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderIsComplete(&jb));
+
+    FAIL_IF(MsgpackWriteJson(ctx2, &b2, js, false) != 0);
+    FAIL_IF_NOT(b1->offset == b2->offset);
+    FAIL_IF(memcmp(b1->buffer, b2->buffer, b1->offset) != 0);
+    FAIL_IF_NOT(b1->buffer[0] == 0x85);
+    FAIL_IF_NOT(MsgpackStringCount(ctx1) == MsgpackStringCount(ctx2));
+
+    json_decref(js);
+    MemBufferFree(b1);
+    MemBufferFree(b2);
+    MsgpackCtxFree(ctx1);
+    MsgpackCtxFree(ctx2);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03);
+    UtRegisterTest("JsonBuilderTest04", JsonBuilderTest04);
+    UtRegisterTest("JsonBuilderTest05", JsonBuilderTest05);
+#endif
+}
+
+#endif /* HAVE_LIBJANSSON */
@@ -0,0 +1,90 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Append only JSON writer that serializes straight into a MemBuffer,
+ * without building a jansson tree first. The output is the same as
+ * json_dump_callback() with JSON_PRESERVE_ORDER for the same sequence
+ * of json_object_set_new() calls.
+ *
+ * Initialized with JsonBuilderInitMsgpack() the same calls write the
+ * record as MessagePack instead, see util-msgpack.h.
+ */
+
+#ifndef __UTIL_JSON_BUILDER_H__
+#define __UTIL_JSON_BUILDER_H__
+
+#ifdef HAVE_LIBJANSSON
+
+#include "util-buffer.h"
+
+/** max nesting of objects and arrays */
+#define JSON_BUILDER_MAX_DEPTH  64
+
+typedef struct JsonBuilder_ {
+    MemBuffer **buffer;
+    /* jansson dump flags: JSON_COMPACT, JSON_ENSURE_ASCII and
+     * JSON_ESCAPE_SLASH are honoured */
+    size_t flags;
+    /* nesting depth, 0 before the top level object is opened */
+    uint32_t depth;
+    /* bit per depth: a member was written at that depth */
+    uint64_t members;
+    /* bit per depth: the container at that depth is an array */
+    uint64_t arrays;
+    /* nesting of dropped containers, e.g. opened with an invalid key */
+    uint32_t discard;
+    /* set if the buffer could not be expanded, the output is invalid */
+    bool error;
+
+    /* msgpack mode: string table of the output, NULL for JSON */
+    struct MsgpackCtx_ *msgpack;
+    /* the value of the current member is to be interned */
+    bool intern;
+    /* per depth: members written and offset of the container header,
+     * which is patched on close */
+    uint32_t counts[JSON_BUILDER_MAX_DEPTH];
+    uint32_t offsets[JSON_BUILDER_MAX_DEPTH];
+} JsonBuilder;
+
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer, size_t flags);
+void JsonBuilderInitMsgpack(JsonBuilder *jb, MemBuffer **buffer,
+        struct MsgpackCtx_ *ctx);
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key);
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key);
+void JsonBuilderClose(JsonBuilder *jb);
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *str);
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val);
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val);
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, const json_t *js);
+
+/** \brief check that the top level object is closed and no write failed */
+static inline bool JsonBuilderIsComplete(const JsonBuilder *jb)
+{
+    return (jb->depth == 0 && jb->discard == 0 && jb->members != 0 &&
+            !jb->error);
+}
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* HAVE_LIBJANSSON */
+
+#endif /* __UTIL_JSON_BUILDER_H__ */
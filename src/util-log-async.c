@@ -0,0 +1,868 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous writer for LogFileCtx outputs.
+ *
+ * Each logging thread gets a single producer, single consumer ring per
+ * output. LogFileWrite() only copies the record into the ring, so a slow
+ * disk or a stalled socket consumer no longer blocks packet processing.
+ * A writer thread per output drains all rings. Regular files are written
+ * with one writev() per batch, other types record by record with the
+ * original write function. Outputs that can send a batch at once, like
+ * redis, pass their own batch function.
+ *
+ * When a ring is full the record is dropped, or with "on-full: block"
+ * the logging thread waits for the writer.
+ *
+ * Records that don't fit a ring are written by the logging thread
+ * itself. With a batch function that is a batch of one record, as the
+ * write function of such outputs only works in the writer.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-logopenfile.h"
+#include "util-log-async.h"
+#include "util-unittest.h"
+
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define LOG_ASYNC_DEFAULT_BUFFER_SIZE   (1024 * 1024)
+#define LOG_ASYNC_MIN_BUFFER_SIZE       (4 * 1024)
+#define LOG_ASYNC_DEFAULT_BATCH_SIZE    256
+/** max time a record waits in a ring if the rings don't fill up */
+#define LOG_ASYNC_FLUSH_USEC            10000
+
+/** ring record header value that marks the unused end of the ring */
+#define LOG_ASYNC_WRAP                  UINT32_MAX
+#define LOG_ASYNC_ALIGN(len)            (((len) + 7) & ~7)
+
+/** single producer, single consumer ring of records: a 4 byte length
+ *  followed by the data, padded to 8 bytes */
+typedef struct LogAsyncRing_ {
+    uint8_t *buffer;
+    /** size of the buffer, power of 2 */
+    uint32_t size;
+    /** positions are not wrapped, the offset is pos & (size - 1) */
+    SC_ATOMIC_DECLARE(uint64_t, head);  /**< written by the producer */
+    SC_ATOMIC_DECLARE(uint64_t, tail);  /**< written by the writer */
+    /** records dropped because the ring was full, producer only */
+    uint64_t dropped;
+} LogAsyncRing;
+
+typedef struct LogAsyncCtx_ {
+    struct LogFileCtx_ *file_ctx;
+    /** the write function of the file_ctx, called from the writer */
+    int (*Write)(const char *buffer, int buffer_len, struct LogFileCtx_ *fp);
+    /** optional, writes a whole batch instead of the above */
+    LogAsyncBatchFunc Batch;
+    /** Batch is called by the writer and by direct writes */
+    SCMutex batch_mutex;
+    /** records dropped on direct writes */
+    SC_ATOMIC_DECLARE(uint64_t, direct_dropped);
+
+    uint32_t ring_size;
+    uint32_t batch_size;
+    bool block;
+
+    /** owner id of the rings in the thread cache */
+    uint32_t id;
+
+    /** rings of all logging threads, only added until the ctx is freed */
+    SCMutex rings_mutex;
+    LogAsyncRing **rings;
+    uint32_t rings_cnt;
+    uint32_t rings_max;
+
+    pthread_t thread;
+    bool running;
+    SC_ATOMIC_DECLARE(int, stop);
+    /** set by the writer while the output can't take records */
+    SC_ATOMIC_DECLARE(int, stalled);
+    SCCtrlMutex wakeup_mutex;
+    SCCtrlCondT wakeup_cond;
+
+    /* writer stats, only written by the writer */
+    uint64_t records;
+    uint64_t writes;
+    uint64_t write_usec;
+    uint64_t write_usec_max;
+    uint64_t write_errors;
+
+    TAILQ_ENTRY(LogAsyncCtx_) next;
+} LogAsyncCtx;
+
+/* all async outputs, for the stats counters */
+static TAILQ_HEAD(, LogAsyncCtx_) log_async_list =
+    TAILQ_HEAD_INITIALIZER(log_async_list);
+static SCMutex log_async_list_mutex = SCMUTEX_INITIALIZER;
+static bool log_async_counters_registered = false;
+
+static uint64_t LogAsyncNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline uint32_t LogAsyncRingUsed(LogAsyncRing *r)
+{
+    return (uint32_t)(SC_ATOMIC_GET(r->head) - SC_ATOMIC_GET(r->tail));
+}
+
+static void LogAsyncWakeup(LogAsyncCtx *actx)
+{
+    SCCtrlMutexLock(&actx->wakeup_mutex);
+    SCCtrlCondSignal(&actx->wakeup_cond);
+    SCCtrlMutexUnlock(&actx->wakeup_mutex);
+}
+
+static LogAsyncRing *LogAsyncRingNew(uint32_t size)
+{
+    LogAsyncRing *r = SCCalloc(1, sizeof(*r));
+    if (unlikely(r == NULL))
+        return NULL;
+    r->buffer = SCMallocAligned(size, 64);
+    if (unlikely(r->buffer == NULL)) {
+        SCFree(r);
+        return NULL;
+    }
+    r->size = size;
+    SC_ATOMIC_INIT(r->head);
+    SC_ATOMIC_INIT(r->tail);
+    return r;
+}
+
+static void LogAsyncRingFree(LogAsyncRing *r)
+{
+    SCFreeAligned(r->buffer);
+    SC_ATOMIC_DESTROY(r->head);
+    SC_ATOMIC_DESTROY(r->tail);
+    SCFree(r);
+}
+
+/**
+ * \brief get the ring of the calling thread, add one on first use
+ *
+ * \retval NULL if the thread has no ring, its records are written
+ *         directly then
+ */
+static LogAsyncRing *LogAsyncRingGet(LogAsyncCtx *actx)
+{
+    void **slot = LogThreadCacheSlot(actx->id);
+    if (unlikely(slot == NULL))
+        return NULL;
+    if (likely(*slot != NULL))
+        return *slot;
+
+    LogAsyncRing *r = LogAsyncRingNew(actx->ring_size);
+    if (unlikely(r == NULL))
+        return NULL;
+
+    SCMutexLock(&actx->rings_mutex);
+    if (actx->rings_cnt == actx->rings_max) {
+        uint32_t max = actx->rings_max ? actx->rings_max * 2 : 8;
+        LogAsyncRing **rings = SCRealloc(actx->rings, max * sizeof(*rings));
+        if (unlikely(rings == NULL)) {
+            SCMutexUnlock(&actx->rings_mutex);
+            LogAsyncRingFree(r);
+            return NULL;
+        }
+        actx->rings = rings;
+        actx->rings_max = max;
+    }
+    actx->rings[actx->rings_cnt++] = r;
+    SCMutexUnlock(&actx->rings_mutex);
+
+    *slot = r;
+    return r;
+}
+
+/**
+ * \brief wait for the writer to write out all records of a ring
+ *
+ * \retval 0 ring is empty
+ * \retval -1 the output is stalled and the ctx drops records when full
+ */
+static int LogAsyncRingWait(LogAsyncCtx *actx, LogAsyncRing *r)
+{
+    while (LogAsyncRingUsed(r) > 0) {
+        if (!actx->block && SC_ATOMIC_GET(actx->stalled))
+            return -1;
+        LogAsyncWakeup(actx);
+        usleep(100);
+    }
+    return 0;
+}
+
+/**
+ * \brief write a record from the logging thread, bypassing the rings
+ *
+ * \retval 1 written
+ * \retval 0 dropped
+ */
+static int LogAsyncWriteDirect(LogAsyncCtx *actx, const char *buffer,
+        int buffer_len)
+{
+    LogFileCtx *log_ctx = actx->file_ctx;
+
+    if (actx->Batch == NULL)
+        return actx->Write(buffer, buffer_len, log_ctx);
+
+    struct iovec iov = { (void *)buffer, (size_t)buffer_len };
+    int r;
+    while (1) {
+        SCMutexLock(&actx->batch_mutex);
+        r = actx->Batch(log_ctx, &iov, 1);
+        SCMutexUnlock(&actx->batch_mutex);
+        if (r == 0 || !actx->block || SC_ATOMIC_GET(actx->stop))
+            break;
+        usleep(LOG_ASYNC_FLUSH_USEC);
+    }
+    if (r < 0) {
+        (void)SC_ATOMIC_ADD(actx->direct_dropped, 1);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Queue a record for the writer thread.
+ *
+ * Replaces the Write function of the LogFileCtx.
+ */
+static int LogAsyncWrite(const char *buffer, int buffer_len,
+        struct LogFileCtx_ *log_ctx)
+{
+    LogAsyncCtx *actx = log_ctx->async;
+    const uint32_t need = LOG_ASYNC_ALIGN(sizeof(uint32_t) + buffer_len);
+
+    LogAsyncRing *r = LogAsyncRingGet(actx);
+    if (unlikely(r == NULL)) {
+        /* no ring for this thread: write it directly */
+        return LogAsyncWriteDirect(actx, buffer, buffer_len);
+    }
+    if (unlikely(need > r->size / 2)) {
+        /* a record that would stall the ring is written directly, but
+         * only after the records this thread queued before it */
+        if (LogAsyncRingWait(actx, r) < 0) {
+            r->dropped++;
+            return 0;
+        }
+        return LogAsyncWriteDirect(actx, buffer, buffer_len);
+    }
+
+    const uint64_t head = SC_ATOMIC_GET(r->head);
+    uint32_t offset = head & (r->size - 1);
+    uint32_t wrap = (need > r->size - offset) ? r->size - offset : 0;
+
+    uint64_t tail = SC_ATOMIC_GET(r->tail);
+    while (head + wrap + need - tail > r->size) {
+        if (!actx->block) {
+            r->dropped++;
+            return 0;
+        }
+        LogAsyncWakeup(actx);
+        usleep(100);
+        tail = SC_ATOMIC_GET(r->tail);
+    }
+    /* don't touch the space before the writer is done with it, pairs
+     * with the tail update in LogAsyncDrain() */
+    hw_barrier();
+
+    if (wrap) {
+        *(uint32_t *)(r->buffer + offset) = LOG_ASYNC_WRAP;
+        offset = 0;
+    }
+    *(uint32_t *)(r->buffer + offset) = (uint32_t)buffer_len;
+    memcpy(r->buffer + offset + sizeof(uint32_t), buffer, buffer_len);
+
+    const uint32_t used = (uint32_t)(head - tail);
+    SC_ATOMIC_SET(r->head, head + wrap + need);
+
+    /* wake the writer once when the ring gets half full, otherwise it
+     * drains the rings on its own schedule */
+    if (used <= r->size / 2 && used + wrap + need > r->size / 2)
+        LogAsyncWakeup(actx);
+
+    return 1;
+}
+
+/** \brief writev() all of iov, retrying on partial writes */
+static int LogAsyncWritev(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t r = writev(fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief write a batch of records to the output of the ctx
+ *
+ * \retval 0 batch done
+ * \retval -1 output unavailable, the records stay queued
+ */
+static int LogAsyncFlush(LogAsyncCtx *actx, struct iovec *iov, int cnt)
+{
+    LogFileCtx *log_ctx = actx->file_ctx;
+
+    uint64_t start = LogAsyncNow();
+    if (actx->Batch != NULL) {
+        SCMutexLock(&actx->batch_mutex);
+        int r = actx->Batch(log_ctx, iov, cnt);
+        SCMutexUnlock(&actx->batch_mutex);
+        if (r < 0)
+            return -1;
+    } else if (log_ctx->is_regular) {
+        SCMutexLock(&log_ctx->fp_mutex);
+        if (log_ctx->rotation_flag) {
+            log_ctx->rotation_flag = 0;
+            SCConfLogReopen(log_ctx);
+        }
+        if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
+            time_t now = time(NULL);
+            if (now >= log_ctx->rotate_time) {
+                SCConfLogReopen(log_ctx);
+                log_ctx->rotate_time = now + log_ctx->rotate_interval;
+            }
+        }
+        if (log_ctx->fp == NULL) {
+            actx->write_errors++;
+        } else if (log_ctx->compress != NULL) {
+            /* the compressor batches on its own */
+            for (int i = 0; i < cnt && log_ctx->fp != NULL; i++) {
+                if (SCLogFileWriteRegular(log_ctx, iov[i].iov_base,
+                            iov[i].iov_len) != 1)
+                    actx->write_errors++;
+            }
+        } else if (SCLogFileMsgpackSync(log_ctx) < 0) {
+            /* records were encoded before they were queued, so one
+             * string table sync covers the whole batch */
+            actx->write_errors += cnt;
+        } else {
+            size_t len = 0;
+            for (int i = 0; i < cnt; i++)
+                len += iov[i].iov_len;
+            if (LogAsyncWritev(fileno(log_ctx->fp), iov, cnt) != 0) {
+                actx->write_errors++;
+            } else {
+                log_ctx->size_current += len;
+                if ((log_ctx->flags & LOGFILE_ROTATE_SIZE) &&
+                        log_ctx->size_current >= log_ctx->size_limit) {
+                    SCConfLogReopen(log_ctx);
+                }
+            }
+        }
+        SCMutexUnlock(&log_ctx->fp_mutex);
+    } else {
+        /* sockets: keep the record boundaries and reconnect handling */
+        for (int i = 0; i < cnt; i++) {
+            actx->Write(iov[i].iov_base, iov[i].iov_len, log_ctx);
+        }
+    }
+    uint64_t usec = LogAsyncNow() - start;
+
+    actx->records += cnt;
+    actx->writes++;
+    actx->write_usec += usec;
+    if (usec > actx->write_usec_max)
+        actx->write_usec_max = usec;
+    return 0;
+}
+
+/**
+ * \brief write out the records queued in all rings
+ *
+ * \retval cnt number of records written
+ */
+static uint32_t LogAsyncDrain(LogAsyncCtx *actx, struct iovec *iov)
+{
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; ; i++) {
+        SCMutexLock(&actx->rings_mutex);
+        LogAsyncRing *r = (i < actx->rings_cnt) ? actx->rings[i] : NULL;
+        SCMutexUnlock(&actx->rings_mutex);
+        if (r == NULL)
+            break;
+
+        const uint64_t head = SC_ATOMIC_GET(r->head);
+        uint64_t tail = SC_ATOMIC_GET(r->tail);
+        /* pairs with the head update in LogAsyncWrite(): the records up
+         * to head are complete */
+        hw_barrier();
+        while (tail != head) {
+            int cnt = 0;
+            while (tail != head && cnt < (int)actx->batch_size) {
+                uint32_t offset = tail & (r->size - 1);
+                uint32_t len = *(uint32_t *)(r->buffer + offset);
+                if (len == LOG_ASYNC_WRAP) {
+                    tail += r->size - offset;
+                    continue;
+                }
+                iov[cnt].iov_base = r->buffer + offset + sizeof(uint32_t);
+                iov[cnt].iov_len = len;
+                cnt++;
+                tail += LOG_ASYNC_ALIGN(sizeof(uint32_t) + len);
+            }
+            if (cnt > 0) {
+                if (LogAsyncFlush(actx, iov, cnt) < 0) {
+                    /* retried on the next wakeup */
+                    SC_ATOMIC_SET(actx->stalled, 1);
+                    return total;
+                }
+                SC_ATOMIC_SET(actx->stalled, 0);
+                total += cnt;
+            }
+            /* hand the space back only after the data is written */
+            SC_ATOMIC_SET(r->tail, tail);
+        }
+    }
+    return total;
+}
+
+static void *LogAsyncThread(void *arg)
+{
+    LogAsyncCtx *actx = arg;
+
+    char name[16];
+    snprintf(name, sizeof(name), "LogWriter#%02u", actx->id);
+    if (SCSetThreadName(name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    struct iovec *iov = SCCalloc(actx->batch_size, sizeof(*iov));
+    if (unlikely(iov == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate log writer batch");
+        return NULL;
+    }
+
+    while (1) {
+        /* read the flag before draining, so records queued before the
+         * stop are always written */
+        int stop = SC_ATOMIC_GET(actx->stop);
+        if (LogAsyncDrain(actx, iov) != 0)
+            continue;
+        if (stop)
+            break;
+
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        uint64_t usec = tv.tv_usec + LOG_ASYNC_FLUSH_USEC;
+        ts.tv_sec = tv.tv_sec + usec / 1000000;
+        ts.tv_nsec = (usec % 1000000) * 1000;
+
+        SCCtrlMutexLock(&actx->wakeup_mutex);
+        if (!SC_ATOMIC_GET(actx->stop))
+            SCCtrlCondTimedwait(&actx->wakeup_cond, &actx->wakeup_mutex, &ts);
+        SCCtrlMutexUnlock(&actx->wakeup_mutex);
+    }
+
+    SCFree(iov);
+    return NULL;
+}
+
+static uint64_t LogAsyncCounterQueued(void)
+{
+    uint64_t bytes = 0;
+    LogAsyncCtx *actx;
+    SCMutexLock(&log_async_list_mutex);
+    TAILQ_FOREACH(actx, &log_async_list, next) {
+        SCMutexLock(&actx->rings_mutex);
+        for (uint32_t i = 0; i < actx->rings_cnt; i++)
+            bytes += LogAsyncRingUsed(actx->rings[i]);
+        SCMutexUnlock(&actx->rings_mutex);
+    }
+    SCMutexUnlock(&log_async_list_mutex);
+    return bytes;
+}
+
+static uint64_t LogAsyncCounterDropped(void)
+{
+    uint64_t dropped = 0;
+    LogAsyncCtx *actx;
+    SCMutexLock(&log_async_list_mutex);
+    TAILQ_FOREACH(actx, &log_async_list, next) {
+        SCMutexLock(&actx->rings_mutex);
+        for (uint32_t i = 0; i < actx->rings_cnt; i++)
+            dropped += actx->rings[i]->dropped;
+        SCMutexUnlock(&actx->rings_mutex);
+        dropped += SC_ATOMIC_GET(actx->direct_dropped);
+    }
+    SCMutexUnlock(&log_async_list_mutex);
+    return dropped;
+}
+
+#define LOG_ASYNC_COUNTER_SUM(name, field)                  \
+static uint64_t name(void)                                  \
+{                                                           \
+    uint64_t v = 0;                                         \
+    LogAsyncCtx *actx;                                      \
+    SCMutexLock(&log_async_list_mutex);                     \
+    TAILQ_FOREACH(actx, &log_async_list, next) {            \
+        v += actx->field;                                   \
+    }                                                       \
+    SCMutexUnlock(&log_async_list_mutex);                   \
+    return v;                                               \
+}
+
+LOG_ASYNC_COUNTER_SUM(LogAsyncCounterRecords, records)
+LOG_ASYNC_COUNTER_SUM(LogAsyncCounterWrites, writes)
+LOG_ASYNC_COUNTER_SUM(LogAsyncCounterWriteUsec, write_usec)
+LOG_ASYNC_COUNTER_SUM(LogAsyncCounterWriteErrors, write_errors)
+
+static uint64_t LogAsyncCounterWriteUsecMax(void)
+{
+    uint64_t v = 0;
+    LogAsyncCtx *actx;
+    SCMutexLock(&log_async_list_mutex);
+    TAILQ_FOREACH(actx, &log_async_list, next) {
+        if (actx->write_usec_max > v)
+            v = actx->write_usec_max;
+    }
+    SCMutexUnlock(&log_async_list_mutex);
+    return v;
+}
+
+static void LogAsyncRegisterCounters(void)
+{
+    if (log_async_counters_registered)
+        return;
+    log_async_counters_registered = true;
+
+    StatsRegisterGlobalCounter("log_async.queued_bytes", LogAsyncCounterQueued);
+    StatsRegisterGlobalCounter("log_async.dropped", LogAsyncCounterDropped);
+    StatsRegisterGlobalCounter("log_async.records", LogAsyncCounterRecords);
+    StatsRegisterGlobalCounter("log_async.writes", LogAsyncCounterWrites);
+    StatsRegisterGlobalCounter("log_async.write_usec", LogAsyncCounterWriteUsec);
+    StatsRegisterGlobalCounter("log_async.write_usec_max",
+            LogAsyncCounterWriteUsecMax);
+    StatsRegisterGlobalCounter("log_async.write_errors",
+            LogAsyncCounterWriteErrors);
+}
+
+static LogAsyncCtx *LogAsyncInit(LogFileCtx *log_ctx, uint32_t ring_size,
+        uint32_t batch_size, bool block, LogAsyncBatchFunc Batch)
+{
+    LogAsyncCtx *actx = SCCalloc(1, sizeof(*actx));
+    if (unlikely(actx == NULL))
+        return NULL;
+
+    /* round up to a power of 2 */
+    uint32_t size = LOG_ASYNC_MIN_BUFFER_SIZE;
+    while (size < ring_size && size < (1U << 31))
+        size <<= 1;
+
+    actx->file_ctx = log_ctx;
+    actx->Write = log_ctx->Write;
+    actx->Batch = Batch;
+    actx->ring_size = size;
+    actx->batch_size = MIN(MAX(batch_size, 1), IOV_MAX);
+    actx->block = block;
+    actx->id = LogThreadCacheNewOwner();
+    SCMutexInit(&actx->rings_mutex, NULL);
+    SCMutexInit(&actx->batch_mutex, NULL);
+    SCCtrlMutexInit(&actx->wakeup_mutex, NULL);
+    SCCtrlCondInit(&actx->wakeup_cond, NULL);
+    SC_ATOMIC_INIT(actx->stop);
+    SC_ATOMIC_INIT(actx->stalled);
+    SC_ATOMIC_INIT(actx->direct_dropped);
+
+    if (pthread_create(&actx->thread, NULL, LogAsyncThread, actx) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to start log writer thread");
+        SCMutexDestroy(&actx->rings_mutex);
+        SCMutexDestroy(&actx->batch_mutex);
+        SCCtrlMutexDestroy(&actx->wakeup_mutex);
+        SCCtrlCondDestroy(&actx->wakeup_cond);
+        SCFree(actx);
+        return NULL;
+    }
+    actx->running = true;
+
+    SCMutexLock(&log_async_list_mutex);
+    TAILQ_INSERT_TAIL(&log_async_list, actx, next);
+    SCMutexUnlock(&log_async_list_mutex);
+
+    log_ctx->async = actx;
+    log_ctx->Write = LogAsyncWrite;
+    return actx;
+}
+
+/**
+ * \brief Set up the async writer for an opened LogFileCtx
+ *
+ * \param conf the "async" node of the output
+ * \param Batch function writing a batch of records, NULL to use the
+ *        Write function of the log_ctx. Returning -1 keeps the records
+ *        queued, they are retried after LOG_ASYNC_FLUSH_USEC.
+ *
+ * \retval 0 on success or if not enabled, -1 on error
+ */
+int LogAsyncSetupBatch(LogFileCtx *log_ctx, ConfNode *conf,
+        LogAsyncBatchFunc Batch)
+{
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return 0;
+
+    uint32_t ring_size = LOG_ASYNC_DEFAULT_BUFFER_SIZE;
+    const char *value = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (value != NULL && (ParseSizeStringU32(value, &ring_size) < 0 ||
+                ring_size == 0)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                "invalid async buffer-size \"%s\"", value);
+        return -1;
+    }
+
+    intmax_t batch_size = LOG_ASYNC_DEFAULT_BATCH_SIZE;
+    if (ConfGetChildValueInt(conf, "batch-size", &batch_size) &&
+            (batch_size <= 0 || batch_size > IOV_MAX)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                "invalid async batch-size %"PRIdMAX", expected 1-%d",
+                batch_size, IOV_MAX);
+        return -1;
+    }
+
+    bool block = false;
+    value = ConfNodeLookupChildValue(conf, "on-full");
+    if (value != NULL) {
+        if (strcasecmp(value, "block") == 0) {
+            block = true;
+        } else if (strcasecmp(value, "drop") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                    "invalid async on-full \"%s\", expected drop or block",
+                    value);
+            return -1;
+        }
+    }
+
+    LogAsyncCtx *actx = LogAsyncInit(log_ctx, ring_size,
+            (uint32_t)batch_size, block, Batch);
+    if (actx == NULL)
+        return -1;
+
+    LogAsyncRegisterCounters();
+
+    SCLogConfig("%s: async writer, %"PRIu32" bytes per thread, "
+            "%s records when full", log_ctx->filename, actx->ring_size,
+            block ? "blocking on" : "dropping");
+    return 0;
+}
+
+int LogAsyncSetup(LogFileCtx *log_ctx, ConfNode *conf)
+{
+    return LogAsyncSetupBatch(log_ctx, conf, NULL);
+}
+
+/**
+ * \brief Stop the writer thread after it wrote out the queued records
+ *        and free the ctx
+ *
+ * The logging threads must be done with the output.
+ */
+void LogAsyncFree(LogAsyncCtx *actx)
+{
+    if (actx == NULL)
+        return;
+
+    if (actx->running) {
+        SC_ATOMIC_SET(actx->stop, 1);
+        LogAsyncWakeup(actx);
+        pthread_join(actx->thread, NULL);
+    }
+
+    SCMutexLock(&log_async_list_mutex);
+    TAILQ_REMOVE(&log_async_list, actx, next);
+    SCMutexUnlock(&log_async_list_mutex);
+
+    for (uint32_t i = 0; i < actx->rings_cnt; i++) {
+        if (actx->rings[i]->dropped) {
+            SCLogWarning(SC_WARN_EVENT_DROPPED, "%s: %"PRIu64" records "
+                    "dropped by the async writer", actx->file_ctx->filename,
+                    actx->rings[i]->dropped);
+        }
+        /* only with a batch function that gave up at shutdown */
+        if (LogAsyncRingUsed(actx->rings[i]) > 0) {
+            SCLogWarning(SC_WARN_EVENT_DROPPED, "%s: %"PRIu32" bytes of "
+                    "records not written at shutdown", actx->file_ctx->filename,
+                    LogAsyncRingUsed(actx->rings[i]));
+        }
+        LogAsyncRingFree(actx->rings[i]);
+    }
+    if (actx->rings != NULL)
+        SCFree(actx->rings);
+    if (SC_ATOMIC_GET(actx->direct_dropped)) {
+        SCLogWarning(SC_WARN_EVENT_DROPPED, "%s: %"PRIu64" records dropped "
+                "on direct writes", actx->file_ctx->filename,
+                SC_ATOMIC_GET(actx->direct_dropped));
+    }
+
+    actx->file_ctx->Write = actx->Write;
+    actx->file_ctx->async = NULL;
+
+    SCMutexDestroy(&actx->rings_mutex);
+    SCMutexDestroy(&actx->batch_mutex);
+    SCCtrlMutexDestroy(&actx->wakeup_mutex);
+    SCCtrlCondDestroy(&actx->wakeup_cond);
+    SC_ATOMIC_DESTROY(actx->stop);
+    SC_ATOMIC_DESTROY(actx->stalled);
+    SC_ATOMIC_DESTROY(actx->direct_dropped);
+    SCFree(actx);
+}
+
+#ifdef UNITTESTS
+
+#define LOG_ASYNC_TEST_THREADS  4
+#define LOG_ASYNC_TEST_RECORDS  10000
+
+static void *LogAsyncTestProducer(void *arg)
+{
+    LogFileCtx *log_ctx = arg;
+    char record[64];
+
+    for (int i = 0; i < LOG_ASYNC_TEST_RECORDS; i++) {
+        int len = snprintf(record, sizeof(record), "{\"record\":%d}\n", i);
+        log_ctx->Write(record, len, log_ctx);
+    }
+    return NULL;
+}
+
+static uint32_t LogAsyncTestCountLines(FILE *fp)
+{
+    uint32_t lines = 0;
+    int c;
+
+    fseek(fp, 0, SEEK_SET);
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '\n')
+            lines++;
+    }
+    return lines;
+}
+
+/**
+ * \test records of several threads all end up in the file when the
+ *       writer blocks the producers, also with wrapping small rings
+ */
+static int LogAsyncTest01(void)
+{
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    FAIL_IF_NULL(log_ctx);
+    log_ctx->fp = tmpfile();
+    FAIL_IF_NULL(log_ctx->fp);
+    log_ctx->is_regular = 1;
+    log_ctx->filename = SCStrdup("async-test");
+    FAIL_IF_NULL(log_ctx->filename);
+
+    LogAsyncCtx *actx = LogAsyncInit(log_ctx, LOG_ASYNC_MIN_BUFFER_SIZE,
+            LOG_ASYNC_DEFAULT_BATCH_SIZE, true, NULL);
+    FAIL_IF_NULL(actx);
+
+    pthread_t threads[LOG_ASYNC_TEST_THREADS];
+    for (int i = 0; i < LOG_ASYNC_TEST_THREADS; i++) {
+        FAIL_IF(pthread_create(&threads[i], NULL, LogAsyncTestProducer,
+                    log_ctx) != 0);
+    }
+    for (int i = 0; i < LOG_ASYNC_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    LogAsyncFree(actx);
+    FAIL_IF_NOT_NULL(log_ctx->async);
+
+    FAIL_IF(LogAsyncTestCountLines(log_ctx->fp) !=
+            LOG_ASYNC_TEST_THREADS * LOG_ASYNC_TEST_RECORDS);
+
+    LogFileFreeCtx(log_ctx);
+    PASS;
+}
+
+/**
+ * \test records too large for the ring are written directly, after the
+ *       records queued before them
+ */
+static int LogAsyncTest02(void)
+{
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    FAIL_IF_NULL(log_ctx);
+    log_ctx->fp = tmpfile();
+    FAIL_IF_NULL(log_ctx->fp);
+    log_ctx->is_regular = 1;
+    log_ctx->filename = SCStrdup("async-test");
+    FAIL_IF_NULL(log_ctx->filename);
+
+    LogAsyncCtx *actx = LogAsyncInit(log_ctx, LOG_ASYNC_MIN_BUFFER_SIZE,
+            LOG_ASYNC_DEFAULT_BATCH_SIZE, false, NULL);
+    FAIL_IF_NULL(actx);
+
+    char big[LOG_ASYNC_MIN_BUFFER_SIZE];
+    memset(big, 'x', sizeof(big));
+    big[sizeof(big) - 1] = '\n';
+
+    FAIL_IF(log_ctx->Write("{}\n", 3, log_ctx) != 1);
+    FAIL_IF(log_ctx->Write(big, sizeof(big), log_ctx) != 1);
+
+    LogAsyncFree(actx);
+
+    fseek(log_ctx->fp, 0, SEEK_END);
+    FAIL_IF(ftell(log_ctx->fp) != (long)(3 + sizeof(big)));
+    FAIL_IF(LogAsyncTestCountLines(log_ctx->fp) != 2);
+
+    char first[3];
+    fseek(log_ctx->fp, 0, SEEK_SET);
+    FAIL_IF(fread(first, 1, sizeof(first), log_ctx->fp) != sizeof(first));
+    FAIL_IF(memcmp(first, "{}\n", 3) != 0);
+
+    LogFileFreeCtx(log_ctx);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void LogAsyncRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogAsyncTest01", LogAsyncTest01);
+    UtRegisterTest("LogAsyncTest02", LogAsyncTest02);
+#endif
+}
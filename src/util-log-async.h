@@ -0,0 +1,45 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous writer for LogFileCtx outputs: the logging threads copy
+ * their records into a per thread ring and a writer thread per output
+ * writes them out in batches.
+ */
+
+#ifndef __UTIL_LOG_ASYNC_H__
+#define __UTIL_LOG_ASYNC_H__
+
+struct LogFileCtx_;
+struct LogAsyncCtx_;
+struct iovec;
+
+/** writes a batch of records from the writer thread
+ *  \retval 0 done, -1 to keep the records queued and retry later */
+typedef int (*LogAsyncBatchFunc)(struct LogFileCtx_ *log_ctx,
+        struct iovec *iov, int cnt);
+
+int LogAsyncSetup(struct LogFileCtx_ *log_ctx, ConfNode *conf);
+int LogAsyncSetupBatch(struct LogFileCtx_ *log_ctx, ConfNode *conf,
+        LogAsyncBatchFunc Batch);
+void LogAsyncFree(struct LogAsyncCtx_ *actx);
+
+void LogAsyncRegisterTests(void);
+
+#endif /* __UTIL_LOG_ASYNC_H__ */
@@ -0,0 +1,750 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming lz4 frame and zstd compression for regular log files.
+ *
+ * The records are fed to the compressor as they are written. The
+ * compressed data is flushed to the file by the first write at least a
+ * second after the previous flush, so a tail of the file can be
+ * decompressed while it is written. There is no timer: on an idle output
+ * the last records stay in the compressor until the next write. Every
+ * (re)open of the file starts a new frame and every rotation or close
+ * finishes it. Concatenated frames are valid lz4 and zstd files, so
+ * appending to an existing file works too.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-debug.h"
+#include "util-logopenfile.h"
+#include "util-log-compress.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif /* HAVE_LIBZSTD */
+
+/** input is fed to lz4 in chunks of this size, so the output buffer
+ *  doesn't depend on the record size */
+#define LOG_COMPRESS_LZ4_CHUNK      (64 * 1024)
+#define LOG_COMPRESS_ZSTD_LEVEL     3
+/** min time between two flushes, checked on each write */
+#define LOG_COMPRESS_FLUSH_SECS     1
+
+enum LogCompressFormat {
+    LOG_COMPRESS_NONE = 0,
+    LOG_COMPRESS_LZ4,
+    LOG_COMPRESS_ZSTD,
+};
+
+typedef struct LogCompressCtx_ {
+    enum LogCompressFormat format;
+    int level;
+    bool checksum;
+
+    /** compressed output, written to the file as it fills */
+    uint8_t *buffer;
+    size_t buffer_size;
+
+#ifdef HAVE_LIBLZ4
+    LZ4F_compressionContext_t lz4f_context;
+    LZ4F_preferences_t lz4f_prefs;
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+    ZSTD_CStream *zstd;
+#endif /* HAVE_LIBZSTD */
+
+    /** a frame was started and not finished yet */
+    bool in_frame;
+    time_t flush_time;
+
+    /* stats, only updated by the writer of the file */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t usec;
+    uint64_t frames;
+    uint64_t errors;
+
+    TAILQ_ENTRY(LogCompressCtx_) next;
+} LogCompressCtx;
+
+/* all compressed files, for the stats counters */
+static TAILQ_HEAD(, LogCompressCtx_) log_compress_list =
+    TAILQ_HEAD_INITIALIZER(log_compress_list);
+static SCMutex log_compress_list_mutex = SCMUTEX_INITIALIZER;
+static bool log_compress_counters_registered = false;
+
+static const char *LogCompressFormatName(enum LogCompressFormat format)
+{
+    switch (format) {
+        case LOG_COMPRESS_LZ4:
+            return "lz4";
+        case LOG_COMPRESS_ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
+
+static uint64_t LogCompressNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void LogCompressError(LogCompressCtx *c, const char *func,
+        const char *err)
+{
+    /* don't flood the log, the errors are counted in the stats */
+    if (c->errors++ == 0) {
+        SCLogError(SC_ERR_LOG_COMPRESS, "%s %s failed: %s",
+                LogCompressFormatName(c->format), func, err);
+    }
+}
+
+/** \brief write len bytes of the output buffer to the file
+ *  \retval len or -1 on error */
+static int LogCompressOut(LogCompressCtx *c, FILE *fp, size_t len)
+{
+    if (len == 0)
+        return 0;
+    if (fwrite(c->buffer, len, 1, fp) != 1) {
+        LogCompressError(c, "write", strerror(errno));
+        return -1;
+    }
+    c->bytes_out += len;
+    return (int)len;
+}
+
+#ifdef HAVE_LIBLZ4
+static int LogCompressLz4Init(LogCompressCtx *c)
+{
+    memset(&c->lz4f_prefs, 0, sizeof(c->lz4f_prefs));
+    c->lz4f_prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    c->lz4f_prefs.frameInfo.blockMode = LZ4F_blockLinked;
+    c->lz4f_prefs.frameInfo.contentChecksumFlag = c->checksum ? 1 : 0;
+    c->lz4f_prefs.compressionLevel = c->level;
+
+    LZ4F_errorCode_t errcode =
+        LZ4F_createCompressionContext(&c->lz4f_context, LZ4F_VERSION);
+    if (LZ4F_isError(errcode)) {
+        SCLogError(SC_ERR_LOG_COMPRESS,
+                "LZ4F_createCompressionContext failed: %s",
+                LZ4F_getErrorName(errcode));
+        return -1;
+    }
+    c->buffer_size = LZ4F_compressBound(LOG_COMPRESS_LZ4_CHUNK,
+            &c->lz4f_prefs);
+    return 0;
+}
+#endif /* HAVE_LIBLZ4 */
+
+#ifdef HAVE_LIBZSTD
+static int LogCompressZstdInit(LogCompressCtx *c)
+{
+    c->zstd = ZSTD_createCStream();
+    if (c->zstd == NULL) {
+        SCLogError(SC_ERR_LOG_COMPRESS, "ZSTD_createCStream failed");
+        return -1;
+    }
+    c->buffer_size = ZSTD_CStreamOutSize();
+    return 0;
+}
+
+/** \brief run a zstd flush or end until it is done */
+static int LogCompressZstdFinish(LogCompressCtx *c, FILE *fp, bool end)
+{
+    int written = 0;
+    size_t r;
+    do {
+        ZSTD_outBuffer out = { c->buffer, c->buffer_size, 0 };
+        r = end ? ZSTD_endStream(c->zstd, &out) :
+            ZSTD_flushStream(c->zstd, &out);
+        if (ZSTD_isError(r)) {
+            LogCompressError(c, end ? "end" : "flush", ZSTD_getErrorName(r));
+            return -1;
+        }
+        int n = LogCompressOut(c, fp, out.pos);
+        if (n < 0)
+            return -1;
+        written += n;
+    } while (r != 0);
+    return written;
+}
+#endif /* HAVE_LIBZSTD */
+
+static LogCompressCtx *LogCompressNew(enum LogCompressFormat format,
+        int level, bool checksum)
+{
+    LogCompressCtx *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    c->format = format;
+    c->level = level;
+    c->checksum = checksum;
+
+    int r = -1;
+    switch (format) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4:
+            r = LogCompressLz4Init(c);
+            break;
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD:
+            r = LogCompressZstdInit(c);
+            break;
+#endif /* HAVE_LIBZSTD */
+        default:
+            break;
+    }
+    if (r < 0) {
+        SCFree(c);
+        return NULL;
+    }
+
+    c->buffer = SCMalloc(c->buffer_size);
+    if (unlikely(c->buffer == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate memory for the "
+                "compression buffer");
+        LogCompressFree(c, NULL);
+        return NULL;
+    }
+
+    SCMutexLock(&log_compress_list_mutex);
+    TAILQ_INSERT_TAIL(&log_compress_list, c, next);
+    SCMutexUnlock(&log_compress_list_mutex);
+    return c;
+}
+
+/**
+ * \brief new compression ctx with the settings of src, e.g. for the
+ *        per thread files of a threaded output
+ */
+LogCompressCtx *LogCompressClone(const LogCompressCtx *src)
+{
+    return LogCompressNew(src->format, src->level, src->checksum);
+}
+
+/**
+ * \brief Free a compression ctx. The frame must be finished already.
+ *
+ * \param filename if set, a summary is logged for the file
+ */
+void LogCompressFree(LogCompressCtx *c, const char *filename)
+{
+    if (c == NULL)
+        return;
+
+    if (filename != NULL && c->bytes_in > 0) {
+        SCLogInfo("%s: %s compressed %"PRIu64" bytes to %"PRIu64
+                " (ratio %.2f) in %"PRIu64" frames using %"PRIu64"ms",
+                filename, LogCompressFormatName(c->format), c->bytes_in,
+                c->bytes_out, c->bytes_out ?
+                (double)c->bytes_in / (double)c->bytes_out : 0.0,
+                c->frames, c->usec / 1000);
+    }
+
+    /* only unlink ctx's that made it onto the list */
+    if (c->buffer != NULL) {
+        SCMutexLock(&log_compress_list_mutex);
+        TAILQ_REMOVE(&log_compress_list, c, next);
+        SCMutexUnlock(&log_compress_list_mutex);
+        SCFree(c->buffer);
+    }
+
+#ifdef HAVE_LIBLZ4
+    if (c->format == LOG_COMPRESS_LZ4) {
+        LZ4F_errorCode_t errcode =
+            LZ4F_freeCompressionContext(c->lz4f_context);
+        if (LZ4F_isError(errcode)) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "Error freeing lz4 context.");
+        }
+    }
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+    if (c->format == LOG_COMPRESS_ZSTD) {
+        ZSTD_freeCStream(c->zstd);
+    }
+#endif /* HAVE_LIBZSTD */
+
+    SCFree(c);
+}
+
+/**
+ * \brief start a new frame in a (re)opened file
+ *
+ * \retval bytes written to fp or -1 on error
+ */
+int LogCompressBegin(LogCompressCtx *c, FILE *fp)
+{
+    int r = 0;
+    uint64_t start = LogCompressNow();
+
+    switch (c->format) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            size_t n = LZ4F_compressBegin(c->lz4f_context, c->buffer,
+                    c->buffer_size, &c->lz4f_prefs);
+            if (LZ4F_isError(n)) {
+                LogCompressError(c, "begin", LZ4F_getErrorName(n));
+                r = -1;
+                break;
+            }
+            r = LogCompressOut(c, fp, n);
+            break;
+        }
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD: {
+            size_t n = ZSTD_initCStream(c->zstd, c->level);
+            if (ZSTD_isError(n)) {
+                LogCompressError(c, "begin", ZSTD_getErrorName(n));
+                r = -1;
+            }
+            break;
+        }
+#endif /* HAVE_LIBZSTD */
+        default:
+            r = -1;
+            break;
+    }
+
+    c->usec += LogCompressNow() - start;
+    if (r >= 0) {
+        c->in_frame = true;
+        c->frames++;
+        c->flush_time = time(NULL);
+    }
+    return r;
+}
+
+/** \brief write out what the compressor holds back, the frame stays open */
+static int LogCompressFlush(LogCompressCtx *c, FILE *fp)
+{
+    switch (c->format) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            size_t n = LZ4F_flush(c->lz4f_context, c->buffer,
+                    c->buffer_size, NULL);
+            if (LZ4F_isError(n)) {
+                LogCompressError(c, "flush", LZ4F_getErrorName(n));
+                return -1;
+            }
+            return LogCompressOut(c, fp, n);
+        }
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD:
+            return LogCompressZstdFinish(c, fp, false);
+#endif /* HAVE_LIBZSTD */
+        default:
+            return -1;
+    }
+}
+
+/**
+ * \brief compress a record into the current frame
+ *
+ * \retval bytes written to fp, 0 if the compressor held the data back,
+ *         or -1 on error
+ */
+int LogCompressWrite(LogCompressCtx *c, FILE *fp, const char *buffer,
+        size_t buffer_len)
+{
+    if (unlikely(!c->in_frame)) {
+        if (LogCompressBegin(c, fp) < 0)
+            return -1;
+    }
+
+    int written = 0;
+    uint64_t start = LogCompressNow();
+
+    switch (c->format) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            size_t offset = 0;
+            while (offset < buffer_len) {
+                size_t chunk = MIN(buffer_len - offset, LOG_COMPRESS_LZ4_CHUNK);
+                size_t n = LZ4F_compressUpdate(c->lz4f_context, c->buffer,
+                        c->buffer_size, buffer + offset, chunk, NULL);
+                if (LZ4F_isError(n)) {
+                    LogCompressError(c, "compress", LZ4F_getErrorName(n));
+                    written = -1;
+                    goto end;
+                }
+                int r = LogCompressOut(c, fp, n);
+                if (r < 0) {
+                    written = -1;
+                    goto end;
+                }
+                written += r;
+                offset += chunk;
+            }
+            break;
+        }
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD: {
+            ZSTD_inBuffer in = { buffer, buffer_len, 0 };
+            while (in.pos < in.size) {
+                ZSTD_outBuffer out = { c->buffer, c->buffer_size, 0 };
+                size_t n = ZSTD_compressStream(c->zstd, &out, &in);
+                if (ZSTD_isError(n)) {
+                    LogCompressError(c, "compress", ZSTD_getErrorName(n));
+                    written = -1;
+                    goto end;
+                }
+                int r = LogCompressOut(c, fp, out.pos);
+                if (r < 0) {
+                    written = -1;
+                    goto end;
+                }
+                written += r;
+            }
+            break;
+        }
+#endif /* HAVE_LIBZSTD */
+        default:
+            written = -1;
+            goto end;
+    }
+    c->bytes_in += buffer_len;
+
+    time_t now = time(NULL);
+    if (now - c->flush_time >= LOG_COMPRESS_FLUSH_SECS) {
+        c->flush_time = now;
+        int r = LogCompressFlush(c, fp);
+        if (r < 0) {
+            written = -1;
+            goto end;
+        }
+        written += r;
+    }
+
+end:
+    c->usec += LogCompressNow() - start;
+    return written;
+}
+
+/**
+ * \brief finish the current frame, before the file is rotated or closed
+ *
+ * \retval bytes written to fp or -1 on error
+ */
+int LogCompressEnd(LogCompressCtx *c, FILE *fp)
+{
+    if (!c->in_frame)
+        return 0;
+    c->in_frame = false;
+
+    int r = -1;
+    uint64_t start = LogCompressNow();
+
+    switch (c->format) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            size_t n = LZ4F_compressEnd(c->lz4f_context, c->buffer,
+                    c->buffer_size, NULL);
+            if (LZ4F_isError(n)) {
+                LogCompressError(c, "end", LZ4F_getErrorName(n));
+                break;
+            }
+            r = LogCompressOut(c, fp, n);
+            break;
+        }
+#endif /* HAVE_LIBLZ4 */
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD:
+            r = LogCompressZstdFinish(c, fp, true);
+            break;
+#endif /* HAVE_LIBZSTD */
+        default:
+            break;
+    }
+    fflush(fp);
+
+    c->usec += LogCompressNow() - start;
+    return r;
+}
+
+#define LOG_COMPRESS_COUNTER_SUM(name, field)               \
+static uint64_t name(void)                                  \
+{                                                           \
+    uint64_t v = 0;                                         \
+    LogCompressCtx *c;                                      \
+    SCMutexLock(&log_compress_list_mutex);                  \
+    TAILQ_FOREACH(c, &log_compress_list, next) {            \
+        v += c->field;                                      \
+    }                                                       \
+    SCMutexUnlock(&log_compress_list_mutex);                \
+    return v;                                               \
+}
+
+LOG_COMPRESS_COUNTER_SUM(LogCompressCounterBytesIn, bytes_in)
+LOG_COMPRESS_COUNTER_SUM(LogCompressCounterBytesOut, bytes_out)
+LOG_COMPRESS_COUNTER_SUM(LogCompressCounterUsec, usec)
+LOG_COMPRESS_COUNTER_SUM(LogCompressCounterFrames, frames)
+LOG_COMPRESS_COUNTER_SUM(LogCompressCounterErrors, errors)
+
+/** \brief uncompressed / compressed size, times 100 */
+static uint64_t LogCompressCounterRatio(void)
+{
+    uint64_t in = LogCompressCounterBytesIn();
+    uint64_t out = LogCompressCounterBytesOut();
+    return out ? (in * 100) / out : 0;
+}
+
+static void LogCompressRegisterCounters(void)
+{
+    if (log_compress_counters_registered)
+        return;
+    log_compress_counters_registered = true;
+
+    StatsRegisterGlobalCounter("log_compress.bytes_in",
+            LogCompressCounterBytesIn);
+    StatsRegisterGlobalCounter("log_compress.bytes_out",
+            LogCompressCounterBytesOut);
+    StatsRegisterGlobalCounter("log_compress.ratio_x100",
+            LogCompressCounterRatio);
+    StatsRegisterGlobalCounter("log_compress.usec", LogCompressCounterUsec);
+    StatsRegisterGlobalCounter("log_compress.frames",
+            LogCompressCounterFrames);
+    StatsRegisterGlobalCounter("log_compress.errors",
+            LogCompressCounterErrors);
+}
+
+/**
+ * \brief Set up compression for a regular LogFileCtx
+ *
+ * Starts the first frame if the file is open already.
+ *
+ * \param conf the output node
+ *
+ * \retval 0 on success or if compression is not enabled, -1 on error
+ */
+int LogCompressSetup(LogFileCtx *log_ctx, ConfNode *conf)
+{
+    const char *value = ConfNodeLookupChildValue(conf, "compression");
+    if (value == NULL || strcasecmp(value, "none") == 0)
+        return 0;
+
+    enum LogCompressFormat format;
+    intmax_t level = 0;
+    bool checksum = false;
+
+    if (strcasecmp(value, "lz4") == 0) {
+#ifdef HAVE_LIBLZ4
+        format = LOG_COMPRESS_LZ4;
+        if (ConfGetChildValueInt(conf, "lz4-level", &level)) {
+            if (level > 16) {
+                level = 16;
+            } else if (level < 0) {
+                level = 0;
+            }
+        }
+        checksum = ConfNodeChildValueIsTrue(conf, "lz4-checksum");
+#else
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "lz4 compression was selected "
+                "in %s, but suricata was not compiled with lz4 support.",
+                conf->name);
+        return -1;
+#endif /* HAVE_LIBLZ4 */
+    } else if (strcasecmp(value, "zstd") == 0) {
+#ifdef HAVE_LIBZSTD
+        format = LOG_COMPRESS_ZSTD;
+        level = LOG_COMPRESS_ZSTD_LEVEL;
+        if (ConfGetChildValueInt(conf, "zstd-level", &level)) {
+            if (level > ZSTD_maxCLevel()) {
+                level = ZSTD_maxCLevel();
+            } else if (level < 1) {
+                level = 1;
+            }
+        }
+#else
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "zstd compression was selected "
+                "in %s, but suricata was not compiled with zstd support.",
+                conf->name);
+        return -1;
+#endif /* HAVE_LIBZSTD */
+    } else {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Unsupported %s compression "
+                "format: %s", conf->name, value);
+        return -1;
+    }
+
+    LogCompressCtx *c = LogCompressNew(format, (int)level, checksum);
+    if (c == NULL)
+        return -1;
+    if (log_ctx->fp != NULL && LogCompressBegin(c, log_ctx->fp) < 0) {
+        LogCompressFree(c, NULL);
+        return -1;
+    }
+    log_ctx->compress = c;
+
+    LogCompressRegisterCounters();
+
+    SCLogConfig("%s: %s compression, level %d", conf->name,
+            LogCompressFormatName(format), (int)level);
+    return 0;
+}
+
+#ifdef UNITTESTS
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+
+#define LOG_COMPRESS_TEST_RECORD \
+    "{\"timestamp\":\"2018-01-01T00:00:00.000000+0000\",\"event_type\":" \
+    "\"flow\",\"src_ip\":\"10.0.0.1\",\"dest_ip\":\"10.0.0.2\"}\n"
+
+/**
+ * \brief compress records in two frames, the second one in append mode
+ *        after a rotation, and check the decompressed result
+ */
+static int LogCompressTestRoundTrip(enum LogCompressFormat format,
+        size_t (*Decompress)(const uint8_t *, size_t, uint8_t *, size_t))
+{
+    const size_t rec_len = strlen(LOG_COMPRESS_TEST_RECORD);
+    const int records = 10000;
+
+    FILE *fp = tmpfile();
+    FAIL_IF_NULL(fp);
+    LogCompressCtx *c = LogCompressNew(format, format == LOG_COMPRESS_ZSTD ?
+            LOG_COMPRESS_ZSTD_LEVEL : 0, true);
+    FAIL_IF_NULL(c);
+
+    for (int frame = 0; frame < 2; frame++) {
+        FAIL_IF(LogCompressBegin(c, fp) < 0);
+        for (int i = 0; i < records; i++) {
+            FAIL_IF(LogCompressWrite(c, fp, LOG_COMPRESS_TEST_RECORD,
+                        rec_len) < 0);
+        }
+        FAIL_IF(LogCompressEnd(c, fp) < 0);
+    }
+    FAIL_IF_NOT(c->frames == 2);
+    FAIL_IF_NOT(c->bytes_in == 2 * records * rec_len);
+    FAIL_IF_NOT(c->bytes_out == (uint64_t)ftell(fp));
+    /* repetitive input, expect a decent ratio */
+    FAIL_IF_NOT(c->bytes_out * 10 < c->bytes_in);
+
+    size_t in_len = (size_t)ftell(fp);
+    uint8_t *in = SCMalloc(in_len);
+    FAIL_IF_NULL(in);
+    rewind(fp);
+    FAIL_IF_NOT(fread(in, in_len, 1, fp) == 1);
+
+    size_t out_size = 2 * records * rec_len;
+    uint8_t *out = SCMalloc(out_size + 1);
+    FAIL_IF_NULL(out);
+    FAIL_IF_NOT(Decompress(in, in_len, out, out_size + 1) == out_size);
+    for (int i = 0; i < 2 * records; i++) {
+        FAIL_IF(memcmp(out + i * rec_len, LOG_COMPRESS_TEST_RECORD,
+                    rec_len) != 0);
+    }
+
+    SCFree(in);
+    SCFree(out);
+    LogCompressFree(c, NULL);
+    fclose(fp);
+    PASS;
+}
+
+#endif /* HAVE_LIBLZ4 || HAVE_LIBZSTD */
+
+#ifdef HAVE_LIBLZ4
+/** \brief decompress all lz4 frames in the input */
+static size_t LogCompressTestLz4Decompress(const uint8_t *in, size_t in_len,
+        uint8_t *out, size_t out_size)
+{
+    LZ4F_decompressionContext_t dctx;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        return 0;
+
+    size_t in_off = 0, out_off = 0;
+    while (in_off < in_len && out_off < out_size) {
+        size_t src = in_len - in_off;
+        size_t dst = out_size - out_off;
+        size_t r = LZ4F_decompress(dctx, out + out_off, &dst, in + in_off,
+                &src, NULL);
+        if (LZ4F_isError(r)) {
+            out_off = 0;
+            break;
+        }
+        in_off += src;
+        out_off += dst;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    return out_off;
+}
+
+static int LogCompressTest01(void)
+{
+    return LogCompressTestRoundTrip(LOG_COMPRESS_LZ4,
+            LogCompressTestLz4Decompress);
+}
+#endif /* HAVE_LIBLZ4 */
+
+#ifdef HAVE_LIBZSTD
+/** \brief decompress all zstd frames in the input */
+static size_t LogCompressTestZstdDecompress(const uint8_t *in, size_t in_len,
+        uint8_t *out, size_t out_size)
+{
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    if (dstream == NULL)
+        return 0;
+    ZSTD_initDStream(dstream);
+
+    ZSTD_inBuffer zin = { in, in_len, 0 };
+    ZSTD_outBuffer zout = { out, out_size, 0 };
+    while (zin.pos < zin.size && zout.pos < zout.size) {
+        size_t r = ZSTD_decompressStream(dstream, &zout, &zin);
+        if (ZSTD_isError(r)) {
+            zout.pos = 0;
+            break;
+        }
+    }
+    ZSTD_freeDStream(dstream);
+    return zout.pos;
+}
+
+static int LogCompressTest02(void)
+{
+    return LogCompressTestRoundTrip(LOG_COMPRESS_ZSTD,
+            LogCompressTestZstdDecompress);
+}
+#endif /* HAVE_LIBZSTD */
+
+#endif /* UNITTESTS */
+
+void LogCompressRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef HAVE_LIBLZ4
+    UtRegisterTest("LogCompressTest01", LogCompressTest01);
+#endif
+#ifdef HAVE_LIBZSTD
+    UtRegisterTest("LogCompressTest02", LogCompressTest02);
+#endif
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,43 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming compression of regular LogFileCtx files. Each time the file
+ * is (re)opened a new lz4 or zstd frame is started, it is finished when
+ * the file is rotated or closed.
+ */
+
+#ifndef __UTIL_LOG_COMPRESS_H__
+#define __UTIL_LOG_COMPRESS_H__
+
+struct LogFileCtx_;
+struct LogCompressCtx_;
+
+int LogCompressSetup(struct LogFileCtx_ *log_ctx, ConfNode *conf);
+struct LogCompressCtx_ *LogCompressClone(const struct LogCompressCtx_ *src);
+void LogCompressFree(struct LogCompressCtx_ *c, const char *filename);
+
+int LogCompressBegin(struct LogCompressCtx_ *c, FILE *fp);
+int LogCompressWrite(struct LogCompressCtx_ *c, FILE *fp,
+        const char *buffer, size_t buffer_len);
+int LogCompressEnd(struct LogCompressCtx_ *c, FILE *fp);
+
+void LogCompressRegisterTests(void);
+
+#endif /* __UTIL_LOG_COMPRESS_H__ */
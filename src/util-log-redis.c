@@ -24,8 +24,18 @@
  * File-like output for logging:  redis
  */
 #include "suricata-common.h" /* errno.h, string.h, etc. */
+#include "counters.h"
+#include "util-atomic.h"
 #include "util-log-redis.h"
+#include "util-log-async.h"
 #include "util-logopenfile.h"
+#include "util-unittest.h"
+
+#include <sys/uio.h>
+
+#ifdef UNITTESTS
+#include "conf-yaml-loader.h"
+#endif
 
 #ifdef HAVE_LIBHIREDIS
 
@@ -434,6 +444,218 @@ int LogFileWriteRedis(void *lf_ctx, const char *string, size_t string_len)
     return -1;
 }
 
+/* async writer thread: the logging threads queue the records in the
+ * rings of util-log-async.c and its writer thread sends them in batches
+ * over a blocking connection, so only that thread waits on redis */
+
+#define REDIS_ASYNC_TIMEOUT_SEC     2
+#define REDIS_ASYNC_BACKOFF_MIN     250     /**< msec */
+#define REDIS_ASYNC_BACKOFF_MAX     30000   /**< msec */
+
+static SC_ATOMIC_DECLARE(uint64_t, redis_records);
+static SC_ATOMIC_DECLARE(uint64_t, redis_commands);
+static SC_ATOMIC_DECLARE(uint64_t, redis_errors);
+static SC_ATOMIC_DECLARE(uint64_t, redis_dropped);
+static SC_ATOMIC_DECLARE(uint64_t, redis_reconnects);
+static bool redis_counters_registered = false;
+
+static uint64_t SCLogRedisNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/** \brief drop the connection, the next attempt is delayed by the
+ *         backoff which doubles on every failure until a batch went out */
+static void SCLogRedisAsyncDisconnect(SCLogRedisContext *ctx)
+{
+    if (ctx->sync != NULL) {
+        redisFree(ctx->sync);
+        ctx->sync = NULL;
+    }
+    if (ctx->backoff == 0)
+        ctx->backoff = REDIS_ASYNC_BACKOFF_MIN;
+    else
+        ctx->backoff = MIN(ctx->backoff * 2, REDIS_ASYNC_BACKOFF_MAX);
+    ctx->retry_usec = SCLogRedisNow() + (uint64_t)ctx->backoff * 1000;
+}
+
+static int SCLogRedisAsyncConnect(LogFileCtx *log_ctx)
+{
+    SCLogRedisContext *ctx = log_ctx->redis;
+
+    if (SCLogRedisNow() < ctx->retry_usec)
+        return -1;
+
+    struct timeval tv = { REDIS_ASYNC_TIMEOUT_SEC, 0 };
+    ctx->sync = redisConnectWithTimeout(log_ctx->redis_setup.server,
+            log_ctx->redis_setup.port, tv);
+    if (ctx->sync == NULL || ctx->sync->err) {
+        if (ctx->tried == 0) {
+            SCLogWarning(SC_ERR_SOCKET, "Failed to connect to redis server "
+                    "%s:%d: %s (will keep trying)", log_ctx->redis_setup.server,
+                    log_ctx->redis_setup.port,
+                    ctx->sync ? ctx->sync->errstr : "out of memory");
+            ctx->tried = time(NULL);
+        }
+        SCLogRedisAsyncDisconnect(ctx);
+        return -1;
+    }
+    if (redisSetTimeout(ctx->sync, tv) != REDIS_OK) {
+        SCLogRedisAsyncDisconnect(ctx);
+        return -1;
+    }
+    if (ctx->tried != 0) {
+        SCLogNotice("Reconnected to redis server %s:%d",
+                log_ctx->redis_setup.server, log_ctx->redis_setup.port);
+        (void)SC_ATOMIC_ADD(redis_reconnects, 1);
+        ctx->tried = 0;
+    }
+    return 0;
+}
+
+/**
+ * \brief send a batch of records, called by the async writer thread, or
+ *        by a logging thread for a record that doesn't fit its ring
+ *
+ * In list mode the whole batch is a single LPUSH/RPUSH, in channel mode
+ * the PUBLISH commands are pipelined. If the connection fails the batch
+ * stays queued and is sent again after reconnecting, so records can be
+ * delivered twice but are not lost.
+ *
+ * \retval 0 batch done
+ * \retval -1 not connected
+ */
+static int SCLogRedisWriteBatch(LogFileCtx *log_ctx, struct iovec *iov, int cnt)
+{
+    SCLogRedisContext *ctx = log_ctx->redis;
+    const bool publish = (log_ctx->redis_setup.command == redis_publish_cmd);
+
+    if (ctx->sync == NULL && SCLogRedisAsyncConnect(log_ctx) < 0)
+        return -1;
+
+    if (cnt + 2 > ctx->argv_size) {
+        /* argv_size is the size of both arrays, so it's only raised once
+         * both grew. One may be larger after a failure, that's harmless. */
+        const char **argv = SCRealloc(ctx->argv, (cnt + 2) * sizeof(*argv));
+        if (unlikely(argv == NULL))
+            return -1;
+        ctx->argv = argv;
+        size_t *argvlen = SCRealloc(ctx->argvlen, (cnt + 2) * sizeof(*argvlen));
+        if (unlikely(argvlen == NULL))
+            return -1;
+        ctx->argvlen = argvlen;
+        ctx->argv_size = cnt + 2;
+    }
+
+    ctx->argv[0] = log_ctx->redis_setup.command;
+    ctx->argvlen[0] = strlen(log_ctx->redis_setup.command);
+    ctx->argv[1] = log_ctx->redis_setup.key;
+    ctx->argvlen[1] = strlen(log_ctx->redis_setup.key);
+
+    int replies = 0;
+    if (publish) {
+        for (int i = 0; i < cnt; i++) {
+            ctx->argv[2] = iov[i].iov_base;
+            ctx->argvlen[2] = iov[i].iov_len;
+            if (redisAppendCommandArgv(ctx->sync, 3, ctx->argv,
+                        ctx->argvlen) != REDIS_OK)
+                goto error;
+            replies++;
+        }
+    } else {
+        for (int i = 0; i < cnt; i++) {
+            ctx->argv[i + 2] = iov[i].iov_base;
+            ctx->argvlen[i + 2] = iov[i].iov_len;
+        }
+        if (redisAppendCommandArgv(ctx->sync, cnt + 2, ctx->argv,
+                    ctx->argvlen) != REDIS_OK)
+            goto error;
+        replies = 1;
+    }
+
+    for (int i = 0; i < replies; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx->sync, (void **)&reply) != REDIS_OK)
+            goto error;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            /* not a connection problem, retrying won't help */
+            SCLogWarning(SC_ERR_REDIS, "Redis error: %s", reply->str);
+            (void)SC_ATOMIC_ADD(redis_errors, 1);
+            (void)SC_ATOMIC_ADD(redis_dropped, publish ? 1 : cnt);
+        }
+        freeReplyObject(reply);
+    }
+
+    (void)SC_ATOMIC_ADD(redis_records, cnt);
+    (void)SC_ATOMIC_ADD(redis_commands, replies);
+    ctx->backoff = 0;
+    return 0;
+
+error:
+    SCLogWarning(SC_ERR_SOCKET, "Lost connection to redis server %s:%d: %s",
+            log_ctx->redis_setup.server, log_ctx->redis_setup.port,
+            ctx->sync->errstr[0] ? ctx->sync->errstr : "out of memory");
+    ctx->tried = time(NULL);
+    SCLogRedisAsyncDisconnect(ctx);
+    return -1;
+}
+
+#define REDIS_COUNTER(name, var)        \
+static uint64_t name(void)              \
+{                                       \
+    return SC_ATOMIC_GET(var);          \
+}
+
+REDIS_COUNTER(SCLogRedisCounterRecords, redis_records)
+REDIS_COUNTER(SCLogRedisCounterCommands, redis_commands)
+REDIS_COUNTER(SCLogRedisCounterErrors, redis_errors)
+REDIS_COUNTER(SCLogRedisCounterDropped, redis_dropped)
+REDIS_COUNTER(SCLogRedisCounterReconnects, redis_reconnects)
+
+/**
+ * \brief hand the records of a redis output to the async writer thread
+ *
+ * \param lf_ctx LogFileCtx set up by SCConfLogOpenRedis()
+ * \param conf the "async" node of the output
+ *
+ * \retval 0 on success, -1 on error
+ */
+int SCLogRedisAsyncSetup(void *lf_ctx, ConfNode *conf)
+{
+    LogFileCtx *log_ctx = lf_ctx;
+
+    if (log_ctx->redis_setup.is_async) {
+        SCLogWarning(SC_ERR_REDIS_CONFIG, "redis.async is ignored with the "
+                "async writer");
+        log_ctx->redis_setup.is_async = 0;
+    }
+    if (log_ctx->redis_setup.batch_size) {
+        SCLogInfo("redis pipelining replaced by the async writer batches");
+        log_ctx->redis_setup.batch_size = 0;
+    }
+    if (log_ctx->filename == NULL) {
+        log_ctx->filename = SCStrdup("redis");
+        if (unlikely(log_ctx->filename == NULL))
+            return -1;
+    }
+
+    if (LogAsyncSetupBatch(log_ctx, conf, SCLogRedisWriteBatch) < 0)
+        return -1;
+
+    if (!redis_counters_registered) {
+        redis_counters_registered = true;
+        StatsRegisterGlobalCounter("redis.records", SCLogRedisCounterRecords);
+        StatsRegisterGlobalCounter("redis.commands", SCLogRedisCounterCommands);
+        StatsRegisterGlobalCounter("redis.errors", SCLogRedisCounterErrors);
+        StatsRegisterGlobalCounter("redis.dropped", SCLogRedisCounterDropped);
+        StatsRegisterGlobalCounter("redis.reconnects",
+                SCLogRedisCounterReconnects);
+    }
+    return 0;
+}
+
 /** \brief configure and initializes redis output logging
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -571,9 +793,302 @@ void SCLogFileCloseRedis(LogFileCtx *log_ctx)
         ctx->batch_count = 0;
     }
 
-    if (ctx != NULL) {
-        SCFree(ctx);
+    if (ctx->argv != NULL)
+        SCFree(ctx->argv);
+    if (ctx->argvlen != NULL)
+        SCFree(ctx->argvlen);
+    SCFree(ctx);
+}
+
+
+#ifdef UNITTESTS
+
+#define REDIS_TEST_THREADS  2
+#define REDIS_TEST_RECORDS  1000
+
+/** minimal redis server: counts the records of the RPUSH commands it
+ *  gets and replies with the list length */
+typedef struct RedisTestServer_ {
+    int fd;
+    uint16_t port;
+    pthread_t thread;
+    bool running;
+    SC_ATOMIC_DECLARE(uint32_t, records);
+    SC_ATOMIC_DECLARE(uint32_t, commands);
+    SC_ATOMIC_DECLARE(uint32_t, invalid);
+} RedisTestServer;
+
+/** \retval consumed bytes of one command, 0 if incomplete, -1 if invalid */
+static int RedisTestParseCommand(RedisTestServer *srv, const char *buf,
+        int len, uint32_t *args)
+{
+    const char *end = buf + len;
+    const char *p = buf;
+    char *e;
+
+    if (len < 1 || *p != '*')
+        return len < 1 ? 0 : -1;
+    const char *nl = memchr(p, '\n', end - p);
+    if (nl == NULL)
+        return 0;
+    long n = strtol(p + 1, &e, 10);
+    p = nl + 1;
+
+    for (long i = 0; i < n; i++) {
+        if (p >= end)
+            return 0;
+        if (*p != '$')
+            return -1;
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL)
+            return 0;
+        long alen = strtol(p + 1, &e, 10);
+        p = nl + 1;
+        if (end - p < alen + 2)
+            return 0;
+        if ((i == 0 && (alen != 5 || memcmp(p, "RPUSH", 5) != 0)) ||
+            (i == 1 && (alen != 8 || memcmp(p, "suricata", 8) != 0)) ||
+            (i > 1 && (alen < 2 || p[0] != '{' || p[alen - 1] != '}'))) {
+            (void)SC_ATOMIC_ADD(srv->invalid, 1);
+        }
+        p += alen + 2;
+    }
+    *args = (uint32_t)n;
+    return (int)(p - buf);
+}
+
+static void *RedisTestServerThread(void *arg)
+{
+    RedisTestServer *srv = arg;
+    char *buf = SCMalloc(1024 * 1024);
+    if (buf == NULL)
+        return NULL;
+
+    int c;
+    while ((c = accept(srv->fd, NULL, NULL)) >= 0) {
+        int len = 0;
+        ssize_t r;
+        while ((r = read(c, buf + len, 1024 * 1024 - len)) > 0) {
+            len += r;
+            int used;
+            uint32_t args = 0;
+            while ((used = RedisTestParseCommand(srv, buf, len, &args)) > 0) {
+                uint32_t records = args - 2;
+                uint32_t total = SC_ATOMIC_ADD(srv->records, records);
+                (void)SC_ATOMIC_ADD(srv->commands, 1);
+                char reply[32];
+                int rlen = snprintf(reply, sizeof(reply), ":%u\r\n", total);
+                if (write(c, reply, rlen) != rlen)
+                    break;
+                memmove(buf, buf + used, len - used);
+                len -= used;
+            }
+            if (used < 0) {
+                (void)SC_ATOMIC_ADD(srv->invalid, 1);
+                break;
+            }
+        }
+        close(c);
     }
+    SCFree(buf);
+    return NULL;
 }
 
+/** \brief bind the server to a free port, connections are refused until
+ *         RedisTestServerStart() */
+static int RedisTestServerInit(RedisTestServer *srv)
+{
+    memset(srv, 0, sizeof(*srv));
+    SC_ATOMIC_INIT(srv->records);
+    SC_ATOMIC_INIT(srv->commands);
+    SC_ATOMIC_INIT(srv->invalid);
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sinlen = sizeof(sin);
+
+    srv->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv->fd < 0)
+        return -1;
+    if (bind(srv->fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+            getsockname(srv->fd, (struct sockaddr *)&sin, &sinlen) != 0) {
+        close(srv->fd);
+        return -1;
+    }
+    srv->port = ntohs(sin.sin_port);
+    return 0;
+}
+
+static int RedisTestServerStart(RedisTestServer *srv)
+{
+    if (listen(srv->fd, 4) != 0)
+        return -1;
+    if (pthread_create(&srv->thread, NULL, RedisTestServerThread, srv) != 0)
+        return -1;
+    srv->running = true;
+    return 0;
+}
+
+static void RedisTestServerStop(RedisTestServer *srv)
+{
+    shutdown(srv->fd, SHUT_RDWR);
+    if (srv->running)
+        pthread_join(srv->thread, NULL);
+    close(srv->fd);
+}
+
+static LogFileCtx *RedisTestLogCtx(uint16_t port, const char *batch_size)
+{
+    char yaml[256];
+    snprintf(yaml, sizeof(yaml), "%%YAML 1.1\n---\n"
+            "async:\n  enabled: yes\n  batch-size: %s\n",
+            batch_size);
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(yaml, strlen(yaml));
+
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    if (log_ctx != NULL) {
+        log_ctx->type = LOGFILE_TYPE_REDIS;
+        log_ctx->redis_setup.server = redis_default_server;
+        log_ctx->redis_setup.port = port;
+        log_ctx->redis_setup.key = redis_default_key;
+        log_ctx->redis_setup.command = redis_rpush_cmd;
+        log_ctx->redis = SCLogRedisContextAlloc();
+        log_ctx->Close = SCLogFileCloseRedis;
+        if (SCLogRedisAsyncSetup(log_ctx, ConfGetNode("async")) < 0) {
+            LogFileFreeCtx(log_ctx);
+            log_ctx = NULL;
+        }
+    }
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return log_ctx;
+}
+
+static void *RedisTestProducer(void *arg)
+{
+    LogFileCtx *log_ctx = arg;
+    char record[64];
+
+    for (int i = 0; i < REDIS_TEST_RECORDS; i++) {
+        int len = snprintf(record, sizeof(record), "{\"record\":%d}", i);
+        log_ctx->Write(record, len, log_ctx);
+    }
+    return NULL;
+}
+
+/**
+ * \test records of several threads reach the server as a few RPUSH
+ *       commands of many records
+ */
+static int SCLogRedisTest01(void)
+{
+    RedisTestServer srv;
+    FAIL_IF(RedisTestServerInit(&srv) != 0);
+    FAIL_IF(RedisTestServerStart(&srv) != 0);
+
+    LogFileCtx *log_ctx = RedisTestLogCtx(srv.port, "100");
+    FAIL_IF_NULL(log_ctx);
+
+    pthread_t threads[REDIS_TEST_THREADS];
+    for (int i = 0; i < REDIS_TEST_THREADS; i++) {
+        FAIL_IF(pthread_create(&threads[i], NULL, RedisTestProducer,
+                    log_ctx) != 0);
+    }
+    for (int i = 0; i < REDIS_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* writes out the queued records */
+    LogFileFreeCtx(log_ctx);
+    RedisTestServerStop(&srv);
+
+    FAIL_IF(SC_ATOMIC_GET(srv.records) !=
+            REDIS_TEST_THREADS * REDIS_TEST_RECORDS);
+    FAIL_IF(SC_ATOMIC_GET(srv.commands) <
+            REDIS_TEST_THREADS * REDIS_TEST_RECORDS / 100);
+    FAIL_IF(SC_ATOMIC_GET(srv.commands) >=
+            REDIS_TEST_THREADS * REDIS_TEST_RECORDS);
+    FAIL_IF(SC_ATOMIC_GET(srv.invalid) != 0);
+    PASS;
+}
+
+/**
+ * \test records stay queued while the server is down and are sent once
+ *       it accepts connections
+ */
+static int SCLogRedisTest02(void)
+{
+    RedisTestServer srv;
+    FAIL_IF(RedisTestServerInit(&srv) != 0);
+
+    LogFileCtx *log_ctx = RedisTestLogCtx(srv.port, "16");
+    FAIL_IF_NULL(log_ctx);
+
+    RedisTestProducer(log_ctx);
+    usleep(100000);
+    FAIL_IF(SC_ATOMIC_GET(srv.records) != 0);
+
+    FAIL_IF(RedisTestServerStart(&srv) != 0);
+    for (int i = 0; i < 500 &&
+            SC_ATOMIC_GET(srv.records) < REDIS_TEST_RECORDS; i++) {
+        usleep(10000);
+    }
+    FAIL_IF(SC_ATOMIC_GET(srv.records) != REDIS_TEST_RECORDS);
+
+    LogFileFreeCtx(log_ctx);
+    RedisTestServerStop(&srv);
+    FAIL_IF(SC_ATOMIC_GET(srv.invalid) != 0);
+    PASS;
+}
+
+/**
+ * \test a record too large for the ring is sent by the logging thread,
+ *       in order with the queued ones
+ */
+static int SCLogRedisTest03(void)
+{
+    RedisTestServer srv;
+    FAIL_IF(RedisTestServerInit(&srv) != 0);
+    FAIL_IF(RedisTestServerStart(&srv) != 0);
+
+    LogFileCtx *log_ctx = RedisTestLogCtx(srv.port, "16");
+    FAIL_IF_NULL(log_ctx);
+
+    /* more than half of the default 1mb ring */
+    const int big_len = 600 * 1024;
+    char *big = SCMalloc(big_len);
+    FAIL_IF_NULL(big);
+    memset(big, 'x', big_len);
+    memcpy(big, "{\"big\":\"", 8);
+    memcpy(big + big_len - 2, "\"}", 2);
+
+    RedisTestProducer(log_ctx);
+    FAIL_IF(log_ctx->Write(big, big_len, log_ctx) != 1);
+    RedisTestProducer(log_ctx);
+
+    LogFileFreeCtx(log_ctx);
+    RedisTestServerStop(&srv);
+    SCFree(big);
+
+    FAIL_IF(SC_ATOMIC_GET(srv.records) != 2 * REDIS_TEST_RECORDS + 1);
+    FAIL_IF(SC_ATOMIC_GET(srv.invalid) != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
 #endif //#ifdef HAVE_LIBHIREDIS
+
+void SCLogRedisRegisterTests(void)
+{
+#if defined(HAVE_LIBHIREDIS) && defined(UNITTESTS)
+    UtRegisterTest("SCLogRedisTest01", SCLogRedisTest01);
+    UtRegisterTest("SCLogRedisTest02", SCLogRedisTest02);
+    UtRegisterTest("SCLogRedisTest03", SCLogRedisTest03);
+#endif
+}
@@ -55,11 +55,22 @@ typedef struct SCLogRedisContext_ {
 #endif /* HAVE_LIBEVENT */
     time_t tried;
     int  batch_count;
+
+    /* async writer thread, see SCLogRedisAsyncSetup() */
+    const char **argv;
+    size_t *argvlen;
+    int argv_size;
+    uint32_t backoff;       /**< msec to wait after the next failure */
+    uint64_t retry_usec;    /**< no reconnect before this time */
 } SCLogRedisContext;
 
 void SCLogRedisInit(void);
 int SCConfLogOpenRedis(ConfNode *, void *);
+int SCLogRedisAsyncSetup(void *, ConfNode *);
 int LogFileWriteRedis(void *, const char *, size_t);
 
 #endif /* HAVE_LIBHIREDIS */
+
+void SCLogRedisRegisterTests(void);
+
 #endif /* __UTIL_LOG_REDIS_H__ */
@@ -29,9 +29,13 @@
 #include "conf.h"            /* ConfNode, etc. */
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-byte.h"
+#include "util-misc.h"
 #include "util-path.h"
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-log-async.h"
+#include "util-log-compress.h"
+#include "util-msgpack.h"
 
 #if defined(HAVE_SYS_UN_H) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_TYPES_H)
 #define BUILD_WITH_UNIXSOCKET
@@ -44,6 +48,106 @@
 #include "util-log-redis.h"
 #endif /* HAVE_LIBHIREDIS */
 
+static FILE *SCLogOpenFileFp(const char *path, const char *append_setting,
+        uint32_t mode);
+
+/** number of per thread objects a thread can find without locking */
+#define LOG_THREAD_CACHE_SIZE   16
+
+/** per thread lookup of the thread's object (file, ring) per output */
+typedef struct LogThreadCache_ {
+    /** id of this thread, e.g. in the thread file names, 0 if not set yet */
+    uint32_t thread_id;
+    struct {
+        uint32_t owner_id;
+        void *data;
+    } slots[LOG_THREAD_CACHE_SIZE];
+} LogThreadCache;
+
+static SC_ATOMIC_DECLARE(uint32_t, log_thread_id);
+static SC_ATOMIC_DECLARE(uint32_t, log_thread_owner_id);
+
+#ifdef TLS
+static __thread LogThreadCache log_thread_cache;
+
+static inline LogThreadCache *LogThreadCacheLocal(void)
+{
+    return &log_thread_cache;
+}
+#else
+/* __thread not supported. */
+static pthread_key_t log_thread_cache_key;
+static pthread_once_t log_thread_cache_once = PTHREAD_ONCE_INIT;
+
+static void LogThreadCacheFree(void *data)
+{
+    SCFree(data);
+}
+
+static void LogThreadCacheKeyInit(void)
+{
+    pthread_key_create(&log_thread_cache_key, LogThreadCacheFree);
+}
+
+static LogThreadCache *LogThreadCacheLocal(void)
+{
+    pthread_once(&log_thread_cache_once, LogThreadCacheKeyInit);
+    LogThreadCache *cache = pthread_getspecific(log_thread_cache_key);
+    if (cache == NULL) {
+        cache = SCCalloc(1, sizeof(*cache));
+        if (unlikely(cache == NULL))
+            return NULL;
+        pthread_setspecific(log_thread_cache_key, cache);
+    }
+    return cache;
+}
+#endif
+
+/** \brief get a new id for an owner of per thread objects */
+uint32_t LogThreadCacheNewOwner(void)
+{
+    return SC_ATOMIC_ADD(log_thread_owner_id, 1);
+}
+
+/** \brief get the id of the calling thread, starting at 1
+ *  \retval 0 on error */
+uint32_t LogThreadCacheThreadId(void)
+{
+    LogThreadCache *cache = LogThreadCacheLocal();
+    if (unlikely(cache == NULL))
+        return 0;
+    if (cache->thread_id == 0)
+        cache->thread_id = SC_ATOMIC_ADD(log_thread_id, 1);
+    return cache->thread_id;
+}
+
+/**
+ * \brief get the slot of the calling thread for an owner's object
+ *
+ * The slot is claimed on first use, its value is NULL until the caller
+ * sets it. Owner ids are never reused, so slots of freed owners never
+ * match again.
+ *
+ * \retval slot or NULL if the cache is full and the caller has to do
+ *         without
+ */
+void **LogThreadCacheSlot(uint32_t owner_id)
+{
+    LogThreadCache *cache = LogThreadCacheLocal();
+    if (unlikely(cache == NULL))
+        return NULL;
+    for (int i = 0; i < LOG_THREAD_CACHE_SIZE; i++) {
+        if (cache->slots[i].owner_id == owner_id)
+            return &cache->slots[i].data;
+        if (cache->slots[i].owner_id == 0) {
+            cache->slots[i].owner_id = owner_id;
+            cache->slots[i].data = NULL;
+            return &cache->slots[i].data;
+        }
+    }
+    return NULL;
+}
+
 #ifdef BUILD_WITH_UNIXSOCKET
 /** \brief connect to the indicated local stream socket, logging any errors
  *  \param path filesystem path to connect to
@@ -180,6 +284,91 @@ tryagain:
 }
 #endif /* BUILD_WITH_UNIXSOCKET */
 
+static int SCLogFileWriteRaw(LogFileCtx *log_ctx, const char *buffer,
+        size_t buffer_len)
+{
+    int ret;
+
+    clearerr(log_ctx->fp);
+    if (log_ctx->compress != NULL) {
+        int written = LogCompressWrite(log_ctx->compress, log_ctx->fp,
+                buffer, buffer_len);
+        ret = (written >= 0);
+        if (written > 0)
+            log_ctx->size_current += written;
+    } else {
+        ret = fwrite(buffer, buffer_len, 1, log_ctx->fp);
+        if (ret == 1)
+            log_ctx->size_current += buffer_len;
+    }
+    return ret;
+}
+
+/**
+ * \brief Write the msgpack header and the strings added to the string
+ *        table since the last sync, so the next record can be decoded.
+ *
+ * The caller holds the fp_mutex or owns the LogFileCtx.
+ *
+ * \retval 0 on success, -1 on failure
+ */
+int SCLogFileMsgpackSync(LogFileCtx *log_ctx)
+{
+#ifdef HAVE_LIBJANSSON
+    if (log_ctx->msgpack == NULL || log_ctx->fp == NULL)
+        return 0;
+
+    const bool header = !(log_ctx->flags & LOGFILE_MSGPACK_HEADER);
+    if (!header &&
+            MsgpackStringCount(log_ctx->msgpack) <= log_ctx->msgpack_strings)
+        return 0;
+
+    uint32_t written = log_ctx->msgpack_strings;
+    uint8_t *out;
+    size_t out_len;
+    if (MsgpackSync(log_ctx->msgpack, header, &written, &out, &out_len) < 0)
+        return -1;
+    if (out != NULL) {
+        int ret = SCLogFileWriteRaw(log_ctx, (const char *)out, out_len);
+        SCFree(out);
+        /* flushed for writers that bypass stdio, like the async writer */
+        fflush(log_ctx->fp);
+        if (ret != 1)
+            return -1;
+    }
+    log_ctx->flags |= LOGFILE_MSGPACK_HEADER;
+    log_ctx->msgpack_strings = written;
+#endif
+    return 0;
+}
+
+/**
+ * \brief Write buffer to the open fp of a regular file, compressed if
+ *        set up, and rotate the file once it reaches rotate-size.
+ *
+ * The caller holds the fp_mutex or owns the LogFileCtx.
+ *
+ * \retval 1 on success, 0 on failure
+ */
+int SCLogFileWriteRegular(LogFileCtx *log_ctx, const char *buffer,
+        int buffer_len)
+{
+    if (log_ctx->msgpack != NULL && SCLogFileMsgpackSync(log_ctx) < 0) {
+        /* the record would reference strings the file doesn't have */
+        return 0;
+    }
+
+    int ret = SCLogFileWriteRaw(log_ctx, buffer, buffer_len);
+    fflush(log_ctx->fp);
+
+    if ((log_ctx->flags & LOGFILE_ROTATE_SIZE) &&
+            log_ctx->size_current >= log_ctx->size_limit) {
+        SCConfLogReopen(log_ctx);
+    }
+
+    return ret;
+}
+
 /**
  * \brief Write buffer to log file.
  * \retval 0 on failure; otherwise, the return value of fwrite (number of
@@ -212,9 +401,7 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
         }
 
         if (log_ctx->fp) {
-            clearerr(log_ctx->fp);
-            ret = fwrite(buffer, buffer_len, 1, log_ctx->fp);
-            fflush(log_ctx->fp);
+            ret = SCLogFileWriteRegular(log_ctx, buffer, buffer_len);
         }
     }
 
@@ -223,6 +410,199 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     return ret;
 }
 
+/**
+ * \brief Write buffer to a per thread log file.
+ *
+ * Only the owning thread writes to the file, so no lock is needed.
+ * Rotation is driven by the parent, see SCLogFileWriteThreaded().
+ */
+static int SCLogFileWriteThreadFile(const char *buffer, int buffer_len,
+        LogFileCtx *log_ctx)
+{
+    int ret = 0;
+    if (log_ctx->fp) {
+        ret = SCLogFileWriteRegular(log_ctx, buffer, buffer_len);
+    }
+    return ret;
+}
+
+/**
+ * \brief Build the name of a per thread file: "eve.json" becomes
+ *        "eve.<id>.json", a name without extension gets ".<id>" appended.
+ */
+static char *LogFileThreadedName(const char *original, uint32_t id)
+{
+    char *name = SCMalloc(PATH_MAX);
+    if (unlikely(name == NULL))
+        return NULL;
+
+    const char *base = strrchr(original, '/');
+    base = (base != NULL) ? base + 1 : original;
+    const char *ext = strrchr(base, '.');
+
+    int r;
+    if (ext != NULL && ext != base) {
+        r = snprintf(name, PATH_MAX, "%.*s.%"PRIu32"%s",
+                (int)(ext - original), original, id, ext);
+    } else {
+        r = snprintf(name, PATH_MAX, "%s.%"PRIu32, original, id);
+    }
+    if (r < 0 || r >= PATH_MAX) {
+        SCFree(name);
+        return NULL;
+    }
+    return name;
+}
+
+/**
+ * \brief Open the file of the calling thread and add it to the parent.
+ *
+ * \retval ctx the per thread LogFileCtx. Its fp is NULL if the file could
+ *         not be opened, so the open is not retried for every record.
+ */
+static LogFileCtx *LogFileThreadedAdd(LogFileCtx *parent, uint32_t thread_id)
+{
+    LogThreadedFileCtx *threads = parent->threads;
+    LogFileCtx *ctx = NULL;
+
+    SCMutexLock(&threads->mutex);
+    for (uint32_t i = 0; i < threads->slot_count; i++) {
+        if (threads->slots[i]->thread_id == thread_id) {
+            ctx = threads->slots[i];
+            goto end;
+        }
+    }
+
+    if (threads->slot_count == threads->slot_size) {
+        uint32_t size = threads->slot_size ? threads->slot_size * 2 : 8;
+        LogFileCtx **slots = SCRealloc(threads->slots, size * sizeof(*slots));
+        if (unlikely(slots == NULL))
+            goto end;
+        threads->slots = slots;
+        threads->slot_size = size;
+    }
+
+    ctx = LogFileNewCtx();
+    if (unlikely(ctx == NULL))
+        goto end;
+
+    ctx->filename = LogFileThreadedName(parent->filename, thread_id);
+    if (unlikely(ctx->filename == NULL)) {
+        LogFileFreeCtx(ctx);
+        ctx = NULL;
+        goto end;
+    }
+    ctx->type = LOGFILE_TYPE_FILE;
+    ctx->is_regular = 1;
+    ctx->filemode = parent->filemode;
+    ctx->flags = parent->flags & LOGFILE_ROTATE_SIZE;
+    ctx->size_limit = parent->size_limit;
+    ctx->msgpack = parent->msgpack;
+    ctx->thread_id = thread_id;
+    ctx->rotation_gen = SC_ATOMIC_GET(threads->rotation_gen);
+    ctx->Write = SCLogFileWriteThreadFile;
+    ctx->fp = SCLogOpenFileFp(ctx->filename, threads->append ? "yes" : "no",
+            ctx->filemode);
+    if (parent->compress != NULL) {
+        ctx->compress = LogCompressClone(parent->compress);
+        if (ctx->compress == NULL ||
+                (ctx->fp != NULL && LogCompressBegin(ctx->compress, ctx->fp) < 0)) {
+            /* don't write uncompressed data to a compressed output */
+            if (ctx->fp != NULL)
+                fclose(ctx->fp);
+            ctx->fp = NULL;
+        }
+    }
+
+    threads->slots[threads->slot_count++] = ctx;
+    SCLogDebug("thread %"PRIu32" logging to %s", thread_id, ctx->filename);
+end:
+    SCMutexUnlock(&threads->mutex);
+    return ctx;
+}
+
+/** \brief get the file of the calling thread for a threaded LogFileCtx */
+static LogFileCtx *LogFileThreadedGet(LogFileCtx *parent)
+{
+    void **slot = LogThreadCacheSlot(parent->threads->id);
+    if (likely(slot != NULL && *slot != NULL))
+        return *slot;
+
+    uint32_t thread_id = LogThreadCacheThreadId();
+    if (unlikely(thread_id == 0))
+        return NULL;
+
+    /* without a slot the file is looked up under the lock every time */
+    LogFileCtx *ctx = LogFileThreadedAdd(parent, thread_id);
+    if (slot != NULL)
+        *slot = ctx;
+    return ctx;
+}
+
+/**
+ * \brief Write buffer to the log file of the calling thread.
+ *
+ * HUP and rotate-interval are handled here for all threads at once:
+ * they bump the rotation generation and each thread reopens its file
+ * on its next write.
+ */
+static int SCLogFileWriteThreaded(const char *buffer, int buffer_len,
+        LogFileCtx *log_ctx)
+{
+    LogThreadedFileCtx *threads = log_ctx->threads;
+
+    if (log_ctx->rotation_flag ||
+            ((log_ctx->flags & LOGFILE_ROTATE_INTERVAL) &&
+             time(NULL) >= log_ctx->rotate_time)) {
+        SCMutexLock(&threads->mutex);
+        if (log_ctx->rotation_flag) {
+            log_ctx->rotation_flag = 0;
+            (void)SC_ATOMIC_ADD(threads->rotation_gen, 1);
+        }
+        if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
+            time_t now = time(NULL);
+            if (now >= log_ctx->rotate_time) {
+                log_ctx->rotate_time = now + log_ctx->rotate_interval;
+                (void)SC_ATOMIC_ADD(threads->rotation_gen, 1);
+            }
+        }
+        SCMutexUnlock(&threads->mutex);
+    }
+
+    LogFileCtx *ctx = LogFileThreadedGet(log_ctx);
+    if (unlikely(ctx == NULL))
+        return 0;
+
+    uint32_t gen = SC_ATOMIC_GET(threads->rotation_gen);
+    if (ctx->rotation_gen != gen) {
+        ctx->rotation_gen = gen;
+        SCConfLogReopen(ctx);
+    }
+
+    return ctx->Write(buffer, buffer_len, ctx);
+}
+
+/**
+ * \brief Set up threaded mode: the file itself is not opened, each
+ *        writer thread opens its own on its first write.
+ */
+static int LogFileThreadedInit(LogFileCtx *log_ctx, const char *append)
+{
+    LogThreadedFileCtx *threads = SCCalloc(1, sizeof(*threads));
+    if (unlikely(threads == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate threaded log ctx");
+        return -1;
+    }
+    SCMutexInit(&threads->mutex, NULL);
+    SC_ATOMIC_INIT(threads->rotation_gen);
+    threads->append = ConfValIsTrue(append);
+    threads->id = LogThreadCacheNewOwner();
+
+    log_ctx->threads = threads;
+    log_ctx->Write = SCLogFileWriteThreaded;
+    return 0;
+}
+
 /** \brief generate filename based on pattern
  *  \param pattern pattern to use
  *  \retval char* on success
@@ -390,6 +770,18 @@ SCConfLogOpenGeneric(ConfNode *conf,
         }
     }
 
+    /* Rotate log file based on size */
+    const char *rotate_size = ConfNodeLookupChildValue(conf, "rotate-size");
+    if (rotate_size != NULL) {
+        if (ParseSizeStringU64(rotate_size, &log_ctx->size_limit) < 0 ||
+                log_ctx->size_limit == 0) {
+            SCLogError(SC_ERR_INVALID_NUMERIC_VALUE,
+                       "invalid rotate-size value");
+            return -1;
+        }
+        log_ctx->flags |= LOGFILE_ROTATE_SIZE;
+    }
+
     filetype = ConfNodeLookupChildValue(conf, "filetype");
     if (filetype == NULL)
         filetype = DEFAULT_LOG_FILETYPE;
@@ -456,9 +848,14 @@ SCConfLogOpenGeneric(ConfNode *conf,
 #endif
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
-        if (log_ctx->fp == NULL)
-            return -1; // Error already logged by Open...Fp routine
+        if (log_ctx->threaded) {
+            if (LogFileThreadedInit(log_ctx, append) < 0)
+                return -1;
+        } else {
+            log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
+            if (log_ctx->fp == NULL)
+                return -1; // Error already logged by Open...Fp routine
+        }
         log_ctx->is_regular = 1;
         if (rotate) {
             OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
@@ -497,8 +894,45 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->send_flags |= MSG_DONTWAIT;
     }
 #endif
-    SCLogInfo("%s output device (%s) initialized: %s", conf->name, filetype,
-              filename);
+    const char *compression = ConfNodeLookupChildValue(conf, "compression");
+    if (compression != NULL && strcasecmp(compression, "none") != 0) {
+        if (log_ctx->is_regular) {
+            if (LogCompressSetup(log_ctx, conf) < 0)
+                return -1;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.compression is "
+                    "only supported for regular files, ignoring", conf->name);
+        }
+    }
+
+    ConfNode *async = ConfNodeLookupChild(conf, "async");
+    if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+        if (log_ctx->threads != NULL) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async can't be "
+                    "combined with threaded, ignoring", conf->name);
+        } else if (log_ctx->is_regular || log_ctx->is_sock) {
+            if (LogAsyncSetup(log_ctx, async) < 0)
+                return -1;
+#ifdef HAVE_LIBHIREDIS
+        } else if (log_ctx->type == LOGFILE_TYPE_REDIS) {
+            if (SCLogRedisAsyncSetup(log_ctx, async) < 0)
+                return -1;
+#endif
+        } else {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is only "
+                    "supported for regular files, unix sockets and redis, "
+                    "ignoring", conf->name);
+        }
+    }
+
+    if (log_ctx->threaded && log_ctx->threads == NULL) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded is only "
+                "supported for regular files, ignoring", conf->name);
+        log_ctx->threaded = false;
+    }
+
+    SCLogInfo("%s output device (%s) initialized: %s%s", conf->name, filetype,
+              filename, log_ctx->threaded ? " (one file per thread)" : "");
 
     return 0;
 }
@@ -523,7 +957,22 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
         return -1;
     }
 
-    fclose(log_ctx->fp);
+    if (log_ctx->threads != NULL) {
+        /* reopen all thread files on their next write */
+        (void)SC_ATOMIC_ADD(log_ctx->threads->rotation_gen, 1);
+        return 0;
+    }
+
+    if (log_ctx->fp != NULL) {
+        /* finish the frame, so the rotated file is complete */
+        if (log_ctx->compress != NULL)
+            LogCompressEnd(log_ctx->compress, log_ctx->fp);
+        fclose(log_ctx->fp);
+    }
+    log_ctx->size_current = 0;
+    /* a msgpack file starts with the header and its own strings */
+    log_ctx->flags &= ~LOGFILE_MSGPACK_HEADER;
+    log_ctx->msgpack_strings = 0;
 
     /* Reopen the file. Append is forced in case the file was not
      * moved as part of a rotation process. */
@@ -533,6 +982,14 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
         return -1; // Already logged by Open..Fp routine.
     }
 
+    /* appending a new frame to an existing file is fine for lz4 and zstd */
+    if (log_ctx->compress != NULL &&
+            LogCompressBegin(log_ctx->compress, log_ctx->fp) < 0) {
+        fclose(log_ctx->fp);
+        log_ctx->fp = NULL;
+        return -1;
+    }
+
     return 0;
 }
 
@@ -567,14 +1024,35 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    /* write out what is still queued before the file is closed */
+    if (lf_ctx->async != NULL) {
+        LogAsyncFree(lf_ctx->async);
+    }
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
+        if (lf_ctx->compress != NULL)
+            LogCompressEnd(lf_ctx->compress, lf_ctx->fp);
         lf_ctx->Close(lf_ctx);
         SCMutexUnlock(&lf_ctx->fp_mutex);
     }
+    if (lf_ctx->compress != NULL) {
+        LogCompressFree(lf_ctx->compress, lf_ctx->filename);
+    }
 
     SCMutexDestroy(&lf_ctx->fp_mutex);
 
+    if (lf_ctx->threads != NULL) {
+        for (uint32_t i = 0; i < lf_ctx->threads->slot_count; i++) {
+            LogFileFreeCtx(lf_ctx->threads->slots[i]);
+        }
+        if (lf_ctx->threads->slots != NULL)
+            SCFree(lf_ctx->threads->slots);
+        SCMutexDestroy(&lf_ctx->threads->mutex);
+        SC_ATOMIC_DESTROY(lf_ctx->threads->rotation_gen);
+        SCFree(lf_ctx->threads);
+    }
+
     if (lf_ctx->prefix != NULL) {
         SCFree(lf_ctx->prefix);
         lf_ctx->prefix_len = 0;
@@ -609,10 +1087,16 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
-        SCMutexLock(&file_ctx->fp_mutex);
-        LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
-                MEMBUFFER_OFFSET(buffer));
-        SCMutexUnlock(&file_ctx->fp_mutex);
+        if (file_ctx->async != NULL) {
+            /* queued for the writer thread, no lock needed */
+            file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer), file_ctx);
+        } else {
+            SCMutexLock(&file_ctx->fp_mutex);
+            LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer));
+            SCMutexUnlock(&file_ctx->fp_mutex);
+        }
     }
 #endif
 
@@ -47,6 +47,24 @@ typedef struct SyslogSetup_ {
     int alert_syslog_level;
 } SyslogSetup;
 
+struct LogFileCtx_;
+
+/** Per thread files of a LogFileCtx in threaded mode */
+typedef struct LogThreadedFileCtx_ {
+    /** protects the slots and the rotation state of the parent */
+    SCMutex mutex;
+    /** the per thread LogFileCtx's, for rotation and cleanup */
+    struct LogFileCtx_ **slots;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    /** unique id, used to match the thread local lookup cache */
+    uint32_t id;
+    /** open the thread files in append mode */
+    bool append;
+    /** bumped to make all thread files reopen */
+    SC_ATOMIC_DECLARE(uint32_t, rotation_gen);
+} LogThreadedFileCtx;
+
 
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
@@ -131,6 +149,27 @@ typedef struct LogFileCtx_ {
     /* Socket types may need to drop events to keep from blocking
      * Suricata. */
     uint64_t dropped;
+
+    /* Set to true before SCConfLogOpenGeneric() to give each writer
+     * thread its own file. Only used with regular files. */
+    bool threaded;
+    LogThreadedFileCtx *threads;
+
+    /* threaded mode: writer thread and rotation generation this per
+     * thread file was (re)opened for */
+    uint32_t thread_id;
+    uint32_t rotation_gen;
+
+    /* Set if records are handed to an async writer thread. */
+    struct LogAsyncCtx_ *async;
+
+    /* Set if regular files are written compressed. */
+    struct LogCompressCtx_ *compress;
+
+    /* eve "format: msgpack": string table shared by the output, and
+     * the number of its strings already written to this file */
+    struct MsgpackCtx_ *msgpack;
+    uint32_t msgpack_strings;
 } LogFileCtx;
 
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
@@ -140,12 +179,21 @@ typedef struct LogFileCtx_ {
 #define LOGFILE_HEADER_WRITTEN  0x01
 #define LOGFILE_ALERTS_PRINTED  0x02
 #define LOGFILE_ROTATE_INTERVAL 0x04
+#define LOGFILE_ROTATE_SIZE     0x08
+#define LOGFILE_MSGPACK_HEADER  0x10
 
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int SCLogFileWriteRegular(LogFileCtx *log_ctx, const char *buffer,
+        int buffer_len);
+int SCLogFileMsgpackSync(LogFileCtx *log_ctx);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
+
+uint32_t LogThreadCacheNewOwner(void);
+uint32_t LogThreadCacheThreadId(void);
+void **LogThreadCacheSlot(uint32_t owner_id);
 int SCConfLogReopen(LogFileCtx *);
 
 #endif /* __UTIL_LOGOPENFILE_H__ */
@@ -28,7 +28,136 @@
 #include "util-memcmp.h"
 #include "util-unittest.h"
 
-/* code is implemented in util-memcmp.h as it's all inlined */
+/* code is implemented in util-memcmp.h as it's all inlined, except for
+ * the variants selected at runtime below. Those are only used when the
+ * header didn't pick a variant at compile time. */
+
+#ifdef SC_MEMCMP_DISPATCH
+#include <immintrin.h>
+
+static int MemcmpLowercaseScalar(const void *s1, const void *s2, size_t len)
+{
+    return MemcmpLowercase(s1, s2, len);
+}
+
+/**
+ *  \brief lowercase compare using SSE2, 16 bytes at a time
+ *
+ *  The last block overlaps the previous one, so len must be 16 or more.
+ */
+SC_CPU_TARGET("sse2")
+static int MemcmpLowercaseSSE2(const void *s1, const void *s2, size_t len)
+{
+    const __m128i upper_low = _mm_set1_epi8(0x40);  /* 'A' - 1 */
+    const __m128i upper_high = _mm_set1_epi8(0x5B); /* 'Z' + 1 */
+    const __m128i uplow = _mm_set1_epi8(0x20);
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+    size_t offset = 0;
+
+    for (;;) {
+        if (offset + 16 > len)
+            offset = len - 16;
+
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(p1 + offset));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p2 + offset));
+        /* 0x20 for the uppercase chars, 0 for the rest */
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(b2, upper_low),
+                _mm_cmplt_epi8(b2, upper_high));
+        b2 = _mm_add_epi8(b2, _mm_and_si128(upper, uplow));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(b1, b2)) != 0xFFFF)
+            return 1;
+
+        offset += 16;
+        if (offset >= len)
+            return 0;
+    }
+}
+
+/**
+ *  \brief lowercase compare using AVX2, 32 bytes at a time
+ *
+ *  Compares of 16 to 31 bytes use two overlapping 16 byte blocks.
+ */
+SC_CPU_TARGET("avx2")
+static int MemcmpLowercaseAVX2(const void *s1, const void *s2, size_t len)
+{
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+
+    if (len < 32) {
+        const __m128i upper_low = _mm_set1_epi8(0x40);
+        const __m128i upper_high = _mm_set1_epi8(0x5B);
+        const __m128i uplow = _mm_set1_epi8(0x20);
+
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)p1);
+        const __m128i a2 = _mm_loadu_si128((const __m128i *)(p1 + len - 16));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)p2);
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p2 + len - 16));
+        b1 = _mm_add_epi8(b1, _mm_and_si128(uplow, _mm_and_si128(
+                        _mm_cmpgt_epi8(b1, upper_low), _mm_cmplt_epi8(b1, upper_high))));
+        b2 = _mm_add_epi8(b2, _mm_and_si128(uplow, _mm_and_si128(
+                        _mm_cmpgt_epi8(b2, upper_low), _mm_cmplt_epi8(b2, upper_high))));
+        const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a1, b1), _mm_cmpeq_epi8(a2, b2));
+        return (_mm_movemask_epi8(eq) != 0xFFFF);
+    }
+
+    const __m256i upper_low = _mm256_set1_epi8(0x40);
+    const __m256i upper_high = _mm256_set1_epi8(0x5B);
+    const __m256i uplow = _mm256_set1_epi8(0x20);
+    size_t offset = 0;
+
+    for (;;) {
+        if (offset + 32 > len)
+            offset = len - 32;
+
+        const __m256i b1 = _mm256_loadu_si256((const __m256i *)(p1 + offset));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(p2 + offset));
+        const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(b2, upper_low),
+                _mm256_cmpgt_epi8(upper_high, b2));
+        b2 = _mm256_add_epi8(b2, _mm256_and_si256(upper, uplow));
+
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, b2)) != 0xFFFFFFFF)
+            return 1;
+
+        offset += 32;
+        if (offset >= len)
+            return 0;
+    }
+}
+
+SCMemcmpFunc memcmp_lowercase_func = MemcmpLowercaseScalar;
+#endif /* SC_MEMCMP_DISPATCH */
+
+/**
+ *  \brief select the SCMemcmpLowercase variant for this cpu
+ */
+void MemcmpDispatchSetup(void)
+{
+#if defined(__SSE4_2__)
+    UtilCpuDispatchRegister("memcmp", "sse4.2 (build)");
+#elif defined(__SSE4_1__)
+    UtilCpuDispatchRegister("memcmp", "sse4.1 (build)");
+#elif defined(__SSE3__)
+    UtilCpuDispatchRegister("memcmp", "sse3 (build)");
+#elif defined(__tile__)
+    UtilCpuDispatchRegister("memcmp", "tile (build)");
+#elif defined(SC_MEMCMP_DISPATCH)
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        memcmp_lowercase_func = MemcmpLowercaseAVX2;
+        UtilCpuDispatchRegister("memcmp", "avx2");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_SSE2)) {
+        memcmp_lowercase_func = MemcmpLowercaseSSE2;
+        UtilCpuDispatchRegister("memcmp", "sse2");
+    } else {
+        memcmp_lowercase_func = MemcmpLowercaseScalar;
+        UtilCpuDispatchRegister("memcmp", "scalar");
+    }
+#else
+    UtilCpuDispatchRegister("memcmp", "scalar");
+#endif
+}
 
 /* UNITTESTS */
 #ifdef UNITTESTS
@@ -379,6 +508,49 @@ static int MemcmpTest18 (void)
     return 1;
 }
 
+/** \test runtime selected lowercase variants against the scalar one */
+static int MemcmpTest19 (void)
+{
+#ifdef SC_MEMCMP_DISPATCH
+    /* include the chars around 'A' and 'Z' and the high ones */
+    static const uint8_t chars[] = { '@', 'A', 'B', 'Y', 'Z', '[', '`', 'a',
+        'z', '{', '0', 0x80, 0xc1, 0xda, 0xe1, 0xff };
+    uint8_t lc[128];
+    uint8_t mixed[128];
+    uint32_t seed = 1;
+    SCMemcmpFunc funcs[3] = { MemcmpLowercaseScalar, NULL, NULL };
+    int nfuncs = 1;
+
+    if (UtilCpuHasFeature(CPU_FEATURE_SSE2))
+        funcs[nfuncs++] = MemcmpLowercaseSSE2;
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2))
+        funcs[nfuncs++] = MemcmpLowercaseAVX2;
+
+    for (int run = 0; run < 10000; run++) {
+        for (size_t i = 0; i < sizeof(mixed); i++) {
+            seed = seed * 1103515245 + 12345;
+            mixed[i] = chars[(seed >> 16) % sizeof(chars)];
+            lc[i] = u8_tolower(mixed[i]);
+        }
+        seed = seed * 1103515245 + 12345;
+        const size_t len = 16 + (seed >> 16) % (sizeof(lc) - 16);
+        /* make about half of them differ in a single byte */
+        if (run & 1) {
+            seed = seed * 1103515245 + 12345;
+            lc[(seed >> 16) % len] ^= 0x01;
+        }
+
+        const int expect = MemcmpLowercase(lc, mixed, len);
+        for (int f = 0; f < nfuncs; f++) {
+            FAIL_IF(funcs[f](lc, mixed, len) != expect);
+        }
+        FAIL_IF(SCMemcmpLowercase(lc, mixed, len) != expect);
+        FAIL_IF((run & 1) && expect == 0);
+    }
+#endif
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void MemcmpRegisterTests(void)
@@ -402,6 +574,7 @@ void MemcmpRegisterTests(void)
     UtRegisterTest("MemcmpTest16", MemcmpTest16);
     UtRegisterTest("MemcmpTest17", MemcmpTest17);
     UtRegisterTest("MemcmpTest18", MemcmpTest18);
+    UtRegisterTest("MemcmpTest19", MemcmpTest19);
 #endif /* UNITTESTS */
 }
 
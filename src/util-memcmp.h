@@ -30,6 +30,7 @@
 #define __UTIL_MEMCMP_H__
 
 #include "util-optimize.h"
+#include "util-cpu.h"
 
 /** \brief compare two patterns, converting the 2nd to lowercase
  *  \warning *ONLY* the 2nd pattern is converted to lowercase
@@ -37,6 +38,7 @@
 static inline int SCMemcmpLowercase(const void *, const void *, size_t);
 
 void MemcmpRegisterTests(void);
+void MemcmpDispatchSetup(void);
 
 static inline int
 MemcmpLowercase(const void *s1, const void *s2, size_t n)
@@ -482,6 +484,29 @@ static inline int SCMemcmpLowercase(const void *s1, const void *s2, size_t len)
     return 0;
 }
 
+#elif defined(SC_CPU_DISPATCH)
+
+/* x86 build without SSE3 or later enabled at compile time: the lowercase
+ * compare is picked at startup by MemcmpDispatchSetup(). Plain memcmp is
+ * already selected at runtime by libc, so SCMemcmp uses it as is. */
+#define SC_MEMCMP_DISPATCH 1
+
+/* wrapper around memcmp to match the retvals of the SIMD implementations */
+#define SCMemcmp(a,b,c) ({ \
+    memcmp((a), (b), (c)) ? 1 : 0; \
+})
+
+typedef int (*SCMemcmpFunc)(const void *, const void *, size_t);
+extern SCMemcmpFunc memcmp_lowercase_func;
+
+static inline int SCMemcmpLowercase(const void *s1, const void *s2, size_t len)
+{
+    /* the vector variants need at least 16 bytes */
+    if (len < 16)
+        return MemcmpLowercase(s1, s2, len);
+    return memcmp_lowercase_func(s1, s2, len);
+}
+
 #else
 
 /* No SIMD support, fall back to plain memcmp and a home grown lowercase one */
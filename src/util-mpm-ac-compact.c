@@ -0,0 +1,1335 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with compressed state rows.
+ *
+ * "ac" stores a full 256 entry delta row for every state, which makes it
+ * fast but means 512 bytes (or 1k above 32k states) per state. Most of the
+ * states are deep in the trie and have a single goto transition, everything
+ * else on such a row is a copy of the row of its failure state.
+ *
+ * Here only the states closer to the root than 'dense-depth' get a full
+ * delta row. Those are the states the search spends most of its time in.
+ * All other states get a compressed row of 16 bytes: the failure state and
+ * either the (up to 7) bytes that have a goto transition, or a reference to
+ * a 256 bit bitmap of those bytes. The targets of the transitions are kept
+ * in a shared array. A byte without a transition is looked up in the failure
+ * state, until a dense state is reached. The root is always dense, so this
+ * ends. Most deep states have a single transition.
+ *
+ * The trie is built with sparse states too, so the 1k per state goto table
+ * "ac" uses during construction isn't needed either.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-build.h"
+
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-mpm-ac-compact.h"
+
+void SCACCInitCtx(MpmCtx *);
+void SCACCInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCACCDestroyCtx(MpmCtx *);
+void SCACCDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACCAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                      uint32_t, SigIntId, uint8_t);
+int SCACCAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                      uint32_t, SigIntId, uint8_t);
+int SCACCPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACCSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+uint32_t SCACCSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt);
+void SCACCPrintInfo(MpmCtx *mpm_ctx);
+void SCACCPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACCRegisterTests(void);
+
+/* state has outputs, set on the transitions into it */
+#define ACC_OUTPUT_FLAG 0x80000000
+#define ACC_STATE_MASK  0x7FFFFFFF
+/* pattern is case sensitive, set on the pattern ids in the output lists */
+#define ACC_CASE_MASK   0x80000000
+#define ACC_PID_MASK    0x7FFFFFFF
+
+#define ACC_NONE        UINT32_MAX
+
+/** dense depth from the config, 0 if not read yet */
+static uint16_t acc_dense_depth = 0;
+
+/**
+ * \brief State of the trie while building it.
+ */
+typedef struct ACCBuildState_ {
+    /* goto transitions, sorted by byte */
+    uint8_t *bytes;
+    uint32_t *next;
+    uint16_t edge_cnt;
+
+    uint16_t depth;
+    uint32_t fail;
+
+    /* pattern ids, including those of the failure states */
+    uint32_t *pids;
+    uint32_t pid_cnt;
+} ACCBuildState;
+
+typedef struct ACCBuild_ {
+    ACCBuildState *states;
+    uint32_t state_count;
+    uint32_t allocated_state_count;
+
+    /* states in breadth first order and the reverse mapping. The
+     * final state numbers are the positions in this order. */
+    uint32_t *order;
+    uint32_t *newid;
+} ACCBuild;
+
+/**
+ * \internal
+ * \brief Get the dense depth from the config.
+ *
+ *        ac-compact:
+ *          dense-depth: 2
+ */
+static uint16_t ACCGetConfig(void)
+{
+    intmax_t value = ACC_DENSE_DEPTH_DEFAULT;
+
+    if (ConfGetInt("ac-compact.dense-depth", &value) == 1) {
+        if (value < 1 || value > ACC_DENSE_DEPTH_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ac-compact.dense-depth "
+                    "%"PRIdMAX" is out of range 1-%d, using %d", value,
+                    ACC_DENSE_DEPTH_MAX, ACC_DENSE_DEPTH_DEFAULT);
+            value = ACC_DENSE_DEPTH_DEFAULT;
+        }
+    }
+    return (uint16_t)value;
+}
+
+/**
+ * \brief Initialize the ac-compact context.
+ *
+ * \param mpm_ctx Mpm context.
+ */
+void SCACCInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACCCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACCCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+
+    /* contexts are set up by the main thread, only prepare is threaded */
+    if (acc_dense_depth == 0)
+        acc_dense_depth = ACCGetConfig();
+    ((SCACCCtx *)mpm_ctx->ctx)->dense_depth = acc_dense_depth;
+}
+
+/**
+ * \brief Init the mpm thread context. Nothing is kept per thread.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCACCDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACCCtx *ctx = (SCACCCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        for (uint32_t i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i];
+            while (node != NULL) {
+                MpmPattern *next = node->next;
+                if (node->sids != NULL)
+                    SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = next;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+    }
+
+    if (ctx->dense != NULL)
+        SCFree(ctx->dense);
+    if (ctx->rows != NULL)
+        SCFree(ctx->rows);
+    if (ctx->next != NULL)
+        SCFree(ctx->next);
+    if (ctx->bitmaps != NULL)
+        SCFree(ctx->bitmaps);
+    if (ctx->output_index != NULL)
+        SCFree(ctx->output_index);
+    if (ctx->outputs != NULL)
+        SCFree(ctx->outputs);
+    mpm_ctx->memory_size -= ctx->table_size;
+
+    if (ctx->pid_pat_list != NULL) {
+        for (uint32_t i = 0; i < (mpm_ctx->max_pat_id + 1); i++) {
+            if (ctx->pid_pat_list[i].cs != NULL)
+                SCFree(ctx->pid_pat_list[i].cs);
+            if (ctx->pid_pat_list[i].sids != NULL)
+                SCFree(ctx->pid_pat_list[i].sids);
+        }
+        SCFree(ctx->pid_pat_list);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->max_pat_id + 1) * sizeof(SCACCPatternList);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCCtx);
+}
+
+/**
+ * \internal
+ * \brief find the goto transition of a build state
+ *
+ * \retval state next state or ACC_NONE
+ */
+static uint32_t ACCBuildGoto(const ACCBuildState *st, const uint8_t c)
+{
+    int lo = 0, hi = (int)st->edge_cnt - 1;
+    while (lo <= hi) {
+        const int mid = (lo + hi) / 2;
+        if (st->bytes[mid] == c)
+            return st->next[mid];
+        if (st->bytes[mid] < c)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return ACC_NONE;
+}
+
+/**
+ * \internal
+ * \brief add a goto transition, keeping the transitions sorted
+ */
+static int ACCBuildAddEdge(ACCBuildState *st, const uint8_t c, const uint32_t next)
+{
+    uint8_t *bytes = SCRealloc(st->bytes, st->edge_cnt + 1);
+    if (bytes == NULL)
+        return -1;
+    st->bytes = bytes;
+    uint32_t *nexts = SCRealloc(st->next, (st->edge_cnt + 1) * sizeof(uint32_t));
+    if (nexts == NULL)
+        return -1;
+    st->next = nexts;
+
+    uint16_t i = st->edge_cnt;
+    while (i > 0 && st->bytes[i - 1] > c) {
+        st->bytes[i] = st->bytes[i - 1];
+        st->next[i] = st->next[i - 1];
+        i--;
+    }
+    st->bytes[i] = c;
+    st->next[i] = next;
+    st->edge_cnt++;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief add a pattern id to a build state, unless it's already there
+ */
+static int ACCBuildAddPid(ACCBuildState *st, const uint32_t pid)
+{
+    for (uint32_t i = 0; i < st->pid_cnt; i++) {
+        if (st->pids[i] == pid)
+            return 0;
+    }
+    uint32_t *pids = SCRealloc(st->pids, (st->pid_cnt + 1) * sizeof(uint32_t));
+    if (pids == NULL)
+        return -1;
+    st->pids = pids;
+    st->pids[st->pid_cnt++] = pid;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief create a new build state
+ *
+ * \retval state the new state or ACC_NONE on error
+ */
+static uint32_t ACCBuildNewState(ACCBuild *b, const uint16_t depth)
+{
+    if (b->allocated_state_count < b->state_count + 1) {
+        uint32_t cnt = b->allocated_state_count ? b->allocated_state_count * 2 : 256;
+        ACCBuildState *states = SCRealloc(b->states, cnt * sizeof(ACCBuildState));
+        if (states == NULL)
+            return ACC_NONE;
+        memset(states + b->allocated_state_count, 0,
+                (cnt - b->allocated_state_count) * sizeof(ACCBuildState));
+        b->states = states;
+        b->allocated_state_count = cnt;
+    }
+    b->states[b->state_count].depth = depth;
+    return b->state_count++;
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the trie.
+ *
+ * \param pattern lowercase pattern
+ * \param pid     pattern id, with ACC_CASE_MASK set if the match has to
+ *                be confirmed case sensitive
+ */
+static int ACCBuildEnter(ACCBuild *b, const uint8_t *pattern,
+                         const uint16_t pattern_len, const uint32_t pid)
+{
+    uint32_t state = 0;
+
+    for (uint16_t i = 0; i < pattern_len; i++) {
+        uint32_t next = ACCBuildGoto(&b->states[state], pattern[i]);
+        if (next == ACC_NONE) {
+            next = ACCBuildNewState(b, i + 1);
+            if (next == ACC_NONE)
+                return -1;
+            if (ACCBuildAddEdge(&b->states[state], pattern[i], next) != 0)
+                return -1;
+        }
+        state = next;
+    }
+    return ACCBuildAddPid(&b->states[state], pid);
+}
+
+/**
+ * \internal
+ * \brief Walk the trie breadth first to set the failure states and to
+ *        determine the final state numbers. The outputs of the failure
+ *        state are added to each state.
+ */
+static int ACCBuildFailure(ACCBuild *b)
+{
+    b->order = SCMalloc(b->state_count * sizeof(uint32_t));
+    b->newid = SCMalloc(b->state_count * sizeof(uint32_t));
+    if (b->order == NULL || b->newid == NULL)
+        return -1;
+
+    /* in a trie each state is reached once, so the queue doubles as the
+     * order */
+    uint32_t head = 0, tail = 0;
+    b->order[tail++] = 0;
+    b->states[0].fail = 0;
+
+    while (head < tail) {
+        const uint32_t r = b->order[head++];
+        const ACCBuildState *rs = &b->states[r];
+
+        for (uint16_t e = 0; e < rs->edge_cnt; e++) {
+            const uint8_t c = rs->bytes[e];
+            const uint32_t t = rs->next[e];
+            uint32_t fail = 0;
+
+            b->order[tail++] = t;
+
+            if (r != 0) {
+                uint32_t f = rs->fail;
+                for (;;) {
+                    const uint32_t g = ACCBuildGoto(&b->states[f], c);
+                    if (g != ACC_NONE) {
+                        fail = g;
+                        break;
+                    }
+                    if (f == 0)
+                        break;
+                    f = b->states[f].fail;
+                }
+            }
+            b->states[t].fail = fail;
+
+            /* the failure state is less deep, so it is complete */
+            const ACCBuildState *fs = &b->states[fail];
+            for (uint32_t i = 0; i < fs->pid_cnt; i++) {
+                if (ACCBuildAddPid(&b->states[t], fs->pids[i]) != 0)
+                    return -1;
+            }
+        }
+    }
+    BUG_ON(tail != b->state_count);
+
+    for (uint32_t i = 0; i < b->state_count; i++) {
+        b->newid[b->order[i]] = i;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief final state number of a build state, with the output flag
+ */
+static inline uint32_t ACCBuildTarget(const ACCBuild *b, const uint32_t state)
+{
+    return b->newid[state] | (b->states[state].pid_cnt ? ACC_OUTPUT_FLAG : 0);
+}
+
+/**
+ * \internal
+ * \brief Create the dense rows, the compressed rows and the output lists
+ *        from the trie.
+ */
+static int ACCBuildTables(MpmCtx *mpm_ctx, SCACCCtx *ctx, const ACCBuild *b)
+{
+    uint32_t i;
+
+    ctx->state_count = b->state_count;
+
+    /* breadth first order is ordered by depth */
+    for (i = 0; i < b->state_count; i++) {
+        if (b->states[b->order[i]].depth >= ctx->dense_depth)
+            break;
+    }
+    ctx->dense_count = i;
+
+    ctx->next_count = 0;
+    ctx->bitmap_count = 0;
+    ctx->output_count = 0;
+    for (i = 0; i < b->state_count; i++) {
+        const ACCBuildState *st = &b->states[b->order[i]];
+        if (i >= ctx->dense_count) {
+            ctx->next_count += st->edge_cnt;
+            if (st->edge_cnt > ACC_ROW_BYTES)
+                ctx->bitmap_count++;
+        }
+        ctx->output_count += st->pid_cnt;
+    }
+
+    const uint32_t sparse_count = ctx->state_count - ctx->dense_count;
+    const size_t dense_size = (size_t)ctx->dense_count * sizeof(uint32_t) * 256;
+    const size_t rows_size = (size_t)sparse_count * sizeof(SCACCRow);
+    const size_t next_size = (size_t)ctx->next_count * sizeof(uint32_t);
+    const size_t bitmaps_size = (size_t)ctx->bitmap_count * sizeof(SCACCBitmap);
+    const size_t index_size = (size_t)(ctx->state_count + 1) * sizeof(uint32_t);
+    const size_t outputs_size = (size_t)ctx->output_count * sizeof(uint32_t);
+
+    ctx->dense = SCMalloc(dense_size);
+    ctx->output_index = SCMalloc(index_size);
+    if (ctx->dense == NULL || ctx->output_index == NULL)
+        return -1;
+    if (sparse_count > 0) {
+        ctx->rows = SCMalloc(rows_size);
+        if (ctx->rows == NULL)
+            return -1;
+        memset(ctx->rows, 0, rows_size);
+    }
+    if (ctx->next_count > 0) {
+        ctx->next = SCMalloc(next_size);
+        if (ctx->next == NULL)
+            return -1;
+    }
+    if (ctx->bitmap_count > 0) {
+        ctx->bitmaps = SCMalloc(bitmaps_size);
+        if (ctx->bitmaps == NULL)
+            return -1;
+        memset(ctx->bitmaps, 0, bitmaps_size);
+    }
+    if (ctx->output_count > 0) {
+        ctx->outputs = SCMalloc(outputs_size);
+        if (ctx->outputs == NULL)
+            return -1;
+    }
+    ctx->table_size = dense_size + rows_size + next_size + bitmaps_size +
+        index_size + outputs_size;
+    mpm_ctx->memory_cnt += 6;
+    mpm_ctx->memory_size += ctx->table_size;
+
+    /* dense rows: the row of the failure state with the goto transitions
+     * on top. The failure state is less deep, so it is dense and done. */
+    for (i = 0; i < ctx->dense_count; i++) {
+        const ACCBuildState *st = &b->states[b->order[i]];
+        if (i == 0) {
+            memset(ctx->dense[0], 0, sizeof(ctx->dense[0]));
+        } else {
+            memcpy(ctx->dense[i], ctx->dense[b->newid[st->fail]],
+                    sizeof(ctx->dense[i]));
+        }
+        for (uint16_t e = 0; e < st->edge_cnt; e++) {
+            ctx->dense[i][st->bytes[e]] = ACCBuildTarget(b, st->next[e]);
+        }
+    }
+
+    /* compressed rows */
+    uint32_t n = 0, bm = 0;
+    for (i = ctx->dense_count; i < ctx->state_count; i++) {
+        const ACCBuildState *st = &b->states[b->order[i]];
+        SCACCRow *row = &ctx->rows[i - ctx->dense_count];
+
+        const uint32_t base = n;
+        row->fail = b->newid[st->fail];
+        /* edges are sorted, so the targets are in bitmap order */
+        for (uint16_t e = 0; e < st->edge_cnt; e++) {
+            ctx->next[n++] = ACCBuildTarget(b, st->next[e]);
+        }
+
+        if (st->edge_cnt <= ACC_ROW_BYTES) {
+            row->base = base;
+            row->cnt = (uint8_t)st->edge_cnt;
+            if (st->edge_cnt > 0)
+                memcpy(row->bytes, st->bytes, st->edge_cnt);
+            continue;
+        }
+
+        SCACCBitmap *bitmap = &ctx->bitmaps[bm];
+        bitmap->base = base;
+        row->cnt = ACC_ROW_BITMAP;
+        row->base = bm++;
+        for (uint16_t e = 0; e < st->edge_cnt; e++) {
+            const uint8_t c = st->bytes[e];
+            bitmap->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+        }
+        bitmap->rank[0] = 0;
+        for (int w = 1; w < 4; w++) {
+            bitmap->rank[w] = bitmap->rank[w - 1] +
+                __builtin_popcountll(bitmap->bits[w - 1]);
+        }
+    }
+
+    /* output lists */
+    uint32_t o = 0;
+    for (i = 0; i < ctx->state_count; i++) {
+        const ACCBuildState *st = &b->states[b->order[i]];
+        ctx->output_index[i] = o;
+        if (st->pid_cnt > 0) {
+            memcpy(ctx->outputs + o, st->pids, st->pid_cnt * sizeof(uint32_t));
+            o += st->pid_cnt;
+        }
+    }
+    ctx->output_index[ctx->state_count] = o;
+
+    return 0;
+}
+
+static void ACCBuildFree(ACCBuild *b)
+{
+    for (uint32_t i = 0; i < b->state_count; i++) {
+        if (b->states[i].bytes != NULL)
+            SCFree(b->states[i].bytes);
+        if (b->states[i].next != NULL)
+            SCFree(b->states[i].next);
+        if (b->states[i].pids != NULL)
+            SCFree(b->states[i].pids);
+    }
+    if (b->states != NULL)
+        SCFree(b->states);
+    if (b->order != NULL)
+        SCFree(b->order);
+    if (b->newid != NULL)
+        SCFree(b->newid);
+}
+
+/**
+ * \internal
+ * \brief Build the trie from the patterns and turn it into the tables.
+ */
+static int ACCPrepareStateTable(MpmCtx *mpm_ctx, SCACCCtx *ctx, MpmPattern **parray)
+{
+    ACCBuild b;
+    memset(&b, 0, sizeof(b));
+    int r = -1;
+
+    /* the root */
+    if (ACCBuildNewState(&b, 0) == ACC_NONE)
+        goto end;
+
+    for (uint32_t i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        const MpmPattern *p = parray[i];
+        uint32_t pid = p->id;
+        if (!(p->flags & MPM_PATTERN_FLAG_NOCASE))
+            pid |= ACC_CASE_MASK;
+        if (ACCBuildEnter(&b, p->ci, p->len, pid) != 0)
+            goto end;
+    }
+
+    if (ACCBuildFailure(&b) != 0)
+        goto end;
+    if (ACCBuildTables(mpm_ctx, ctx, &b) != 0)
+        goto end;
+
+    SCLogDebug("%u states, %u dense, %"PRIu64" bytes, %"PRIu64" per state",
+            ctx->state_count, ctx->dense_count, ctx->table_size,
+            ctx->table_size / ctx->state_count);
+    r = 0;
+end:
+    ACCBuildFree(&b);
+    return r;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACCCtx *ctx = (SCACCCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    MpmPattern **parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+    if (parray == NULL)
+        goto error;
+    memset(parray, 0, mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+
+    /* populate it with the patterns in the hash */
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    int r = -1;
+    ctx->pid_pat_list = SCMalloc((mpm_ctx->max_pat_id + 1) * sizeof(SCACCPatternList));
+    if (ctx->pid_pat_list == NULL)
+        goto free_patterns;
+    memset(ctx->pid_pat_list, 0, (mpm_ctx->max_pat_id + 1) * sizeof(SCACCPatternList));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->max_pat_id + 1) * sizeof(SCACCPatternList);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmPattern *pat = parray[i];
+        SCACCPatternList *pl = &ctx->pid_pat_list[pat->id];
+
+        if (!(pat->flags & MPM_PATTERN_FLAG_NOCASE)) {
+            pl->cs = SCMalloc(pat->len);
+            if (pl->cs == NULL)
+                goto free_patterns;
+            memcpy(pl->cs, pat->original_pat, pat->len);
+        }
+        pl->patlen = pat->len;
+        pl->offset = pat->offset;
+        pl->depth = pat->depth;
+
+        /* the pattern list owns the sids now */
+        pl->sids_size = pat->sids_size;
+        pl->sids = pat->sids;
+        pat->sids_size = 0;
+        pat->sids = NULL;
+    }
+
+    r = ACCPrepareStateTable(mpm_ctx, ctx, parray);
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+
+free_patterns:
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (parray[i]->sids != NULL)
+            SCFree(parray[i]->sids);
+        MpmFreePattern(mpm_ctx, parray[i]);
+    }
+    SCFree(parray);
+
+    if (r != 0)
+        goto error;
+    return 0;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "failed to prepare ac-compact mpm");
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Get the next state.
+ *
+ * Compressed rows without a transition for 'c' defer to their failure
+ * state, until a row has it or a dense row is reached.
+ */
+static inline uint32_t ACCNextState(const SCACCCtx *ctx, uint32_t state, const uint8_t c)
+{
+    while (state >= ctx->dense_count) {
+        const SCACCRow *row = &ctx->rows[state - ctx->dense_count];
+        if (row->cnt != ACC_ROW_BITMAP) {
+            for (uint8_t e = 0; e < row->cnt; e++) {
+                if (row->bytes[e] == c)
+                    return ctx->next[row->base + e];
+            }
+        } else {
+            const SCACCBitmap *bitmap = &ctx->bitmaps[row->base];
+            const int w = c >> 6;
+            const uint64_t bit = (uint64_t)1 << (c & 63);
+            const uint64_t word = bitmap->bits[w];
+            if (word & bit) {
+                return ctx->next[bitmap->base + bitmap->rank[w] +
+                    __builtin_popcountll(word & (bit - 1))];
+            }
+        }
+        state = row->fail;
+    }
+    return ctx->dense[state][c];
+}
+
+/**
+ * \internal
+ * \brief Check the patterns that end in 'state' at buffer position 'i'.
+ *
+ * \retval matches number of patterns that matched
+ */
+static inline uint32_t ACCOutput(const SCACCCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t i, const uint32_t state)
+{
+    uint32_t matches = 0;
+
+    for (uint32_t k = ctx->output_index[state]; k < ctx->output_index[state + 1]; k++) {
+        const uint32_t pid = ctx->outputs[k] & ACC_PID_MASK;
+        const SCACCPatternList *pat = &ctx->pid_pat_list[pid];
+        const int offset = i - pat->patlen + 1;
+
+        if (offset < (int)pat->offset || (pat->depth && i > pat->depth))
+            continue;
+
+        if ((ctx->outputs[k] & ACC_CASE_MASK) &&
+                SCMemcmp(pat->cs, buf + offset, pat->patlen) != 0)
+            continue;
+
+        if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+            bitarray[pid / 8] |= (1 << (pid % 8));
+            PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+        }
+        matches++;
+    }
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Run a single buffer through the automaton.
+ */
+static inline uint32_t ACCSearchBuffer(const SCACCCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen)
+{
+    uint32_t matches = 0;
+    uint32_t state = 0;
+
+    for (uint32_t i = 0; i < buflen; i++) {
+        state = ACCNextState(ctx, state & ACC_STATE_MASK, u8_tolower(buf[i]));
+        if (state & ACC_OUTPUT_FLAG) {
+            matches += ACCOutput(ctx, pmq, bitarray, buf, i, state & ACC_STATE_MASK);
+        }
+    }
+    return matches;
+}
+
+/**
+ * \brief The ac-compact search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACCSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    const SCACCCtx *ctx = (SCACCCtx *)mpm_ctx->ctx;
+
+    if (ctx->state_count == 0)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    return ACCSearchBuffer(ctx, pmq, bitarray, buf, buflen);
+}
+
+/**
+ * \brief Batched search. All buffers share the pattern id bitarray, so
+ *        sids are added to the pmq once per batch.
+ *
+ * \retval matches Match count over all buffers.
+ */
+uint32_t SCACCSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt)
+{
+    const SCACCCtx *ctx = (SCACCCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+
+    for (uint32_t i = 0; i < cnt; i++)
+        vec[i].matches = 0;
+    if (ctx->state_count == 0)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (vec[i].len == 0)
+            continue;
+        vec[i].matches = ACCSearchBuffer(ctx, pmq, bitarray, vec[i].buf, vec[i].len);
+        matches += vec[i].matches;
+    }
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  The pattern offset.
+ * \param depth   The pattern depth.
+ * \param pid     The pattern id.
+ * \param sid     The signature internal id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                      uint16_t offset, uint16_t depth, uint32_t pid,
+                      SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  The pattern offset.
+ * \param depth   The pattern depth.
+ * \param pid     The pattern id.
+ * \param sid     The signature internal id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                      uint16_t offset, uint16_t depth, uint32_t pid,
+                      SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCACCPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+void SCACCPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACCCtx *ctx = (SCACCCtx *)mpm_ctx->ctx;
+
+    printf("MPM AC Compact Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACCCtx:      %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCCtx));
+    printf("  SCACCRow:      %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCRow));
+    printf("  SCACCBitmap:   %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCBitmap));
+    printf("  MpmPattern     %" PRIuMAX "\n", (uintmax_t)sizeof(MpmPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Dense depth:     %" PRIu32 "\n", ctx->dense_depth);
+    printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
+    printf("Dense states:                       %" PRIu32 "\n", ctx->dense_count);
+    printf("Bitmap states:                      %" PRIu32 "\n", ctx->bitmap_count);
+    printf("State table bytes:                  %" PRIu64 "\n", ctx->table_size);
+    if (ctx->state_count > 0) {
+        printf("Bytes per state:                    %" PRIu64 "\n",
+                ctx->table_size / ctx->state_count);
+    }
+    printf("\n");
+}
+
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the aho-corasick compact mpm.
+ */
+void MpmACCompactRegister(void)
+{
+    mpm_table[MPM_AC_COMPACT].name = "ac-compact";
+    mpm_table[MPM_AC_COMPACT].InitCtx = SCACCInitCtx;
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx = SCACCInitThreadCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyCtx = SCACCDestroyCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx = SCACCDestroyThreadCtx;
+    mpm_table[MPM_AC_COMPACT].AddPattern = SCACCAddPatternCS;
+    mpm_table[MPM_AC_COMPACT].AddPatternNocase = SCACCAddPatternCI;
+    mpm_table[MPM_AC_COMPACT].Prepare = SCACCPreparePatterns;
+    mpm_table[MPM_AC_COMPACT].Search = SCACCSearch;
+    mpm_table[MPM_AC_COMPACT].SearchVector = SCACCSearchVector;
+    mpm_table[MPM_AC_COMPACT].PrintCtx = SCACCPrintInfo;
+    mpm_table[MPM_AC_COMPACT].PrintThreadCtx = SCACCPrintSearchStats;
+    mpm_table[MPM_AC_COMPACT].RegisterUnittests = SCACCRegisterTests;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+typedef struct ACCTestPattern_ {
+    const char *pat;
+    int nocase;
+} ACCTestPattern;
+
+/**
+ * \internal
+ * \brief add 'pats' with pattern ids 0..n-1, search 'buf' and return the
+ *        match count.
+ */
+static uint32_t ACCTestSearch(const ACCTestPattern *pats, uint32_t n,
+        uint16_t dense_depth, const uint8_t *buf, uint32_t buflen)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    ((SCACCCtx *)mpm_ctx.ctx)->dense_depth = dense_depth;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint16_t len = (uint16_t)strlen(pats[i].pat);
+        if (pats[i].nocase)
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)pats[i].pat, len, 0, 0, i, 0, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)pats[i].pat, len, 0, 0, i, 0, 0);
+    }
+    PmqSetup(&pmq);
+
+    SCACCPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+
+    SCACCDestroyCtx(&mpm_ctx);
+    SCACCDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/* run with only the root dense and with the default */
+#define ACC_TEST(pats, buf, expect) do { \
+    FAIL_IF(ACCTestSearch((pats), sizeof(pats) / sizeof(pats[0]), 1, \
+                (const uint8_t *)(buf), strlen(buf)) != (expect)); \
+    FAIL_IF(ACCTestSearch((pats), sizeof(pats) / sizeof(pats[0]), \
+                ACC_DENSE_DEPTH_DEFAULT, \
+                (const uint8_t *)(buf), strlen(buf)) != (expect)); \
+} while (0)
+
+static int SCACCTest01(void)
+{
+    ACCTestPattern pats[] = { { "abcd", 0 } };
+    ACC_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 1);
+    PASS;
+}
+
+static int SCACCTest02(void)
+{
+    ACCTestPattern pats[] = { { "abce", 0 } };
+    ACC_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 0);
+    PASS;
+}
+
+/** \test overlapping patterns and patterns that are suffixes of others,
+ *        so that outputs come in through the failure states */
+static int SCACCTest03(void)
+{
+    ACCTestPattern pats[] = { { "he", 0 }, { "she", 0 }, { "his", 0 },
+                              { "hers", 0 } };
+    ACC_TEST(pats, "ushers", 3);
+    ACC_TEST(pats, "ahishers", 4);
+    PASS;
+}
+
+/** \test failing over from a deep compressed row to another deep state */
+static int SCACCTest04(void)
+{
+    ACCTestPattern pats[] = { { "abcdex", 0 }, { "bcdey", 0 }, { "cdez", 0 } };
+    ACC_TEST(pats, "abcdez", 1);
+    ACC_TEST(pats, "abcdey", 1);
+    ACC_TEST(pats, "abcdeabcdex", 1);
+    PASS;
+}
+
+static int SCACCTest05(void)
+{
+    ACCTestPattern pats[] = { { "ONE", 0 }, { "one", 1 } };
+    ACC_TEST(pats, "tONE", 2);
+    ACC_TEST(pats, "tOnE", 1);
+    ACC_TEST(pats, "tone", 1);
+    PASS;
+}
+
+/** \test bytes in every bitmap word and the edges of the words */
+static int SCACCTest06(void)
+{
+    const uint8_t p0[] = { 'x', 0x00, 0x3f, 0x40 };
+    const uint8_t p1[] = { 'x', 0x7f, 0x80, 0xbf };
+    const uint8_t p2[] = { 'x', 0xc0, 0xff };
+    const uint8_t p3[] = { 'x', 0x3f, 0xc0, 0x00 };
+    const uint8_t buf[] = { 'x', 0x00, 0x3f, 0x40, 'x', 0x7f, 0x80, 0xbf,
+                            'x', 0xc0, 0xff, 'x', 0x3f, 0xc0, 0x00 };
+
+    for (uint16_t d = 1; d <= 3; d++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PrefilterRuleStore pmq;
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+        SCACCInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        ((SCACCCtx *)mpm_ctx.ctx)->dense_depth = d;
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)p0, sizeof(p0), 0, 0, 0, 0, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)p1, sizeof(p1), 0, 0, 1, 1, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)p2, sizeof(p2), 0, 0, 2, 2, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)p3, sizeof(p3), 0, 0, 3, 3, 0);
+        PmqSetup(&pmq);
+        FAIL_IF(SCACCPreparePatterns(&mpm_ctx) != 0);
+
+        FAIL_IF(SCACCSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, sizeof(buf)) != 4);
+        FAIL_IF(pmq.rule_id_array_cnt != 4);
+
+        SCACCDestroyCtx(&mpm_ctx);
+        SCACCDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+    PASS;
+}
+
+/** \test offset and depth are enforced like in AC */
+static int SCACCTest07(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* only at offset >= 4 */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abc", 3, 4, 0, 0, 0, 0);
+    /* must end at or before index 5 */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"def", 3, 0, 5, 1, 1, 0);
+    PmqSetup(&pmq);
+    FAIL_IF(SCACCPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "abcdefabcdef";
+    uint32_t cnt = SCACCSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+            (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+    FAIL_IF(pmq.rule_id_array_cnt != 2);
+
+    SCACCDestroyCtx(&mpm_ctx);
+    SCACCDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/**
+ * \internal
+ * \brief simple deterministic generator for the randomized tests
+ */
+static uint32_t ACCTestRand(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+/**
+ * \internal
+ * \brief run the same random patterns through ac-compact and ac and
+ *        compare the match counts and the sids added to the pmq
+ */
+static int ACCTestCompareAC(uint32_t seed, uint32_t pattern_cnt,
+        uint16_t dense_depth, uint16_t maxlen)
+{
+    MpmCtx c_ctx, a_ctx;
+    MpmThreadCtx c_tctx, a_tctx;
+    PrefilterRuleStore c_pmq, a_pmq;
+    uint32_t state = seed;
+
+    memset(&c_ctx, 0, sizeof(MpmCtx));
+    memset(&a_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&c_ctx, MPM_AC_COMPACT);
+    MpmInitCtx(&a_ctx, MPM_AC);
+    MpmInitThreadCtx(&c_tctx, MPM_AC_COMPACT);
+    MpmInitThreadCtx(&a_tctx, MPM_AC);
+    PmqSetup(&c_pmq);
+    PmqSetup(&a_pmq);
+    ((SCACCCtx *)c_ctx.ctx)->dense_depth = dense_depth;
+
+    /* small alphabet with mixed case to get plenty of hits */
+    static const char alphabet[] = "abcABC01";
+    for (uint32_t i = 0; i < pattern_cnt; i++) {
+        uint8_t pat[maxlen];
+        uint16_t len = 1 + ACCTestRand(&state) % maxlen;
+        for (uint16_t x = 0; x < len; x++)
+            pat[x] = alphabet[ACCTestRand(&state) % (sizeof(alphabet) - 1)];
+        if (ACCTestRand(&state) & 1) {
+            MpmAddPatternCI(&c_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCI(&a_ctx, pat, len, 0, 0, i, i, 0);
+        } else {
+            MpmAddPatternCS(&c_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCS(&a_ctx, pat, len, 0, 0, i, i, 0);
+        }
+    }
+    FAIL_IF(mpm_table[MPM_AC_COMPACT].Prepare(&c_ctx) != 0);
+    FAIL_IF(mpm_table[MPM_AC].Prepare(&a_ctx) != 0);
+
+    uint8_t buf[1500];
+    for (int round = 0; round < 8; round++) {
+        uint32_t buflen = ACCTestRand(&state) % sizeof(buf);
+        for (uint32_t x = 0; x < buflen; x++)
+            buf[x] = alphabet[ACCTestRand(&state) % (sizeof(alphabet) - 1)];
+
+        PmqReset(&c_pmq);
+        PmqReset(&a_pmq);
+        uint32_t c = mpm_table[MPM_AC_COMPACT].Search(&c_ctx, &c_tctx, &c_pmq, buf, buflen);
+        uint32_t a = mpm_table[MPM_AC].Search(&a_ctx, &a_tctx, &a_pmq, buf, buflen);
+        FAIL_IF(c != a);
+        FAIL_IF(c_pmq.rule_id_array_cnt != a_pmq.rule_id_array_cnt);
+
+        /* same sids, possibly in a different order */
+        uint8_t seen[pattern_cnt];
+        memset(seen, 0, sizeof(seen));
+        for (uint32_t x = 0; x < a_pmq.rule_id_array_cnt; x++)
+            seen[a_pmq.rule_id_array[x]] = 1;
+        for (uint32_t x = 0; x < c_pmq.rule_id_array_cnt; x++)
+            FAIL_IF(seen[c_pmq.rule_id_array[x]] != 1);
+    }
+
+    mpm_table[MPM_AC_COMPACT].DestroyCtx(&c_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&a_ctx);
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx(NULL, &c_tctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(NULL, &a_tctx);
+    PmqFree(&c_pmq);
+    PmqFree(&a_pmq);
+    PASS;
+}
+
+/** \test random sets against AC, for several dense depths */
+static int SCACCTest08(void)
+{
+    for (uint32_t seed = 1; seed <= 8; seed++) {
+        for (uint16_t d = 1; d <= 4; d++) {
+            FAIL_IF_NOT(ACCTestCompareAC(seed, seed * 16, d, 8));
+        }
+    }
+    PASS;
+}
+
+/** \test large set with long patterns, so most states are compressed */
+static int SCACCTest09(void)
+{
+    FAIL_IF_NOT(ACCTestCompareAC(42, 2000, 1, 32));
+    FAIL_IF_NOT(ACCTestCompareAC(43, 2000, ACC_DENSE_DEPTH_DEFAULT, 32));
+    PASS;
+}
+
+/** \test compressed rows use a lot less memory per state than ac */
+static int SCACCTest10(void)
+{
+    MpmCtx mpm_ctx;
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    ((SCACCCtx *)mpm_ctx.ctx)->dense_depth = 1;
+
+    char pat[32];
+    for (uint32_t i = 0; i < 1000; i++) {
+        snprintf(pat, sizeof(pat), "pattern-%08u-xyz", i * 7919);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, i, 0);
+    }
+    FAIL_IF(SCACCPreparePatterns(&mpm_ctx) != 0);
+
+    const SCACCCtx *ctx = (SCACCCtx *)mpm_ctx.ctx;
+    FAIL_IF(ctx->state_count < 1000);
+    FAIL_IF(ctx->dense_count != 1);
+    /* ac needs 512 or 1024 bytes per state */
+    FAIL_IF(ctx->table_size / ctx->state_count > 32);
+
+    SCACCDestroyCtx(&mpm_ctx);
+    PASS;
+}
+
+static int SCACCTest11(void)
+{
+    uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
+    uint16_t buflen = strlen((char *)buf);
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_matcher = MPM_AC_COMPACT;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"onetwothreefourfivesixseveneightnine\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"onetwothreefourfivesixseveneightnine\"; fast_pattern:3,3; sid:2;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 1);
+    FAIL_IF_NOT(PacketAlertCheck(p, 2) == 1);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
+/** \test batched search matches the per buffer search and adds the sids
+ *        of a pattern found in several buffers once */
+static int SCACCTest12(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+    FAIL_IF(SCACCPreparePatterns(&mpm_ctx) != 0);
+
+    MpmVector vec[4] = {
+        { (const uint8_t *)"abcdXYZ", 7, 10, 0 },
+        { (const uint8_t *)"xyzab", 5, 11, 0 },
+        { (const uint8_t *)"cd", 2, 12, 0 },
+        { NULL, 0, 13, 0 },
+    };
+
+    uint32_t cnt = SCACCSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq, vec, 4);
+    FAIL_IF_NOT(cnt == 3);
+    FAIL_IF_NOT(vec[0].matches == 2);
+    FAIL_IF_NOT(vec[1].matches == 1);
+    FAIL_IF_NOT(vec[2].matches == 0);
+    FAIL_IF_NOT(vec[3].matches == 0);
+    FAIL_IF_NOT(vec[2].tag == 12);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+
+    SCACCDestroyCtx(&mpm_ctx);
+    SCACCDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCACCRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCACCTest01", SCACCTest01);
+    UtRegisterTest("SCACCTest02", SCACCTest02);
+    UtRegisterTest("SCACCTest03", SCACCTest03);
+    UtRegisterTest("SCACCTest04", SCACCTest04);
+    UtRegisterTest("SCACCTest05", SCACCTest05);
+    UtRegisterTest("SCACCTest06", SCACCTest06);
+    UtRegisterTest("SCACCTest07", SCACCTest07);
+    UtRegisterTest("SCACCTest08", SCACCTest08);
+    UtRegisterTest("SCACCTest09", SCACCTest09);
+    UtRegisterTest("SCACCTest10", SCACCTest10);
+    UtRegisterTest("SCACCTest11", SCACCTest11);
+    UtRegisterTest("SCACCTest12", SCACCTest12);
+#endif /* UNITTESTS */
+}
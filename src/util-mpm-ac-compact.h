@@ -0,0 +1,113 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with compressed state rows, for low memory setups.
+ */
+
+#ifndef __UTIL_MPM_AC_COMPACT__H__
+#define __UTIL_MPM_AC_COMPACT__H__
+
+#include "util-mpm.h"
+
+/** default depth below which states get a full transition row */
+#define ACC_DENSE_DEPTH_DEFAULT 2
+#define ACC_DENSE_DEPTH_MAX     8
+
+typedef struct SCACCPatternList_ {
+    /* case sensitive pattern, NULL for nocase patterns */
+    uint8_t *cs;
+    uint16_t patlen;
+
+    uint16_t offset;
+    uint16_t depth;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCACCPatternList;
+
+/** max goto transitions stored in the row itself */
+#define ACC_ROW_BYTES   7
+/** SCACCRow::cnt value of rows that use a bitmap */
+#define ACC_ROW_BITMAP  0xff
+
+/**
+ * Bitmap of the bytes with a goto transition, for compressed rows with
+ * more than ACC_ROW_BYTES transitions.
+ */
+typedef struct SCACCBitmap_ {
+    uint64_t bits[4];
+    /* first goto target in SCACCCtx::next */
+    uint32_t base;
+    /* number of bits set in the words before this one */
+    uint8_t rank[4];
+} SCACCBitmap;
+
+/**
+ * Compressed row of a state that is too deep to get a full row. The
+ * goto targets are stored in SCACCCtx::next in byte order. Bytes without
+ * a transition are looked up in the failure state.
+ */
+typedef struct SCACCRow_ {
+    uint32_t fail;
+    /* first goto target in SCACCCtx::next or, if cnt is ACC_ROW_BITMAP,
+     * the index in SCACCCtx::bitmaps */
+    uint32_t base;
+    /* number of goto transitions or ACC_ROW_BITMAP */
+    uint8_t cnt;
+    /* the transition bytes, if cnt <= ACC_ROW_BYTES */
+    uint8_t bytes[ACC_ROW_BYTES];
+} SCACCRow;
+
+typedef struct SCACCCtx_ {
+    /* states with a depth below this get a full row */
+    uint16_t dense_depth;
+
+    /* no of states used by ac */
+    uint32_t state_count;
+    /* states 0 to dense_count - 1 are dense, the rest are in 'rows' */
+    uint32_t dense_count;
+
+    /* full delta rows of the dense states */
+    uint32_t (*dense)[256];
+    /* compressed rows for states dense_count and up */
+    SCACCRow *rows;
+    /* goto targets of the compressed rows */
+    uint32_t *next;
+    uint32_t next_count;
+    SCACCBitmap *bitmaps;
+    uint32_t bitmap_count;
+
+    /* pattern ids per state: outputs[output_index[s]] to
+     * outputs[output_index[s+1]-1] */
+    uint32_t *output_index;
+    uint32_t *outputs;
+    uint32_t output_count;
+
+    SCACCPatternList *pid_pat_list;
+    uint32_t pattern_id_bitarray_size;
+
+    /* bytes used by the state tables, excluding the pattern list */
+    uint64_t table_size;
+} SCACCCtx;
+
+void MpmACCompactRegister(void);
+
+#endif /* __UTIL_MPM_AC_COMPACT__H__ */
@@ -71,6 +71,8 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+uint32_t SCACSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACRegisterTests(void);
@@ -1015,21 +1017,17 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
 }
 
 /**
- * \brief The aho corasick search function.
+ * \brief Search a single buffer. The sids of a pattern are only added if
+ *        its bit in bitarray isn't set yet.
  *
- * \param mpm_ctx        Pointer to the mpm context.
- * \param mpm_thread_ctx Pointer to the mpm thread context.
- * \param pmq            Pointer to the Pattern Matcher Queue to hold
- *                       search matches.
- * \param buf            Buffer to be searched.
- * \param buflen         Buffer length.
+ * \param bitarray pattern id bitarray, shared by all buffers of a search
  *
  * \retval matches Match count.
  */
-uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                    PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+static inline uint32_t SCACSearchBuffer(const SCACCtx *ctx,
+        PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen,
+        uint8_t *bitarray)
 {
-    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
     uint32_t i = 0;
     int matches = 0;
 
@@ -1038,9 +1036,6 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     /* \todo Change it for stateful MPM.  Supply the state using mpm_thread_ctx */
     const SCACPatternList *pid_pat_list = ctx->pid_pat_list;
 
-    uint8_t bitarray[ctx->pattern_id_bitarray_size];
-    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
-
     if (ctx->state_count < 32767) {
         register SC_AC_STATE_TYPE_U16 state = 0;
         SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
@@ -1147,6 +1142,57 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return matches;
 }
 
+/**
+ * \brief The aho corasick search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                    PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    return SCACSearchBuffer(ctx, pmq, buf, buflen, bitarray);
+}
+
+/**
+ * \brief Batched search. Runs the buffers through the state table one
+ *        after the other with a single pattern id bitarray, so sids are
+ *        added to the pmq once per batch instead of once per buffer.
+ *
+ * \retval matches Match count over all buffers.
+ */
+uint32_t SCACSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t i;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    for (i = 0; i < cnt; i++) {
+        vec[i].matches = 0;
+        if (vec[i].len == 0)
+            continue;
+        vec[i].matches = SCACSearchBuffer(ctx, pmq, vec[i].buf, vec[i].len,
+                bitarray);
+        matches += vec[i].matches;
+    }
+    return matches;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1247,6 +1293,7 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchVector = SCACSearchVector;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
@@ -2280,6 +2327,47 @@ end:
     return result;
 }
 
+/** \test batched search: per buffer matches, no matches spanning buffers
+ *        and sids added once per batch */
+static int SCACTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    MpmVector vec[4] = {
+        { (const uint8_t *)"abcdXYZ", 7, 10, 0 },
+        { (const uint8_t *)"xyzab", 5, 11, 0 },
+        { (const uint8_t *)"cd", 2, 12, 0 },
+        { NULL, 0, 13, 0 },
+    };
+
+    uint32_t cnt = SCACSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq, vec, 4);
+    FAIL_IF_NOT(cnt == 3);
+    FAIL_IF_NOT(vec[0].matches == 2);
+    FAIL_IF_NOT(vec[1].matches == 1);
+    FAIL_IF_NOT(vec[2].matches == 0);
+    FAIL_IF_NOT(vec[3].matches == 0);
+    FAIL_IF_NOT(vec[1].tag == 11);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2315,6 +2403,7 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
 #endif
 
     return;
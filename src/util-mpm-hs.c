@@ -57,6 +57,14 @@ int SCHSAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCHSPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, const uint32_t buflen);
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt);
+uint32_t SCHSStreamSize(const MpmCtx *mpm_ctx);
+int SCHSStreamOpen(const MpmCtx *mpm_ctx, void **stream);
+uint32_t SCHSStreamScan(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                        void *stream, PrefilterRuleStore *pmq,
+                        const uint8_t *buf, const uint32_t buflen);
+void SCHSStreamClose(void *stream);
 void SCHSPrintInfo(MpmCtx *mpm_ctx);
 void SCHSPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCHSRegisterTests(void);
@@ -67,12 +75,6 @@ void SCHSRegisterTests(void);
 /* Initial size of the global database hash (used for de-duplication). */
 #define INIT_DB_HASH_SIZE 1000
 
-/* Global prototype scratch, built incrementally as Hyperscan databases are
- * built and then cloned for each thread context. Access is serialised via
- * g_scratch_proto_mutex. */
-static hs_scratch_t *g_scratch_proto = NULL;
-static SCMutex g_scratch_proto_mutex = SCMUTEX_INITIALIZER;
-
 /* Global hash table of Hyperscan databases, used for de-duplication. Access is
  * serialised via g_db_table_mutex. */
 static HashTable *g_db_table = NULL;
@@ -442,6 +444,12 @@ typedef struct PatternDatabase_ {
     hs_database_t *hs_db;
     uint32_t pattern_cnt;
 
+    /* streaming mode database, only built for MPMCTX_FLAGS_STREAM ctxs.
+     * Part of the hash key, so block only ctxs don't pay for it. */
+    bool stream;
+    hs_database_t *hs_stream_db;
+    size_t hs_stream_size;
+
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
 } PatternDatabase;
@@ -487,6 +495,7 @@ static uint32_t PatternDatabaseHash(HashTable *ht, void *data, uint16_t len)
     const PatternDatabase *pd = data;
     uint32_t hash = 0;
     hash = hashword(&pd->pattern_cnt, 1, hash);
+    hash = hashlittle_safe(&pd->stream, sizeof(pd->stream), hash);
 
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
         hash = SCHSPatternHash(pd->parray[i], hash);
@@ -502,7 +511,7 @@ static char PatternDatabaseCompare(void *data1, uint16_t len1, void *data2,
     const PatternDatabase *pd1 = data1;
     const PatternDatabase *pd2 = data2;
 
-    if (pd1->pattern_cnt != pd2->pattern_cnt) {
+    if (pd1->pattern_cnt != pd2->pattern_cnt || pd1->stream != pd2->stream) {
         return 0;
     }
 
@@ -532,6 +541,7 @@ static void PatternDatabaseFree(PatternDatabase *pd)
     }
 
     hs_free_database(pd->hs_db);
+    hs_free_database(pd->hs_stream_db);
 
     SCFree(pd);
 }
@@ -542,7 +552,7 @@ static void PatternDatabaseTableFree(void *data)
      * structures is done in MPM destruction when the ref_cnt drops to zero. */
 }
 
-static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
+static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt, bool stream)
 {
     PatternDatabase *pd = SCMalloc(sizeof(PatternDatabase));
     if (pd == NULL) {
@@ -552,6 +562,7 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     pd->pattern_cnt = pattern_cnt;
     pd->ref_cnt = 0;
     pd->hs_db = NULL;
+    pd->stream = stream;
 
     /* alloc the pattern array */
     pd->parray =
@@ -565,6 +576,58 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/**
+ * \internal
+ * \brief Compile the streaming mode database for a pattern database.
+ *
+ * Offset and depth are relative to the start of the buffer, which a stream
+ * that starts mid-way doesn't know about, so they are left out. A prefilter
+ * may report more, never less, so that is safe.
+ *
+ * The stream lives as long as the flow, so unlike the block database the
+ * patterns are not compiled with HS_FLAG_SINGLEMATCH: that would report a
+ * pattern only once per flow direction, not for each chunk it is in.
+ * SCHSStreamScan dedups the matches of a single scan instead.
+ *
+ * \retval 0 ok, -1 error
+ */
+static int SCHSCompileStreamDatabase(PatternDatabase *pd, SCHSCompileData *cd)
+{
+    hs_compile_error_t *compile_err = NULL;
+
+    unsigned int *flags = SCMalloc(cd->pattern_cnt * sizeof(unsigned int));
+    if (flags == NULL)
+        return -1;
+    for (unsigned int i = 0; i < cd->pattern_cnt; i++) {
+        flags[i] = cd->flags[i] & ~HS_FLAG_SINGLEMATCH;
+    }
+
+    hs_error_t err = hs_compile_multi((const char *const *)cd->expressions,
+                                      flags, cd->ids, cd->pattern_cnt,
+                                      HS_MODE_STREAM, NULL, &pd->hs_stream_db,
+                                      &compile_err);
+    SCFree(flags);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan stream database");
+        if (compile_err) {
+            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        }
+        hs_free_compile_error(compile_err);
+        return -1;
+    }
+
+    err = hs_stream_size(pd->hs_stream_db, &pd->hs_stream_size);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to query stream size");
+        return -1;
+    }
+
+    if (HSScratchAddDatabase(pd->hs_stream_db) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -589,7 +652,8 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         goto error;
     }
 
-    pd = PatternDatabaseAlloc(mpm_ctx->pattern_cnt);
+    pd = PatternDatabaseAlloc(mpm_ctx->pattern_cnt,
+            (mpm_ctx->flags & MPMCTX_FLAGS_STREAM) != 0);
     if (pd == NULL) {
         goto error;
     }
@@ -609,8 +673,10 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* Check global hash table to see if we've seen this pattern database
+     * before, and reuse the Hyperscan database if so. The lock is not held
+     * during compilation so that multiple mpm contexts can be prepared in
+     * parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -624,10 +690,7 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         }
     }
 
-    /* Check global hash table to see if we've seen this pattern database
-     * before, and reuse the Hyperscan database if so. */
     PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
-
     if (pd_cached != NULL) {
         SCLogDebug("Reusing cached database %p with %" PRIu32
                    " patterns (ref_cnt=%" PRIu32 ")",
@@ -640,6 +703,7 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         SCHSFreeCompileData(cd);
         return 0;
     }
+    SCMutexUnlock(&g_db_table_mutex);
 
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
 
@@ -657,7 +721,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
             cd->ext[i] = SCMalloc(sizeof(hs_expr_ext_t));
             if (cd->ext[i] == NULL) {
-                SCMutexUnlock(&g_db_table_mutex);
                 goto error;
             }
             memset(cd->ext[i], 0, sizeof(hs_expr_ext_t));
@@ -686,28 +749,56 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
             SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
         }
         hs_free_compile_error(compile_err);
-        SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
-    ctx->pattern_db = pd;
+    if (HSScratchAddDatabase(pd->hs_db) != 0) {
+        goto error;
+    }
 
-    SCMutexLock(&g_scratch_proto_mutex);
-    err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
-    SCMutexUnlock(&g_scratch_proto_mutex);
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "failed to allocate scratch");
-        SCMutexUnlock(&g_db_table_mutex);
+    if (pd->stream && SCHSCompileStreamDatabase(pd, cd) != 0) {
         goto error;
     }
 
+    SCMutexLock(&g_db_table_mutex);
+
+    /* another thread may have compiled the same database while we were
+     * busy, in which case we use theirs and drop ours */
+    pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached != NULL) {
+        SCLogDebug("Database %p with %" PRIu32 " patterns was built "
+                   "concurrently, reusing it", pd_cached->hs_db,
+                   pd_cached->pattern_cnt);
+        pd_cached->ref_cnt++;
+        ctx->pattern_db = pd_cached;
+        SCMutexUnlock(&g_db_table_mutex);
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
+
+    ctx->pattern_db = pd;
+
     err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to query database size");
+        ctx->pattern_db = NULL;
         SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
+    if (pd->hs_stream_db != NULL) {
+        size_t stream_db_size = 0;
+        err = hs_database_size(pd->hs_stream_db, &stream_db_size);
+        if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "failed to query database size");
+            ctx->pattern_db = NULL;
+            SCMutexUnlock(&g_db_table_mutex);
+            goto error;
+        }
+        ctx->hs_db_size += stream_db_size;
+    }
+
     mpm_ctx->memory_cnt++;
     mpm_ctx->memory_size += ctx->hs_db_size;
 
@@ -744,47 +835,8 @@ void SCHSInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
 {
     memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
 
-    SCHSThreadCtx *ctx = SCMalloc(sizeof(SCHSThreadCtx));
-    if (ctx == NULL) {
-        exit(EXIT_FAILURE);
-    }
-    mpm_thread_ctx->ctx = ctx;
-
-    memset(ctx, 0, sizeof(SCHSThreadCtx));
-    mpm_thread_ctx->memory_cnt++;
-    mpm_thread_ctx->memory_size += sizeof(SCHSThreadCtx);
-
-    ctx->scratch = NULL;
-    ctx->scratch_size = 0;
-
-    SCMutexLock(&g_scratch_proto_mutex);
-
-    if (g_scratch_proto == NULL) {
-        /* There is no scratch prototype: this means that we have not compiled
-         * any Hyperscan databases. */
-        SCMutexUnlock(&g_scratch_proto_mutex);
-        SCLogDebug("No scratch space prototype");
-        return;
-    }
-
-    hs_error_t err = hs_clone_scratch(g_scratch_proto,
-                                      (hs_scratch_t **)&ctx->scratch);
-
-    SCMutexUnlock(&g_scratch_proto_mutex);
-
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "Unable to clone scratch prototype");
-        exit(EXIT_FAILURE);
-    }
-
-    err = hs_scratch_size(ctx->scratch, &ctx->scratch_size);
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "Unable to query scratch size");
-        exit(EXIT_FAILURE);
-    }
-
-    mpm_thread_ctx->memory_cnt++;
-    mpm_thread_ctx->memory_size += ctx->scratch_size;
+    /* nothing per ctx: the scratch is shared by all Hyperscan users of
+     * the thread, see HSScratchGet() */
 }
 
 /**
@@ -824,21 +876,6 @@ void SCHSInitCtx(MpmCtx *mpm_ctx)
 void SCHSDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
 {
     SCHSPrintSearchStats(mpm_thread_ctx);
-
-    if (mpm_thread_ctx->ctx != NULL) {
-        SCHSThreadCtx *thr_ctx = (SCHSThreadCtx *)mpm_thread_ctx->ctx;
-
-        if (thr_ctx->scratch != NULL) {
-            hs_free_scratch(thr_ctx->scratch);
-            mpm_thread_ctx->memory_cnt--;
-            mpm_thread_ctx->memory_size -= thr_ctx->scratch_size;
-        }
-
-        SCFree(mpm_thread_ctx->ctx);
-        mpm_thread_ctx->ctx = NULL;
-        mpm_thread_ctx->memory_cnt--;
-        mpm_thread_ctx->memory_size -= sizeof(SCHSThreadCtx);
-    }
 }
 
 /**
@@ -882,6 +919,9 @@ typedef struct SCHSCallbackCtx_ {
     SCHSCtx *ctx;
     void *pmq;
     uint32_t match_count;
+    /* optional pattern id bitarray, used by the batched search to add
+     * the sids of a pattern only once */
+    uint8_t *bitarray;
 } SCHSCallbackCtx;
 
 /* Hyperscan MPM match event handler */
@@ -898,7 +938,12 @@ static int SCHSMatchEvent(unsigned int id, unsigned long long from,
                " (pat id=%" PRIu32 ")",
                cctx->match_count, (uint32_t)id, (uintmax_t)to, pat->id);
 
-    PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    if (cctx->bitarray == NULL) {
+        PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    } else if (!(cctx->bitarray[id / 8] & (1 << (id % 8)))) {
+        cctx->bitarray[id / 8] |= (1 << (id % 8));
+        PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    }
 
     cctx->match_count++;
     return 0;
@@ -921,7 +966,6 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
 {
     uint32_t ret = 0;
     SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
-    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
     const PatternDatabase *pd = ctx->pattern_db;
 
     if (unlikely(buflen == 0)) {
@@ -930,8 +974,8 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
 
     SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0};
 
-    /* scratch should have been cloned from g_scratch_proto at thread init. */
-    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    /* thread scratch, large enough for every database compiled so far */
+    hs_scratch_t *scratch = HSScratchGet();
     BUG_ON(pd->hs_db == NULL);
     BUG_ON(scratch == NULL);
 
@@ -950,6 +994,131 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return ret;
 }
 
+/**
+ * \brief Batched Hyperscan search.
+ *
+ * Hyperscan's vectored mode treats the buffers as one contiguous
+ * stream, so a pattern could match across two buffers. Instead every
+ * buffer gets its own hs_scan() call, with the scratch and callback
+ * ctx set up once and the sids of each pattern added once per batch.
+ *
+ * \retval matches Match count over all buffers.
+ */
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, MpmVector *vec, uint32_t cnt)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    const PatternDatabase *pd = ctx->pattern_db;
+    uint32_t matches = 0;
+
+    hs_scratch_t *scratch = HSScratchGet();
+    BUG_ON(pd->hs_db == NULL);
+    BUG_ON(scratch == NULL);
+
+    const uint32_t bitarray_size = pd->pattern_cnt / 8 + 1;
+    uint8_t bitarray[bitarray_size];
+    memset(bitarray, 0, bitarray_size);
+
+    SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0,
+                            .bitarray = bitarray};
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        vec[i].matches = 0;
+        if (vec[i].len == 0)
+            continue;
+
+        cctx.match_count = 0;
+        hs_error_t err = hs_scan(pd->hs_db, (const char *)vec[i].buf,
+                                 vec[i].len, 0, scratch, SCHSMatchEvent, &cctx);
+        if (err != HS_SUCCESS) {
+            /* see SCHSSearch */
+            SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+            exit(EXIT_FAILURE);
+        }
+        vec[i].matches = cctx.match_count;
+        matches += cctx.match_count;
+    }
+
+    return matches;
+}
+
+/**
+ * \brief Memory used by an open stream of this ctx.
+ */
+uint32_t SCHSStreamSize(const MpmCtx *mpm_ctx)
+{
+    const SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    const PatternDatabase *pd = ctx->pattern_db;
+    return (uint32_t)pd->hs_stream_size;
+}
+
+/**
+ * \brief Open a stream on the streaming database of the ctx.
+ *
+ * \retval 0 ok, -1 if the ctx has no stream database or on error
+ */
+int SCHSStreamOpen(const MpmCtx *mpm_ctx, void **stream)
+{
+    const SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    const PatternDatabase *pd = ctx->pattern_db;
+    if (pd == NULL || pd->hs_stream_db == NULL)
+        return -1;
+
+    hs_error_t err = hs_open_stream(pd->hs_stream_db, 0, (hs_stream_t **)stream);
+    if (err != HS_SUCCESS) {
+        SCLogDebug("hs_open_stream failed: %d", err);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Scan the next part of a stream.
+ *
+ * \param stream stream opened with SCHSStreamOpen for this ctx
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSStreamScan(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                        void *stream, PrefilterRuleStore *pmq,
+                        const uint8_t *buf, const uint32_t buflen)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+
+    if (unlikely(buflen == 0)) {
+        return 0;
+    }
+
+    /* a pattern matches each time it is seen, add its sids once */
+    const PatternDatabase *pd = ctx->pattern_db;
+    const uint32_t bitarray_size = pd->pattern_cnt / 8 + 1;
+    uint8_t bitarray[bitarray_size];
+    memset(bitarray, 0, bitarray_size);
+
+    SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0,
+                            .bitarray = bitarray};
+
+    hs_scratch_t *scratch = HSScratchGet();
+    BUG_ON(scratch == NULL);
+
+    hs_error_t err = hs_scan_stream(stream, (const char *)buf, buflen, 0,
+                                    scratch, SCHSMatchEvent, &cctx);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+    return cctx.match_count;
+}
+
+/**
+ * \brief Close a stream, discarding any end of data matches. Doesn't
+ *        touch the database, so it is safe after the ctx is freed.
+ */
+void SCHSStreamClose(void *stream)
+{
+    (void)hs_close_stream(stream, NULL, NULL, NULL);
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1050,28 +1219,29 @@ void MpmHSRegister(void)
     mpm_table[MPM_HS].AddPatternNocase = SCHSAddPatternCI;
     mpm_table[MPM_HS].Prepare = SCHSPreparePatterns;
     mpm_table[MPM_HS].Search = SCHSSearch;
+    mpm_table[MPM_HS].SearchVector = SCHSSearchVector;
     mpm_table[MPM_HS].PrintCtx = SCHSPrintInfo;
     mpm_table[MPM_HS].PrintThreadCtx = SCHSPrintSearchStats;
     mpm_table[MPM_HS].RegisterUnittests = SCHSRegisterTests;
+    mpm_table[MPM_HS].StreamSize = SCHSStreamSize;
+    mpm_table[MPM_HS].StreamOpen = SCHSStreamOpen;
+    mpm_table[MPM_HS].StreamScan = SCHSStreamScan;
+    mpm_table[MPM_HS].StreamClose = SCHSStreamClose;
 
     /* Set Hyperscan memory allocators */
     SCHSSetAllocators();
+
+    HSScratchInit();
 }
 
 /**
  * \brief Clean up global memory used by all Hyperscan MPM instances.
  *
- * Currently, this is just the global scratch prototype.
+ * This is the shared scratch and the database cache.
  */
 void MpmHSGlobalCleanup(void)
 {
-    SCMutexLock(&g_scratch_proto_mutex);
-    if (g_scratch_proto) {
-        SCLogPerf("Cleaning up Hyperscan global scratch");
-        hs_free_scratch(g_scratch_proto);
-        g_scratch_proto = NULL;
-    }
-    SCMutexUnlock(&g_scratch_proto_mutex);
+    HSScratchCleanup();
 
     SCMutexLock(&g_db_table_mutex);
     if (g_db_table != NULL) {
@@ -2134,6 +2304,305 @@ end:
     return result;
 }
 
+/** \test streaming: match spanning two chunks, overlap not rescanned,
+ *        sids replayed */
+static int SCHSTestStream01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState *list = NULL;
+    uint32_t received, scanned;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAM;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    const uint8_t buf[] = "xxxxabcdyyyy";
+
+    /* "ab" */
+    uint32_t cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 6, 0, 1, MPM_STREAM_REPLAY, &received, &scanned);
+    FAIL_IF(cnt != 0);
+    FAIL_IF(received != 6 || scanned != 6);
+    FAIL_IF(pmq.rule_id_array_cnt != 0);
+
+    /* window overlapping the first scan: only "cdyyyy" is new */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf + 2, 10, 2, 1, MPM_STREAM_REPLAY, &received, &scanned);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(received != 6 || scanned != 6);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    PmqReset(&pmq);
+
+    /* nothing new: the sid is replayed */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 12, 0, 1, MPM_STREAM_REPLAY, &received, &scanned);
+    FAIL_IF(cnt != 0);
+    FAIL_IF(received != 0 || scanned != 0);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    FAIL_IF(pmq.rule_id_array[0] != 1);
+    PmqReset(&pmq);
+
+    /* new engine version: old state is dropped, full scan */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 12, 0, 2, 0, &received, &scanned);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(list == NULL || list->next != NULL);
+
+    MpmStreamStateFree(list);
+    FAIL_IF(MpmStreamGetMemuse() != 0);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test streaming: a pattern is reported again for each chunk it is in,
+ *        but only once per chunk */
+static int SCHSTestStream03(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState *list = NULL;
+    uint32_t received, scanned;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAM;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    const uint8_t buf[] = "xxabcdxxyyabcdyyabcdabcd";
+
+    /* first chunk */
+    uint32_t cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 8, 0, 1, 0, &received, &scanned);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    PmqReset(&pmq);
+
+    /* second chunk has the pattern again */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf + 8, 8, 8, 1, 0, &received, &scanned);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(received != 8 || scanned != 8);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    FAIL_IF(pmq.rule_id_array[0] != 1);
+    PmqReset(&pmq);
+
+    /* twice in the third chunk: the sid is added once */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf + 16, 8, 16, 1, 0, &received, &scanned);
+    FAIL_IF(cnt != 2);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+
+    MpmStreamStateFree(list);
+    FAIL_IF(MpmStreamGetMemuse() != 0);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test streaming: a pattern matching in every chunk of a long buffer
+ *        is stored for replay only once */
+static int SCHSTestStream04(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState *list = NULL;
+    uint32_t received, scanned;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAM;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"efgh", 4, 0, 0, 1, 2, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    const uint8_t chunk[] = "xxabcdxxefghxxabcdxx";
+    const uint32_t chunk_len = sizeof(chunk) - 1;
+    uint64_t offset = 0;
+    uint32_t memuse = 0;
+
+    for (int i = 0; i < 1000; i++) {
+        uint32_t cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+                chunk, chunk_len, offset, 1, MPM_STREAM_REPLAY,
+                &received, &scanned);
+        FAIL_IF(cnt != 3);
+        FAIL_IF(received != chunk_len || scanned != chunk_len);
+        FAIL_IF(list == NULL || list->stream == NULL);
+        FAIL_IF(list->sids_cnt != 2);
+        if (i == 0)
+            memuse = list->memuse;
+        FAIL_IF(list->memuse != memuse);
+        offset += chunk_len;
+        PmqReset(&pmq);
+    }
+
+    MpmStreamStateFree(list);
+    FAIL_IF(MpmStreamGetMemuse() != 0);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test streaming: block mode fallback when the memcap is reached */
+static int SCHSTestStream02(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState *list = NULL;
+    uint32_t received, scanned;
+    const uint64_t memcap = MpmStreamGetMemcap();
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAM;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* room for the state, not for the stream */
+    MpmStreamSetMemcap(sizeof(MpmStreamState));
+
+    const uint8_t buf[] = "xxxxabcdyyyy";
+    uint32_t cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 6, 0, 1, 0, &received, &scanned);
+    FAIL_IF(cnt != 0);
+    FAIL_IF(list == NULL || list->stream != NULL);
+
+    /* block mode scans the whole window again */
+    cnt = MpmStreamScan(&list, &mpm_ctx, &mpm_thread_ctx, &pmq,
+            buf, 12, 0, 1, 0, &received, &scanned);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(received != 6 || scanned != 12);
+
+    MpmStreamSetMemcap(memcap);
+    MpmStreamStateFree(list);
+    FAIL_IF(MpmStreamGetMemuse() != 0);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test batched search doesn't match across buffers and adds the sids
+ *        of a pattern once */
+static int SCHSTestVector01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmVector vec[4] = {
+        { (const uint8_t *)"abcdXYZ", 7, 10, 0 },
+        { (const uint8_t *)"xyzab", 5, 11, 0 },
+        { (const uint8_t *)"cd", 2, 12, 0 },
+        { NULL, 0, 13, 0 },
+    };
+
+    uint32_t cnt = SCHSSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq, vec, 4);
+    FAIL_IF_NOT(cnt == 3);
+    FAIL_IF_NOT(vec[0].matches == 2);
+    FAIL_IF_NOT(vec[1].matches == 1);
+    FAIL_IF_NOT(vec[2].matches == 0);
+    FAIL_IF_NOT(vec[3].matches == 0);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test ctxs with different databases share the thread scratch, which
+ *        grows to fit the largest database */
+static int SCHSTestScratch01(void)
+{
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    MpmThreadCtx mpm_thread_ctx1, mpm_thread_ctx2;
+    PrefilterRuleStore pmq;
+    char pat[64];
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_HS);
+    MpmInitCtx(&mpm_ctx2, MPM_HS);
+    PmqSetup(&pmq);
+
+    MpmAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx1) != 0);
+    SCHSInitThreadCtx(&mpm_ctx1, &mpm_thread_ctx1);
+
+    const char *buf = "xxabcdxxpattern-7-with-some-length";
+    FAIL_IF(SCHSSearch(&mpm_ctx1, &mpm_thread_ctx1, &pmq,
+                (uint8_t *)buf, strlen(buf)) != 1);
+    hs_scratch_t *scratch = HSScratchGet();
+    FAIL_IF_NULL(scratch);
+    FAIL_IF(HSScratchGetMemuse() == 0);
+
+    /* a second, larger database */
+    for (uint32_t i = 0; i < 32; i++) {
+        snprintf(pat, sizeof(pat), "pattern-%u-with-some-length", i);
+        MpmAddPatternCI(&mpm_ctx2, (uint8_t *)pat, strlen(pat), 0, 0, i, i, 0);
+    }
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx2) != 0);
+    SCHSInitThreadCtx(&mpm_ctx2, &mpm_thread_ctx2);
+
+    /* both ctxs scan with the (possibly re-cloned) thread scratch */
+    FAIL_IF(SCHSSearch(&mpm_ctx2, &mpm_thread_ctx2, &pmq,
+                (uint8_t *)buf, strlen(buf)) != 1);
+    FAIL_IF(SCHSSearch(&mpm_ctx1, &mpm_thread_ctx1, &pmq,
+                (uint8_t *)buf, strlen(buf)) != 1);
+    scratch = HSScratchGet();
+    FAIL_IF(scratch != HSScratchGet());
+
+    SCHSDestroyCtx(&mpm_ctx1);
+    SCHSDestroyCtx(&mpm_ctx2);
+    SCHSDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx1);
+    SCHSDestroyThreadCtx(&mpm_ctx2, &mpm_thread_ctx2);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2168,6 +2637,12 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTestStream01", SCHSTestStream01);
+    UtRegisterTest("SCHSTestStream02", SCHSTestStream02);
+    UtRegisterTest("SCHSTestStream03", SCHSTestStream03);
+    UtRegisterTest("SCHSTestStream04", SCHSTestStream04);
+    UtRegisterTest("SCHSTestVector01", SCHSTestVector01);
+    UtRegisterTest("SCHSTestScratch01", SCHSTestScratch01);
 #endif
 
     return;
@@ -0,0 +1,1328 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy multi literal matcher, after the algorithm of the same name in
+ * Hyperscan.
+ *
+ * Patterns are spread over 8 buckets. For each of the first (up to 3)
+ * pattern bytes two 16 byte tables are built, indexed by the low and the
+ * high nibble of a byte. Each table entry holds a bit per bucket that has a
+ * pattern with that nibble at that position. Using a byte shuffle, 16 (SSSE3,
+ * NEON) or 32 (AVX2) buffer positions are looked up at once. ANDing the
+ * results for all nibbles and pattern positions gives, per buffer position,
+ * the buckets with a pattern that may start there. Those candidates are then
+ * verified against the full patterns of the bucket.
+ *
+ * This works well for small and medium pattern sets. Larger sets cause too
+ * many false positives, so above TEDDY_MAX_PATTERNS the patterns are handed
+ * to the Aho-Corasick matcher.
+ *
+ * Without SSSE3, AVX2 or NEON the same tables are used one byte at a time.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-build.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-cpu.h"
+#include "util-mpm-teddy.h"
+
+#if defined(SC_CPU_DISPATCH)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/**
+ * \internal
+ * \brief matcher used for sets too large for teddy
+ */
+static uint16_t TeddyFallbackMatcher(void)
+{
+    /* ac-ks is a no-op on big endian */
+    if (mpm_table[MPM_AC_TILE].Search != NULL)
+        return MPM_AC_TILE;
+    return MPM_AC;
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMallocAligned(sizeof(SCTeddyCtx), 16);
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * The thread ctx is shared by all mpm ctx' of this type, so the one for
+ * the fallback matcher is always set up.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    SCTeddyThreadCtx *tctx = SCMalloc(sizeof(SCTeddyThreadCtx));
+    if (tctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(tctx, 0, sizeof(SCTeddyThreadCtx));
+    MpmInitThreadCtx(&tctx->fallback, TeddyFallbackMatcher());
+
+    mpm_thread_ctx->ctx = tctx;
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCTeddyThreadCtx);
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCTeddyThreadCtx *tctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+    if (tctx == NULL)
+        return;
+
+    mpm_table[TeddyFallbackMatcher()].DestroyThreadCtx(NULL, &tctx->fallback);
+
+    SCFree(tctx);
+    mpm_thread_ctx->ctx = NULL;
+    mpm_thread_ctx->memory_cnt--;
+    mpm_thread_ctx->memory_size -= sizeof(SCTeddyThreadCtx);
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        for (uint32_t i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i];
+            while (node != NULL) {
+                MpmPattern *next = node->next;
+                if (node->sids != NULL)
+                    SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = next;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+    }
+
+    if (ctx->patterns != NULL) {
+        for (uint32_t i = 0; i < ctx->bucket_start[TEDDY_BUCKETS]; i++) {
+            SCTeddyPattern *p = &ctx->patterns[i];
+            if (p->pat != NULL) {
+                SCFree(p->pat);
+                mpm_ctx->memory_cnt--;
+                mpm_ctx->memory_size -= p->len;
+            }
+            if (p->sids != NULL)
+                SCFree(p->sids);
+        }
+        SCFree(ctx->patterns);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->bucket_start[TEDDY_BUCKETS] * sizeof(SCTeddyPattern);
+        ctx->patterns = NULL;
+    }
+
+    if (ctx->fallback != NULL) {
+        mpm_ctx->memory_cnt -= ctx->fallback->memory_cnt;
+        mpm_ctx->memory_size -= ctx->fallback->memory_size;
+        mpm_table[ctx->fallback->mpm_type].DestroyCtx(ctx->fallback);
+        SCFree(ctx->fallback);
+        ctx->fallback = NULL;
+    }
+
+    SCFreeAligned(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+}
+
+/**
+ * \internal
+ * \brief order patterns by their lowercase prefix, so that patterns that
+ *        share leading bytes end up in the same bucket.
+ */
+static int TeddyPatternCompare(const void *a, const void *b)
+{
+    const MpmPattern *p1 = *(const MpmPattern **)a;
+    const MpmPattern *p2 = *(const MpmPattern **)b;
+
+    /* patterns shorter than the masks first, so they share buckets */
+    const int short1 = p1->len < TEDDY_MAX_MASKS;
+    const int short2 = p2->len < TEDDY_MAX_MASKS;
+    if (short1 != short2)
+        return short1 ? -1 : 1;
+
+    int r = memcmp(p1->ci, p2->ci, MIN(p1->len, p2->len));
+    if (r != 0)
+        return r;
+    if (p1->len != p2->len)
+        return p1->len < p2->len ? -1 : 1;
+    if (p1->id != p2->id)
+        return p1->id < p2->id ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief set the nibble mask bits for byte 'c' at pattern position 'k'
+ */
+static void TeddyMaskAdd(SCTeddyCtx *ctx, const uint16_t k, const uint8_t c,
+                         const uint8_t bucket_bit)
+{
+    ctx->lo[k][c & 0x0f] |= bucket_bit;
+    ctx->hi[k][c >> 4] |= bucket_bit;
+}
+
+/**
+ * \internal
+ * \brief hand the patterns to the fallback matcher
+ */
+static int TeddyPrepareFallback(MpmCtx *mpm_ctx, SCTeddyCtx *ctx, MpmPattern **parray)
+{
+    ctx->fallback = SCMalloc(sizeof(MpmCtx));
+    if (ctx->fallback == NULL)
+        return -1;
+    memset(ctx->fallback, 0, sizeof(MpmCtx));
+    MpmInitCtx(ctx->fallback, TeddyFallbackMatcher());
+
+    for (uint32_t i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        const MpmPattern *p = parray[i];
+        /* the id is final at this point, even if we assigned it */
+        const uint8_t flags = p->flags & ~MPM_PATTERN_CTX_OWNS_ID;
+
+        for (uint32_t s = 0; s < p->sids_size; s++) {
+            if (MpmAddPattern(ctx->fallback, p->original_pat, p->len,
+                        p->offset, p->depth, p->id, p->sids[s], flags) != 0)
+                return -1;
+        }
+    }
+
+    if (mpm_table[ctx->fallback->mpm_type].Prepare(ctx->fallback) != 0)
+        return -1;
+
+    mpm_ctx->memory_cnt += ctx->fallback->memory_cnt;
+    mpm_ctx->memory_size += ctx->fallback->memory_size;
+
+    SCLogDebug("%u patterns: using %s", mpm_ctx->pattern_cnt,
+            mpm_table[ctx->fallback->mpm_type].name);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief spread the patterns over the buckets and build the nibble masks
+ */
+static int TeddyPrepareBuckets(MpmCtx *mpm_ctx, SCTeddyCtx *ctx, MpmPattern **parray)
+{
+    const uint32_t cnt = mpm_ctx->pattern_cnt;
+
+    qsort(parray, cnt, sizeof(MpmPattern *), TeddyPatternCompare);
+
+    ctx->patterns = SCMalloc(cnt * sizeof(SCTeddyPattern));
+    if (ctx->patterns == NULL)
+        return -1;
+    memset(ctx->patterns, 0, cnt * sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += cnt * sizeof(SCTeddyPattern);
+
+    /* contiguous runs of the sorted patterns per bucket */
+    for (uint32_t b = 0; b <= TEDDY_BUCKETS; b++) {
+        ctx->bucket_start[b] = (b * cnt + TEDDY_BUCKETS - 1) / TEDDY_BUCKETS;
+    }
+
+    ctx->masks = MIN(TEDDY_MAX_MASKS, mpm_ctx->maxlen);
+
+    for (uint32_t b = 0; b < TEDDY_BUCKETS; b++) {
+        const uint8_t bucket_bit = (uint8_t)(1 << b);
+
+        for (uint32_t i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            MpmPattern *p = parray[i];
+            SCTeddyPattern *t = &ctx->patterns[i];
+
+            t->nocase = (p->flags & MPM_PATTERN_FLAG_NOCASE) ? 1 : 0;
+            t->len = p->len;
+            t->offset = p->offset;
+            t->depth = p->depth;
+            t->id = p->id;
+
+            t->pat = SCMalloc(p->len);
+            if (t->pat == NULL)
+                return -1;
+            mpm_ctx->memory_cnt++;
+            mpm_ctx->memory_size += p->len;
+            memcpy(t->pat, t->nocase ? p->ci : p->original_pat, p->len);
+
+            /* we own the sids now */
+            t->sids = p->sids;
+            t->sids_size = p->sids_size;
+            p->sids = NULL;
+            p->sids_size = 0;
+
+            for (uint16_t k = 0; k < ctx->masks; k++) {
+                if (k >= t->len) {
+                    /* pattern is shorter than the masks: any byte will do */
+                    for (uint32_t n = 0; n < 16; n++) {
+                        ctx->lo[k][n] |= bucket_bit;
+                        ctx->hi[k][n] |= bucket_bit;
+                    }
+                    continue;
+                }
+                const uint8_t c = t->pat[k];
+                TeddyMaskAdd(ctx, k, c, bucket_bit);
+                if (t->nocase && c >= 'a' && c <= 'z') {
+                    TeddyMaskAdd(ctx, k, (uint8_t)toupper(c), bucket_bit);
+                }
+            }
+        }
+    }
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    return 0;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal
+ *        tables or the fallback matcher.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    MpmPattern **parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+    if (parray == NULL)
+        goto error;
+    memset(parray, 0, mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+
+    /* populate it with the patterns in the hash */
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    int r;
+    if (mpm_ctx->pattern_cnt > TEDDY_MAX_PATTERNS) {
+        r = TeddyPrepareFallback(mpm_ctx, ctx, parray);
+    } else {
+        r = TeddyPrepareBuckets(mpm_ctx, ctx, parray);
+    }
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (parray[i]->sids != NULL)
+            SCFree(parray[i]->sids);
+        MpmFreePattern(mpm_ctx, parray[i]);
+    }
+    SCFree(parray);
+
+    if (r != 0)
+        goto error;
+    return 0;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "failed to prepare teddy mpm");
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief verify the patterns of the buckets set in 'buckets' at 'pos'
+ *
+ * \retval matches number of patterns that matched
+ */
+static inline uint32_t TeddyVerify(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen,
+        const uint32_t pos, uint32_t buckets)
+{
+    uint32_t matches = 0;
+
+    while (buckets) {
+        const uint32_t b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        for (uint32_t x = ctx->bucket_start[b]; x < ctx->bucket_start[b + 1]; x++) {
+            const SCTeddyPattern *p = &ctx->patterns[x];
+
+            if (p->len > buflen - pos)
+                continue;
+            /* same semantics as AC: depth limits the last byte */
+            const uint32_t end = pos + p->len - 1;
+            if (pos < p->offset || (p->depth && end > p->depth))
+                continue;
+
+            if (p->nocase) {
+                if (SCMemcmpLowercase(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            }
+
+            if (!(bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+                bitarray[p->id / 8] |= (1 << (p->id % 8));
+                PrefilterAddSids(pmq, p->sids, p->sids_size);
+            }
+            matches++;
+        }
+    }
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief scan the positions where full vector loads are in bounds
+ *
+ * \param pos [out] first position not scanned
+ */
+typedef uint32_t (*TeddyScanBlocksFunc)(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t *pos);
+
+#if defined(SC_CPU_DISPATCH)
+/**
+ * \internal
+ * \brief scan 32 positions per iteration while full loads are in bounds
+ *
+ * \param pos [out] first position not scanned
+ */
+SC_CPU_TARGET("avx2")
+static uint32_t TeddyScanBlocksAVX2(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t *pos)
+{
+    const uint32_t masks = ctx->masks;
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    __m256i lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (uint32_t k = 0; k < masks; k++) {
+        lo[k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)ctx->lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)ctx->hi[k]));
+    }
+
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    for ( ; i + 32 + masks - 1 <= buflen; i += 32) {
+        __m256i res = _mm256_set1_epi8((char)0xff);
+        for (uint32_t k = 0; k < masks; k++) {
+            const __m256i d = _mm256_loadu_si256((const __m256i *)(buf + i + k));
+            const __m256i l = _mm256_shuffle_epi8(lo[k], _mm256_and_si256(d, low4));
+            const __m256i h = _mm256_shuffle_epi8(hi[k],
+                    _mm256_and_si256(_mm256_srli_epi16(d, 4), low4));
+            res = _mm256_and_si256(res, _mm256_and_si256(l, h));
+        }
+        uint32_t nz = ~(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(res, _mm256_setzero_si256()));
+        if (nz == 0)
+            continue;
+
+        uint8_t r[32] __attribute__((aligned(32)));
+        _mm256_store_si256((__m256i *)r, res);
+        while (nz) {
+            const uint32_t j = __builtin_ctz(nz);
+            nz &= nz - 1;
+            matches += TeddyVerify(ctx, pmq, bitarray, buf, buflen, i + j, r[j]);
+        }
+    }
+    *pos = i;
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief scan 16 positions per iteration while full loads are in bounds
+ *
+ * \param pos [out] first position not scanned
+ */
+SC_CPU_TARGET("ssse3")
+static uint32_t TeddyScanBlocksSSSE3(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t *pos)
+{
+    const uint32_t masks = ctx->masks;
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    __m128i lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (uint32_t k = 0; k < masks; k++) {
+        lo[k] = _mm_load_si128((const __m128i *)ctx->lo[k]);
+        hi[k] = _mm_load_si128((const __m128i *)ctx->hi[k]);
+    }
+
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    for ( ; i + 16 + masks - 1 <= buflen; i += 16) {
+        __m128i res = _mm_set1_epi8((char)0xff);
+        for (uint32_t k = 0; k < masks; k++) {
+            const __m128i d = _mm_loadu_si128((const __m128i *)(buf + i + k));
+            const __m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(d, low4));
+            const __m128i h = _mm_shuffle_epi8(hi[k],
+                    _mm_and_si128(_mm_srli_epi16(d, 4), low4));
+            res = _mm_and_si128(res, _mm_and_si128(l, h));
+        }
+        uint32_t nz = ~(uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xffff;
+        if (nz == 0)
+            continue;
+
+        uint8_t r[16] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *)r, res);
+        while (nz) {
+            const uint32_t j = __builtin_ctz(nz);
+            nz &= nz - 1;
+            matches += TeddyVerify(ctx, pmq, bitarray, buf, buflen, i + j, r[j]);
+        }
+    }
+    *pos = i;
+    return matches;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+/**
+ * \internal
+ * \brief scan 16 positions per iteration while full loads are in bounds
+ *
+ * \param pos [out] first position not scanned
+ */
+static uint32_t TeddyScanBlocksNEON(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t *pos)
+{
+    const uint32_t masks = ctx->masks;
+    const uint8x16_t low4 = vdupq_n_u8(0x0f);
+    uint8x16_t lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (uint32_t k = 0; k < masks; k++) {
+        lo[k] = vld1q_u8(ctx->lo[k]);
+        hi[k] = vld1q_u8(ctx->hi[k]);
+    }
+
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    for ( ; i + 16 + masks - 1 <= buflen; i += 16) {
+        uint8x16_t res = vdupq_n_u8(0xff);
+        for (uint32_t k = 0; k < masks; k++) {
+            const uint8x16_t d = vld1q_u8(buf + i + k);
+            const uint8x16_t l = vqtbl1q_u8(lo[k], vandq_u8(d, low4));
+            const uint8x16_t h = vqtbl1q_u8(hi[k], vshrq_n_u8(d, 4));
+            res = vandq_u8(res, vandq_u8(l, h));
+        }
+        if (vmaxvq_u8(res) == 0)
+            continue;
+
+        uint8_t r[16];
+        vst1q_u8(r, res);
+        for (uint32_t j = 0; j < 16; j++) {
+            if (r[j] != 0)
+                matches += TeddyVerify(ctx, pmq, bitarray, buf, buflen, i + j, r[j]);
+        }
+    }
+    *pos = i;
+    return matches;
+}
+#endif
+
+#if !(defined(__ARM_NEON) && defined(__aarch64__)) || defined(UNITTESTS)
+/* no shuffle support: everything is done by TeddyScanTail */
+static uint32_t TeddyScanBlocksNone(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t *pos)
+{
+    *pos = 0;
+    return 0;
+}
+#endif
+
+/** block scanner for this cpu, set by MpmTeddyRegister() */
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static TeddyScanBlocksFunc TeddyScanBlocks = TeddyScanBlocksNEON;
+#else
+static TeddyScanBlocksFunc TeddyScanBlocks = TeddyScanBlocksNone;
+#endif
+
+/**
+ * \internal
+ * \brief scan the positions from 'i' on one byte at a time
+ */
+static uint32_t TeddyScanTail(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, const uint32_t buflen, uint32_t i)
+{
+    const uint32_t masks = ctx->masks;
+    uint32_t matches = 0;
+
+    for ( ; i < buflen; i++) {
+        /* past the end of the buffer only short patterns can match,
+         * which is up to TeddyVerify */
+        const uint32_t kmax = MIN(masks, buflen - i);
+        uint8_t r = 0xff;
+        for (uint32_t k = 0; k < kmax && r != 0; k++) {
+            const uint8_t c = buf[i + k];
+            r &= ctx->lo[k][c & 0x0f] & ctx->hi[k][c >> 4];
+        }
+        if (r != 0)
+            matches += TeddyVerify(ctx, pmq, bitarray, buf, buflen, i, r);
+    }
+    return matches;
+}
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (ctx->fallback != NULL) {
+        SCTeddyThreadCtx *tctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+        return mpm_table[ctx->fallback->mpm_type].Search(ctx->fallback,
+                &tctx->fallback, pmq, buf, buflen);
+    }
+
+    if (ctx->patterns == NULL || buflen < mpm_ctx->minlen)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    uint32_t i = 0;
+    uint32_t matches = TeddyScanBlocks(ctx, pmq, bitarray, buf, buflen, &i);
+    matches += TeddyScanTail(ctx, pmq, bitarray, buf, buflen, i);
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  The pattern offset.
+ * \param depth   The pattern depth.
+ * \param pid     The pattern id.
+ * \param sid     The signature internal id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  The pattern offset.
+ * \param depth   The pattern depth.
+ * \param pid     The pattern id.
+ * \param sid     The signature internal id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:    %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  MpmPattern     %" PRIuMAX "\n", (uintmax_t)sizeof(MpmPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    if (ctx->fallback != NULL) {
+        printf("Fallback:        %s\n", mpm_table[ctx->fallback->mpm_type].name);
+    } else {
+        printf("Masks:           %" PRIu32 "\n", ctx->masks);
+        for (uint32_t b = 0; b < TEDDY_BUCKETS; b++) {
+            printf("Bucket %" PRIu32 ":        %" PRIu32 " patterns\n", b,
+                    ctx->bucket_start[b + 1] - ctx->bucket_start[b]);
+        }
+    }
+    printf("\n");
+}
+
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+
+#if defined(SC_CPU_DISPATCH)
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        TeddyScanBlocks = TeddyScanBlocksAVX2;
+        UtilCpuDispatchRegister("teddy", "avx2");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_SSSE3)) {
+        TeddyScanBlocks = TeddyScanBlocksSSSE3;
+        UtilCpuDispatchRegister("teddy", "ssse3");
+    } else {
+        TeddyScanBlocks = TeddyScanBlocksNone;
+        UtilCpuDispatchRegister("teddy", "scalar");
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    UtilCpuDispatchRegister("teddy", "neon");
+#else
+    UtilCpuDispatchRegister("teddy", "scalar");
+#endif
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+typedef struct TeddyTestPattern_ {
+    const char *pat;
+    int nocase;
+} TeddyTestPattern;
+
+/**
+ * \internal
+ * \brief add 'pats' with pattern ids 0..n-1, search 'buf' and return the
+ *        match count.
+ */
+static uint32_t TeddyTestSearch(const TeddyTestPattern *pats, uint32_t n,
+        const uint8_t *buf, uint32_t buflen)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint16_t len = (uint16_t)strlen(pats[i].pat);
+        if (pats[i].nocase)
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)pats[i].pat, len, 0, 0, i, 0, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)pats[i].pat, len, 0, 0, i, 0, 0);
+    }
+    PmqSetup(&pmq);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+#define TEDDY_TEST(pats, buf, expect) \
+    FAIL_IF(TeddyTestSearch((pats), sizeof(pats) / sizeof(pats[0]), \
+                (const uint8_t *)(buf), strlen(buf)) != (expect))
+
+static int SCTeddyTest01(void)
+{
+    /* 1 match */
+    TeddyTestPattern pats[] = { { "abcd", 0 } };
+    TEDDY_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 1);
+    PASS;
+}
+
+static int SCTeddyTest02(void)
+{
+    TeddyTestPattern pats[] = { { "abce", 0 } };
+    TEDDY_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 0);
+    PASS;
+}
+
+static int SCTeddyTest03(void)
+{
+    TeddyTestPattern pats[] = { { "abcd", 0 }, { "bcde", 0 }, { "fghj", 0 } };
+    TEDDY_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 3);
+    PASS;
+}
+
+static int SCTeddyTest04(void)
+{
+    TeddyTestPattern pats[] = { { "abcd", 0 }, { "bcdegh", 0 }, { "fghjxyz", 0 } };
+    TEDDY_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 1);
+    PASS;
+}
+
+static int SCTeddyTest05(void)
+{
+    TeddyTestPattern pats[] = { { "ABCD", 1 }, { "bCdEfG", 1 }, { "fghJikl", 1 } };
+    TEDDY_TEST(pats, "abcdefghjiklmnopqrstuvwxyz", 3);
+    PASS;
+}
+
+static int SCTeddyTest06(void)
+{
+    TeddyTestPattern pats[] = { { "abcd", 0 } };
+    TEDDY_TEST(pats, "abcd", 1);
+    PASS;
+}
+
+static int SCTeddyTest07(void)
+{
+    /* 30 + 29 + 28 + 26 + 21 + 1 matches */
+    TeddyTestPattern pats[] = {
+        { "A", 0 }, { "AA", 0 }, { "AAA", 0 }, { "AAAAA", 0 },
+        { "AAAAAAAAAA", 0 }, { "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 0 } };
+    TEDDY_TEST(pats, "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 135);
+    PASS;
+}
+
+static int SCTeddyTest08(void)
+{
+    TeddyTestPattern pats[] = { { "abcd", 0 } };
+    TEDDY_TEST(pats, "a", 0);
+    PASS;
+}
+
+static int SCTeddyTest09(void)
+{
+    TeddyTestPattern pats[] = { { "ab", 0 } };
+    TEDDY_TEST(pats, "ab", 1);
+    PASS;
+}
+
+static int SCTeddyTest10(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefgh", 0 } };
+    const char *buf = "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789"
+                "abcdefgh"
+                "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789";
+    TEDDY_TEST(pats, buf, 1);
+    PASS;
+}
+
+static int SCTeddyTest11(void)
+{
+    TeddyTestPattern pats[] = { { "he", 0 }, { "she", 0 }, { "his", 0 }, { "hers", 0 } };
+    TEDDY_TEST(pats, "he", 1);
+    TEDDY_TEST(pats, "she", 2);
+    TEDDY_TEST(pats, "his", 1);
+    TEDDY_TEST(pats, "hers", 2);
+    PASS;
+}
+
+static int SCTeddyTest12(void)
+{
+    TeddyTestPattern pats[] = { { "wxyz", 0 }, { "vwxyz", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyz", 2);
+    PASS;
+}
+
+static int SCTeddyTest13(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefghijklmnopqrstuvwxyzABCD", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyzABCD", 1);
+    PASS;
+}
+
+static int SCTeddyTest14(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefghijklmnopqrstuvwxyzABCDE", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyzABCDE", 1);
+    PASS;
+}
+
+static int SCTeddyTest15(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefghijklmnopqrstuvwxyzABCDEF", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyzABCDEF", 1);
+    PASS;
+}
+
+static int SCTeddyTest16(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefghijklmnopqrstuvwxyzABC", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyzABC", 1);
+    PASS;
+}
+
+static int SCTeddyTest17(void)
+{
+    TeddyTestPattern pats[] = { { "abcdefghijklmnopqrstuvwxyzAB", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyzAB", 1);
+    PASS;
+}
+
+static int SCTeddyTest18(void)
+{
+    TeddyTestPattern pats[] = { { "abcde""fghij""klmno""pqrst""uvwxy""z", 0 } };
+    TEDDY_TEST(pats, "abcde""fghij""klmno""pqrst""uvwxy""z", 1);
+    PASS;
+}
+
+static int SCTeddyTest19(void)
+{
+    TeddyTestPattern pats[] = { { "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 0 } };
+    TEDDY_TEST(pats, "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 1);
+    PASS;
+}
+
+static int SCTeddyTest20(void)
+{
+    TeddyTestPattern pats[] = { { "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA", 0 } };
+    TEDDY_TEST(pats, "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA", 1);
+    PASS;
+}
+
+static int SCTeddyTest21(void)
+{
+    TeddyTestPattern pats[] = { { "AA", 0 } };
+    TEDDY_TEST(pats, "AA", 1);
+    PASS;
+}
+
+static int SCTeddyTest22(void)
+{
+    TeddyTestPattern pats[] = { { "abcd", 0 }, { "abcde", 0 } };
+    TEDDY_TEST(pats, "abcdefghijklmnopqrstuvwxyz", 2);
+    PASS;
+}
+
+static int SCTeddyTest23(void)
+{
+    TeddyTestPattern pats[] = { { "AA", 0 } };
+    TEDDY_TEST(pats, "aa", 0);
+    PASS;
+}
+
+static int SCTeddyTest24(void)
+{
+    TeddyTestPattern pats[] = { { "AA", 1 } };
+    TEDDY_TEST(pats, "aa", 1);
+    PASS;
+}
+
+static int SCTeddyTest25(void)
+{
+    TeddyTestPattern pats[] = { { "ABCD", 1 }, { "bCdEfG", 1 }, { "fghiJkl", 1 } };
+    TEDDY_TEST(pats, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", 3);
+    PASS;
+}
+
+static int SCTeddyTest26(void)
+{
+    TeddyTestPattern pats[] = { { "Works", 1 }, { "Works", 0 } };
+    TEDDY_TEST(pats, "works", 1);
+    PASS;
+}
+
+static int SCTeddyTest27(void)
+{
+    TeddyTestPattern pats[] = { { "ONE", 0 } };
+    TEDDY_TEST(pats, "tone", 0);
+    PASS;
+}
+
+static int SCTeddyTest28(void)
+{
+    TeddyTestPattern pats[] = { { "one", 0 } };
+    TEDDY_TEST(pats, "tONE", 0);
+    PASS;
+}
+
+static int SCTeddyTest29(void)
+{
+    uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
+    uint16_t buflen = strlen((char *)buf);
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_matcher = MPM_TEDDY;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"onetwothreefourfivesixseveneightnine\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"onetwothreefourfivesixseveneightnine\"; fast_pattern:3,3; sid:2;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 1);
+    FAIL_IF_NOT(PacketAlertCheck(p, 2) == 1);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
+/** \test pattern at each position of a buffer, crossing the block edges
+ *        of the vector loops and the scalar tail */
+static int SCTeddyTest30(void)
+{
+    TeddyTestPattern pats[] = { { "xyz", 0 }, { "QrS", 1 } };
+    uint8_t buf[100];
+
+    for (uint32_t pos = 0; pos + 3 <= sizeof(buf); pos++) {
+        memset(buf, '.', sizeof(buf));
+        memcpy(buf + pos, "xyz", 3);
+        FAIL_IF(TeddyTestSearch(pats, 2, buf, sizeof(buf)) != 1);
+        memcpy(buf + pos, "qRs", 3);
+        FAIL_IF(TeddyTestSearch(pats, 2, buf, sizeof(buf)) != 1);
+        /* truncated at the end of the buffer */
+        FAIL_IF(TeddyTestSearch(pats, 2, buf, pos + 2) != 0);
+    }
+    PASS;
+}
+
+/** \test offset and depth are enforced like in AC */
+static int SCTeddyTest31(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* only at offset >= 4 */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abc", 3, 4, 0, 0, 0, 0);
+    /* must end at or before index 5 */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"def", 3, 0, 5, 1, 1, 0);
+    PmqSetup(&pmq);
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "abcdefabcdef";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+            (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+    FAIL_IF(pmq.rule_id_array_cnt != 2);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/**
+ * \internal
+ * \brief simple deterministic generator for the randomized tests
+ */
+static uint32_t TeddyTestRand(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+/**
+ * \internal
+ * \brief run the same random patterns through teddy and ac and compare
+ *        the match counts and the sids added to the pmq
+ */
+static int TeddyTestCompareAC(uint32_t seed, uint32_t pattern_cnt)
+{
+    MpmCtx t_ctx, a_ctx;
+    MpmThreadCtx t_tctx, a_tctx;
+    PrefilterRuleStore t_pmq, a_pmq;
+    uint32_t state = seed;
+
+    memset(&t_ctx, 0, sizeof(MpmCtx));
+    memset(&a_ctx, 0, sizeof(MpmCtx));
+    memset(&t_tctx, 0, sizeof(MpmThreadCtx));
+    memset(&a_tctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&t_ctx, MPM_TEDDY);
+    MpmInitCtx(&a_ctx, MPM_AC);
+    MpmInitThreadCtx(&t_tctx, MPM_TEDDY);
+    MpmInitThreadCtx(&a_tctx, MPM_AC);
+    PmqSetup(&t_pmq);
+    PmqSetup(&a_pmq);
+
+    /* small alphabet with mixed case to get plenty of hits */
+    static const char alphabet[] = "abcABC01";
+    for (uint32_t i = 0; i < pattern_cnt; i++) {
+        uint8_t pat[8];
+        uint16_t len = 1 + TeddyTestRand(&state) % sizeof(pat);
+        for (uint16_t x = 0; x < len; x++)
+            pat[x] = alphabet[TeddyTestRand(&state) % (sizeof(alphabet) - 1)];
+        if (TeddyTestRand(&state) & 1) {
+            MpmAddPatternCI(&t_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCI(&a_ctx, pat, len, 0, 0, i, i, 0);
+        } else {
+            MpmAddPatternCS(&t_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCS(&a_ctx, pat, len, 0, 0, i, i, 0);
+        }
+    }
+    FAIL_IF(mpm_table[MPM_TEDDY].Prepare(&t_ctx) != 0);
+    FAIL_IF(mpm_table[MPM_AC].Prepare(&a_ctx) != 0);
+
+    uint8_t buf[1500];
+    for (int round = 0; round < 8; round++) {
+        uint32_t buflen = TeddyTestRand(&state) % sizeof(buf);
+        for (uint32_t x = 0; x < buflen; x++)
+            buf[x] = alphabet[TeddyTestRand(&state) % (sizeof(alphabet) - 1)];
+
+        PmqReset(&t_pmq);
+        PmqReset(&a_pmq);
+        uint32_t t = mpm_table[MPM_TEDDY].Search(&t_ctx, &t_tctx, &t_pmq, buf, buflen);
+        uint32_t a = mpm_table[MPM_AC].Search(&a_ctx, &a_tctx, &a_pmq, buf, buflen);
+        /* the ac-ks fallback counts matches differently */
+        if (((SCTeddyCtx *)t_ctx.ctx)->fallback == NULL)
+            FAIL_IF(t != a);
+        FAIL_IF(t_pmq.rule_id_array_cnt != a_pmq.rule_id_array_cnt);
+
+        /* same sids, possibly in a different order */
+        uint8_t seen[pattern_cnt];
+        memset(seen, 0, sizeof(seen));
+        for (uint32_t x = 0; x < a_pmq.rule_id_array_cnt; x++)
+            seen[a_pmq.rule_id_array[x]] = 1;
+        for (uint32_t x = 0; x < t_pmq.rule_id_array_cnt; x++)
+            FAIL_IF(seen[t_pmq.rule_id_array[x]] != 1);
+    }
+
+    mpm_table[MPM_TEDDY].DestroyCtx(&t_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&a_ctx);
+    mpm_table[MPM_TEDDY].DestroyThreadCtx(NULL, &t_tctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(NULL, &a_tctx);
+    PmqFree(&t_pmq);
+    PmqFree(&a_pmq);
+    PASS;
+}
+
+/** \test random small sets against AC */
+static int SCTeddyTest32(void)
+{
+    for (uint32_t seed = 1; seed <= 16; seed++) {
+        FAIL_IF_NOT(TeddyTestCompareAC(seed, 1 + seed * 4));
+    }
+    PASS;
+}
+
+/** \test set too large for teddy goes through the fallback */
+static int SCTeddyTest33(void)
+{
+    MpmCtx mpm_ctx;
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+
+    char pat[16];
+    for (uint32_t i = 0; i < TEDDY_MAX_PATTERNS + 1; i++) {
+        snprintf(pat, sizeof(pat), "pat%04u", i);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, i, 0);
+    }
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx.ctx;
+    FAIL_IF_NULL(ctx->fallback);
+    FAIL_IF_NOT_NULL(ctx->patterns);
+    SCTeddyDestroyCtx(&mpm_ctx);
+
+    /* and it still matches like AC */
+    FAIL_IF_NOT(TeddyTestCompareAC(42, TEDDY_MAX_PATTERNS + 64));
+    PASS;
+}
+
+/** \test every block scanner the cpu supports matches like AC */
+static int SCTeddyTest34(void)
+{
+    TeddyScanBlocksFunc funcs[3] = { TeddyScanBlocksNone, NULL, NULL };
+    int nfuncs = 1;
+#if defined(SC_CPU_DISPATCH)
+    if (UtilCpuHasFeature(CPU_FEATURE_SSSE3))
+        funcs[nfuncs++] = TeddyScanBlocksSSSE3;
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2))
+        funcs[nfuncs++] = TeddyScanBlocksAVX2;
+#endif
+    TeddyScanBlocksFunc selected = TeddyScanBlocks;
+    int result = 1;
+
+    for (int f = 0; f < nfuncs; f++) {
+        TeddyScanBlocks = funcs[f];
+        for (uint32_t seed = 1; seed <= 4; seed++) {
+            if (!TeddyTestCompareAC(seed, 1 + seed * 6))
+                result = 0;
+        }
+    }
+    TeddyScanBlocks = selected;
+    FAIL_IF_NOT(result);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06);
+    UtRegisterTest("SCTeddyTest07", SCTeddyTest07);
+    UtRegisterTest("SCTeddyTest08", SCTeddyTest08);
+    UtRegisterTest("SCTeddyTest09", SCTeddyTest09);
+    UtRegisterTest("SCTeddyTest10", SCTeddyTest10);
+    UtRegisterTest("SCTeddyTest11", SCTeddyTest11);
+    UtRegisterTest("SCTeddyTest12", SCTeddyTest12);
+    UtRegisterTest("SCTeddyTest13", SCTeddyTest13);
+    UtRegisterTest("SCTeddyTest14", SCTeddyTest14);
+    UtRegisterTest("SCTeddyTest15", SCTeddyTest15);
+    UtRegisterTest("SCTeddyTest16", SCTeddyTest16);
+    UtRegisterTest("SCTeddyTest17", SCTeddyTest17);
+    UtRegisterTest("SCTeddyTest18", SCTeddyTest18);
+    UtRegisterTest("SCTeddyTest19", SCTeddyTest19);
+    UtRegisterTest("SCTeddyTest20", SCTeddyTest20);
+    UtRegisterTest("SCTeddyTest21", SCTeddyTest21);
+    UtRegisterTest("SCTeddyTest22", SCTeddyTest22);
+    UtRegisterTest("SCTeddyTest23", SCTeddyTest23);
+    UtRegisterTest("SCTeddyTest24", SCTeddyTest24);
+    UtRegisterTest("SCTeddyTest25", SCTeddyTest25);
+    UtRegisterTest("SCTeddyTest26", SCTeddyTest26);
+    UtRegisterTest("SCTeddyTest27", SCTeddyTest27);
+    UtRegisterTest("SCTeddyTest28", SCTeddyTest28);
+    UtRegisterTest("SCTeddyTest29", SCTeddyTest29);
+    UtRegisterTest("SCTeddyTest30", SCTeddyTest30);
+    UtRegisterTest("SCTeddyTest31", SCTeddyTest31);
+    UtRegisterTest("SCTeddyTest32", SCTeddyTest32);
+    UtRegisterTest("SCTeddyTest33", SCTeddyTest33);
+    UtRegisterTest("SCTeddyTest34", SCTeddyTest34);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy: shuffle based multi literal matcher for small pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY__H__
+#define __UTIL_MPM_TEDDY__H__
+
+#include "util-mpm.h"
+
+/** number of buckets: one bit per bucket in a byte of the nibble masks */
+#define TEDDY_BUCKETS       8
+/** max number of leading pattern bytes used for the nibble masks */
+#define TEDDY_MAX_MASKS     3
+/** pattern sets larger than this are handed to the AC fallback */
+#define TEDDY_MAX_PATTERNS  32
+
+typedef struct SCTeddyPattern_ {
+    /* pattern as it should be matched: lowercase if nocase */
+    uint8_t *pat;
+    uint16_t len;
+    uint8_t nocase;
+
+    uint16_t offset;
+    uint16_t depth;
+
+    uint32_t id;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* nibble masks: bit b is set in lo[k][n] if a pattern in bucket b
+     * can have n as the low nibble of its k-th byte. Same for hi. */
+    uint8_t lo[TEDDY_MAX_MASKS][16] __attribute__((aligned(16)));
+    uint8_t hi[TEDDY_MAX_MASKS][16] __attribute__((aligned(16)));
+    /* number of masks in use: min(TEDDY_MAX_MASKS, longest pattern).
+     * Shorter patterns match any byte at the positions they don't cover. */
+    uint16_t masks;
+
+    /* patterns ordered by bucket; bucket b is
+     * patterns[bucket_start[b]] to patterns[bucket_start[b+1]-1] */
+    SCTeddyPattern *patterns;
+    uint32_t bucket_start[TEDDY_BUCKETS + 1];
+
+    uint32_t pattern_id_bitarray_size;
+
+    /* large sets are handled by this ctx if set */
+    MpmCtx *fallback;
+} SCTeddyCtx;
+
+typedef struct SCTeddyThreadCtx_ {
+    /* thread ctx for the fallback matcher */
+    MpmThreadCtx fallback;
+} SCTeddyThreadCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY__H__ */
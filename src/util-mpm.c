@@ -31,6 +31,8 @@
 #include "util-mpm-ac.h"
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
+#include "util-mpm-teddy.h"
+#include "util-mpm-ac-compact.h"
 #include "util-mpm-hs.h"
 #include "util-hashlist.h"
 
@@ -45,6 +47,12 @@
 #include "hs.h"
 #endif
 
+/** default memcap for the streaming mpm state of all flows and txs */
+#define MPM_STREAM_DEFAULT_MEMCAP   (32 * 1024 * 1024)
+
+static uint64_t mpm_stream_memcap = MPM_STREAM_DEFAULT_MEMCAP;
+SC_ATOMIC_DECLARE(uint64_t, mpm_stream_memuse);
+
 /**
  * \brief Register a new Mpm Context.
  *
@@ -285,10 +293,13 @@ void MpmTableSetup(void)
 {
     memset(mpm_table, 0, sizeof(mpm_table));
     mpm_default_matcher = DEFAULT_MPM;
+    SC_ATOMIC_INIT(mpm_stream_memuse);
 
     MpmACRegister();
     MpmACBSRegister();
     MpmACTileRegister();
+    MpmTeddyRegister();
+    MpmACCompactRegister();
 #ifdef BUILD_HYPERSCAN
     #ifdef HAVE_HS_VALID_PLATFORM
     /* Enable runtime check for SSSE3. Do not use Hyperscan MPM matcher if
@@ -611,6 +622,318 @@ error:
     return -1;
 }
 
+void MpmStreamSetMemcap(uint64_t size)
+{
+    mpm_stream_memcap = size;
+}
+
+uint64_t MpmStreamGetMemcap(void)
+{
+    return mpm_stream_memcap;
+}
+
+uint64_t MpmStreamGetMemuse(void)
+{
+    return SC_ATOMIC_GET(mpm_stream_memuse);
+}
+
+/** \retval 1 if size bytes can be allocated within the memcap
+ *  \retval 0 otherwise */
+static int MpmStreamCheckMemcap(uint64_t size)
+{
+    if (mpm_stream_memcap == 0 ||
+            size + SC_ATOMIC_GET(mpm_stream_memuse) <= mpm_stream_memcap)
+        return 1;
+    return 0;
+}
+
+static void MpmStreamMemuseIncr(MpmStreamState *state, uint32_t size)
+{
+    (void)SC_ATOMIC_ADD(mpm_stream_memuse, size);
+    state->memuse += size;
+}
+
+static void MpmStreamMemuseDecr(MpmStreamState *state, uint32_t size)
+{
+    (void)SC_ATOMIC_SUB(mpm_stream_memuse, size);
+    state->memuse -= size;
+}
+
+/** \internal
+ *  \brief close the matcher stream and drop the sids. The state stays
+ *          around in block mode. */
+static void MpmStreamStateClose(MpmStreamState *state)
+{
+    if (state->stream != NULL) {
+        mpm_table[state->mpm_type].StreamClose(state->stream);
+        state->stream = NULL;
+    }
+    if (state->sids != NULL) {
+        SCFree(state->sids);
+        state->sids = NULL;
+        state->sids_cnt = state->sids_size = 0;
+    }
+    MpmStreamMemuseDecr(state, state->memuse - sizeof(*state));
+}
+
+/** \internal
+ *  \brief (re)open the matcher stream of a state, falling back to block
+ *          mode if this would exceed the memcap */
+static void MpmStreamStateOpen(MpmStreamState *state, const MpmCtx *mpm_ctx)
+{
+    const uint32_t size = mpm_table[mpm_ctx->mpm_type].StreamSize(mpm_ctx);
+    if (!MpmStreamCheckMemcap(size))
+        return;
+    if (mpm_table[mpm_ctx->mpm_type].StreamOpen(mpm_ctx, &state->stream) != 0) {
+        state->stream = NULL;
+        return;
+    }
+    MpmStreamMemuseIncr(state, size);
+}
+
+static MpmStreamState *MpmStreamStateGet(MpmStreamState **list,
+        const MpmCtx *mpm_ctx, const uint32_t generation)
+{
+    MpmStreamState *prev = NULL;
+    MpmStreamState *state = *list;
+    while (state != NULL) {
+        MpmStreamState *next = state->next;
+        if (state->generation != generation) {
+            /* opened by a previous detect engine: its ctx is gone */
+            if (prev == NULL)
+                *list = next;
+            else
+                prev->next = next;
+            state->next = NULL;
+            MpmStreamStateFree(state);
+        } else if (state->mpm_ctx == mpm_ctx) {
+            return state;
+        } else {
+            prev = state;
+        }
+        state = next;
+    }
+
+    if (!MpmStreamCheckMemcap(sizeof(*state)))
+        return NULL;
+    state = SCCalloc(1, sizeof(*state));
+    if (unlikely(state == NULL))
+        return NULL;
+    MpmStreamMemuseIncr(state, sizeof(*state));
+    state->mpm_ctx = mpm_ctx;
+    state->mpm_type = mpm_ctx->mpm_type;
+    state->generation = generation;
+    MpmStreamStateOpen(state, mpm_ctx);
+
+    state->next = *list;
+    *list = state;
+    return state;
+}
+
+static int MpmStreamSidCompare(const void *a, const void *b)
+{
+    const SigIntId x = *(const SigIntId *)a;
+    const SigIntId y = *(const SigIntId *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static inline int MpmStreamHasSid(const SigIntId *sids, const uint32_t cnt,
+        const SigIntId *sid)
+{
+    return cnt > 0 && bsearch(sid, sids, cnt, sizeof(SigIntId),
+            MpmStreamSidCompare) != NULL;
+}
+
+/** \internal
+ *  \brief store the sids the stream scan added to the pmq
+ *
+ *  The stored sids are kept sorted and unique: a pattern that matches
+ *  in every chunk of a long buffer must not grow the list each time.
+ *
+ *  \retval 0 ok, -1 memcap or alloc failure */
+static int MpmStreamStoreSids(MpmStreamState *state,
+        const PrefilterRuleStore *pmq, const uint32_t start)
+{
+    const uint32_t cnt = pmq->rule_id_array_cnt - start;
+    const SigIntId *new_sids = pmq->rule_id_array + start;
+    uint32_t add = 0;
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        if (!MpmStreamHasSid(state->sids, state->sids_cnt, &new_sids[i]))
+            add++;
+    }
+    if (add == 0)
+        return 0;
+
+    if (state->sids_cnt + add > state->sids_size) {
+        const uint32_t new_size = MAX(state->sids_size * 2, state->sids_cnt + add);
+        const uint32_t grow = (new_size - state->sids_size) * sizeof(SigIntId);
+        if (!MpmStreamCheckMemcap(grow))
+            return -1;
+        SigIntId *sids = SCRealloc(state->sids, new_size * sizeof(SigIntId));
+        if (unlikely(sids == NULL))
+            return -1;
+        state->sids = sids;
+        state->sids_size = new_size;
+        MpmStreamMemuseIncr(state, grow);
+    }
+
+    const uint32_t old_cnt = state->sids_cnt;
+    for (i = 0; i < cnt; i++) {
+        if (!MpmStreamHasSid(state->sids, old_cnt, &new_sids[i]))
+            state->sids[state->sids_cnt++] = new_sids[i];
+    }
+
+    /* the scan itself may have added a sid more than once */
+    qsort(state->sids, state->sids_cnt, sizeof(SigIntId), MpmStreamSidCompare);
+    uint32_t u = 1;
+    for (i = 1; i < state->sids_cnt; i++) {
+        if (state->sids[i] != state->sids[u - 1])
+            state->sids[u++] = state->sids[i];
+    }
+    state->sids_cnt = u;
+    return 0;
+}
+
+/**
+ * \brief Search a batch of buffers with the same ctx.
+ *
+ * Meant for the many small buffers a single tx can have, like dns
+ * queries. Buffers shorter than the shortest pattern are skipped. The
+ * matches per buffer are stored in MpmVector::matches.
+ *
+ * \param vec buffers to search
+ * \param cnt number of buffers in vec
+ *
+ * \retval matches total number of matches
+ */
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmVector *vec, const uint32_t cnt)
+{
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+    uint32_t matches = 0;
+    uint32_t i;
+
+    if (cnt == 0)
+        return 0;
+
+    if (m->SearchVector != NULL) {
+        for (i = 0; i < cnt; i++) {
+            if (vec[i].len < mpm_ctx->minlen)
+                vec[i].len = 0;
+        }
+        return m->SearchVector(mpm_ctx, mpm_thread_ctx, pmq, vec, cnt);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        vec[i].matches = 0;
+        if (vec[i].len == 0 || vec[i].len < mpm_ctx->minlen)
+            continue;
+        vec[i].matches = m->Search(mpm_ctx, mpm_thread_ctx, pmq,
+                vec[i].buf, vec[i].len);
+        matches += vec[i].matches;
+    }
+    return matches;
+}
+
+/**
+ * \brief Scan a buffer that grows over time, like the raw stream or a http
+ *        body, feeding only the bytes the matcher hasn't seen yet.
+ *
+ * The stream state for mpm_ctx is looked up in (or added to) list. If the
+ * buffer skips ahead of what was scanned so far the stream is reopened at
+ * buf_offset. Without a matcher stream (no memory) the whole buffer is
+ * scanned in block mode.
+ *
+ * \param list        per buffer list of stream states, owned by the caller
+ * \param buf         buffer to scan
+ * \param buflen      length of buf
+ * \param buf_offset  absolute offset of buf in the stream
+ * \param generation  detect engine version, stale states are dropped
+ * \param flags       MPM_STREAM_*
+ * \param received    out: bytes of buf that were not seen before
+ * \param scanned     out: bytes passed to the matcher
+ *
+ * \retval matches number of matches
+ */
+uint32_t MpmStreamScan(MpmStreamState **list, const MpmCtx *mpm_ctx,
+        MpmThreadCtx *mpm_thread_ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, const uint32_t buflen, const uint64_t buf_offset,
+        const uint32_t generation, const uint8_t flags,
+        uint32_t *received, uint32_t *scanned)
+{
+    *received = *scanned = 0;
+
+    MpmStreamState *state = MpmStreamStateGet(list, mpm_ctx, generation);
+    if (state == NULL) {
+        *received = *scanned = buflen;
+        goto block;
+    }
+
+    /* data we haven't seen before: all of it after a gap */
+    uint32_t skip = 0;
+    if (buf_offset > state->offset) {
+        if (state->stream != NULL && state->offset != 0) {
+            SCLogDebug("gap from %"PRIu64" to %"PRIu64", reopening stream",
+                    state->offset, buf_offset);
+            mpm_table[state->mpm_type].StreamClose(state->stream);
+            state->stream = NULL;
+            MpmStreamMemuseDecr(state, mpm_table[state->mpm_type].StreamSize(mpm_ctx));
+            MpmStreamStateOpen(state, mpm_ctx);
+        }
+    } else if (buf_offset + buflen > state->offset) {
+        skip = (uint32_t)(state->offset - buf_offset);
+    } else {
+        skip = buflen;
+    }
+    *received = buflen - skip;
+    state->offset = MAX(state->offset, buf_offset + buflen);
+
+    if (state->stream == NULL) {
+        *scanned = buflen;
+        goto block;
+    }
+
+    if (flags & MPM_STREAM_REPLAY)
+        PrefilterAddSids(pmq, state->sids, state->sids_cnt);
+    if (skip == buflen)
+        return 0;
+
+    const uint32_t start = pmq->rule_id_array_cnt;
+    *scanned = buflen - skip;
+    uint32_t matches = mpm_table[state->mpm_type].StreamScan(mpm_ctx,
+            mpm_thread_ctx, state->stream, pmq, buf + skip, buflen - skip);
+
+    if ((flags & MPM_STREAM_REPLAY) && MpmStreamStoreSids(state, pmq, start) < 0) {
+        /* can't replay the sids on the next scan, so from now on
+         * scan the whole buffer each time */
+        SCLogDebug("mpm stream memcap reached, switching to block mode");
+        MpmStreamStateClose(state);
+    }
+    return matches;
+
+block:
+    if (buflen < mpm_ctx->minlen)
+        return 0;
+    return mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, mpm_thread_ctx,
+            pmq, buf, buflen);
+}
+
+/**
+ * \brief Free a list of stream states. Safe to call after the mpm ctxs
+ *        the streams were opened for have been freed.
+ */
+void MpmStreamStateFree(MpmStreamState *list)
+{
+    while (list != NULL) {
+        MpmStreamState *next = list->next;
+        MpmStreamStateClose(list);
+        MpmStreamMemuseDecr(list, sizeof(*list));
+        SCFree(list);
+        list = next;
+    }
+}
 
 /************************************Unittests*********************************/
 
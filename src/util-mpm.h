@@ -36,6 +36,10 @@ enum {
     MPM_AC_BS,
     MPM_AC_TILE,
     MPM_HS,
+    /* shuffle based literal matcher for small sets */
+    MPM_TEDDY,
+    /* aho-corasick with compressed state rows */
+    MPM_AC_COMPACT,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -85,9 +89,11 @@ typedef struct MpmCtx_ {
 
     /* Indicates if this a global mpm_ctx.  Global mpm_ctx is the one that
      * is instantiated when we use "single".  Non-global is "full", i.e.
-     * one per sgh.  We are using a uint16_t here to avoiding using a pad.
-     * You can use a uint8_t here as well. */
-    uint16_t global;
+     * one per sgh. */
+    uint8_t global;
+
+    /* MPMCTX_FLAGS_* */
+    uint8_t flags;
 
     /* unique patterns */
     uint32_t pattern_cnt;
@@ -104,6 +110,19 @@ typedef struct MpmCtx_ {
     MpmPattern **init_hash;
 } MpmCtx;
 
+/** ctx is (also) prepared for the streaming api, see MpmStreamScan() */
+#define MPMCTX_FLAGS_STREAM     BIT_U8(0)
+
+/** buffer for the batched search, see MpmSearchVector() */
+typedef struct MpmVector_ {
+    const uint8_t *buf;
+    uint32_t len;
+    /** set by the caller to identify the buffer */
+    uint32_t tag;
+    /** set by the search: matches in this buffer */
+    uint32_t matches;
+} MpmVector;
+
 /* if we want to retrieve an unique mpm context from the mpm context factory
  * we should supply this as the key */
 #define MPM_CTX_FACTORY_UNIQUE_CONTEXT -1
@@ -159,9 +178,59 @@ typedef struct MpmTableElmt_ {
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
     void (*RegisterUnittests)(void);
+
+    /** optional batched search. Scans each buffer on its own, so
+     *  matches don't span buffers, and sets MpmVector::matches. A
+     *  pattern's sids are added to the pmq once per call, even if it
+     *  matches in several buffers. Without it MpmSearchVector() calls
+     *  Search for each buffer. */
+    uint32_t (*SearchVector)(const struct MpmCtx_ *, struct MpmThreadCtx_ *,
+            PrefilterRuleStore *, MpmVector *, uint32_t);
+
+    /** optional streaming mode, used for buffers that grow over time
+     *  (raw stream, http bodies). Only ctxs with MPMCTX_FLAGS_STREAM set
+     *  have it prepared.
+     *
+     *  StreamSize returns the memory an open stream uses. StreamClose
+     *  must not need the ctx, as the stream may outlive it. */
+    uint32_t (*StreamSize)(const struct MpmCtx_ *);
+    int (*StreamOpen)(const struct MpmCtx_ *, void **);
+    uint32_t (*StreamScan)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, void *, PrefilterRuleStore *, const uint8_t *, uint32_t);
+    void (*StreamClose)(void *);
+
     uint8_t flags;
 } MpmTableElmt;
 
+/** per buffer state of the streaming mpm. One per mpm ctx the buffer was
+ *  scanned with, kept in a list by the owner of the buffer (flow, tx). */
+typedef struct MpmStreamState_ {
+    /* ctx and detect engine version the stream was opened for. The ctx
+     * is only used as a key, it may be gone after a reload. */
+    const struct MpmCtx_ *mpm_ctx;
+    uint32_t generation;
+    uint16_t mpm_type;
+
+    /* matcher stream, NULL if the memcap was hit: in that case the
+     * buffer is scanned in block mode */
+    void *stream;
+    /* bytes accounted against the memcap for this state */
+    uint32_t memuse;
+
+    /* absolute offset of the next byte the stream expects */
+    uint64_t offset;
+
+    /* sids matched so far, replayed on each scan (MPM_STREAM_REPLAY) */
+    SigIntId *sids;
+    uint32_t sids_cnt;
+    uint32_t sids_size;
+
+    struct MpmStreamState_ *next;
+} MpmStreamState;
+
+/** add the sids matched on earlier scans of the buffer to the pmq, for
+ *  buffers whose rules rely on the mpm to be revisited */
+#define MPM_STREAM_REPLAY       BIT_U8(0)
+
 MpmTableElmt mpm_table[MPM_TABLE_SIZE];
 int mpm_default_matcher;
 
@@ -197,4 +266,17 @@ int MpmAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
                             uint16_t offset, uint16_t depth, uint32_t pid,
                             SigIntId sid, uint8_t flags);
 
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmVector *vec, const uint32_t cnt);
+
+void MpmStreamSetMemcap(uint64_t size);
+uint64_t MpmStreamGetMemcap(void);
+uint64_t MpmStreamGetMemuse(void);
+uint32_t MpmStreamScan(MpmStreamState **list, const MpmCtx *mpm_ctx,
+        MpmThreadCtx *mpm_thread_ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, const uint32_t buflen, const uint64_t buf_offset,
+        const uint32_t generation, const uint8_t flags,
+        uint32_t *received, uint32_t *scanned);
+void MpmStreamStateFree(MpmStreamState *list);
+
 #endif /* __UTIL_MPM_H__ */
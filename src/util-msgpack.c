@@ -0,0 +1,833 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * MessagePack encoding of eve records, see util-msgpack.h for the file
+ * format.
+ *
+ * The string table is shared by all threads of an output. Lookups don't
+ * take a lock: strings are only added, under the lock, and an entry is
+ * published in the hash after its id is counted, so a writer that syncs
+ * the table to the file before writing a record always has the ids the
+ * record uses. The table is bounded, once it is full new strings are
+ * written inline.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-msgpack.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_LIBJANSSON
+
+/** max number of interned strings per output */
+#define MSGPACK_STRINGS_MAX     4096
+/** longer strings are not interned */
+#define MSGPACK_STRING_MAX_LEN  128
+#define MSGPACK_HASH_SIZE       (2 * MSGPACK_STRINGS_MAX)
+
+#define MSGPACK_EXPAND_SIZE     65536
+
+typedef struct MsgpackString_ {
+    uint32_t hash;
+    uint32_t id;
+    uint16_t len;
+    /** the values of members with this key are interned too */
+    bool intern_values;
+    char str[];
+} MsgpackString;
+
+struct MsgpackCtx_ {
+    size_t json_flags;
+    char *prefix;
+
+    /** serializes adding strings */
+    SCMutex mutex;
+    bool full;
+    SC_ATOMIC_DECLARE(uint32_t, count);
+    /** open addressing, only written under the mutex */
+    MsgpackString *hash[MSGPACK_HASH_SIZE];
+    /** by id */
+    MsgpackString *strings[MSGPACK_STRINGS_MAX];
+};
+
+/** members with a small set of distinct values, their values are
+ *  interned along with the keys */
+static const char *msgpack_intern_value_keys[] = {
+    "event_type", "proto", "app_proto", "app_proto_ts", "app_proto_tc",
+    "app_proto_orig", "app_proto_expected", "in_iface", "host",
+    "direction", "state", "reason", "action", "category", "signature",
+    "type", "rrtype", "rcode", "http_method", "protocol", "version",
+    "tcp_flags", "tcp_flags_ts", "tcp_flags_tc",
+    NULL
+};
+
+MsgpackCtx *MsgpackCtxNew(size_t json_flags, const char *prefix)
+{
+    MsgpackCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    if (prefix != NULL) {
+        ctx->prefix = SCStrdup(prefix);
+        if (unlikely(ctx->prefix == NULL)) {
+            SCFree(ctx);
+            return NULL;
+        }
+    }
+    ctx->json_flags = json_flags;
+    SCMutexInit(&ctx->mutex, NULL);
+    SC_ATOMIC_INIT(ctx->count);
+    return ctx;
+}
+
+void MsgpackCtxFree(MsgpackCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    uint32_t count = SC_ATOMIC_GET(ctx->count);
+    for (uint32_t i = 0; i < count; i++)
+        SCFree(ctx->strings[i]);
+    if (ctx->prefix != NULL)
+        SCFree(ctx->prefix);
+    SCMutexDestroy(&ctx->mutex);
+    SC_ATOMIC_DESTROY(ctx->count);
+    SCFree(ctx);
+}
+
+static inline uint32_t MsgpackHash(const char *str, size_t len)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)str[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static inline MsgpackString *MsgpackFind(MsgpackCtx *ctx, const char *str,
+        size_t len, uint32_t h, uint32_t *slot)
+{
+    uint32_t i = h & (MSGPACK_HASH_SIZE - 1);
+    MsgpackString *s;
+    while ((s = ctx->hash[i]) != NULL) {
+        if (s->hash == h && s->len == len && memcmp(s->str, str, len) == 0)
+            return s;
+        i = (i + 1) & (MSGPACK_HASH_SIZE - 1);
+    }
+    *slot = i;
+    return NULL;
+}
+
+static MsgpackString *MsgpackAdd(MsgpackCtx *ctx, const char *str,
+        size_t len, uint32_t h)
+{
+    SCMutexLock(&ctx->mutex);
+
+    /* another thread may have added it meanwhile */
+    uint32_t slot;
+    MsgpackString *s = MsgpackFind(ctx, str, len, h, &slot);
+    if (s != NULL || ctx->full)
+        goto end;
+
+    uint32_t id = SC_ATOMIC_GET(ctx->count);
+    s = SCMalloc(sizeof(*s) + len + 1);
+    if (unlikely(s == NULL))
+        goto end;
+    s->hash = h;
+    s->id = id;
+    s->len = (uint16_t)len;
+    memcpy(s->str, str, len);
+    s->str[len] = '\0';
+    s->intern_values = false;
+    for (const char **k = msgpack_intern_value_keys; *k != NULL; k++) {
+        if (strcmp(*k, s->str) == 0) {
+            s->intern_values = true;
+            break;
+        }
+    }
+
+    /* count the id before the string can be found */
+    ctx->strings[id] = s;
+    (void)SC_ATOMIC_ADD(ctx->count, 1);
+    ctx->hash[slot] = s;
+    if (id + 1 == MSGPACK_STRINGS_MAX)
+        ctx->full = true;
+end:
+    SCMutexUnlock(&ctx->mutex);
+    return s;
+}
+
+/**
+ * \brief get the id of an interned string, adding it if there is room
+ *
+ * \param intern_values if not NULL, set if the values of a member with
+ *        this key are to be interned too
+ * \retval id or -1 if the string is not interned
+ */
+int64_t MsgpackIntern(MsgpackCtx *ctx, const char *str, size_t len,
+        bool *intern_values)
+{
+    if (len > MSGPACK_STRING_MAX_LEN)
+        return -1;
+
+    uint32_t h = MsgpackHash(str, len);
+    uint32_t slot;
+    MsgpackString *s = MsgpackFind(ctx, str, len, h, &slot);
+    if (s == NULL) {
+        if (ctx->full)
+            return -1;
+        s = MsgpackAdd(ctx, str, len, h);
+        if (s == NULL)
+            return -1;
+    }
+    if (intern_values != NULL)
+        *intern_values = s->intern_values;
+    return s->id;
+}
+
+uint32_t MsgpackStringCount(const MsgpackCtx *ctx)
+{
+    return SC_ATOMIC_GET(ctx->count);
+}
+
+static inline uint8_t *MsgpackWriteBE(uint8_t *dst, uint64_t v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        *dst++ = (uint8_t)(v >> (i * 8));
+    return dst;
+}
+
+uint8_t *MsgpackWriteInt(uint8_t *dst, int64_t val)
+{
+    if (val >= 0) {
+        if (val < 128) {
+            *dst++ = (uint8_t)val;
+        } else if (val <= UINT8_MAX) {
+            *dst++ = 0xcc;
+            *dst++ = (uint8_t)val;
+        } else if (val <= UINT16_MAX) {
+            *dst++ = 0xcd;
+            dst = MsgpackWriteBE(dst, val, 2);
+        } else if (val <= UINT32_MAX) {
+            *dst++ = 0xce;
+            dst = MsgpackWriteBE(dst, val, 4);
+        } else {
+            *dst++ = 0xcf;
+            dst = MsgpackWriteBE(dst, val, 8);
+        }
+    } else {
+        if (val >= -32) {
+            *dst++ = (uint8_t)val;
+        } else if (val >= INT8_MIN) {
+            *dst++ = 0xd0;
+            *dst++ = (uint8_t)val;
+        } else if (val >= INT16_MIN) {
+            *dst++ = 0xd1;
+            dst = MsgpackWriteBE(dst, (uint64_t)val, 2);
+        } else if (val >= INT32_MIN) {
+            *dst++ = 0xd2;
+            dst = MsgpackWriteBE(dst, (uint64_t)val, 4);
+        } else {
+            *dst++ = 0xd3;
+            dst = MsgpackWriteBE(dst, (uint64_t)val, 8);
+        }
+    }
+    return dst;
+}
+
+uint8_t *MsgpackWriteBool(uint8_t *dst, bool val)
+{
+    *dst++ = val ? 0xc3 : 0xc2;
+    return dst;
+}
+
+uint8_t *MsgpackWriteDouble(uint8_t *dst, double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    *dst++ = 0xcb;
+    return MsgpackWriteBE(dst, bits, 8);
+}
+
+uint8_t *MsgpackWriteStr(uint8_t *dst, const char *str, size_t len)
+{
+    if (len < 32) {
+        *dst++ = 0xa0 | (uint8_t)len;
+    } else if (len <= UINT8_MAX) {
+        *dst++ = 0xd9;
+        *dst++ = (uint8_t)len;
+    } else if (len <= UINT16_MAX) {
+        *dst++ = 0xda;
+        dst = MsgpackWriteBE(dst, len, 2);
+    } else {
+        *dst++ = 0xdb;
+        dst = MsgpackWriteBE(dst, len, 4);
+    }
+    memcpy(dst, str, len);
+    return dst + len;
+}
+
+uint8_t *MsgpackWriteStringRef(uint8_t *dst, uint32_t id)
+{
+    if (id <= UINT16_MAX) {
+        *dst++ = 0xd5;      /* fixext 2 */
+        *dst++ = MSGPACK_EXT_STRING;
+        return MsgpackWriteBE(dst, id, 2);
+    }
+    *dst++ = 0xd6;          /* fixext 4 */
+    *dst++ = MSGPACK_EXT_STRING;
+    return MsgpackWriteBE(dst, id, 4);
+}
+
+uint8_t *MsgpackWriteTime(uint8_t *dst, int64_t usec, int16_t offset)
+{
+    *dst++ = 0xc7;          /* ext 8 */
+    *dst++ = 10;
+    *dst++ = MSGPACK_EXT_TIME;
+    dst = MsgpackWriteBE(dst, (uint64_t)usec, 8);
+    return MsgpackWriteBE(dst, (uint16_t)offset, 2);
+}
+
+uint8_t *MsgpackWriteContainer(uint8_t *dst, bool array, uint32_t count)
+{
+    if (count < 16) {
+        *dst++ = (array ? 0x90 : 0x80) | (uint8_t)count;
+    } else if (count <= UINT16_MAX) {
+        *dst++ = array ? 0xdc : 0xde;
+        dst = MsgpackWriteBE(dst, count, 2);
+    } else {
+        *dst++ = array ? 0xdd : 0xdf;
+        dst = MsgpackWriteBE(dst, count, 4);
+    }
+    return dst;
+}
+
+/* days since 1970-01-01 of a date in the proleptic gregorian calendar */
+static int64_t MsgpackDaysFromCivil(int64_t y, uint32_t m, uint32_t d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const uint32_t yoe = (uint32_t)(y - era * 400);
+    const uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void MsgpackCivilFromDays(int64_t z, int64_t *y, uint32_t *m,
+        uint32_t *d)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const uint32_t doe = (uint32_t)(z - era * 146097);
+    const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const uint32_t mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static inline bool MsgpackDigits(const char *s, int n, uint32_t *v)
+{
+    uint32_t r = 0;
+    for (int i = 0; i < n; i++) {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+        r = r * 10 + (s[i] - '0');
+    }
+    *v = r;
+    return true;
+}
+
+/**
+ * \brief parse a timestamp as written by CreateIsoTimeString()
+ *
+ * Only strings that MsgpackFormatTime() turns back into the exact same
+ * string are accepted.
+ */
+bool MsgpackParseTime(const char *s, size_t len, int64_t *usec,
+        int16_t *offset)
+{
+    static const uint8_t mdays[12] = {
+        31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    uint32_t y, mon, d, h, min, sec, us, oh, om;
+
+    if (len != MSGPACK_TIME_STR_LEN || s[4] != '-' || s[7] != '-' ||
+            s[10] != 'T' || s[13] != ':' || s[16] != ':' || s[19] != '.' ||
+            (s[26] != '+' && s[26] != '-'))
+        return false;
+    if (!MsgpackDigits(s, 4, &y) || !MsgpackDigits(s + 5, 2, &mon) ||
+            !MsgpackDigits(s + 8, 2, &d) || !MsgpackDigits(s + 11, 2, &h) ||
+            !MsgpackDigits(s + 14, 2, &min) ||
+            !MsgpackDigits(s + 17, 2, &sec) ||
+            !MsgpackDigits(s + 20, 6, &us) ||
+            !MsgpackDigits(s + 27, 2, &oh) || !MsgpackDigits(s + 29, 2, &om))
+        return false;
+
+    if (mon < 1 || mon > 12 || d < 1 || d > mdays[mon - 1] || h > 23 ||
+            min > 59 || sec > 59 || oh > 23 || om > 59)
+        return false;
+    if (mon == 2 && d == 29 &&
+            !((y % 4 == 0 && y % 100 != 0) || y % 400 == 0))
+        return false;
+    /* "-0000" would come back as "+0000" */
+    if (s[26] == '-' && oh == 0 && om == 0)
+        return false;
+
+    int16_t off = (int16_t)(oh * 60 + om);
+    if (s[26] == '-')
+        off = -off;
+
+    int64_t days = MsgpackDaysFromCivil(y, mon, d);
+    int64_t secs = days * 86400 + h * 3600 + min * 60 + sec - off * 60;
+    *usec = secs * 1000000 + us;
+    *offset = off;
+    return true;
+}
+
+/**
+ * \brief format a MSGPACK_EXT_TIME value as eve timestamp
+ *
+ * \retval 0 on success, -1 if the value is out of range
+ */
+int MsgpackFormatTime(int64_t usec, int16_t offset, char *str, size_t size)
+{
+    if (offset <= -24 * 60 || offset >= 24 * 60)
+        return -1;
+
+    int64_t secs = usec / 1000000;
+    int64_t us = usec % 1000000;
+    if (us < 0) {
+        us += 1000000;
+        secs--;
+    }
+    secs += offset * 60;
+
+    int64_t days = secs / 86400;
+    int64_t rem = secs % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        days--;
+    }
+
+    int64_t y;
+    uint32_t m, d;
+    MsgpackCivilFromDays(days, &y, &m, &d);
+    if (y < 0 || y > 9999)
+        return -1;
+
+    int absoff = offset < 0 ? -offset : offset;
+    int r = snprintf(str, size, "%04d-%02u-%02uT%02d:%02d:%02d.%06d%c%02d%02d",
+            (int)y, m, d, (int)(rem / 3600), (int)(rem / 60 % 60),
+            (int)(rem % 60), (int)us, offset < 0 ? '-' : '+', absoff / 60,
+            absoff % 60);
+    return (r == MSGPACK_TIME_STR_LEN && (size_t)r < size) ? 0 : -1;
+}
+
+/**
+ * \brief encode a string value, as a reference to the string table or
+ *        as a native timestamp when possible
+ *
+ * dst must have room for MSGPACK_STR_MAX_LEN(len) bytes.
+ *
+ * \param intern try to intern the string
+ */
+uint8_t *MsgpackWriteValue(MsgpackCtx *ctx, uint8_t *dst, const char *str,
+        size_t len, bool intern)
+{
+    if (intern) {
+        int64_t id = MsgpackIntern(ctx, str, len, NULL);
+        if (id >= 0)
+            return MsgpackWriteStringRef(dst, (uint32_t)id);
+    } else if (len == MSGPACK_TIME_STR_LEN) {
+        int64_t usec;
+        int16_t offset;
+        if (MsgpackParseTime(str, len, &usec, &offset))
+            return MsgpackWriteTime(dst, usec, offset);
+    }
+    return MsgpackWriteStr(dst, str, len);
+}
+
+static int MsgpackReserve(MemBuffer **buffer, size_t len)
+{
+    MemBuffer *b = *buffer;
+    if ((uint64_t)b->offset + len < b->size)
+        return 0;
+
+    uint64_t expand_by = MSGPACK_EXPAND_SIZE;
+    while ((uint64_t)b->offset + len >= b->size + expand_by)
+        expand_by += MSGPACK_EXPAND_SIZE;
+    if (expand_by > UINT32_MAX ||
+            MemBufferExpand(buffer, (uint32_t)expand_by) < 0)
+        return -1;
+    return 0;
+}
+
+/** \brief write a key, interned if possible */
+static uint8_t *MsgpackWriteKey(MsgpackCtx *ctx, uint8_t *dst,
+        const char *key, size_t len, bool *intern_values)
+{
+    *intern_values = false;
+    int64_t id = MsgpackIntern(ctx, key, len, intern_values);
+    if (id >= 0)
+        return MsgpackWriteStringRef(dst, (uint32_t)id);
+    return MsgpackWriteStr(dst, key, len);
+}
+
+/**
+ * \brief encode a jansson value
+ *
+ * \param intern intern a string value, as the key of the member is in
+ *        msgpack_intern_value_keys. Like the builder, array elements are
+ *        never interned.
+ * \retval 0 on success, -1 if the buffer could not be expanded
+ */
+int MsgpackWriteJson(MsgpackCtx *ctx, MemBuffer **buffer, const json_t *js,
+        bool intern)
+{
+    size_t len = 0;
+    const char *str = NULL;
+
+    if (json_is_string(js)) {
+        str = json_string_value(js);
+        len = strlen(str);
+    }
+    if (MsgpackReserve(buffer, MAX(MSGPACK_MAX_SCALAR_LEN,
+                    MSGPACK_STR_MAX_LEN(len))) < 0)
+        return -1;
+
+    MemBuffer *b = *buffer;
+    uint8_t *dst = b->buffer + b->offset;
+
+    switch (json_typeof(js)) {
+        case JSON_OBJECT: {
+            const char *key;
+            json_t *value;
+            dst = MsgpackWriteContainer(dst, false, json_object_size(js));
+            b->offset = dst - b->buffer;
+            json_object_foreach((json_t *)js, key, value) {
+                size_t klen = strlen(key);
+                if (MsgpackReserve(buffer, MSGPACK_STR_MAX_LEN(klen)) < 0)
+                    return -1;
+                b = *buffer;
+                bool intern_values;
+                dst = MsgpackWriteKey(ctx, b->buffer + b->offset, key, klen,
+                        &intern_values);
+                b->offset = dst - b->buffer;
+                if (MsgpackWriteJson(ctx, buffer, value, intern_values) < 0)
+                    return -1;
+                b = *buffer;
+            }
+            return 0;
+        }
+        case JSON_ARRAY: {
+            size_t n = json_array_size(js);
+            dst = MsgpackWriteContainer(dst, true, n);
+            b->offset = dst - b->buffer;
+            for (size_t i = 0; i < n; i++) {
+                if (MsgpackWriteJson(ctx, buffer, json_array_get(js, i),
+                            false) < 0)
+                    return -1;
+            }
+            return 0;
+        }
+        case JSON_STRING:
+            dst = MsgpackWriteValue(ctx, dst, str, len, intern);
+            break;
+        case JSON_INTEGER:
+            dst = MsgpackWriteInt(dst, json_integer_value(js));
+            break;
+        case JSON_REAL:
+            dst = MsgpackWriteDouble(dst, json_real_value(js));
+            break;
+        case JSON_TRUE:
+            dst = MsgpackWriteBool(dst, true);
+            break;
+        case JSON_FALSE:
+            dst = MsgpackWriteBool(dst, false);
+            break;
+        default:
+            *dst++ = 0xc0;
+            break;
+    }
+    b->offset = dst - b->buffer;
+    return 0;
+}
+
+/**
+ * \brief start a frame at the current offset of the buffer, its length
+ *        is set by MsgpackFrameFinish()
+ */
+int MsgpackFrameStart(MemBuffer **buffer, uint8_t type)
+{
+    if (MsgpackReserve(buffer, MSGPACK_FRAME_HDR_LEN) < 0)
+        return -1;
+    MemBuffer *b = *buffer;
+    memset(b->buffer + b->offset, 0, MSGPACK_FRAME_HDR_LEN - 1);
+    b->buffer[b->offset + MSGPACK_FRAME_HDR_LEN - 1] = type;
+    b->offset += MSGPACK_FRAME_HDR_LEN;
+    return 0;
+}
+
+/** \brief set the length of the frame started at offset start */
+void MsgpackFrameFinish(MemBuffer *buffer, uint32_t start)
+{
+    uint32_t len = buffer->offset - start - MSGPACK_FRAME_HDR_LEN;
+    MsgpackWriteBE(buffer->buffer + start, len, 4);
+}
+
+/**
+ * \brief get the frames a file needs before the next record can be
+ *        written to it: the header and the strings it hasn't seen yet
+ *
+ * \param header the file was (re)opened and needs a header
+ * \param written strings already in the file, updated
+ * \param out set to an allocated buffer with the frames or NULL if
+ *        nothing is needed, to be freed by the caller
+ *
+ * \retval 0 on success, -1 on error
+ */
+int MsgpackSync(MsgpackCtx *ctx, bool header, uint32_t *written,
+        uint8_t **out, size_t *out_len)
+{
+    *out = NULL;
+    *out_len = 0;
+
+    if (header)
+        *written = 0;
+    const uint32_t count = SC_ATOMIC_GET(ctx->count);
+    if (!header && count <= *written)
+        return 0;
+
+    size_t size = 0;
+    if (header) {
+        size += MSGPACK_FRAME_HDR_LEN + 64 + sizeof(MSGPACK_FORMAT_NAME) +
+            (ctx->prefix ? MSGPACK_STR_MAX_LEN(strlen(ctx->prefix)) : 0);
+    }
+    if (count > *written) {
+        size += MSGPACK_FRAME_HDR_LEN + 2 * MSGPACK_MAX_SCALAR_LEN;
+        for (uint32_t i = *written; i < count; i++)
+            size += MSGPACK_STR_MAX_LEN(ctx->strings[i]->len);
+    }
+
+    MemBuffer *b = MemBufferCreateNew(size);
+    if (unlikely(b == NULL))
+        return -1;
+
+    if (header) {
+        MsgpackFrameStart(&b, MSGPACK_FRAME_HEADER);
+        uint8_t *dst = b->buffer + b->offset;
+        dst = MsgpackWriteContainer(dst, false, ctx->prefix ? 4 : 3);
+        dst = MsgpackWriteStr(dst, "format", 6);
+        dst = MsgpackWriteStr(dst, MSGPACK_FORMAT_NAME,
+                strlen(MSGPACK_FORMAT_NAME));
+        dst = MsgpackWriteStr(dst, "version", 7);
+        dst = MsgpackWriteInt(dst, MSGPACK_FORMAT_VERSION);
+        dst = MsgpackWriteStr(dst, "json-flags", 10);
+        dst = MsgpackWriteInt(dst, (int64_t)ctx->json_flags);
+        if (ctx->prefix) {
+            dst = MsgpackWriteStr(dst, "prefix", 6);
+            dst = MsgpackWriteStr(dst, ctx->prefix, strlen(ctx->prefix));
+        }
+        b->offset = dst - b->buffer;
+        MsgpackFrameFinish(b, 0);
+    }
+
+    if (count > *written) {
+        uint32_t start = b->offset;
+        MsgpackFrameStart(&b, MSGPACK_FRAME_STRINGS);
+        uint8_t *dst = b->buffer + b->offset;
+        dst = MsgpackWriteContainer(dst, true, 1 + count - *written);
+        dst = MsgpackWriteInt(dst, *written);
+        for (uint32_t i = *written; i < count; i++) {
+            dst = MsgpackWriteStr(dst, ctx->strings[i]->str,
+                    ctx->strings[i]->len);
+        }
+        b->offset = dst - b->buffer;
+        MsgpackFrameFinish(b, start);
+    }
+
+    /* hand out the buffer itself, the MemBuffer header is dropped */
+    *out_len = b->offset;
+    *out = SCMalloc(b->offset);
+    if (unlikely(*out == NULL)) {
+        MemBufferFree(b);
+        return -1;
+    }
+    memcpy(*out, b->buffer, b->offset);
+    MemBufferFree(b);
+
+    *written = count;
+    return 0;
+}
+
+#ifdef UNITTESTS
+
+/** \test timestamps round trip, anything else is written as string */
+static int MsgpackTest01(void)
+{
+    const char *valid[] = {
+        "2018-01-01T00:00:00.000000+0000",
+        "2018-07-12T13:45:01.123456+0200",
+        "2016-02-29T23:59:59.999999-0930",
+        "1969-12-31T23:59:59.000001+0000",
+        "2000-03-01T00:00:00.500000+1400",
+        NULL
+    };
+    const char *invalid[] = {
+        "2018-01-01T00:00:00.000000-0000",
+        "2017-02-29T00:00:00.000000+0000",
+        "2018-13-01T00:00:00.000000+0000",
+        "2018-01-01T24:00:00.000000+0000",
+        "2018-01-01 00:00:00.000000+0000",
+        "2018-01-01T00:00:00.000000+00:0",
+        "2018-01-01T00:00:00.00000+00000",
+        "2018-01-01T00:00:00+0000",
+        NULL
+    };
+
+    for (int i = 0; valid[i] != NULL; i++) {
+        int64_t usec;
+        int16_t offset;
+        char str[64];
+        FAIL_IF_NOT(MsgpackParseTime(valid[i], strlen(valid[i]), &usec,
+                    &offset));
+        FAIL_IF(MsgpackFormatTime(usec, offset, str, sizeof(str)) != 0);
+        FAIL_IF(strcmp(str, valid[i]) != 0);
+    }
+    for (int i = 0; invalid[i] != NULL; i++) {
+        int64_t usec;
+        int16_t offset;
+        FAIL_IF(MsgpackParseTime(invalid[i], strlen(invalid[i]), &usec,
+                    &offset));
+    }
+
+    /* 2018-07-12T13:45:01.123456+0200 */
+    int64_t usec;
+    int16_t offset;
+    FAIL_IF_NOT(MsgpackParseTime(valid[1], strlen(valid[1]), &usec, &offset));
+    FAIL_IF_NOT(usec == 1531395901123456LL);
+    FAIL_IF_NOT(offset == 120);
+    PASS;
+}
+
+/** \test encoding of a jansson record and the string frames */
+static int MsgpackTest02(void)
+{
+    MsgpackCtx *ctx = MsgpackCtxNew(0, NULL);
+    FAIL_IF_NULL(ctx);
+    MemBuffer *b = MemBufferCreateNew(16);
+    FAIL_IF_NULL(b);
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_object_set_new(js, "a", json_integer(1));
+    json_object_set_new(js, "event_type", json_string("alert"));
+    json_object_set_new(js, "n", json_integer(-300));
+    json_object_set_new(js, "s", json_string("alert"));
+    json_object_set_new(js, "t", json_string("2018-01-01T00:00:00.000000+0000"));
+    json_t *arr = json_array();
+    json_array_append_new(arr, json_true());
+    json_array_append_new(arr, json_null());
+    json_object_set_new(js, "l", arr);
+
+    FAIL_IF(MsgpackWriteJson(ctx, &b, js, false) != 0);
+    const uint8_t expected[] = {
+        0x86,
+        0xd5, 0x01, 0x00, 0x00, 0x01,                   /* a: 1 */
+        0xd5, 0x01, 0x00, 0x01, 0xd5, 0x01, 0x00, 0x02, /* event_type */
+        0xd5, 0x01, 0x00, 0x03, 0xd1, 0xfe, 0xd4,       /* n: -300 */
+        0xd5, 0x01, 0x00, 0x04, 0xa5, 'a', 'l', 'e', 'r', 't',
+        0xd5, 0x01, 0x00, 0x05, 0xc7, 0x0a, 0x02,       /* t */
+        0x00, 0x05, 0x61, 0xab, 0xa9, 0xd2, 0x80, 0x00, 0x00, 0x00,
+        0xd5, 0x01, 0x00, 0x06, 0x92, 0xc3, 0xc0,       /* l */
+    };
+    FAIL_IF_NOT(b->offset == sizeof(expected));
+    FAIL_IF(memcmp(b->buffer, expected, sizeof(expected)) != 0);
+    FAIL_IF_NOT(MsgpackStringCount(ctx) == 7);
+
+    /* a new file gets the header and all strings, then only new ones */
+    uint32_t written = 5;
+    uint8_t *out;
+    size_t out_len;
+    FAIL_IF(MsgpackSync(ctx, true, &written, &out, &out_len) != 0);
+    FAIL_IF_NULL(out);
+    FAIL_IF_NOT(written == 7);
+    FAIL_IF_NOT(out[4] == MSGPACK_FRAME_HEADER);
+    uint32_t hlen = (out[0] << 24) | (out[1] << 16) | (out[2] << 8) | out[3];
+    FAIL_IF_NOT(out[MSGPACK_FRAME_HDR_LEN + hlen + 4] == MSGPACK_FRAME_STRINGS);
+    /* [0, "a", "event_type", ...] */
+    FAIL_IF_NOT(out[MSGPACK_FRAME_HDR_LEN * 2 + hlen] == 0x98);
+    FAIL_IF_NOT(out[MSGPACK_FRAME_HDR_LEN * 2 + hlen + 1] == 0x00);
+    SCFree(out);
+
+    FAIL_IF(MsgpackSync(ctx, false, &written, &out, &out_len) != 0);
+    FAIL_IF_NOT(out == NULL && out_len == 0);
+    FAIL_IF_NOT(MsgpackIntern(ctx, "new", 3, NULL) == 7);
+    FAIL_IF(MsgpackSync(ctx, false, &written, &out, &out_len) != 0);
+    FAIL_IF_NULL(out);
+    const uint8_t strings[] = { 0x00, 0x00, 0x00, 0x06, 'S',
+        0x92, 0x07, 0xa3, 'n', 'e', 'w' };
+    FAIL_IF_NOT(out_len == sizeof(strings));
+    FAIL_IF(memcmp(out, strings, sizeof(strings)) != 0);
+    SCFree(out);
+
+    json_decref(js);
+    MemBufferFree(b);
+    MsgpackCtxFree(ctx);
+    PASS;
+}
+
+/** \test the table stops growing when it is full */
+static int MsgpackTest03(void)
+{
+    MsgpackCtx *ctx = MsgpackCtxNew(0, NULL);
+    FAIL_IF_NULL(ctx);
+
+    char str[32];
+    for (int i = 0; i < MSGPACK_STRINGS_MAX; i++) {
+        int len = snprintf(str, sizeof(str), "s%d", i);
+        FAIL_IF_NOT(MsgpackIntern(ctx, str, len, NULL) == i);
+    }
+    FAIL_IF_NOT(MsgpackIntern(ctx, "more", 4, NULL) == -1);
+    FAIL_IF_NOT(MsgpackIntern(ctx, "s10", 3, NULL) == 10);
+
+    char big[MSGPACK_STRING_MAX_LEN + 1];
+    memset(big, 'x', sizeof(big));
+    FAIL_IF_NOT(MsgpackIntern(ctx, big, sizeof(big), NULL) == -1);
+
+    MsgpackCtxFree(ctx);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MsgpackRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MsgpackTest01", MsgpackTest01);
+    UtRegisterTest("MsgpackTest02", MsgpackTest02);
+    UtRegisterTest("MsgpackTest03", MsgpackTest03);
+#endif /* UNITTESTS */
+}
+
+#endif /* HAVE_LIBJANSSON */
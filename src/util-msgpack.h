@@ -0,0 +1,110 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * MessagePack encoding of eve records ("format: msgpack").
+ *
+ * A file is a sequence of frames: a 4 byte big endian length, a 1 byte
+ * frame type and length bytes of MessagePack:
+ *
+ * - 'H' header, a map with "format", "version", "json-flags" and
+ *   optionally "prefix". Starts every (re)opened file and resets the
+ *   string table of the reader.
+ * - 'S' strings, an array of the first id followed by the strings that
+ *   get the ids from there on.
+ * - 'E' event, a map with the same members as the eve.json record.
+ *
+ * Two ext types are used in the events:
+ *
+ * - MSGPACK_EXT_STRING, a string from the string table by its big endian
+ *   id (2 or 4 bytes). Used for the keys and for the values of a few
+ *   members with few distinct values, like event_type and proto.
+ * - MSGPACK_EXT_TIME, a timestamp string in the eve format: 8 bytes big
+ *   endian microseconds since the epoch and 2 bytes big endian utc
+ *   offset in minutes.
+ *
+ * Strings are sent to the file before the first record that uses them,
+ * so every file can be read on its own.
+ */
+
+#ifndef __UTIL_MSGPACK_H__
+#define __UTIL_MSGPACK_H__
+
+#ifdef HAVE_LIBJANSSON
+
+#include "util-buffer.h"
+
+#define MSGPACK_FORMAT_NAME     "eve-msgpack"
+#define MSGPACK_FORMAT_VERSION  1
+
+#define MSGPACK_FRAME_HEADER    'H'
+#define MSGPACK_FRAME_STRINGS   'S'
+#define MSGPACK_FRAME_EVENT     'E'
+/** frame length and type */
+#define MSGPACK_FRAME_HDR_LEN   5
+
+#define MSGPACK_EXT_STRING      1
+#define MSGPACK_EXT_TIME        2
+
+/** max bytes an integer, double or container header takes */
+#define MSGPACK_MAX_SCALAR_LEN  9
+/** length of an eve timestamp, "2018-01-01T00:00:00.000000+0000" */
+#define MSGPACK_TIME_STR_LEN    31
+
+/** per output state: the string table and the header settings */
+typedef struct MsgpackCtx_ MsgpackCtx;
+
+MsgpackCtx *MsgpackCtxNew(size_t json_flags, const char *prefix);
+void MsgpackCtxFree(MsgpackCtx *ctx);
+
+int64_t MsgpackIntern(MsgpackCtx *ctx, const char *str, size_t len,
+        bool *intern_values);
+uint32_t MsgpackStringCount(const MsgpackCtx *ctx);
+int MsgpackSync(MsgpackCtx *ctx, bool header, uint32_t *written,
+        uint8_t **out, size_t *out_len);
+
+/** max bytes a string takes, as a string or as a reference */
+#define MSGPACK_STR_MAX_LEN(len)    (5 + (size_t)(len))
+
+/* encoding into a buffer the caller made big enough */
+uint8_t *MsgpackWriteInt(uint8_t *dst, int64_t val);
+uint8_t *MsgpackWriteBool(uint8_t *dst, bool val);
+uint8_t *MsgpackWriteDouble(uint8_t *dst, double val);
+uint8_t *MsgpackWriteStr(uint8_t *dst, const char *str, size_t len);
+uint8_t *MsgpackWriteStringRef(uint8_t *dst, uint32_t id);
+uint8_t *MsgpackWriteTime(uint8_t *dst, int64_t usec, int16_t offset);
+uint8_t *MsgpackWriteContainer(uint8_t *dst, bool array, uint32_t count);
+uint8_t *MsgpackWriteValue(MsgpackCtx *ctx, uint8_t *dst, const char *str,
+        size_t len, bool intern);
+
+bool MsgpackParseTime(const char *str, size_t len, int64_t *usec,
+        int16_t *offset);
+int MsgpackFormatTime(int64_t usec, int16_t offset, char *str, size_t size);
+
+int MsgpackWriteJson(MsgpackCtx *ctx, MemBuffer **buffer, const json_t *js,
+        bool intern);
+
+int MsgpackFrameStart(MemBuffer **buffer, uint8_t type);
+void MsgpackFrameFinish(MemBuffer *buffer, uint32_t start);
+
+void MsgpackRegisterTests(void);
+
+#endif /* HAVE_LIBJANSSON */
+
+#endif /* __UTIL_MSGPACK_H__ */
@@ -54,12 +54,32 @@ typedef struct SCProfileKeywordData_ {
     uint64_t ticks_no_match;
 } SCProfileKeywordData;
 
+/**
+ * Per rule pcre data.
+ */
+typedef struct SCProfilePcreData_ {
+    uint64_t checks;
+    uint64_t matches;
+    uint64_t limit_hits;    /**< match or jit stack limit reached */
+    uint64_t max;
+    uint64_t ticks;
+} SCProfilePcreData;
+
 typedef struct SCProfileKeywordDetectCtx_ {
     uint32_t id;
     SCProfileKeywordData *data;
     pthread_mutex_t data_m;
+
+    /* per rule pcre stats, by Signature::num. Only in the global ctx. */
+    SCProfilePcreData *pcre_data;
+    uint32_t pcre_data_size;
 } SCProfileKeywordDetectCtx;
 
+typedef struct SCProfilePcreSummary_ {
+    uint32_t sid;
+    SCProfilePcreData d;
+} SCProfilePcreSummary;
+
 static int profiling_keywords_output_to_file = 0;
 int profiling_keyword_enabled = 0;
 __thread int profiling_keyword_entered = 0;
@@ -146,6 +166,74 @@ static void DoDump(SCProfileKeywordDetectCtx *rules_ctx, FILE *fp, const char *n
     }
 }
 
+static int PcreSummaryCompare(const void *a, const void *b)
+{
+    const SCProfilePcreSummary *s0 = a;
+    const SCProfilePcreSummary *s1 = b;
+    if (s1->d.ticks == s0->d.ticks)
+        return 0;
+    return s0->d.ticks > s1->d.ticks ? -1 : 1;
+}
+
+static void DoDumpPcre(const DetectEngineCtx *de_ctx, FILE *fp)
+{
+    const SCProfileKeywordDetectCtx *ctx = de_ctx->profile_keyword_ctx;
+    uint32_t i, cnt = 0;
+
+    if (ctx->pcre_data == NULL || de_ctx->sig_array == NULL)
+        return;
+
+    for (i = 0; i < ctx->pcre_data_size; i++) {
+        if (ctx->pcre_data[i].checks)
+            cnt++;
+    }
+    if (cnt == 0)
+        return;
+
+    SCProfilePcreSummary *summary = SCCalloc(cnt, sizeof(*summary));
+    if (summary == NULL)
+        return;
+    cnt = 0;
+    for (i = 0; i < ctx->pcre_data_size && i < de_ctx->sig_array_len; i++) {
+        if (ctx->pcre_data[i].checks == 0 || de_ctx->sig_array[i] == NULL)
+            continue;
+        summary[cnt].sid = de_ctx->sig_array[i]->id;
+        summary[cnt].d = ctx->pcre_data[i];
+        cnt++;
+    }
+    qsort(summary, cnt, sizeof(*summary), PcreSummaryCompare);
+
+    fprintf(fp, "  ----------------------------------------------"
+            "------------------------------------------------------"
+            "----------------------------\n");
+    fprintf(fp, "  Stats for: pcre per rule\n");
+    fprintf(fp, "  ----------------------------------------------"
+            "------------------------------------------------------"
+            "----------------------------\n");
+    fprintf(fp, "  %-10s %-15s %-15s %-15s %-15s %-15s %-15s\n", "Sid", "Ticks", "Checks", "Matches", "Max Ticks", "Avg", "Limit Hits");
+    fprintf(fp, "  ---------- "
+                "--------------- "
+                "--------------- "
+                "--------------- "
+                "--------------- "
+                "--------------- "
+                "--------------- "
+        "\n");
+    for (i = 0; i < cnt; i++) {
+        const SCProfilePcreData *d = &summary[i].d;
+        fprintf(fp,
+            "  %-10"PRIu32" %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15.2f %-15"PRIu64"\n",
+            summary[i].sid,
+            d->ticks,
+            d->checks,
+            d->matches,
+            d->max,
+            (double)d->ticks / d->checks,
+            d->limit_hits);
+    }
+    SCFree(summary);
+}
+
 static void
 SCProfilingKeywordDump(DetectEngineCtx *de_ctx)
 {
@@ -204,6 +292,7 @@ SCProfilingKeywordDump(DetectEngineCtx *de_ctx)
             DoDump(de_ctx->profile_keyword_ctx_per_list[i], fp, name);
         }
     }
+    DoDumpPcre(de_ctx, fp);
 
     fprintf(fp,"\n");
     if (fp != stdout)
@@ -249,6 +338,30 @@ SCProfilingKeywordUpdateCounter(DetectEngineThreadCtx *det_ctx, int id, uint64_t
     }
 }
 
+/**
+ * \brief Update the pcre counters of a rule.
+ *
+ * \param s rule the pcre belongs to
+ * \param ticks Number of CPU ticks for this pcre.
+ * \param match Did the pcre match?
+ * \param limit_hit Did pcre give up because of a limit?
+ */
+void SCProfilingPcreUpdateCounter(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint64_t ticks, int match, int limit_hit)
+{
+    if (det_ctx != NULL && det_ctx->pcre_perf_data != NULL &&
+            s != NULL && s->num < det_ctx->pcre_perf_data_size) {
+        SCProfilePcreData *p = &det_ctx->pcre_perf_data[s->num];
+
+        p->checks++;
+        p->matches += match;
+        p->limit_hits += limit_hit;
+        p->ticks += ticks;
+        if (ticks > p->max)
+            p->max = ticks;
+    }
+}
+
 static SCProfileKeywordDetectCtx *SCProfilingKeywordInitCtx(void)
 {
     SCProfileKeywordDetectCtx *ctx = SCMalloc(sizeof(SCProfileKeywordDetectCtx));
@@ -270,6 +383,8 @@ static void DetroyCtx(SCProfileKeywordDetectCtx *ctx)
     if (ctx) {
         if (ctx->data != NULL)
             SCFree(ctx->data);
+        if (ctx->pcre_data != NULL)
+            SCFree(ctx->pcre_data);
         pthread_mutex_destroy(&ctx->data_m);
         SCFree(ctx);
     }
@@ -302,6 +417,12 @@ void SCProfilingKeywordThreadSetup(SCProfileKeywordDetectCtx *ctx, DetectEngineT
         det_ctx->keyword_perf_data = a;
     }
 
+    if (ctx->pcre_data_size > 0) {
+        det_ctx->pcre_perf_data = SCCalloc(ctx->pcre_data_size, sizeof(SCProfilePcreData));
+        if (det_ctx->pcre_perf_data != NULL)
+            det_ctx->pcre_perf_data_size = ctx->pcre_data_size;
+    }
+
     const int nlists = det_ctx->de_ctx->buffer_type_id;
     det_ctx->keyword_perf_data_per_list = SCCalloc(nlists, sizeof(SCProfileKeywordData *));
     BUG_ON(det_ctx->keyword_perf_data_per_list == NULL);
@@ -334,6 +455,18 @@ static void SCProfilingKeywordThreadMerge(DetectEngineCtx *de_ctx, DetectEngineT
             de_ctx->profile_keyword_ctx->data[i].max = det_ctx->keyword_perf_data[i].max;
     }
 
+    uint32_t x;
+    for (x = 0; x < det_ctx->pcre_perf_data_size && x < de_ctx->profile_keyword_ctx->pcre_data_size; x++) {
+        SCProfilePcreData *t = &de_ctx->profile_keyword_ctx->pcre_data[x];
+        const SCProfilePcreData *d = &det_ctx->pcre_perf_data[x];
+        t->checks += d->checks;
+        t->matches += d->matches;
+        t->limit_hits += d->limit_hits;
+        t->ticks += d->ticks;
+        if (d->max > t->max)
+            t->max = d->max;
+    }
+
     const int nlists = det_ctx->de_ctx->buffer_type_id;
     int j;
     for (j = 0; j < nlists; j++) {
@@ -359,6 +492,11 @@ void SCProfilingKeywordThreadCleanup(DetectEngineThreadCtx *det_ctx)
 
     SCFree(det_ctx->keyword_perf_data);
     det_ctx->keyword_perf_data = NULL;
+    if (det_ctx->pcre_perf_data != NULL) {
+        SCFree(det_ctx->pcre_perf_data);
+        det_ctx->pcre_perf_data = NULL;
+        det_ctx->pcre_perf_data_size = 0;
+    }
 
     const int nlists = det_ctx->de_ctx->buffer_type_id;
     int i;
@@ -389,6 +527,13 @@ SCProfilingKeywordInitCounters(DetectEngineCtx *de_ctx)
     BUG_ON(de_ctx->profile_keyword_ctx->data == NULL);
     memset(de_ctx->profile_keyword_ctx->data, 0x00, sizeof(SCProfileKeywordData) * DETECT_TBLSIZE);
 
+    if (de_ctx->sig_array_len > 0) {
+        de_ctx->profile_keyword_ctx->pcre_data = SCCalloc(de_ctx->sig_array_len,
+                sizeof(SCProfilePcreData));
+        BUG_ON(de_ctx->profile_keyword_ctx->pcre_data == NULL);
+        de_ctx->profile_keyword_ctx->pcre_data_size = de_ctx->sig_array_len;
+    }
+
     de_ctx->profile_keyword_ctx_per_list = SCCalloc(nlists, sizeof(SCProfileKeywordDetectCtx *));
     BUG_ON(de_ctx->profile_keyword_ctx_per_list == NULL);
 
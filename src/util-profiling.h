@@ -87,6 +87,19 @@ extern __thread int profiling_keyword_entered;
         profiling_keyword_entered--; \
     }
 
+/* per rule pcre stats, part of the keyword profiling */
+#define PCRE_PROFILING_START \
+    uint64_t profile_pcre_start_ = 0; \
+    if (profiling_keyword_enabled) { \
+        profile_pcre_start_ = UtilCpuGetTicks(); \
+    }
+
+#define PCRE_PROFILING_END(ctx, s, m, limit) \
+    if (profiling_keyword_enabled) { \
+        SCProfilingPcreUpdateCounter((ctx), (s), \
+            UtilCpuGetTicks() - profile_pcre_start_, (m), (limit)); \
+    }
+
 PktProfiling *SCProfilePacketStart(void);
 
 #define PACKET_PROFILING_START(p)                                   \
@@ -310,6 +323,8 @@ void SCProfilingKeywordsGlobalInit(void);
 void SCProfilingKeywordDestroyCtx(DetectEngineCtx *);//struct SCProfileKeywordDetectCtx_ *);
 void SCProfilingKeywordInitCounters(DetectEngineCtx *);
 void SCProfilingKeywordUpdateCounter(DetectEngineThreadCtx *det_ctx, int id, uint64_t ticks, int match);
+void SCProfilingPcreUpdateCounter(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint64_t ticks, int match, int limit_hit);
 void SCProfilingKeywordThreadSetup(struct SCProfileKeywordDetectCtx_ *, DetectEngineThreadCtx *);
 void SCProfilingKeywordThreadCleanup(DetectEngineThreadCtx *);
 
@@ -342,6 +357,9 @@ void SCProfilingDump(void);
 #define KEYWORD_PROFILING_START
 #define KEYWORD_PROFILING_END(a,b,c)
 
+#define PCRE_PROFILING_START
+#define PCRE_PROFILING_END(a,b,c,d)
+
 #define PACKET_PROFILING_START(p)
 #define PACKET_PROFILING_RESTART(p)
 #define PACKET_PROFILING_END(p)
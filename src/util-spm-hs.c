@@ -65,8 +65,7 @@ static void HSDestroyCtx(SpmCtx *ctx)
 }
 
 static int HSBuildDatabase(const uint8_t *needle, uint16_t needle_len,
-                            int nocase, SpmHsCtx *sctx,
-                            SpmGlobalThreadCtx *global_thread_ctx)
+                            int nocase, SpmHsCtx *sctx)
 {
     char *expr = HSRenderPattern(needle, needle_len);
     if (expr == NULL) {
@@ -88,17 +87,12 @@ static int HSBuildDatabase(const uint8_t *needle, uint16_t needle_len,
 
     SCFree(expr);
 
-    /* Update scratch for this database. */
-    hs_scratch_t *scratch = global_thread_ctx->ctx;
-    err = hs_alloc_scratch(db, &scratch);
-    if (err != HS_SUCCESS) {
-        /* If scratch allocation failed, this is not recoverable:  other SPM
-         * contexts may need this scratch space. */
-        SCLogError(SC_ERR_FATAL,
-                   "Unable to alloc scratch for Hyperscan, returned %d.", err);
+    /* Update the shared scratch for this database. */
+    if (HSScratchAddDatabase(db) != 0) {
+        /* If scratch allocation failed, this is not recoverable:  other
+         * Hyperscan users may need this scratch space. */
         exit(EXIT_FAILURE);
     }
-    global_thread_ctx->ctx = scratch;
     sctx->db = db;
     sctx->needle_len = needle_len;
 
@@ -125,8 +119,7 @@ static SpmCtx *HSInitCtx(const uint8_t *needle, uint16_t needle_len, int nocase,
     ctx->ctx = sctx;
 
     memset(sctx, 0, sizeof(SpmHsCtx));
-    if (HSBuildDatabase(needle, needle_len, nocase, sctx,
-                        global_thread_ctx) != 0) {
+    if (HSBuildDatabase(needle, needle_len, nocase, sctx) != 0) {
         SCLogDebug("HSBuildDatabase failed.");
         HSDestroyCtx(ctx);
         return NULL;
@@ -139,7 +132,7 @@ static uint8_t *HSScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
                        const uint8_t *haystack, uint32_t haystack_len)
 {
     const SpmHsCtx *sctx = ctx->ctx;
-    hs_scratch_t *scratch = thread_ctx->ctx;
+    hs_scratch_t *scratch = HSScratchGet();
 
     if (unlikely(haystack_len == 0)) {
         return NULL;
@@ -176,8 +169,8 @@ static SpmGlobalThreadCtx *HSInitGlobalThreadCtx(void)
     memset(global_thread_ctx, 0, sizeof(*global_thread_ctx));
     global_thread_ctx->matcher = SPM_HS;
 
-    /* We store scratch in the HS-specific ctx. This will be initialized as
-     * patterns are compiled by SpmInitCtx. */
+    /* No scratch here: it is shared with the other Hyperscan users of
+     * the thread, see HSScratchGet(). */
     global_thread_ctx->ctx = NULL;
 
     return global_thread_ctx;
@@ -188,7 +181,6 @@ static void HSDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
     if (global_thread_ctx == NULL) {
         return;
     }
-    hs_free_scratch(global_thread_ctx->ctx);
     SCFree(global_thread_ctx);
 }
 
@@ -197,7 +189,6 @@ static void HSDestroyThreadCtx(SpmThreadCtx *thread_ctx)
     if (thread_ctx == NULL) {
         return;
     }
-    hs_free_scratch(thread_ctx->ctx);
     SCFree(thread_ctx);
 }
 
@@ -211,17 +202,6 @@ static SpmThreadCtx *HSMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx
     memset(thread_ctx, 0, sizeof(*thread_ctx));
     thread_ctx->matcher = SPM_HS;
 
-    if (global_thread_ctx->ctx != NULL) {
-        hs_scratch_t *scratch = NULL;
-        hs_error_t err = hs_clone_scratch(global_thread_ctx->ctx, &scratch);
-        if (err != HS_SUCCESS) {
-            SCLogError(SC_ERR_FATAL, "Unable to clone scratch (error %d).",
-                       err);
-            exit(EXIT_FAILURE);
-        }
-        thread_ctx->ctx = scratch;
-    }
-
     return thread_ctx;
 }
 
@@ -235,6 +215,8 @@ void SpmHSRegister(void)
     spm_table[SPM_HS].InitCtx = HSInitCtx;
     spm_table[SPM_HS].DestroyCtx = HSDestroyCtx;
     spm_table[SPM_HS].Scan = HSScan;
+
+    HSScratchInit();
 }
 
 #endif /* BUILD_HYPERSCAN */
@@ -0,0 +1,426 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher that filters candidates on the first and last
+ * byte of the needle with SIMD compares.
+ *
+ * For each block of 16 (sse2) or 32 (avx2) haystack positions the
+ * bytes at the position and at position + needle_len - 1 are compared
+ * against the first and last byte of the needle. Only the positions
+ * where both match are verified with a memcmp. For nocase needles both
+ * the lower and the upper case of the first and last byte are accepted
+ * and the needle is verified case insensitive.
+ *
+ * Unlike Boyer-Moore there is no per pattern table to build, and short
+ * needles don't limit the shift, so it does well on the short and
+ * nocase contents that make up most of the non fast pattern contents.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-spm.h"
+#include "util-spm-simd.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-memcmp.h"
+#include "util-memcpy.h"
+#include "util-unittest.h"
+
+typedef struct SpmSimdCtx_ {
+    /* needle, in lowercase for nocase */
+    uint8_t *needle;
+    uint16_t needle_len;
+    int nocase;
+
+    /* first and last byte of the needle, and their uppercase versions
+     * for nocase. Equal to first and last otherwise. */
+    uint8_t first;
+    uint8_t first_alt;
+    uint8_t last;
+    uint8_t last_alt;
+} SpmSimdCtx;
+
+typedef uint8_t *(*SpmSimdSearchFunc)(const SpmSimdCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len);
+
+/**
+ * \internal
+ * \brief Check a candidate whose first and last byte matched.
+ */
+static inline int SpmSimdVerify(const SpmSimdCtx *sctx, const uint8_t *p)
+{
+    const uint16_t m = sctx->needle_len;
+
+    if (m <= 2)
+        return 1;
+    if (sctx->nocase)
+        return SCMemcmpLowercase(sctx->needle + 1, p + 1, m - 2) == 0;
+    return SCMemcmp(sctx->needle + 1, p + 1, m - 2) == 0;
+}
+
+static inline int SpmSimdEdgeMatch(const uint8_t c, const uint8_t b,
+        const uint8_t b_alt)
+{
+    return c == b || c == b_alt;
+}
+
+/**
+ * \internal
+ * \brief Scalar search from position 'i', also used for the tail the
+ *        vector loops can't load a full block for.
+ */
+static uint8_t *SpmSimdSearchFrom(const SpmSimdCtx *sctx,
+        const uint8_t *haystack, uint32_t i, const uint32_t haystack_len)
+{
+    const uint16_t m = sctx->needle_len;
+
+    for ( ; i + m <= haystack_len; i++) {
+        if (SpmSimdEdgeMatch(haystack[i], sctx->first, sctx->first_alt) &&
+            SpmSimdEdgeMatch(haystack[i + m - 1], sctx->last, sctx->last_alt) &&
+            SpmSimdVerify(sctx, haystack + i))
+        {
+            return (uint8_t *)haystack + i;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t *SpmSimdSearchScalar(const SpmSimdCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len)
+{
+    return SpmSimdSearchFrom(sctx, haystack, 0, haystack_len);
+}
+
+#ifdef SC_CPU_DISPATCH
+#include <immintrin.h>
+
+SC_CPU_TARGET("sse2")
+static uint8_t *SpmSimdSearchSSE2(const SpmSimdCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len)
+{
+    const uint32_t m = sctx->needle_len;
+    const __m128i first = _mm_set1_epi8((char)sctx->first);
+    const __m128i first_alt = _mm_set1_epi8((char)sctx->first_alt);
+    const __m128i last = _mm_set1_epi8((char)sctx->last);
+    const __m128i last_alt = _mm_set1_epi8((char)sctx->last_alt);
+    uint32_t i = 0;
+
+    for ( ; i + m - 1 + 16 <= haystack_len; i += 16) {
+        const __m128i bf = _mm_loadu_si128((const __m128i *)(haystack + i));
+        const __m128i bl = _mm_loadu_si128((const __m128i *)(haystack + i + m - 1));
+        const __m128i ef = _mm_or_si128(_mm_cmpeq_epi8(bf, first),
+                _mm_cmpeq_epi8(bf, first_alt));
+        const __m128i el = _mm_or_si128(_mm_cmpeq_epi8(bl, last),
+                _mm_cmpeq_epi8(bl, last_alt));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(ef, el));
+
+        while (mask != 0) {
+            const uint32_t bit = __builtin_ctz(mask);
+            if (SpmSimdVerify(sctx, haystack + i + bit))
+                return (uint8_t *)haystack + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return SpmSimdSearchFrom(sctx, haystack, i, haystack_len);
+}
+
+SC_CPU_TARGET("avx2")
+static uint8_t *SpmSimdSearchAVX2(const SpmSimdCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len)
+{
+    const uint32_t m = sctx->needle_len;
+    const __m256i first = _mm256_set1_epi8((char)sctx->first);
+    const __m256i first_alt = _mm256_set1_epi8((char)sctx->first_alt);
+    const __m256i last = _mm256_set1_epi8((char)sctx->last);
+    const __m256i last_alt = _mm256_set1_epi8((char)sctx->last_alt);
+    uint32_t i = 0;
+
+    for ( ; i + m - 1 + 32 <= haystack_len; i += 32) {
+        const __m256i bf = _mm256_loadu_si256((const __m256i *)(haystack + i));
+        const __m256i bl = _mm256_loadu_si256((const __m256i *)(haystack + i + m - 1));
+        const __m256i ef = _mm256_or_si256(_mm256_cmpeq_epi8(bf, first),
+                _mm256_cmpeq_epi8(bf, first_alt));
+        const __m256i el = _mm256_or_si256(_mm256_cmpeq_epi8(bl, last),
+                _mm256_cmpeq_epi8(bl, last_alt));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(ef, el));
+
+        while (mask != 0) {
+            const uint32_t bit = __builtin_ctz(mask);
+            if (SpmSimdVerify(sctx, haystack + i + bit))
+                return (uint8_t *)haystack + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return SpmSimdSearchFrom(sctx, haystack, i, haystack_len);
+}
+#endif /* SC_CPU_DISPATCH */
+
+static SpmSimdSearchFunc SpmSimdSearch = SpmSimdSearchScalar;
+
+/**
+ * \brief check if the cpu has the vector support that makes this
+ *        matcher worth using over Boyer-Moore
+ */
+int SpmSimdAvailable(void)
+{
+#ifdef SC_CPU_DISPATCH
+    return UtilCpuHasFeature(CPU_FEATURE_SSE2);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief select the search kernel of the simd spm
+ */
+void SpmSimdDispatchSetup(void)
+{
+#ifdef SC_CPU_DISPATCH
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2)) {
+        SpmSimdSearch = SpmSimdSearchAVX2;
+        UtilCpuDispatchRegister("spm", "avx2");
+    } else if (UtilCpuHasFeature(CPU_FEATURE_SSE2)) {
+        SpmSimdSearch = SpmSimdSearchSSE2;
+        UtilCpuDispatchRegister("spm", "sse2");
+    } else {
+        SpmSimdSearch = SpmSimdSearchScalar;
+        UtilCpuDispatchRegister("spm", "scalar");
+    }
+#else
+    UtilCpuDispatchRegister("spm", "scalar");
+#endif
+}
+
+static void SimdDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    SpmSimdCtx *sctx = ctx->ctx;
+    if (sctx != NULL) {
+        if (sctx->needle != NULL) {
+            SCFree(sctx->needle);
+        }
+        SCFree(sctx);
+    }
+    SCFree(ctx);
+}
+
+static SpmCtx *SimdInitCtx(const uint8_t *needle, uint16_t needle_len,
+                           int nocase, SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmCtx *ctx = SCCalloc(1, sizeof(SpmCtx));
+    if (ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmCtx.");
+        return NULL;
+    }
+    ctx->matcher = SPM_SIMD;
+
+    SpmSimdCtx *sctx = SCCalloc(1, sizeof(SpmSimdCtx));
+    if (sctx == NULL) {
+        SCLogDebug("Unable to alloc SpmSimdCtx.");
+        SCFree(ctx);
+        return NULL;
+    }
+    ctx->ctx = sctx;
+
+    /* never zero, so the edge bytes below exist */
+    sctx->needle = SCMalloc(needle_len ? needle_len : 1);
+    if (sctx->needle == NULL) {
+        SCLogDebug("Unable to alloc string.");
+        SimdDestroyCtx(ctx);
+        return NULL;
+    }
+    sctx->needle_len = needle_len;
+    sctx->nocase = nocase ? 1 : 0;
+    if (needle_len == 0) {
+        return ctx;
+    }
+
+    if (nocase) {
+        memcpy_tolower(sctx->needle, needle, needle_len);
+    } else {
+        memcpy(sctx->needle, needle, needle_len);
+    }
+    sctx->first = sctx->needle[0];
+    sctx->last = sctx->needle[needle_len - 1];
+    sctx->first_alt = nocase ? (uint8_t)toupper(sctx->first) : sctx->first;
+    sctx->last_alt = nocase ? (uint8_t)toupper(sctx->last) : sctx->last;
+
+    return ctx;
+}
+
+static uint8_t *SimdScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                         const uint8_t *haystack, uint32_t haystack_len)
+{
+    const SpmSimdCtx *sctx = ctx->ctx;
+
+    if (unlikely(sctx->needle_len == 0 || sctx->needle_len > haystack_len)) {
+        return NULL;
+    }
+    return SpmSimdSearch(sctx, haystack, haystack_len);
+}
+
+static SpmGlobalThreadCtx *SimdInitGlobalThreadCtx(void)
+{
+    SpmGlobalThreadCtx *global_thread_ctx = SCCalloc(1, sizeof(SpmGlobalThreadCtx));
+    if (global_thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmGlobalThreadCtx.");
+        return NULL;
+    }
+    global_thread_ctx->matcher = SPM_SIMD;
+    return global_thread_ctx;
+}
+
+static void SimdDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (global_thread_ctx == NULL) {
+        return;
+    }
+    SCFree(global_thread_ctx);
+}
+
+static void SimdDestroyThreadCtx(SpmThreadCtx *thread_ctx)
+{
+    if (thread_ctx == NULL) {
+        return;
+    }
+    SCFree(thread_ctx);
+}
+
+static SpmThreadCtx *SimdMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmThreadCtx *thread_ctx = SCCalloc(1, sizeof(SpmThreadCtx));
+    if (thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    thread_ctx->matcher = SPM_SIMD;
+    return thread_ctx;
+}
+
+void SpmSimdRegister(void)
+{
+    spm_table[SPM_SIMD].name = "simd";
+    spm_table[SPM_SIMD].InitGlobalThreadCtx = SimdInitGlobalThreadCtx;
+    spm_table[SPM_SIMD].DestroyGlobalThreadCtx = SimdDestroyGlobalThreadCtx;
+    spm_table[SPM_SIMD].MakeThreadCtx = SimdMakeThreadCtx;
+    spm_table[SPM_SIMD].DestroyThreadCtx = SimdDestroyThreadCtx;
+    spm_table[SPM_SIMD].InitCtx = SimdInitCtx;
+    spm_table[SPM_SIMD].DestroyCtx = SimdDestroyCtx;
+    spm_table[SPM_SIMD].Scan = SimdScan;
+}
+
+#ifdef UNITTESTS
+
+/**
+ * \internal
+ * \brief naive reference search
+ */
+static const uint8_t *SpmSimdTestRef(const uint8_t *needle, uint16_t needle_len,
+        int nocase, const uint8_t *haystack, uint32_t haystack_len)
+{
+    for (uint32_t i = 0; i + needle_len <= haystack_len; i++) {
+        uint16_t j;
+        for (j = 0; j < needle_len; j++) {
+            uint8_t a = needle[j], b = haystack[i + j];
+            if (nocase) {
+                a = u8_tolower(a);
+                b = u8_tolower(b);
+            }
+            if (a != b)
+                break;
+        }
+        if (j == needle_len)
+            return haystack + i;
+    }
+    return NULL;
+}
+
+static uint32_t SpmSimdTestRand(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+/**
+ * \test every kernel this cpu supports finds the same first match as a
+ *       naive search, for needles and matches at all alignments and a
+ *       small alphabet so partial matches are common.
+ */
+static int SpmSimdTest01(void)
+{
+    static const char alphabet[] = "aAbB:\xff";
+    SpmSimdSearchFunc funcs[3];
+    int funcs_cnt = 0;
+    uint8_t haystack[200];
+    uint8_t needle[40];
+    uint32_t seed = 1;
+
+    funcs[funcs_cnt++] = SpmSimdSearchScalar;
+#ifdef SC_CPU_DISPATCH
+    if (UtilCpuHasFeature(CPU_FEATURE_SSE2))
+        funcs[funcs_cnt++] = SpmSimdSearchSSE2;
+    if (UtilCpuHasFeature(CPU_FEATURE_AVX2))
+        funcs[funcs_cnt++] = SpmSimdSearchAVX2;
+#endif
+
+    for (int round = 0; round < 2000; round++) {
+        const uint32_t haystack_len = 1 + SpmSimdTestRand(&seed) % sizeof(haystack);
+        const uint16_t needle_len = 1 + SpmSimdTestRand(&seed) % sizeof(needle);
+        const int nocase = SpmSimdTestRand(&seed) & 1;
+
+        for (uint32_t i = 0; i < haystack_len; i++)
+            haystack[i] = alphabet[SpmSimdTestRand(&seed) % (sizeof(alphabet) - 1)];
+        for (uint16_t i = 0; i < needle_len; i++)
+            needle[i] = alphabet[SpmSimdTestRand(&seed) % 4];
+        /* plant the needle, case flipped, in most rounds */
+        if (needle_len <= haystack_len && (round % 4) != 0) {
+            uint32_t at = SpmSimdTestRand(&seed) % (haystack_len - needle_len + 1);
+            for (uint16_t i = 0; i < needle_len; i++)
+                haystack[at + i] = nocase ? (uint8_t)toupper(needle[i]) : needle[i];
+        }
+
+        SpmCtx *ctx = SimdInitCtx(needle, needle_len, nocase, NULL);
+        FAIL_IF_NULL(ctx);
+        const SpmSimdCtx *sctx = ctx->ctx;
+
+        const uint8_t *ref = SpmSimdTestRef(needle, needle_len, nocase,
+                haystack, haystack_len);
+        for (int f = 0; f < funcs_cnt; f++) {
+            const uint8_t *found = needle_len > haystack_len ? NULL :
+                funcs[f](sctx, haystack, haystack_len);
+            FAIL_IF(found != ref);
+        }
+        SimdDestroyCtx(ctx);
+    }
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SpmSimdRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SpmSimdTest01", SpmSimdTest01);
+#endif
+}
@@ -54,6 +54,7 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-spm-hs.h"
+#include "util-spm-simd.h"
 #include "util-clock.h"
 #ifdef BUILD_HYPERSCAN
 #include "hs.h"
@@ -98,8 +99,8 @@ default_matcher:
         if (hs_valid_platform() != HS_SUCCESS) {
             SCLogInfo("SSSE3 support not detected, disabling Hyperscan for "
                       "SPM");
-            /* Use Boyer-Moore as fallback. */
-            return SPM_BM;
+            /* Use the SIMD matcher or Boyer-Moore as fallback. */
+            return SpmSimdAvailable() ? SPM_SIMD : SPM_BM;
         } else {
             return SPM_HS;
         }
@@ -107,8 +108,9 @@ default_matcher:
         return SPM_HS;
     #endif
 #else
-    /* Otherwise, default to Boyer-Moore */
-    return SPM_BM;
+    /* Otherwise, default to the SIMD matcher if the cpu has vector
+     * support, or Boyer-Moore */
+    return SpmSimdAvailable() ? SPM_SIMD : SPM_BM;
 #endif
 }
 
@@ -117,6 +119,7 @@ void SpmTableSetup(void)
     memset(spm_table, 0, sizeof(spm_table));
 
     SpmBMRegister();
+    SpmSimdRegister();
 #ifdef BUILD_HYPERSCAN
     #ifdef HAVE_HS_VALID_PLATFORM
         if (hs_valid_platform() == HS_SUCCESS) {
@@ -2706,6 +2709,7 @@ void UtilSpmSearchRegistertests(void)
     /* new SPM API */
     UtRegisterTest("SpmSearchTest01", SpmSearchTest01);
     UtRegisterTest("SpmSearchTest02", SpmSearchTest02);
+    SpmSimdRegisterTests();
 
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */
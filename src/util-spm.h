@@ -31,6 +31,7 @@
 enum {
     SPM_BM, /* Boyer-Moore */
     SPM_HS, /* Hyperscan */
+    SPM_SIMD, /* first/last byte SIMD filter */
     /* Other SPM matchers will go here. */
     SPM_TABLE_SIZE
 };